@@ -389,6 +389,18 @@ __BEGIN_CDECLS
     ISB; \
 })
 
+// Versions of the above which don't wait for the invalidation to take effect,
+// for issuing a batch of them; follow the batch with "dsb ish" and ISB.
+#define ARM64_TLBI_NOADDR_NOSYNC(op) \
+({ \
+    __asm__ volatile("tlbi " #op::: "memory"); \
+})
+
+#define ARM64_TLBI_NOSYNC(op, val) \
+({ \
+    __asm__ volatile("tlbi " #op ", %0" :: "r" ((uint64_t)(val)) : "memory"); \
+})
+
 #define MMU_ARM64_GLOBAL_ASID (~0U)
 #define MMU_ARM64_USER_ASID (0U)
 
@@ -14,6 +14,8 @@
 #include <zircon/compiler.h>
 #include <zircon/types.h>
 
+struct PendingTlbInvalidation;
+
 class ArmArchVmAspace final : public ArchVmAspaceInterface {
 public:
     ArmArchVmAspace();
@@ -33,12 +35,17 @@ public:
 
     zx_status_t Query(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags) override;
 
+    bool HasMappings(vaddr_t vaddr, size_t count) override;
+
     vaddr_t PickSpot(vaddr_t base, uint prev_region_mmu_flags,
                      vaddr_t end, uint next_region_mmu_flags,
                      vaddr_t align, size_t size, uint mmu_flags) override;
 
     paddr_t arch_table_phys() const override { return tt_phys_; }
 
+    // Number of batched TLB invalidation rounds issued for this aspace.
+    size_t tlb_shootdowns() const { return tlb_shootdowns_; }
+
     static void ContextSwitch(ArmArchVmAspace* from, ArmArchVmAspace* to);
 
 private:
@@ -59,15 +66,25 @@ private:
     ssize_t MapPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
                          paddr_t paddr_in, size_t size_in, pte_t attrs,
                          uint index_shift, uint page_size_shift,
-                         volatile pte_t* page_table, uint asid) TA_REQ(lock_);
+                         volatile pte_t* page_table, uint asid,
+                         PendingTlbInvalidation* pending) TA_REQ(lock_);
+
+    zx_status_t SplitLargePage(vaddr_t vaddr, uint index_shift, uint page_size_shift,
+                               vaddr_t index, volatile pte_t* page_table, uint asid,
+                               PendingTlbInvalidation* pending) TA_REQ(lock_);
 
     ssize_t UnmapPageTable(vaddr_t vaddr, vaddr_t vaddr_rel, size_t size,
                            uint index_shift, uint page_size_shift,
-                           volatile pte_t* page_table, uint asid) TA_REQ(lock_);
+                           volatile pte_t* page_table, uint asid,
+                           PendingTlbInvalidation* pending) TA_REQ(lock_);
 
     int ProtectPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in, size_t size_in,
                          pte_t attrs, uint index_shift, uint page_size_shift,
-                         volatile pte_t* page_table, uint asid) TA_REQ(lock_);
+                         volatile pte_t* page_table, uint asid,
+                         PendingTlbInvalidation* pending) TA_REQ(lock_);
+
+    // Issue the batched invalidations and free any page tables waiting on them.
+    void TlbInvalidate(PendingTlbInvalidation* pending, uint asid) TA_REQ(lock_);
 
     ssize_t MapPages(vaddr_t vaddr, paddr_t paddr, size_t size, pte_t attrs,
                      vaddr_t vaddr_base, uint top_size_shift, uint top_index_shift,
@@ -98,6 +115,9 @@ private:
     // table.
     size_t pt_pages_ = 0;
 
+    // Counter of TLB invalidation rounds, see tlb_shootdowns().
+    size_t tlb_shootdowns_ = 0;
+
     uint flags_ = 0;
 
     // Range of address space.
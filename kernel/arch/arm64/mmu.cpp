@@ -36,6 +36,62 @@ static_assert(((long)KERNEL_ASPACE_BASE >> MMU_KERNEL_SIZE_SHIFT) == -1, "");
 static_assert(MMU_KERNEL_SIZE_SHIFT <= 48, "");
 static_assert(MMU_KERNEL_SIZE_SHIFT >= 25, "");
 
+// A batch of TLB invalidations for a single Map/Unmap/Protect operation.
+//
+// Addresses are collected while the page tables are walked and the TLBIs are
+// issued together once the walk is done, behind a single barrier.  Past
+// kMaxPages entries it is cheaper to drop the whole ASID (or VMID, or the
+// whole kernel TLB) than to broadcast one TLBI per page.
+//
+// Page tables unlinked by the operation are parked here as well and only
+// freed after the invalidation has completed, since other cores may keep
+// walking them through their walk caches until then.
+struct PendingTlbInvalidation {
+    struct FreedPageTable {
+        void* vaddr;
+        paddr_t paddr;
+        uint page_size_shift;
+    };
+
+    static constexpr uint kMaxPages = 32;
+    static constexpr uint kMaxFreedPageTables = 16;
+
+    PendingTlbInvalidation() = default;
+
+    ~PendingTlbInvalidation() {
+        DEBUG_ASSERT(empty());
+        DEBUG_ASSERT(freed_count == 0);
+    }
+
+    void enqueue(vaddr_t vaddr) {
+        if (count == kMaxPages) {
+            full_shootdown = true;
+        }
+        if (full_shootdown) {
+            return;
+        }
+        item[count++] = vaddr;
+    }
+
+    bool empty() const {
+        return count == 0 && !full_shootdown;
+    }
+
+    void clear() {
+        count = 0;
+        full_shootdown = false;
+    }
+
+    vaddr_t item[kMaxPages];
+    uint count = 0;
+    bool full_shootdown = false;
+
+    FreedPageTable freed[kMaxFreedPageTables];
+    uint freed_count = 0;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PendingTlbInvalidation);
+};
+
 static uint64_t asid_pool[(1 << MMU_ARM64_ASID_BITS) / 64];
 static mutex_t asid_lock = MUTEX_INITIAL_VALUE(asid_lock);
 
@@ -56,9 +112,9 @@ static zx_status_t arm64_mmu_alloc_asid(uint16_t* asid) {
             mutex_release(&asid_lock);
             return ZX_ERR_NO_MEMORY;
         }
-    } while ((asid_pool[new_asid >> 6] & (1 << (new_asid % 64))) || (new_asid == 0));
+    } while ((asid_pool[new_asid >> 6] & (1UL << (new_asid % 64))) || (new_asid == 0));
 
-    asid_pool[new_asid >> 6] = asid_pool[new_asid >> 6] | (1 << (new_asid % 64));
+    asid_pool[new_asid >> 6] = asid_pool[new_asid >> 6] | (1UL << (new_asid % 64));
 
     mutex_release(&asid_lock);
 
@@ -71,7 +127,7 @@ static zx_status_t arm64_mmu_free_asid(uint16_t asid) {
 
     mutex_acquire(&asid_lock);
 
-    asid_pool[asid >> 6] = asid_pool[asid >> 6] & ~(1 << (asid % 64));
+    asid_pool[asid >> 6] = asid_pool[asid >> 6] & ~(1UL << (asid % 64));
 
     mutex_release(&asid_lock);
 
@@ -258,6 +314,69 @@ zx_status_t ArmArchVmAspace::Query(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flag
     return 0;
 }
 
+bool ArmArchVmAspace::HasMappings(vaddr_t vaddr, size_t count) {
+    canary_.Assert();
+    LTRACEF("aspace %p, vaddr 0x%lx, count %zu\n", this, vaddr, count);
+
+    DEBUG_ASSERT(tt_virt_);
+
+    if (!IsValidVaddr(vaddr))
+        return false;
+
+    vaddr_t vaddr_base;
+    uint top_index_shift;
+    uint page_size_shift;
+    if (flags_ & ARCH_ASPACE_FLAG_KERNEL) {
+        vaddr_base = ~0UL << MMU_KERNEL_SIZE_SHIFT;
+        top_index_shift = MMU_KERNEL_TOP_SHIFT;
+        page_size_shift = MMU_KERNEL_PAGE_SIZE_SHIFT;
+    } else if (flags_ & ARCH_ASPACE_FLAG_GUEST) {
+        vaddr_base = 0;
+        top_index_shift = MMU_GUEST_TOP_SHIFT;
+        page_size_shift = MMU_GUEST_PAGE_SIZE_SHIFT;
+    } else {
+        vaddr_base = 0;
+        top_index_shift = MMU_USER_TOP_SHIFT;
+        page_size_shift = MMU_USER_PAGE_SIZE_SHIFT;
+    }
+
+    fbl::AutoLock a(&lock_);
+
+    size_t size = count * PAGE_SIZE;
+    while (size > 0) {
+        // walk down to the entry covering vaddr, as Query() does
+        vaddr_t vaddr_rem = vaddr - vaddr_base;
+        uint index_shift = top_index_shift;
+        volatile pte_t* page_table = tt_virt_;
+        while (true) {
+            vaddr_t index = vaddr_rem >> index_shift;
+            vaddr_rem -= index << index_shift;
+            pte_t pte = page_table[index];
+            uint descriptor_type = pte & MMU_PTE_DESCRIPTOR_MASK;
+
+            if (descriptor_type == MMU_PTE_DESCRIPTOR_INVALID)
+                break;
+            if (index_shift <= page_size_shift ||
+                descriptor_type != MMU_PTE_L012_DESCRIPTOR_TABLE) {
+                return true;
+            }
+
+            page_table = static_cast<volatile pte_t*>(
+                paddr_to_physmap(pte & MMU_PTE_OUTPUT_ADDR_MASK));
+            index_shift -= page_size_shift - 3;
+        }
+
+        // nothing is mapped in the rest of the range covered by the invalid
+        // entry the walk stopped at
+        size_t skip = (1UL << index_shift) - vaddr_rem;
+        if (skip >= size)
+            break;
+        vaddr += skip;
+        size -= skip;
+    }
+    return false;
+}
+
 zx_status_t ArmArchVmAspace::AllocPageTable(paddr_t* paddrp, uint page_size_shift) {
     size_t size = 1UL << page_size_shift;
 
@@ -375,10 +494,107 @@ static bool page_table_is_clear(volatile pte_t* page_table, uint page_size_shift
     return true;
 }
 
+void ArmArchVmAspace::TlbInvalidate(PendingTlbInvalidation* pending, uint asid) {
+    if (!pending->empty()) {
+        // Make the page table updates visible to the table walkers before
+        // invalidating anything they may have cached.
+        __asm__ volatile("dsb ishst" ::: "memory");
+
+        if (flags_ & ARCH_ASPACE_FLAG_GUEST) {
+            paddr_t vttbr = arm64_vttbr(asid_, tt_phys_);
+            if (pending->full_shootdown) {
+                __UNUSED zx_status_t status = arm64_el2_tlbi_vmid(vttbr);
+                DEBUG_ASSERT(status == ZX_OK);
+            } else {
+                for (uint i = 0; i < pending->count; i++) {
+                    __UNUSED zx_status_t status =
+                        arm64_el2_tlbi_ipa(vttbr, pending->item[i] >> 12);
+                    DEBUG_ASSERT(status == ZX_OK);
+                }
+            }
+        } else if (asid == MMU_ARM64_GLOBAL_ASID) {
+            if (pending->full_shootdown) {
+                ARM64_TLBI_NOADDR_NOSYNC(vmalle1is);
+            } else {
+                for (uint i = 0; i < pending->count; i++) {
+                    ARM64_TLBI_NOSYNC(vaae1is, pending->item[i] >> 12);
+                }
+            }
+        } else {
+            if (pending->full_shootdown) {
+                ARM64_TLBI_NOSYNC(aside1is, (vaddr_t)asid << 48);
+            } else {
+                for (uint i = 0; i < pending->count; i++) {
+                    ARM64_TLBI_NOSYNC(vae1is, pending->item[i] >> 12 | (vaddr_t)asid << 48);
+                }
+            }
+        }
+        // Wait for all of the invalidations to complete, on every cpu, before
+        // anything depends on the old entries being gone.
+        __asm__ volatile("dsb ish" ::: "memory");
+        ISB;
+
+        pending->clear();
+        tlb_shootdowns_++;
+    }
+
+    for (uint i = 0; i < pending->freed_count; i++) {
+        const PendingTlbInvalidation::FreedPageTable& pt = pending->freed[i];
+        FreePageTable(pt.vaddr, pt.paddr, pt.page_size_shift);
+    }
+    pending->freed_count = 0;
+}
+
+// Replace the block mapping at page_table[index], which covers vaddr, with a
+// table of next level entries mapping the same memory with the same
+// attributes, so that part of it can be unmapped or reprotected.
+zx_status_t ArmArchVmAspace::SplitLargePage(vaddr_t vaddr, uint index_shift,
+                                            uint page_size_shift, vaddr_t index,
+                                            volatile pte_t* page_table, uint asid,
+                                            PendingTlbInvalidation* pending) {
+    pte_t pte = page_table[index];
+    DEBUG_ASSERT(index_shift > page_size_shift);
+    DEBUG_ASSERT((pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK);
+
+    paddr_t page_table_paddr;
+    zx_status_t ret = AllocPageTable(&page_table_paddr, page_size_shift);
+    if (ret) {
+        TRACEF("failed to allocate page table\n");
+        return ret;
+    }
+    volatile pte_t* next_page_table =
+        static_cast<volatile pte_t*>(paddr_to_physmap(page_table_paddr));
+
+    uint next_shift = index_shift - (page_size_shift - 3);
+    pte_t attrs = pte & ~(MMU_PTE_OUTPUT_ADDR_MASK | MMU_PTE_DESCRIPTOR_MASK);
+    attrs |= (next_shift > page_size_shift) ? MMU_PTE_L012_DESCRIPTOR_BLOCK
+                                            : MMU_PTE_L3_DESCRIPTOR_PAGE;
+    paddr_t paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
+    size_t count = 1UL << (page_size_shift - 3);
+    for (size_t i = 0; i < count; i++) {
+        next_page_table[i] = (paddr + (i << next_shift)) | attrs;
+    }
+
+    LTRACEF("splitting pte %p[%#" PRIxPTR "] = %#" PRIx64 " into table %#" PRIxPTR "\n",
+            page_table, index, pte, page_table_paddr);
+
+    // Changing the size of a mapping requires break-before-make: the block
+    // entry has to be invalidated everywhere before the table goes in.
+    page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
+    pending->enqueue(vaddr);
+    TlbInvalidate(pending, asid);
+
+    page_table[index] = page_table_paddr | MMU_PTE_L012_DESCRIPTOR_TABLE;
+    __asm__ volatile("dmb ishst" ::: "memory");
+
+    return ZX_OK;
+}
+
 ssize_t ArmArchVmAspace::UnmapPageTable(vaddr_t vaddr, vaddr_t vaddr_rel,
                                         size_t size, uint index_shift,
                                         uint page_size_shift,
-                                        volatile pte_t* page_table, uint asid) {
+                                        volatile pte_t* page_table, uint asid,
+                                        PendingTlbInvalidation* pending) {
     volatile pte_t* next_page_table;
     vaddr_t index;
     size_t chunk_size;
@@ -402,34 +618,50 @@ ssize_t ArmArchVmAspace::UnmapPageTable(vaddr_t vaddr, vaddr_t vaddr_rel,
 
         pte = page_table[index];
 
+        // Only part of a block is being unmapped, split it up.  If that
+        // fails, leave the block mapped rather than unmapping more than was
+        // asked for.
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            zx_status_t status = SplitLargePage(vaddr, index_shift, page_size_shift, index,
+                                                page_table, asid, pending);
+            if (status != ZX_OK) {
+                return status;
+            }
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
             next_page_table = static_cast<volatile pte_t*>(paddr_to_physmap(page_table_paddr));
-            UnmapPageTable(vaddr, vaddr_rem, chunk_size,
-                           index_shift - (page_size_shift - 3),
-                           page_size_shift, next_page_table, asid);
+            ssize_t ret = UnmapPageTable(vaddr, vaddr_rem, chunk_size,
+                                         index_shift - (page_size_shift - 3),
+                                         page_size_shift, next_page_table, asid, pending);
+            if (ret < 0) {
+                return ret;
+            }
             if (chunk_size == block_size ||
                 page_table_is_clear(next_page_table, page_size_shift)) {
                 LTRACEF("pte %p[0x%lx] = 0 (was page table)\n", page_table, index);
                 page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
                 __asm__ volatile("dmb ishst" ::: "memory");
-                FreePageTable(const_cast<pte_t*>(next_page_table), page_table_paddr,
-                              page_size_shift);
+
+                // A by-VA invalidate also drops the walk cache entries for
+                // the levels above it, which covers the unlinked table.
+                pending->enqueue(vaddr);
+                if (pending->freed_count == PendingTlbInvalidation::kMaxFreedPageTables) {
+                    TlbInvalidate(pending, asid);
+                }
+                pending->freed[pending->freed_count++] = {
+                    const_cast<pte_t*>(next_page_table), page_table_paddr, page_size_shift
+                };
             }
         } else if (pte) {
             LTRACEF("pte %p[0x%lx] = 0\n", page_table, index);
             page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
             fbl::atomic_signal_fence();
-            if (flags_ & ARCH_ASPACE_FLAG_GUEST) {
-                paddr_t vttbr = arm64_vttbr(asid_, tt_phys_);
-                __UNUSED zx_status_t status = arm64_el2_tlbi_ipa(vttbr, vaddr >> 12);
-                DEBUG_ASSERT(status == ZX_OK);
-            } else if (asid == MMU_ARM64_GLOBAL_ASID) {
-                ARM64_TLBI(vaae1is, vaddr >> 12);
-            } else {
-                ARM64_TLBI(vae1is, vaddr >> 12 | (vaddr_t)asid << 48);
-            }
+            pending->enqueue(vaddr);
         } else {
             LTRACEF("pte %p[0x%lx] already clear\n", page_table, index);
         }
@@ -446,7 +678,8 @@ ssize_t ArmArchVmAspace::MapPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
                                       paddr_t paddr_in, size_t size_in,
                                       pte_t attrs, uint index_shift,
                                       uint page_size_shift,
-                                      volatile pte_t* page_table, uint asid) {
+                                      volatile pte_t* page_table, uint asid,
+                                      PendingTlbInvalidation* pending) {
     ssize_t ret;
     volatile pte_t* next_page_table;
     vaddr_t index;
@@ -489,14 +722,22 @@ ssize_t ArmArchVmAspace::MapPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
 
             ret = MapPageTable(vaddr, vaddr_rem, paddr, chunk_size, attrs,
                                index_shift - (page_size_shift - 3),
-                               page_size_shift, next_page_table, asid);
+                               page_size_shift, next_page_table, asid, pending);
             if (ret < 0)
                 goto err;
         } else {
             pte = page_table[index];
             if (pte) {
-                TRACEF("page table entry already in use, index %#" PRIxPTR ", %#" PRIx64 "\n",
-                       index, pte);
+                // Large pages are mapped opportunistically on fault, and the
+                // caller falls back to small pages when part of the range is
+                // already mapped, so only a clash between pages is unexpected.
+                if (index_shift > page_size_shift) {
+                    LTRACEF("block entry already in use, index %#" PRIxPTR ", %#" PRIx64 "\n",
+                            index, pte);
+                } else {
+                    TRACEF("page table entry already in use, index %#" PRIxPTR ", %#" PRIx64 "\n",
+                           index, pte);
+                }
                 goto err;
             }
 
@@ -522,15 +763,15 @@ ssize_t ArmArchVmAspace::MapPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
 
 err:
     UnmapPageTable(vaddr_in, vaddr_rel_in, size_in - size, index_shift,
-                   page_size_shift, page_table, asid);
-    DSB;
+                   page_size_shift, page_table, asid, pending);
     return ZX_ERR_INTERNAL;
 }
 
 int ArmArchVmAspace::ProtectPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
                                       size_t size_in, pte_t attrs,
                                       uint index_shift, uint page_size_shift,
-                                      volatile pte_t* page_table, uint asid) {
+                                      volatile pte_t* page_table, uint asid,
+                                      PendingTlbInvalidation* pending) {
     int ret;
     volatile pte_t* next_page_table;
     vaddr_t index;
@@ -563,13 +804,24 @@ int ArmArchVmAspace::ProtectPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
         index = vaddr_rel >> index_shift;
         pte = page_table[index];
 
+        // Only part of a block is being reprotected, split it up.
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            ret = SplitLargePage(vaddr, index_shift, page_size_shift, index, page_table,
+                                 asid, pending);
+            if (ret != 0) {
+                goto err;
+            }
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
             next_page_table = static_cast<volatile pte_t*>(paddr_to_physmap(page_table_paddr));
             ret = ProtectPageTable(vaddr, vaddr_rem, chunk_size, attrs,
                                    index_shift - (page_size_shift - 3),
-                                   page_size_shift, next_page_table, asid);
+                                   page_size_shift, next_page_table, asid, pending);
             if (ret != 0) {
                 goto err;
             }
@@ -580,15 +832,7 @@ int ArmArchVmAspace::ProtectPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
             page_table[index] = pte;
 
             fbl::atomic_signal_fence();
-            if (flags_ & ARCH_ASPACE_FLAG_GUEST) {
-                paddr_t vttbr = arm64_vttbr(asid_, tt_phys_);
-                __UNUSED zx_status_t status = arm64_el2_tlbi_ipa(vttbr, vaddr >> 12);
-                DEBUG_ASSERT(status == ZX_OK);
-            } else if (asid == MMU_ARM64_GLOBAL_ASID) {
-                ARM64_TLBI(vaae1is, vaddr >> 12);
-            } else {
-                ARM64_TLBI(vae1is, vaddr >> 12 | (vaddr_t)asid << 48);
-            }
+            pending->enqueue(vaddr);
         } else {
             LTRACEF("page table entry does not exist, index %#" PRIxPTR
                     ", %#" PRIx64 "\n",
@@ -599,14 +843,12 @@ int ArmArchVmAspace::ProtectPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
         size -= chunk_size;
     }
 
-    DSB;
     return 0;
 
 err:
     // TODO: Unroll any changes we've made, though in practice if we've reached
     // here there's a programming bug since the higher level region abstraction
     // should guard against us trying to change permissions on an umapped page
-    DSB;
     return ZX_ERR_INTERNAL;
 }
 
@@ -632,9 +874,11 @@ ssize_t ArmArchVmAspace::MapPages(vaddr_t vaddr, paddr_t paddr, size_t size,
         return ZX_ERR_INVALID_ARGS;
     }
 
+    PendingTlbInvalidation pending;
     ssize_t ret = MapPageTable(vaddr, vaddr_rel, paddr, size, attrs,
                                top_index_shift, page_size_shift, top_page_table,
-                               asid);
+                               asid, &pending);
+    TlbInvalidate(&pending, asid);
     DSB;
     return ret;
 }
@@ -662,8 +906,10 @@ ssize_t ArmArchVmAspace::UnmapPages(vaddr_t vaddr, size_t size,
         return ZX_ERR_INVALID_ARGS;
     }
 
+    PendingTlbInvalidation pending;
     ssize_t ret = UnmapPageTable(vaddr, vaddr_rel, size, top_index_shift,
-                                 page_size_shift, top_page_table, asid);
+                                 page_size_shift, top_page_table, asid, &pending);
+    TlbInvalidate(&pending, asid);
     DSB;
     return ret;
 }
@@ -690,9 +936,11 @@ zx_status_t ArmArchVmAspace::ProtectPages(vaddr_t vaddr, size_t size, pte_t attr
         return ZX_ERR_INVALID_ARGS;
     }
 
+    PendingTlbInvalidation pending;
     zx_status_t ret = ProtectPageTable(vaddr, vaddr_rel, size, attrs,
                                        top_index_shift, page_size_shift,
-                                       top_page_table, asid);
+                                       top_page_table, asid, &pending);
+    TlbInvalidate(&pending, asid);
     DSB;
     return ret;
 }
@@ -910,7 +1158,10 @@ zx_status_t ArmArchVmAspace::Destroy() {
         __UNUSED zx_status_t status = arm64_el2_tlbi_vmid(vttbr);
         DEBUG_ASSERT(status == ZX_OK);
     } else {
-        ARM64_TLBI(ASIDE1IS, asid_);
+        // Drop everything tagged with the ASID before it can be handed out
+        // to another aspace.  The ASID lives in bits 63:48 of the operand.
+        ARM64_TLBI(ASIDE1IS, (uint64_t)asid_ << 48);
+        DSB;
         arm64_mmu_free_asid(asid_);
         asid_ = 0;
     }
@@ -956,6 +1207,11 @@ void arch_zero_page(void* _ptr) {
     } while (ptr != end_ptr);
 }
 
+// dc zva already zeroes without reading the lines in, so there's nothing more to do
+void arch_zero_page_nontemporal(void* ptr) {
+    arch_zero_page(ptr);
+}
+
 ArmArchVmAspace::ArmArchVmAspace() {}
 
 ArmArchVmAspace::~ArmArchVmAspace() {
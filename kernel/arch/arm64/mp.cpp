@@ -95,6 +95,20 @@ void arch_mp_init_percpu(void) {
     interrupt_init_percpu();
 }
 
+cpu_mask_t arch_mp_cache_sibling_mask(cpu_num_t cpu) {
+    DEBUG_ASSERT(cpu < arm_num_cpus);
+
+    // cpus within a cluster share the last level cache
+    cpu_mask_t mask = 0;
+    for (cpu_num_t i = 0; i < arm_num_cpus; i++) {
+        if (arm64_cpu_cluster_ids[i] == arm64_cpu_cluster_ids[cpu]) {
+            mask |= cpu_num_to_mask(i);
+        }
+    }
+
+    return mask | cpu_num_to_mask(cpu);
+}
+
 void arch_flush_state_and_halt(event_t *flush_done) {
     PANIC_UNIMPLEMENTED;
 }
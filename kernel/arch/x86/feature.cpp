@@ -222,6 +222,8 @@ void x86_feature_debug(void)
         { X86_FEATURE_TSC_ADJUST, "tsc_adj" },
         { X86_FEATURE_SMEP, "smep" },
         { X86_FEATURE_SMAP, "smap" },
+        { X86_FEATURE_PCID, "pcid" },
+        { X86_FEATURE_INVPCID, "invpcid" },
         { X86_FEATURE_ERMS, "erms" },
         { X86_FEATURE_RDRAND, "rdrand" },
         { X86_FEATURE_RDSEED, "rdseed" },
@@ -17,11 +17,13 @@
 #include <zircon/types.h>
 
 struct MappingCursor;
+struct PendingTlbInvalidation;
 
 class X86ArchVmAspace final : public ArchVmAspaceInterface {
 public:
     template <typename PageTable>
-    static void UnmapEntry(X86ArchVmAspace* aspace, vaddr_t vaddr, volatile pt_entry_t* pte);
+    static void UnmapEntry(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                           volatile pt_entry_t* pte);
 
     X86ArchVmAspace();
     virtual ~X86ArchVmAspace();
@@ -40,6 +42,8 @@ public:
 
     zx_status_t Query(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags) override;
 
+    bool HasMappings(vaddr_t vaddr, size_t count) override;
+
     vaddr_t PickSpot(vaddr_t base, uint prev_region_mmu_flags,
                      vaddr_t end, uint next_region_mmu_flags,
                      vaddr_t align, size_t size, uint mmu_flags) override;
@@ -52,6 +56,21 @@ public:
 
     int active_cpus() { return active_cpus_.load(); }
 
+    // Number of TLB shootdown rounds issued on behalf of this aspace.
+    size_t tlb_shootdowns() const { return tlb_shootdowns_; }
+
+    // Process-context identifier tagging this aspace's TLB entries, or 0 if
+    // it has none and its entries are dropped on every switch away.
+    uint16_t pcid() const { return pcid_; }
+
+    // Record that every CPU may hold stale TLB entries for this aspace's
+    // pcid, which they must drop the next time they switch to it.
+    void MarkPcidStale() { pcid_stale_cpus_.store(-1); }
+
+    // Record that the calling CPU's TLB entries for this aspace's pcid are
+    // up to date.  Must be called with interrupts disabled.
+    void ClearPcidStale(int cpu_bit) { pcid_stale_cpus_.fetch_and(~cpu_bit); }
+
     IoBitmap& io_bitmap() { return io_bitmap_; }
 
     static void ContextSwitch(X86ArchVmAspace* from, X86ArchVmAspace* to);
@@ -79,34 +98,43 @@ private:
     zx_status_t QueryVaddr(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags,
                            F arch_to_mmu) TA_REQ(lock_);
 
+    template <template <int> class PageTable>
+    bool HasMappingsInternal(vaddr_t vaddr, size_t size) TA_REQ(lock_);
+
     template <typename PageTable>
     zx_status_t AddMapping(volatile pt_entry_t* table, uint mmu_flags,
                            const MappingCursor& start_cursor,
-                           MappingCursor* new_cursor) TA_REQ(lock_);
+                           MappingCursor* new_cursor,
+                           PendingTlbInvalidation* pending) TA_REQ(lock_);
 
     template <typename PageTable>
     zx_status_t AddMappingL0(volatile pt_entry_t* table, uint mmu_flags,
                              const MappingCursor& start_cursor,
-                             MappingCursor* new_cursor) TA_REQ(lock_);
+                             MappingCursor* new_cursor,
+                             PendingTlbInvalidation* pending) TA_REQ(lock_);
 
     template <typename PageTable>
     bool RemoveMapping(volatile pt_entry_t* table,
                        const MappingCursor& start_cursor,
-                       MappingCursor* new_cursor) TA_REQ(lock_);
+                       MappingCursor* new_cursor,
+                       PendingTlbInvalidation* pending) TA_REQ(lock_);
     template <typename PageTable>
     bool RemoveMappingL0(volatile pt_entry_t* table,
                          const MappingCursor& start_cursor,
-                         MappingCursor* new_cursor) TA_REQ(lock_);
+                         MappingCursor* new_cursor,
+                         PendingTlbInvalidation* pending) TA_REQ(lock_);
 
     template <typename PageTable>
     zx_status_t UpdateMapping(volatile pt_entry_t* table, uint mmu_flags,
                               const MappingCursor& start_cursor,
-                              MappingCursor* new_cursor) TA_REQ(lock_);
+                              MappingCursor* new_cursor,
+                              PendingTlbInvalidation* pending) TA_REQ(lock_);
 
     template <typename PageTable>
     zx_status_t UpdateMappingL0(volatile pt_entry_t* table, uint mmu_flags,
                                 const MappingCursor& start_cursor,
-                                MappingCursor* new_cursor) TA_REQ(lock_);
+                                MappingCursor* new_cursor,
+                                PendingTlbInvalidation* pending) TA_REQ(lock_);
 
     template <typename PageTable>
     zx_status_t GetMapping(volatile pt_entry_t* table, vaddr_t vaddr,
@@ -119,11 +147,15 @@ private:
                              volatile pt_entry_t** mapping) TA_REQ(lock_);
 
     template <typename PageTable>
-    void UpdateEntry(vaddr_t vaddr, volatile pt_entry_t* pte, paddr_t paddr,
-                     arch_flags_t flags) TA_REQ(lock_);
+    void UpdateEntry(PendingTlbInvalidation* pending, vaddr_t vaddr, volatile pt_entry_t* pte,
+                     paddr_t paddr, arch_flags_t flags) TA_REQ(lock_);
 
     template <typename PageTable>
-    zx_status_t SplitLargePage(vaddr_t vaddr, volatile pt_entry_t* pte) TA_REQ(lock_);
+    zx_status_t SplitLargePage(vaddr_t vaddr, volatile pt_entry_t* pte,
+                               PendingTlbInvalidation* pending) TA_REQ(lock_);
+
+    // Issue the batched invalidations for a Map/Unmap/Protect operation.
+    void TlbInvalidate(PendingTlbInvalidation* pending) TA_REQ(lock_);
 
     fbl::Canary<fbl::magic("VAAS")> canary_;
     IoBitmap io_bitmap_;
@@ -138,6 +170,9 @@ private:
     // Counter of pages allocated to back the translation table.
     size_t pt_pages_ = 0;
 
+    // Counter of TLB shootdown rounds, see tlb_shootdowns().
+    size_t tlb_shootdowns_ = 0;
+
     uint flags_ = 0;
 
     // Range of address space.
@@ -147,6 +182,13 @@ private:
     // CPUs that are currently executing in this aspace.
     // Actually an mp_cpu_mask_t, but header dependencies.
     fbl::atomic_int active_cpus_{0};
+
+    // See pcid().
+    uint16_t pcid_ = 0;
+
+    // CPUs that may hold stale TLB entries tagged with pcid_.  Also an
+    // mp_cpu_mask_t.
+    fbl::atomic_int pcid_stale_cpus_{0};
 };
 
 using ArchVmAspace = X86ArchVmAspace;
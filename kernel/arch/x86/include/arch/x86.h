@@ -278,6 +278,26 @@ static inline void x86_set_cr3(ulong in_val)
         :"r" (in_val));
 }
 
+/* INVPCID invalidation types */
+#define X86_INVPCID_ADDRESS          0 /* one address in one pcid */
+#define X86_INVPCID_CONTEXT          1 /* all non-global entries of one pcid */
+#define X86_INVPCID_ALL_GLOBAL       2 /* everything, including global entries */
+#define X86_INVPCID_ALL              3 /* everything but global entries */
+
+static inline void x86_invpcid(uint64_t type, uint16_t pcid, uint64_t addr)
+{
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = { pcid, addr };
+
+    __asm__ __volatile__ (
+        "invpcid %0, %1"
+        :
+        : "m" (desc), "r" (type)
+        : "memory");
+}
+
 static inline ulong x86_get_cr0(void)
 {
     ulong rv;
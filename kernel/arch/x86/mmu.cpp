@@ -16,7 +16,9 @@
 #include <arch/x86/feature.h>
 #include <arch/x86/mmu.h>
 #include <arch/x86/mmu_mem_types.h>
+#include <kernel/cmdline.h>
 #include <kernel/mp.h>
+#include <kernel/mutex.h>
 #include <vm/arch_vm_aspace.h>
 #include <vm/physmap.h>
 #include <vm/pmm.h>
@@ -34,6 +36,19 @@ uint8_t g_paddr_width = 32;
 /* True if the system supports 1GB pages */
 static bool supports_huge_pages = false;
 
+/* True if user aspaces are tagged with PCIDs, see x86_mmu_init() */
+static bool use_pcid = false;
+
+/* True if the INVPCID instruction is available */
+static bool supports_invpcid = false;
+
+/* PCID 0 is used by the kernel aspace and by user aspaces that could not get
+ * one of their own; CR4.PCIDE allows 12 bits of PCID */
+#define X86_PCID_COUNT (1u << 12)
+static uint64_t pcid_pool[X86_PCID_COUNT / 64];
+static uint16_t pcid_next = 1;
+static mutex_t pcid_lock = MUTEX_INITIAL_VALUE(pcid_lock);
+
 /* top level kernel page tables, initialized in start.S */
 volatile pt_entry_t pml4[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE);
 volatile pt_entry_t pdp[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE); /* temporary */
@@ -106,10 +121,49 @@ static bool x86_mmu_check_paddr(paddr_t paddr) {
     return paddr <= max_paddr;
 }
 
+/**
+ * @brief  allocate a PCID for a user aspace
+ *
+ * @return the new PCID, or 0 if they have all been handed out
+ */
+static uint16_t x86_pcid_alloc() {
+    mutex_acquire(&pcid_lock);
+
+    uint16_t pcid = 0;
+    for (uint i = 1; i < X86_PCID_COUNT; i++) {
+        uint16_t candidate = pcid_next;
+        pcid_next = (pcid_next == X86_PCID_COUNT - 1) ? 1 : static_cast<uint16_t>(pcid_next + 1);
+
+        if (!(pcid_pool[candidate / 64] & (1ull << (candidate % 64)))) {
+            pcid_pool[candidate / 64] |= (1ull << (candidate % 64));
+            pcid = candidate;
+            break;
+        }
+    }
+
+    mutex_release(&pcid_lock);
+
+    return pcid;
+}
+
+static void x86_pcid_free(uint16_t pcid) {
+    DEBUG_ASSERT(pcid != 0 && pcid < X86_PCID_COUNT);
+
+    mutex_acquire(&pcid_lock);
+    pcid_pool[pcid / 64] &= ~(1ull << (pcid % 64));
+    mutex_release(&pcid_lock);
+}
+
 /**
  * @brief  invalidate all TLB entries, including global entries
  */
 static void x86_tlb_global_invalidate() {
+    if (supports_invpcid) {
+        /* Also covers every PCID, not just the current one */
+        x86_invpcid(X86_INVPCID_ALL_GLOBAL, 0, 0);
+        return;
+    }
+
     /* See Intel 3A section 4.10.4.1 */
     ulong cr4 = x86_get_cr4();
     if (likely(cr4 & X86_CR4_PGE)) {
@@ -120,70 +174,191 @@ static void x86_tlb_global_invalidate() {
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
-struct tlb_invalidate_page_context {
+/**
+ * @brief A batch of TLB invalidations for a single Map/Unmap/Protect operation
+ *
+ * Entries are accumulated while the page tables are walked and then issued
+ * with a single mp_sync_exec when the operation completes.  Past kMaxPages
+ * entries it is cheaper to flush the whole TLB on each target CPU.
+ *
+ * Page table pages that were unlinked by the operation are also parked here
+ * and only returned to the pmm after the invalidation has completed, since
+ * other CPUs may still be walking them through their paging-structure caches
+ * until then.
+ */
+struct PendingTlbInvalidation {
+    struct Item {
+        vaddr_t vaddr;
+        page_table_levels level;
+        bool global_page;
+    };
+
+    static constexpr uint kMaxPages = 32;
+
+    PendingTlbInvalidation() {
+        list_initialize(&freed_page_tables);
+    }
+
+    ~PendingTlbInvalidation() {
+        DEBUG_ASSERT(empty());
+        DEBUG_ASSERT(list_is_empty(&freed_page_tables));
+    }
+
+    void enqueue(vaddr_t vaddr, page_table_levels level, bool global_page) {
+        if (global_page) {
+            contains_global = true;
+        }
+        // An entry at the top level may cover anything, flush it all
+        if (level == PML4_L || count == kMaxPages) {
+            full_shootdown = true;
+        }
+        if (full_shootdown) {
+            return;
+        }
+        item[count++] = { .vaddr = vaddr, .level = level, .global_page = global_page };
+    }
+
+    void free_page_table(vm_page_t* page) {
+        list_add_tail(&freed_page_tables, &page->free.node);
+    }
+
+    bool empty() const {
+        return count == 0 && !full_shootdown;
+    }
+
+    void clear() {
+        count = 0;
+        full_shootdown = false;
+        contains_global = false;
+    }
+
+    Item item[kMaxPages];
+    uint count = 0;
+    bool full_shootdown = false;
+    bool contains_global = false;
+
+    struct list_node freed_page_tables;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PendingTlbInvalidation);
+};
+
+/* Task used for invalidating a batch of TLB entries on each CPU */
+struct tlb_invalidate_context {
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum page_table_levels level;
-    bool global_page;
+    X86ArchVmAspace* aspace;
+    const PendingTlbInvalidation* pending;
+    /* Flush every PCID's entries, not only the current one's */
+    bool all_contexts;
 };
-static void tlb_invalidate_page_task(void* raw_context) {
+static void tlb_invalidate_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
-    tlb_invalidate_page_context* context = (tlb_invalidate_page_context*)raw_context;
+    const tlb_invalidate_context* context = (const tlb_invalidate_context*)raw_context;
+    const PendingTlbInvalidation* pending = context->pending;
 
     ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
-        /* This invalidation doesn't apply to this CPU, ignore it */
+    bool in_target_aspace = (context->target_cr3 == (cr3 & X86_CR3_BASE_MASK));
+    if (!in_target_aspace && !pending->contains_global) {
+        /* This invalidation doesn't apply to this CPU, ignore it.  If the
+         * aspace is tagged with a PCID, any entries this CPU still holds for
+         * it were marked stale by x86_tlb_invalidate(). */
         return;
     }
 
-    switch (context->level) {
-    case PML4_L:
-        x86_tlb_global_invalidate();
-        break;
-    case PDP_L:
-    case PD_L:
-    case PT_L:
-        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-        break;
+    if (in_target_aspace && context->aspace && context->aspace->pcid()) {
+        /* The entries this CPU holds for the aspace are about to be brought
+         * up to date, so the next switch back to it need not flush them */
+        context->aspace->ClearPcidStale(cpu_num_to_mask(arch_curr_cpu_num()));
+    }
+
+    if (pending->full_shootdown || context->all_contexts) {
+        if (pending->contains_global) {
+            x86_tlb_global_invalidate();
+        } else {
+            /* Reloading cr3 drops all non-global entries of the current PCID */
+            x86_set_cr3(cr3);
+        }
+        return;
+    }
+
+    for (uint i = 0; i < pending->count; ++i) {
+        const PendingTlbInvalidation::Item& item = pending->item[i];
+        if (!in_target_aspace && !item.global_page) {
+            continue;
+        }
+
+        switch (item.level) {
+        case PML4_L:
+            x86_tlb_global_invalidate();
+            return;
+        case PDP_L:
+        case PD_L:
+        case PT_L:
+            __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)item.vaddr));
+            break;
+        }
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
+ * @brief Execute a batch of pending TLB invalidations
+ *
+ * Issues one mp_sync_exec for the whole batch, then frees any page tables
+ * that were waiting on it.
  *
  * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
+ * @param pending The batch to execute, cleared on return
  *
- * TODO(ZX-979): Optimize this.  This is horribly inefficient.
- * We should also change this to pool invalidations from a single
- * "transaction" and then only execute a single mp_sync_exec for that
- * transaction, rather than one per page.
+ * @return true if an invalidation round was issued
  */
-static void x86_tlb_invalidate_page(X86ArchVmAspace* aspace, vaddr_t vaddr,
-                                    enum page_table_levels level, bool global_page) {
-    ulong cr3 = aspace ? aspace->pt_phys() : x86_get_cr3();
-    struct tlb_invalidate_page_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
-    };
+static bool x86_tlb_invalidate(X86ArchVmAspace* aspace, PendingTlbInvalidation* pending) {
+    bool issued = false;
+
+    if (!pending->empty()) {
+        ulong cr3 = aspace ? aspace->pt_phys() : (x86_get_cr3() & X86_CR3_BASE_MASK);
+        /* invlpg only drops the paging-structure caches of the current PCID.
+         * Other PCIDs may still cache upper-level entries that lead into a
+         * kernel page table this batch unlinked, and which is freed below, so
+         * flush every context in that case. */
+        bool all_contexts = use_pcid && pending->contains_global &&
+                            !list_is_empty(&pending->freed_page_tables);
+        struct tlb_invalidate_context task_context = {
+            .target_cr3 = cr3, .aspace = aspace, .pending = pending,
+            .all_contexts = all_contexts,
+        };
+
+        /* CPUs that ran the aspace before may still hold entries tagged with
+         * its PCID even though they are not active in it anymore.  Mark them
+         * all stale before sampling active_cpus below, so that any CPU that
+         * switches in afterwards drops its entries, and the ones we do reach
+         * clear their own mark again. */
+        if (aspace && aspace->pcid()) {
+            aspace->MarkPcidStale();
+        }
 
-    /* Target only CPUs this aspace is active on.  It may be the case that some
-     * other CPU will become active in it after this load, or will have left it
-     * just before this load.  In the former case, it is becoming active after
-     * the write to the page table, so it will see the change.  In the latter
-     * case, it will get a spurious request to flush. */
-    mp_ipi_target_t target;
-    cpu_mask_t target_mask = 0;
-    if (global_page || aspace == nullptr) {
-        target = MP_IPI_TARGET_ALL;
-    } else {
-        target = MP_IPI_TARGET_MASK;
-        target_mask = aspace->active_cpus();
+        /* Target only CPUs this aspace is active on.  It may be the case that some
+         * other CPU will become active in it after this load, or will have left it
+         * just before this load.  In the former case, it is becoming active after
+         * the write to the page table, so it will see the change.  In the latter
+         * case, it will get a spurious request to flush. */
+        mp_ipi_target_t target;
+        cpu_mask_t target_mask = 0;
+        if (pending->contains_global || aspace == nullptr) {
+            target = MP_IPI_TARGET_ALL;
+        } else {
+            target = MP_IPI_TARGET_MASK;
+            target_mask = aspace->active_cpus();
+        }
+
+        mp_sync_exec(target, target_mask, tlb_invalidate_task, &task_context);
+        pending->clear();
+        issued = true;
+    }
+
+    if (!list_is_empty(&pending->freed_page_tables)) {
+        pmm_free(&pending->freed_page_tables);
     }
 
-    mp_sync_exec(target, target_mask, tlb_invalidate_page_task, &task_context);
+    return issued;
 }
 
 template <int Level>
@@ -371,10 +546,11 @@ struct PageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Queue the invalidation of a single page at this page table level
      */
-    static void tlb_invalidate_page(X86ArchVmAspace* aspace, vaddr_t vaddr, bool global_page) {
-        x86_tlb_invalidate_page(aspace, vaddr, Base::level, global_page);
+    static void tlb_invalidate_page(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                                    bool global_page) {
+        pending->enqueue(vaddr, Base::level, global_page);
     }
 };
 
@@ -423,9 +599,10 @@ struct ExtendedPageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Queue the invalidation of a single page at this page table level
      */
-    static void tlb_invalidate_page(X86ArchVmAspace* aspace, vaddr_t vaddr, bool global_page) {
+    static void tlb_invalidate_page(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                                    bool global_page) {
         // TODO(ZX-981): Implement this.
     }
 };
@@ -521,8 +698,8 @@ public:
 };
 
 template <typename PageTable>
-void X86ArchVmAspace::UpdateEntry(vaddr_t vaddr, volatile pt_entry_t* pte, paddr_t paddr,
-                                  arch_flags_t flags) {
+void X86ArchVmAspace::UpdateEntry(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                                  volatile pt_entry_t* pte, paddr_t paddr, arch_flags_t flags) {
     DEBUG_ASSERT(pte);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(paddr));
 
@@ -533,12 +710,13 @@ void X86ArchVmAspace::UpdateEntry(vaddr_t vaddr, volatile pt_entry_t* pte, paddr
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(this, vaddr, is_kernel_address(vaddr));
+        PageTable::tlb_invalidate_page(pending, vaddr, is_kernel_address(vaddr));
     }
 }
 
 template <typename PageTable>
-void X86ArchVmAspace::UnmapEntry(X86ArchVmAspace* aspace, vaddr_t vaddr, volatile pt_entry_t* pte) {
+void X86ArchVmAspace::UnmapEntry(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                                 volatile pt_entry_t* pte) {
     DEBUG_ASSERT(pte);
 
     pt_entry_t olde = *pte;
@@ -547,7 +725,7 @@ void X86ArchVmAspace::UnmapEntry(X86ArchVmAspace* aspace, vaddr_t vaddr, volatil
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        PageTable::tlb_invalidate_page(pending, vaddr, is_kernel_address(vaddr));
     }
 }
 
@@ -571,7 +749,8 @@ static volatile pt_entry_t* _map_alloc_page(void) {
  * @brief Split the given large page into smaller pages
  */
 template <typename PageTable>
-zx_status_t X86ArchVmAspace::SplitLargePage(vaddr_t vaddr, volatile pt_entry_t* pte) {
+zx_status_t X86ArchVmAspace::SplitLargePage(vaddr_t vaddr, volatile pt_entry_t* pte,
+                                            PendingTlbInvalidation* pending) {
     static_assert(PageTable::level != PT_L, "tried splitting PT_L");
     LTRACEF_LEVEL(2, "splitting table %p at level %d\n", pte, PageTable::level);
 
@@ -592,14 +771,14 @@ zx_status_t X86ArchVmAspace::SplitLargePage(vaddr_t vaddr, volatile pt_entry_t*
         volatile pt_entry_t* e = m + i;
         // If this is a PDP_L (i.e. huge page), flags will include the
         // PS bit still, so the new PD entries will be large pages.
-        UpdateEntry<typename PageTable::LowerTable>(new_vaddr, e, new_paddr, flags);
+        UpdateEntry<typename PageTable::LowerTable>(pending, new_vaddr, e, new_paddr, flags);
         new_vaddr += ps;
         new_paddr += ps;
     }
     DEBUG_ASSERT(new_vaddr == vaddr + PageTable::page_size());
 
     flags = PageTable::intermediate_arch_flags();
-    UpdateEntry<PageTable>(vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
+    UpdateEntry<PageTable>(pending, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
     pt_pages_++;
     return ZX_OK;
 }
@@ -619,7 +798,8 @@ static inline volatile pt_entry_t* get_next_table_from_entry(pt_entry_t entry) {
  *
  * @param table The top-level paging structure's virtual address
  * @param vaddr The virtual address to retrieve the mapping for
- * @param ret_level The level of the table that defines the found mapping
+ * @param ret_level The level of the table that defines the found mapping, or
+ * if there is none, the level of the non-present entry the walk stopped at
  * @param mapping The mapping that was found
  *
  * @return ZX_OK if mapping is found
@@ -638,8 +818,10 @@ zx_status_t X86ArchVmAspace::GetMapping(volatile pt_entry_t* table, vaddr_t vadd
     uint index = PageTable::vaddr_to_index(vaddr);
     volatile pt_entry_t* e = table + index;
     pt_entry_t pt_val = *e;
-    if (!IS_PAGE_PRESENT(pt_val))
+    if (!IS_PAGE_PRESENT(pt_val)) {
+        *ret_level = PageTable::level;
         return ZX_ERR_NOT_FOUND;
+    }
 
     /* if this is a large page, stop here */
     if (IS_LARGE_PAGE(pt_val)) {
@@ -678,8 +860,10 @@ zx_status_t X86ArchVmAspace::GetMappingL0(volatile pt_entry_t* table, vaddr_t va
     /* do the final page table lookup */
     uint index = PageTable::vaddr_to_index(vaddr);
     volatile pt_entry_t* e = table + index;
-    if (!IS_PAGE_PRESENT(*e))
+    if (!IS_PAGE_PRESENT(*e)) {
+        *ret_level = PageTable::level;
         return ZX_ERR_NOT_FOUND;
+    }
 
     *mapping = e;
     *ret_level = PageTable::level;
@@ -702,7 +886,8 @@ zx_status_t X86ArchVmAspace::GetMappingL0(volatile pt_entry_t* table, vaddr_t va
 template <typename PageTable>
 bool X86ArchVmAspace::RemoveMapping(volatile pt_entry_t* table,
                                     const MappingCursor& start_cursor,
-                                    MappingCursor* new_cursor) {
+                                    MappingCursor* new_cursor,
+                                    PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
             start_cursor.size);
@@ -727,7 +912,7 @@ bool X86ArchVmAspace::RemoveMapping(volatile pt_entry_t* table,
             bool vaddr_level_aligned = PageTable::page_aligned(new_cursor->vaddr);
             // If the request covers the entire large page, just unmap it
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                UnmapEntry<PageTable>(this, new_cursor->vaddr, e);
+                UnmapEntry<PageTable>(pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 new_cursor->vaddr += ps;
@@ -737,11 +922,11 @@ bool X86ArchVmAspace::RemoveMapping(volatile pt_entry_t* table,
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            zx_status_t status = SplitLargePage<PageTable>(page_vaddr, e);
+            zx_status_t status = SplitLargePage<PageTable>(page_vaddr, e, pending);
             if (status != ZX_OK) {
                 // If split fails, just unmap the whole thing, and let a
                 // subsequent page fault clean it up.
-                UnmapEntry<PageTable>(this, new_cursor->vaddr, e);
+                UnmapEntry<PageTable>(pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 new_cursor->SkipEntry<PageTable>();
@@ -753,7 +938,7 @@ bool X86ArchVmAspace::RemoveMapping(volatile pt_entry_t* table,
         MappingCursor cursor;
         volatile pt_entry_t* next_table = get_next_table_from_entry(pt_val);
         bool lower_unmapped = RemoveMapping<typename PageTable::LowerTable>(
-            next_table, *new_cursor, &cursor);
+            next_table, *new_cursor, &cursor, pending);
 
         // If we were requesting to unmap everything in the lower page table,
         // we know we can unmap the lower level page table.  Otherwise, if
@@ -777,7 +962,7 @@ bool X86ArchVmAspace::RemoveMapping(volatile pt_entry_t* table,
             LTRACEF("L: %d free pt v %#" PRIxPTR " phys %#" PRIxPTR "\n",
                     PageTable::level, (uintptr_t)next_table, ptable_phys);
 
-            UnmapEntry<PageTable>(this, new_cursor->vaddr, e);
+            UnmapEntry<PageTable>(pending, new_cursor->vaddr, e);
             vm_page_t* page = paddr_to_vm_page(ptable_phys);
 
             DEBUG_ASSERT(page);
@@ -785,7 +970,9 @@ bool X86ArchVmAspace::RemoveMapping(volatile pt_entry_t* table,
                              "page %p state %u, paddr %#" PRIxPTR "\n", page, page->state,
                              X86_VIRT_TO_PHYS(next_table));
 
-            pmm_free_page(page);
+            // Don't hand the table back to the pmm until the TLB shootdown
+            // for this operation has completed.
+            pending->free_page_table(page);
             pt_pages_--;
             unmapped = true;
         }
@@ -801,22 +988,25 @@ bool X86ArchVmAspace::RemoveMapping(volatile pt_entry_t* table,
 template <>
 bool X86ArchVmAspace::RemoveMapping<PageTable<PT_L>>(volatile pt_entry_t* table,
                                                      const MappingCursor& start_cursor,
-                                                     MappingCursor* new_cursor) {
-    return RemoveMappingL0<PageTable<PT_L>>(table, start_cursor, new_cursor);
+                                                     MappingCursor* new_cursor,
+                                                     PendingTlbInvalidation* pending) {
+    return RemoveMappingL0<PageTable<PT_L>>(table, start_cursor, new_cursor, pending);
 }
 
 template <>
 bool X86ArchVmAspace::RemoveMapping<ExtendedPageTable<PT_L>>(volatile pt_entry_t* table,
                                                              const MappingCursor& start_cursor,
-                                                             MappingCursor* new_cursor) {
-    return RemoveMappingL0<ExtendedPageTable<PT_L>>(table, start_cursor, new_cursor);
+                                                             MappingCursor* new_cursor,
+                                                             PendingTlbInvalidation* pending) {
+    return RemoveMappingL0<ExtendedPageTable<PT_L>>(table, start_cursor, new_cursor, pending);
 }
 
 // Base case of RemoveMapping for smallest page size.
 template <typename PageTable>
 bool X86ArchVmAspace::RemoveMappingL0(volatile pt_entry_t* table,
                                       const MappingCursor& start_cursor,
-                                      MappingCursor* new_cursor) {
+                                      MappingCursor* new_cursor,
+                                      PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "RemoveMappingL0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -828,7 +1018,7 @@ bool X86ArchVmAspace::RemoveMappingL0(volatile pt_entry_t* table,
     for (; index != NO_OF_PT_ENTRIES && new_cursor->size != 0; ++index) {
         volatile pt_entry_t* e = table + index;
         if (IS_PAGE_PRESENT(*e)) {
-            UnmapEntry<PageTable>(this, new_cursor->vaddr, e);
+            UnmapEntry<PageTable>(pending, new_cursor->vaddr, e);
             unmapped = true;
         }
 
@@ -857,7 +1047,8 @@ bool X86ArchVmAspace::RemoveMappingL0(volatile pt_entry_t* table,
 template <typename PageTable>
 zx_status_t X86ArchVmAspace::AddMapping(volatile pt_entry_t* table, uint mmu_flags,
                                         const MappingCursor& start_cursor,
-                                        MappingCursor* new_cursor) {
+                                        MappingCursor* new_cursor,
+                                        PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     DEBUG_ASSERT(x86_mmu_check_vaddr(start_cursor.vaddr));
     DEBUG_ASSERT(x86_mmu_check_paddr(start_cursor.paddr));
@@ -886,7 +1077,7 @@ zx_status_t X86ArchVmAspace::AddMapping(volatile pt_entry_t* table, uint mmu_fla
         if (level_supports_large_pages && !IS_PAGE_PRESENT(pt_val) && level_valigned &&
             level_paligned && new_cursor->size >= ps) {
 
-            UpdateEntry<PageTable>(new_cursor->vaddr, table + index,
+            UpdateEntry<PageTable>(pending, new_cursor->vaddr, table + index,
                                    new_cursor->paddr,
                                    arch_flags | X86_MMU_PG_PS);
 
@@ -905,7 +1096,7 @@ zx_status_t X86ArchVmAspace::AddMapping(volatile pt_entry_t* table, uint mmu_fla
 
                 LTRACEF_LEVEL(2, "new table %p at level %d\n", m, PageTable::level);
 
-                UpdateEntry<PageTable>(new_cursor->vaddr, e,
+                UpdateEntry<PageTable>(pending, new_cursor->vaddr, e,
                                        X86_VIRT_TO_PHYS(m), interm_arch_flags);
                 pt_val = *e;
                 pt_pages_++;
@@ -913,7 +1104,7 @@ zx_status_t X86ArchVmAspace::AddMapping(volatile pt_entry_t* table, uint mmu_fla
 
             MappingCursor cursor;
             ret = AddMapping<typename PageTable::LowerTable>(
-                get_next_table_from_entry(pt_val), mmu_flags, *new_cursor, &cursor);
+                get_next_table_from_entry(pt_val), mmu_flags, *new_cursor, &cursor, pending);
             *new_cursor = cursor;
             DEBUG_ASSERT(new_cursor->size <= start_cursor.size);
             if (ret != ZX_OK) {
@@ -929,7 +1120,7 @@ err:
         // new_cursor->size should be how much is left to be mapped still
         cursor.size -= new_cursor->size;
         if (cursor.size > 0) {
-            RemoveMapping<typename PageTable::TopTable>(table, cursor, &result);
+            RemoveMapping<typename PageTable::TopTable>(table, cursor, &result, pending);
             DEBUG_ASSERT(result.size == 0);
         }
     }
@@ -939,24 +1130,27 @@ err:
 template <>
 zx_status_t X86ArchVmAspace::AddMapping<PageTable<PT_L>>(
     volatile pt_entry_t* table, uint mmu_flags,
-    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+    const MappingCursor& start_cursor, MappingCursor* new_cursor,
+    PendingTlbInvalidation* pending) {
     return AddMappingL0<PageTable<PT_L>>(table, mmu_flags, start_cursor,
-                                         new_cursor);
+                                         new_cursor, pending);
 }
 
 template <>
 zx_status_t X86ArchVmAspace::AddMapping<ExtendedPageTable<PT_L>>(
     volatile pt_entry_t* table, uint mmu_flags,
-    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+    const MappingCursor& start_cursor, MappingCursor* new_cursor,
+    PendingTlbInvalidation* pending) {
     return AddMappingL0<ExtendedPageTable<PT_L>>(table, mmu_flags, start_cursor,
-                                                 new_cursor);
+                                                 new_cursor, pending);
 }
 
 // Base case of AddMapping for smallest page size.
 template <typename PageTable>
 zx_status_t X86ArchVmAspace::AddMappingL0(volatile pt_entry_t* table, uint mmu_flags,
                                           const MappingCursor& start_cursor,
-                                          MappingCursor* new_cursor) {
+                                          MappingCursor* new_cursor,
+                                          PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "AddMappingL0 used with wrong level");
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
 
@@ -971,7 +1165,7 @@ zx_status_t X86ArchVmAspace::AddMappingL0(volatile pt_entry_t* table, uint mmu_f
             return ZX_ERR_ALREADY_EXISTS;
         }
 
-        UpdateEntry<PageTable>(new_cursor->vaddr, e, new_cursor->paddr, arch_flags);
+        UpdateEntry<PageTable>(pending, new_cursor->vaddr, e, new_cursor->paddr, arch_flags);
 
         new_cursor->paddr += PAGE_SIZE;
         new_cursor->vaddr += PAGE_SIZE;
@@ -997,7 +1191,8 @@ template <typename PageTable>
 zx_status_t X86ArchVmAspace::UpdateMapping(volatile pt_entry_t* table,
                                            uint mmu_flags,
                                            const MappingCursor& start_cursor,
-                                           MappingCursor* new_cursor) {
+                                           MappingCursor* new_cursor,
+                                           PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
             start_cursor.size);
@@ -1024,7 +1219,7 @@ zx_status_t X86ArchVmAspace::UpdateMapping(volatile pt_entry_t* table,
             // If the request covers the entire large page, just change the
             // permissions
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                UpdateEntry<PageTable>(new_cursor->vaddr, e,
+                UpdateEntry<PageTable>(pending, new_cursor->vaddr, e,
                                        PageTable::paddr_from_pte(pt_val),
                                        arch_flags | X86_MMU_PG_PS);
 
@@ -1035,7 +1230,7 @@ zx_status_t X86ArchVmAspace::UpdateMapping(volatile pt_entry_t* table,
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            ret = SplitLargePage<PageTable>(page_vaddr, e);
+            ret = SplitLargePage<PageTable>(page_vaddr, e, pending);
             if (ret != ZX_OK) {
                 // If we failed to split the table, just unmap it.  Subsequent
                 // page faults will bring it back in.
@@ -1044,7 +1239,7 @@ zx_status_t X86ArchVmAspace::UpdateMapping(volatile pt_entry_t* table,
                 cursor.size = ps;
 
                 MappingCursor tmp_cursor;
-                RemoveMapping<PageTable>(table, cursor, &tmp_cursor);
+                RemoveMapping<PageTable>(table, cursor, &tmp_cursor, pending);
 
                 new_cursor->SkipEntry<PageTable>();
             }
@@ -1054,7 +1249,7 @@ zx_status_t X86ArchVmAspace::UpdateMapping(volatile pt_entry_t* table,
         MappingCursor cursor;
         volatile pt_entry_t* next_table = get_next_table_from_entry(pt_val);
         ret = UpdateMapping<typename PageTable::LowerTable>(next_table, mmu_flags,
-                                                            *new_cursor, &cursor);
+                                                            *new_cursor, &cursor, pending);
         *new_cursor = cursor;
         if (ret != ZX_OK) {
             // Currently this can't happen
@@ -1070,17 +1265,19 @@ zx_status_t X86ArchVmAspace::UpdateMapping(volatile pt_entry_t* table,
 template <>
 zx_status_t X86ArchVmAspace::UpdateMapping<PageTable<PT_L>>(
     volatile pt_entry_t* table, uint mmu_flags,
-    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+    const MappingCursor& start_cursor, MappingCursor* new_cursor,
+    PendingTlbInvalidation* pending) {
     return UpdateMappingL0<PageTable<PT_L>>(table, mmu_flags,
-                                            start_cursor, new_cursor);
+                                            start_cursor, new_cursor, pending);
 }
 
 template <>
 zx_status_t X86ArchVmAspace::UpdateMapping<ExtendedPageTable<PT_L>>(
     volatile pt_entry_t* table, uint mmu_flags,
-    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+    const MappingCursor& start_cursor, MappingCursor* new_cursor,
+    PendingTlbInvalidation* pending) {
     return UpdateMappingL0<ExtendedPageTable<PT_L>>(table, mmu_flags,
-                                                    start_cursor, new_cursor);
+                                                    start_cursor, new_cursor, pending);
 }
 
 // Base case of UpdateMapping for smallest page size.
@@ -1088,7 +1285,8 @@ template <typename PageTable>
 zx_status_t X86ArchVmAspace::UpdateMappingL0(volatile pt_entry_t* table,
                                              uint mmu_flags,
                                              const MappingCursor& start_cursor,
-                                             MappingCursor* new_cursor) {
+                                             MappingCursor* new_cursor,
+                                             PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "UpdateMappingL0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -1103,7 +1301,7 @@ zx_status_t X86ArchVmAspace::UpdateMappingL0(volatile pt_entry_t* table,
         pt_entry_t pt_val = *e;
         // Skip unmapped pages (we may encounter these due to demand paging)
         if (IS_PAGE_PRESENT(pt_val)) {
-            UpdateEntry<PageTable>(new_cursor->vaddr, e,
+            UpdateEntry<PageTable>(pending, new_cursor->vaddr, e,
                                    PageTable::paddr_from_pte(pt_val),
                                    arch_flags);
         }
@@ -1116,6 +1314,12 @@ zx_status_t X86ArchVmAspace::UpdateMappingL0(volatile pt_entry_t* table,
     return ZX_OK;
 }
 
+void X86ArchVmAspace::TlbInvalidate(PendingTlbInvalidation* pending) {
+    if (x86_tlb_invalidate(this, pending)) {
+        tlb_shootdowns_++;
+    }
+}
+
 template <template <int> class PageTable>
 zx_status_t X86ArchVmAspace::UnmapPages(vaddr_t vaddr, const size_t count,
                                         size_t* unmapped) {
@@ -1137,7 +1341,9 @@ zx_status_t X86ArchVmAspace::UnmapPages(vaddr_t vaddr, const size_t count,
     };
 
     MappingCursor result;
-    RemoveMapping<PageTable<MAX_PAGING_LEVEL>>(pt_virt_, start, &result);
+    PendingTlbInvalidation pending;
+    RemoveMapping<PageTable<MAX_PAGING_LEVEL>>(pt_virt_, start, &result, &pending);
+    TlbInvalidate(&pending);
     DEBUG_ASSERT(result.size == 0);
 
     if (unmapped)
@@ -1183,8 +1389,10 @@ zx_status_t X86ArchVmAspace::MapPages(vaddr_t vaddr, paddr_t paddr,
         .paddr = paddr, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
+    PendingTlbInvalidation pending;
     zx_status_t status = AddMapping<PageTable<MAX_PAGING_LEVEL>>(pt_virt_, mmu_flags,
-                                                              start, &result);
+                                                              start, &result, &pending);
+    TlbInvalidate(&pending);
     if (status != ZX_OK) {
         dprintf(SPEW, "Add mapping failed with err=%d\n", status);
         return status;
@@ -1231,8 +1439,10 @@ zx_status_t X86ArchVmAspace::ProtectPages(vaddr_t vaddr, size_t count, uint mmu_
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
+    PendingTlbInvalidation pending;
     zx_status_t status = UpdateMapping<PageTable<MAX_PAGING_LEVEL>>(
-        pt_virt_, mmu_flags, start, &result);
+        pt_virt_, mmu_flags, start, &result, &pending);
+    TlbInvalidate(&pending);
     if (status != ZX_OK) {
         return status;
     }
@@ -1257,7 +1467,9 @@ void x86_mmu_early_init() {
     x86_mmu_percpu_init();
 
     // Unmap the lower identity mapping.
-    X86ArchVmAspace::UnmapEntry<PageTable<PML4_L>>(nullptr, 0, &pml4[0]);
+    PendingTlbInvalidation pending;
+    X86ArchVmAspace::UnmapEntry<PageTable<PML4_L>>(&pending, 0, &pml4[0]);
+    x86_tlb_invalidate(nullptr, &pending);
 
     /* get the address width from the CPU */
     uint8_t vaddr_width = x86_linear_address_width();
@@ -1276,7 +1488,20 @@ void x86_mmu_early_init() {
     LTRACEF("paddr_width %u vaddr_width %u\n", g_paddr_width, g_vaddr_width);
 }
 
-void x86_mmu_init(void) {}
+void x86_mmu_init(void) {
+    // The command line is not available yet when x86_mmu_early_init() runs,
+    // but no user aspace exists and no secondary CPU is up at this point.
+    supports_invpcid = x86_feature_test(X86_FEATURE_INVPCID);
+    use_pcid = x86_feature_test(X86_FEATURE_PCID) &&
+               cmdline_get_bool("kernel.x86.pcid", true);
+
+    if (use_pcid) {
+        x86_set_cr4(x86_get_cr4() | X86_CR4_PCIDE);
+    }
+
+    dprintf(INFO, "MMU: PCID %s, INVPCID %s\n",
+            use_pcid ? "enabled" : "disabled", supports_invpcid ? "supported" : "unsupported");
+}
 
 X86ArchVmAspace::X86ArchVmAspace() {}
 
@@ -1300,15 +1525,13 @@ zx_status_t X86ArchVmAspace::Init(vaddr_t base, size_t size, uint mmu_flags) {
         pt_virt_ = (pt_entry_t*)X86_PHYS_TO_VIRT(pt_phys_);
         LTRACEF("kernel aspace: pt phys %#" PRIxPTR ", virt %p\n", pt_phys_, pt_virt_);
     } else if (mmu_flags & ARCH_ASPACE_FLAG_GUEST) {
-        vm_page_t* p = pmm_alloc_page(0, &pt_phys_);
+        vm_page_t* p = pmm_alloc_page(PMM_ALLOC_FLAG_ZEROED, &pt_phys_);
         if (p == nullptr) {
             TRACEF("error allocating top level page directory\n");
             return ZX_ERR_NO_MEMORY;
         }
         p->state = VM_PAGE_STATE_MMU;
         pt_virt_ = static_cast<pt_entry_t*>(paddr_to_physmap(pt_phys_));
-        // TODO(abdulla): Remove when PMM returns pre-zeroed pages.
-        arch_zero_page(pt_virt_);
         LTRACEF("guest paspace: pt phys %#" PRIxPTR ", virt %p\n", pt_phys_, pt_virt_);
     } else {
         /* allocate a top level page table for the new address space */
@@ -1332,7 +1555,15 @@ zx_status_t X86ArchVmAspace::Init(vaddr_t base, size_t size, uint mmu_flags) {
                const_cast<pt_entry_t*>(&KERNEL_PT[NO_OF_PT_ENTRIES / 2]),
                sizeof(pt_entry_t) * NO_OF_PT_ENTRIES / 2);
 
-        LTRACEF("user aspace: pt phys %#" PRIxPTR ", virt %p\n", pt_phys_, pt_virt_);
+        if (use_pcid) {
+            // A recycled PCID may still have entries cached on any CPU from
+            // its previous owner.
+            pcid_ = x86_pcid_alloc();
+            MarkPcidStale();
+        }
+
+        LTRACEF("user aspace: pt phys %#" PRIxPTR ", virt %p, pcid %u\n", pt_phys_, pt_virt_,
+                pcid_);
     }
     pt_pages_ = 1;
     fbl::atomic_init(&active_cpus_, 0);
@@ -1367,6 +1598,11 @@ zx_status_t X86ArchVmAspace::DestroyAspace() {
     pmm_free_page(paddr_to_vm_page(pt_phys_));
     pt_phys_ = 0;
 
+    if (pcid_ != 0) {
+        x86_pcid_free(pcid_);
+        pcid_ = 0;
+    }
+
     return ZX_OK;
 }
 
@@ -1384,12 +1620,26 @@ void X86ArchVmAspace::ContextSwitch(X86ArchVmAspace* old_aspace, X86ArchVmAspace
     if (aspace != nullptr) {
         aspace->canary_.Assert();
         LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR "\n", aspace, aspace->pt_phys_);
-        x86_set_cr3(aspace->pt_phys_);
+
+        // Become active before looking at the stale mask, so that a
+        // concurrent invalidation either sees us in active_cpus_ and sends us
+        // an IPI, or marked us stale before we look.
+        aspace->active_cpus_.fetch_or(cpu_bit);
+
+        ulong cr3 = aspace->pt_phys_;
+        if (aspace->pcid_ != 0) {
+            cr3 |= aspace->pcid_;
+            // Keep the entries this CPU cached the last time it ran the
+            // aspace, unless an invalidation has happened since.
+            if (!(aspace->pcid_stale_cpus_.fetch_and(~cpu_bit) & cpu_bit)) {
+                cr3 |= X86_CR3_NOFLUSH;
+            }
+        }
+        x86_set_cr3(cr3);
 
         if (old_aspace != nullptr) {
             old_aspace->active_cpus_.fetch_and(~cpu_bit);
         }
-        aspace->active_cpus_.fetch_or(cpu_bit);
     } else {
         LTRACEF_LEVEL(3, "switching to kernel aspace, pt %#" PRIxPTR "\n", kernel_pt_phys);
         x86_set_cr3(kernel_pt_phys);
@@ -1472,6 +1722,59 @@ zx_status_t X86ArchVmAspace::Query(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flag
     }
 }
 
+template <template <int> class PageTable>
+bool X86ArchVmAspace::HasMappingsInternal(vaddr_t vaddr, size_t size) {
+    while (size > 0) {
+        page_table_levels level;
+        volatile pt_entry_t* entry;
+        if (GetMapping<PageTable<MAX_PAGING_LEVEL>>(pt_virt_, vaddr, &level, &entry) == ZX_OK) {
+            return true;
+        }
+
+        // nothing is mapped in the rest of the range covered by the
+        // non-present entry the walk stopped at
+        size_t skip;
+        switch (level) {
+        case PML4_L:
+            skip = PageTable<PML4_L>::page_size();
+            break;
+        case PDP_L:
+            skip = PageTable<PDP_L>::page_size();
+            break;
+        case PD_L:
+            skip = PageTable<PD_L>::page_size();
+            break;
+        default:
+            skip = PageTable<PT_L>::page_size();
+            break;
+        }
+        skip -= vaddr & (skip - 1);
+        if (skip >= size) {
+            break;
+        }
+        vaddr += skip;
+        size -= skip;
+    }
+    return false;
+}
+
+bool X86ArchVmAspace::HasMappings(vaddr_t vaddr, size_t count) {
+    canary_.Assert();
+
+    LTRACEF("aspace %p, vaddr %#" PRIxPTR ", count %#zx\n", this, vaddr, count);
+
+    if (!IsValidVaddr(vaddr))
+        return false;
+
+    fbl::AutoLock a(&lock_);
+
+    if (flags_ & ARCH_ASPACE_FLAG_GUEST) {
+        return HasMappingsInternal<ExtendedPageTable>(vaddr, count * PAGE_SIZE);
+    } else {
+        return HasMappingsInternal<PageTable>(vaddr, count * PAGE_SIZE);
+    }
+}
+
 void x86_mmu_percpu_init(void) {
     ulong cr0 = x86_get_cr0();
     /* Set write protect bit in CR0*/
@@ -1486,6 +1789,11 @@ void x86_mmu_percpu_init(void) {
         cr4 |= X86_CR4_SMEP;
     if (x86_feature_test(X86_FEATURE_SMAP))
         cr4 |= X86_CR4_SMAP;
+    /* Setting the PCIDE bit requires the current PCID to be 0 */
+    if (use_pcid) {
+        DEBUG_ASSERT((x86_get_cr3() & X86_CR3_PCID_MASK) == 0);
+        cr4 |= X86_CR4_PCIDE;
+    }
     x86_set_cr4(cr4);
 
     // Set NXE bit in X86_MSR_IA32_EFER.
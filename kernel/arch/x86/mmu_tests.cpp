@@ -149,6 +149,50 @@ static bool mmu_tests(void* context) {
         EXPECT_EQ(err, ZX_OK, "destroy aspace");
     }
 
+    unittest_printf("unmap and protect of many pages issue a single shootdown\n");
+    {
+        ArchVmAspace aspace;
+        vaddr_t base = 1UL << 20;
+        size_t size = (1UL << 47) - base - (1UL << 20);
+        zx_status_t err = aspace.Init(1UL << 20, size, 0);
+        EXPECT_EQ(err, ZX_OK, "init aspace");
+
+        const uint arch_rw_flags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
+
+        vaddr_t va = 1UL << PDP_SHIFT;
+        // More pages than fit in a single batch, and not enough to form a
+        // large page.
+        static const size_t count = 64;
+
+        size_t mapped;
+        err = aspace.Map(va, 0, count, arch_rw_flags, &mapped);
+        EXPECT_EQ(err, ZX_OK, "map pages");
+        EXPECT_EQ(mapped, count, "map pages");
+        EXPECT_EQ(aspace.tlb_shootdowns(), 0u, "no shootdown for new mappings");
+
+        err = aspace.Protect(va, count, ARCH_MMU_FLAG_PERM_READ);
+        EXPECT_EQ(err, ZX_OK, "protect pages");
+        EXPECT_EQ(aspace.tlb_shootdowns(), 1u, "single shootdown for protect");
+
+        err = aspace.Protect(va, 1, arch_rw_flags);
+        EXPECT_EQ(err, ZX_OK, "protect single page");
+        EXPECT_EQ(aspace.tlb_shootdowns(), 2u, "single shootdown for protect");
+
+        size_t unmapped;
+        err = aspace.Unmap(va, count, &unmapped);
+        EXPECT_EQ(err, ZX_OK, "unmap pages");
+        EXPECT_EQ(unmapped, count, "unmap pages");
+        EXPECT_EQ(aspace.tlb_shootdowns(), 3u, "single shootdown for unmap");
+        EXPECT_EQ(aspace.pt_pages(), 1u, "page tables freed after unmap");
+
+        err = aspace.Unmap(va, count, &unmapped);
+        EXPECT_EQ(err, ZX_OK, "unmap unmapped pages");
+        EXPECT_EQ(aspace.tlb_shootdowns(), 3u, "no shootdown for unmapped pages");
+
+        err = aspace.Destroy();
+        EXPECT_EQ(err, ZX_OK, "destroy aspace");
+    }
+
     unittest_printf("done with mmu tests\n");
     END_TEST;
 }
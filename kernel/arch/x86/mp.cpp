@@ -203,6 +203,40 @@ int x86_apic_id_to_cpu_num(uint32_t apic_id)
     return -1;
 }
 
+static uint32_t x86_cpu_num_to_apic_id(cpu_num_t cpu_num)
+{
+    if (cpu_num == 0) {
+        return bp_percpu.apic_id;
+    }
+    DEBUG_ASSERT(cpu_num < x86_num_cpus);
+    return ap_percpus[cpu_num - 1].apic_id;
+}
+
+cpu_mask_t arch_mp_cache_sibling_mask(cpu_num_t cpu)
+{
+    DEBUG_ASSERT(cpu < x86_num_cpus);
+
+    // treat every cpu in the same package as sharing the last level cache
+    x86_cpu_topology_t topo;
+    x86_cpu_topology_decode(x86_cpu_num_to_apic_id(cpu), &topo);
+
+    cpu_mask_t mask = 0;
+    for (cpu_num_t i = 0; i < x86_num_cpus; ++i) {
+        uint32_t apic_id = x86_cpu_num_to_apic_id(i);
+        if (apic_id == INVALID_APIC_ID) {
+            continue;
+        }
+
+        x86_cpu_topology_t other;
+        x86_cpu_topology_decode(apic_id, &other);
+        if (other.package_id == topo.package_id) {
+            mask |= cpu_num_to_mask(i);
+        }
+    }
+
+    return mask | cpu_num_to_mask(cpu);
+}
+
 zx_status_t arch_mp_send_ipi(mp_ipi_target_t target, cpu_mask_t mask, mp_ipi_t ipi)
 {
     uint8_t vector = 0;
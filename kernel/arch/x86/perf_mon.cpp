@@ -796,7 +796,7 @@ static bool pmi_interrupt_handler(x86_iframe_t *frame, perfmon_state_t* state) {
     uint64_t cr3 = 0;
     if (state->misc_ctrl & IPM_MISC_CTRL_PROFILE_PC) {
         record_type = IPM_RECORD_PC;
-        cr3 = x86_get_cr3();
+        cr3 = x86_get_cr3() & X86_CR3_BASE_MASK;
     }
 
     const uint64_t status = read_msr(IA32_PERF_GLOBAL_STATUS);
@@ -42,4 +42,9 @@ zx_status_t arch_mp_cpu_unplug(cpu_num_t cpu_id);
 
 void arch_mp_init_percpu(void);
 
+/* returns the mask of cpus that share a last level cache with |cpu|, including
+ * |cpu| itself. used by the scheduler to keep load balancing local where possible.
+ */
+cpu_mask_t arch_mp_cache_sibling_mask(cpu_num_t cpu);
+
 __END_CDECLS
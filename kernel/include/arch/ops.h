@@ -65,6 +65,9 @@ static void arch_spinloop_signal(void);
 /* arch optimized version of a page zero routine against a page aligned buffer */
 void arch_zero_page(void *);
 
+/* same as above, but avoids pulling the page into the cache where possible */
+void arch_zero_page_nontemporal(void *);
+
 /* give the specific arch a chance to override some routines */
 #include <arch/arch_ops.h>
 
@@ -110,6 +110,26 @@ static inline void atomic_store_64(volatile int64_t* ptr, int64_t newval) {
     __atomic_store_n(ptr, newval, __ATOMIC_SEQ_CST);
 }
 
+static inline uint32_t atomic_and_u32(volatile uint32_t* ptr, uint32_t val) {
+    return __atomic_fetch_and(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t atomic_or_u32(volatile uint32_t* ptr, uint32_t val) {
+    return __atomic_fetch_or(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t atomic_load_u32(volatile uint32_t* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t atomic_load_u32_relaxed(volatile uint32_t* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_store_u32_relaxed(volatile uint32_t* ptr, uint32_t newval) {
+    __atomic_store_n(ptr, newval, __ATOMIC_RELAXED);
+}
+
 static inline uint64_t atomic_swap_u64(volatile uint64_t* ptr, uint64_t val) {
     return __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST);
 }
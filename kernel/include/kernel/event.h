@@ -40,6 +40,8 @@ typedef struct event {
  * - Events may be signaled from interrupt context *but* the reschedule
  *   parameter must be false in that case.
  * - Events may not be waited upon from interrupt context.
+ * - Events may not be signaled while holding a run queue lock or a thread's
+ *   state lock, since waking a thread takes both.
  * - Events without FLAG_AUTOUNSIGNAL:
  *   - Wake up any waiting threads when signaled.
  *   - Continue to do so (no threads will wait) until unsignaled.
@@ -73,7 +75,7 @@ zx_status_t event_wait_with_mask(event_t*, uint signal_mask);
 
 int event_signal_etc(event_t*, bool reschedule, zx_status_t result);
 int event_signal(event_t*, bool reschedule);
-int event_signal_thread_locked(event_t*);
+int event_signal_handoff(event_t*, zx_status_t result);
 zx_status_t event_unsignal(event_t*);
 
 static inline bool event_initialized(const event_t* e) {
@@ -117,6 +119,12 @@ public:
         return event_signal_etc(&event_, false, status);
     }
 
+    // Same as Signal(), but honors the current thread's wake handoff hint,
+    // see thread_set_wake_handoff().
+    __WARN_UNUSED_RESULT int SignalHandoff(zx_status_t status = ZX_OK) {
+        return event_signal_handoff(&event_, status);
+    }
+
     zx_status_t Unsignal() {
         return event_unsignal(&event_);
     }
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <kernel/atomic.h>
 #include <kernel/cpu.h>
 #include <kernel/mutex.h>
 #include <limits.h>
@@ -76,9 +77,10 @@ struct mp_state {
     /* cpus that are currently schedulable */
     volatile cpu_mask_t active_cpus;
 
-    /* only safely accessible with thread lock held */
-    cpu_mask_t idle_cpus;
-    cpu_mask_t realtime_cpus;
+    /* each cpu updates its own bits, under its run queue lock. anyone else
+     * only gets a hint */
+    volatile cpu_mask_t idle_cpus;
+    volatile cpu_mask_t realtime_cpus;
 
     spin_lock_t ipi_task_lock;
     /* list of outstanding tasks for CPUs to execute.  Should only be
@@ -95,37 +97,37 @@ void mp_set_curr_cpu_online(bool online);
 void mp_set_curr_cpu_active(bool active);
 
 static inline int mp_is_cpu_active(cpu_num_t cpu) {
-    return atomic_load((int*)&mp.active_cpus) & cpu_num_to_mask(cpu);
+    return atomic_load_u32(&mp.active_cpus) & cpu_num_to_mask(cpu);
 }
 
 static inline int mp_is_cpu_idle(cpu_num_t cpu) {
-    return mp.idle_cpus & cpu_num_to_mask(cpu);
+    return atomic_load_u32(&mp.idle_cpus) & cpu_num_to_mask(cpu);
 }
 
 static inline int mp_is_cpu_online(cpu_num_t cpu) {
     return mp.online_cpus & cpu_num_to_mask(cpu);
 }
 
-/* must be called with the thread lock held */
+/* must be called with the cpu's run queue lock held */
 
 /* idle/busy is used to track if the cpu is running anything or has a non empty run queue
  * idle == (cpu run queue empty & cpu running idle thread)
  * busy == !idle
  */
 static inline void mp_set_cpu_idle(cpu_num_t cpu) {
-    mp.idle_cpus |= cpu_num_to_mask(cpu);
+    atomic_or_u32(&mp.idle_cpus, cpu_num_to_mask(cpu));
 }
 
 static inline void mp_set_cpu_busy(cpu_num_t cpu) {
-    mp.idle_cpus &= ~cpu_num_to_mask(cpu);
+    atomic_and_u32(&mp.idle_cpus, ~cpu_num_to_mask(cpu));
 }
 
 static inline cpu_mask_t mp_get_idle_mask(void) {
-    return mp.idle_cpus;
+    return atomic_load_u32(&mp.idle_cpus);
 }
 
 static inline cpu_mask_t mp_get_active_mask(void) {
-    return atomic_load((int*)&mp.active_cpus);
+    return atomic_load_u32(&mp.active_cpus);
 }
 
 static inline cpu_mask_t mp_get_online_mask(void) {
@@ -133,15 +135,15 @@ static inline cpu_mask_t mp_get_online_mask(void) {
 }
 
 static inline void mp_set_cpu_realtime(cpu_num_t cpu) {
-    mp.realtime_cpus |= cpu_num_to_mask(cpu);
+    atomic_or_u32(&mp.realtime_cpus, cpu_num_to_mask(cpu));
 }
 
 static inline void mp_set_cpu_non_realtime(cpu_num_t cpu) {
-    mp.realtime_cpus &= ~cpu_num_to_mask(cpu);
+    atomic_and_u32(&mp.realtime_cpus, ~cpu_num_to_mask(cpu));
 }
 
 static inline cpu_mask_t mp_get_realtime_mask(void) {
-    return mp.realtime_cpus;
+    return atomic_load_u32(&mp.realtime_cpus);
 }
 
 __END_CDECLS
@@ -23,15 +23,32 @@ __BEGIN_CDECLS
 /* Body of the mutex.
  * The val field holds either 0 or a pointer to the thread_t holding the mutex.
  * If one or more threads are blocking and queued up, MUTEX_FLAG_QUEUED is ORed in as well.
- * NOTE: MUTEX_FLAG_QUEUED is only manipulated under the THREAD_LOCK.
+ * While the holder is known to be running, MUTEX_FLAG_OWNER_RUNNING is ORed in too.
+ * NOTE: MUTEX_FLAG_QUEUED is only manipulated under the mutex's wait queue lock, and
+ * MUTEX_FLAG_OWNER_RUNNING only by the holder, on its own cpu.
  */
 typedef struct TA_CAP("mutex") mutex {
     uint32_t magic;
+    uint32_t options;
     uintptr_t val;
     wait_queue_t wait;
+    /* node in the holder's owned_pi_mutexes list, priority inheriting mutexes only */
+    struct list_node pi_node;
+    /* the highest effective priority of anyone blocked on a priority inheriting
+     * mutex. only raised under the wait queue lock, but read without it */
+    int pi_waiter_priority;
 } mutex_t;
 
 #define MUTEX_FLAG_QUEUED ((uintptr_t)1)
+#define MUTEX_FLAG_OWNER_RUNNING ((uintptr_t)2)
+#define MUTEX_FLAGS (MUTEX_FLAG_QUEUED | MUTEX_FLAG_OWNER_RUNNING)
+
+/* options for mutex_init_etc() */
+/* While a thread is blocked on the mutex, the holder runs at no less than the
+ * blocked thread's effective priority. If the holder is itself blocked on a
+ * priority inheriting mutex, that mutex's holder is lent the priority too, and
+ * so on down the chain. */
+#define MUTEX_OPTION_PRIORITY_INHERIT (1u << 0)
 
 /* accessors to extract the holder pointer from the val member */
 static inline uintptr_t mutex_val(const mutex_t* m) {
@@ -41,27 +58,42 @@ static inline uintptr_t mutex_val(const mutex_t* m) {
 
 static inline thread_t* mutex_holder(const mutex_t* m) {
     static_assert(sizeof(uintptr_t) == sizeof(uint64_t), "");
-    return (thread_t*)(mutex_val(m) & ~MUTEX_FLAG_QUEUED);
+    return (thread_t*)(mutex_val(m) & ~MUTEX_FLAGS);
 }
 
-#define MUTEX_INITIAL_VALUE(m)                      \
+#define MUTEX_INITIAL_VALUE_ETC(m, opts)            \
     {                                               \
         .magic = MUTEX_MAGIC,                       \
+        .options = (opts),                          \
         .val = 0,                                   \
         .wait = WAIT_QUEUE_INITIAL_VALUE((m).wait), \
+        .pi_node = LIST_INITIAL_CLEARED_VALUE,      \
+        .pi_waiter_priority = 0,                    \
     }
 
+#define MUTEX_INITIAL_VALUE(m) MUTEX_INITIAL_VALUE_ETC(m, 0)
+
 /* Rules for Mutexes:
  * - Mutexes are only safe to use from thread context.
  * - Mutexes are non-recursive.
+ * - A contended acquire spins briefly while the holder is running on another
+ *   cpu before blocking.
 */
 void mutex_init(mutex_t* m);
+void mutex_init_etc(mutex_t* m, uint32_t options);
 void mutex_destroy(mutex_t* m);
 void mutex_acquire(mutex_t* m) TA_ACQ(m);
 void mutex_release(mutex_t* m) TA_REL(m);
 
-/* special version of the above with the thread lock held */
-void mutex_release_thread_locked(mutex_t* m, bool resched) TA_REL(m);
+/* special version of the above for callers holding another wait queue's lock,
+ * which the woken waiter is left to run behind.
+ */
+void mutex_release_etc(mutex_t* m, bool resched) TA_REL(m);
+
+/* called by the scheduler as |t| is switched out, to stop anyone spinning on
+ * a mutex it holds. interrupts must be disabled.
+ */
+void mutex_owner_switched_out(thread_t* t);
 
 /* does the current thread hold the mutex? */
 static inline bool is_mutex_held(const mutex_t* m) {
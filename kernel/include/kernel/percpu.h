@@ -6,6 +6,7 @@
 #pragma once
 
 #include <arch/ops.h>
+#include <kernel/spinlock.h>
 #include <kernel/stats.h>
 #include <kernel/thread.h>
 #include <kernel/timer.h>
@@ -16,16 +17,41 @@
 __BEGIN_CDECLS
 
 struct percpu {
-    /* per cpu timer queue */
-    struct list_node timer_queue;
+    /* per cpu timer queue, protected by timer_lock. timer_lock nests inside
+     * the scheduler locks and, when two are needed, is taken in cpu order.
+     */
+    spin_lock_t timer_lock;
+    struct timer_queue timer_queue;
 
     /* per cpu preemption timer */
     timer_t preempt_timer;
 
-    /* per cpu run queue and bitmap to indicate which queues are non empty */
+    /* per cpu run queue and bitmap to indicate which queues are non empty.
+     * protected by run_queue_lock, see the lock ordering rules in sched.c.
+     */
+    spin_lock_t run_queue_lock;
     struct list_node run_queue[NUM_PRIORITIES];
     uint32_t run_queue_bitmap;
 
+    /* number of threads currently sitting in the run queue */
+    uint32_t run_queue_len;
+
+    /* the thread that was last switched away from here and still has to be put
+     * in another cpu's run queue, once the switch is complete. run_queue_lock.
+     */
+    thread_t* migrating_thread;
+
+    /* number of run queue locks this cpu holds, so that code which may be
+     * reached from inside the scheduler can tell without looking at every
+     * cpu's lock. only touched by this cpu, with interrupts disabled.
+     */
+    uint32_t run_queue_locks_held;
+
+    /* the thread the running thread handed its time slice to, which other cpus
+     * leave alone until it has had the cpu. run_queue_lock.
+     */
+    thread_t* handoff_thread;
+
     /* timestamp of the last reschedule IPI sent to this cpu */
     /* 0 means no pending IPI */
     zx_time_t ipi_timestamp;
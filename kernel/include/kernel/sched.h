@@ -13,19 +13,74 @@
 
 /* scheduler interface, used internally by thread.c */
 /* not intended to be used by regular kernel code */
+/* see the locking notes in sched.c for what each of these expects to be held */
 void sched_init_early(void);
 
+/* the current thread has put itself in a blocked state with its state_lock
+ * held. switch away, dropping the state_lock on the way.
+ */
 void sched_block(void);
+
+/* called with interrupts disabled and no scheduler locks held */
 void sched_yield(void);
 void sched_preempt(void);
 void sched_reschedule(void);
-void sched_resched_internal(void);
+
+/* finish the context switch that started the current thread running, for
+ * threads that don't start out of sched_block() and friends
+ */
+void sched_finish_switch(void);
+
 void sched_unblock_idle(thread_t* t);
-void sched_migrate(thread_t* t);
 
+/* set the thread's affinity mask, moving it off any cpu it's no longer allowed
+ * on. t->state_lock must be held. return true if the caller should locally
+ * reschedule.
+ */
+bool sched_set_affinity(thread_t* t, cpu_mask_t affinity) __WARN_UNUSED_RESULT;
+
+/* make a thread runnable. t->state_lock must be held. */
 /* return true if the thread was placed on the current cpu's run queue */
 /* this usually means the caller should locally reschedule soon */
 bool sched_unblock(thread_t* t) __WARN_UNUSED_RESULT;
+
+/* same as above for a list of threads linked through queue_node, taking each
+ * one's state_lock in turn
+ */
 bool sched_unblock_list(struct list_node* list) __WARN_UNUSED_RESULT;
 
+/* same as sched_unblock(), but |t| is queued on the current cpu and given the
+ * rest of our time slice. see thread_set_wake_handoff().
+ */
+bool sched_unblock_handoff(thread_t* t) __WARN_UNUSED_RESULT;
+
 void sched_transition_off_cpu(cpu_num_t old_cpu);
+
+/* wait for a thread that has died to be completely switched out, after which
+ * its stack and structure can be freed
+ */
+void sched_sync_switch_out(thread_t* t);
+
+/* the priority the scheduler is currently running the thread at */
+int sched_get_effective_priority(const thread_t* t);
+
+/* set the priority the thread inherits from mutex waiters; 0 clears it.
+ * a thread sitting in a run queue is moved to the queue for its new priority.
+ * t->state_lock must be held.
+ * return true if the caller should locally reschedule.
+ */
+bool sched_inherit_priority(thread_t* t, int pri) __WARN_UNUSED_RESULT;
+
+/* total time the thread has spent running. t->state_lock must be held. */
+zx_duration_t sched_get_runtime(thread_t* t);
+
+/* returns true if the current cpu's run queue is empty. only a hint, since
+ * other cpus may insert or steal threads at any time.
+ * interrupts must be disabled.
+ */
+bool sched_local_run_queue_empty(void);
+
+/* returns true if the current cpu is inside the scheduler with a run queue
+ * locked, where nothing may be woken up. interrupts must be disabled.
+ */
+bool sched_run_queue_held(void);
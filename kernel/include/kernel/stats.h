@@ -19,6 +19,9 @@ struct cpu_stats {
     ulong irq_preempts;
     ulong preempts;
     ulong yields;
+    ulong steals;     /* threads pulled from another cpu's run queue when going idle */
+    ulong rebalances; /* threads pushed to another cpu's run queue */
+    ulong handoffs;   /* threads woken straight onto this cpu by a thread about to block */
 
     /* cpu level interrupts and exceptions */
     ulong interrupts;  /* hardware interrupts, minus timer interrupts or inter-processor interrupts */
@@ -26,6 +29,7 @@ struct cpu_stats {
     ulong timers;      /* timer callbacks */
     ulong perf_ints;   /* performance monitor interrupts */
     ulong page_faults; /* page faults */
+    ulong fault_around_pages; /* pages mapped ahead of use while handling a page fault */
     ulong exceptions;  /* exceptions such as undefined opcode */
     ulong syscalls;
 
@@ -43,3 +47,8 @@ __END_CDECLS
     do {                                                                           \
         __atomic_fetch_add(&get_local_percpu()->stats.name, 1u, __ATOMIC_RELAXED); \
     } while (0)
+
+#define CPU_STATS_ADD(name, n)                                                     \
+    do {                                                                           \
+        __atomic_fetch_add(&get_local_percpu()->stats.name, n, __ATOMIC_RELAXED);  \
+    } while (0)
@@ -82,6 +82,10 @@ typedef struct thread {
     int magic;
     struct list_node thread_list_node;
 
+    /* protects the thread's state when it isn't running or about to run, see
+     * the locking notes in sched.c */
+    spin_lock_t state_lock;
+
     /* active bits */
     struct list_node queue_node;
     enum thread_state state;
@@ -92,8 +96,17 @@ typedef struct thread {
 
     int base_priority;
     int priority_boost;
-
-    /* current cpu the thread is either running on or in the ready queue, undefined otherwise */
+    /* priority lent by a thread blocked on a priority inheriting mutex we hold, 0 if none */
+    int inherited_priority;
+    /* priority inheriting mutexes we hold. only touched by this thread, or
+     * by whoever wakes it up from a mutex while it is still blocked */
+    struct list_node owned_pi_mutexes;
+    /* the priority inheriting mutex we're blocked on, if any. protected by state_lock */
+    struct mutex* blocking_pi_mutex;
+    /* the mutex, if any, whose value says we're running. only touched on our own cpu */
+    struct mutex* running_mutex;
+
+    /* current cpu the thread is either running on or in the ready queue, INVALID_CPU otherwise */
     cpu_num_t curr_cpu;
     cpu_num_t last_cpu;      /* last cpu the thread ran on, INVALID_CPU if it's never run */
     cpu_mask_t cpu_affinity; /* mask of cpus that this thread can run on */
@@ -123,6 +136,10 @@ typedef struct thread {
     /* are we allowed to be interrupted on the current thing we're blocked/sleeping on */
     bool interruptable;
 
+    /* a thread we wake through a handoff point should run on our cpu, see
+     * thread_set_wake_handoff() */
+    bool wake_handoff;
+
     /* non-NULL if stopped in an exception */
     const struct arch_exception_context* exception_context;
 
@@ -282,7 +299,10 @@ static inline bool thread_is_real_time_or_idle(thread_t* t) {
 thread_t* get_current_thread(void);
 void set_current_thread(thread_t*);
 
-/* scheduler lock */
+/* protects the thread list, thread lifetime (join, detach, exit) and thread
+ * flags. the scheduler itself does not need it, see the locking notes in
+ * sched.c.
+ */
 extern spin_lock_t thread_lock;
 
 #define THREAD_LOCK(state)         \
@@ -294,6 +314,19 @@ static inline bool thread_lock_held(void) {
     return spin_lock_held(&thread_lock);
 }
 
+/* Hint that the current thread is about to block until a thread it wakes has
+ * done some work for it, as in a synchronous rpc. Only wakeups that go through
+ * wait_queue_wake_one_handoff() honor it, so that the thread woken is the one being
+ * waited on and not whoever else happens to be released on the way, such as
+ * a mutex waiter. That thread is queued on the current cpu ahead of its peers
+ * and given what is left of our time slice, instead of being sent to another
+ * cpu. The hint is consumed by the first such wakeup; clear it afterwards in
+ * case nothing was woken.
+ */
+static inline void thread_set_wake_handoff(bool handoff) {
+    get_current_thread()->wake_handoff = handoff;
+}
+
 /* thread local storage */
 static inline void* tls_get(uint entry) {
     return get_current_thread()->tls[entry];
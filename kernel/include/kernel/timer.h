@@ -30,7 +30,14 @@ enum slack_mode {
 
 typedef struct timer {
     int magic;
-    struct list_node node;
+
+    // Links for the per cpu timer queue, a balanced (AVL) tree ordered by
+    // scheduled_time. |height| is 0 when the timer is not queued.
+    struct timer* parent;
+    struct timer* left;
+    struct timer* right;
+    int height;
+    volatile int queue_cpu; // <0 if not queued
 
     zx_time_t scheduled_time;
     int64_t slack; // Stores the applied slack adjustment from
@@ -45,7 +52,11 @@ typedef struct timer {
 #define TIMER_INITIAL_VALUE(t)              \
     {                                       \
         .magic = TIMER_MAGIC,               \
-        .node = LIST_INITIAL_CLEARED_VALUE, \
+        .parent = NULL,                     \
+        .left = NULL,                       \
+        .right = NULL,                      \
+        .height = 0,                        \
+        .queue_cpu = -1,                    \
         .scheduled_time = 0,                \
         .slack = 0,                         \
         .callback = NULL,                   \
@@ -54,6 +65,14 @@ typedef struct timer {
         .cancel = false,                    \
     }
 
+/* A cpu's pending timers. Insertion and removal are O(log n); the earliest
+ * timer is kept at hand in |head|.
+ */
+struct timer_queue {
+    timer_t* root;
+    timer_t* head;
+};
+
 /* Rules for Timers:
  * - Timer callbacks occur from interrupt context
  * - Timers may be programmed or canceled from interrupt or thread context
@@ -10,6 +10,7 @@
 #include <arch/defines.h>
 #include <arch/ops.h>
 #include <arch/thread.h>
+#include <kernel/spinlock.h>
 #include <list.h>
 #include <sys/types.h>
 #include <zircon/compiler.h>
@@ -22,25 +23,52 @@ __BEGIN_CDECLS
 
 typedef struct wait_queue {
     int magic;
+    spin_lock_t lock;
     struct list_node list;
     int count;
+
+    /* threads woken while the lock is held. they are only made runnable once
+     * it has been dropped, see wait_queue_unlock().
+     */
+    struct list_node woken;
+    uint woken_flags;
 } wait_queue_t;
 
-#define WAIT_QUEUE_INITIAL_VALUE(q)           \
-    {                                         \
-        .magic = WAIT_QUEUE_MAGIC,            \
-        .list = LIST_INITIAL_VALUE((q).list), \
-        .count = 0                            \
+#define WAIT_QUEUE_INITIAL_VALUE(q)             \
+    {                                           \
+        .magic = WAIT_QUEUE_MAGIC,              \
+        .lock = SPIN_LOCK_INITIAL_VALUE,        \
+        .list = LIST_INITIAL_VALUE((q).list),   \
+        .count = 0,                             \
+        .woken = LIST_INITIAL_VALUE((q).woken), \
+        .woken_flags = 0                        \
     }
 
 /* wait queue primitive */
-/* NOTE: must be inside critical section when using these */
+/* NOTE: the wait queue must be locked with wait_queue_lock() when using these,
+ * apart from init and destroy.
+ */
 void wait_queue_init(wait_queue_t* wait);
 
 void wait_queue_destroy(wait_queue_t*);
 
+/* lock a wait queue, disabling interrupts */
+static inline void wait_queue_lock(wait_queue_t* wait, spin_lock_saved_state_t* state) {
+    spin_lock_irqsave(&wait->lock, *state);
+}
+
+/*
+ * unlock a wait queue and restore interrupts.
+ * threads woken while it was locked are made runnable here, after the lock has
+ * been dropped, so that neither the waker nor the woken thread touches the wait
+ * queue once the woken thread can run and perhaps free it.
+ */
+void wait_queue_unlock(wait_queue_t* wait, spin_lock_saved_state_t state);
+
 /*
- * block on a wait queue.
+ * block on a locked wait queue.
+ * the wait queue is unlocked by the time this returns, but interrupts stay
+ * disabled until the caller restores the state saved by wait_queue_lock().
  * return status is whatever the caller of wait_queue_wake_*() specifies.
  * a deadline other than ZX_TIME_INFINITE will abort at the specified time
  * and return ZX_ERR_TIMED_OUT. a deadline in the past will immediately return.
@@ -48,7 +76,9 @@ void wait_queue_destroy(wait_queue_t*);
 zx_status_t wait_queue_block(wait_queue_t*, zx_time_t deadline);
 
 /*
- * block on a wait queue, ignoring existing signals in |signal_mask|.
+ * block on a locked wait queue, ignoring existing signals in |signal_mask|.
+ * the wait queue is unlocked by the time this returns, but interrupts stay
+ * disabled until the caller restores the state saved by wait_queue_lock().
  * return status is whatever the caller of wait_queue_wake_*() specifies.
  * a deadline other than ZX_TIME_INFINITE will abort at the specified time
  * and return ZX_ERR_TIMED_OUT. a deadline in the past will immediately return.
@@ -57,13 +87,23 @@ zx_status_t wait_queue_block_with_mask(wait_queue_t*, zx_time_t deadline,
                                        uint signal_mask);
 
 /*
- * release one or more threads from the wait queue.
+ * release one or more threads from the wait queue. they run once it is unlocked.
  * reschedule = should the system reschedule if any is released.
  * wait_queue_error = what wait_queue_block() should return for the blocking thread.
  */
 int wait_queue_wake_one(wait_queue_t*, bool reschedule, zx_status_t wait_queue_error);
 int wait_queue_wake_all(wait_queue_t*, bool reschedule, zx_status_t wait_queue_error);
-struct thread* wait_queue_dequeue_one(wait_queue_t* wait, zx_status_t wait_queue_error);
+
+/* same as wait_queue_wake_one(), but returns the thread released, if any.
+ * the caller may set it up further until the wait queue is unlocked.
+ */
+struct thread* wait_queue_dequeue_one(wait_queue_t* wait, bool reschedule,
+                                      zx_status_t wait_queue_error);
+
+/* release one thread, handing it the cpu if the current thread asked for a
+ * wake handoff. see thread_set_wake_handoff().
+ */
+int wait_queue_wake_one_handoff(wait_queue_t*, zx_status_t wait_queue_error);
 
 /* is the wait queue currently empty */
 bool wait_queue_is_empty(wait_queue_t*);
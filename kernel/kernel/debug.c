@@ -128,9 +128,13 @@ static int cmd_threadstats(int argc, const cmd_args* argv, uint32_t flags) {
         printf("\tcontext_switches: %lu\n", percpu[i].stats.context_switches);
         printf("\tpreempts: %lu\n", percpu[i].stats.preempts);
         printf("\tyields: %lu\n", percpu[i].stats.yields);
+        printf("\tsteals: %lu\n", percpu[i].stats.steals);
+        printf("\trebalances: %lu\n", percpu[i].stats.rebalances);
+        printf("\thandoffs: %lu\n", percpu[i].stats.handoffs);
         printf("\tinterrupts: %lu\n", percpu[i].stats.interrupts);
         printf("\ttimer interrupts: %lu\n", percpu[i].stats.timer_ints);
         printf("\ttimers: %lu\n", percpu[i].stats.timers);
+        printf("\tfault-around pages: %lu\n", percpu[i].stats.fault_around_pages);
     }
 
     return 0;
@@ -70,7 +70,8 @@ static zx_status_t event_wait_worker(event_t* e, zx_time_t deadline,
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    wait_queue_lock(&e->wait, &state);
 
     current_thread->interruptable = interruptable;
 
@@ -80,15 +81,15 @@ static zx_status_t event_wait_worker(event_t* e, zx_time_t deadline,
             /* autounsignal flag lets one thread fall through before unsignaling */
             e->signaled = false;
         }
+        wait_queue_unlock(&e->wait, state);
     } else {
         /* unsignaled, block here */
         ret = wait_queue_block_with_mask(&e->wait, deadline, signal_mask);
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
     }
 
     current_thread->interruptable = false;
 
-    THREAD_UNLOCK(state);
-
     return ret;
 }
 
@@ -132,23 +133,26 @@ zx_status_t event_wait_with_mask(event_t* e, uint signal_mask) {
     return event_wait_worker(e, ZX_TIME_INFINITE, true, signal_mask);
 }
 
-static int event_signal_internal(event_t* e, bool reschedule, zx_status_t wait_result, bool thread_lock_held) {
+static int event_signal_internal(event_t* e, bool reschedule, zx_status_t wait_result,
+                                 bool handoff) {
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
     DEBUG_ASSERT(!reschedule || !arch_in_int_handler());
+    DEBUG_ASSERT(!handoff || !reschedule);
 
-    // conditionally acquire/release the thread lock
-    // NOTE: using the manual spinlock grab/release instead of THREAD_LOCK because
-    // the state variable needs to exit in either path.
-    spin_lock_saved_state_t state = 0;
-    if (!thread_lock_held)
-        spin_lock_irqsave(&thread_lock, state);
+    spin_lock_saved_state_t state;
+    wait_queue_lock(&e->wait, &state);
 
     int wake_count = 0;
 
     if (!e->signaled) {
         if (e->flags & EVENT_FLAG_AUTOUNSIGNAL) {
             /* try to release one thread and leave unsignaled if successful */
-            if ((wake_count = wait_queue_wake_one(&e->wait, reschedule, wait_result)) <= 0) {
+            if (handoff) {
+                wake_count = wait_queue_wake_one_handoff(&e->wait, wait_result);
+            } else {
+                wake_count = wait_queue_wake_one(&e->wait, reschedule, wait_result);
+            }
+            if (wake_count <= 0) {
                 /*
                  * if we didn't actually find a thread to wake up, go to
                  * signaled state and let the next call to event_wait
@@ -159,13 +163,14 @@ static int event_signal_internal(event_t* e, bool reschedule, zx_status_t wait_r
         } else {
             /* release all threads and remain signaled */
             e->signaled = true;
-            wake_count = wait_queue_wake_all(&e->wait, reschedule, wait_result);
+            if (handoff)
+                wake_count = wait_queue_wake_one_handoff(&e->wait, wait_result);
+            wake_count += wait_queue_wake_all(&e->wait, reschedule, wait_result);
         }
     }
 
-    // conditionally THREAD_UNLOCK
-    if (!thread_lock_held)
-        spin_unlock_irqrestore(&thread_lock, state);
+    // the woken threads become runnable here
+    wait_queue_unlock(&e->wait, state);
 
     return wake_count;
 }
@@ -214,12 +219,17 @@ int event_signal(event_t* e, bool reschedule) {
     return event_signal_internal(e, reschedule, ZX_OK, false);
 }
 
-/* same as above, but the thread lock must already be held */
-int event_signal_thread_locked(event_t* e) {
-    DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-
-    return event_signal_internal(e, false, ZX_OK, true);
+/**
+ * @brief  Signal an event, handing the cpu to the thread it wakes
+ *
+ * Same as event_signal_etc() without rescheduling, except that if the
+ * current thread asked for a wake handoff the first waiter is queued on
+ * the current cpu. See thread_set_wake_handoff().
+ *
+ * @return  Returns the number of threads that have been unblocked.
+ */
+int event_signal_handoff(event_t* e, zx_status_t wait_result) {
+    return event_signal_internal(e, false, wait_result, true);
 }
 
 /**
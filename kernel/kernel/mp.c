@@ -226,8 +226,9 @@ void mp_sync_exec(mp_ipi_target_t target, cpu_mask_t mask, mp_sync_task_t task,
 
 static void mp_unplug_trampoline(void) __NO_RETURN;
 static void mp_unplug_trampoline(void) {
-    /* We're still holding the thread lock from the reschedule that took us
-     * here. */
+    /* finish the context switch that took us here, which leaves our run queue
+     * unlocked. interrupts stay disabled. */
+    sched_finish_switch();
 
     thread_t* ct = get_current_thread();
     event_t* unplug_done = ct->arg;
@@ -243,8 +244,6 @@ static void mp_unplug_trampoline(void) {
      * should be quick), then this CPU may execute the task. */
     mp_set_curr_cpu_online(false);
 
-    spin_unlock(&thread_lock);
-
     /* do *not* enable interrupts, we want this CPU to never receive another
      * interrupt */
 
@@ -383,17 +382,17 @@ cleanup_mutex:
 
 void mp_set_curr_cpu_online(bool online) {
     if (online) {
-        atomic_or((volatile int*)&mp.online_cpus, cpu_num_to_mask(arch_curr_cpu_num()));
+        atomic_or_u32(&mp.online_cpus, cpu_num_to_mask(arch_curr_cpu_num()));
     } else {
-        atomic_and((volatile int*)&mp.online_cpus, ~cpu_num_to_mask(arch_curr_cpu_num()));
+        atomic_and_u32(&mp.online_cpus, ~cpu_num_to_mask(arch_curr_cpu_num()));
     }
 }
 
 void mp_set_curr_cpu_active(bool active) {
     if (active) {
-        atomic_or((volatile int*)&mp.active_cpus, cpu_num_to_mask(arch_curr_cpu_num()));
+        atomic_or_u32(&mp.active_cpus, cpu_num_to_mask(arch_curr_cpu_num()));
     } else {
-        atomic_and((volatile int*)&mp.active_cpus, ~cpu_num_to_mask(arch_curr_cpu_num()));
+        atomic_and_u32(&mp.active_cpus, ~cpu_num_to_mask(arch_curr_cpu_num()));
     }
 }
 
@@ -23,11 +23,124 @@
 #include <kernel/sched.h>
 #include <kernel/thread.h>
 #include <lib/ktrace.h>
+#include <platform.h>
 #include <trace.h>
 #include <zircon/types.h>
 
 #define LOCAL_TRACE 0
 
+/* how long a contended acquire may spin on a running holder before blocking */
+#define MUTEX_SPIN_TIMEOUT ZX_USEC(10)
+
+/* how long lending priority down a chain of mutexes may wait on a busy one */
+#define MUTEX_PI_CHAIN_TIMEOUT ZX_USEC(50)
+
+static_assert(__alignof__(thread_t) > MUTEX_FLAGS, "mutex flags overlap the holder pointer");
+
+// Take MUTEX_FLAG_OWNER_RUNNING out of the value of m, which ct holds.
+static void mutex_clear_owner_running(mutex_t* m, thread_t* ct) {
+    DEBUG_ASSERT(mutex_holder(m) == ct);
+    atomic_and_u64(&m->val, ~(uint64_t)MUTEX_FLAG_OWNER_RUNNING);
+}
+
+// Note that ct now holds m, and has marked itself running in m's value.
+// Priority inheriting mutexes are tracked per holder so that releasing one can
+// work out what is still owed through the others.
+//
+// Only the most recently acquired mutex advertises its holder as running, so a
+// nested acquire takes the flag off the outer one. Spinners on that one just
+// block, which is what they'd have done before spinning existed.
+//
+// Being switched out between taking m and getting here, or between giving up
+// running_mutex and releasing, leaves the flag set while we're off the cpu.
+// That only costs a spinner its time budget.
+static inline void mutex_acquired(mutex_t* m, thread_t* ct) {
+    mutex_t* prev = ct->running_mutex;
+    ct->running_mutex = m;
+    if (unlikely(prev != NULL))
+        mutex_clear_owner_running(prev, ct);
+
+    if (unlikely(m->options & MUTEX_OPTION_PRIORITY_INHERIT))
+        list_add_head(&ct->owned_pi_mutexes, &m->pi_node);
+}
+
+// The highest effective priority of anyone blocked on m, 0 if nobody is.
+// Called with m's wait queue lock held. The waiters' priorities are read
+// without their locks; anyone raising one goes on to raise m's
+// pi_waiter_priority as well, under m's wait queue lock.
+static int mutex_waiter_priority(mutex_t* m) {
+    int pri = 0;
+    thread_t* w;
+    list_for_every_entry (&m->wait.list, w, thread_t, queue_node) {
+        int wpri = sched_get_effective_priority(w);
+        if (wpri > pri)
+            pri = wpri;
+    }
+    return pri;
+}
+
+// Lend pri to the holder of m, and if that holder is itself blocked on a
+// priority inheriting mutex, on to that mutex's holder, and so on down the
+// chain. Called with m's wait queue lock held and MUTEX_FLAG_QUEUED set, which
+// keeps m's holder from letting go of it.
+//
+// A thread's state_lock ranks above the wait queue lock of the mutex it's
+// blocked on, so each step only tries for that lock, letting go of the
+// thread's lock and trying again while it's busy. Holding the wait queue lock
+// of the mutex the thread holds keeps it from going anywhere meanwhile. If
+// that lock stays busy, say because another thread is lending priority the
+// other way round a deadlock, the rest of the chain is left alone.
+//
+// The walk stops at the first holder already running at pri or above, which
+// is where its own blocking left off lending.
+static void mutex_lend_priority(mutex_t* m, int pri) {
+    mutex_t* cur = m;
+    for (;;) {
+        thread_t* holder = mutex_holder(cur);
+        spin_lock(&holder->state_lock);
+        if (pri <= sched_get_effective_priority(holder)) {
+            spin_unlock(&holder->state_lock);
+            break;
+        }
+        // we're about to block, which reschedules anyway
+        (void)sched_inherit_priority(holder, pri);
+
+        mutex_t* next;
+        zx_time_t deadline = 0;
+        for (;;) {
+            next = holder->blocking_pi_mutex;
+            // coming back around to m means a deadlock, nothing more to lend
+            if (next == NULL || next == m)
+                break;
+            if (!spin_trylock(&next->wait.lock))
+                break;
+
+            zx_time_t now = current_time();
+            if (deadline == 0) {
+                deadline = now + MUTEX_PI_CHAIN_TIMEOUT;
+            } else if (now >= deadline) {
+                next = NULL;
+                break;
+            }
+            spin_unlock(&holder->state_lock);
+            arch_spinloop_pause();
+            spin_lock(&holder->state_lock);
+        }
+        spin_unlock(&holder->state_lock);
+        if (cur != m)
+            spin_unlock(&cur->wait.lock);
+        if (next == NULL || next == m)
+            return;
+
+        // the holder is queued on next, so it has a holder of its own
+        if (pri > next->pi_waiter_priority)
+            atomic_store(&next->pi_waiter_priority, pri);
+        cur = next;
+    }
+    if (cur != m)
+        spin_unlock(&cur->wait.lock);
+}
+
 /**
  * @brief  Initialize a mutex_t
  */
@@ -35,6 +148,14 @@ void mutex_init(mutex_t* m) {
     *m = (mutex_t)MUTEX_INITIAL_VALUE(*m);
 }
 
+/**
+ * @brief  Initialize a mutex_t with MUTEX_OPTION_* flags
+ */
+void mutex_init_etc(mutex_t* m, uint32_t options) {
+    DEBUG_ASSERT((options & ~MUTEX_OPTION_PRIORITY_INHERIT) == 0);
+    *m = (mutex_t)MUTEX_INITIAL_VALUE_ETC(*m, options);
+}
+
 /**
  * @brief  Destroy a mutex_t
  *
@@ -59,6 +180,51 @@ void mutex_destroy(mutex_t* m) {
     wait_queue_destroy(&m->wait);
 }
 
+void mutex_owner_switched_out(thread_t* t) {
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    mutex_t* m = t->running_mutex;
+    if (m != NULL) {
+        t->running_mutex = NULL;
+        mutex_clear_owner_running(m, t);
+    }
+}
+
+// Spin while the holder is running on another cpu, on the theory that it will
+// drop the mutex sooner than we could block and be woken up again. Returns true
+// if the mutex was acquired.
+//
+// Only the mutex's own value is looked at, never the holder, which may release
+// the mutex and exit under us. Gives up as soon as anyone is queued, since a
+// contended release hands the mutex directly to the first waiter and a spinner
+// can never win it, or once the holder is no longer flagged as running or the
+// time budget runs out.
+static bool mutex_spin(mutex_t* m, thread_t* ct) {
+    zx_time_t deadline = 0;
+
+    for (;;) {
+        uintptr_t oldval = mutex_val(m);
+        if (oldval == 0) {
+            if (atomic_cmpxchg_u64(&m->val, &oldval, (uintptr_t)ct | MUTEX_FLAG_OWNER_RUNNING)) {
+                mutex_acquired(m, ct);
+                return true;
+            }
+            continue;
+        }
+        if ((oldval & MUTEX_FLAGS) != MUTEX_FLAG_OWNER_RUNNING)
+            return false;
+
+        zx_time_t now = current_time();
+        if (deadline == 0) {
+            deadline = now + MUTEX_SPIN_TIMEOUT;
+        } else if (now >= deadline) {
+            return false;
+        }
+
+        arch_spinloop_pause();
+    }
+}
+
 /**
  * @brief  Acquire the mutex
  */
@@ -72,8 +238,9 @@ void mutex_acquire(mutex_t* m) TA_NO_THREAD_SAFETY_ANALYSIS {
 retry:
     // fast path: assume its unheld, try to grab it
     oldval = 0;
-    if (likely(atomic_cmpxchg_u64(&m->val, &oldval, (uintptr_t)ct))) {
+    if (likely(atomic_cmpxchg_u64(&m->val, &oldval, (uintptr_t)ct | MUTEX_FLAG_OWNER_RUNNING))) {
         // acquired it cleanly
+        mutex_acquired(m, ct);
         return;
     }
 
@@ -83,23 +250,46 @@ retry:
               ct, ct->name, m);
 #endif
 
+    // the holder may be about to let go, try not to block
+    if (mutex_spin(m, ct)) {
+        return;
+    }
+
     // we contended with someone else, will probably need to block
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    wait_queue_lock(&m->wait, &state);
 
     // save the current state and check to see if it wasn't released in the interim
     oldval = mutex_val(m);
     if (unlikely(oldval == 0)) {
-        THREAD_UNLOCK(state);
+        wait_queue_unlock(&m->wait, state);
         goto retry;
     }
 
-    // try to exchange again with a flag indicating that we're blocking is set
+    // try to exchange again with a flag indicating that we're blocking is set.
+    // this also fails if the holder has just been switched out.
     if (unlikely(!atomic_cmpxchg_u64(&m->val, &oldval, oldval | MUTEX_FLAG_QUEUED))) {
         // if we fail, just start over from the top
-        THREAD_UNLOCK(state);
+        wait_queue_unlock(&m->wait, state);
         goto retry;
     }
 
+    // lend the holder our priority so it can't be starved while we wait. it
+    // can't release without the wait queue lock now that QUEUED is set, so it
+    // is safe to touch. we stay locked until we're in the wait queue, so
+    // nobody lending priority through us can find m before we're on it.
+    if (unlikely(m->options & MUTEX_OPTION_PRIORITY_INHERIT)) {
+        int pri = sched_get_effective_priority(ct);
+        if (pri > m->pi_waiter_priority)
+            atomic_store(&m->pi_waiter_priority, pri);
+
+        spin_lock(&ct->state_lock);
+        ct->blocking_pi_mutex = m;
+        spin_unlock(&ct->state_lock);
+
+        mutex_lend_priority(m, pri);
+    }
+
     // we have signalled that we're blocking, so drop into the wait queue
     zx_status_t ret = wait_queue_block(&m->wait, ZX_TIME_INFINITE);
     if (unlikely(ret < ZX_OK)) {
@@ -109,23 +299,38 @@ retry:
               ret, m, ct, __GET_FRAME());
     }
 
-    // someone must have woken us up, we should own the mutex now
+    // someone must have woken us up, we should own the mutex now. the
+    // releaser has already added it to our owned list.
     DEBUG_ASSERT(ct == mutex_holder(m));
 
-    THREAD_UNLOCK(state);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 // shared implementation of release
-static inline void mutex_release_internal(mutex_t* m, bool reschedule, bool thread_lock_held)
+static inline void mutex_release_internal(mutex_t* m, bool reschedule)
     TA_NO_THREAD_SAFETY_ANALYSIS {
     thread_t* ct = get_current_thread();
     uintptr_t oldval;
 
-    // in case there's no contention, try the fast path
-    oldval = (uintptr_t)ct;
-    if (likely(atomic_cmpxchg_u64(&m->val, &oldval, 0))) {
-        // we're done, exit
-        return;
+    // stop tracking it before anyone else can own it and reuse the node
+    bool pi = m->options & MUTEX_OPTION_PRIORITY_INHERIT;
+    if (unlikely(pi))
+        list_delete(&m->pi_node);
+
+    // nothing spinning on m should think we're still running once it's gone
+    if (ct->running_mutex == m)
+        ct->running_mutex = NULL;
+
+    // in case there's no contention, try the fast path. the running flag may
+    // be cleared under us if we're switched out, so go around again if so.
+    for (;;) {
+        oldval = mutex_val(m);
+        if ((oldval & ~MUTEX_FLAG_OWNER_RUNNING) != (uintptr_t)ct)
+            break;
+        if (likely(atomic_cmpxchg_u64(&m->val, &oldval, 0))) {
+            // we're done, exit
+            return;
+        }
     }
 
 // must have been some contention, try the slow release
@@ -138,53 +343,78 @@ static inline void mutex_release_internal(mutex_t* m, bool reschedule, bool thre
     }
 #endif
 
-    // conditionally acquire/release the thread lock
-    // NOTE: using the manual spinlock grab/release instead of THREAD_LOCK because
-    // the state variable needs to exit in either path.
     spin_lock_saved_state_t state;
-    if (!thread_lock_held)
-        spin_lock_irqsave(&thread_lock, state);
+    wait_queue_lock(&m->wait, &state);
 
-    // release a thread in the wait queue
-    thread_t* t = wait_queue_dequeue_one(&m->wait, ZX_OK);
+    // release a thread in the wait queue. it becomes runnable once the wait queue is unlocked.
+    thread_t* t = wait_queue_dequeue_one(&m->wait, reschedule, ZX_OK);
     DEBUG_ASSERT_MSG(t, "mutex_release: wait queue didn't have anything, but m->val = %#" PRIxPTR "\n", mutex_val(m));
 
-    // we woke up a thread, mark the mutex owned by that thread
+    bool local_resched = false;
+    if (unlikely(pi)) {
+        int pri = mutex_waiter_priority(m);
+        atomic_store(&m->pi_waiter_priority, pri);
+
+        // the new owner stays blocked until the wait queue is unlocked, so its
+        // list is ours to touch. it is lent the priority of whoever is still waiting.
+        list_add_head(&t->owned_pi_mutexes, &m->pi_node);
+        spin_lock(&t->state_lock);
+        t->blocking_pi_mutex = NULL;
+        if (pri > sched_get_effective_priority(t)) {
+            (void)sched_inherit_priority(t, pri);
+        }
+        spin_unlock(&t->state_lock);
+
+        // hand back what we were lent through this mutex, but keep whatever
+        // is still owed by waiters on the other ones we hold. anyone lending us
+        // more through one of those raises its pi_waiter_priority before
+        // taking our state_lock, so reading them under it can't miss a loan.
+        spin_lock(&ct->state_lock);
+        pri = 0;
+        mutex_t* om;
+        list_for_every_entry (&ct->owned_pi_mutexes, om, mutex_t, pi_node) {
+            int opri = atomic_load(&om->pi_waiter_priority);
+            if (opri > pri)
+                pri = opri;
+        }
+        local_resched = sched_inherit_priority(ct, pri);
+        spin_unlock(&ct->state_lock);
+    }
+
+    // we woke up a thread, mark the mutex owned by that thread. it isn't
+    // running yet, so anyone who comes along will go to the wait queue.
     uintptr_t newval = (uintptr_t)t | (wait_queue_is_empty(&m->wait) ? 0 : MUTEX_FLAG_QUEUED);
 
-    oldval = (uintptr_t)ct | MUTEX_FLAG_QUEUED;
+    // with interrupts disabled nothing else can touch the running flag
+    oldval = mutex_val(m);
+    DEBUG_ASSERT((oldval & ~MUTEX_FLAG_OWNER_RUNNING) == ((uintptr_t)ct | MUTEX_FLAG_QUEUED));
     if (!atomic_cmpxchg_u64(&m->val, &oldval, newval)) {
         panic("bad state in mutex release %p, current thread %p\n", m, ct);
     }
 
     ktrace(TAG_KWAIT_WAKE, (uintptr_t)&m->wait >> 32, (uintptr_t)&m->wait, 1, 0);
 
-    // wake up the new thread, putting it in a run queue on a cpu. reschedule if the local
-    // cpu run queue was modified
-    bool local_resched = sched_unblock(t);
-    if (reschedule && local_resched)
-        sched_reschedule();
+    // wake up the new thread, putting it in a run queue on a cpu. this reschedules
+    // if asked to and the local cpu run queue was modified
+    wait_queue_unlock(&m->wait, state);
 
-    // conditionally THREAD_UNLOCK
-    if (!thread_lock_held)
-        spin_unlock_irqrestore(&thread_lock, state);
+    // our priority dropped, let whoever is waiting for this cpu have it
+    if (reschedule && local_resched)
+        thread_reschedule();
 }
 
 void mutex_release(mutex_t* m) TA_NO_THREAD_SAFETY_ANALYSIS {
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    // default release will reschedule if any threads are woken up and acquire the thread lock
-    mutex_release_internal(m, true, false);
+    // default release will reschedule if any threads are woken up
+    mutex_release_internal(m, true);
 }
 
-void mutex_release_thread_locked(mutex_t* m, bool reschedule) TA_NO_THREAD_SAFETY_ANALYSIS {
+void mutex_release_etc(mutex_t* m, bool reschedule) TA_NO_THREAD_SAFETY_ANALYSIS {
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
-    DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    // this special version of release will pass through the reschedule flag and not acquire
-    // the thread_lock
-    mutex_release_internal(m, reschedule, true);
+    // this special version of release will pass through the reschedule flag
+    mutex_release_internal(m, reschedule);
 }
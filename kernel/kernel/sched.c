@@ -6,11 +6,14 @@
 // https://opensource.org/licenses/MIT
 #include <kernel/sched.h>
 
+#include <arch/mp.h>
 #include <assert.h>
 #include <debug.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/atomic.h>
 #include <kernel/mp.h>
+#include <kernel/mutex.h>
 #include <kernel/percpu.h>
 #include <kernel/thread.h>
 #include <lib/ktrace.h>
@@ -52,12 +55,20 @@
 /* threads get 10ms to run before they use up their time slice and the scheduler is invoked */
 #define THREAD_INITIAL_TIME_SLICE ZX_MSEC(10)
 
-static bool local_migrate_if_needed(thread_t* curr_thread);
+/* how many more threads a cpu's run queue must hold than a target cpu's before the
+ * periodic rebalance pushes one over. moving a thread out of its cache domain is more
+ * expensive, so it takes a bigger imbalance.
+ */
+#define REBALANCE_SIBLING_IMBALANCE 2
+#define REBALANCE_REMOTE_IMBALANCE 4
 
 /* compute the effective priority of a thread */
 static int effec_priority(const thread_t* t) {
     int ep = t->base_priority + t->priority_boost;
     DEBUG_ASSERT(ep >= LOWEST_PRIORITY && ep <= HIGHEST_PRIORITY);
+    /* a mutex waiter may have lent us a higher priority */
+    if (unlikely(t->inherited_priority > ep))
+        ep = t->inherited_priority;
     return ep;
 }
 
@@ -123,15 +134,17 @@ static cpu_mask_t rand_cpu(cpu_mask_t mask) {
     cpu_num_t highest_cpu = highest_cpu_set(mask);
 
     /* not very random, round robins a bit through the mask until it gets a hit */
+    static uint32_t rot = 0;
+    uint32_t r = atomic_load_u32_relaxed(&rot);
     for (;;) {
-        /* protected by THREAD_LOCK, safe to use non atomically */
-        static uint rot = 0;
-
-        if (++rot > highest_cpu)
-            rot = 0;
+        if (++r > highest_cpu)
+            r = 0;
 
-        if ((1u << rot) & mask)
-            return (1u << rot);
+        if ((1u << r) & mask) {
+            /* racy, but the worst a lost update does is skew the round robin */
+            atomic_store_u32_relaxed(&rot, r);
+            return (1u << r);
+        }
     }
 }
 
@@ -194,36 +207,152 @@ static cpu_mask_t find_cpu_mask(thread_t* t) {
     return mask;
 }
 
-/* run queue manipulation */
-static void insert_in_run_queue_head(cpu_num_t cpu, thread_t* t) {
+/* scheduler locking
+ *
+ * There is no global scheduler lock. What the scheduler works with is split
+ * between three kinds of spinlock:
+ *
+ * - percpu[].run_queue_lock protects a cpu's run queue, bitmap and length,
+ *   its migrating and handoff threads, and moving threads between READY and
+ *   RUNNING on that cpu. A thread's curr_cpu is only valid while the thread is
+ *   queued at or running on that cpu, and only changes under that cpu's run
+ *   queue lock.
+ * - thread_t.state_lock protects a thread's transitions into and out of the
+ *   blocked, sleeping, suspended, initial and dead states, its signals and
+ *   wait queue bookkeeping, and its priority and affinity while it isn't
+ *   queued or running anywhere. Anyone who makes a thread runnable holds it.
+ * - wait_queue_t.lock protects the list of threads blocked on a wait queue.
+ *   Its users hold it around checking their condition and blocking or waking.
+ *
+ * thread_lock is still taken for what it protects (see thread.h), but the
+ * scheduler doesn't need it. The lock ordering is:
+ *
+ *   thread_lock -> wait queue lock -> thread state_lock ->
+ *   percpu[lower cpu].run_queue_lock -> percpu[higher cpu].run_queue_lock
+ *
+ * Two wait queue locks only nest where the inner one is never held while
+ * waiting for the outer one: a futex node's wait queue around the futex
+ * mutex, and priority inheriting mutexes lending priority down a chain, which
+ * only trylock the next mutex's wait queue lock, see mutex_lend_priority().
+ * Two state locks are never held at once.
+ *
+ * Blocking: the thread adds itself to the wait queue with the wait queue lock
+ * and its own state_lock held, drops the wait queue lock, and calls
+ * sched_block(). That locks the local run queue before dropping the
+ * state_lock, and the run queue lock is held across the context switch and
+ * released by whichever thread runs next, in sched_finish_switch(). Once
+ * another cpu gets hold of a cpu's run queue lock, the thread that last
+ * blocked there is completely switched out.
+ *
+ * Waking: the waker claims a blocked thread with the wait queue lock and the
+ * thread's state_lock held, taking it off the wait queue but leaving it
+ * BLOCKED with no blocking_wait_queue, and parks it on the wait queue's woken
+ * list. Woken threads are only made runnable once the wait queue lock has been
+ * dropped, so neither the waker nor the woken thread touches a wait queue that
+ * the woken thread may free as soon as it runs. sched_unblock() then waits for
+ * the thread to be switched out by locking the run queue of the cpu it last
+ * ran on, picks a cpu, locks that cpu's run queue, checks that it's still
+ * active, and inserts the thread. The reschedule ipi goes out after the run
+ * queue is unlocked. Timeouts and kills, which don't hold the wait queue lock,
+ * lock the thread's state first and only trylock the wait queue, backing off
+ * and retrying if that fails.
+ *
+ * Migration:
+ * - a cpu about to go idle steals from the most loaded cpu, and the periodic
+ *   rebalance pushes a thread from the local run queue to a less loaded cpu.
+ *   both already hold the local run queue lock, so they only trylock the
+ *   other cpu's if it's lower numbered, and give up if it's busy.
+ * - changing the affinity of a queued thread or lending it priority takes it
+ *   out of its run queue with its state_lock held.
+ * - a running thread that has to leave its cpu marks itself READY with no cpu
+ *   and switches away. the next thread to run there finishes the switch and
+ *   queues it on another cpu, with its state_lock held.
+ * - a cpu going offline empties its run queue the same way.
+ * A READY thread with no cpu is only ever queued with its state_lock held, so
+ * whoever holds that lock can treat it like a blocked thread.
+ *
+ * Interrupts are always disabled while any of these locks is held.
+ */
+static inline void run_queue_lock(cpu_num_t cpu) {
+    DEBUG_ASSERT(arch_ints_disabled());
+    spin_lock(&percpu[cpu].run_queue_lock);
+    percpu[arch_curr_cpu_num()].run_queue_locks_held++;
+}
+
+static inline void run_queue_unlock(cpu_num_t cpu) {
+    percpu[arch_curr_cpu_num()].run_queue_locks_held--;
+    spin_unlock(&percpu[cpu].run_queue_lock);
+}
+
+/* lock |cpu|'s run queue while already holding |held_cpu|'s. if that would go
+ * against the lock order, only try once, returning false if it's busy.
+ */
+static inline bool run_queue_lock_nested(cpu_num_t held_cpu, cpu_num_t cpu) {
+    DEBUG_ASSERT(held_cpu != cpu);
+    DEBUG_ASSERT(spin_lock_held(&percpu[held_cpu].run_queue_lock));
+
+    if (cpu > held_cpu) {
+        run_queue_lock(cpu);
+        return true;
+    }
+    if (spin_trylock(&percpu[cpu].run_queue_lock))
+        return false;
+    percpu[arch_curr_cpu_num()].run_queue_locks_held++;
+    return true;
+}
+
+/* run queue manipulation, percpu[cpu].run_queue_lock must be held */
+static void insert_in_run_queue_head_locked(cpu_num_t cpu, thread_t* t) {
+    DEBUG_ASSERT(spin_lock_held(&percpu[cpu].run_queue_lock));
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
     int ep = effec_priority(t);
 
     list_add_head(&percpu[cpu].run_queue[ep], &t->queue_node);
     percpu[cpu].run_queue_bitmap |= (1u << ep);
+    percpu[cpu].run_queue_len++;
 
     /* mark the cpu as busy since the run queue now has at least one item in it */
     mp_set_cpu_busy(cpu);
 }
 
-static void insert_in_run_queue_tail(cpu_num_t cpu, thread_t* t) {
+static void insert_in_run_queue_tail_locked(cpu_num_t cpu, thread_t* t) {
+    DEBUG_ASSERT(spin_lock_held(&percpu[cpu].run_queue_lock));
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
     int ep = effec_priority(t);
 
     list_add_tail(&percpu[cpu].run_queue[ep], &t->queue_node);
     percpu[cpu].run_queue_bitmap |= (1u << ep);
+    percpu[cpu].run_queue_len++;
 
     /* mark the cpu as busy since the run queue now has at least one item in it */
     mp_set_cpu_busy(cpu);
 }
 
-static thread_t* sched_get_top_thread(cpu_num_t cpu) {
+/* pull a thread out of the middle of the run queue it is sitting in */
+static void remove_from_run_queue_locked(cpu_num_t cpu, thread_t* t) {
+    DEBUG_ASSERT(spin_lock_held(&percpu[cpu].run_queue_lock));
+    DEBUG_ASSERT_MSG(list_in_list(&t->queue_node), "thread %p name %s curr_cpu %u\n", t, t->name, cpu);
+
+    struct percpu* c = &percpu[cpu];
+    int pri = effec_priority(t);
+
+    list_delete(&t->queue_node);
+    if (list_is_empty(&c->run_queue[pri])) {
+        c->run_queue_bitmap &= ~(1u << pri);
+    }
+    DEBUG_ASSERT(c->run_queue_len > 0);
+    c->run_queue_len--;
+}
+
+static thread_t* sched_get_top_thread_locked(cpu_num_t cpu) {
     /* pop the head of the highest priority queue with any threads
      * queued up on the passed in cpu.
      */
     struct percpu* c = &percpu[cpu];
+    DEBUG_ASSERT(spin_lock_held(&c->run_queue_lock));
+
     if (likely(c->run_queue_bitmap)) {
         uint highest_queue = HIGHEST_PRIORITY - __builtin_clz(c->run_queue_bitmap) -
                              (sizeof(c->run_queue_bitmap) * CHAR_BIT - NUM_PRIORITIES);
@@ -239,6 +368,9 @@ static thread_t* sched_get_top_thread(cpu_num_t cpu) {
         if (list_is_empty(&c->run_queue[highest_queue]))
             c->run_queue_bitmap &= ~(1u << highest_queue);
 
+        DEBUG_ASSERT(c->run_queue_len > 0);
+        c->run_queue_len--;
+
         LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
 
         return newthread;
@@ -248,58 +380,419 @@ static thread_t* sched_get_top_thread(cpu_num_t cpu) {
     return &c->idle_thread;
 }
 
-void sched_block(void) {
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+/* returns true if the local run queue has nothing in it. only a hint, other cpus
+ * may insert or steal threads as soon as the lock is dropped.
+ */
+bool sched_local_run_queue_empty(void) {
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    cpu_num_t cpu = arch_curr_cpu_num();
+    run_queue_lock(cpu);
+    bool empty = (percpu[cpu].run_queue_bitmap == 0);
+    run_queue_unlock(cpu);
 
-    __UNUSED thread_t* current_thread = get_current_thread();
+    return empty;
+}
+
+bool sched_run_queue_held(void) {
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    return percpu[arch_curr_cpu_num()].run_queue_locks_held != 0;
+}
+
+/* lock the run queue of the cpu |t| is running on or queued at and return that cpu,
+ * or return INVALID_CPU if it's on neither. t->state_lock must be held, which keeps
+ * it from blocking or being woken, but not from being scheduled, stolen or moved
+ * between run queues, hence the retry.
+ */
+static cpu_num_t lock_thread_cpu(thread_t* t) {
+    DEBUG_ASSERT(spin_lock_held(&t->state_lock));
+
+    for (;;) {
+        cpu_num_t cpu = *(volatile cpu_num_t*)&t->curr_cpu;
+        if (cpu == INVALID_CPU)
+            return INVALID_CPU;
+
+        run_queue_lock(cpu);
+        if (likely(t->curr_cpu == cpu)) {
+            DEBUG_ASSERT(t->state == THREAD_READY || t->state == THREAD_RUNNING);
+            return cpu;
+        }
+        run_queue_unlock(cpu);
+    }
+}
+
+/* a thread that has just blocked may still be on its way off the cpu it last ran on,
+ * which holds its run queue lock until the switch is complete. wait for that before
+ * letting the thread run anywhere else.
+ */
+static void wait_for_switch_out(const thread_t* t) {
+    cpu_num_t cpu = t->last_cpu;
+    if (cpu != INVALID_CPU) {
+        run_queue_lock(cpu);
+        run_queue_unlock(cpu);
+    }
+}
+
+/* work stealing and rebalancing */
+
+/* the cpus that share a last level cache with |cpu|, including |cpu| */
+static cpu_mask_t cache_siblings(cpu_num_t cpu) {
+    /* filled in racily, but every cpu computes the same value and the topology
+     * does not change once a cpu is up */
+    static cpu_mask_t sibling_mask[SMP_MAX_CPUS];
+
+    cpu_mask_t mask = atomic_load_u32_relaxed(&sibling_mask[cpu]);
+    if (unlikely(mask == 0)) {
+        mask = arch_mp_cache_sibling_mask(cpu);
+        atomic_store_u32_relaxed(&sibling_mask[cpu], mask);
+    }
+
+    return mask;
+}
+
+static uint32_t run_queue_len(cpu_num_t cpu) {
+    /* only a hint unless the cpu's run queue lock is held */
+    return __atomic_load_n(&percpu[cpu].run_queue_len, __ATOMIC_RELAXED);
+}
+
+/* find the cpu in |mask| with the deepest run queue, INVALID_CPU if they are all empty */
+static cpu_num_t most_loaded_cpu(cpu_mask_t mask) {
+    cpu_num_t busiest = INVALID_CPU;
+    uint32_t busiest_len = 0;
+
+    while (mask) {
+        cpu_num_t i = lowest_cpu_set(mask);
+        mask &= ~cpu_num_to_mask(i);
+
+        uint32_t len = run_queue_len(i);
+        if (len > busiest_len) {
+            busiest = i;
+            busiest_len = len;
+        }
+    }
+
+    return busiest;
+}
+
+/* find the cpu in |mask| with the shallowest run queue, INVALID_CPU if the mask is empty */
+static cpu_num_t least_loaded_cpu(cpu_mask_t mask, uint32_t* len_out) {
+    cpu_num_t idlest = INVALID_CPU;
+    uint32_t idlest_len = UINT32_MAX;
+
+    while (mask) {
+        cpu_num_t i = lowest_cpu_set(mask);
+        mask &= ~cpu_num_to_mask(i);
+
+        uint32_t len = run_queue_len(i);
+        if (len < idlest_len) {
+            idlest = i;
+            idlest_len = len;
+        }
+    }
+
+    *len_out = idlest_len;
+    return idlest;
+}
+
+/* called when |cpu| is about to go idle, with its run queue locked. pull the next
+ * runnable thread that is allowed to run here out of the most loaded cpu's run queue,
+ * looking at the cpus we share a cache with before the rest of the system. returns
+ * NULL if there was nothing to steal.
+ */
+static thread_t* sched_steal_work(cpu_num_t cpu) {
+    DEBUG_ASSERT(spin_lock_held(&percpu[cpu].run_queue_lock));
+
+    cpu_mask_t local_mask = cpu_num_to_mask(cpu);
+    cpu_mask_t candidates = mp_get_active_mask() & ~local_mask;
+    if (candidates == 0)
+        return NULL;
+
+    cpu_mask_t siblings = cache_siblings(cpu) & candidates;
+    cpu_num_t victim = most_loaded_cpu(siblings);
+    if (victim == INVALID_CPU)
+        victim = most_loaded_cpu(candidates & ~siblings);
+    if (victim == INVALID_CPU)
+        return NULL;
+
+    /* don't wait on a busy lower numbered cpu, we'll be back soon enough */
+    if (!run_queue_lock_nested(cpu, victim))
+        return NULL;
+
+    struct percpu* c = &percpu[victim];
+    thread_t* stolen = NULL;
+
+    /* take the thread the victim would have run next, walking down the priority levels
+     * until one is found whose affinity mask allows it to run here. a thread the
+     * victim's running thread just handed off to is about to get that cpu anyway.
+     */
+    uint32_t bitmap = c->run_queue_bitmap;
+    while (bitmap && !stolen) {
+        uint pri = HIGHEST_PRIORITY - __builtin_clz(bitmap) -
+                   (sizeof(bitmap) * CHAR_BIT - NUM_PRIORITIES);
+        bitmap &= ~(1u << pri);
+
+        thread_t* t;
+        list_for_every_entry (&c->run_queue[pri], t, thread_t, queue_node) {
+            if ((t->cpu_affinity & local_mask) && t != c->handoff_thread) {
+                stolen = t;
+                break;
+            }
+        }
+    }
+
+    if (stolen) {
+        remove_from_run_queue_locked(victim, stolen);
+        stolen->curr_cpu = cpu;
+    }
+
+    run_queue_unlock(victim);
+
+    if (stolen) {
+        CPU_STATS_INC(steals);
+        LOCAL_KTRACE2("sched_steal", (uint32_t)stolen->user_tid, victim);
+    }
+
+    return stolen;
+}
+
+/* push one thread from |cpu|'s run queue over to a less loaded cpu if the imbalance is
+ * large enough to be worth moving it. called periodically from the preemption path when
+ * the running thread's quantum expires, with the local run queue locked.
+ */
+static void sched_rebalance(cpu_num_t cpu) {
+    DEBUG_ASSERT(spin_lock_held(&percpu[cpu].run_queue_lock));
+
+    uint32_t local_len = run_queue_len(cpu);
+    if (local_len < REBALANCE_SIBLING_IMBALANCE)
+        return;
+
+    cpu_mask_t candidates = mp_get_active_mask() & ~cpu_num_to_mask(cpu);
+    if (candidates == 0)
+        return;
+
+    /* prefer a cpu that shares our cache, only go further afield for a bigger imbalance */
+    cpu_mask_t siblings = cache_siblings(cpu) & candidates;
+    uint32_t target_len;
+    cpu_num_t target = least_loaded_cpu(siblings, &target_len);
+    if (target == INVALID_CPU || local_len < target_len + REBALANCE_SIBLING_IMBALANCE) {
+        target = least_loaded_cpu(candidates & ~siblings, &target_len);
+        if (target == INVALID_CPU || local_len < target_len + REBALANCE_REMOTE_IMBALANCE)
+            return;
+    }
+
+    /* this is only opportunistic, don't wait on a busy lower numbered cpu */
+    if (!run_queue_lock_nested(cpu, target))
+        return;
+
+    /* it may have started going offline since it was picked */
+    if (unlikely(!mp_is_cpu_active(target))) {
+        run_queue_unlock(target);
+        return;
+    }
+
+    struct percpu* c = &percpu[cpu];
+    cpu_mask_t target_mask = cpu_num_to_mask(target);
+    thread_t* moved = NULL;
+
+    /* move the thread that would have waited the longest here: the tail of the lowest
+     * priority queue that has something allowed to run on the target.
+     */
+    uint32_t bitmap = c->run_queue_bitmap;
+    while (bitmap && !moved) {
+        uint pri = __builtin_ctz(bitmap);
+        bitmap &= ~(1u << pri);
+
+        thread_t* t = list_peek_tail_type(&c->run_queue[pri], thread_t, queue_node);
+        while (t) {
+            if ((t->cpu_affinity & target_mask) && t != c->handoff_thread) {
+                moved = t;
+                break;
+            }
+            t = list_prev_type(&c->run_queue[pri], &t->queue_node, thread_t, queue_node);
+        }
+    }
+
+    if (moved) {
+        remove_from_run_queue_locked(cpu, moved);
+        moved->curr_cpu = target;
+        insert_in_run_queue_tail_locked(target, moved);
+    }
+
+    run_queue_unlock(target);
+
+    if (moved) {
+        CPU_STATS_INC(rebalances);
+        LOCAL_KTRACE2("sched_rebalance", (uint32_t)moved->user_tid, target);
+        mp_reschedule(MP_IPI_TARGET_MASK, target_mask, 0);
+    }
+}
+
+static void sched_resched_internal(void);
+
+void sched_block(void) {
+    thread_t* current_thread = get_current_thread();
+    cpu_num_t cpu = arch_curr_cpu_num();
 
     DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
-    DEBUG_ASSERT(current_thread->state != THREAD_RUNNING);
+    DEBUG_ASSERT(current_thread->state != THREAD_RUNNING && current_thread->state != THREAD_READY);
+    DEBUG_ASSERT(spin_lock_held(&current_thread->state_lock));
 
     LOCAL_KTRACE0("sched_block");
 
-    /* we are blocking on something. the blocking code should have already stuck us on a queue */
+    /* we are blocking on something. the blocking code should have already stuck us on a
+     * queue. once our run queue is locked, anyone waking us up waits for the switch to
+     * finish, so the state_lock can go.
+     */
+    run_queue_lock(cpu);
+    current_thread->curr_cpu = INVALID_CPU;
+    spin_unlock(&current_thread->state_lock);
+
     sched_resched_internal();
 }
 
 /* find a cpu to run the thread on, put it in the run queue for that cpu, and accumulate a list
- * of cpus we'll need to reschedule, including the local cpu.
+ * of cpus we'll need to reschedule, including the local cpu. t->state_lock must be held.
  */
 static void find_cpu_and_insert(thread_t* t, bool* local_resched, cpu_mask_t* accum_cpu_mask) {
-    /* find a core to run it on */
-    cpu_mask_t cpu = find_cpu_mask(t);
+    DEBUG_ASSERT(spin_lock_held(&t->state_lock));
+    DEBUG_ASSERT(t->curr_cpu == INVALID_CPU);
+
+    cpu_num_t curr_cpu = arch_curr_cpu_num();
     cpu_num_t cpu_num;
+    for (;;) {
+        /* find a core to run it on */
+        cpu_mask_t cpu = find_cpu_mask(t);
+        DEBUG_ASSERT(cpu != 0);
+        cpu_num = lowest_cpu_set(cpu);
 
-    DEBUG_ASSERT(cpu != 0);
+        run_queue_lock(cpu_num);
 
-    cpu_num = lowest_cpu_set(cpu);
-    if (cpu_num == arch_curr_cpu_num()) {
-        *local_resched = true;
-    } else {
-        *accum_cpu_mask |= cpu_num_to_mask(cpu_num);
+        /* a cpu that went offline since it was picked has already emptied its run queue */
+        if (likely(mp_is_cpu_active(cpu_num) || cpu_num == curr_cpu))
+            break;
+
+        run_queue_unlock(cpu_num);
     }
 
+    t->state = THREAD_READY;
     t->curr_cpu = cpu_num;
     if (t->remaining_time_slice > 0) {
-        insert_in_run_queue_head(cpu_num, t);
+        insert_in_run_queue_head_locked(cpu_num, t);
     } else {
-        insert_in_run_queue_tail(cpu_num, t);
+        insert_in_run_queue_tail_locked(cpu_num, t);
+    }
+
+    run_queue_unlock(cpu_num);
+
+    if (cpu_num == curr_cpu) {
+        *local_resched = true;
+    } else {
+        *accum_cpu_mask |= cpu_num_to_mask(cpu_num);
     }
 }
 
-bool sched_unblock(thread_t* t) {
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+int sched_get_effective_priority(const thread_t* t) {
+    return effec_priority(t);
+}
 
+bool sched_inherit_priority(thread_t* t, int pri) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(pri >= 0 && pri <= HIGHEST_PRIORITY);
+    DEBUG_ASSERT(spin_lock_held(&t->state_lock));
+
+    if (t->inherited_priority == pri)
+        return false;
+
+    int old_ep = effec_priority(t);
+
+    cpu_num_t cpu = lock_thread_cpu(t);
+    if (cpu != INVALID_CPU && t->state == THREAD_READY) {
+        /* the run queue is indexed by effective priority, so requeue the thread */
+        remove_from_run_queue_locked(cpu, t);
+        t->inherited_priority = pri;
+        insert_in_run_queue_tail_locked(cpu, t);
+        run_queue_unlock(cpu);
+
+        if (effec_priority(t) > old_ep) {
+            /* it may now outrank whatever that cpu is running */
+            if (cpu == arch_curr_cpu_num())
+                return true;
+            mp_reschedule(MP_IPI_TARGET_MASK, cpu_num_to_mask(cpu), 0);
+        }
+        return false;
+    }
+
+    t->inherited_priority = pri;
+    if (cpu != INVALID_CPU)
+        run_queue_unlock(cpu);
+
+    /* dropping our own priority may let a waiting thread in */
+    return t == get_current_thread() && effec_priority(t) < old_ep;
+}
+
+zx_duration_t sched_get_runtime(thread_t* t) {
+    DEBUG_ASSERT(spin_lock_held(&t->state_lock));
+
+    /* a running thread's time is only added up when it's switched out */
+    cpu_num_t cpu = lock_thread_cpu(t);
+    if (cpu == INVALID_CPU)
+        wait_for_switch_out(t);
+
+    zx_duration_t runtime = t->runtime_ns;
+    if (t->state == THREAD_RUNNING) {
+        runtime += current_time() - t->last_started_running;
+    }
+
+    if (cpu != INVALID_CPU)
+        run_queue_unlock(cpu);
+
+    return runtime;
+}
+
+/* the current thread is about to block waiting on |t|: queue |t| locally at the
+ * head of its priority and give it what's left of the current time slice, so
+ * that it picks up where we leave off without waking another cpu.
+ */
+static void handoff_insert(thread_t* t) {
+    thread_t* current_thread = get_current_thread();
+    cpu_num_t cpu = arch_curr_cpu_num();
+
+    /* the current thread's slice is only charged at context switch time, so
+     * leave it just what it has used. it is used up by the time we block, and
+     * if |t| hands the cpu back the rest comes back with it.
+     */
+    zx_duration_t used = current_time() - current_thread->last_started_running;
+    if (current_thread->remaining_time_slice > used) {
+        t->remaining_time_slice = current_thread->remaining_time_slice - used;
+        current_thread->remaining_time_slice = used;
+    }
+
+    run_queue_lock(cpu);
+    t->state = THREAD_READY;
+    t->curr_cpu = cpu;
+    insert_in_run_queue_head_locked(cpu, t);
+
+    /* keep idle cpus from stealing it before we get around to blocking */
+    percpu[cpu].handoff_thread = t;
+    run_queue_unlock(cpu);
+
+    CPU_STATS_INC(handoffs);
+}
+
+bool sched_unblock(thread_t* t) {
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(spin_lock_held(&t->state_lock));
+    DEBUG_ASSERT(t->state != THREAD_READY && t->state != THREAD_RUNNING);
 
     LOCAL_KTRACE0("sched_unblock");
 
+    wait_for_switch_out(t);
+
     /* thread is being woken up, boost its priority */
     boost_thread(t);
 
     /* stuff the new thread in the run queue */
-    t->state = THREAD_READY;
-
     bool local_resched = false;
     cpu_mask_t mask = 0;
     find_cpu_and_insert(t, &local_resched, &mask);
@@ -309,9 +802,28 @@ bool sched_unblock(thread_t* t) {
     return local_resched;
 }
 
+bool sched_unblock_handoff(thread_t* t) {
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(spin_lock_held(&t->state_lock));
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    /* wake it up the usual way if it can't run here */
+    if (!(t->cpu_affinity & cpu_num_to_mask(arch_curr_cpu_num())))
+        return sched_unblock(t);
+
+    LOCAL_KTRACE0("sched_unblock_handoff");
+
+    wait_for_switch_out(t);
+
+    /* thread is being woken up, boost its priority */
+    boost_thread(t);
+
+    handoff_insert(t);
+    return true;
+}
+
 bool sched_unblock_list(struct list_node* list) {
     DEBUG_ASSERT(list);
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
     LOCAL_KTRACE0("sched_unblock_list");
 
@@ -323,12 +835,18 @@ bool sched_unblock_list(struct list_node* list) {
         DEBUG_ASSERT(t->magic == THREAD_MAGIC);
         DEBUG_ASSERT(!thread_is_idle(t));
 
+        spin_lock(&t->state_lock);
+        DEBUG_ASSERT(t->state != THREAD_READY && t->state != THREAD_RUNNING);
+
+        wait_for_switch_out(t);
+
         /* thread is being woken up, boost its priority */
         boost_thread(t);
 
         /* stuff the new thread in the run queue */
-        t->state = THREAD_READY;
         find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
+
+        spin_unlock(&t->state_lock);
     }
 
     if (accum_cpu_mask)
@@ -339,7 +857,7 @@ bool sched_unblock_list(struct list_node* list) {
 
 /* handle the special case of resuming a newly created idle thread */
 void sched_unblock_idle(thread_t* t) {
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&t->state_lock));
 
     DEBUG_ASSERT(thread_is_idle(t));
     DEBUG_ASSERT(t->cpu_affinity && (t->cpu_affinity & (t->cpu_affinity - 1)) == 0);
@@ -347,40 +865,69 @@ void sched_unblock_idle(thread_t* t) {
     /* idle thread is special case, just jam it into the cpu's run queue in the thread's
      * affinity mask and mark it ready.
      */
-    t->state = THREAD_READY;
     cpu_num_t cpu = lowest_cpu_set(t->cpu_affinity);
+    run_queue_lock(cpu);
+    t->state = THREAD_READY;
     t->curr_cpu = cpu;
-    insert_in_run_queue_head(cpu, t);
+    insert_in_run_queue_head_locked(cpu, t);
+    run_queue_unlock(cpu);
+}
+
+/* the current thread can't stay on this cpu. it can't go in another cpu's run queue while
+ * it's still running here either, so leave that to whoever runs here next, see
+ * sched_finish_switch().
+ */
+static void migrate_current_thread(thread_t* current_thread) {
+    cpu_num_t cpu = arch_curr_cpu_num();
+    DEBUG_ASSERT(spin_lock_held(&percpu[cpu].run_queue_lock));
+    DEBUG_ASSERT(percpu[cpu].migrating_thread == NULL);
+
+    current_thread->curr_cpu = INVALID_CPU;
+    percpu[cpu].migrating_thread = current_thread;
+}
+
+/* check to see if the current thread needs to migrate to a new core */
+/* the passed argument must be the current thread and must already be pushed into the READY state */
+static bool local_migrate_if_needed(thread_t* curr_thread) {
+    DEBUG_ASSERT(curr_thread == get_current_thread());
+    DEBUG_ASSERT(curr_thread->state == THREAD_READY);
+
+    /* if the affinity mask does not include the current cpu, migrate us right now */
+    if (unlikely((curr_thread->cpu_affinity & cpu_num_to_mask(curr_thread->curr_cpu)) == 0)) {
+        migrate_current_thread(curr_thread);
+        return true;
+    }
+    return false;
 }
 
 /* the thread is voluntarily giving up its time slice */
 void sched_yield(void) {
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-
     thread_t* current_thread = get_current_thread();
+    cpu_num_t curr_cpu = arch_curr_cpu_num();
     DEBUG_ASSERT(!thread_is_idle(current_thread));
 
     LOCAL_KTRACE0("sched_yield");
 
+    run_queue_lock(curr_cpu);
+
     /* consume the rest of the time slice, deboost ourself, and go to the end of a queue */
     current_thread->remaining_time_slice = 0;
     deboost_thread(current_thread, false);
 
     current_thread->state = THREAD_READY;
 
-    if (local_migrate_if_needed(current_thread))
-        return;
+    if (!local_migrate_if_needed(current_thread))
+        insert_in_run_queue_tail_locked(curr_cpu, current_thread);
 
-    insert_in_run_queue_tail(arch_curr_cpu_num(), current_thread);
     sched_resched_internal();
 }
 
 /* the current thread is being preempted from interrupt context */
 void sched_preempt(void) {
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-
     thread_t* current_thread = get_current_thread();
-    uint curr_cpu = arch_curr_cpu_num();
+    cpu_num_t curr_cpu = arch_curr_cpu_num();
+
+    run_queue_lock(curr_cpu);
 
     DEBUG_ASSERT(current_thread->curr_cpu == curr_cpu);
     DEBUG_ASSERT(current_thread->last_cpu == current_thread->curr_cpu);
@@ -393,15 +940,17 @@ void sched_preempt(void) {
         if (current_thread->remaining_time_slice <= 0) {
             /* if we're out of quantum, deboost the thread and put it at the tail of a queue */
             deboost_thread(current_thread, true);
-        }
 
-        if (local_migrate_if_needed(current_thread))
-            return;
+            /* the quantum expiring is our periodic chance to shed load onto other cpus */
+            sched_rebalance(curr_cpu);
+        }
 
-        if (current_thread->remaining_time_slice > 0) {
-            insert_in_run_queue_head(curr_cpu, current_thread);
-        } else {
-            insert_in_run_queue_tail(curr_cpu, current_thread);
+        if (!local_migrate_if_needed(current_thread)) {
+            if (current_thread->remaining_time_slice > 0) {
+                insert_in_run_queue_head_locked(curr_cpu, current_thread);
+            } else {
+                insert_in_run_queue_tail_locked(curr_cpu, current_thread);
+            }
         }
     }
 
@@ -410,10 +959,10 @@ void sched_preempt(void) {
 
 /* the current thread is voluntarily reevaluating the scheduler on the current cpu */
 void sched_reschedule(void) {
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-
     thread_t* current_thread = get_current_thread();
-    uint curr_cpu = arch_curr_cpu_num();
+    cpu_num_t curr_cpu = arch_curr_cpu_num();
+
+    run_queue_lock(curr_cpu);
 
     DEBUG_ASSERT(current_thread->curr_cpu == curr_cpu);
     DEBUG_ASSERT(current_thread->last_cpu == current_thread->curr_cpu);
@@ -427,44 +976,45 @@ void sched_reschedule(void) {
         /* deboost the current thread */
         deboost_thread(current_thread, false);
 
-        if (local_migrate_if_needed(current_thread))
-            return;
-
-        if (current_thread->remaining_time_slice > 0) {
-            insert_in_run_queue_head(curr_cpu, current_thread);
-        } else {
-            insert_in_run_queue_tail(curr_cpu, current_thread);
+        if (!local_migrate_if_needed(current_thread)) {
+            if (current_thread->remaining_time_slice > 0) {
+                insert_in_run_queue_head_locked(curr_cpu, current_thread);
+            } else {
+                insert_in_run_queue_tail_locked(curr_cpu, current_thread);
+            }
         }
     }
 
     sched_resched_internal();
 }
 
-/* migrate the current thread to a new cpu and locally reschedule to seal the deal */
-static void migrate_current_thread(thread_t* current_thread) {
-    bool local_resched = false;
-    cpu_mask_t accum_cpu_mask = 0;
-
-    // current thread, so just shove ourself into another cpu's queue and reschedule locally
-    current_thread->state = THREAD_READY;
-    find_cpu_and_insert(current_thread, &local_resched, &accum_cpu_mask);
-    if (accum_cpu_mask)
-        mp_reschedule(MP_IPI_TARGET_MASK, accum_cpu_mask, 0);
-    sched_resched_internal();
-}
-
 /* migrate all threads assigned to |old_cpu| to other queues */
 void sched_transition_off_cpu(cpu_num_t old_cpu) {
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(old_cpu == arch_curr_cpu_num());
+
+    struct list_node list = LIST_INITIAL_VALUE(list);
+    thread_t* t;
+
+    run_queue_lock(old_cpu);
 
-    // Ensure we do not get scheduled on anymore.
+    // Ensure we do not get scheduled on anymore. Anyone who picked this cpu before
+    // this notices once they get the run queue lock.
     mp_set_curr_cpu_active(false);
 
-    thread_t* t;
+    percpu[old_cpu].handoff_thread = NULL;
+    while (!thread_is_idle(t = sched_get_top_thread_locked(old_cpu))) {
+        t->curr_cpu = INVALID_CPU;
+        list_add_tail(&list, &t->queue_node);
+    }
+
+    run_queue_unlock(old_cpu);
+
     bool local_resched = false;
     cpu_mask_t accum_cpu_mask = 0;
-    while (!thread_is_idle(t = sched_get_top_thread(old_cpu))) {
+    while ((t = list_remove_head_type(&list, thread_t, queue_node))) {
+        spin_lock(&t->state_lock);
         find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
+        spin_unlock(&t->state_lock);
         DEBUG_ASSERT(!local_resched);
     }
 
@@ -473,79 +1023,88 @@ void sched_transition_off_cpu(cpu_num_t old_cpu) {
     }
 }
 
-/* check to see if the current thread needs to migrate to a new core */
-/* the passed argument must be the current thread and must already be pushed into the READY state */
-static bool local_migrate_if_needed(thread_t* curr_thread) {
-    DEBUG_ASSERT(curr_thread == get_current_thread());
-    DEBUG_ASSERT(curr_thread->state == THREAD_READY);
-
-    /* if the affinity mask does not include the current cpu, migrate us right now */
-    if (unlikely((curr_thread->cpu_affinity & cpu_num_to_mask(curr_thread->curr_cpu)) == 0)) {
-        migrate_current_thread(curr_thread);
-        return true;
-    }
-    return false;
-}
-
 /* potentially migrate a thread to a new core based on the affinity mask on the thread. If it's
  * running or in a scheduler queue, handle it.
  */
-void sched_migrate(thread_t* t) {
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+bool sched_set_affinity(thread_t* t, cpu_mask_t affinity) {
+    DEBUG_ASSERT(spin_lock_held(&t->state_lock));
 
-    bool local_resched = false;
-    cpu_mask_t accum_cpu_mask = 0;
-    switch (t->state) {
-    case THREAD_RUNNING:
-        // see if we need to migrate
-        if (t->cpu_affinity & cpu_num_to_mask(t->curr_cpu)) {
-            // it's running and the new mask contains the core it's already running on, nothing to do.
-            //TRACEF("t %p nomigrate\n", t);
-            return;
-        }
+    /* whoever next queues the thread, or picks it from a run queue, sees the new mask */
+    cpu_num_t cpu = lock_thread_cpu(t);
+    t->cpu_affinity = affinity;
 
-        // we need to migrate
-        if (t == get_current_thread()) {
-            // current thread, so just shove ourself into another cpu's queue and reschedule locally
-            migrate_current_thread(t);
-            return;
-        } else {
-            // running on another cpu, interrupt and let sched_preempt() sort it out
-            accum_cpu_mask = cpu_num_to_mask(t->curr_cpu);
-        }
-        break;
-    case THREAD_READY:
-        if (t->cpu_affinity & cpu_num_to_mask(t->curr_cpu)) {
-            // it's ready and the new mask contains the core it's already waiting on, nothing to do.
-            //TRACEF("t %p nomigrate\n", t);
-            return;
-        }
+    if (cpu == INVALID_CPU)
+        return false;
 
-        // it's sitting in a run queue somewhere, so pull it out of that one and find a new home
-        DEBUG_ASSERT_MSG(list_in_list(&t->queue_node), "thread %p name %s curr_cpu %u\n", t, t->name, t->curr_cpu);
-        list_delete(&t->queue_node);
+    if (affinity & cpu_num_to_mask(cpu)) {
+        // it's running or waiting somewhere the new mask allows, nothing to do.
+        run_queue_unlock(cpu);
+        return false;
+    }
 
-        DEBUG_ASSERT(is_valid_cpu_num(t->curr_cpu));
+    if (t->state == THREAD_RUNNING) {
+        run_queue_unlock(cpu);
 
-        struct percpu* c = &percpu[t->curr_cpu];
-        int pri = effec_priority(t);
-        if (list_is_empty(&c->run_queue[pri])) {
-            c->run_queue_bitmap &= ~(1u << pri);
-        }
+        // the current thread moves itself the next time it goes through the scheduler
+        if (t == get_current_thread())
+            return true;
 
-        find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
-        break;
-    default:
-        // the other states do not matter, exit
-        return;
+        // running on another cpu, interrupt and let sched_preempt() sort it out
+        mp_reschedule(MP_IPI_TARGET_MASK, cpu_num_to_mask(cpu), 0);
+        return false;
     }
 
-    // send some ipis based on the previous code
+    // it's sitting in a run queue somewhere, so pull it out of that one and find a new home
+    remove_from_run_queue_locked(cpu, t);
+    t->curr_cpu = INVALID_CPU;
+    run_queue_unlock(cpu);
+
+    bool local_resched = false;
+    cpu_mask_t accum_cpu_mask = 0;
+    find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
+
     if (accum_cpu_mask) {
         mp_reschedule(MP_IPI_TARGET_MASK, accum_cpu_mask, 0);
     }
-    if (local_resched) {
-        sched_reschedule();
+    return local_resched;
+}
+
+void sched_sync_switch_out(thread_t* t) {
+    DEBUG_ASSERT(t->state == THREAD_DEATH);
+
+    /* the dying thread keeps its state_lock until it has locked its run queue */
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&t->state_lock, state);
+    wait_for_switch_out(t);
+    spin_unlock_irqrestore(&t->state_lock, state);
+}
+
+void sched_finish_switch(void) {
+    cpu_num_t cpu = arch_curr_cpu_num();
+    struct percpu* c = &percpu[cpu];
+
+    DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(spin_lock_held(&c->run_queue_lock));
+
+    thread_t* t = c->migrating_thread;
+    c->migrating_thread = NULL;
+
+    run_queue_unlock(cpu);
+
+    /* the thread we switched away from had to leave this cpu, queue it somewhere it's
+     * allowed to run now that it's off the cpu. if that turns out to be here after all,
+     * it runs the next time this cpu reschedules.
+     */
+    if (unlikely(t)) {
+        bool local_resched = false;
+        cpu_mask_t accum_cpu_mask = 0;
+
+        spin_lock(&t->state_lock);
+        find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
+        spin_unlock(&t->state_lock);
+
+        if (accum_cpu_mask)
+            mp_reschedule(MP_IPI_TARGET_MASK, accum_cpu_mask, 0);
     }
 }
 
@@ -592,25 +1151,37 @@ __NO_SAFESTACK static void final_context_switch(thread_t* oldthread,
  * @brief  Cause another thread to be executed.
  *
  * Internal reschedule routine. The current thread needs to already be in whatever
- * state and queues it needs to be in. This routine simply picks the next thread and
- * switches to it.
+ * state and queues it needs to be in, and the local run queue must be locked. This
+ * routine simply picks the next thread and switches to it. The run queue stays locked
+ * across the switch and is unlocked by whoever runs next, in sched_finish_switch().
  */
-void sched_resched_internal(void) {
+static void sched_resched_internal(void) {
     thread_t* current_thread = get_current_thread();
     uint cpu = arch_curr_cpu_num();
 
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&percpu[cpu].run_queue_lock));
+    DEBUG_ASSERT(spin_lock_holder_cpu(&thread_lock) != cpu);
     DEBUG_ASSERT_MSG(current_thread->state != THREAD_RUNNING, "state %u\n", current_thread->state);
     DEBUG_ASSERT(!arch_in_int_handler());
 
     CPU_STATS_INC(reschedules);
 
     /* pick a new thread to run */
-    thread_t* newthread = sched_get_top_thread(cpu);
+    thread_t* newthread = sched_get_top_thread_locked(cpu);
+
+    /* nothing runnable locally, try to take some work from a busier cpu before going idle */
+    if (thread_is_idle(newthread) && mp_is_cpu_active(cpu)) {
+        thread_t* stolen = sched_steal_work(cpu);
+        if (stolen)
+            newthread = stolen;
+    }
 
     DEBUG_ASSERT(newthread);
 
+    /* whatever was handed the cpu has now had its chance at it */
+    percpu[cpu].handoff_thread = NULL;
+
     newthread->state = THREAD_RUNNING;
 
     thread_t* oldthread = current_thread;
@@ -619,8 +1190,13 @@ void sched_resched_internal(void) {
     LOCAL_KTRACE2("resched new pri", (uint32_t)newthread->user_tid, effec_priority(newthread));
 
     /* if it's the same thread as we're already running, exit */
-    if (newthread == oldthread)
+    if (newthread == oldthread) {
+        sched_finish_switch();
         return;
+    }
+
+    /* anyone spinning on a mutex the old thread holds should block instead */
+    mutex_owner_switched_out(oldthread);
 
     zx_time_t now = current_time();
 
@@ -637,9 +1213,7 @@ void sched_resched_internal(void) {
 
     newthread->last_started_running = now;
 
-    /* mark the cpu ownership of the threads */
-    if (oldthread->state != THREAD_READY)
-        oldthread->curr_cpu = INVALID_CPU;
+    /* mark the cpu ownership of the new thread, the old one has already given up its own */
     newthread->last_cpu = cpu;
     newthread->curr_cpu = cpu;
 
@@ -729,11 +1303,21 @@ void sched_resched_internal(void) {
 
     /* do the low level context switch */
     final_context_switch(oldthread, newthread);
+
+    /* we are running again, possibly on another cpu, with that cpu's run queue
+     * still locked on behalf of the thread we switched from */
+    sched_finish_switch();
 }
 
 void sched_init_early(void) {
     /* initialize the run queues */
-    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_init(&percpu[cpu].run_queue_lock);
         for (unsigned int i = 0; i < NUM_PRIORITIES; i++)
             list_initialize(&percpu[cpu].run_queue[i]);
+        percpu[cpu].run_queue_len = 0;
+        percpu[cpu].migrating_thread = NULL;
+        percpu[cpu].run_queue_locks_held = 0;
+        percpu[cpu].handoff_thread = NULL;
+    }
 }
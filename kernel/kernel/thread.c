@@ -42,28 +42,51 @@
 /* global thread list */
 static struct list_node thread_list = LIST_INITIAL_VALUE(thread_list);
 
-/* master thread spinlock */
+/* thread list and lifetime spinlock, see thread.h
+ *
+ * The locks used in this file are taken in this order:
+ *
+ *   thread_lock -> wait_queue_t.lock -> thread_t.state_lock -> run queue locks
+ *
+ * - thread_lock covers thread_list, the thread flags and the handoff between
+ *   a dying thread and whoever joins or frees it. thread_join() and
+ *   thread_kill() take the retcode wait queue's lock under it, then let go
+ *   of it before blocking.
+ * - a wait queue's lock covers the threads blocked on it and its woken list.
+ * - a thread's state_lock covers its state, signals, blocking_wait_queue and
+ *   blocked_status. No more than one is held at a time.
+ * - the run queue locks belong to the scheduler, see sched.c. They are only
+ *   taken inside the sched_*() calls made from here.
+ *
+ * Timeouts, kills and suspends start out holding a thread's state_lock and
+ * need the lock of the wait queue it's blocked on, which comes first. They
+ * only trylock it and back off, see thread_unblock_from_wait_queue(). Lending
+ * priority down a chain of mutexes does the same, see mutex_lend_priority().
+ */
 spin_lock_t thread_lock = SPIN_LOCK_INITIAL_VALUE;
 
 /* local routines */
 static int idle_thread_routine(void*) __NO_RETURN;
 static void thread_exit_locked(thread_t* current_thread, int retcode) __NO_RETURN;
 static void thread_do_suspend(void);
+static void thread_interrupt(thread_t* t, zx_status_t wait_queue_error, bool* local_resched);
 static zx_status_t thread_unblock_from_wait_queue(thread_t* t, zx_status_t wait_queue_error, bool* local_resched);
 
 static void init_thread_struct(thread_t* t, const char* name) {
     memset(t, 0, sizeof(thread_t));
     t->magic = THREAD_MAGIC;
     strlcpy(t->name, name, sizeof(t->name));
+    spin_lock_init(&t->state_lock);
     wait_queue_init(&t->retcode_wait_queue);
+    list_initialize(&t->owned_pi_mutexes);
 }
 
 static void initial_thread_func(void) __NO_RETURN;
 static void initial_thread_func(void) {
     int ret;
 
-    /* release the thread lock that was implicitly held across the reschedule */
-    spin_unlock(&thread_lock);
+    /* release the run queue lock that was implicitly held across the reschedule */
+    sched_finish_switch();
     arch_enable_ints();
 
     thread_t* ct = get_current_thread();
@@ -268,10 +291,11 @@ zx_status_t thread_resume(thread_t* t) {
     if (!ints_disabled) /* HACK, don't resced into bootstrap thread before idle thread is set up */
         resched = true;
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&t->state_lock, state);
 
     if (t->state == THREAD_DEATH) {
-        THREAD_UNLOCK(state);
+        spin_unlock_irqrestore(&t->state_lock, state);
         // The thread is dead, resuming it is a no-op.
         return ZX_OK;
     }
@@ -279,15 +303,19 @@ zx_status_t thread_resume(thread_t* t) {
     /* Clear the suspend signal in case there is a pending suspend */
     t->signals &= ~THREAD_SIGNAL_SUSPEND;
 
+    bool local_resched = false;
     if (t->state == THREAD_INITIAL || t->state == THREAD_SUSPENDED) {
         /* wake up the new thread, putting it in a run queue on a cpu. reschedule if the local */
         /* cpu run queue was modified */
-        bool local_resched = sched_unblock(t);
-        if (resched && local_resched)
-            sched_reschedule();
+        local_resched = sched_unblock(t);
     }
 
-    THREAD_UNLOCK(state);
+    spin_unlock(&t->state_lock);
+
+    if (resched && local_resched)
+        sched_reschedule();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     return ZX_OK;
 }
@@ -311,50 +339,53 @@ zx_status_t thread_suspend(thread_t* t) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(!thread_is_idle(t));
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&t->state_lock, state);
+
+    if (t->state == THREAD_INITIAL || t->state == THREAD_DEATH) {
+        spin_unlock_irqrestore(&t->state_lock, state);
+        return ZX_ERR_BAD_STATE;
+    }
+
+    /* set the signal first, waking the thread below may drop the state_lock for a bit */
+    t->signals |= THREAD_SIGNAL_SUSPEND;
 
     bool local_resched = false;
     switch (t->state) {
     case THREAD_INITIAL:
     case THREAD_DEATH:
-        THREAD_UNLOCK(state);
-        return ZX_ERR_BAD_STATE;
+        break;
     case THREAD_READY:
         /* thread is ready to run and not blocked or suspended.
              * will wake up and deal with the signal soon. */
         break;
-    case THREAD_RUNNING:
+    case THREAD_RUNNING: {
         /* thread is running (on another cpu) */
         /* The following call is not essential.  It just makes the
              * thread suspension happen sooner rather than at the next
              * timer interrupt or syscall. */
-        mp_reschedule(MP_IPI_TARGET_MASK, cpu_num_to_mask(t->curr_cpu), 0);
+        cpu_num_t cpu = t->curr_cpu;
+        if (cpu != INVALID_CPU)
+            mp_reschedule(MP_IPI_TARGET_MASK, cpu_num_to_mask(cpu), 0);
         break;
+    }
     case THREAD_SUSPENDED:
         /* thread is suspended already */
         break;
     case THREAD_BLOCKED:
-        /* thread is blocked on something and marked interruptable */
-        if (t->interruptable)
-            thread_unblock_from_wait_queue(t, ZX_ERR_INTERNAL_INTR_RETRY, &local_resched);
-        break;
     case THREAD_SLEEPING:
-        /* thread is sleeping */
-        if (t->interruptable) {
-            t->blocked_status = ZX_ERR_INTERNAL_INTR_RETRY;
-
-            local_resched = sched_unblock(t);
-        }
+        /* thread is blocked or sleeping on something and marked interruptable */
+        thread_interrupt(t, ZX_ERR_INTERNAL_INTR_RETRY, &local_resched);
         break;
     }
 
-    t->signals |= THREAD_SIGNAL_SUSPEND;
+    spin_unlock(&t->state_lock);
 
     /* reschedule if the local cpu run queue was modified */
     if (local_resched)
         sched_reschedule();
 
-    THREAD_UNLOCK(state);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     return ZX_OK;
 }
@@ -367,9 +398,10 @@ zx_status_t thread_suspend(thread_t* t) {
  * syscall. */
 void thread_signal_policy_exception(void) {
     thread_t* t = get_current_thread();
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&t->state_lock, state);
     t->signals |= THREAD_SIGNAL_POLICY_EXCEPTION;
-    THREAD_UNLOCK(state);
+    spin_unlock_irqrestore(&t->state_lock, state);
 }
 
 zx_status_t thread_join(thread_t* t, int* retcode, zx_time_t deadline) {
@@ -385,11 +417,17 @@ zx_status_t thread_join(thread_t* t, int* retcode, zx_time_t deadline) {
 
     /* wait for the thread to die */
     if (t->state != THREAD_DEATH) {
+        spin_lock(&t->retcode_wait_queue.lock);
+        spin_unlock(&thread_lock);
+
         zx_status_t err = wait_queue_block(&t->retcode_wait_queue, deadline);
         if (err < 0) {
-            THREAD_UNLOCK(state);
+            arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
             return err;
         }
+
+        /* it marks itself dead before letting go of the thread_lock */
+        spin_lock(&thread_lock);
     }
 
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
@@ -409,6 +447,9 @@ zx_status_t thread_join(thread_t* t, int* retcode, zx_time_t deadline) {
 
     THREAD_UNLOCK(state);
 
+    /* it may still be on its way off the cpu it died on */
+    sched_sync_switch_out(t);
+
     free_thread_resources(t);
 
     return ZX_OK;
@@ -421,7 +462,10 @@ zx_status_t thread_detach(thread_t* t) {
 
     /* if another thread is blocked inside thread_join() on this thread,
      * wake them up with a specific return code */
+    spin_lock_saved_state_t wait_state;
+    wait_queue_lock(&t->retcode_wait_queue, &wait_state);
     wait_queue_wake_all(&t->retcode_wait_queue, false, ZX_ERR_BAD_STATE);
+    wait_queue_unlock(&t->retcode_wait_queue, wait_state);
 
     /* if it's already dead, then just do what join would have and exit */
     if (t->state == THREAD_DEATH) {
@@ -442,7 +486,6 @@ static void thread_free_dpc(struct dpc* dpc) {
     thread_t* t = (thread_t*)dpc->arg;
 
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
-    DEBUG_ASSERT(t->state == THREAD_DEATH);
 
     /* grab and release the thread lock, which effectively serializes us with
      * the thread that is queuing itself for destruction.
@@ -451,6 +494,11 @@ static void thread_free_dpc(struct dpc* dpc) {
     atomic_signal_fence();
     THREAD_UNLOCK(state);
 
+    DEBUG_ASSERT(t->state == THREAD_DEATH);
+
+    /* then wait for it to finish switching away for the last time */
+    sched_sync_switch_out(t);
+
     free_thread_resources(t);
 }
 
@@ -461,9 +509,7 @@ __NO_RETURN static void thread_exit_locked(thread_t* current_thread, int retcode
      */
     dpc_t free_dpc;
 
-    /* enter the dead state */
-    current_thread->state = THREAD_DEATH;
-    current_thread->retcode = retcode;
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
     /* if we're detached, then do our teardown here */
     if (current_thread->flags & THREAD_FLAG_DETACHED) {
@@ -477,15 +523,26 @@ __NO_RETURN static void thread_exit_locked(thread_t* current_thread, int retcode
             current_thread->flags & THREAD_FLAG_FREE_STRUCT) {
             free_dpc.func = thread_free_dpc;
             free_dpc.arg = (void*)current_thread;
-            dpc_queue_thread_locked(&free_dpc);
+            dpc_queue(&free_dpc, false);
         }
     } else {
         /* signal if anyone is waiting */
+        spin_lock_saved_state_t wait_state;
+        wait_queue_lock(&current_thread->retcode_wait_queue, &wait_state);
         wait_queue_wake_all(&current_thread->retcode_wait_queue, false, 0);
+        wait_queue_unlock(&current_thread->retcode_wait_queue, wait_state);
     }
 
+    /* enter the dead state. anyone who wants to free us takes the thread_lock
+     * and then waits for us to be switched out.
+     */
+    spin_lock(&current_thread->state_lock);
+    current_thread->state = THREAD_DEATH;
+    current_thread->retcode = retcode;
+    spin_unlock(&thread_lock);
+
     /* reschedule */
-    sched_resched_internal();
+    sched_block();
 
     panic("somehow fell through thread_exit()\n");
 }
@@ -541,11 +598,12 @@ void thread_exit(int retcode) {
 void thread_kill(thread_t* t, bool block) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&t->state_lock, state);
 
     /* deliver a signal to the thread */
     /* NOTE: it's not important to do this atomically, since we're inside
-     * the thread lock, but go ahead and flush it out to memory to avoid the amount
+     * the thread's state lock, but go ahead and flush it out to memory to avoid the amount
      * of races if another thread is looking at this.
      */
     t->signals |= THREAD_SIGNAL_KILL;
@@ -571,45 +629,55 @@ void thread_kill(thread_t* t, bool block) {
              */
         /* TODO: short circuit if it was blocked from user space */
         break;
-    case THREAD_RUNNING:
+    case THREAD_RUNNING: {
         /* thread is running (on another cpu) */
         /* The following call is not essential.  It just makes the
              * thread termination happen sooner rather than at the next
              * timer interrupt or syscall. */
-        mp_reschedule(MP_IPI_TARGET_MASK, cpu_num_to_mask(t->curr_cpu), 0);
+        cpu_num_t cpu = t->curr_cpu;
+        if (cpu != INVALID_CPU)
+            mp_reschedule(MP_IPI_TARGET_MASK, cpu_num_to_mask(cpu), 0);
         break;
+    }
     case THREAD_SUSPENDED:
         /* thread is suspended, resume it so it can get the kill signal */
         local_resched = sched_unblock(t);
         break;
     case THREAD_BLOCKED:
-        /* thread is blocked on something and marked interruptable */
-        if (t->interruptable)
-            thread_unblock_from_wait_queue(t, ZX_ERR_INTERNAL_INTR_KILLED, &local_resched);
-        break;
     case THREAD_SLEEPING:
-        /* thread is sleeping */
-        if (t->interruptable) {
-            t->blocked_status = ZX_ERR_INTERNAL_INTR_KILLED;
-
-            local_resched = sched_unblock(t);
-        }
+        /* thread is blocked or sleeping on something and marked interruptable */
+        thread_interrupt(t, ZX_ERR_INTERNAL_INTR_KILLED, &local_resched);
         break;
     case THREAD_DEATH:
         /* thread is already dead */
         goto done;
     }
 
+    spin_unlock(&t->state_lock);
+
     /* wait for the thread to exit */
-    if (block && !(t->flags & THREAD_FLAG_DETACHED)) {
-        wait_queue_block(&t->retcode_wait_queue, ZX_TIME_INFINITE);
-    } else if (local_resched) {
-        /* reschedule if the local cpu run queue was modified */
-        sched_reschedule();
+    if (block) {
+        /* it wakes its joiners and marks itself dead under the thread_lock */
+        spin_lock(&thread_lock);
+        if (!(t->flags & THREAD_FLAG_DETACHED) && t->state != THREAD_DEATH) {
+            spin_lock(&t->retcode_wait_queue.lock);
+            spin_unlock(&thread_lock);
+            wait_queue_block(&t->retcode_wait_queue, ZX_TIME_INFINITE);
+            arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+            return;
+        }
+        spin_unlock(&thread_lock);
     }
 
+    /* reschedule if the local cpu run queue was modified */
+    if (local_resched)
+        sched_reschedule();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return;
+
 done:
-    THREAD_UNLOCK(state);
+    spin_unlock_irqrestore(&t->state_lock, state);
 }
 
 // Sets the cpu affinity mask of a thread to the passed in mask and migrate
@@ -617,36 +685,41 @@ done:
 void thread_set_cpu_affinity(thread_t* t, cpu_mask_t affinity) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&t->state_lock, state);
 
     // make sure the passed in mask is valid and at least one cpu can run the thread
+    bool local_resched = false;
     if (affinity & mp_get_active_mask()) {
-        // set the affinity mask
-        t->cpu_affinity = affinity;
-
-        // let the scheduler deal with it
-        sched_migrate(t);
+        // set the affinity mask and let the scheduler deal with it
+        local_resched = sched_set_affinity(t, affinity);
     }
 
-    THREAD_UNLOCK(state);
+    spin_unlock(&t->state_lock);
+
+    // this also moves the current thread off a cpu it's no longer allowed on
+    if (local_resched)
+        sched_reschedule();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 void thread_migrate_to_cpu(const cpu_num_t target_cpu) {
     thread_set_cpu_affinity(get_current_thread(), cpu_num_to_mask(target_cpu));
 }
 
-// thread_lock must be held when calling this function.  This function will
-// not return if it decides to kill the thread.
+// current_thread->state_lock must be held when calling this function.  This
+// function will not return if it decides to kill the thread.
 static void check_kill_signal(thread_t* current_thread,
                               spin_lock_saved_state_t state) {
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&current_thread->state_lock));
 
     if (current_thread->signals & THREAD_SIGNAL_KILL) {
         // Ensure we don't recurse into thread_exit.
         DEBUG_ASSERT(current_thread->state != THREAD_DEATH);
 
-        THREAD_UNLOCK(state);
+        spin_unlock_irqrestore(&current_thread->state_lock, state);
         thread_exit(0);
         // Unreachable.
     }
@@ -664,7 +737,8 @@ static void thread_do_suspend(void) {
         current_thread->user_callback(THREAD_USER_STATE_SUSPEND, current_thread->user_thread);
     }
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&current_thread->state_lock, state);
 
     // make sure we haven't been killed while the lock was dropped for the user callback
     check_kill_signal(current_thread, state);
@@ -676,16 +750,17 @@ static void thread_do_suspend(void) {
         current_thread->signals &= ~THREAD_SIGNAL_SUSPEND;
 
         // directly invoke the context switch, since we've already manipulated this thread's state
-        sched_resched_internal();
+        sched_block();
 
         // If the thread was killed, we should not allow it to resume.  We
         // shouldn't call user_callback() with THREAD_USER_STATE_RESUME in
         // this case, because there might not have been any request to
         // resume the thread.
+        spin_lock(&current_thread->state_lock);
         check_kill_signal(current_thread, state);
     }
 
-    THREAD_UNLOCK(state);
+    spin_unlock_irqrestore(&current_thread->state_lock, state);
 
     if (current_thread->user_callback) {
         current_thread->user_callback(THREAD_USER_STATE_RESUME, current_thread->user_thread);
@@ -698,15 +773,16 @@ void thread_process_pending_signals(void) {
     if (likely(current_thread->signals == 0))
         return;
 
-    /* grab the thread lock so we can safely look at the signal mask */
-    THREAD_LOCK(state);
+    /* grab our state lock so we can safely look at the signal mask */
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&current_thread->state_lock, state);
 
     check_kill_signal(current_thread, state);
 
     /* Report exceptions raised by syscalls */
     if (current_thread->signals & THREAD_SIGNAL_POLICY_EXCEPTION) {
         current_thread->signals &= ~THREAD_SIGNAL_POLICY_EXCEPTION;
-        THREAD_UNLOCK(state);
+        spin_unlock_irqrestore(&current_thread->state_lock, state);
         zx_status_t status = arch_dispatch_user_policy_exception();
         if (status != ZX_OK) {
             panic("arch_dispatch_user_policy_exception() failed: status=%d\n",
@@ -718,10 +794,10 @@ void thread_process_pending_signals(void) {
     if (current_thread->signals & THREAD_SIGNAL_SUSPEND) {
         /* transition the thread to the suspended state */
         DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
-        THREAD_UNLOCK(state);
+        spin_unlock_irqrestore(&current_thread->state_lock, state);
         thread_do_suspend();
     } else {
-        THREAD_UNLOCK(state);
+        spin_unlock_irqrestore(&current_thread->state_lock, state);
     }
 }
 
@@ -746,13 +822,14 @@ void thread_yield(void) {
     DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     CPU_STATS_INC(yields);
 
     sched_yield();
 
-    THREAD_UNLOCK(state);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 /**
@@ -771,13 +848,20 @@ void thread_preempt(void) {
     if (!thread_is_idle(current_thread)) {
         /* only track when a meaningful preempt happens */
         CPU_STATS_INC(irq_preempts);
+    } else if (sched_local_run_queue_empty()) {
+        /* the idle thread would just pick itself again, don't bother going through
+         * the scheduler. anything inserted into our run queue after this check
+         * is followed by a reschedule ipi that brings us back here.
+         */
+        return;
     }
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     sched_preempt();
 
-    THREAD_UNLOCK(state);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 /**
@@ -794,11 +878,12 @@ void thread_reschedule(void) {
     DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     sched_reschedule();
 
-    THREAD_UNLOCK(state);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 /* timer callback to wake up a sleeping thread */
@@ -807,15 +892,14 @@ static enum handler_return thread_sleep_handler(timer_t* timer, zx_time_t now, v
 
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    /* spin trylocking on the thread lock since the routine that set up the callback,
-     * thread_sleep_etc, may be trying to simultaneously cancel this timer while holding the
-     * thread_lock.
+    /* spin trylocking on the thread's state lock since the thread may have been woken
+     * some other way and be trying to cancel this timer.
      */
-    if (timer_trylock_or_cancel(timer, &thread_lock))
+    if (timer_trylock_or_cancel(timer, &t->state_lock))
         return INT_NO_RESCHEDULE;
 
     if (t->state != THREAD_SLEEPING) {
-        spin_unlock(&thread_lock);
+        spin_unlock(&t->state_lock);
         return INT_NO_RESCHEDULE;
     }
 
@@ -824,7 +908,7 @@ static enum handler_return thread_sleep_handler(timer_t* timer, zx_time_t now, v
     /* unblock the thread */
     bool local_resched = sched_unblock(t);
 
-    spin_unlock(&thread_lock);
+    spin_unlock(&t->state_lock);
 
     /* force a reschedule on the current cpu if the local run queue was modified in sched_unblock */
     return local_resched ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
@@ -873,7 +957,8 @@ zx_status_t thread_sleep_etc(zx_time_t deadline, bool interruptable) {
     timer_t timer;
     timer_init(&timer);
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&current_thread->state_lock, state);
 
     /* if we've been killed and going in interruptable, abort here */
     if (interruptable && unlikely((current_thread->signals))) {
@@ -901,8 +986,12 @@ zx_status_t thread_sleep_etc(zx_time_t deadline, bool interruptable) {
     /* always cancel the timer, since we may be racing with the timer tick on other cpus */
     timer_cancel(&timer);
 
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return blocked_status;
+
 out:
-    THREAD_UNLOCK(state);
+    spin_unlock_irqrestore(&current_thread->state_lock, state);
 
     return blocked_status;
 }
@@ -917,18 +1006,18 @@ zx_status_t thread_sleep_relative(zx_duration_t delay) {
 /**
  * @brief Return the number of nanoseconds a thread has been running for.
  *
- * This takes the thread_lock to ensure there are no races while calculating the
- * runtime of the thread.
+ * This takes the thread's state lock, and the lock of the run queue it's on if
+ * any, to ensure there are no races while calculating the runtime of the thread.
  */
 zx_duration_t thread_runtime(const thread_t* t) {
-    THREAD_LOCK(state);
+    thread_t* thread = (thread_t*)t;
 
-    zx_duration_t runtime = t->runtime_ns;
-    if (t->state == THREAD_RUNNING) {
-        runtime += current_time() - t->last_started_running;
-    }
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&thread->state_lock, state);
 
-    THREAD_UNLOCK(state);
+    zx_duration_t runtime = sched_get_runtime(thread);
+
+    spin_unlock_irqrestore(&thread->state_lock, state);
 
     return runtime;
 }
@@ -1014,18 +1103,22 @@ void thread_set_user_callback(thread_t* t, thread_user_callback_t cb) {
 void thread_set_priority(int priority) {
     thread_t* current_thread = get_current_thread();
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     if (priority <= IDLE_PRIORITY)
         priority = IDLE_PRIORITY + 1;
     if (priority > HIGHEST_PRIORITY)
         priority = HIGHEST_PRIORITY;
+
+    /* the run queues are indexed by priority, but we're not in one until
+     * sched_reschedule() puts us back */
     current_thread->base_priority = priority;
     current_thread->priority_boost = 0;
 
     sched_reschedule();
 
-    THREAD_UNLOCK(state);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 /**
@@ -1107,9 +1200,10 @@ thread_t* thread_create_idle_thread(cpu_num_t cpu_num) {
     t->flags |= THREAD_FLAG_IDLE | THREAD_FLAG_DETACHED;
     t->cpu_affinity = cpu_num_to_mask(cpu_num);
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&t->state_lock, state);
     sched_unblock_idle(t);
-    THREAD_UNLOCK(state);
+    spin_unlock_irqrestore(&t->state_lock, state);
 
     return t;
 }
@@ -1275,31 +1369,107 @@ void ktrace_report_live_threads(void) {
  * @defgroup  wait  Wait Queue
  * @{
  */
+
+/* wait_queue_t.woken_flags */
+#define WAIT_QUEUE_WOKEN_RESCHEDULE (1u << 0) /* a waker asked to reschedule */
+#define WAIT_QUEUE_WOKEN_HANDOFF (1u << 1)    /* the head of the woken list gets our cpu */
+
 void wait_queue_init(wait_queue_t* wait) {
     *wait = (wait_queue_t)WAIT_QUEUE_INITIAL_VALUE(*wait);
 }
 
+/* move the threads woken on a locked wait queue to |list|, returning the woken flags */
+static uint wait_queue_take_woken(wait_queue_t* wait, struct list_node* list) {
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
+
+    thread_t* t;
+    while ((t = list_remove_head_type(&wait->woken, thread_t, queue_node)))
+        list_add_tail(list, &t->queue_node);
+
+    uint flags = wait->woken_flags;
+    wait->woken_flags = 0;
+    return flags;
+}
+
+/* make runnable the threads taken off a wait queue's woken list, taking each one's
+ * state_lock. returns true if a waker asked for a reschedule and one of them went in
+ * the local run queue.
+ */
+static bool wait_queue_unblock_woken(struct list_node* list, uint flags) {
+    if (flags & WAIT_QUEUE_WOKEN_HANDOFF) {
+        thread_t* t = list_remove_head_type(list, thread_t, queue_node);
+        DEBUG_ASSERT(t);
+
+        /* the waker is about to block, so don't reschedule for this one */
+        spin_lock(&t->state_lock);
+        (void)sched_unblock_handoff(t);
+        spin_unlock(&t->state_lock);
+    }
+
+    if (list_is_empty(list))
+        return false;
+
+    bool local_resched = sched_unblock_list(list);
+    return local_resched && (flags & WAIT_QUEUE_WOKEN_RESCHEDULE);
+}
+
+void wait_queue_unlock(wait_queue_t* wait, spin_lock_saved_state_t state) {
+    DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
+
+    struct list_node list = LIST_INITIAL_VALUE(list);
+    uint flags = wait_queue_take_woken(wait, &list);
+
+    spin_unlock(&wait->lock);
+
+    /* the woken threads may free the wait queue as soon as they run */
+    if (wait_queue_unblock_woken(&list, flags))
+        sched_reschedule();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+/* take |t| off the locked wait queue it's blocked on. it stays blocked until it is made
+ * runnable after the wait queue is unlocked, which keeps timeouts and kills away from it.
+ */
+static void wait_queue_claim(wait_queue_t* wait, thread_t* t, zx_status_t wait_queue_error) {
+    spin_lock(&t->state_lock);
+
+    DEBUG_ASSERT(t->state == THREAD_BLOCKED);
+    DEBUG_ASSERT(t->blocking_wait_queue == wait);
+
+    list_delete(&t->queue_node);
+    wait->count--;
+    t->blocked_status = wait_queue_error;
+    t->blocking_wait_queue = NULL;
+
+    spin_unlock(&t->state_lock);
+}
+
 static enum handler_return wait_queue_timeout_handler(timer_t* timer, zx_time_t now, void* arg) {
     thread_t* thread = (thread_t*)arg;
 
     DEBUG_ASSERT(thread->magic == THREAD_MAGIC);
 
-    /* spin trylocking on the thread lock since the routine that set up the callback,
-     * wait_queue_block, may be trying to simultaneously cancel this timer while holding the
-     * thread_lock.
+    /* spin trylocking on the thread's state lock since the thread may have been woken some
+     * other way and be trying to cancel this timer. the wait queue lock comes after it in
+     * the lock order, so if that's busy, back off and try again.
      */
-    if (timer_trylock_or_cancel(timer, &thread_lock))
-        return INT_NO_RESCHEDULE;
+    bool local_resched = false;
+    zx_status_t status;
+    for (;;) {
+        if (timer_trylock_or_cancel(timer, &thread->state_lock))
+            return INT_NO_RESCHEDULE;
 
-    bool local_resched;
-    enum handler_return ret = INT_NO_RESCHEDULE;
-    if (thread_unblock_from_wait_queue(thread, ZX_ERR_TIMED_OUT, &local_resched) >= ZX_OK) {
-        ret = local_resched ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
-    }
+        status = thread_unblock_from_wait_queue(thread, ZX_ERR_TIMED_OUT, &local_resched);
 
-    spin_unlock(&thread_lock);
+        spin_unlock(&thread->state_lock);
 
-    return ret;
+        if (status != ZX_ERR_SHOULD_WAIT)
+            break;
+        arch_spinloop_pause();
+    }
+
+    return (status == ZX_OK && local_resched) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
 }
 
 static zx_status_t wait_queue_block_worker(wait_queue_t* wait, zx_time_t deadline,
@@ -1311,18 +1481,34 @@ static zx_status_t wait_queue_block_worker(wait_queue_t* wait, zx_time_t deadlin
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
+
+    /* let go of anyone released before we got here. we can't once we've started blocking,
+     * since that means holding our own state_lock. the wait queue stays alive while we're
+     * using it either way.
+     */
+    struct list_node woken = LIST_INITIAL_VALUE(woken);
+    uint woken_flags = wait_queue_take_woken(wait, &woken);
+    bool local_resched = wait_queue_unblock_woken(&woken, woken_flags);
 
+    zx_status_t status;
     if (deadline != ZX_TIME_INFINITE && deadline <= current_time()) {
-        return ZX_ERR_TIMED_OUT;
+        status = ZX_ERR_TIMED_OUT;
+        goto out;
     }
 
+    spin_lock(&current_thread->state_lock);
+
     if (current_thread->interruptable &&
         (unlikely(current_thread->signals & ~signal_mask))) {
         if (current_thread->signals & THREAD_SIGNAL_KILL) {
-            return ZX_ERR_INTERNAL_INTR_KILLED;
+            spin_unlock(&current_thread->state_lock);
+            status = ZX_ERR_INTERNAL_INTR_KILLED;
+            goto out;
         } else if (current_thread->signals & THREAD_SIGNAL_SUSPEND) {
-            return ZX_ERR_INTERNAL_INTR_RETRY;
+            spin_unlock(&current_thread->state_lock);
+            status = ZX_ERR_INTERNAL_INTR_RETRY;
+            goto out;
         }
     }
 
@@ -1340,6 +1526,10 @@ static zx_status_t wait_queue_block_worker(wait_queue_t* wait, zx_time_t deadlin
 
     ktrace(TAG_KWAIT_BLOCK, (uintptr_t)wait >> 32, (uintptr_t)wait, 0, 0);
 
+    /* anyone who wakes us from here on has to wait for our state_lock, which we only let
+     * go of once we're on our way off the cpu */
+    spin_unlock(&wait->lock);
+
     sched_block();
 
     ktrace(TAG_KWAIT_UNBLOCK, (uintptr_t)wait >> 32, (uintptr_t)wait, current_thread->blocked_status, 0);
@@ -1350,6 +1540,14 @@ static zx_status_t wait_queue_block_worker(wait_queue_t* wait, zx_time_t deadlin
     }
 
     return current_thread->blocked_status;
+
+out:
+    spin_unlock(&wait->lock);
+
+    if (local_resched)
+        sched_reschedule();
+
+    return status;
 }
 
 /**
@@ -1359,7 +1557,7 @@ static zx_status_t wait_queue_block_worker(wait_queue_t* wait, zx_time_t deadlin
  * queue and then blocks until some other thread wakes the queue
  * up again.
  *
- * @param  wait     The wait queue to enter
+ * @param  wait     The wait queue to enter, locked with wait_queue_lock()
  * @param  deadline The time at which to abort the wait
  *
  * If the deadline is zero, this function returns immediately with
@@ -1367,6 +1565,8 @@ static zx_status_t wait_queue_block_worker(wait_queue_t* wait, zx_time_t deadlin
  * waits indefinitely.  Otherwise, this function returns with
  * ZX_ERR_TIMED_OUT when the deadline occurs.
  *
+ * The wait queue is unlocked on return, but interrupts are left disabled.
+ *
  * @return ZX_ERR_TIMED_OUT on timeout, else returns the return
  * value specified when the queue was woken by wait_queue_wake_one().
  */
@@ -1382,7 +1582,7 @@ zx_status_t wait_queue_block(wait_queue_t* wait, zx_time_t deadline) {
  * queue and then blocks until some other thread wakes the queue
  * up again.
  *
- * @param  wait        The wait queue to enter
+ * @param  wait        The wait queue to enter, locked with wait_queue_lock()
  * @param  deadline    The time at which to abort the wait
  * @param  signal_mask Mask of existing signals to ignore
  *
@@ -1391,6 +1591,8 @@ zx_status_t wait_queue_block(wait_queue_t* wait, zx_time_t deadline) {
  * waits indefinitely.  Otherwise, this function returns with
  * ZX_ERR_TIMED_OUT when the deadline occurs.
  *
+ * The wait queue is unlocked on return, but interrupts are left disabled.
+ *
  * @return ZX_ERR_TIMED_OUT on timeout, else returns the return
  * value specified when the queue was woken by wait_queue_wake_one().
  */
@@ -1403,8 +1605,8 @@ zx_status_t wait_queue_block_with_mask(wait_queue_t* wait, zx_time_t deadline,
  * @brief  Wake up one thread sleeping on a wait queue
  *
  * This function removes one thread (if any) from the head of the wait queue and
- * makes it executable.  The new thread will be placed at the head of the
- * run queue.
+ * makes it executable once the wait queue is unlocked.  The new thread will be
+ * placed at the head of the run queue.
  *
  * @param wait  The wait queue to wake
  * @param reschedule  If true, the newly-woken thread will run immediately.
@@ -1414,58 +1616,60 @@ zx_status_t wait_queue_block_with_mask(wait_queue_t* wait, zx_time_t deadline,
  * @return  The number of threads woken (zero or one)
  */
 int wait_queue_wake_one(wait_queue_t* wait, bool reschedule, zx_status_t wait_queue_error) {
-    thread_t* t;
-    int ret = 0;
+    if (!wait_queue_dequeue_one(wait, reschedule, wait_queue_error))
+        return 0;
 
+    ktrace(TAG_KWAIT_WAKE, (uintptr_t)wait >> 32, (uintptr_t)wait, 0, 0);
+    return 1;
+}
+
+thread_t* wait_queue_dequeue_one(wait_queue_t* wait, bool reschedule,
+                                 zx_status_t wait_queue_error) {
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
-    t = list_remove_head_type(&wait->list, thread_t, queue_node);
+    thread_t* t = list_peek_head_type(&wait->list, thread_t, queue_node);
     if (t) {
-        wait->count--;
-        DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-        t->blocked_status = wait_queue_error;
-        t->blocking_wait_queue = NULL;
-
-        ktrace(TAG_KWAIT_WAKE, (uintptr_t)wait >> 32, (uintptr_t)wait, 0, 0);
-
-        /* wake up the new thread, putting it in a run queue on a cpu. reschedule if the local */
-        /* cpu run queue was modified */
-        bool local_resched = sched_unblock(t);
-        if (reschedule && local_resched)
-            sched_reschedule();
-
-        ret = 1;
+        wait_queue_claim(wait, t, wait_queue_error);
+        list_add_tail(&wait->woken, &t->queue_node);
+        if (reschedule)
+            wait->woken_flags |= WAIT_QUEUE_WOKEN_RESCHEDULE;
     }
 
-    return ret;
+    return t;
 }
 
-thread_t* wait_queue_dequeue_one(wait_queue_t* wait, zx_status_t wait_queue_error) {
-    thread_t* t;
+int wait_queue_wake_one_handoff(wait_queue_t* wait, zx_status_t wait_queue_error) {
+    DEBUG_ASSERT(!arch_in_int_handler());
 
-    DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
-    DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    thread_t* current_thread = get_current_thread();
+    if (likely(!current_thread->wake_handoff))
+        return wait_queue_wake_one(wait, false, wait_queue_error);
 
-    t = list_remove_head_type(&wait->list, thread_t, queue_node);
-    if (t) {
-        wait->count--;
-        DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-        t->blocked_status = wait_queue_error;
-        t->blocking_wait_queue = NULL;
+    thread_t* t = wait_queue_dequeue_one(wait, false, wait_queue_error);
+    if (!t)
+        return 0;
+
+    ktrace(TAG_KWAIT_WAKE, (uintptr_t)wait >> 32, (uintptr_t)wait, 0, 0);
+
+    /* only the first thread released this way gets the cpu */
+    current_thread->wake_handoff = false;
+    if (!(wait->woken_flags & WAIT_QUEUE_WOKEN_HANDOFF)) {
+        list_delete(&t->queue_node);
+        list_add_head(&wait->woken, &t->queue_node);
+        wait->woken_flags |= WAIT_QUEUE_WOKEN_HANDOFF;
     }
 
-    return t;
+    return 1;
 }
 
 /**
  * @brief  Wake all threads sleeping on a wait queue
  *
  * This function removes all threads (if any) from the wait queue and
- * makes them executable.  The new threads will be placed at the head of the
- * run queue.
+ * makes them executable once the wait queue is unlocked.  The new threads will
+ * be placed at the head of the run queue.
  *
  * @param wait  The wait queue to wake
  * @param reschedule  If true, the newly-woken threads will run immediately.
@@ -1480,22 +1684,15 @@ int wait_queue_wake_all(wait_queue_t* wait, bool reschedule, zx_status_t wait_qu
 
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
     if (wait->count == 0)
         return 0;
 
-    struct list_node list = LIST_INITIAL_VALUE(list);
-
-    /* pop all the threads off the wait queue into the run queue */
-    while ((t = list_remove_head_type(&wait->list, thread_t, queue_node))) {
-        wait->count--;
-
-        DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-        t->blocked_status = wait_queue_error;
-        t->blocking_wait_queue = NULL;
-
-        list_add_tail(&list, &t->queue_node);
+    /* pop all the threads off the wait queue onto the woken list */
+    while ((t = list_peek_head_type(&wait->list, thread_t, queue_node))) {
+        wait_queue_claim(wait, t, wait_queue_error);
+        list_add_tail(&wait->woken, &t->queue_node);
 
         ret++;
     }
@@ -1503,13 +1700,10 @@ int wait_queue_wake_all(wait_queue_t* wait, bool reschedule, zx_status_t wait_qu
     DEBUG_ASSERT(ret > 0);
     DEBUG_ASSERT(wait->count == 0);
 
-    ktrace(TAG_KWAIT_WAKE, (uintptr_t)wait >> 32, (uintptr_t)wait, 0, 0);
+    if (reschedule)
+        wait->woken_flags |= WAIT_QUEUE_WOKEN_RESCHEDULE;
 
-    /* wake up the new thread(s), putting it in a run queue on a cpu. reschedule if the local */
-    /* cpu run queue was modified */
-    bool local_resched = sched_unblock_list(&list);
-    if (reschedule && local_resched)
-        sched_reschedule();
+    ktrace(TAG_KWAIT_WAKE, (uintptr_t)wait >> 32, (uintptr_t)wait, 0, 0);
 
     return ret;
 }
@@ -1517,7 +1711,7 @@ int wait_queue_wake_all(wait_queue_t* wait, bool reschedule, zx_status_t wait_qu
 bool wait_queue_is_empty(wait_queue_t* wait) {
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
     return list_is_empty(&wait->list);
 }
@@ -1537,6 +1731,7 @@ void wait_queue_destroy(wait_queue_t* wait) {
     if (!list_is_empty(&wait->list)) {
         panic("wait_queue_destroy() called on non-empty wait_queue_t\n");
     }
+    DEBUG_ASSERT(list_is_empty(&wait->woken));
 
     wait->magic = 0;
 }
@@ -1545,36 +1740,71 @@ void wait_queue_destroy(wait_queue_t* wait) {
  * @brief  Wake a specific thread in a wait queue
  *
  * This function extracts a specific thread from a wait queue, wakes it, and
- * puts it at the head of the run queue.
+ * puts it at the head of the run queue. It is called with the thread's
+ * state_lock held, which comes before the wait queue lock in the lock order,
+ * so the wait queue lock is only tried.
  *
  * @param t  The thread to wake
  * @param wait_queue_error  The return value which the new thread will receive from wait_queue_block().
  * @param local_resched  Returns if the caller should reschedule locally.
  *
- * @return ZX_ERR_BAD_STATE if thread was not in any wait queue.
+ * @return ZX_ERR_BAD_STATE if thread was not in any wait queue, ZX_ERR_SHOULD_WAIT
+ * if the wait queue is busy and the caller should drop the state_lock and try again.
  */
 static zx_status_t thread_unblock_from_wait_queue(thread_t* t, zx_status_t wait_queue_error, bool* local_resched) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&t->state_lock));
 
-    if (t->state != THREAD_BLOCKED)
+    /* a thread that's already been released from its wait queue is as good as awake */
+    wait_queue_t* wait = t->blocking_wait_queue;
+    if (t->state != THREAD_BLOCKED || wait == NULL)
         return ZX_ERR_BAD_STATE;
 
-    DEBUG_ASSERT(t->blocking_wait_queue != NULL);
-    DEBUG_ASSERT(t->blocking_wait_queue->magic == WAIT_QUEUE_MAGIC);
+    DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(list_in_list(&t->queue_node));
 
+    if (spin_trylock(&wait->lock))
+        return ZX_ERR_SHOULD_WAIT;
+
     list_delete(&t->queue_node);
-    t->blocking_wait_queue->count--;
+    wait->count--;
     t->blocking_wait_queue = NULL;
     t->blocked_status = wait_queue_error;
 
+    spin_unlock(&wait->lock);
+
     *local_resched = sched_unblock(t);
 
     return ZX_OK;
 }
 
+/* wake |t| up with |wait_queue_error| if it's blocked or sleeping interruptably. may
+ * drop and retake t->state_lock while waiting for the wait queue it's blocked on.
+ */
+static void thread_interrupt(thread_t* t, zx_status_t wait_queue_error, bool* local_resched) {
+    DEBUG_ASSERT(spin_lock_held(&t->state_lock));
+
+    for (;;) {
+        if (!t->interruptable)
+            return;
+
+        if (t->state == THREAD_SLEEPING) {
+            t->blocked_status = wait_queue_error;
+            *local_resched = sched_unblock(t);
+            return;
+        }
+
+        if (thread_unblock_from_wait_queue(t, wait_queue_error, local_resched) != ZX_ERR_SHOULD_WAIT)
+            return;
+
+        /* let whoever holds the wait queue lock get at our state_lock */
+        spin_unlock(&t->state_lock);
+        arch_spinloop_pause();
+        spin_lock(&t->state_lock);
+    }
+}
+
 #define THREAD_BACKTRACE_DEPTH 16
 typedef struct thread_backtrace {
     void* pc[THREAD_BACKTRACE_DEPTH];
@@ -37,12 +37,170 @@
 
 #define LOCAL_TRACE 0
 
-static spin_lock_t timer_lock;
-
 void timer_init(timer_t* timer) {
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
+static inline bool timer_is_queued(const timer_t* timer) {
+    return timer->queue_cpu >= 0;
+}
+
+// The per cpu timer queue is an AVL tree ordered by scheduled_time, with
+// timers that have the same scheduled_time kept in insertion order. The
+// earliest timer is cached in |head| so that timer_tick() doesn't have to
+// walk down the tree to find it.
+
+static inline int node_height(const timer_t* t) {
+    return t ? t->height : 0;
+}
+
+static inline void update_height(timer_t* t) {
+    int l = node_height(t->left);
+    int r = node_height(t->right);
+    t->height = 1 + ((l > r) ? l : r);
+}
+
+// Makes |child| take the place of |old| under |parent|, or at the root.
+static void replace_child(struct timer_queue* q, timer_t* parent,
+                          timer_t* old, timer_t* child) {
+    if (parent == NULL) {
+        q->root = child;
+    } else if (parent->left == old) {
+        parent->left = child;
+    } else {
+        parent->right = child;
+    }
+    if (child != NULL)
+        child->parent = parent;
+}
+
+static timer_t* rotate_left(struct timer_queue* q, timer_t* x) {
+    timer_t* y = x->right;
+    x->right = y->left;
+    if (y->left != NULL)
+        y->left->parent = x;
+    replace_child(q, x->parent, x, y);
+    y->left = x;
+    x->parent = y;
+    update_height(x);
+    update_height(y);
+    return y;
+}
+
+static timer_t* rotate_right(struct timer_queue* q, timer_t* x) {
+    timer_t* y = x->left;
+    x->left = y->right;
+    if (y->right != NULL)
+        y->right->parent = x;
+    replace_child(q, x->parent, x, y);
+    y->right = x;
+    x->parent = y;
+    update_height(x);
+    update_height(y);
+    return y;
+}
+
+// Restores the height invariant on the path from |t| up to the root.
+static void rebalance(struct timer_queue* q, timer_t* t) {
+    while (t != NULL) {
+        update_height(t);
+        int balance = node_height(t->left) - node_height(t->right);
+        if (balance > 1) {
+            if (node_height(t->left->left) < node_height(t->left->right))
+                rotate_left(q, t->left);
+            t = rotate_right(q, t);
+        } else if (balance < -1) {
+            if (node_height(t->right->right) < node_height(t->right->left))
+                rotate_right(q, t->right);
+            t = rotate_left(q, t);
+        }
+        t = t->parent;
+    }
+}
+
+static timer_t* timer_queue_next(timer_t* t) {
+    if (t->right != NULL) {
+        t = t->right;
+        while (t->left != NULL)
+            t = t->left;
+        return t;
+    }
+    while (t->parent != NULL && t == t->parent->right)
+        t = t->parent;
+    return t->parent;
+}
+
+static inline timer_t* timer_queue_head(uint cpu) {
+    return percpu[cpu].timer_queue.head;
+}
+
+static void timer_queue_add(uint cpu, timer_t* timer) {
+    struct timer_queue* q = &percpu[cpu].timer_queue;
+
+    timer_t* parent = NULL;
+    timer_t** link = &q->root;
+    bool leftmost = true;
+    while (*link != NULL) {
+        parent = *link;
+        if (timer->scheduled_time < parent->scheduled_time) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    timer->parent = parent;
+    timer->left = NULL;
+    timer->right = NULL;
+    timer->height = 1;
+    timer->queue_cpu = (int)cpu;
+    *link = timer;
+    if (leftmost)
+        q->head = timer;
+
+    rebalance(q, parent);
+}
+
+static void timer_queue_remove(uint cpu, timer_t* timer) {
+    struct timer_queue* q = &percpu[cpu].timer_queue;
+    DEBUG_ASSERT(timer->queue_cpu == (int)cpu);
+
+    if (q->head == timer)
+        q->head = timer_queue_next(timer);
+
+    timer_t* rebalance_from;
+    if (timer->left != NULL && timer->right != NULL) {
+        // Put the in-order successor, which has no left child, in our place.
+        timer_t* succ = timer->right;
+        while (succ->left != NULL)
+            succ = succ->left;
+        if (succ->parent != timer) {
+            rebalance_from = succ->parent;
+            replace_child(q, succ->parent, succ, succ->right);
+            succ->right = timer->right;
+            succ->right->parent = succ;
+        } else {
+            rebalance_from = succ;
+        }
+        replace_child(q, timer->parent, timer, succ);
+        succ->left = timer->left;
+        succ->left->parent = succ;
+        succ->height = timer->height;
+    } else {
+        rebalance_from = timer->parent;
+        replace_child(q, timer->parent, timer,
+                      (timer->left != NULL) ? timer->left : timer->right);
+    }
+    rebalance(q, rebalance_from);
+
+    timer->parent = NULL;
+    timer->left = NULL;
+    timer->right = NULL;
+    timer->height = 0;
+    timer->queue_cpu = -1;
+}
+
 static void insert_timer_in_queue(uint cpu, timer_t* timer,
                                   uint64_t early_slack, uint64_t late_slack) {
 
@@ -52,109 +210,92 @@ static void insert_timer_in_queue(uint cpu, timer_t* timer,
     zx_time_t earliest_deadline = timer->scheduled_time - early_slack;
     zx_time_t latest_deadline = timer->scheduled_time + late_slack;
 
-    // For inserting the timer we consider several cases. In general we
-    // want to coalesce with the current timer unless we can prove that
-    // either that:
-    //  1- there is no slack overlap with current timer OR
-    //  2- the next timer is a better fit.
+    // In general we want to coalesce with an existing timer unless we can
+    // prove that either:
+    //  1- there is no slack overlap with any existing timer OR
+    //  2- another timer is a better fit.
+    //
+    // Only the two timers on either side of the new one can be candidates,
+    // so find them with a single walk down the tree.
     //
     // In diagrams that follow
-    // - Let |e| be the current (existing) timer deadline
     // - Let |t| be the deadline of the timer we are inserting
-    // - Let |n| be the next timer deadline if any
-    // - Let |x| be the end of the list (not a timer)
+    // - Let |p| be the latest timer deadline before |t|, if any
+    // - Let |n| be the earliest timer deadline at or after |t|, if any
     // - Let |(| and |)| the earliest_deadline and latest_deadline.
     //
-    timer_t* entry;
-
-    list_for_every_entry (&percpu[cpu].timer_queue, entry, timer_t, node) {
-        if (entry->scheduled_time > latest_deadline) {
-            // New timer latest is earlier than the current timer.
-            // Just add upfront as is, without slack.
-            //
-            //   ---------t---)--e-------------------------------> time
-            //
-            timer->slack = 0ull;
-            list_add_before(&entry->node, &timer->node);
-            return;
-        }
-
-        if (entry->scheduled_time >= timer->scheduled_time) {
-            //  New timer slack overlaps and is to the left (or equal). We
-            //  coalesce with current by scheduling late.
-            //
-            //  --------(----t---e-)----------------------------> time
-            //
-            timer->slack = entry->scheduled_time - timer->scheduled_time;
-            timer->scheduled_time = entry->scheduled_time;
-            list_add_after(&entry->node, &timer->node);
-            return;
+    timer_t* prev = NULL;
+    timer_t* next = NULL;
+    for (timer_t* t = percpu[cpu].timer_queue.root; t != NULL;) {
+        if (t->scheduled_time < timer->scheduled_time) {
+            prev = t;
+            t = t->right;
+        } else {
+            next = t;
+            t = t->left;
         }
+    }
 
-        if (entry->scheduled_time < earliest_deadline) {
-            // new timer earliest is later than the current timer. This case
-            // is handled in a future iteration.
+    timer_t* target = NULL;
+    if (prev != NULL && prev->scheduled_time >= earliest_deadline) {
+        // New timer is to the right of the previous timer and there is
+        // overlap, but could the next timer (if any) be a better fit?
+        //
+        //  -------------(--p---t-----?-------------------> time
+        //
+        target = prev;
+        if (next != NULL && (next->scheduled_time < latest_deadline ||
+                             next->scheduled_time == timer->scheduled_time)) {
+            // There is slack overlap with the next timer, and also with the
+            // previous timer. Which coalescing is a better match?
             //
-            //   ----------------e--(---t-----------------------> time
+            //  --------------(-p---t---n-)-----------------------> time
             //
-            continue;
+            zx_duration_t delta_prev = timer->scheduled_time - prev->scheduled_time;
+            zx_duration_t delta_next = next->scheduled_time - timer->scheduled_time;
+            if (delta_next < delta_prev)
+                target = next;
         }
-
-        // New timer is to the right of current timer and there is overlap
-        // with the current timer, but could the next timer (if any) be
-        // a better fit?
+    } else if (next != NULL && next->scheduled_time <= latest_deadline) {
+        //  New timer slack overlaps and is to the left (or equal) of the
+        //  next timer. We coalesce with it by scheduling late.
         //
-        //  -------------(--e---t-----?-------------------> time
+        //  --------(----t---n-)----------------------------> time
         //
+        target = next;
+    }
 
-        const timer_t* next =
-            list_next_type(&percpu[cpu].timer_queue, &entry->node, timer_t, node);
-
-        if (next != NULL) {
-            if (next->scheduled_time <= timer->scheduled_time) {
-                // The new timer is to the right of the next timer. There is no
-                // chance the current timer is a better fit.
-                //
-                //  -------------(--e---n---t----------------------> time
-                //
-                continue;
-            }
-
-            if (next->scheduled_time < latest_deadline) {
-                // There is slack overlap with the next timer, and also with the
-                // current timer. Which coalescing is a better match?
-                //
-                //  --------------(-e---t---n-)-----------------------> time
-                //
-                zx_duration_t delta_entry = timer->scheduled_time - entry->scheduled_time;
-                zx_duration_t delta_next = next->scheduled_time - timer->scheduled_time;
-                if (delta_next < delta_entry) {
-                    // New timer is closer to the next timer, handle it in the
-                    // next iteration.
-                    continue;
-                }
-            }
-        }
-
-        // Handles the remaining cases, note that there is overlap with
-        // the current timer.
-        //
-        //  1- this is the last timer (next == NULL) or
-        //  2- there is no overlap with the next timer, or
-        //  3- there is overlap with both current and next but
-        //     current is closer.
+    if (target != NULL) {
+        timer->slack = target->scheduled_time - timer->scheduled_time;
+        timer->scheduled_time = target->scheduled_time;
+    } else {
+        // No slack overlap with either neighbor. Add as is, without slack.
         //
-        //  So we coalesce by scheduling early.
+        //   -----p--(---t---)--n---------------------------> time
         //
-        timer->slack = entry->scheduled_time - timer->scheduled_time;
-        timer->scheduled_time = entry->scheduled_time;
-        list_add_after(&entry->node, &timer->node);
-        return;
+        timer->slack = 0ull;
     }
+    timer_queue_add(cpu, timer);
+}
 
-    // Walked off the end of the list and there was no overlap.
-    timer->slack = 0ull;
-    list_add_tail(&percpu[cpu].timer_queue, &timer->node);
+// Locks the timer queue of the cpu that |timer| is queued on, or whose
+// timer_tick() is running its callback, and returns that cpu. Returns -1
+// without taking a lock if the timer is neither queued nor running.
+static int lock_timer_cpu(timer_t* timer) {
+    for (;;) {
+        int cpu = timer->queue_cpu;
+        if (cpu < 0)
+            cpu = timer->active_cpu;
+        if (cpu < 0)
+            return -1;
+
+        spin_lock(&percpu[cpu].timer_lock);
+        // The timer may have fired or moved while we were spinning.
+        if (timer->queue_cpu == cpu ||
+            (timer->queue_cpu < 0 && timer->active_cpu == cpu))
+            return cpu;
+        spin_unlock(&percpu[cpu].timer_lock);
+    }
 }
 
 void timer_set(timer_t* timer, zx_time_t deadline,
@@ -166,8 +307,8 @@ void timer_set(timer_t* timer, zx_time_t deadline,
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
     DEBUG_ASSERT(mode <= TIMER_SLACK_EARLY);
 
-    if (list_in_list(&timer->node)) {
-        panic("timer %p already in list\n", timer);
+    if (timer_is_queued(timer)) {
+        panic("timer %p already in a queue\n", timer);
     }
 
     zx_duration_t late_slack;
@@ -196,9 +337,10 @@ void timer_set(timer_t* timer, zx_time_t deadline,
     }
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     uint cpu = arch_curr_cpu_num();
+    spin_lock(&percpu[cpu].timer_lock);
 
     bool currently_active = (timer->active_cpu == (int)cpu);
     if (unlikely(currently_active)) {
@@ -220,14 +362,15 @@ void timer_set(timer_t* timer, zx_time_t deadline,
 
     insert_timer_in_queue(cpu, timer, early_slack, late_slack);
 
-    if (list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node) == timer) {
+    if (timer_queue_head(cpu) == timer) {
         /* we just modified the head of the timer queue */
         LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
         platform_set_oneshot_timer(deadline);
     }
 
 out:
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock(&percpu[cpu].timer_lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 /* similar to timer_set_oneshot, with additional features/constraints:
@@ -245,15 +388,17 @@ void timer_reset_oneshot_local(timer_t* timer, zx_time_t deadline, timer_callbac
     uint cpu = arch_curr_cpu_num();
 
     /* no need to disable interrupts when acquiring this lock */
-    spin_lock(&timer_lock);
+    spin_lock(&percpu[cpu].timer_lock);
 
     if (unlikely(timer->active_cpu >= 0)) {
         panic("timer %p currently active\n", timer);
     }
 
     /* remove it from the queue if it was present */
-    if (list_in_list(&timer->node))
-        list_delete(&timer->node);
+    if (timer_is_queued(timer)) {
+        DEBUG_ASSERT(timer->queue_cpu == (int)cpu);
+        timer_queue_remove(cpu, timer);
+    }
 
     /* set up the structure */
     timer->scheduled_time = deadline;
@@ -267,23 +412,28 @@ void timer_reset_oneshot_local(timer_t* timer, zx_time_t deadline, timer_callbac
 
     insert_timer_in_queue(cpu, timer, 0u, 0u);
 
-    if (list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node) == timer) {
+    if (timer_queue_head(cpu) == timer) {
         /* we just modified the head of the timer queue */
         LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
         platform_set_oneshot_timer(deadline);
     }
 
-    spin_unlock(&timer_lock);
+    spin_unlock(&percpu[cpu].timer_lock);
 }
 
 bool timer_cancel(timer_t* timer) {
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     uint cpu = arch_curr_cpu_num();
 
+    /* lock the queue the timer is on, or the one whose cpu is running it; a
+     * callback can only requeue its timer on that same cpu.
+     */
+    int locked_cpu = lock_timer_cpu(timer);
+
     /* mark the timer as canceled */
     timer->cancel = true;
     smp_mb();
@@ -298,21 +448,24 @@ bool timer_cancel(timer_t* timer) {
         timer->arg = NULL;
 
         /* we're done, so return back to the callback */
-        spin_unlock_irqrestore(&timer_lock, state);
+        DEBUG_ASSERT(locked_cpu == (int)cpu);
+        spin_unlock(&percpu[cpu].timer_lock);
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
         return false;
     }
 
     bool callback_not_running;
 
     /* if the timer is in a queue, remove it and adjust hardware timers if needed */
-    if (list_in_list(&timer->node)) {
+    if (timer_is_queued(timer)) {
+        DEBUG_ASSERT(timer->queue_cpu == locked_cpu);
         callback_not_running = true;
 
         /* save a copy of the old head of the queue */
-        timer_t* oldhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        timer_t* oldhead = timer_queue_head(locked_cpu);
 
         /* remove our timer from the queue */
-        list_delete(&timer->node);
+        timer_queue_remove(locked_cpu, timer);
 
         /* TODO(cpu): if  after removing |timer| there is one other single timer with
            the same scheduled_time and slack non-zero then it is possible to return
@@ -320,8 +473,8 @@ bool timer_cancel(timer_t* timer) {
 
         /* see if we've just modified the head of this cpu's timer queue */
         /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
-        if (unlikely(oldhead == timer)) {
-            timer_t* newhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        if (unlikely(oldhead == timer) && locked_cpu == (int)cpu) {
+            timer_t* newhead = timer_queue_head(cpu);
             if (newhead) {
                 LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
                 platform_set_oneshot_timer(newhead->scheduled_time);
@@ -334,7 +487,9 @@ bool timer_cancel(timer_t* timer) {
         callback_not_running = false;
     }
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    if (locked_cpu >= 0)
+        spin_unlock(&percpu[locked_cpu].timer_lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     /* wait for the timer to become un-busy in case a callback is currently active on another cpu */
     while (timer->active_cpu >= 0) {
@@ -361,11 +516,11 @@ enum handler_return timer_tick(zx_time_t now) {
 
     LTRACEF("cpu %u now %" PRIu64 ", sp %p\n", cpu, now, __GET_FRAME());
 
-    spin_lock(&timer_lock);
+    spin_lock(&percpu[cpu].timer_lock);
 
     for (;;) {
         /* see if there's an event to process */
-        timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        timer = timer_queue_head(cpu);
         if (likely(timer == 0))
             break;
         LTRACEF("next item on timer queue %p at %" PRIu64 " now %" PRIu64 " (%p, arg %p)\n",
@@ -378,14 +533,14 @@ enum handler_return timer_tick(zx_time_t now) {
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                          "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                          timer, (uint)timer->magic);
-        list_delete(&timer->node);
+        timer_queue_remove(cpu, timer);
 
         /* mark the timer busy */
         timer->active_cpu = cpu;
         /* spinlock below acts as a memory barrier */
 
-        /* we pulled it off the list, release the list lock to handle it */
-        spin_unlock(&timer_lock);
+        /* we pulled it off the queue, release the queue lock to handle it */
+        spin_unlock(&percpu[cpu].timer_lock);
 
         LTRACEF("dequeued timer %p, scheduled %" PRIu64 "\n", timer, timer->scheduled_time);
 
@@ -397,7 +552,7 @@ enum handler_return timer_tick(zx_time_t now) {
 
         DEBUG_ASSERT(arch_ints_disabled());
         /* it may have been requeued, grab the lock so we can safely inspect it */
-        spin_lock(&timer_lock);
+        spin_lock(&percpu[cpu].timer_lock);
 
         /* mark it not busy */
         timer->active_cpu = -1;
@@ -408,7 +563,7 @@ enum handler_return timer_tick(zx_time_t now) {
     }
 
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer = timer_queue_head(cpu);
     if (timer) {
         /* has to be the case or it would have fired already */
         DEBUG_ASSERT(timer->scheduled_time > now);
@@ -419,7 +574,7 @@ enum handler_return timer_tick(zx_time_t now) {
     }
 
     /* we're done manipulating the timer queue */
-    spin_unlock(&timer_lock);
+    spin_unlock(&percpu[cpu].timer_lock);
 
     return ret;
 }
@@ -443,50 +598,58 @@ zx_status_t timer_trylock_or_cancel(timer_t* t, spin_lock_t* lock) {
 
 void timer_transition_off_cpu(uint old_cpu) {
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
     uint cpu = arch_curr_cpu_num();
+    DEBUG_ASSERT(cpu != old_cpu);
+
+    /* take both queue locks in cpu order */
+    spin_lock(&percpu[MIN(cpu, old_cpu)].timer_lock);
+    spin_lock(&percpu[MAX(cpu, old_cpu)].timer_lock);
 
-    timer_t* old_head = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer_t* old_head = timer_queue_head(cpu);
 
-    timer_t *entry = NULL, *tmp_entry = NULL;
+    timer_t* entry;
     /* Move all timers from old_cpu to this cpu */
-    list_for_every_entry_safe (&percpu[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
+    while ((entry = timer_queue_head(old_cpu)) != NULL) {
+        timer_queue_remove(old_cpu, entry);
         // We lost the original asymmetric slack information so when we combine them
         // with the other timer queue they are not coalesced again.
         // TODO(cpu): figure how important this case is.
         insert_timer_in_queue(cpu, entry, 0u, 0u);
     }
 
-    timer_t* new_head = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer_t* new_head = timer_queue_head(cpu);
     if (new_head != NULL && new_head != old_head) {
         /* we just modified the head of the timer queue */
         LTRACEF("setting new timer for %" PRIu64 " nsecs\n", new_head->scheduled_time);
         platform_set_oneshot_timer(new_head->scheduled_time);
     }
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock(&percpu[MAX(cpu, old_cpu)].timer_lock);
+    spin_unlock(&percpu[MIN(cpu, old_cpu)].timer_lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 void timer_thaw_percpu(void) {
     DEBUG_ASSERT(arch_ints_disabled());
-    spin_lock(&timer_lock);
 
     uint cpu = arch_curr_cpu_num();
+    spin_lock(&percpu[cpu].timer_lock);
 
-    timer_t* t = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer_t* t = timer_queue_head(cpu);
     if (t) {
         LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", t->scheduled_time);
         platform_set_oneshot_timer(t->scheduled_time);
     }
 
-    spin_unlock(&timer_lock);
+    spin_unlock(&percpu[cpu].timer_lock);
 }
 
 void timer_queue_init(void) {
-    timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&percpu[i].timer_queue);
+        percpu[i].timer_lock = SPIN_LOCK_INITIAL_VALUE;
+        percpu[i].timer_queue.root = NULL;
+        percpu[i].timer_queue.head = NULL;
     }
 }
 
@@ -495,16 +658,15 @@ static void dump_timer_queues(char* buf, size_t len) {
     size_t ptr = 0;
     zx_time_t now = current_time();
 
-    spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
-
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
         if (mp_is_cpu_online(i)) {
+            spin_lock_saved_state_t state;
+            spin_lock_irqsave(&percpu[i].timer_lock, state);
+
             ptr += snprintf(buf + ptr, len - ptr, "cpu %u:\n", i);
 
-            timer_t* t;
             zx_time_t last = now;
-            list_for_every_entry (&percpu[i].timer_queue, t, timer_t, node) {
+            for (timer_t* t = timer_queue_head(i); t != NULL; t = timer_queue_next(t)) {
                 zx_duration_t delta_now = (t->scheduled_time > now) ? (t->scheduled_time - now) : 0;
                 zx_duration_t delta_last = (t->scheduled_time > last) ? (t->scheduled_time - last) : 0;
                 ptr += snprintf(buf + ptr, len - ptr,
@@ -512,10 +674,10 @@ static void dump_timer_queues(char* buf, size_t len) {
                                 t->scheduled_time, delta_now, delta_last, t->callback, t->arg);
                 last = t->scheduled_time;
             }
+
+            spin_unlock_irqrestore(&percpu[i].timer_lock, state);
         }
     }
-
-    spin_unlock_irqrestore(&timer_lock, state);
 }
 
 #if WITH_LIB_CONSOLE
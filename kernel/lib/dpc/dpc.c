@@ -43,26 +43,6 @@ zx_status_t dpc_queue(dpc_t *dpc, bool reschedule)
     return ZX_OK;
 }
 
-zx_status_t dpc_queue_thread_locked(dpc_t *dpc)
-{
-    DEBUG_ASSERT(dpc);
-    DEBUG_ASSERT(dpc->func);
-
-    if (list_in_list(&dpc->node))
-        return ZX_OK;
-
-    spin_lock_saved_state_t state;
-    spin_lock_irqsave(&dpc_lock, state);
-
-    // put the dpc at the tail of the list and signal the worker
-    list_add_tail(&dpc_list, &dpc->node);
-    event_signal_thread_locked(&dpc_event);
-
-    spin_unlock_irqrestore(&dpc_lock, state);
-
-    return ZX_OK;
-}
-
 bool dpc_cancel(dpc_t *dpc)
 {
     DEBUG_ASSERT(dpc);
@@ -35,10 +35,6 @@ typedef struct dpc {
 /* the deferred procedure runs in a dedicated thread that runs at DPC_THREAD_PRIORITY */
 zx_status_t dpc_queue(dpc_t *dpc, bool reschedule);
 
-/* queue a dpc, but must be holding the thread lock */
-/* does not force a reschedule */
-zx_status_t dpc_queue_thread_locked(dpc_t *dpc);
-
 /* Cancels a previously queued dpc. Returns true if the the dpc was canceled */
 /* before it was scheduled to run. */
 bool dpc_cancel(dpc_t *dpc);
@@ -19,6 +19,14 @@ void* cmpct_realloc(void*, size_t);
 void cmpct_free(void*);
 void* cmpct_memalign(size_t size, size_t alignment);
 
+// Allocate up to |count| areas of |size| bytes into |ptrs|, taking the heap lock
+// once. Returns the number allocated.
+size_t cmpct_alloc_batch(size_t size, void** ptrs, size_t count);
+// Free |count| areas, taking the heap lock once. NULL entries are skipped.
+void cmpct_free_batch(void** ptrs, size_t count);
+// The number of usable bytes in an allocated area, which may be more than was asked for.
+size_t cmpct_usable_size(const void* payload);
+
 void cmpct_init(void);
 void cmpct_dump(bool panic_time);
 void cmpct_get_info(size_t* size_bytes, size_t* free_bytes);
@@ -0,0 +1,219 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/heap_cache.h>
+
+#include <assert.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <kernel/auto_lock.h>
+#include <lib/cmpctmalloc.h>
+#include <string.h>
+#include <trace.h>
+
+#define LOCAL_TRACE 0
+
+// Mirror cmpctmalloc's debug fills, since cached objects never go back through
+// it to be checked.
+#if defined(DEBUG) || LK_DEBUGLEVEL > 2
+#define HEAP_CACHE_DEBUG
+#endif
+
+// Also look for double frees in every other cpu's magazine. This takes each
+// cpu's lock on every free, so it is kept out of the regular debug checks,
+// which only look at the freeing cpu's own magazine.
+#ifndef HEAP_CACHE_CHECK_ALL_CPUS
+#define HEAP_CACHE_CHECK_ALL_CPUS 0
+#endif
+
+#define ALLOC_FILL 0x99
+#define FREE_FILL 0x77
+
+namespace {
+
+// All caches that have been used at least once, for DrainAll() and DumpAll().
+spin_lock_t registry_lock = SPIN_LOCK_INITIAL_VALUE;
+HeapCache* registry_head = nullptr;
+
+} // namespace
+
+void HeapCache::Register() {
+    AutoSpinLockIrqSave guard(&registry_lock);
+    if (registered_)
+        return;
+    registered_ = true;
+    next_ = registry_head;
+    registry_head = this;
+}
+
+void HeapCache::FillFree(void* ptr) const {
+#ifdef HEAP_CACHE_DEBUG
+    memset(ptr, FREE_FILL, object_size_);
+#endif
+}
+
+void HeapCache::CheckFreeFill(void* ptr) const {
+#ifdef HEAP_CACHE_DEBUG
+    for (size_t i = 0; i < object_size_; i++) {
+        uint8_t byte = static_cast<uint8_t*>(ptr)[i];
+        if (byte != FREE_FILL) {
+            panic("%s: write after free at %p, offset %zu, fill was %02x\n",
+                  name_, ptr, i, byte);
+        }
+    }
+    memset(ptr, ALLOC_FILL, object_size_);
+#endif
+}
+
+bool HeapCache::IsCachedLocked(const PerCpu& cpu, const void* ptr) const {
+    for (size_t i = 0; i < cpu.count; i++) {
+        if (cpu.objects[i] == ptr)
+            return true;
+    }
+    return false;
+}
+
+void* HeapCache::Alloc() {
+    void* ptr = nullptr;
+    {
+        // We may migrate before the lock is taken; that's fine, it's the lock
+        // that protects the magazine, not the cpu we happen to be running on.
+        PerCpu& cpu = current_cpu();
+        AutoSpinLockIrqSave guard(&cpu.lock);
+        cpu.allocs++;
+        if (likely(cpu.count > 0)) {
+            ptr = cpu.objects[--cpu.count];
+        } else {
+            cpu.misses++;
+        }
+    }
+    if (likely(ptr != nullptr)) {
+        CheckFreeFill(ptr);
+        return ptr;
+    }
+
+    if (unlikely(!registered_))
+        Register();
+
+    // Refill outside of the spinlock; the heap lock is a mutex. Keep one of
+    // the batch for the caller and stash the rest on whichever cpu we end up on.
+    void* batch[kBatchSize];
+    size_t count = cmpct_alloc_batch(object_size_, batch, kBatchSize);
+    if (count == 0)
+        return nullptr;
+
+    void* result = batch[--count];
+    for (size_t i = 0; i < count; i++)
+        FillFree(batch[i]);
+    size_t stashed = 0;
+    {
+        PerCpu& cpu = current_cpu();
+        AutoSpinLockIrqSave guard(&cpu.lock);
+        while (stashed < count && cpu.count < kMagazineSize)
+            cpu.objects[cpu.count++] = batch[stashed++];
+    }
+    if (stashed < count)
+        cmpct_free_batch(batch + stashed, count - stashed);
+
+    LTRACEF("%s: refilled %zu\n", name_, stashed);
+    return result;
+}
+
+void HeapCache::Free(void* ptr) {
+    if (ptr == nullptr)
+        return;
+    // cmpct_usable_size() catches objects that have already gone back to the heap.
+    DEBUG_ASSERT(cmpct_usable_size(ptr) >= object_size_);
+#if HEAP_CACHE_CHECK_ALL_CPUS
+    // and this catches the ones still sitting in a magazine, on any cpu
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        AutoSpinLockIrqSave guard(&cpu_[i].lock);
+        if (IsCachedLocked(cpu_[i], ptr))
+            panic("%s: double free of %p\n", name_, ptr);
+    }
+#endif
+    FillFree(ptr);
+
+    void* batch[kBatchSize];
+    {
+        PerCpu& cpu = current_cpu();
+        AutoSpinLockIrqSave guard(&cpu.lock);
+        // Bounded by the magazine size; a double free of an object cached on
+        // another cpu is only caught with HEAP_CACHE_CHECK_ALL_CPUS.
+        DEBUG_ASSERT_MSG(!IsCachedLocked(cpu, ptr), "%s: double free of %p\n", name_, ptr);
+        cpu.frees++;
+        if (likely(cpu.count < kMagazineSize)) {
+            cpu.objects[cpu.count++] = ptr;
+            return;
+        }
+
+        // Full: hand the oldest half back to the heap and keep the hot end.
+        cpu.flushes++;
+        memcpy(batch, cpu.objects, sizeof(batch));
+        memmove(cpu.objects, cpu.objects + kBatchSize,
+                (kMagazineSize - kBatchSize) * sizeof(void*));
+        cpu.count -= kBatchSize;
+        cpu.objects[cpu.count++] = ptr;
+    }
+
+    cmpct_free_batch(batch, kBatchSize);
+}
+
+void HeapCache::Drain() {
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        void* objects[kMagazineSize];
+        size_t count;
+        {
+            AutoSpinLockIrqSave guard(&cpu_[i].lock);
+            count = cpu_[i].count;
+            memcpy(objects, cpu_[i].objects, count * sizeof(void*));
+            cpu_[i].count = 0;
+        }
+        if (count > 0)
+            cmpct_free_batch(objects, count);
+    }
+}
+
+HeapCache::Stats HeapCache::GetStats() const {
+    Stats stats = {};
+    // Racy reads, but these are only statistics.
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        stats.cached += cpu_[i].count;
+        stats.allocs += cpu_[i].allocs;
+        stats.misses += cpu_[i].misses;
+        stats.frees += cpu_[i].frees;
+        stats.flushes += cpu_[i].flushes;
+    }
+    return stats;
+}
+
+void HeapCache::Dump() const {
+    Stats stats = GetStats();
+    uint64_t hit_pct = stats.allocs ? (stats.allocs - stats.misses) * 100 / stats.allocs : 0;
+    printf("%-20s %6zu %6zu %12" PRIu64 " %3" PRIu64 "%% %12" PRIu64 " %10" PRIu64 "\n",
+           name_, object_size_, stats.cached, stats.allocs, hit_pct, stats.frees, stats.flushes);
+}
+
+void HeapCache::DrainAll() {
+    // Caches are never unregistered, so the list can be walked without the
+    // lock once the head has been read.
+    HeapCache* cache;
+    {
+        AutoSpinLockIrqSave guard(&registry_lock);
+        cache = registry_head;
+    }
+    for (; cache != nullptr; cache = cache->next_)
+        cache->Drain();
+}
+
+void HeapCache::DumpAll() {
+    printf("%-20s %6s %6s %12s %4s %12s %10s\n",
+           "name", "size", "cached", "allocs", "hit", "frees", "flushes");
+    // Dump() only reads statistics, so it's fine to call with the lock held.
+    AutoSpinLockIrqSave guard(&registry_lock);
+    for (HeapCache* cache = registry_head; cache != nullptr; cache = cache->next_)
+        cache->Dump();
+}
@@ -6,6 +6,7 @@
 // https://opensource.org/licenses/MIT
 
 #include <lib/heap.h>
+#include <lib/heap_cache.h>
 
 #include <trace.h>
 #include <debug.h>
@@ -13,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <list.h>
 #include <arch/ops.h>
 #include <kernel/spinlock.h>
@@ -38,6 +40,58 @@ static bool heap_trace = false;
 #define heap_trace (false)
 #endif
 
+/* per-cpu caches for common small allocation sizes, in ascending order */
+static HeapCache size_caches[] = {
+    {"malloc-32", 32},
+    {"malloc-48", 48},
+    {"malloc-64", 64},
+    {"malloc-96", 96},
+    {"malloc-128", 128},
+    {"malloc-192", 192},
+    {"malloc-256", 256},
+    {"malloc-384", 384},
+    {"malloc-512", 512},
+    {"malloc-768", 768},
+    {"malloc-1024", 1024},
+};
+
+/* blocks this large or larger are returned straight to the heap on free,
+ * rather than being cached in the largest class they would fit */
+static const size_t kSizeCacheFreeLimit = 1536;
+
+/* the smallest cache whose objects can hold |size| bytes */
+HeapCache *heap_size_cache_for_alloc(size_t size)
+{
+    for (auto &cache : size_caches) {
+        if (size <= cache.object_size())
+            return &cache;
+    }
+    return nullptr;
+}
+
+/* the largest cache whose objects fit in a block of |usable| bytes */
+HeapCache *heap_size_cache_for_free(size_t usable)
+{
+    if (usable >= kSizeCacheFreeLimit)
+        return nullptr;
+    for (size_t i = fbl::count_of(size_caches); i > 0; i--) {
+        if (size_caches[i - 1].object_size() <= usable)
+            return &size_caches[i - 1];
+    }
+    return nullptr;
+}
+
+static void *heap_alloc(size_t size)
+{
+    if (unlikely(size == 0))
+        return nullptr;
+
+    HeapCache *cache = heap_size_cache_for_alloc(size);
+    if (likely(cache))
+        return cache->Alloc();
+    return cmpct_alloc(size);
+}
+
 void heap_init(void)
 {
     cmpct_init();
@@ -45,6 +99,7 @@ void heap_init(void)
 
 void heap_trim(void)
 {
+    HeapCache::DrainAll();
     cmpct_trim();
 }
 
@@ -54,7 +109,7 @@ void *malloc(size_t size)
 
     LTRACEF("size %zu\n", size);
 
-    void *ptr = cmpct_alloc(size);
+    void *ptr = heap_alloc(size);
     if (unlikely(heap_trace))
         printf("caller %p malloc %zu -> %p\n", __GET_CALLER(), size, ptr);
 
@@ -90,7 +145,7 @@ void *calloc(size_t count, size_t size)
 
     size_t realsize = count * size;
 
-    void *ptr = cmpct_alloc(realsize);
+    void *ptr = heap_alloc(realsize);
     if (likely(ptr))
         memset(ptr, 0, realsize);
     if (unlikely(heap_trace))
@@ -123,7 +178,15 @@ void free(void *ptr)
     if (unlikely(heap_trace))
         printf("caller %p free %p\n", __GET_CALLER(), ptr);
 
-    cmpct_free(ptr);
+    if (unlikely(!ptr))
+        return;
+
+    HeapCache *cache = heap_size_cache_for_free(cmpct_usable_size(ptr));
+    if (likely(cache)) {
+        cache->Free(ptr);
+    } else {
+        cmpct_free(ptr);
+    }
 }
 
 static void heap_dump(bool panic_time)
@@ -189,6 +252,7 @@ usage:
         if (!(flags & CMD_FLAG_PANIC)) {
             printf("\t%s trace\n", argv[0].str);
             printf("\t%s trim\n", argv[0].str);
+            printf("\t%s caches\n", argv[0].str);
             printf("\t%s alloc <size> [alignment]\n", argv[0].str);
             printf("\t%s realloc <ptr> <size>\n", argv[0].str);
             printf("\t%s free <address>\n", argv[0].str);
@@ -205,6 +269,8 @@ usage:
         printf("heap trace is now %s\n", heap_trace ? "on" : "off");
     } else if (!(flags & CMD_FLAG_PANIC) && strcmp(argv[1].str, "trim") == 0) {
         heap_trim();
+    } else if (!(flags & CMD_FLAG_PANIC) && strcmp(argv[1].str, "caches") == 0) {
+        HeapCache::DumpAll();
     } else if (!(flags & CMD_FLAG_PANIC) && strcmp(argv[1].str, "alloc") == 0) {
         if (argc < 3) goto notenoughargs;
 
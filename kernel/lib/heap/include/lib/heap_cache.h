@@ -0,0 +1,133 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <arch/ops.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/macros.h>
+#include <kernel/spinlock.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <zircon/compiler.h>
+
+// A per-cpu cache ("magazine") of same-sized heap objects.
+//
+// Each cpu keeps a small stack of free objects that it can hand out and take
+// back under a cpu-local spinlock, without touching the global heap lock. When
+// a cpu's stack is empty it is refilled, and when it is full it is flushed, a
+// batch at a time, from and to the underlying heap.
+//
+// Objects held by a cache are still allocated as far as the underlying heap is
+// concerned, so they can always be released with free() and the cache can be
+// dropped on the floor at any time by calling Drain().
+//
+// Instances must have static storage duration; they are constant-initialized
+// and register themselves for "heap caches" the first time they miss.
+class HeapCache {
+public:
+    static constexpr size_t kMagazineSize = 16;
+    static constexpr size_t kBatchSize = kMagazineSize / 2;
+
+    // Totals across all cpus.
+    struct Stats {
+        size_t cached;
+        uint64_t allocs;
+        uint64_t misses;
+        uint64_t frees;
+        uint64_t flushes;
+    };
+
+    constexpr HeapCache(const char* name, size_t object_size)
+        : name_(name), object_size_(object_size) {}
+
+    const char* name() const { return name_; }
+    size_t object_size() const { return object_size_; }
+
+    // Returns an object of at least object_size() bytes, or nullptr.
+    void* Alloc();
+
+    // Returns |ptr| to the cache. |ptr| must be a heap allocation with at
+    // least object_size() usable bytes.
+    void Free(void* ptr);
+
+    // Returns every cached object to the underlying heap.
+    void Drain();
+
+    // Racy unless nothing else is using the cache; only meant for
+    // diagnostics and tests.
+    Stats GetStats() const;
+
+    // Prints statistics for this cache.
+    void Dump() const;
+
+    // Calls Drain() or Dump() on every registered cache.
+    static void DrainAll();
+    static void DumpAll();
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(HeapCache);
+
+private:
+    struct PerCpu {
+        spin_lock_t lock = SPIN_LOCK_INITIAL_VALUE;
+        size_t count = 0;
+        void* objects[kMagazineSize] = {};
+
+        uint64_t allocs = 0;
+        uint64_t misses = 0;
+        uint64_t frees = 0;
+        uint64_t flushes = 0;
+    } __CPU_ALIGN;
+
+    PerCpu& current_cpu() { return cpu_[arch_curr_cpu_num()]; }
+    void Register();
+
+    // Debug checks standing in for the ones cmpctmalloc makes on its own
+    // free path: objects are filled as they go into a magazine and checked
+    // as they come out, and a free of an object already in the freeing
+    // cpu's magazine is caught.
+    void FillFree(void* ptr) const;
+    void CheckFreeFill(void* ptr) const;
+    bool IsCachedLocked(const PerCpu& cpu, const void* ptr) const;
+
+    const char* const name_;
+    const size_t object_size_;
+    bool registered_ = false;
+    HeapCache* next_ = nullptr;
+
+    PerCpu cpu_[SMP_MAX_CPUS];
+};
+
+// The size-class caches behind malloc() and free(): the cache that serves a
+// malloc() of |size| bytes, and the one a free() of a block with |usable|
+// bytes goes to. nullptr means the request goes straight to cmpctmalloc.
+HeapCache* heap_size_cache_for_alloc(size_t size);
+HeapCache* heap_size_cache_for_free(size_t usable);
+
+// Gives |Type| class-specific operator new/delete backed by a HeapCache.
+// HEAP_CACHE_DECLARE goes in the class body, HEAP_CACHE_DEFINE in one
+// translation unit. Only allocations of exactly sizeof(Type) are cached, so
+// derived classes fall through to the regular heap.
+#define HEAP_CACHE_DECLARE(Type)                                              \
+    static void* operator new(size_t size, fbl::AllocChecker* ac) noexcept;  \
+    static void operator delete(void* ptr, size_t size);                     \
+    static HeapCache heap_cache_
+
+#define HEAP_CACHE_DEFINE(Type)                                                  \
+    HeapCache Type::heap_cache_(#Type, sizeof(Type));                            \
+    void* Type::operator new(size_t size, fbl::AllocChecker* ac) noexcept {      \
+        void* ptr = (size == sizeof(Type)) ? heap_cache_.Alloc() : malloc(size); \
+        ac->arm(size, ptr != nullptr);                                           \
+        return ptr;                                                              \
+    }                                                                            \
+    void Type::operator delete(void* ptr, size_t size) {                         \
+        if (size == sizeof(Type)) {                                              \
+            heap_cache_.Free(ptr);                                               \
+        } else {                                                                 \
+            free(ptr);                                                           \
+        }                                                                        \
+    }
@@ -216,8 +216,12 @@ zx_status_t ChannelDispatcher::Call(fbl::unique_ptr<MessagePacket> msg,
         waiters_.push_back(waiter);
     }
 
-    // (1) Write outbound message to opposing endpoint.
+    // (1) Write outbound message to opposing endpoint. We block until the
+    // reply arrives, so if that wakes a server waiting to read the other end,
+    // directly or through a port, have it run right here.
+    thread_set_wake_handoff(true);
     other->WriteSelf(fbl::move(msg));
+    thread_set_wake_handoff(false);
 
     // Reuse the code from the half-call used for retrying a Call after thread
     // suspend.
@@ -274,8 +278,13 @@ int ChannelDispatcher::WriteSelf(fbl::unique_ptr<MessagePacket> msg) {
             // Remove waiter from list.
             if (waiter.get_txid() == txid) {
                 waiters_.erase(waiter);
+                // The caller was most likely handed to us by Call() above;
+                // send it back the same way, onto this cpu.
+                thread_set_wake_handoff(true);
                 // we return how many threads have been woken up, or zero.
-                return waiter.Deliver(fbl::move(msg));
+                int woken = waiter.Deliver(fbl::move(msg));
+                thread_set_wake_handoff(false);
+                return woken;
             }
         }
     }
@@ -340,7 +349,7 @@ int ChannelDispatcher::MessageWaiter::Deliver(fbl::unique_ptr<MessagePacket> msg
 
     msg_ = fbl::move(msg);
     status_ = ZX_OK;
-    return event_.Signal(ZX_OK);
+    return event_.SignalHandoff(ZX_OK);
 }
 
 int ChannelDispatcher::MessageWaiter::Cancel(zx_status_t status) {
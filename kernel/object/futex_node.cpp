@@ -150,12 +150,15 @@ FutexNode* FutexNode::RemoveFromHead(FutexNode* list_head, uint32_t count,
 // must be held when BlockThread() is called).  To reduce contention, it
 // does not reclaim the mutex on return.
 zx_status_t FutexNode::BlockThread(fbl::Mutex* mutex, zx_time_t deadline) TA_NO_THREAD_SAFETY_ANALYSIS {
-    AutoThreadLock lock;
+    spin_lock_saved_state_t state;
+    wait_queue_lock(&wait_queue_, &state);
 
     // We specifically want reschedule=false here, otherwise the
     // combination of releasing the mutex and enqueuing the current thread
     // would not be atomic, which would mean that we could miss wakeups.
-    mutex_release_thread_locked(mutex->GetInternal(), /* reschedule= */ false);
+    // Whoever the mutex is handed to runs once its wait queue is unlocked,
+    // which happens before this returns; our own wait queue stays locked.
+    mutex_release_etc(mutex->GetInternal(), /* reschedule= */ false);
 
     thread_t* current_thread = get_current_thread();
     zx_status_t result;
@@ -163,6 +166,7 @@ zx_status_t FutexNode::BlockThread(fbl::Mutex* mutex, zx_time_t deadline) TA_NO_
     result = wait_queue_block(&wait_queue_, deadline);
     current_thread->interruptable = false;
 
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
     return result;
 }
 
@@ -180,7 +184,7 @@ bool FutexNode::WakeThread() {
     //  2) The thread is woken by our wait_queue_wake_one() call.  In
     //     this case, FutexWait() will *not* reacquire the FutexContext
     //     lock.  To handle this correctly, we must not access |this|
-    //     after wait_queue_wake_one().
+    //     after wait_queue_unlock(), which is when the thread can run.
 
     // We must do this before we wake the thread, to handle case 2.
     MarkAsNotInQueue();
@@ -192,8 +196,11 @@ bool FutexNode::WakeThread() {
     // indicate that the thread was woken during this process, our caller
     // will release the lock and then arrange for a reschedule operation
     // (which leads to a smoother transition).
-    AutoThreadLock lock;
-    return wait_queue_wake_one(&wait_queue_, /* reschedule */ false, ZX_OK);
+    spin_lock_saved_state_t state;
+    wait_queue_lock(&wait_queue_, &state);
+    bool woken = wait_queue_wake_one(&wait_queue_, /* reschedule */ false, ZX_OK);
+    wait_queue_unlock(&wait_queue_, state);
+    return woken;
 }
 
 // Set |node1| and |node2|'s list pointers so that |node1| is immediately
@@ -8,10 +8,18 @@
 // an arena of handles, and the computation of userspace handle values
 // based on properties of that arena. This file also defines a number
 // of diagnostics about the handle table, like a high water mark.
+//
+// The arena itself is guarded by a single mutex. To keep that mutex off
+// the hot path, each cpu keeps a small cache of free arena slots that it
+// refills from, and flushes back to, the arena a batch at a time.
 
 #include <object/handles.h>
 
+#include <arch/ops.h>
+#include <kernel/auto_lock.h>
+#include <kernel/spinlock.h>
 #include <pow2.h>
+#include <string.h>
 #include <trace.h>
 
 #include <object/diagnostics.h>
@@ -19,6 +27,7 @@
 #include <object/handle.h>
 
 #include <fbl/arena.h>
+#include <fbl/atomic.h>
 #include <fbl/auto_lock.h>
 #include <fbl/mutex.h>
 
@@ -33,13 +42,37 @@ constexpr size_t kMaxHandleCount = 256 * 1024u;
 // there are this many outstanding handles.
 constexpr size_t kHighHandleCount = (kMaxHandleCount * 7) / 8;
 
-// The handle arena and its mutex. It also guards Dispatcher::handle_count_.
+// The number of free slots each cpu may hold on to, and how many are
+// moved between a cpu and the arena at once.
+constexpr size_t kSlotCacheSize = 32u;
+constexpr size_t kSlotBatchSize = kSlotCacheSize / 2;
+
+// The handle arena and its mutex.
 static fbl::Mutex handle_mutex;
 static fbl::Arena TA_GUARDED(handle_mutex) handle_arena;
 
+// The first slot of |handle_arena|. Set once by HandleTableInit().
+static Handle* handle_table_start;
+
+// One past the highest slot ever handed out by |handle_arena|. The arena
+// never gives back the data pages of freed slots, so this only grows, and
+// lets MapU32ToHandle() range-check without taking |handle_mutex|.
+static fbl::atomic<uintptr_t> handle_table_top(0u);
+
+// Handles that are currently live, i.e. not counting slots that are free
+// but sitting in a cpu's cache.
+static fbl::atomic<size_t> outstanding_handles(0u);
+
+struct SlotCache {
+    spin_lock_t lock = SPIN_LOCK_INITIAL_VALUE;
+    size_t count = 0u;
+    void* slots[kSlotCacheSize] = {};
+} __CPU_ALIGN;
+
+static SlotCache slot_cache[SMP_MAX_CPUS];
+
 size_t diagnostics::OutstandingHandles() {
-    AutoLock lock(&handle_mutex);
-    return handle_arena.DiagnosticCount();
+    return outstanding_handles.load();
 }
 
 // Masks for building a Handle's base_value, which ProcessDispatcher
@@ -70,10 +103,9 @@ static_assert(((3 << 30) ^ kHandleGenerationMask ^ kHandleIndexMask) ==
 // Returns a new |base_value| based on the value stored in the free
 // |handle_arena| slot pointed to by |addr|. The new value will be different
 // from the last |base_value| used by this slot.
-static uint32_t GetNewHandleBaseValue(void* addr) TA_REQ(handle_mutex) {
+static uint32_t GetNewHandleBaseValue(void* addr) {
     // Get the index of this slot within handle_arena.
-    auto va = reinterpret_cast<Handle*>(addr) -
-              reinterpret_cast<Handle*>(handle_arena.start());
+    auto va = reinterpret_cast<Handle*>(addr) - handle_table_start;
     uint32_t handle_index = static_cast<uint32_t>(va);
     DEBUG_ASSERT((handle_index & ~kHandleIndexMask) == 0);
 
@@ -119,58 +151,136 @@ void internal::TearDownHandle(Handle* handle) TA_EXCL(handle_mutex) {
 
 static void high_handle_count(size_t count) {
     // TODO: Avoid calling this for every handle after kHighHandleCount;
-    // printfs are slow and |handle_mutex| is held by our caller.
+    // printfs are slow.
     printf("WARNING: High handle count: %zu handles\n", count);
 }
 
-Handle* MakeHandle(fbl::RefPtr<Dispatcher> dispatcher, zx_rights_t rights) {
-    void* addr;
-    uint32_t base_value;
+// Returns up to |count| slots from |handle_arena|.
+static size_t ArenaAllocBatch(void** slots, size_t count) {
+    AutoLock lock(&handle_mutex);
+    size_t allocated = 0u;
+    while (allocated < count) {
+        void* slot = handle_arena.Alloc();
+        if (slot == nullptr)
+            break;
+        slots[allocated++] = slot;
+        uintptr_t top = reinterpret_cast<uintptr_t>(slot) + sizeof(Handle);
+        if (top > handle_table_top.load(fbl::memory_order_relaxed))
+            handle_table_top.store(top, fbl::memory_order_release);
+    }
+    return allocated;
+}
 
-    {
-        AutoLock lock(&handle_mutex);
-        addr = handle_arena.Alloc();
-        const size_t outstanding_handles = handle_arena.DiagnosticCount();
-        if (addr == nullptr) {
-            lock.release();
-            printf("WARNING: Could not allocate new handle (%zu outstanding)\n",
-                   outstanding_handles);
-            return nullptr;
+static void ArenaFreeBatch(void** slots, size_t count) {
+    AutoLock lock(&handle_mutex);
+    for (size_t i = 0u; i < count; ++i)
+        handle_arena.Free(slots[i]);
+}
+
+// Returns every slot cached by any cpu to |handle_arena|.
+static void DrainSlotCaches() {
+    for (uint i = 0; i < arch_max_num_cpus(); ++i) {
+        void* slots[kSlotCacheSize];
+        size_t count;
+        {
+            AutoSpinLockIrqSave guard(&slot_cache[i].lock);
+            count = slot_cache[i].count;
+            memcpy(slots, slot_cache[i].slots, count * sizeof(void*));
+            slot_cache[i].count = 0u;
         }
-        if (outstanding_handles > kHighHandleCount)
-            high_handle_count(outstanding_handles);
+        if (count > 0u)
+            ArenaFreeBatch(slots, count);
+    }
+}
 
-        dispatcher->increment_handle_count();
+static void* AllocHandleSlot() {
+    {
+        // We may migrate before taking the lock; that's fine, the lock is
+        // what protects the cache, not the cpu we happen to run on.
+        SlotCache& cache = slot_cache[arch_curr_cpu_num()];
+        AutoSpinLockIrqSave guard(&cache.lock);
+        if (likely(cache.count > 0u))
+            return cache.slots[--cache.count];
+    }
 
-        base_value = GetNewHandleBaseValue(addr);
+    void* batch[kSlotBatchSize];
+    size_t count = ArenaAllocBatch(batch, kSlotBatchSize);
+    if (count == 0u) {
+        // The arena is exhausted, but other cpus may be sitting on free
+        // slots. Take them back before giving up.
+        DrainSlotCaches();
+        count = ArenaAllocBatch(batch, 1u);
+        if (count == 0u)
+            return nullptr;
     }
 
-    return new (addr) Handle(fbl::move(dispatcher), rights, base_value);
+    // Keep one for the caller and stash the rest.
+    void* slot = batch[--count];
+    size_t stashed = 0u;
+    {
+        SlotCache& cache = slot_cache[arch_curr_cpu_num()];
+        AutoSpinLockIrqSave guard(&cache.lock);
+        while (stashed < count && cache.count < kSlotCacheSize)
+            cache.slots[cache.count++] = batch[stashed++];
+    }
+    if (stashed < count)
+        ArenaFreeBatch(batch + stashed, count - stashed);
+    return slot;
 }
 
-Handle* DupHandle(Handle* source, zx_rights_t rights) {
-    fbl::RefPtr<Dispatcher> dispatcher(source->dispatcher());
-    void* addr;
-    uint32_t base_value;
-
+static void FreeHandleSlot(void* slot) {
+    void* batch[kSlotBatchSize];
     {
-        AutoLock lock(&handle_mutex);
-        addr = handle_arena.Alloc();
-        const size_t outstanding_handles = handle_arena.DiagnosticCount();
-        if (addr == nullptr) {
-            lock.release();
-            printf("WARNING: Could not allocate duplicate handle (%zu outstanding)\n",
-                   outstanding_handles);
-            return nullptr;
+        SlotCache& cache = slot_cache[arch_curr_cpu_num()];
+        AutoSpinLockIrqSave guard(&cache.lock);
+        if (likely(cache.count < kSlotCacheSize)) {
+            cache.slots[cache.count++] = slot;
+            return;
         }
-        if (outstanding_handles > kHighHandleCount)
-            high_handle_count(outstanding_handles);
 
-        dispatcher->increment_handle_count();
+        // Full: return the coldest half to the arena.
+        memcpy(batch, cache.slots, sizeof(batch));
+        memmove(cache.slots, cache.slots + kSlotBatchSize,
+                (kSlotCacheSize - kSlotBatchSize) * sizeof(void*));
+        cache.count -= kSlotBatchSize;
+        cache.slots[cache.count++] = slot;
+    }
+    ArenaFreeBatch(batch, kSlotBatchSize);
+}
 
-        base_value = GetNewHandleBaseValue(addr);
+// Allocates a slot for a new handle to |dispatcher| and returns it along
+// with the slot's new |base_value|, or returns nullptr.
+static void* AllocHandle(Dispatcher* dispatcher, const char* what,
+                         uint32_t* base_value) {
+    void* addr = AllocHandleSlot();
+    if (addr == nullptr) {
+        printf("WARNING: Could not allocate %s handle (%zu outstanding)\n",
+               what, outstanding_handles.load());
+        return nullptr;
     }
+    const size_t outstanding = outstanding_handles.fetch_add(1u) + 1u;
+    if (outstanding > kHighHandleCount)
+        high_handle_count(outstanding);
+
+    dispatcher->increment_handle_count();
+
+    *base_value = GetNewHandleBaseValue(addr);
+    return addr;
+}
 
+Handle* MakeHandle(fbl::RefPtr<Dispatcher> dispatcher, zx_rights_t rights) {
+    uint32_t base_value;
+    void* addr = AllocHandle(dispatcher.get(), "new", &base_value);
+    if (addr == nullptr)
+        return nullptr;
+    return new (addr) Handle(fbl::move(dispatcher), rights, base_value);
+}
+
+Handle* DupHandle(Handle* source, zx_rights_t rights) {
+    uint32_t base_value;
+    void* addr = AllocHandle(source->dispatcher().get(), "duplicate", &base_value);
+    if (addr == nullptr)
+        return nullptr;
     return new (addr) Handle(source, rights, base_value);
 }
 
@@ -186,14 +296,10 @@ void DeleteHandle(Handle* handle) {
     // base_value for reuse the next time this slot is allocated.
     internal::TearDownHandle(handle);
 
-    bool zero_handles = false;
-    {
-        AutoLock lock(&handle_mutex);
+    const bool zero_handles = dispatcher->decrement_handle_count();
 
-        zero_handles = dispatcher->decrement_handle_count();
-
-        handle_arena.Free(handle);
-    }
+    outstanding_handles.fetch_sub(1u);
+    FreeHandleSlot(handle);
 
     if (zero_handles) {
         dispatcher->on_zero_handles();
@@ -205,27 +311,38 @@ void DeleteHandle(Handle* handle) {
 }
 
 uint32_t GetHandleCount(const fbl::RefPtr<const Dispatcher>& dispatcher) {
-    AutoLock lock(&handle_mutex);
     return dispatcher->current_handle_count();
 }
 
-Handle* MapU32ToHandle(uint32_t value) TA_NO_THREAD_SAFETY_ANALYSIS {
+Handle* MapU32ToHandle(uint32_t value) {
     auto index = value & kHandleIndexMask;
-    auto va = &reinterpret_cast<Handle*>(handle_arena.start())[index];
-    {
-        AutoLock lock(&handle_mutex);
-        if (!handle_arena.in_range(va))
-            return nullptr;
-    }
-    Handle* handle = reinterpret_cast<Handle*>(va);
+    Handle* handle = &handle_table_start[index];
+    // Slots below the top have been handed out at least once and stay
+    // mapped, so it is safe to read their base_value even if they are free.
+    if (reinterpret_cast<uintptr_t>(handle + 1) >
+        handle_table_top.load(fbl::memory_order_acquire))
+        return nullptr;
     return handle->base_value() == value ? handle : nullptr;
 }
 
 void diagnostics::DumpHandleTableInfo() {
-    AutoLock lock(&handle_mutex);
-    handle_arena.Dump();
+    {
+        AutoLock lock(&handle_mutex);
+        handle_arena.Dump();
+    }
+    size_t cached = 0u;
+    printf("per-cpu free slot caches:\n");
+    for (uint i = 0; i < arch_max_num_cpus(); ++i) {
+        // Racy, but this is only a diagnostic.
+        printf("  cpu %u: %zu slots\n", i, slot_cache[i].count);
+        cached += slot_cache[i].count;
+    }
+    printf("%zu outstanding handles, %zu free slots cached\n",
+           outstanding_handles.load(), cached);
 }
 
 void HandleTableInit() TA_NO_THREAD_SAFETY_ANALYSIS {
     handle_arena.Init("handles", sizeof(Handle), kMaxHandleCount);
+    handle_table_start = reinterpret_cast<Handle*>(handle_arena.start());
+    handle_table_top.store(reinterpret_cast<uintptr_t>(handle_table_start));
 }
@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <stdint.h>
 
+#include <fbl/atomic.h>
 #include <fbl/canary.h>
 #include <fbl/intrusive_double_list.h>
 #include <fbl/mutex.h>
@@ -54,6 +55,7 @@ DECLARE_DISPTAG(FifoDispatcher, ZX_OBJ_TYPE_FIFO)
 DECLARE_DISPTAG(GuestDispatcher, ZX_OBJ_TYPE_GUEST)
 DECLARE_DISPTAG(VcpuDispatcher, ZX_OBJ_TYPE_VCPU)
 DECLARE_DISPTAG(TimerDispatcher, ZX_OBJ_TYPE_TIMER)
+DECLARE_DISPTAG(PagerDispatcher, ZX_OBJ_TYPE_PAGER)
 
 #undef DECLARE_DISPTAG
 
@@ -66,21 +68,19 @@ public:
 
     zx_koid_t get_koid() const { return koid_; }
 
-    // Must be called under the handle table lock.
+    // Only to be called by the handle table.
     void increment_handle_count() {
-        ++handle_count_;
+        handle_count_.fetch_add(1u);
     }
 
-    // Must be called under the handle table lock.
+    // Only to be called by the handle table.
     // Returns true exactly when the handle count goes to zero.
     bool decrement_handle_count() {
-        --handle_count_;
-        return handle_count_ == 0u;
+        return handle_count_.fetch_sub(1u) == 1u;
     }
 
-    // Must be called under the handle table lock.
     uint32_t current_handle_count() const {
-        return handle_count_;
+        return handle_count_.load();
     }
 
     // The following are only to be called when |has_state_tracker| reports true.
@@ -165,7 +165,7 @@ private:
     StateObserver::Flags UpdateInternalLocked(ObserverList* obs_to_remove, zx_signals_t signals) TA_REQ(lock_);
 
     const zx_koid_t koid_;
-    uint32_t handle_count_;
+    fbl::atomic<uint32_t> handle_count_;
 
     // TODO(kulakowski) Make signals_ TA_GUARDED(lock_).
     // Right now, signals_ is almost entirely accessed under the
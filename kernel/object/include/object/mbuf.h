@@ -6,34 +6,54 @@
 
 #pragma once
 
+#include <list.h>
 #include <stdint.h>
 
+#include <lib/heap_cache.h>
 #include <lib/user_copy/user_ptr.h>
 #include <zircon/types.h>
 #include <fbl/intrusive_single_list.h>
 
 class MBufChain {
 public:
+    // Bounds and default for the number of bytes the chain will accept
+    // before reporting itself full.
+    static constexpr size_t kMinCapacity = 4096u;
+    static constexpr size_t kDefaultCapacity = 256u * 1024u;
+    static constexpr size_t kMaxCapacity = 16u * 1024u * 1024u;
+
     MBufChain() = default;
     ~MBufChain();
 
     zx_status_t WriteStream(user_in_ptr<const void> src, size_t len, size_t* written);
     zx_status_t WriteDatagram(user_in_ptr<const void> src, size_t len, size_t* written);
-    size_t Read(user_out_ptr<void> dst, size_t len, bool datagram);
+    // Like WriteStream, but moves the pages backing page aligned runs of
+    // |src| into the chain instead of copying them, decommitting them from
+    // the caller's VMO. Falls back to copying whatever can't be moved.
+    zx_status_t WriteStreamPages(user_in_ptr<const void> src, size_t len, size_t* written);
+    // If |move_pages| is set, whole pages queued by WriteStreamPages are
+    // supplied to the VMO behind a page aligned, writable |dst| instead of
+    // being copied, replacing whatever that VMO had committed there.
+    size_t Read(user_out_ptr<void> dst, size_t len, bool datagram, bool move_pages);
     bool is_full() const;
     bool is_empty() const;
     size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    void set_capacity(size_t capacity) { capacity_ = capacity; }
 
 private:
     // An MBuf is a small fixed-size chainable memory buffer.
     struct MBuf : public fbl::SinglyLinkedListable<MBuf*> {
-        // 8 for the linked list and 4 for the explicit uint32_t fields.
-        static constexpr size_t kHeaderSize = 8 + (4 * 4);
+        // 8 for the linked list, 16 for the explicit uint32_t fields and
+        // 16 for the page list.
+        static constexpr size_t kHeaderSize = 8 + (4 * 4) + 16;
         // 16 is for the malloc header.
         static constexpr size_t kMallocSize = 2048 - 16;
         static constexpr size_t kPayloadSize = kMallocSize - kHeaderSize;
 
         size_t rem() const;
+        bool is_paged() const { return paged_ != 0u; }
+        void FreePages();
 
         uint32_t off_ = 0u;
         uint32_t len_ = 0u;
@@ -43,19 +63,26 @@ private:
         //
         // Always 0 in ZX_SOCKET_STREAM mode.
         uint32_t pkt_len_ = 0u;
-        uint32_t unused_;
+        // Nonzero if the payload lives in |pages_| rather than |data_|. Paged
+        // mbufs hold whole pages; off_ is then the offset into the first one.
+        uint32_t paged_ = 0u;
+        list_node pages_ = LIST_INITIAL_VALUE(pages_);
         char data_[kPayloadSize] = {0};
-        // TODO: maybe union data_ with char* blocks for large messages
+
+        // Every socket write that outgrows a chain's freelist allocates
+        // these, so they come from a per-cpu cache.
+        HEAP_CACHE_DECLARE(MBuf);
     };
     static_assert(sizeof(MBuf) == MBuf::kMallocSize, "");
 
-    static constexpr size_t kSizeMax = 128 * MBuf::kPayloadSize;
-
     MBuf* AllocMBuf();
     void FreeMBuf(MBuf* buf);
+    void AppendMBuf(MBuf* buf);
+    size_t ReadPaged(MBuf* buf, user_out_ptr<void> dst, size_t len, bool move_pages);
 
     fbl::SinglyLinkedList<MBuf*> freelist_;
     fbl::SinglyLinkedList<MBuf*> tail_;
     MBuf* head_ = nullptr;;
     size_t size_ = 0u;
+    size_t capacity_ = kDefaultCapacity;
 };
@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 
+#include <lib/heap_cache.h>
 #include <lib/user_copy/user_ptr.h>
 #include <zircon/types.h>
 #include <fbl/intrusive_double_list.h>
@@ -59,6 +60,10 @@ public:
     }
 
 private:
+    // Messages whose handles and data fit in this many bytes are stored
+    // inside the packet itself; e.g. 256 bytes of data plus one handle.
+    static constexpr size_t kInlineBufferSize = 256 + sizeof(Handle*);
+
     MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles);
     ~MessagePacket();
 
@@ -67,18 +72,22 @@ private:
     static zx_status_t NewPacket(uint32_t data_size, uint32_t num_handles,
                                  fbl::unique_ptr<MessagePacket>* msg);
 
-    // Create() uses malloc(), so we must delete using free().
-    static void operator delete(void* ptr) {
-        free(ptr);
-    }
+    // Packets are a fixed size, so they come from a per-cpu cache rather
+    // than straight from the heap.
+    HEAP_CACHE_DECLARE(MessagePacket);
     friend class fbl::unique_ptr<MessagePacket>;
 
     // Handles and data are stored in the same buffer: num_handles_ Handle*
-    // entries first, then the data buffer.
+    // entries first, then the data buffer. The buffer is inline_buffer_
+    // for small messages and a separate heap allocation otherwise.
     void* data() const { return static_cast<void*>(handles_ + num_handles_); }
+    bool is_inline() const {
+        return reinterpret_cast<const char*>(handles_) == inline_buffer_;
+    }
 
     Handle** const handles_;
     const uint32_t data_size_;
     const uint16_t num_handles_;
     bool owns_handles_;
+    alignas(Handle*) char inline_buffer_[kInlineBufferSize];
 };
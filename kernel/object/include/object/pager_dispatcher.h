@@ -0,0 +1,82 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <fbl/canary.h>
+#include <fbl/intrusive_double_list.h>
+#include <fbl/ref_ptr.h>
+#include <object/dispatcher.h>
+#include <object/port_dispatcher.h>
+#include <vm/page_source.h>
+#include <vm/vm_object.h>
+#include <zircon/types.h>
+
+#include <sys/types.h>
+
+class PagerSource;
+
+// A pager lets a userspace process provide the contents of VMOs on demand.
+// Every VMO created by the pager starts out with no pages; a thread that
+// touches a missing page blocks while a ZX_PKT_TYPE_PAGE_REQUEST packet is
+// queued on the port the VMO was created with, until the pager process
+// answers with SupplyPages().
+class PagerDispatcher final : public Dispatcher {
+public:
+    static zx_status_t Create(uint32_t options, fbl::RefPtr<Dispatcher>* dispatcher,
+                              zx_rights_t* rights);
+
+    ~PagerDispatcher() final;
+    zx_obj_type_t get_type() const final { return ZX_OBJ_TYPE_PAGER; }
+    void on_zero_handles() final;
+
+    // Creates a VMO of |size| bytes whose page requests are queued on |port|
+    // with |key|.
+    zx_status_t CreateVmo(uint32_t options, fbl::RefPtr<PortDispatcher> port, uint64_t key,
+                          uint64_t size, fbl::RefPtr<VmObject>* vmo);
+
+    // Moves the committed pages of [aux_offset, aux_offset + length) out of
+    // |aux_vmo| and into the missing pages of [offset, offset + length) of
+    // |vmo|, which must have been created by this pager, then wakes the
+    // threads waiting for them.
+    zx_status_t SupplyPages(fbl::RefPtr<VmObject> vmo, uint64_t offset, uint64_t length,
+                            fbl::RefPtr<VmObject> aux_vmo, uint64_t aux_offset);
+
+    // Called by |source| once its VMO is gone.
+    void RemoveSource(PagerSource* source);
+
+private:
+    PagerDispatcher();
+
+    fbl::Canary<fbl::magic("PGRD")> canary_;
+
+    fbl::DoublyLinkedList<fbl::RefPtr<PagerSource>> sources_ TA_GUARDED(lock_);
+    bool closed_ TA_GUARDED(lock_) = false;
+};
+
+// The page source of a VMO created by a PagerDispatcher.
+class PagerSource final : public PageSource,
+                          public fbl::DoublyLinkedListable<fbl::RefPtr<PagerSource>> {
+public:
+    PagerSource(fbl::RefPtr<PagerDispatcher> pager, fbl::RefPtr<PortDispatcher> port,
+                uint64_t key);
+
+    // Fails all requests and forgets the pager. Called with the pager lock held
+    // when the pager goes away.
+    void OnPagerClosed();
+
+private:
+    ~PagerSource() final = default;
+    friend fbl::RefPtr<PagerSource>;
+
+    // PageSource overrides.
+    zx_status_t SendRequestLocked(uint64_t offset, uint64_t len) final TA_REQ(lock_);
+    void OnDetach() final;
+
+    fbl::RefPtr<PagerDispatcher> pager_ TA_GUARDED(lock_);
+    const fbl::RefPtr<PortDispatcher> port_;
+    const uint64_t key_;
+};
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <lib/heap_cache.h>
 #include <object/dispatcher.h>
 #include <object/semaphore.h>
 #include <object/state_observer.h>
@@ -114,6 +115,9 @@ public:
                  uint64_t key, zx_signals_t signals);
     ~PortObserver() = default;
 
+    // One of these is allocated for every zx_object_wait_async() call.
+    HEAP_CACHE_DECLARE(PortObserver);
+
 private:
     PortObserver(const PortObserver&) = delete;
     PortObserver& operator=(const PortObserver&) = delete;
@@ -151,6 +155,10 @@ public:
     zx_status_t Queue(PortPacket* port_packet, zx_signals_t observed, uint64_t count);
     zx_status_t QueueUser(const zx_port_packet_t& packet);
     zx_status_t Dequeue(zx_time_t deadline, zx_port_packet_t* packet);
+    // Like Dequeue(), but once a packet is available takes up to |count|
+    // of them under a single lock hold. |packets| may be null to discard.
+    zx_status_t DequeueMany(zx_time_t deadline, zx_port_packet_t* packets, size_t count,
+                            size_t* actual);
 
     // Decides who is going to destroy the observer. If it returns |true| it
     // is the duty of the caller. If it is false it is the duty of the port.
@@ -23,6 +23,10 @@ public:
     // the caller must call thread_reschedule().
     __WARN_UNUSED_RESULT int Post();
 
+    // Same as Post(), but honors the current thread's wake handoff hint,
+    // see thread_set_wake_handoff().
+    __WARN_UNUSED_RESULT int PostHandoff();
+
     // Returns whether we blocked via |was_blocked|.
     zx_status_t Wait(zx_time_t deadline, bool* was_blocked);
 
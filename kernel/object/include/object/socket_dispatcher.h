@@ -36,7 +36,9 @@ public:
     zx_status_t user_signal(uint32_t clear_mask, uint32_t set_mask, bool peer) final;
 
     // Socket methods.
-    zx_status_t Write(user_in_ptr<const void> src, size_t len, size_t* written);
+    // If |move_pages| is set, page aligned runs of |src| are moved into the
+    // socket rather than copied; see MBufChain::WriteStreamPages().
+    zx_status_t Write(user_in_ptr<const void> src, size_t len, bool move_pages, size_t* written);
 
     zx_status_t WriteControl(user_in_ptr<const void> src, size_t len);
 
@@ -45,7 +47,9 @@ public:
 
     zx_status_t HalfClose();
 
-    zx_status_t Read(user_out_ptr<void> dst, size_t len, size_t* nread);
+    // If |move_pages| is set, pages that were moved in by the writer may be
+    // moved on into page aligned runs of |dst|; see MBufChain::Read().
+    zx_status_t Read(user_out_ptr<void> dst, size_t len, bool move_pages, size_t* nread);
 
     zx_status_t ReadControl(user_out_ptr<void> dst, size_t len, size_t* nread);
 
@@ -59,13 +63,19 @@ public:
 
     zx_status_t CheckShareable(SocketDispatcher* to_send);
 
+    // The number of bytes this endpoint buffers for reading before its peer
+    // stops being writable.
+    size_t GetCapacity();
+    zx_status_t SetCapacity(size_t capacity);
+
 private:
     // The control_msg must be either nullptr or an allocation of
     // size kControlMsgSize.
     SocketDispatcher(zx_signals_t starting_signals, uint32_t flags,
                      fbl::unique_ptr<char[]> control_msg);
     void Init(fbl::RefPtr<SocketDispatcher> other);
-    zx_status_t WriteSelf(user_in_ptr<const void> src, size_t len, size_t* nwritten);
+    zx_status_t WriteSelf(user_in_ptr<const void> src, size_t len, bool move_pages,
+                          size_t* nwritten);
     zx_status_t WriteControlSelf(user_in_ptr<const void> src, size_t len);
     zx_status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     zx_status_t ShutdownOther(uint32_t how);
@@ -7,6 +7,11 @@
 #include <object/mbuf.h>
 
 #include <lib/user_copy/user_ptr.h>
+#include <object/process_dispatcher.h>
+#include <vm/physmap.h>
+#include <vm/pmm.h>
+#include <vm/vm_aspace.h>
+#include <vm/vm_object.h>
 
 #include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
@@ -16,41 +21,79 @@
 constexpr size_t MBufChain::MBuf::kHeaderSize;
 constexpr size_t MBufChain::MBuf::kMallocSize;
 constexpr size_t MBufChain::MBuf::kPayloadSize;
-constexpr size_t MBufChain::kSizeMax;
+constexpr size_t MBufChain::kMinCapacity;
+constexpr size_t MBufChain::kDefaultCapacity;
+constexpr size_t MBufChain::kMaxCapacity;
+
+HEAP_CACHE_DEFINE(MBufChain::MBuf);
+
+namespace {
+
+// Returns the VMO mapped at [va, va + len) in the current process, and the
+// offset of |va| within it, if a single mapping with at least |mmu_flags|
+// covers the whole range.
+fbl::RefPtr<VmObject> LookupUserVmo(vaddr_t va, size_t len, uint mmu_flags, uint64_t* offset) {
+    auto aspace = ProcessDispatcher::GetCurrent()->aspace();
+    if (!aspace)
+        return nullptr;
+
+    return aspace->FindMappedVmo(va, len, mmu_flags, offset);
+}
+
+} // namespace
 
 size_t MBufChain::MBuf::rem() const {
-    return kPayloadSize - (off_ + len_);
+    // Paged mbufs are never appended to.
+    return is_paged() ? 0u : kPayloadSize - (off_ + len_);
+}
+
+void MBufChain::MBuf::FreePages() {
+    if (is_paged()) {
+        pmm_free(&pages_);
+        paged_ = 0u;
+    }
 }
 
 MBufChain::~MBufChain() {
-    while (!tail_.is_empty())
-        delete tail_.pop_front();
+    while (!tail_.is_empty()) {
+        MBuf* buf = tail_.pop_front();
+        buf->FreePages();
+        delete buf;
+    }
     while (!freelist_.is_empty())
         delete freelist_.pop_front();
 }
 
 bool MBufChain::is_full() const {
-    return size_ >= kSizeMax;
+    return size_ >= capacity_;
 }
 
 bool MBufChain::is_empty() const {
     return size_ == 0;
 }
 
-size_t MBufChain::Read(user_out_ptr<void> dst, size_t len, bool datagram) {
+size_t MBufChain::Read(user_out_ptr<void> dst, size_t len, bool datagram,
+                       bool move_pages) {
     if (datagram && len > tail_.front().pkt_len_)
         len = tail_.front().pkt_len_;
 
     size_t pos = 0;
     while (pos < len && !tail_.is_empty()) {
         MBuf& cur = tail_.front();
-        char* src = cur.data_ + cur.off_;
-        size_t copy_len = MIN(cur.len_, len - pos);
-        if (dst.byte_offset(pos).copy_array_to_user(src, copy_len) != ZX_OK)
-            return pos;
+        size_t copy_len;
+        if (cur.is_paged()) {
+            copy_len = ReadPaged(&cur, dst.byte_offset(pos), len - pos, move_pages);
+            if (copy_len == 0)
+                return pos;
+        } else {
+            char* src = cur.data_ + cur.off_;
+            copy_len = MIN(cur.len_, len - pos);
+            if (dst.byte_offset(pos).copy_array_to_user(src, copy_len) != ZX_OK)
+                return pos;
+            cur.off_ += static_cast<uint32_t>(copy_len);
+            cur.len_ -= static_cast<uint32_t>(copy_len);
+        }
         pos += copy_len;
-        cur.off_ += static_cast<uint32_t>(copy_len);
-        cur.len_ -= static_cast<uint32_t>(copy_len);
         size_ -= copy_len;
         if (cur.len_ == 0 || datagram) {
             size_ -= cur.len_;
@@ -72,9 +115,57 @@ size_t MBufChain::Read(user_out_ptr<void> dst, size_t len, bool datagram) {
     return pos;
 }
 
+size_t MBufChain::ReadPaged(MBuf* buf, user_out_ptr<void> dst, size_t len,
+                            bool move_pages) {
+    size_t pos = 0;
+
+    // If the reader asked for it, whole pages headed for a page aligned,
+    // writable destination are handed over to the reader's VMO rather than
+    // copied. Readers that didn't ask keep their own pages.
+    const size_t move_len = ROUNDDOWN(MIN(len, static_cast<size_t>(buf->len_)), PAGE_SIZE);
+    const vaddr_t va = reinterpret_cast<vaddr_t>(dst.get());
+    if (move_pages && buf->off_ == 0 && move_len > 0 && IS_PAGE_ALIGNED(va)) {
+        uint64_t offset;
+        fbl::RefPtr<VmObject> vmo = LookupUserVmo(va, move_len, ARCH_MMU_FLAG_PERM_WRITE, &offset);
+        if (vmo) {
+            list_node pages = LIST_INITIAL_VALUE(pages);
+            for (size_t i = 0; i < move_len / PAGE_SIZE; i++)
+                list_add_tail(&pages, list_remove_head(&buf->pages_));
+
+            if (vmo->SupplyPages(offset, move_len, &pages) == ZX_OK) {
+                pos = move_len;
+                buf->len_ -= static_cast<uint32_t>(move_len);
+            } else {
+                while (!list_is_empty(&pages))
+                    list_add_head(&buf->pages_, list_remove_tail(&pages));
+            }
+        }
+    }
+
+    // Copy the rest out through the physmap, releasing pages as they drain.
+    while (pos < len && buf->len_ > 0) {
+        vm_page_t* page = list_peek_head_type(&buf->pages_, vm_page_t, free.node);
+        const char* src = static_cast<const char*>(paddr_to_physmap(vm_page_to_paddr(page))) +
+                          buf->off_;
+        size_t copy_len = MIN(PAGE_SIZE - buf->off_, MIN(static_cast<size_t>(buf->len_), len - pos));
+        if (dst.byte_offset(pos).copy_array_to_user(src, copy_len) != ZX_OK)
+            break;
+        pos += copy_len;
+        buf->off_ += static_cast<uint32_t>(copy_len);
+        buf->len_ -= static_cast<uint32_t>(copy_len);
+        if (buf->off_ == PAGE_SIZE) {
+            list_delete(&page->free.node);
+            pmm_free_page(page);
+            buf->off_ = 0u;
+        }
+    }
+
+    return pos;
+}
+
 zx_status_t MBufChain::WriteDatagram(user_in_ptr<const void> src,
                                      size_t len, size_t* written) {
-    if (len + size_ > kSizeMax)
+    if (len + size_ > capacity_)
         return ZX_ERR_SHOULD_WAIT;
 
     fbl::SinglyLinkedList<MBuf*> bufs;
@@ -103,15 +194,8 @@ zx_status_t MBufChain::WriteDatagram(user_in_ptr<const void> src,
     bufs.front().pkt_len_ = static_cast<uint32_t>(len);
 
     // Successfully built the packet mbufs. Put it on the socket.
-    while (!bufs.is_empty()) {
-        auto next = bufs.pop_front();
-        if (head_ == nullptr) {
-            tail_.push_front(next);
-        } else {
-            tail_.insert_after(tail_.make_iterator(*head_), next);
-        }
-        head_ = next;
-    }
+    while (!bufs.is_empty())
+        AppendMBuf(bufs.pop_front());
 
     *written = len;
     size_ += len;
@@ -138,8 +222,8 @@ zx_status_t MBufChain::WriteStream(user_in_ptr<const void> src,
         }
         void* dst = head_->data_ + head_->off_ + head_->len_;
         size_t copy_len = fbl::min(head_->rem(), len - pos);
-        if (size_ + copy_len > kSizeMax) {
-            copy_len = kSizeMax - size_;
+        if (size_ + copy_len > capacity_) {
+            copy_len = capacity_ > size_ ? capacity_ - size_ : 0u;
             if (copy_len == 0)
                 break;
         }
@@ -157,6 +241,48 @@ zx_status_t MBufChain::WriteStream(user_in_ptr<const void> src,
     return ZX_OK;
 }
 
+zx_status_t MBufChain::WriteStreamPages(user_in_ptr<const void> src,
+                                        size_t len, size_t* written) {
+    const vaddr_t va = reinterpret_cast<vaddr_t>(src.get());
+    const size_t room = capacity_ > size_ ? capacity_ - size_ : 0u;
+    const size_t move_len = ROUNDDOWN(MIN(len, room), PAGE_SIZE);
+    if (!IS_PAGE_ALIGNED(va) || move_len == 0)
+        return WriteStream(src, len, written);
+
+    // The pages vanish from the writer's mapping, so it must be one the
+    // writer could have zeroed itself.
+    uint64_t offset;
+    fbl::RefPtr<VmObject> vmo = LookupUserVmo(va, move_len, ARCH_MMU_FLAG_PERM_WRITE, &offset);
+    if (!vmo)
+        return WriteStream(src, len, written);
+
+    MBuf* buf = AllocMBuf();
+    if (buf == nullptr)
+        return ZX_ERR_SHOULD_WAIT;
+
+    // Uncommitted, pinned or cloned ranges can't be moved; copy them instead.
+    if (vmo->TakePages(offset, move_len, &buf->pages_) != ZX_OK) {
+        FreeMBuf(buf);
+        return WriteStream(src, len, written);
+    }
+    buf->paged_ = 1u;
+    buf->len_ = static_cast<uint32_t>(move_len);
+    AppendMBuf(buf);
+
+    size_ += move_len;
+    *written = move_len;
+    return ZX_OK;
+}
+
+void MBufChain::AppendMBuf(MBuf* buf) {
+    if (head_ == nullptr) {
+        tail_.push_front(buf);
+    } else {
+        tail_.insert_after(tail_.make_iterator(*head_), buf);
+    }
+    head_ = buf;
+}
+
 MBufChain::MBuf* MBufChain::AllocMBuf() {
     if (freelist_.is_empty()) {
         fbl::AllocChecker ac;
@@ -167,6 +293,7 @@ MBufChain::MBuf* MBufChain::AllocMBuf() {
 }
 
 void MBufChain::FreeMBuf(MBuf* buf) {
+    buf->FreePages();
     buf->off_ = 0u;
     buf->len_ = 0u;
     freelist_.push_front(buf);
@@ -8,11 +8,14 @@
 
 #include <err.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include <zxcpp/new.h>
+#include <fbl/alloc_checker.h>
 #include <object/handle_reaper.h>
 
+HEAP_CACHE_DEFINE(MessagePacket);
+
 // static
 zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
                                      fbl::unique_ptr<MessagePacket>* msg) {
@@ -23,25 +26,31 @@ zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
         return ZX_ERR_OUT_OF_RANGE;
     }
 
-    // Allocate space for the MessagePacket object followed by num_handles
-    // Handle*s followed by data_size bytes.
+    // Space for num_handles Handle*s followed by data_size bytes. Small
+    // messages use the packet's inline buffer; larger ones get their own.
     // TODO(dbort): Use mbuf-style memory for data_size, ideally allocating from
     // somewhere other than the heap. Lets us better track and isolate channel
     // memory usage.
-    char* ptr = static_cast<char*>(malloc(sizeof(MessagePacket) +
-                                          num_handles * sizeof(Handle*) +
-                                          data_size));
-    if (ptr == nullptr) {
-        return ZX_ERR_NO_MEMORY;
+    size_t buffer_size = num_handles * sizeof(Handle*) + data_size;
+    Handle** buffer = nullptr;
+    if (buffer_size > kInlineBufferSize) {
+        buffer = static_cast<Handle**>(malloc(buffer_size));
+        if (buffer == nullptr) {
+            return ZX_ERR_NO_MEMORY;
+        }
     }
 
     // The storage space for the Handle*s is not initialized because
     // the only creators of MessagePackets (sys_channel_write and
     // _call, and userboot) fill that array immediately after creation
     // of the object.
-    msg->reset(new (ptr) MessagePacket(
-        data_size, num_handles,
-        reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket))));
+    fbl::AllocChecker ac;
+    MessagePacket* packet = new (&ac) MessagePacket(data_size, num_handles, buffer);
+    if (!ac.check()) {
+        free(buffer);
+        return ZX_ERR_NO_MEMORY;
+    }
+    msg->reset(packet);
     return ZX_OK;
 }
 
@@ -82,11 +91,16 @@ MessagePacket::~MessagePacket() {
         // destruction behavior.
         ReapHandles(handles_, num_handles_);
     }
+    if (!is_inline()) {
+        free(handles_);
+    }
 }
 
+// |handles| is the out-of-line buffer, or null to use the inline one.
 MessagePacket::MessagePacket(uint32_t data_size,
                              uint32_t num_handles, Handle** handles)
-    : handles_(handles), data_size_(data_size),
+    : handles_(handles ? handles : reinterpret_cast<Handle**>(inline_buffer_)),
+      data_size_(data_size),
       // NewPacket ensures that num_handles fits in 16 bits.
       num_handles_(static_cast<uint16_t>(num_handles)), owns_handles_(false) {
 }
@@ -0,0 +1,170 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <object/pager_dispatcher.h>
+
+#include <err.h>
+#include <inttypes.h>
+#include <trace.h>
+
+#include <fbl/alloc_checker.h>
+#include <fbl/auto_lock.h>
+#include <vm/pmm.h>
+#include <vm/vm.h>
+#include <vm/vm_object_paged.h>
+#include <zircon/rights.h>
+#include <zircon/syscalls/port.h>
+
+#define LOCAL_TRACE 0
+
+using fbl::AutoLock;
+
+zx_status_t PagerDispatcher::Create(uint32_t options, fbl::RefPtr<Dispatcher>* dispatcher,
+                                    zx_rights_t* rights) {
+    if (options != 0)
+        return ZX_ERR_INVALID_ARGS;
+
+    fbl::AllocChecker ac;
+    auto disp = new (&ac) PagerDispatcher();
+    if (!ac.check())
+        return ZX_ERR_NO_MEMORY;
+
+    *rights = ZX_DEFAULT_PAGER_RIGHTS;
+    *dispatcher = fbl::AdoptRef<Dispatcher>(disp);
+    return ZX_OK;
+}
+
+PagerDispatcher::PagerDispatcher() = default;
+
+PagerDispatcher::~PagerDispatcher() {
+    DEBUG_ASSERT(sources_.is_empty());
+}
+
+void PagerDispatcher::on_zero_handles() {
+    canary_.Assert();
+
+    // Nobody is left to answer requests, so wake everyone waiting on one of
+    // our VMOs and make future faults on them fail.
+    AutoLock lock(&lock_);
+    closed_ = true;
+    while (!sources_.is_empty()) {
+        sources_.pop_front()->OnPagerClosed();
+    }
+}
+
+zx_status_t PagerDispatcher::CreateVmo(uint32_t options, fbl::RefPtr<PortDispatcher> port,
+                                       uint64_t key, uint64_t size,
+                                       fbl::RefPtr<VmObject>* vmo) {
+    canary_.Assert();
+
+    if (options != 0)
+        return ZX_ERR_INVALID_ARGS;
+
+    fbl::AllocChecker ac;
+    auto source = fbl::AdoptRef(new (&ac) PagerSource(fbl::WrapRefPtr(this), fbl::move(port),
+                                                       key));
+    if (!ac.check())
+        return ZX_ERR_NO_MEMORY;
+
+    {
+        AutoLock lock(&lock_);
+        if (closed_)
+            return ZX_ERR_BAD_STATE;
+        sources_.push_back(source);
+    }
+
+    zx_status_t status = VmObjectPaged::CreateWithSource(0, size, source, vmo);
+    if (status != ZX_OK) {
+        RemoveSource(source.get());
+        return status;
+    }
+    return ZX_OK;
+}
+
+zx_status_t PagerDispatcher::SupplyPages(fbl::RefPtr<VmObject> vmo, uint64_t offset,
+                                         uint64_t length, fbl::RefPtr<VmObject> aux_vmo,
+                                         uint64_t aux_offset) {
+    canary_.Assert();
+
+    PageSource* source = vmo->page_source();
+    if (source == nullptr || source->owner() != this)
+        return ZX_ERR_INVALID_ARGS;
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(length) || !IS_PAGE_ALIGNED(aux_offset))
+        return ZX_ERR_INVALID_ARGS;
+    if (length == 0)
+        return ZX_OK;
+    if (offset + length < offset || offset + length > vmo->size())
+        return ZX_ERR_OUT_OF_RANGE;
+
+    list_node pages = LIST_INITIAL_VALUE(pages);
+    zx_status_t status = aux_vmo->TakePages(aux_offset, length, &pages);
+    if (status != ZX_OK)
+        return status;
+
+    // Whatever wasn't needed because the page was already there, or everything
+    // if the VMO shrank in the meantime, goes back to the pmm.
+    status = vmo->SupplyMissingPages(offset, length, &pages);
+    pmm_free(&pages);
+    if (status != ZX_OK)
+        return status;
+
+    source->OnPagesAvailable(offset, length);
+    return ZX_OK;
+}
+
+void PagerDispatcher::RemoveSource(PagerSource* source) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+    // on_zero_handles() may have gotten to it first.
+    if (source->InContainer())
+        sources_.erase(*source);
+}
+
+PagerSource::PagerSource(fbl::RefPtr<PagerDispatcher> pager, fbl::RefPtr<PortDispatcher> port,
+                         uint64_t key)
+    : PageSource(pager.get()), pager_(fbl::move(pager)), port_(fbl::move(port)), key_(key) {}
+
+void PagerSource::OnPagerClosed() {
+    fbl::RefPtr<PagerDispatcher> pager;
+    {
+        AutoLock lock(&lock_);
+        pager = fbl::move(pager_);
+    }
+    Close();
+}
+
+void PagerSource::OnDetach() {
+    fbl::RefPtr<PagerDispatcher> pager;
+    {
+        AutoLock lock(&lock_);
+        pager = fbl::move(pager_);
+    }
+    if (pager)
+        pager->RemoveSource(this);
+}
+
+zx_status_t PagerSource::SendRequestLocked(uint64_t offset, uint64_t len) {
+    LTRACEF("key %#" PRIx64 ", offset %#" PRIx64 ", len %#" PRIx64 "\n", key_, offset, len);
+
+    PortPacket* port_packet = PortDispatcher::DefaultPortAllocator()->Alloc();
+    if (port_packet == nullptr)
+        return ZX_ERR_NO_MEMORY;
+
+    port_packet->packet = {};
+    port_packet->packet.key = key_;
+    port_packet->packet.type = ZX_PKT_TYPE_PAGE_REQUEST;
+    port_packet->packet.status = ZX_OK;
+    port_packet->packet.page_request.command = ZX_PAGER_VMO_READ;
+    port_packet->packet.page_request.offset = offset;
+    port_packet->packet.page_request.length = len;
+
+    zx_status_t status = port_->Queue(port_packet, 0u, 0u);
+    if (status != ZX_OK)
+        port_packet->Free();
+    return status;
+}
@@ -85,6 +85,8 @@ size_t PortPacket::DiagnosticAllocationCount() {
     return port_allocator.DiagnosticCount();
 }
 
+HEAP_CACHE_DEFINE(PortObserver);
+
 PortObserver::PortObserver(uint32_t type, const Handle* handle, fbl::RefPtr<PortDispatcher> port,
                            uint64_t key, zx_signals_t signals)
     : type_(type),
@@ -239,7 +241,9 @@ zx_status_t PortDispatcher::Queue(PortPacket* port_packet, zx_signals_t observed
         }
 
         packets_.push_back(port_packet);
-        wake_count = sema_.Post();
+        // The thread woken is the one that will handle this packet, so it
+        // may be handed the cpu of a caller about to block on the answer.
+        wake_count = sema_.PostHandoff();
     }
 
     if (wake_count)
@@ -249,35 +253,51 @@ zx_status_t PortDispatcher::Queue(PortPacket* port_packet, zx_signals_t observed
 }
 
 zx_status_t PortDispatcher::Dequeue(zx_time_t deadline, zx_port_packet_t* out_packet) {
+    size_t actual;
+    return DequeueMany(deadline, out_packet, 1u, &actual);
+}
+
+zx_status_t PortDispatcher::DequeueMany(zx_time_t deadline, zx_port_packet_t* out_packets,
+                                        size_t count, size_t* actual) {
     canary_.Assert();
+    DEBUG_ASSERT(count > 0u);
 
     while (true) {
         {
             AutoLock al(&lock_);
 
-            PortPacket* port_packet = packets_.pop_front();
-            if (port_packet == nullptr)
-                goto wait;
-
-            if (out_packet != nullptr)
-                *out_packet = port_packet->packet;
-
-            PortObserver* observer = port_packet->observer;
+            size_t dequeued = 0u;
+            while (dequeued < count) {
+                PortPacket* port_packet = packets_.pop_front();
+                if (port_packet == nullptr)
+                    break;
+
+                if (out_packets != nullptr)
+                    out_packets[dequeued] = port_packet->packet;
+                dequeued++;
+
+                PortObserver* observer = port_packet->observer;
+
+                if (observer) {
+                    // Deleting the observer under the lock is fine because
+                    // the reference that holds to this PortDispatcher is by
+                    // construction not the last one. We need to do this under
+                    // the lock because another thread can call CanReap().
+                    delete observer;
+                } else if (port_packet->is_ephemeral()) {
+                    port_packet->Free();
+                }
+            }
 
-            if (observer) {
-                // Deleting the observer under the lock is fine because
-                // the reference that holds to this PortDispatcher is by
-                // construction not the last one. We need to do this under
-                // the lock because another thread can call CanReap().
-                delete observer;
-            } else if (port_packet->is_ephemeral()) {
-                port_packet->Free();
+            // The semaphore is only a hint that there may be packets; any
+            // counts left over for the extra packets taken here just cause
+            // other waiters to find the queue empty and wait again.
+            if (dequeued > 0u) {
+                *actual = dequeued;
+                return ZX_OK;
             }
         }
 
-        return ZX_OK;
-
-wait:
         zx_status_t st = sema_.Wait(deadline, nullptr);
         if (st != ZX_OK)
             return st;
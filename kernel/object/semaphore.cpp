@@ -21,10 +21,23 @@ Semaphore::~Semaphore() {
 int Semaphore::Post() {
     // If the count is or was negative then a thread is waiting for a resource,
     // otherwise it's safe to just increase the count available with no downsides.
-    AutoThreadLock lock;
+    spin_lock_saved_state_t state;
+    wait_queue_lock(&waitq_, &state);
+    int woken = 0;
     if (unlikely(++count_ <= 0))
-        return wait_queue_wake_one(&waitq_, false, ZX_OK);
-    return 0;
+        woken = wait_queue_wake_one(&waitq_, false, ZX_OK);
+    wait_queue_unlock(&waitq_, state);
+    return woken;
+}
+
+int Semaphore::PostHandoff() {
+    spin_lock_saved_state_t state;
+    wait_queue_lock(&waitq_, &state);
+    int woken = 0;
+    if (unlikely(++count_ <= 0))
+        woken = wait_queue_wake_one_handoff(&waitq_, ZX_OK);
+    wait_queue_unlock(&waitq_, state);
+    return woken;
 }
 
 zx_status_t Semaphore::Wait(zx_time_t deadline, bool* was_blocked) {
@@ -35,22 +48,28 @@ zx_status_t Semaphore::Wait(zx_time_t deadline, bool* was_blocked) {
     zx_status_t ret = ZX_OK;
     bool block;
 
-    {
-        AutoThreadLock lock;
-        current_thread->interruptable = true;
-        block = --count_ < 0;
+    spin_lock_saved_state_t state;
+    wait_queue_lock(&waitq_, &state);
+    current_thread->interruptable = true;
+    block = --count_ < 0;
 
-        if (unlikely(block)) {
-            ret = wait_queue_block(&waitq_, deadline);
-            if (ret < ZX_OK) {
-                if ((ret == ZX_ERR_TIMED_OUT) || (ret == ZX_ERR_INTERNAL_INTR_KILLED))
-                    count_++;
+    if (unlikely(block)) {
+        // the wait queue is unlocked once we're back
+        ret = wait_queue_block(&waitq_, deadline);
+        if (ret < ZX_OK) {
+            if ((ret == ZX_ERR_TIMED_OUT) || (ret == ZX_ERR_INTERNAL_INTR_KILLED)) {
+                spin_lock(&waitq_.lock);
+                count_++;
+                spin_unlock(&waitq_.lock);
             }
         }
-
-        current_thread->interruptable = false;
+    } else {
+        spin_unlock(&waitq_.lock);
     }
 
+    current_thread->interruptable = false;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
     if (was_blocked != nullptr)
         *was_blocked = block;
     return ret;
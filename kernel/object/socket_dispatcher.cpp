@@ -219,7 +219,7 @@ zx_status_t SocketDispatcher::ShutdownOther(uint32_t how) {
 }
 
 zx_status_t SocketDispatcher::Write(user_in_ptr<const void> src, size_t len,
-                                    size_t* nwritten) {
+                                    bool move_pages, size_t* nwritten) {
     canary_.Assert();
 
     LTRACE_ENTRY;
@@ -242,7 +242,7 @@ zx_status_t SocketDispatcher::Write(user_in_ptr<const void> src, size_t len,
     if (len != static_cast<size_t>(static_cast<uint32_t>(len)))
         return ZX_ERR_INVALID_ARGS;
 
-    return other->WriteSelf(src, len, nwritten);
+    return other->WriteSelf(src, len, move_pages, nwritten);
 }
 
 zx_status_t SocketDispatcher::WriteControl(user_in_ptr<const void> src, size_t len) {
@@ -290,7 +290,7 @@ zx_status_t SocketDispatcher::WriteControlSelf(user_in_ptr<const void> src,
 }
 
 zx_status_t SocketDispatcher::WriteSelf(user_in_ptr<const void> src, size_t len,
-                                        size_t* written) {
+                                        bool move_pages, size_t* written) {
     canary_.Assert();
 
     AutoLock lock(&lock_);
@@ -304,6 +304,8 @@ zx_status_t SocketDispatcher::WriteSelf(user_in_ptr<const void> src, size_t len,
     zx_status_t status;
     if (flags_ & ZX_SOCKET_DATAGRAM) {
         status = data_.WriteDatagram(src, len, &st);
+    } else if (move_pages) {
+        status = data_.WriteStreamPages(src, len, &st);
     } else {
         status = data_.WriteStream(src, len, &st);
     }
@@ -322,7 +324,7 @@ zx_status_t SocketDispatcher::WriteSelf(user_in_ptr<const void> src, size_t len,
     return status;
 }
 
-zx_status_t SocketDispatcher::Read(user_out_ptr<void> dst, size_t len,
+zx_status_t SocketDispatcher::Read(user_out_ptr<void> dst, size_t len, bool move_pages,
                                    size_t* nread) {
     canary_.Assert();
 
@@ -351,7 +353,7 @@ zx_status_t SocketDispatcher::Read(user_out_ptr<void> dst, size_t len,
 
     bool was_full = is_full();
 
-    auto st = data_.Read(dst, len, flags_ & ZX_SOCKET_DATAGRAM);
+    auto st = data_.Read(dst, len, flags_ & ZX_SOCKET_DATAGRAM, move_pages);
 
     if (is_empty()) {
         uint32_t set_mask = 0u;
@@ -360,7 +362,8 @@ zx_status_t SocketDispatcher::Read(user_out_ptr<void> dst, size_t len,
         UpdateState(ZX_SOCKET_READABLE, set_mask);
     }
 
-    if (other_ && was_full && (st > 0))
+    // A shrunken capacity can leave the socket full even after a read.
+    if (other_ && was_full && !is_full())
         other_->UpdateState(0u, ZX_SOCKET_WRITABLE);
 
     *nread = static_cast<size_t>(st);
@@ -404,6 +407,36 @@ zx_status_t SocketDispatcher::CheckShareable(SocketDispatcher* to_send) {
     return ZX_OK;
 }
 
+size_t SocketDispatcher::GetCapacity() {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+    return data_.capacity();
+}
+
+zx_status_t SocketDispatcher::SetCapacity(size_t capacity) {
+    canary_.Assert();
+
+    if (capacity < MBufChain::kMinCapacity || capacity > MBufChain::kMaxCapacity)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    AutoLock lock(&lock_);
+
+    // Shrinking below what is already buffered is fine; the peer just stays
+    // unwritable until enough has been read.
+    bool was_full = is_full();
+    data_.set_capacity(capacity);
+    if (other_ && was_full != is_full()) {
+        if (is_full()) {
+            other_->UpdateState(ZX_SOCKET_WRITABLE, 0u);
+        } else {
+            other_->UpdateState(0u, ZX_SOCKET_WRITABLE);
+        }
+    }
+
+    return ZX_OK;
+}
+
 zx_status_t SocketDispatcher::Share(Handle* h) {
     canary_.Assert();
 
@@ -168,6 +168,14 @@ zx_status_t VmAddressRegionDispatcher::Map(size_t vmar_offset, fbl::RefPtr<VmObj
     if (!is_valid_mapping_protection(flags))
         return ZX_ERR_INVALID_ARGS;
 
+    // Pull out the fault-around options, which only make sense for mappings
+    uint8_t fault_around_shift = static_cast<uint8_t>(
+        (flags & ZX_VM_FLAG_FAULT_AROUND_MASK) >> ZX_VM_FLAG_FAULT_AROUND_SHIFT);
+    bool fault_around_commit = (flags & ZX_VM_FLAG_FAULT_AROUND_COMMIT) != 0;
+    flags &= ~(ZX_VM_FLAG_FAULT_AROUND_MASK | ZX_VM_FLAG_FAULT_AROUND_COMMIT);
+    if (fault_around_commit && fault_around_shift == 0)
+        return ZX_ERR_INVALID_ARGS;
+
     // Split flags into vmar_flags and arch_mmu_flags
     uint32_t vmar_flags;
     uint arch_mmu_flags;
@@ -184,6 +192,10 @@ zx_status_t VmAddressRegionDispatcher::Map(size_t vmar_offset, fbl::RefPtr<VmObj
         return status;
     }
 
+    if (fault_around_shift != 0) {
+        result->SetFaultAround(fault_around_shift, fault_around_commit);
+    }
+
     *out = fbl::move(result);
     return ZX_OK;
 }
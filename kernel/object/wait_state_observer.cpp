@@ -79,8 +79,11 @@ StateObserver::Flags WaitStateObserver::OnStateChange(zx_signals_t new_state) {
     // while we were on the list may have been reasons to wake up.
     wakeup_reasons_ |= new_state;
 
+    // We are what a thread waiting on this object is blocked on, so if the
+    // state change comes from a thread about to block on it in turn (a
+    // channel call), it may hand over its cpu.
     if (new_state & watched_signals_) {
-        if (event_->Signal() > 0) {
+        if (event_->SignalHandoff() > 0) {
             return kWokeThreads;
         }
     }
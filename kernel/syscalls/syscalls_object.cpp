@@ -22,6 +22,7 @@
 #include <object/process_dispatcher.h>
 #include <object/resource_dispatcher.h>
 #include <object/resources.h>
+#include <object/socket_dispatcher.h>
 #include <object/thread_dispatcher.h>
 #include <object/vm_address_region_dispatcher.h>
 
@@ -394,7 +395,7 @@ zx_status_t sys_object_get_info(zx_handle_t handle, uint32_t topic,
 
                 // account for idle time if a cpu is currently idle
                 {
-                    AutoSpinLockIrqSave lock(&thread_lock);
+                    AutoSpinLockIrqSave lock(&cpu->run_queue_lock);
 
                     zx_time_t idle_time = cpu->stats.idle_time;
                     bool is_idle = mp_is_cpu_idle(i);
@@ -456,7 +457,9 @@ zx_status_t sys_object_get_info(zx_handle_t handle, uint32_t topic,
             stats.total_bytes = total * PAGE_SIZE;
             size_t other_bytes = stats.total_bytes;
 
-            stats.free_bytes = state_count[VM_PAGE_STATE_FREE] * PAGE_SIZE;
+            // pages the pmm is holding on to ahead of allocation are as good as free
+            stats.free_bytes = (state_count[VM_PAGE_STATE_FREE] +
+                                state_count[VM_PAGE_STATE_CACHED]) * PAGE_SIZE;
             other_bytes -= stats.free_bytes;
 
             stats.wired_bytes = state_count[VM_PAGE_STATE_WIRED] * PAGE_SIZE;
@@ -583,6 +586,17 @@ zx_status_t sys_object_get_property(zx_handle_t handle_value, uint32_t property,
             }
             return ZX_OK;
         }
+        case ZX_PROP_SOCKET_CAPACITY: {
+            if (size < sizeof(size_t))
+                return ZX_ERR_BUFFER_TOO_SMALL;
+            auto socket = DownCastDispatcher<SocketDispatcher>(&dispatcher);
+            if (!socket)
+                return ZX_ERR_WRONG_TYPE;
+            size_t value = socket->GetCapacity();
+            if (_value.reinterpret<size_t>().copy_to_user(value) != ZX_OK)
+                return ZX_ERR_INVALID_ARGS;
+            return ZX_OK;
+        }
         default:
             return ZX_ERR_INVALID_ARGS;
     }
@@ -663,6 +677,18 @@ zx_status_t sys_object_set_property(zx_handle_t handle_value, uint32_t property,
             return job->set_importance(
                 static_cast<zx_job_importance_t>(value));
         }
+        case ZX_PROP_SOCKET_CAPACITY: {
+            if (size < sizeof(size_t))
+                return ZX_ERR_BUFFER_TOO_SMALL;
+            auto socket = DownCastDispatcher<SocketDispatcher>(&dispatcher);
+            if (!socket)
+                return ZX_ERR_WRONG_TYPE;
+            size_t value = 0;
+            zx_status_t status = _value.reinterpret<const size_t>().copy_from_user(&value);
+            if (status != ZX_OK)
+                return status;
+            return socket->SetCapacity(value);
+        }
     }
 
     return ZX_ERR_INVALID_ARGS;
@@ -0,0 +1,114 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <err.h>
+#include <inttypes.h>
+#include <trace.h>
+
+#include <object/handle_owner.h>
+#include <object/handles.h>
+#include <object/pager_dispatcher.h>
+#include <object/port_dispatcher.h>
+#include <object/process_dispatcher.h>
+#include <object/vm_object_dispatcher.h>
+
+#include <fbl/ref_ptr.h>
+
+#include <zircon/types.h>
+
+#include "syscalls_priv.h"
+
+#define LOCAL_TRACE 0
+
+zx_status_t sys_pager_create(uint32_t options, user_out_ptr<zx_handle_t> out) {
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<Dispatcher> dispatcher;
+    zx_rights_t rights;
+    zx_status_t result = PagerDispatcher::Create(options, &dispatcher, &rights);
+    if (result != ZX_OK)
+        return result;
+
+    HandleOwner handle(MakeHandle(fbl::move(dispatcher), rights));
+    if (!handle)
+        return ZX_ERR_NO_MEMORY;
+
+    if (out.copy_to_user(up->MapHandleToValue(handle)) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+
+    up->AddHandle(fbl::move(handle));
+    return ZX_OK;
+}
+
+zx_status_t sys_pager_create_vmo(zx_handle_t pager, zx_handle_t port, uint64_t key,
+                                 uint64_t size, uint32_t options,
+                                 user_out_ptr<zx_handle_t> out) {
+    LTRACEF("pager %x, port %x, key %#" PRIx64 ", size %#" PRIx64 "\n", pager, port, key, size);
+
+    auto up = ProcessDispatcher::GetCurrent();
+    zx_status_t status = up->QueryPolicy(ZX_POL_NEW_VMO);
+    if (status != ZX_OK)
+        return status;
+
+    fbl::RefPtr<PagerDispatcher> pager_dispatcher;
+    status = up->GetDispatcherWithRights(pager, ZX_RIGHT_WRITE, &pager_dispatcher);
+    if (status != ZX_OK)
+        return status;
+
+    fbl::RefPtr<PortDispatcher> port_dispatcher;
+    status = up->GetDispatcherWithRights(port, ZX_RIGHT_WRITE, &port_dispatcher);
+    if (status != ZX_OK)
+        return status;
+
+    fbl::RefPtr<VmObject> vmo;
+    status = pager_dispatcher->CreateVmo(options, fbl::move(port_dispatcher), key, size, &vmo);
+    if (status != ZX_OK)
+        return status;
+
+    fbl::RefPtr<Dispatcher> dispatcher;
+    zx_rights_t rights;
+    status = VmObjectDispatcher::Create(fbl::move(vmo), &dispatcher, &rights);
+    if (status != ZX_OK)
+        return status;
+
+    HandleOwner handle(MakeHandle(fbl::move(dispatcher), rights));
+    if (!handle)
+        return ZX_ERR_NO_MEMORY;
+
+    if (out.copy_to_user(up->MapHandleToValue(handle)) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+
+    up->AddHandle(fbl::move(handle));
+    return ZX_OK;
+}
+
+zx_status_t sys_pager_supply_pages(zx_handle_t pager, zx_handle_t pager_vmo, uint64_t offset,
+                                   uint64_t length, zx_handle_t aux_vmo, uint64_t aux_offset) {
+    LTRACEF("pager %x, vmo %x, offset %#" PRIx64 ", length %#" PRIx64 "\n",
+            pager, pager_vmo, offset, length);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<PagerDispatcher> pager_dispatcher;
+    zx_status_t status = up->GetDispatcherWithRights(pager, ZX_RIGHT_WRITE, &pager_dispatcher);
+    if (status != ZX_OK)
+        return status;
+
+    fbl::RefPtr<VmObjectDispatcher> pager_vmo_dispatcher;
+    status = up->GetDispatcherWithRights(pager_vmo, ZX_RIGHT_WRITE, &pager_vmo_dispatcher);
+    if (status != ZX_OK)
+        return status;
+
+    // The pages are moved out of |aux_vmo|, which leaves that range decommitted.
+    fbl::RefPtr<VmObjectDispatcher> aux_vmo_dispatcher;
+    status = up->GetDispatcherWithRights(aux_vmo, ZX_RIGHT_READ | ZX_RIGHT_WRITE,
+                                         &aux_vmo_dispatcher);
+    if (status != ZX_OK)
+        return status;
+
+    return pager_dispatcher->SupplyPages(pager_vmo_dispatcher->vmo(), offset, length,
+                                         aux_vmo_dispatcher->vmo(), aux_offset);
+}
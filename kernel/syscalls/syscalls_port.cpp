@@ -114,6 +114,46 @@ zx_status_t sys_port_wait(zx_handle_t handle, zx_time_t deadline,
     return ZX_OK;
 }
 
+// Bounds the kernel stack buffer used by sys_port_wait_many(); larger
+// requests are satisfied with at most this many packets.
+static constexpr size_t kMaxPortWaitManyPackets = 16u;
+
+zx_status_t sys_port_wait_many(zx_handle_t handle, zx_time_t deadline,
+                               user_out_ptr<zx_port_packet_t> packets_out, size_t count,
+                               user_out_ptr<size_t> actual_out) {
+    LTRACEF("handle %x count %zu\n", handle, count);
+
+    if (count == 0u)
+        return ZX_ERR_INVALID_ARGS;
+    if (count > kMaxPortWaitManyPackets)
+        count = kMaxPortWaitManyPackets;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<PortDispatcher> port;
+    zx_status_t status = up->GetDispatcherWithRights(handle, ZX_RIGHT_READ, &port);
+    if (status != ZX_OK)
+        return status;
+
+    ktrace(TAG_PORT_WAIT, (uint32_t)port->get_koid(), 0, 0, 0);
+
+    zx_port_packet_t pp[kMaxPortWaitManyPackets];
+    size_t actual = 0u;
+    zx_status_t st = port->DequeueMany(deadline, pp, count, &actual);
+
+    ktrace(TAG_PORT_WAIT_DONE, (uint32_t)port->get_koid(), st, 0, 0);
+
+    if (st != ZX_OK)
+        return st;
+
+    if (packets_out.copy_array_to_user(pp, actual) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+    if (actual_out.copy_to_user(actual) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+
+    return ZX_OK;
+}
+
 zx_status_t sys_port_cancel(zx_handle_t handle, zx_handle_t source, uint64_t key) {
     auto up = ProcessDispatcher::GetCurrent();
 
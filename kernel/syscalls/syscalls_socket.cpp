@@ -81,7 +81,8 @@ zx_status_t sys_socket_write(zx_handle_t handle, uint32_t options,
     size_t nwritten;
     switch (options) {
     case 0:
-        status = socket->Write(buffer, size, &nwritten);
+    case ZX_SOCKET_MOVE_PAGES:
+        status = socket->Write(buffer, size, options == ZX_SOCKET_MOVE_PAGES, &nwritten);
         break;
     case ZX_SOCKET_CONTROL:
         status = socket->WriteControl(buffer, size);
@@ -124,7 +125,8 @@ zx_status_t sys_socket_read(zx_handle_t handle, uint32_t options,
 
     switch (options) {
     case 0:
-        status = socket->Read(buffer, size, &nread);
+    case ZX_SOCKET_MOVE_PAGES:
+        status = socket->Read(buffer, size, options == ZX_SOCKET_MOVE_PAGES, &nread);
         break;
     case ZX_SOCKET_CONTROL:
         status = socket->ReadControl(buffer, size, &nread);
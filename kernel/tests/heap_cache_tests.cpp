@@ -0,0 +1,201 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "tests.h"
+
+#include <fbl/alloc_checker.h>
+#include <kernel/thread.h>
+#include <lib/heap.h>
+#include <lib/heap_cache.h>
+#include <stdlib.h>
+#include <unittest.h>
+
+// Only used by these tests, so its statistics move only when they do.
+static HeapCache test_cache("test", 80);
+
+struct HeapCacheTestObject {
+    HEAP_CACHE_DECLARE(HeapCacheTestObject);
+    char payload[72];
+};
+HEAP_CACHE_DEFINE(HeapCacheTestObject);
+
+// Magazines are per-cpu, so keep the test on one cpu for as long as it's
+// looking at them.
+class PinToCurrentCpu {
+public:
+    PinToCurrentCpu()
+        : affinity_(get_current_thread()->cpu_affinity) {
+        thread_migrate_to_cpu(arch_curr_cpu_num());
+    }
+    ~PinToCurrentCpu() { thread_set_cpu_affinity(get_current_thread(), affinity_); }
+
+private:
+    const cpu_mask_t affinity_;
+};
+
+static bool heap_cache_hit_miss(void* context) {
+    BEGIN_TEST;
+
+    PinToCurrentCpu pin;
+    test_cache.Drain();
+    HeapCache::Stats before = test_cache.GetStats();
+    EXPECT_EQ(0u, before.cached, "drained cache holds objects");
+
+    // An empty magazine misses and is refilled with a batch, less the one
+    // handed out.
+    void* first = test_cache.Alloc();
+    REQUIRE_NONNULL(first, "");
+    HeapCache::Stats stats = test_cache.GetStats();
+    EXPECT_EQ(before.allocs + 1, stats.allocs, "");
+    EXPECT_EQ(before.misses + 1, stats.misses, "");
+    EXPECT_EQ(HeapCache::kBatchSize - 1, stats.cached, "");
+
+    // which the next one comes out of
+    void* second = test_cache.Alloc();
+    REQUIRE_NONNULL(second, "");
+    stats = test_cache.GetStats();
+    EXPECT_EQ(before.allocs + 2, stats.allocs, "");
+    EXPECT_EQ(before.misses + 1, stats.misses, "");
+    EXPECT_EQ(HeapCache::kBatchSize - 2, stats.cached, "");
+
+    test_cache.Free(second);
+    test_cache.Free(first);
+    stats = test_cache.GetStats();
+    EXPECT_EQ(before.frees + 2, stats.frees, "");
+    EXPECT_EQ(before.flushes, stats.flushes, "");
+    EXPECT_EQ(HeapCache::kBatchSize, stats.cached, "");
+
+    test_cache.Drain();
+
+    END_TEST;
+}
+
+static bool heap_cache_reuse(void* context) {
+    BEGIN_TEST;
+
+    PinToCurrentCpu pin;
+
+    // A freed object is the next one handed out on the same cpu.
+    void* ptr = test_cache.Alloc();
+    REQUIRE_NONNULL(ptr, "");
+    test_cache.Free(ptr);
+    void* again = test_cache.Alloc();
+    EXPECT_EQ(ptr, again, "freed object not reused");
+    test_cache.Free(again);
+
+    // and the same goes for objects of a class backed by a cache
+    HeapCacheTestObject::heap_cache_.Drain();
+    fbl::AllocChecker ac;
+    HeapCacheTestObject* obj = new (&ac) HeapCacheTestObject;
+    REQUIRE_TRUE(ac.check(), "");
+    HeapCache::Stats before = HeapCacheTestObject::heap_cache_.GetStats();
+    delete obj;
+    HeapCacheTestObject* obj_again = new (&ac) HeapCacheTestObject;
+    REQUIRE_TRUE(ac.check(), "");
+    HeapCache::Stats stats = HeapCacheTestObject::heap_cache_.GetStats();
+    EXPECT_EQ(static_cast<void*>(obj), static_cast<void*>(obj_again), "");
+    EXPECT_EQ(before.frees + 1, stats.frees, "");
+    EXPECT_EQ(before.allocs + 1, stats.allocs, "");
+    EXPECT_EQ(before.misses, stats.misses, "");
+    delete obj_again;
+
+    // Overflowing the magazine hands a batch back to the heap.
+    void* objects[HeapCache::kMagazineSize + 1];
+    for (auto& object : objects) {
+        object = test_cache.Alloc();
+        REQUIRE_NONNULL(object, "");
+    }
+    test_cache.Drain();
+    before = test_cache.GetStats();
+    for (auto& object : objects)
+        test_cache.Free(object);
+    stats = test_cache.GetStats();
+    EXPECT_EQ(before.flushes + 1, stats.flushes, "");
+    EXPECT_EQ(HeapCache::kMagazineSize + 1 - HeapCache::kBatchSize, stats.cached, "");
+
+    test_cache.Drain();
+
+    END_TEST;
+}
+
+static bool heap_cache_drain(void* context) {
+    BEGIN_TEST;
+
+    PinToCurrentCpu pin;
+
+    void* objects[HeapCache::kMagazineSize];
+    for (auto& object : objects) {
+        object = test_cache.Alloc();
+        REQUIRE_NONNULL(object, "");
+    }
+    test_cache.Drain();
+    for (auto& object : objects)
+        test_cache.Free(object);
+    EXPECT_EQ(HeapCache::kMagazineSize, test_cache.GetStats().cached, "");
+
+    // Trimming the heap under memory pressure empties every cache that has
+    // been used, this one included.
+    heap_trim();
+    EXPECT_EQ(0u, test_cache.GetStats().cached, "trim left objects cached");
+    EXPECT_EQ(0u, HeapCacheTestObject::heap_cache_.GetStats().cached, "");
+
+    END_TEST;
+}
+
+static bool heap_cache_size_classes(void* context) {
+    BEGIN_TEST;
+
+    // malloc() goes to the smallest class that fits, and past the largest
+    // straight to cmpctmalloc.
+    HeapCache* cache = heap_size_cache_for_alloc(1);
+    REQUIRE_NONNULL(cache, "");
+    EXPECT_EQ(32u, cache->object_size(), "");
+    cache = heap_size_cache_for_alloc(40);
+    REQUIRE_NONNULL(cache, "");
+    EXPECT_EQ(48u, cache->object_size(), "");
+    cache = heap_size_cache_for_alloc(1024);
+    REQUIRE_NONNULL(cache, "");
+    EXPECT_EQ(1024u, cache->object_size(), "");
+    EXPECT_NULL(heap_size_cache_for_alloc(1025), "");
+
+    // free() goes by usable size to the largest class that fits in the block.
+    // Blocks too small for any class, and large ones that would waste most of
+    // a cached object, go back to cmpctmalloc.
+    EXPECT_NULL(heap_size_cache_for_free(31), "");
+    cache = heap_size_cache_for_free(32);
+    REQUIRE_NONNULL(cache, "");
+    EXPECT_EQ(32u, cache->object_size(), "");
+    cache = heap_size_cache_for_free(100);
+    REQUIRE_NONNULL(cache, "");
+    EXPECT_EQ(96u, cache->object_size(), "");
+    cache = heap_size_cache_for_free(1535);
+    REQUIRE_NONNULL(cache, "");
+    EXPECT_EQ(1024u, cache->object_size(), "");
+    EXPECT_NULL(heap_size_cache_for_free(1536), "");
+    EXPECT_NULL(heap_size_cache_for_free(64 * 1024), "");
+
+    // Everything else using the heap moves these counters too, so all that
+    // can be checked is that a cached size went through its class.
+    cache = heap_size_cache_for_alloc(40);
+    HeapCache::Stats before = cache->GetStats();
+    void* ptr = malloc(40);
+    REQUIRE_NONNULL(ptr, "");
+    EXPECT_GT(cache->GetStats().allocs, before.allocs, "");
+    free(ptr);
+
+    ptr = malloc(4096);
+    REQUIRE_NONNULL(ptr, "");
+    free(ptr);
+
+    END_TEST;
+}
+
+UNITTEST_START_TESTCASE(heap_cache_tests)
+UNITTEST("hit and miss accounting", heap_cache_hit_miss)
+UNITTEST("objects return to their cache", heap_cache_reuse)
+UNITTEST("drain on trim", heap_cache_drain)
+UNITTEST("size class routing", heap_cache_size_classes)
+UNITTEST_END_TESTCASE(heap_cache_tests, "heap_cache", "Tests of the per-cpu heap caches", nullptr, nullptr);
@@ -15,6 +15,8 @@
 #include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/percpu.h>
+#include <kernel/sched.h>
 #include <kernel/thread.h>
 #include <platform.h>
 #include <pow2.h>
@@ -93,6 +95,27 @@ static int mutex_test(void) {
         thread_join(threads[i], NULL, ZX_TIME_INFINITE);
     }
 
+    printf("priority inheriting mutex:\n");
+
+    mutex_t pim;
+    mutex_init_etc(&pim, MUTEX_OPTION_PRIORITY_INHERIT);
+
+    // spread the testers across priorities so that lower priority holders
+    // get lent a higher one
+    for (uint i = 0; i < countof(threads); i++) {
+        threads[i] = thread_create("pi mutex tester", &mutex_thread, &pim,
+                                   LOW_PRIORITY + (int)i * 4, DEFAULT_STACK_SIZE);
+        thread_resume(threads[i]);
+    }
+
+    for (uint i = 0; i < countof(threads); i++) {
+        thread_join(threads[i], NULL, ZX_TIME_INFINITE);
+    }
+
+    // nothing should still be lent once the mutex is free
+    ASSERT(get_current_thread()->inherited_priority == 0);
+    mutex_destroy(&pim);
+
     thread_sleep_relative(ZX_MSEC(100));
 
     printf("done with mutex tests\n");
@@ -100,6 +123,160 @@ static int mutex_test(void) {
     return 0;
 }
 
+static int pi_waiter_thread(void* arg) {
+    mutex_t* m = (mutex_t*)arg;
+
+    mutex_acquire(m);
+    mutex_release(m);
+
+    return 0;
+}
+
+// wait for t to block on a priority inheriting mutex. it has lent out its
+// priority by the time it's queued.
+static void pi_wait_for_blocked(thread_t* t) {
+    for (;;) {
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&t->state_lock, state);
+        bool blocked = t->state == THREAD_BLOCKED && t->blocking_pi_mutex != NULL;
+        spin_unlock_irqrestore(&t->state_lock, state);
+        if (blocked)
+            return;
+        thread_sleep_relative(ZX_MSEC(1));
+    }
+}
+
+// start a real time waiter on m, so that its priority doesn't drift, and
+// wait for it to block
+static thread_t* pi_start_waiter(mutex_t* m, int priority) {
+    thread_t* t = thread_create("pi waiter", &pi_waiter_thread, m, priority, DEFAULT_STACK_SIZE);
+    thread_set_real_time(t);
+    thread_resume(t);
+
+    pi_wait_for_blocked(t);
+
+    return t;
+}
+
+// priority is lent with the receiving thread's state_lock held, so read it
+// under that lock too
+static int pi_inherited_priority(thread_t* t) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&t->state_lock, state);
+    int pri = t->inherited_priority;
+    spin_unlock_irqrestore(&t->state_lock, state);
+    return pri;
+}
+
+static int pi_holder_thread(void* arg) {
+    thread_t* ct = get_current_thread();
+
+    mutex_t a, b;
+    mutex_init_etc(&a, MUTEX_OPTION_PRIORITY_INHERIT);
+    mutex_init_etc(&b, MUTEX_OPTION_PRIORITY_INHERIT);
+
+    mutex_acquire(&a);
+    mutex_acquire(&b);
+    ASSERT(pi_inherited_priority(ct) == 0);
+
+    // we run at LOW_PRIORITY, so even fully boosted both waiters outrank us
+    thread_t* wb = pi_start_waiter(&b, DEFAULT_PRIORITY);
+    ASSERT(pi_inherited_priority(ct) == DEFAULT_PRIORITY);
+    ASSERT(sched_get_effective_priority(ct) == DEFAULT_PRIORITY);
+
+    thread_t* wa = pi_start_waiter(&a, HIGH_PRIORITY);
+    ASSERT(pi_inherited_priority(ct) == HIGH_PRIORITY);
+    ASSERT(sched_get_effective_priority(ct) == HIGH_PRIORITY);
+
+    // releasing a hands back only what was lent through it
+    mutex_release(&a);
+    ASSERT(pi_inherited_priority(ct) == DEFAULT_PRIORITY);
+    ASSERT(sched_get_effective_priority(ct) == DEFAULT_PRIORITY);
+
+    mutex_release(&b);
+    ASSERT(pi_inherited_priority(ct) == 0);
+    ASSERT(sched_get_effective_priority(ct) < DEFAULT_PRIORITY);
+
+    thread_join(wa, NULL, ZX_TIME_INFINITE);
+    thread_join(wb, NULL, ZX_TIME_INFINITE);
+    mutex_destroy(&a);
+    mutex_destroy(&b);
+
+    return 0;
+}
+
+struct pi_chain_args {
+    mutex_t* held;
+    mutex_t* wanted;
+};
+
+// takes |held|, then blocks on |wanted|
+static int pi_chain_thread(void* arg) {
+    pi_chain_args* args = static_cast<pi_chain_args*>(arg);
+
+    mutex_acquire(args->held);
+    mutex_acquire(args->wanted);
+    mutex_release(args->wanted);
+    mutex_release(args->held);
+
+    return 0;
+}
+
+// a waiter blocked behind a holder that is itself blocked lends its priority
+// all the way down the chain
+static int pi_chain_holder_thread(void* arg) {
+    thread_t* ct = get_current_thread();
+
+    mutex_t a, b;
+    mutex_init_etc(&a, MUTEX_OPTION_PRIORITY_INHERIT);
+    mutex_init_etc(&b, MUTEX_OPTION_PRIORITY_INHERIT);
+
+    mutex_acquire(&a);
+
+    // the middle thread holds b and blocks on a, lending us its own priority
+    pi_chain_args args = {&b, &a};
+    thread_t* middle = thread_create("pi chain", &pi_chain_thread, &args, DEFAULT_PRIORITY,
+                                     DEFAULT_STACK_SIZE);
+    thread_set_real_time(middle);
+    thread_resume(middle);
+    pi_wait_for_blocked(middle);
+    ASSERT(pi_inherited_priority(ct) == DEFAULT_PRIORITY);
+    ASSERT(pi_inherited_priority(middle) == 0);
+
+    // a higher priority waiter on b boosts the middle thread, and through it, us
+    thread_t* top = pi_start_waiter(&b, HIGH_PRIORITY);
+    ASSERT(pi_inherited_priority(middle) == HIGH_PRIORITY);
+    ASSERT(pi_inherited_priority(ct) == HIGH_PRIORITY);
+    ASSERT(sched_get_effective_priority(ct) == HIGH_PRIORITY);
+
+    // a is handed to the middle thread, which keeps what it's owed through b
+    mutex_release(&a);
+    ASSERT(pi_inherited_priority(ct) == 0);
+    ASSERT(sched_get_effective_priority(ct) < DEFAULT_PRIORITY);
+
+    thread_join(middle, NULL, ZX_TIME_INFINITE);
+    thread_join(top, NULL, ZX_TIME_INFINITE);
+    mutex_destroy(&a);
+    mutex_destroy(&b);
+
+    return 0;
+}
+
+static void pi_mutex_test(void) {
+    printf("starting priority inheritance tests\n");
+
+    thread_t* t = thread_create("pi holder", &pi_holder_thread, NULL, LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_resume(t);
+    thread_join(t, NULL, ZX_TIME_INFINITE);
+
+    t = thread_create("pi chain holder", &pi_chain_holder_thread, NULL, LOW_PRIORITY,
+                      DEFAULT_STACK_SIZE);
+    thread_resume(t);
+    thread_join(t, NULL, ZX_TIME_INFINITE);
+
+    printf("done with priority inheritance tests\n");
+}
+
 static event_t e;
 
 static int event_signaler(void* arg) {
@@ -663,6 +840,273 @@ __NO_INLINE static void affinity_test() {
     printf("done with affinity test\n");
 }
 
+struct wait_stress_state {
+    event_t event;
+    thread_t* waiters[16] = {};
+    thread_t* wakers[SMP_MAX_CPUS] = {};
+    volatile bool shutdown = false;
+    volatile int woken = 0;
+    volatile int timed_out = 0;
+    volatile int killed = 0;
+};
+
+static int wait_stress_waiter(void* arg) {
+    wait_stress_state* state = static_cast<wait_stress_state*>(arg);
+    cpu_mask_t online = mp_get_online_mask();
+
+    while (!state->shutdown) {
+        // short deadlines so that timeouts keep racing the wakers and the killer
+        zx_status_t status = event_wait_deadline(&state->event,
+                                                 current_time() + ZX_USEC(rand() % 200), true);
+        switch (status) {
+        case ZX_OK:
+            atomic_add(&state->woken, 1);
+            break;
+        case ZX_ERR_TIMED_OUT:
+            atomic_add(&state->timed_out, 1);
+            break;
+        case ZX_ERR_INTERNAL_INTR_KILLED:
+            atomic_add(&state->killed, 1);
+            return 0;
+        default:
+            panic("unexpected wait status %d\n", status);
+        }
+
+        // move around so that the run queues keep getting stolen from and rebalanced
+        switch (rand() % 4) {
+        case 0: {
+            cpu_mask_t mask = (cpu_mask_t)rand() & online;
+            thread_set_cpu_affinity(get_current_thread(), mask ? mask : online);
+            break;
+        }
+        case 1:
+            thread_yield();
+            break;
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int wait_stress_waker(void* arg) {
+    wait_stress_state* state = static_cast<wait_stress_state*>(arg);
+
+    while (!state->shutdown) {
+        event_signal(&state->event, (rand() % 2) == 0);
+        spin((uint32_t)rand() % 20);
+    }
+
+    return 0;
+}
+
+static thread_t* wait_stress_start_waiter(wait_stress_state* state) {
+    thread_t* t = thread_create("wait stress waiter", &wait_stress_waiter, state,
+                                LOW_PRIORITY + (rand() % 4), DEFAULT_STACK_SIZE);
+    thread_resume(t);
+    return t;
+}
+
+// block, wake, time out and kill threads on one wait queue from every cpu at once.
+// timeouts and kills race the wakers for the blocked threads, while the waiters hop
+// between cpus to keep the idle steal and periodic rebalance paths busy.
+// a sucessful pass is one where everything is accounted for and nothing hangs.
+__NO_INLINE static void wait_queue_stress_test() {
+    printf("starting wait queue stress test\n");
+
+    cpu_mask_t online = mp_get_online_mask();
+    if (!online || ispow2(online)) {
+        printf("aborting test, not enough online cpus\n");
+        return;
+    }
+
+    ulong steals = 0, rebalances = 0;
+    for (cpu_num_t i = 0; i < SMP_MAX_CPUS; i++) {
+        steals += percpu[i].stats.steals;
+        rebalances += percpu[i].stats.rebalances;
+    }
+
+    wait_stress_state state;
+    event_init(&state.event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+    for (auto& t : state.waiters)
+        t = wait_stress_start_waiter(&state);
+
+    // one waker pinned to each online cpu
+    for (cpu_num_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (!(online & cpu_num_to_mask(i)))
+            continue;
+        state.wakers[i] = thread_create("wait stress waker", &wait_stress_waker, &state,
+                                        DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_set_cpu_affinity(state.wakers[i], cpu_num_to_mask(i));
+        thread_resume(state.wakers[i]);
+    }
+
+    static const int duration = 10;
+    int kills = 0;
+    printf("running tests for %i seconds\n", duration);
+    for (int i = 0; i < duration * 100; i++) {
+        thread_sleep_relative(ZX_MSEC(10));
+
+        // kill a waiter wherever it happens to be and replace it
+        thread_t*& t = state.waiters[rand() % countof(state.waiters)];
+        thread_kill(t, false);
+        thread_join(t, nullptr, ZX_TIME_INFINITE);
+        t = wait_stress_start_waiter(&state);
+        kills++;
+
+        if ((i + 1) % 100 == 0)
+            printf("%d sec elapsed\n", (i + 1) / 100);
+    }
+    state.shutdown = true;
+
+    for (auto& t : state.wakers) {
+        if (t)
+            thread_join(t, nullptr, ZX_TIME_INFINITE);
+    }
+    // the waiters all have deadlines, so they notice the shutdown on their own
+    for (auto& t : state.waiters)
+        thread_join(t, nullptr, ZX_TIME_INFINITE);
+
+    event_destroy(&state.event);
+
+    for (cpu_num_t i = 0; i < SMP_MAX_CPUS; i++) {
+        steals -= percpu[i].stats.steals;
+        rebalances -= percpu[i].stats.rebalances;
+    }
+
+    printf("woken %d, timed out %d, killed %d of %d, %lu steals, %lu rebalances\n",
+           state.woken, state.timed_out, state.killed, kills, -steals, -rebalances);
+
+    // a waiter killed before it first blocked exits without counting
+    ASSERT(state.killed <= kills);
+    ASSERT(state.woken > 0);
+    ASSERT(state.timed_out > 0);
+
+    printf("done with wait queue stress test\n");
+}
+
+struct steal_test_state {
+    cpu_num_t loaded_cpu;
+    volatile bool hog_started = false;
+    volatile bool hog_shutdown = false;
+    volatile int hog_migrations = 0;
+    volatile cpu_num_t pinned_ran_on = INVALID_CPU;
+    volatile cpu_num_t stealable_ran_on = INVALID_CPU;
+};
+
+// keeps the loaded cpu busy, so that whatever is queued behind it can only
+// leave through another cpu's run queue.
+static int steal_hog_thread(void* arg) {
+    steal_test_state* state = static_cast<steal_test_state*>(arg);
+
+    state->hog_started = true;
+    while (!state->hog_shutdown) {
+        if (arch_curr_cpu_num() != state->loaded_cpu)
+            atomic_add(&state->hog_migrations, 1);
+    }
+
+    return 0;
+}
+
+static int steal_pinned_thread(void* arg) {
+    steal_test_state* state = static_cast<steal_test_state*>(arg);
+    state->pinned_ran_on = arch_curr_cpu_num();
+    return 0;
+}
+
+static int steal_stealable_thread(void* arg) {
+    steal_test_state* state = static_cast<steal_test_state*>(arg);
+    state->stealable_ran_on = arch_curr_cpu_num();
+    return 0;
+}
+
+static thread_t* steal_start_hog(steal_test_state* state) {
+    state->hog_started = false;
+    state->hog_shutdown = false;
+
+    thread_t* t = thread_create("steal hog", &steal_hog_thread, state,
+                                HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_set_cpu_affinity(t, cpu_num_to_mask(state->loaded_cpu));
+    thread_resume(t);
+
+    while (!state->hog_started)
+        thread_sleep_relative(ZX_MSEC(1));
+    return t;
+}
+
+// queue a thread behind a busy cpu while the cpu this thread runs on keeps
+// going idle, and check that it is stolen only when its affinity allows it.
+// only one thread is ever queued behind the hog, which is too few for the
+// periodic rebalance to push it away, so the steal path is the only way out.
+__NO_INLINE static void steal_test() {
+    printf("starting steal test\n");
+
+    cpu_mask_t online = mp_get_online_mask();
+    if (!online || ispow2(online)) {
+        printf("aborting test, not enough online cpus\n");
+        return;
+    }
+
+    steal_test_state state;
+    state.loaded_cpu = lowest_cpu_set(online);
+    cpu_num_t idle_cpu = lowest_cpu_set(online & ~cpu_num_to_mask(state.loaded_cpu));
+
+    // every sleep below leaves idle_cpu with nothing to run
+    thread_migrate_to_cpu(idle_cpu);
+
+    // a thread pinned to the loaded cpu has to wait for it, however long
+    // idle_cpu sits there with nothing to do
+    thread_t* hog = steal_start_hog(&state);
+    thread_t* pinned = thread_create("steal pinned", &steal_pinned_thread, &state,
+                                     DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_set_cpu_affinity(pinned, cpu_num_to_mask(state.loaded_cpu));
+    thread_resume(pinned);
+
+    for (int i = 0; i < 100; i++)
+        thread_sleep_relative(ZX_MSEC(1));
+    ASSERT(state.pinned_ran_on == INVALID_CPU);
+
+    state.hog_shutdown = true;
+    thread_join(hog, nullptr, ZX_TIME_INFINITE);
+    thread_join(pinned, nullptr, ZX_TIME_INFINITE);
+    ASSERT(state.pinned_ran_on == state.loaded_cpu);
+
+    // one that may also run on idle_cpu gets pulled over the next time it goes idle.
+    // it's queued on the loaded cpu first, and widening the mask leaves it there.
+    hog = steal_start_hog(&state);
+    ulong steals = percpu[idle_cpu].stats.steals;
+
+    thread_t* stealable = thread_create("steal stealable", &steal_stealable_thread, &state,
+                                        DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_set_cpu_affinity(stealable, cpu_num_to_mask(state.loaded_cpu));
+    thread_resume(stealable);
+    thread_set_cpu_affinity(stealable, cpu_num_to_mask(state.loaded_cpu) |
+                                           cpu_num_to_mask(idle_cpu));
+
+    // stealing from a lower numbered cpu gives up if its run queue lock is busy,
+    // so give idle_cpu a few chances
+    for (int i = 0; i < 1000 && state.stealable_ran_on == INVALID_CPU; i++)
+        thread_sleep_relative(ZX_MSEC(1));
+
+    state.hog_shutdown = true;
+    thread_join(hog, nullptr, ZX_TIME_INFINITE);
+    thread_join(stealable, nullptr, ZX_TIME_INFINITE);
+
+    steals = percpu[idle_cpu].stats.steals - steals;
+    printf("stealable thread ran on cpu %u, %lu steals by cpu %u\n",
+           state.stealable_ran_on, steals, idle_cpu);
+
+    ASSERT(state.stealable_ran_on == idle_cpu);
+    ASSERT(steals > 0);
+    ASSERT(state.hog_migrations == 0);
+
+    thread_set_cpu_affinity(get_current_thread(), CPU_MASK_ALL);
+
+    printf("done with steal test\n");
+}
+
 #define TLS_TEST_TAGV   ((void*)0x666)
 
 static void tls_test_callback(void *tls) {
@@ -693,10 +1137,201 @@ static void tls_tests() {
     printf("done with tls tests\n");
 }
 
+struct handoff_state {
+    wait_queue_t request;
+    wait_queue_t reply;
+    cpu_num_t server_cpu;
+    bool done;
+};
+
+static int handoff_server_thread(void* arg) {
+    handoff_state* hs = (handoff_state*)arg;
+    spin_lock_saved_state_t state, wstate;
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    for (;;) {
+        wait_queue_lock(&hs->request, &wstate);
+        wait_queue_block(&hs->request, ZX_TIME_INFINITE);
+        if (hs->done)
+            break;
+        hs->server_cpu = arch_curr_cpu_num();
+
+        wait_queue_lock(&hs->reply, &wstate);
+        (void)wait_queue_wake_one(&hs->reply, false, ZX_OK);
+        wait_queue_unlock(&hs->reply, wstate);
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return 0;
+}
+
+// wake the server and wait for it to answer, the way a channel call does
+static void handoff_call(handoff_state* hs, thread_t* server) {
+    thread_t* ct = get_current_thread();
+    spin_lock_saved_state_t state, wstate;
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    wait_queue_lock(&hs->request, &wstate);
+    while (wait_queue_is_empty(&hs->request)) {
+        wait_queue_unlock(&hs->request, wstate);
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        thread_sleep_relative(ZX_MSEC(1));
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+        wait_queue_lock(&hs->request, &wstate);
+    }
+
+    // interrupts stay disabled until we block, so we can't be preempted and
+    // no other cpu takes a handed off thread off our run queue
+    cpu_num_t cpu = arch_curr_cpu_num();
+    zx_duration_t slice = ct->remaining_time_slice;
+
+    thread_set_wake_handoff(true);
+    ASSERT(wait_queue_wake_one_handoff(&hs->request, ZX_OK) == 1);
+    thread_set_wake_handoff(false);
+    wait_queue_unlock(&hs->request, wstate);
+
+    ASSERT(server->state == THREAD_READY);
+    ASSERT(server->curr_cpu == cpu);
+    // whatever the server was given came out of our slice
+    if (ct->remaining_time_slice < slice)
+        ASSERT(ct->remaining_time_slice + server->remaining_time_slice == slice);
+
+    if (!hs->done) {
+        wait_queue_lock(&hs->reply, &wstate);
+        wait_queue_block(&hs->reply, ZX_TIME_INFINITE);
+        ASSERT(hs->server_cpu == cpu);
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+static void handoff_test(void) {
+    printf("starting handoff tests\n");
+
+    handoff_state hs = {};
+    wait_queue_init(&hs.request);
+    wait_queue_init(&hs.reply);
+
+    thread_t* t = thread_create("handoff server", &handoff_server_thread, &hs, HIGH_PRIORITY,
+                                DEFAULT_STACK_SIZE);
+    thread_resume(t);
+
+    for (uint i = 0; i < 100; i++)
+        handoff_call(&hs, t);
+
+    hs.done = true;
+    handoff_call(&hs, t);
+    thread_join(t, NULL, ZX_TIME_INFINITE);
+
+    wait_queue_destroy(&hs.request);
+    wait_queue_destroy(&hs.reply);
+
+    printf("done with handoff tests\n");
+}
+
+struct handoff_race_state {
+    wait_queue_t request;
+    wait_queue_t reply;
+    cpu_num_t waiter_cpu;
+    volatile int woken;
+    volatile int timed_out;
+    volatile bool done;
+};
+
+// wait for a request with a short deadline, so that the timeout is always
+// racing the waker to take us off the wait queue
+static int handoff_race_waiter_thread(void* arg) {
+    handoff_race_state* hs = (handoff_race_state*)arg;
+    spin_lock_saved_state_t state, wstate;
+
+    while (!hs->done) {
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+        wait_queue_lock(&hs->request, &wstate);
+        zx_time_t deadline = current_time() + ZX_USEC(10 + rand() % 200);
+        zx_status_t status = wait_queue_block(&hs->request, deadline);
+        if (status == ZX_OK) {
+            atomic_add(&hs->woken, 1);
+            hs->waiter_cpu = arch_curr_cpu_num();
+
+            wait_queue_lock(&hs->reply, &wstate);
+            ASSERT(wait_queue_wake_one(&hs->reply, false, ZX_OK) == 1);
+            wait_queue_unlock(&hs->reply, wstate);
+        } else {
+            ASSERT(status == ZX_ERR_TIMED_OUT);
+            atomic_add(&hs->timed_out, 1);
+        }
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    }
+
+    return 0;
+}
+
+// hand off to one of several waiters that are timing out under us. every
+// handoff that reports a wakeup has to land on exactly one waiter, which must
+// see ZX_OK and run on our cpu, and the rest must see their timeouts.
+static void handoff_race_test(void) {
+    printf("starting handoff race tests\n");
+
+    handoff_race_state hs = {};
+    wait_queue_init(&hs.request);
+    wait_queue_init(&hs.reply);
+
+    thread_t* ct = get_current_thread();
+    thread_t* threads[4];
+    for (auto& t : threads) {
+        t = thread_create("handoff waiter", &handoff_race_waiter_thread, &hs, DEFAULT_PRIORITY,
+                          DEFAULT_STACK_SIZE);
+        thread_resume(t);
+    }
+
+    int wakes = 0;
+    for (uint i = 0; i < 2000; i++) {
+        spin_lock_saved_state_t state, wstate;
+
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+        wait_queue_lock(&hs.request, &wstate);
+
+        cpu_num_t cpu = arch_curr_cpu_num();
+        thread_set_wake_handoff(true);
+        int woken = wait_queue_wake_one_handoff(&hs.request, ZX_OK);
+        ASSERT(woken == 0 || woken == 1);
+        // the hint is used up by the first thread actually released
+        ASSERT(ct->wake_handoff == (woken == 0));
+        thread_set_wake_handoff(false);
+        wait_queue_unlock(&hs.request, wstate);
+
+        // interrupts stay disabled until we block, so the waiter can't answer
+        // before we're waiting for it
+        if (woken) {
+            wakes++;
+            wait_queue_lock(&hs.reply, &wstate);
+            wait_queue_block(&hs.reply, ZX_TIME_INFINITE);
+            ASSERT(hs.waiter_cpu == cpu);
+        }
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+        if (!woken)
+            thread_sleep_relative(ZX_USEC(50));
+    }
+
+    // the waiters all time out and notice we're done
+    hs.done = true;
+    for (auto& t : threads)
+        thread_join(t, NULL, ZX_TIME_INFINITE);
+
+    ASSERT(hs.woken == wakes);
+    printf("%d handoffs, %d timeouts\n", wakes, hs.timed_out);
+
+    wait_queue_destroy(&hs.request);
+    wait_queue_destroy(&hs.reply);
+
+    printf("done with handoff race tests\n");
+}
+
 int thread_tests(void) {
     kill_tests();
 
     mutex_test();
+    pi_mutex_test();
     event_test();
 
     spinlock_test();
@@ -711,6 +1346,13 @@ int thread_tests(void) {
 
     affinity_test();
 
+    wait_queue_stress_test();
+
+    steal_test();
+
+    handoff_test();
+    handoff_race_test();
+
     tls_tests();
 
     return 0;
@@ -15,6 +15,7 @@
 #include <kernel/event.h>
 #include <kernel/thread.h>
 #include <kernel/timer.h>
+#include <unittest.h>
 
 #include <zircon/types.h>
 
@@ -172,6 +173,71 @@ static void timer_test_coalescing_early(void) {
         TIMER_SLACK_EARLY, slack, deadline, expected_adj, countof(deadline));
 }
 
+struct timer_many_state {
+    int fired;
+    int early;
+};
+
+// A timer of timer_test_many(), with the earliest time it may fire: its
+// requested deadline less whatever early slack its mode allows.
+struct timer_many_entry {
+    timer_t timer;
+    zx_time_t earliest;
+    timer_many_state* state;
+};
+
+static enum handler_return timer_cb_many(struct timer* timer, zx_time_t now, void* arg) {
+    timer_many_entry* entry = (timer_many_entry*)arg;
+    if (now < entry->earliest)
+        atomic_add(&entry->state->early, 1);
+    atomic_add(&entry->state->fired, 1);
+    return INT_NO_RESCHEDULE;
+}
+
+// Sets a lot of timers with random deadlines and slack, cancels every other
+// one, and checks that exactly the rest fire, none of them before its
+// requested deadline allows.
+static bool timer_test_many(void* context) {
+    BEGIN_TEST;
+
+    const int count = 1000;
+    timer_many_state state = {};
+
+    timer_many_entry* entry = (timer_many_entry*)malloc(sizeof(timer_many_entry) * count);
+    REQUIRE_NONNULL(entry, "");
+    zx_time_t when = current_time() + ZX_MSEC(5);
+    for (int ix = 0; ix != count; ++ix) {
+        timer_init(&entry[ix].timer);
+        zx_time_t dl = when + ZX_USEC(rand() % 10000);
+        uint64_t slack = ZX_USEC(rand() % 100);
+        enum slack_mode mode = (enum slack_mode)(ix % 3);
+        entry[ix].earliest = (mode == TIMER_SLACK_LATE) ? dl : dl - slack;
+        entry[ix].state = &state;
+        timer_set(&entry[ix].timer, dl, mode, slack, timer_cb_many, &entry[ix]);
+    }
+
+    int canceled = 0;
+    for (int ix = 0; ix < count; ix += 2) {
+        if (timer_cancel(&entry[ix].timer))
+            canceled++;
+    }
+
+    while (atomic_load(&state.fired) != count - canceled) {
+        thread_sleep(current_time() + ZX_MSEC(5));
+    }
+    // Give any timer that should have been canceled a chance to fire.
+    thread_sleep(current_time() + ZX_MSEC(20));
+
+    EXPECT_EQ(count - canceled, atomic_load(&state.fired), "timers fired");
+    EXPECT_EQ(0, atomic_load(&state.early), "timers fired early");
+
+    for (int ix = 0; ix != count; ++ix)
+        timer_cancel(&entry[ix].timer);
+    free(entry);
+
+    END_TEST;
+}
+
 static void timer_far_deadline(void) {
     event_t event;
     timer_t timer;
@@ -197,3 +263,7 @@ void timer_tests(void) {
     timer_test_all_cpus();
     timer_far_deadline();
 }
+
+UNITTEST_START_TESTCASE(timer)
+UNITTEST("many timers", timer_test_many)
+UNITTEST_END_TESTCASE(timer, "timer", "Tests of the timer queues", nullptr, nullptr);
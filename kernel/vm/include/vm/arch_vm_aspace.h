@@ -48,6 +48,11 @@ public:
 
     virtual zx_status_t Query(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags) = 0;
 
+    // Returns true if any of the |count| pages starting at |vaddr| is mapped.
+    // Unmapped stretches are skipped a page table entry at a time, so this is
+    // much cheaper than querying each page of a large range.
+    virtual bool HasMappings(vaddr_t vaddr, size_t count) = 0;
+
     virtual vaddr_t PickSpot(vaddr_t base, uint prev_region_mmu_flags,
                              vaddr_t end, uint next_region_mmu_flags,
                              vaddr_t align, size_t size, uint mmu_flags) = 0;
@@ -56,6 +56,7 @@ enum vm_page_state {
     VM_PAGE_STATE_HEAP,
     VM_PAGE_STATE_OBJECT,
     VM_PAGE_STATE_MMU, /* allocated to serve arch-specific mmu purposes */
+    VM_PAGE_STATE_CACHED, /* held by the pmm ahead of allocation, counted as free */
 
     _VM_PAGE_STATE_COUNT
 };
@@ -0,0 +1,101 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <fbl/canary.h>
+#include <fbl/intrusive_double_list.h>
+#include <fbl/macros.h>
+#include <fbl/mutex.h>
+#include <fbl/ref_counted.h>
+#include <fbl/ref_ptr.h>
+#include <kernel/event.h>
+#include <stdint.h>
+#include <zircon/thread_annotations.h>
+#include <zircon/types.h>
+
+class PageSource;
+
+// An outstanding request for the contents of one page of a VmObject that
+// gets its pages from a PageSource. Every thread that needs the page holds
+// a reference and waits on it with its VMO lock dropped; once the request
+// completes, the waiters retry the lookup.
+class PageRequest final : public fbl::RefCounted<PageRequest>,
+                          public fbl::DoublyLinkedListable<fbl::RefPtr<PageRequest>> {
+public:
+    // Blocks until the source has supplied the page or failed the request.
+    // Returns ZX_OK if the caller should retry the lookup.
+    zx_status_t Wait();
+
+private:
+    friend class PageSource;
+
+    explicit PageRequest(uint64_t offset)
+        : offset_(offset) {}
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PageRequest);
+
+    const uint64_t offset_;
+    Event event_;
+};
+
+// The provider of the pages of a VmObjectPaged created with
+// VmObjectPaged::CreateWithSource(). When a lookup finds a page missing, the
+// object asks its source for it instead of filling the page with zeros; the
+// source passes each distinct request on to its provider through
+// SendRequestLocked() and wakes the waiters when the pages show up.
+//
+// Lock ordering: the VMO lock may be held when calling into the source, so
+// the source must never call back into the VMO.
+class PageSource : public fbl::RefCounted<PageSource> {
+public:
+    // Returns in |request| the outstanding request for the page at |offset|,
+    // sending a new one to the provider if there is none yet.
+    zx_status_t GetPage(uint64_t offset, fbl::RefPtr<PageRequest>* request);
+
+    // Wakes everyone waiting on pages in [offset, offset + len). Called once
+    // the pages have been added to the VMO, or when they no longer exist.
+    void OnPagesAvailable(uint64_t offset, uint64_t len);
+
+    // Fails every outstanding and future request. Called when the provider
+    // goes away.
+    void Close();
+
+    // Called by the VMO when it is destroyed. Closes the source.
+    void Detach();
+
+    // Identifies the provider, so that it can tell its own VMOs apart from
+    // others'. Never dereferenced.
+    const void* owner() const { return owner_; }
+
+protected:
+    explicit PageSource(const void* owner)
+        : owner_(owner) {}
+    virtual ~PageSource();
+    friend fbl::RefPtr<PageSource>;
+
+    // Lets the provider forget about the source once its VMO is gone.
+    virtual void OnDetach() {}
+
+    // Asks the provider for the page at |offset|. Called with the source lock
+    // held, at most once per outstanding request.
+    virtual zx_status_t SendRequestLocked(uint64_t offset, uint64_t len) TA_REQ(lock_) = 0;
+
+    fbl::Canary<fbl::magic("PGSR")> canary_;
+    fbl::Mutex lock_;
+
+private:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PageSource);
+
+    // Fails every request in |requests| with |status|.
+    static void CompleteRequests(fbl::DoublyLinkedList<fbl::RefPtr<PageRequest>>* requests,
+                                 zx_status_t status);
+
+    const void* const owner_;
+
+    fbl::DoublyLinkedList<fbl::RefPtr<PageRequest>> pending_ TA_GUARDED(lock_);
+    bool closed_ TA_GUARDED(lock_) = false;
+};
@@ -31,6 +31,7 @@ zx_status_t pmm_add_arena(const pmm_arena_info_t* arena) __NONNULL((1));
 // flags for allocation routines below
 #define PMM_ALLOC_FLAG_ANY (0x0)  // no restrictions on which arena to allocate from
 #define PMM_ALLOC_FLAG_KMAP (0x1) // allocate only from arenas marked KMAP
+#define PMM_ALLOC_FLAG_ZEROED (0x2) // return pages filled with zeros
 
 // Allocate count pages of physical memory, adding to the tail of the passed list.
 // The list must be initialized.
@@ -115,7 +115,10 @@ public:
 
     // Page fault in an address within the region.  Recursively traverses
     // the regions to find the target mapping, if it exists.
-    virtual zx_status_t PageFault(vaddr_t va, uint pf_flags) = 0;
+    // Returns ZX_ERR_SHOULD_WAIT and a request in |page_request| if the page
+    // has to come from a PageSource; see VmObject::GetPageLocked().
+    virtual zx_status_t PageFault(vaddr_t va, uint pf_flags,
+                                  fbl::RefPtr<PageRequest>* page_request) = 0;
 
     // WAVL tree key function
     vaddr_t GetKey() const { return base(); }
@@ -235,7 +238,8 @@ public:
     bool is_mapping() const override { return false; }
 
     void Dump(uint depth, bool verbose) const override;
-    zx_status_t PageFault(vaddr_t va, uint pf_flags) override;
+    zx_status_t PageFault(vaddr_t va, uint pf_flags,
+                          fbl::RefPtr<PageRequest>* page_request) override;
 
 protected:
     // constructor for use in creating a VmAddressRegionDummy
@@ -368,7 +372,8 @@ public:
         return;
     }
 
-    zx_status_t PageFault(vaddr_t va, uint pf_flags) override {
+    zx_status_t PageFault(vaddr_t va, uint pf_flags,
+                          fbl::RefPtr<PageRequest>* page_request) override {
         // We should never be trying to page fault on this...
         ASSERT(false);
         return ZX_ERR_BAD_STATE;
@@ -417,6 +422,12 @@ public:
     // Map in pages from the underlying vm object, optionally committing pages as it goes
     zx_status_t MapRange(size_t offset, size_t len, bool commit);
 
+    // On a page fault, also map pages of the object within the naturally aligned window
+    // of 2^|window_shift| pages around the fault that are already resident.  If |commit|
+    // is set and the object is anonymous memory, write faults allocate the missing pages
+    // of the window as well.  A |window_shift| of 0 disables fault-around.
+    void SetFaultAround(uint8_t window_shift, bool commit);
+
     // Unmap a subset of the region of memory in the containing address space,
     // returning it to the parent region to allocate.  If all of the memory is unmapped,
     // Destroy()s this mapping.  If a subrange of the mapping is specified, the
@@ -432,7 +443,8 @@ public:
     bool is_mapping() const override { return true; }
 
     void Dump(uint depth, bool verbose) const override;
-    zx_status_t PageFault(vaddr_t va, uint pf_flags) override;
+    zx_status_t PageFault(vaddr_t va, uint pf_flags,
+                          fbl::RefPtr<PageRequest>* page_request) override;
 
 protected:
     ~VmMapping() override;
@@ -470,6 +482,21 @@ private:
     // Version of AllocatedPages() that does not acquire the aspace lock
     size_t AllocatedPagesLocked() const override;
 
+    // Try to satisfy a fault at |va| by mapping the whole large page around it, if the
+    // object already has that range resident and physically contiguous.  Must be called
+    // with the object lock held.
+    zx_status_t MapLargePageLocked(vaddr_t va);
+
+    // Map the pages around the fault at |va| per the fault-around window, once the
+    // faulting page itself has been handled.  Must be called with the object lock held.
+    void FaultAroundLocked(vaddr_t va, uint pf_flags);
+
+    // Carry the fault-around settings over to a mapping split off from this one.
+    void CopyFaultAroundTo(VmMapping* mapping) const {
+        mapping->fault_around_shift_ = fault_around_shift_;
+        mapping->fault_around_commit_ = fault_around_commit_;
+    }
+
     void Activate() override;
 
     // Version of Activate that does not take the object_ lock.
@@ -486,4 +513,9 @@ private:
 
     // used to detect recursions through the vmo fault path
     bool currently_faulting_ = false;
+
+    // log2 of the fault-around window in pages, or 0 if fault-around is off
+    uint8_t fault_around_shift_ = 0;
+    // allocate missing pages of the window on write faults
+    bool fault_around_commit_ = false;
 };
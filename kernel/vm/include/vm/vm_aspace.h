@@ -116,6 +116,13 @@ public:
     // VMAR in the tree that includes *va*.
     fbl::RefPtr<VmAddressRegionOrMapping> FindRegion(vaddr_t va);
 
+    // Returns the VMO mapped at [va, va + len), and the offset of |va| within
+    // it, if a single mapping with at least |arch_mmu_flags| covers the whole
+    // range.  The mapping is found and read under the aspace lock, so it can't
+    // be unmapped or protected part way through.
+    fbl::RefPtr<VmObject> FindMappedVmo(vaddr_t va, size_t len, uint arch_mmu_flags,
+                                        uint64_t* offset);
+
     // For region creation routines
     static const uint VMM_FLAG_VALLOC_SPECIFIC = (1u << 0); // allocate at specific address
     static const uint VMM_FLAG_COMMIT = (1u << 1);          // commit memory up front (no demand paging)
@@ -188,7 +195,9 @@ private:
     bool aspace_destroyed_ = false;
     bool aslr_enabled_ = false;
 
-    mutable mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
+    // Held across page faults, so a real time thread faulting can end up waiting on
+    // whatever lower priority thread is mapping or unmapping in the same aspace.
+    mutable mutex_t lock_ = MUTEX_INITIAL_VALUE_ETC(lock_, MUTEX_OPTION_PRIORITY_INHERIT);
 
     // root of virtual address space
     // Access to this reference is guarded by lock_.
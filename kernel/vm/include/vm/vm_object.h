@@ -19,6 +19,7 @@
 #include <list.h>
 #include <stdint.h>
 #include <vm/page.h>
+#include <vm/page_source.h>
 #include <vm/vm.h>
 #include <vm/vm_page_list.h>
 #include <zircon/thread_annotations.h>
@@ -84,6 +85,33 @@ public:
         panic("Unpin should only be called on a pinned range");
     }
 
+    // Unlinks the committed pages backing [offset, offset + len) and appends
+    // them to |pages|, leaving the range decommitted. Fails with
+    // ZX_ERR_BAD_STATE, without touching the object, if the range is not
+    // page aligned, not fully committed, pinned, or shared with a clone.
+    virtual zx_status_t TakePages(uint64_t offset, uint64_t len, list_node* pages) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
+    // Installs the pages on |pages| as the backing of [offset, offset + len),
+    // freeing whatever was committed there before. On success |pages| is
+    // left empty.
+    virtual zx_status_t SupplyPages(uint64_t offset, uint64_t len, list_node* pages) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
+    // Installs the pages on |pages| into the holes of [offset, offset + len),
+    // taking one page off the front of |pages| for every page offset in the
+    // range. Pages for offsets that were already present are left on |pages|
+    // for the caller to free. Used to answer requests from a PageSource.
+    virtual zx_status_t SupplyMissingPages(uint64_t offset, uint64_t len, list_node* pages) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
+    // The source this object asks for missing pages, or null if missing pages
+    // are zero filled.
+    virtual PageSource* page_source() const { return nullptr; }
+
     // read/write operators against kernel pointers only
     virtual zx_status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) {
         return ZX_ERR_NOT_SUPPORTED;
@@ -170,11 +198,24 @@ public:
 
     // get a pointer to the page structure and/or physical address at the specified offset.
     // valid flags are VMM_PF_FLAG_*
+    //
+    // if the page has to come from a PageSource, ZX_ERR_SHOULD_WAIT is returned. callers
+    // that are faulting pass |page_request| to have the source asked for the page; they
+    // must then drop the lock, wait on the request and retry.
     virtual zx_status_t GetPageLocked(uint64_t offset, uint pf_flags, list_node* free_list,
+                                      fbl::RefPtr<PageRequest>* page_request,
                                       vm_page_t** page, paddr_t* pa) TA_REQ(lock_) {
         return ZX_ERR_NOT_SUPPORTED;
     }
 
+    // if every page of [offset, offset + len) is already present in this object and the
+    // pages are physically contiguous, return the physical address of the first one in |pa|.
+    // does not fault anything in or consult any parent.
+    virtual zx_status_t GetContiguousRunLocked(uint64_t offset, uint64_t len,
+                                               paddr_t* pa) TA_REQ(lock_) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
     fbl::Mutex* lock() TA_RET_CAP(lock_) { return &lock_; }
     fbl::Mutex& lock_ref() TA_RET_CAP(lock_) { return lock_; }
 
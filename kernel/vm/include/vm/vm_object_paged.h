@@ -31,6 +31,12 @@ public:
 
     static zx_status_t CreateFromROData(const void* data, size_t size, fbl::RefPtr<VmObject>* vmo);
 
+    // Creates an object whose missing pages are requested from |source|
+    // rather than zero filled.
+    static zx_status_t CreateWithSource(uint32_t pmm_alloc_flags, uint64_t size,
+                                        fbl::RefPtr<PageSource> source,
+                                        fbl::RefPtr<VmObject>* vmo);
+
     zx_status_t Resize(uint64_t size) override;
     zx_status_t ResizeLocked(uint64_t size) override TA_REQ(lock_);
     uint64_t size() const override
@@ -49,6 +55,11 @@ public:
     zx_status_t Pin(uint64_t offset, uint64_t len) override;
     void Unpin(uint64_t offset, uint64_t len) override;
 
+    zx_status_t TakePages(uint64_t offset, uint64_t len, list_node* pages) override;
+    zx_status_t SupplyPages(uint64_t offset, uint64_t len, list_node* pages) override;
+    zx_status_t SupplyMissingPages(uint64_t offset, uint64_t len, list_node* pages) override;
+    PageSource* page_source() const override { return page_source_.get(); }
+
     zx_status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) override;
     zx_status_t Write(const void* ptr, uint64_t offset, size_t len, size_t* bytes_written) override;
     zx_status_t Lookup(uint64_t offset, uint64_t len, uint pf_flags,
@@ -70,10 +81,14 @@ public:
     zx_status_t SyncCache(const uint64_t offset, const uint64_t len) override;
 
     zx_status_t GetPageLocked(uint64_t offset, uint pf_flags, list_node* free_list,
+                              fbl::RefPtr<PageRequest>* page_request,
                               vm_page_t**, paddr_t*) override
         // Calls a Locked method of the parent, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS;
 
+    zx_status_t GetContiguousRunLocked(uint64_t offset, uint64_t len,
+                                       paddr_t* pa) override TA_REQ(lock_);
+
     zx_status_t CloneCOW(uint64_t offset, uint64_t size, bool copy_name,
                          fbl::RefPtr<VmObject>* clone_vmo) override
         // Calls a Locked method of the child, which confuses analysis.
@@ -85,7 +100,8 @@ public:
 
 private:
     // private constructor (use Create())
-    explicit VmObjectPaged(uint32_t pmm_alloc_flags, fbl::RefPtr<VmObject> parent);
+    VmObjectPaged(uint32_t pmm_alloc_flags, fbl::RefPtr<VmObject> parent,
+                  fbl::RefPtr<PageSource> page_source);
 
     // private destructor, only called from refptr
     ~VmObjectPaged() override;
@@ -131,4 +147,7 @@ private:
 
     // a tree of pages
     VmPageList page_list_ TA_GUARDED(lock_);
+
+    // where missing pages come from, if not zero filled
+    const fbl::RefPtr<PageSource> page_source_;
 };
@@ -189,6 +189,8 @@ public:
 
     zx_status_t AddPage(vm_page*, uint64_t offset);
     vm_page* GetPage(uint64_t offset);
+    // Unlinks the page at |offset| and returns it, or nullptr if there is none.
+    vm_page* RemovePage(uint64_t offset);
     zx_status_t FreePage(uint64_t offset);
     size_t FreeAllPages();
 
@@ -0,0 +1,108 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <vm/page_source.h>
+
+#include <fbl/alloc_checker.h>
+#include <fbl/auto_lock.h>
+#include <inttypes.h>
+#include <kernel/thread.h>
+#include <trace.h>
+#include <vm/vm.h>
+
+#define LOCAL_TRACE 0
+
+zx_status_t PageRequest::Wait() {
+    return event_.Wait(ZX_TIME_INFINITE);
+}
+
+PageSource::~PageSource() {
+    canary_.Assert();
+    DEBUG_ASSERT(pending_.is_empty());
+}
+
+zx_status_t PageSource::GetPage(uint64_t offset, fbl::RefPtr<PageRequest>* request) {
+    canary_.Assert();
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset));
+
+    fbl::AutoLock guard(&lock_);
+
+    if (closed_)
+        return ZX_ERR_BAD_STATE;
+
+    // Several threads faulting on the same page share one request, so the
+    // provider only hears about each missing page once.
+    for (auto& pending : pending_) {
+        if (pending.offset_ == offset) {
+            *request = fbl::WrapRefPtr(&pending);
+            return ZX_OK;
+        }
+    }
+
+    fbl::AllocChecker ac;
+    auto new_request = fbl::AdoptRef(new (&ac) PageRequest(offset));
+    if (!ac.check())
+        return ZX_ERR_NO_MEMORY;
+
+    LTRACEF("source %p, offset %#" PRIx64 "\n", this, offset);
+
+    zx_status_t status = SendRequestLocked(offset, PAGE_SIZE);
+    if (status != ZX_OK)
+        return status;
+
+    pending_.push_back(new_request);
+    *request = fbl::move(new_request);
+    return ZX_OK;
+}
+
+void PageSource::OnPagesAvailable(uint64_t offset, uint64_t len) {
+    canary_.Assert();
+
+    fbl::DoublyLinkedList<fbl::RefPtr<PageRequest>> completed;
+    {
+        fbl::AutoLock guard(&lock_);
+        for (auto iter = pending_.begin(); iter != pending_.end();) {
+            auto cur = iter++;
+            if (cur->offset_ >= offset && cur->offset_ - offset < len)
+                completed.push_back(pending_.erase(cur));
+        }
+    }
+
+    CompleteRequests(&completed, ZX_OK);
+}
+
+void PageSource::Close() {
+    canary_.Assert();
+
+    fbl::DoublyLinkedList<fbl::RefPtr<PageRequest>> completed;
+    {
+        fbl::AutoLock guard(&lock_);
+        closed_ = true;
+        completed.swap(pending_);
+    }
+
+    CompleteRequests(&completed, ZX_ERR_BAD_STATE);
+}
+
+void PageSource::Detach() {
+    canary_.Assert();
+
+    // Requests whose waiters have given up can still be outstanding.
+    Close();
+    OnDetach();
+}
+
+void PageSource::CompleteRequests(fbl::DoublyLinkedList<fbl::RefPtr<PageRequest>>* requests,
+                                  zx_status_t status) {
+    int wake_count = 0;
+    while (!requests->is_empty()) {
+        fbl::RefPtr<PageRequest> request = requests->pop_front();
+        wake_count += request->event_.Signal(status);
+    }
+
+    if (wake_count)
+        thread_reschedule();
+}
@@ -9,8 +9,13 @@
 
 #include <assert.h>
 #include <err.h>
+#include <arch/ops.h>
 #include <inttypes.h>
+#include <kernel/auto_lock.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <lib/console.h>
 #include <lk/init.h>
@@ -42,6 +47,55 @@ static fbl::Mutex arena_lock;
 static fbl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+// Pool of pages zeroed ahead of time by a background thread, used to satisfy
+// PMM_ALLOC_FLAG_ZEROED allocations without zeroing on the caller's time.  Pages
+// in the pool are allocated from a KMAP arena so they can be zeroed through the
+// physmap, and sit in the CACHED state so that they are still counted as free.
+static fbl::Mutex zeroed_lock;
+static list_node zeroed_list TA_GUARDED(zeroed_lock) = LIST_INITIAL_VALUE(zeroed_list);
+
+// Only changed under zeroed_lock, but read without it by pmm_count_zeroed_pages(),
+// so it is always updated atomically.
+static size_t zeroed_count TA_GUARDED(zeroed_lock);
+
+// Signaled when the pool drops below its low water mark.
+static event_t zeroed_event = EVENT_INITIAL_VALUE(zeroed_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+// The zeroing thread fills the pool back up to kZeroedPoolTarget pages once it drops
+// below kZeroedPoolLowWater, as long as more than kZeroedPoolReserve pages remain free
+// in the arenas.
+static const size_t kZeroedPoolTarget = 1024;
+static const size_t kZeroedPoolLowWater = kZeroedPoolTarget / 2;
+static const size_t kZeroedPoolReserve = 4 * kZeroedPoolTarget;
+
+// Per-cpu magazines of pages sitting in front of the arenas, so that single page
+// allocations and frees don't all serialize on arena_lock.  Cached pages are out of
+// the arenas but in the CACHED state, so they are still counted as free, and are
+// refilled from and drained back to the arenas kPcpuCacheBatch pages at a time.
+// Only allocations that can be satisfied from any arena are served from the caches.
+static const size_t kPcpuCacheSize = 64;
+static const size_t kPcpuCacheBatch = kPcpuCacheSize / 2;
+
+struct pmm_pcpu_cache {
+    spin_lock_t lock;
+    // Only changed under |lock|, but read without it by pcpu_cache_count_pages(),
+    // so it is always stored atomically.  See pcpu_cache_set_count().
+    size_t count;
+    vm_page_t* pages[kPcpuCacheSize];
+
+    // statistics
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refills;
+    uint64_t drains;
+} __CPU_ALIGN;
+
+static pmm_pcpu_cache pcpu_cache[SMP_MAX_CPUS];
+
+static void pcpu_cache_set_count(pmm_pcpu_cache* cache, size_t count) {
+    __atomic_store_n(&cache->count, count, __ATOMIC_RELAXED);
+}
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -112,7 +166,96 @@ done_add:
     return ZX_OK;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+static void pmm_zero_page(paddr_t pa) {
+    void* ptr = paddr_to_physmap(pa);
+    DEBUG_ASSERT(ptr);
+
+    arch_zero_page(ptr);
+}
+
+static size_t pmm_alloc_arena_pages(size_t count, uint alloc_flags, struct list_node* list);
+static size_t pmm_free_arena_pages(struct list_node* list);
+
+// Take up to |count| pages out of the zeroed pool, adding them to the tail of |list|.
+static size_t zeroed_pool_take(size_t count, list_node* list) {
+    size_t taken = 0;
+    bool low;
+    {
+        AutoLock al(&zeroed_lock);
+        while (taken < count) {
+            vm_page_t* page = list_remove_head_type(&zeroed_list, vm_page_t, free.node);
+            if (!page)
+                break;
+            DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+            page->state = VM_PAGE_STATE_ALLOC;
+            list_add_tail(list, &page->free.node);
+            taken++;
+        }
+        low = __atomic_sub_fetch(&zeroed_count, taken, __ATOMIC_RELAXED) < kZeroedPoolLowWater;
+    }
+
+    if (low)
+        event_signal(&zeroed_event, false);
+
+    return taken;
+}
+
+// Pull every page of the |count| starting at |address| out of the zeroed pool and
+// give them back to their arenas.
+static void zeroed_pool_release_range(paddr_t address, size_t count) {
+    list_node list = LIST_INITIAL_VALUE(list);
+    {
+        AutoLock al(&zeroed_lock);
+        size_t released = 0;
+        vm_page_t* page;
+        vm_page_t* temp;
+        list_for_every_entry_safe (&zeroed_list, page, temp, vm_page_t, free.node) {
+            paddr_t pa = vm_page_to_paddr(page);
+            if (pa < address || (pa - address) / PAGE_SIZE >= count)
+                continue;
+            DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+            list_delete(&page->free.node);
+            page->state = VM_PAGE_STATE_ALLOC;
+            list_add_tail(&list, &page->free.node);
+            released++;
+        }
+        __atomic_sub_fetch(&zeroed_count, released, __ATOMIC_RELAXED);
+    }
+
+    pmm_free_arena_pages(&list);
+}
+
+// Give every page in the zeroed pool back to the arenas.  The pool is filled with
+// whatever single pages the arenas hand out, so it can be holding pieces of the runs
+// that contiguous allocations need.
+static void zeroed_pool_drain() {
+    list_node list = LIST_INITIAL_VALUE(list);
+    {
+        AutoLock al(&zeroed_lock);
+        vm_page_t* page;
+        while ((page = list_remove_head_type(&zeroed_list, vm_page_t, free.node))) {
+            DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+            page->state = VM_PAGE_STATE_ALLOC;
+            list_add_tail(&list, &page->free.node);
+        }
+        __atomic_store_n(&zeroed_count, 0, __ATOMIC_RELAXED);
+    }
+
+    pmm_free_arena_pages(&list);
+}
+
+static vm_page_t* zeroed_pool_take_page(paddr_t* pa) {
+    list_node list = LIST_INITIAL_VALUE(list);
+    if (zeroed_pool_take(1, &list) == 0)
+        return nullptr;
+
+    vm_page_t* page = list_remove_head_type(&list, vm_page_t, free.node);
+    if (pa)
+        *pa = vm_page_to_paddr(page);
+    return page;
+}
+
+static vm_page_t* pmm_alloc_arena_page(uint alloc_flags, paddr_t* pa) {
     AutoLock al(&arena_lock);
 
     /* walk the arenas in order until we find one with a free page */
@@ -129,19 +272,221 @@ vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
             return page;
     }
 
-    LTRACEF("failed to allocate page\n");
     return nullptr;
 }
 
-size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
-    LTRACEF("count %zu\n", count);
+// Move a page into a per-cpu cache.  It gets the free fill just as if it had gone
+// back to its arena, so that writes after free are caught the same way.
+static void pcpu_cache_put_page(vm_page_t* page) {
+    DEBUG_ASSERT_MSG(page->state != VM_PAGE_STATE_CACHED && !page_is_free(page),
+                     "page %p state %u\n", page, page->state);
+    DEBUG_ASSERT(page->state != VM_PAGE_STATE_OBJECT || page->object.pin_count == 0);
 
-    /* list must be initialized prior to calling this */
-    DEBUG_ASSERT(list);
+#if PMM_ENABLE_FREE_FILL
+    memset(paddr_to_physmap(vm_page_to_paddr(page)), PMM_FREE_FILL_BYTE, PAGE_SIZE);
+#endif
 
-    if (count == 0)
-        return 0;
+    page->state = VM_PAGE_STATE_CACHED;
+}
+
+// Take a page back out of a per-cpu cache, either to hand it out or to drain it.
+static void pcpu_cache_get_page(vm_page_t* page) {
+    DEBUG_ASSERT_MSG(page->state == VM_PAGE_STATE_CACHED, "page %p state %u\n", page,
+                     page->state);
 
+#if PMM_ENABLE_FREE_FILL
+    auto kvaddr = static_cast<const uint8_t*>(paddr_to_physmap(vm_page_to_paddr(page)));
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        ASSERT(kvaddr[i] == PMM_FREE_FILL_BYTE);
+    }
+#endif
+
+    page->state = VM_PAGE_STATE_ALLOC;
+}
+
+// Move up to |count| pages out of the current cpu's cache onto the tail of |list|.
+static size_t pcpu_cache_take(size_t count, list_node* list) {
+    pmm_pcpu_cache* cache = &pcpu_cache[arch_curr_cpu_num()];
+
+    list_node taken_list = LIST_INITIAL_VALUE(taken_list);
+    size_t taken = 0;
+    {
+        AutoSpinLockIrqSave guard(&cache->lock);
+        size_t n = cache->count;
+        while (taken < count && n > 0) {
+            vm_page_t* page = cache->pages[--n];
+            list_add_tail(&taken_list, &page->free.node);
+            taken++;
+        }
+        pcpu_cache_set_count(cache, n);
+        if (taken > 0) {
+            cache->hits++;
+        } else {
+            cache->misses++;
+        }
+    }
+
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&taken_list, vm_page_t, free.node))) {
+        pcpu_cache_get_page(page);
+        list_add_tail(list, &page->free.node);
+    }
+
+    return taken;
+}
+
+// Allocate a single page through the current cpu's cache, refilling it from the
+// arenas in a batch when it runs dry.
+static vm_page_t* pcpu_cache_alloc_page(paddr_t* pa) {
+    list_node list = LIST_INITIAL_VALUE(list);
+    if (pcpu_cache_take(1, &list) == 0) {
+        size_t allocated = pmm_alloc_arena_pages(kPcpuCacheBatch + 1, 0, &list);
+        if (allocated == 0)
+            return nullptr;
+
+        // keep one for ourselves and stash the rest.  we may have moved cpus while
+        // talking to the arenas, which only costs some locality.
+        vm_page_t* page = list_remove_tail_type(&list, vm_page_t, free.node);
+        vm_page_t* p;
+        list_for_every_entry (&list, p, vm_page_t, free.node) {
+            pcpu_cache_put_page(p);
+        }
+
+        pmm_pcpu_cache* cache = &pcpu_cache[arch_curr_cpu_num()];
+        {
+            AutoSpinLockIrqSave guard(&cache->lock);
+            size_t n = cache->count;
+            while (n < kPcpuCacheSize) {
+                p = list_remove_head_type(&list, vm_page_t, free.node);
+                if (!p)
+                    break;
+                cache->pages[n++] = p;
+            }
+            pcpu_cache_set_count(cache, n);
+            cache->refills++;
+        }
+
+        // the cache filled up underneath us, hand the leftovers back
+        if (!list_is_empty(&list)) {
+            list_for_every_entry (&list, p, vm_page_t, free.node) {
+                pcpu_cache_get_page(p);
+            }
+            pmm_free_arena_pages(&list);
+        }
+
+        list_add_tail(&list, &page->free.node);
+    }
+
+    vm_page_t* page = list_remove_head_type(&list, vm_page_t, free.node);
+    DEBUG_ASSERT(page->state == VM_PAGE_STATE_ALLOC);
+    if (pa)
+        *pa = vm_page_to_paddr(page);
+    return page;
+}
+
+// Free the pages on |list| into the current cpu's cache.  Whatever doesn't fit,
+// along with a batch of the cache's older pages if it overflows, is left on |list|
+// for the caller to return to the arenas.
+static void pcpu_cache_free(list_node* list) {
+    vm_page_t* page;
+    list_for_every_entry (list, page, vm_page_t, free.node) {
+        pcpu_cache_put_page(page);
+    }
+
+    pmm_pcpu_cache* cache = &pcpu_cache[arch_curr_cpu_num()];
+
+    list_node overflow = LIST_INITIAL_VALUE(overflow);
+    {
+        AutoSpinLockIrqSave guard(&cache->lock);
+        size_t n = cache->count;
+        while ((page = list_remove_head_type(list, vm_page_t, free.node))) {
+            if (n == kPcpuCacheSize) {
+                // drain the oldest half of the magazine
+                for (size_t i = 0; i < kPcpuCacheBatch; i++) {
+                    list_add_tail(&overflow, &cache->pages[i]->free.node);
+                }
+                memmove(&cache->pages[0], &cache->pages[kPcpuCacheBatch],
+                        (kPcpuCacheSize - kPcpuCacheBatch) * sizeof(cache->pages[0]));
+                n -= kPcpuCacheBatch;
+                cache->drains++;
+            }
+
+            cache->pages[n++] = page;
+        }
+        pcpu_cache_set_count(cache, n);
+    }
+
+    list_for_every_entry (&overflow, page, vm_page_t, free.node) {
+        pcpu_cache_get_page(page);
+    }
+    list_move(&overflow, list);
+}
+
+// Return every cpu's cached pages to the arenas, for when an allocation needs pages
+// that may be stranded in the caches.
+static void pcpu_cache_drain_all() {
+    list_node list = LIST_INITIAL_VALUE(list);
+    for (auto& cache : pcpu_cache) {
+        AutoSpinLockIrqSave guard(&cache.lock);
+        for (size_t n = cache.count; n > 0; n--) {
+            list_add_tail(&list, &cache.pages[n - 1]->free.node);
+        }
+        pcpu_cache_set_count(&cache, 0);
+        cache.drains++;
+    }
+
+    vm_page_t* page;
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        pcpu_cache_get_page(page);
+    }
+    pmm_free_arena_pages(&list);
+}
+
+static size_t pcpu_cache_count_pages() {
+    size_t count = 0;
+    for (auto& cache : pcpu_cache) {
+        // a racy read is fine for statistics
+        count += __atomic_load_n(&cache.count, __ATOMIC_RELAXED);
+    }
+    return count;
+}
+
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    if (alloc_flags & PMM_ALLOC_FLAG_ZEROED) {
+        vm_page_t* page = zeroed_pool_take_page(pa);
+        if (page)
+            return page;
+    }
+
+    paddr_t page_pa;
+    vm_page_t* page;
+    if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+        page = pmm_alloc_arena_page(alloc_flags, &page_pa);
+    } else {
+        page = pcpu_cache_alloc_page(&page_pa);
+    }
+    if (!page) {
+        // pages may be stranded in other cpus' caches
+        pcpu_cache_drain_all();
+        page = pmm_alloc_arena_page(alloc_flags, &page_pa);
+    }
+    if (!page) {
+        // the arenas are empty, but the zeroed pool may still have pages to give out
+        page = zeroed_pool_take_page(pa);
+        if (!page)
+            LTRACEF("failed to allocate page\n");
+        return page;
+    }
+
+    if (alloc_flags & PMM_ALLOC_FLAG_ZEROED)
+        pmm_zero_page(page_pa);
+
+    if (pa)
+        *pa = page_pa;
+    return page;
+}
+
+static size_t pmm_alloc_arena_pages(size_t count, uint alloc_flags, struct list_node* list) {
     AutoLock al(&arena_lock);
 
     /* walk the arenas in order, allocating as many pages as we can from each */
@@ -165,6 +510,59 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     return allocated;
 }
 
+// Allocate pages out of the current cpu's cache, then the arenas, then anything
+// stranded in other cpus' caches.
+static size_t pmm_alloc_cached_pages(size_t count, uint alloc_flags, struct list_node* list) {
+    size_t allocated = 0;
+    if (!(alloc_flags & PMM_ALLOC_FLAG_KMAP))
+        allocated = pcpu_cache_take(count, list);
+
+    if (allocated < count)
+        allocated += pmm_alloc_arena_pages(count - allocated, alloc_flags, list);
+
+    if (allocated < count) {
+        pcpu_cache_drain_all();
+        allocated += pmm_alloc_arena_pages(count - allocated, alloc_flags, list);
+    }
+
+    return allocated;
+}
+
+size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
+    LTRACEF("count %zu\n", count);
+
+    /* list must be initialized prior to calling this */
+    DEBUG_ASSERT(list);
+
+    if (count == 0)
+        return 0;
+
+    size_t allocated = 0;
+    if (alloc_flags & PMM_ALLOC_FLAG_ZEROED) {
+        allocated = zeroed_pool_take(count, list);
+        if (allocated == count)
+            return allocated;
+
+        // zero whatever else has to come from the arenas
+        list_node fresh = LIST_INITIAL_VALUE(fresh);
+        allocated += pmm_alloc_cached_pages(count - allocated, alloc_flags, &fresh);
+
+        vm_page_t* page;
+        while ((page = list_remove_head_type(&fresh, vm_page_t, free.node))) {
+            pmm_zero_page(vm_page_to_paddr(page));
+            list_add_tail(list, &page->free.node);
+        }
+    } else {
+        allocated = pmm_alloc_cached_pages(count, alloc_flags, list);
+    }
+
+    // the arenas are out of pages, so dip into the zeroed pool for the rest
+    if (allocated < count)
+        allocated += zeroed_pool_take(count - allocated, list);
+
+    return allocated;
+}
+
 size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
     LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
 
@@ -174,24 +572,36 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
 
     address = ROUNDDOWN(address, PAGE_SIZE);
 
-    AutoLock al(&arena_lock);
-
-    /* walk through the arenas, looking to see if the physical page belongs to it */
-    for (auto& a : arena_list) {
-        while (allocated < count && a.address_in_arena(address)) {
-            vm_page_t* page = a.AllocSpecific(address);
-            if (!page)
+    for (int pass = 0; pass < 2 && allocated < count; pass++) {
+        // the page we stopped at may be sitting in one of the per-cpu caches or in the
+        // zeroed pool, and so may any of the rest, so get them all back in one go
+        if (pass > 0) {
+            vm_page_t* page = paddr_to_vm_page(address);
+            if (!page || page->state != VM_PAGE_STATE_CACHED)
                 break;
+            pcpu_cache_drain_all();
+            zeroed_pool_release_range(address, count - allocated);
+        }
 
-            if (list)
-                list_add_tail(list, &page->free.node);
+        AutoLock al(&arena_lock);
 
-            allocated++;
-            address += PAGE_SIZE;
-        }
+        /* walk through the arenas, looking to see if the physical page belongs to it */
+        for (auto& a : arena_list) {
+            while (allocated < count && a.address_in_arena(address)) {
+                vm_page_t* page = a.AllocSpecific(address);
+                if (!page)
+                    break;
 
-        if (allocated == count)
-            break;
+                if (list)
+                    list_add_tail(list, &page->free.node);
+
+                allocated++;
+                address += PAGE_SIZE;
+            }
+
+            if (allocated == count)
+                break;
+        }
     }
 
     return allocated;
@@ -206,24 +616,47 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
     if (alignment_log2 < PAGE_SIZE_SHIFT)
         alignment_log2 = PAGE_SIZE_SHIFT;
 
-    AutoLock al(&arena_lock);
+    paddr_t run_pa = 0;
+    size_t allocated = 0;
+    for (int pass = 0; pass < 2 && allocated == 0; pass++) {
+        // pages held in the per-cpu caches or the zeroed pool may be breaking up the
+        // run we need
+        if (pass > 0) {
+            pcpu_cache_drain_all();
+            zeroed_pool_drain();
+        }
 
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
+        AutoLock al(&arena_lock);
+
+        for (auto& a : arena_list) {
+            /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+            if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+            }
+
+            allocated = a.AllocContiguous(count, alignment_log2, &run_pa, list);
+            if (allocated > 0) {
+                DEBUG_ASSERT(allocated == count);
+                break;
+            }
         }
+    }
 
-        size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
-        if (allocated > 0) {
-            DEBUG_ASSERT(allocated == count);
-            return allocated;
+    if (allocated == 0) {
+        LTRACEF("couldn't find run\n");
+        return 0;
+    }
+
+    if (alloc_flags & PMM_ALLOC_FLAG_ZEROED) {
+        for (size_t i = 0; i < count; i++) {
+            pmm_zero_page(run_pa + i * PAGE_SIZE);
         }
     }
 
-    LTRACEF("couldn't find run\n");
-    return 0;
+    if (pa)
+        *pa = run_pa;
+    return allocated;
 }
 
 /* physically allocate a run from arenas marked as KMAP */
@@ -300,6 +733,29 @@ size_t pmm_free(struct list_node* list) {
 
     DEBUG_ASSERT(list);
 
+    size_t count = 0;
+    vm_page_t* page;
+    list_for_every_entry (list, page, vm_page_t, free.node) {
+        DEBUG_ASSERT_MSG(!page_is_free(page) && page->state != VM_PAGE_STATE_CACHED,
+                         "page %p state %u\n", page, page->state);
+        count++;
+    }
+
+    // small frees go through the cache, which hands back whatever it can't hold.
+    // bulk frees already amortize the arena lock, so they go straight to the arenas.
+    if (count <= kPcpuCacheBatch)
+        pcpu_cache_free(list);
+    pmm_free_arena_pages(list);
+
+    LTRACEF("returning count %zu\n", count);
+
+    return count;
+}
+
+static size_t pmm_free_arena_pages(struct list_node* list) {
+    if (list_is_empty(list))
+        return 0;
+
     AutoLock al(&arena_lock);
 
     uint count = 0;
@@ -317,8 +773,6 @@ size_t pmm_free(struct list_node* list) {
         }
     }
 
-    LTRACEF("returning count %u\n", count);
-
     return count;
 }
 
@@ -339,14 +793,38 @@ static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
     return free;
 }
 
+// Doesn't take zeroed_lock, since pmm_dump_free() calls this from the pmm_dump_timer
+// callback, in interrupt context.  A racy read is fine for statistics.
+static size_t pmm_count_zeroed_pages() TA_NO_THREAD_SAFETY_ANALYSIS {
+    return __atomic_load_n(&zeroed_count, __ATOMIC_RELAXED);
+}
+
 size_t pmm_count_free_pages() {
+    // pages waiting in the zeroed pool or the per-cpu caches are as good as free
+    size_t cached = pmm_count_zeroed_pages() + pcpu_cache_count_pages();
+
     AutoLock al(&arena_lock);
-    return pmm_count_free_pages_locked();
+    return pmm_count_free_pages_locked() + cached;
 }
 
+// Called from the pmm_dump_timer callback in interrupt context, so everything but
+// the arena counts is read without taking a lock.
 static void pmm_dump_free() TA_REQ(arena_lock) {
     auto megabytes_free = pmm_count_free_pages_locked() / 256u;
-    printf(" %zu free MBs\n", megabytes_free);
+    printf(" %zu free MBs, %zu pages zeroed, %zu pages in cpu caches\n", megabytes_free,
+           pmm_count_zeroed_pages(), pcpu_cache_count_pages());
+}
+
+static void pcpu_cache_dump() {
+    printf("cpu  cached     hits   misses  refills   drains\n");
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (!mp_is_cpu_active(i))
+            continue;
+
+        const pmm_pcpu_cache& cache = pcpu_cache[i];
+        printf("%3u %7zu %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n", i,
+               cache.count, cache.hits, cache.misses, cache.refills, cache.drains);
+    }
 }
 
 static size_t pmm_count_total_bytes_locked() TA_REQ(arena_lock) {
@@ -367,6 +845,56 @@ void pmm_count_total_states(size_t state_count[_VM_PAGE_STATE_COUNT]) {
     }
 }
 
+// Refill the zeroed pool up to its target, stopping early if memory gets tight.
+static void zeroed_pool_fill() {
+    for (;;) {
+        {
+            AutoLock al(&zeroed_lock);
+            if (zeroed_count >= kZeroedPoolTarget)
+                return;
+        }
+
+        {
+            AutoLock al(&arena_lock);
+            if (pmm_count_free_pages_locked() <= kZeroedPoolReserve)
+                return;
+        }
+
+        paddr_t pa;
+        vm_page_t* page = pmm_alloc_arena_page(PMM_ALLOC_FLAG_KMAP, &pa);
+        if (!page)
+            return;
+
+        // the page isn't going to be touched again until someone allocates it, so
+        // keep it from pushing anything useful out of the cache
+        void* ptr = paddr_to_physmap(pa);
+        DEBUG_ASSERT(ptr);
+        arch_zero_page_nontemporal(ptr);
+
+        AutoLock al(&zeroed_lock);
+        page->state = VM_PAGE_STATE_CACHED;
+        list_add_tail(&zeroed_list, &page->free.node);
+        __atomic_add_fetch(&zeroed_count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static int zeroed_pool_thread(void* arg) {
+    for (;;) {
+        zeroed_pool_fill();
+        event_wait(&zeroed_event);
+    }
+    return 0;
+}
+
+static void zeroed_pool_init(uint level) {
+    thread_t* t = thread_create("pmm-zeroer", &zeroed_pool_thread, nullptr,
+                                LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    DEBUG_ASSERT(t);
+    thread_detach_and_resume(t);
+}
+
+LK_INIT_HOOK(pmm_zeroer, &zeroed_pool_init, LK_INIT_LEVEL_THREADING);
+
 extern "C" enum handler_return pmm_dump_timer(struct timer* t, zx_time_t now, void*) TA_REQ(arena_lock) {
     timer_set(t, now + ZX_SEC(1), TIMER_SLACK_CENTER, ZX_MSEC(20), &pmm_dump_timer, nullptr);
     pmm_dump_free();
@@ -395,6 +923,7 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
     usage:
         printf("usage:\n");
         printf("%s arenas\n", argv[0].str);
+        printf("%s caches\n", argv[0].str);
         if (!is_panic) {
             printf("%s alloc <count>\n", argv[0].str);
             printf("%s alloc_range <address> <count>\n", argv[0].str);
@@ -411,9 +940,11 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
 
     if (!strcmp(argv[1].str, "arenas")) {
         arena_dump(is_panic);
+    } else if (!strcmp(argv[1].str, "caches")) {
+        pcpu_cache_dump();
     } else if (is_panic) {
         // No other operations will work during a panic.
-        printf("Only the \"arenas\" command is available during a panic.\n");
+        printf("Only the \"arenas\" and \"caches\" commands are available during a panic.\n");
         goto usage;
     } else if (!strcmp(argv[1].str, "free")) {
         static bool show_mem = false;
@@ -16,6 +16,7 @@
 #include <fbl/mutex.h>
 #include <fbl/type_support.h>
 #include <inttypes.h>
+#include <kernel/auto_lock.h>
 #include <kernel/cmdline.h>
 #include <kernel/thread.h>
 #include <lib/crypto/global_prng.h>
@@ -520,12 +521,42 @@ fbl::RefPtr<VmAddressRegionOrMapping> VmAspace::FindRegion(vaddr_t va) {
     }
 }
 
+fbl::RefPtr<VmObject> VmAspace::FindMappedVmo(vaddr_t va, size_t len, uint arch_mmu_flags,
+                                              uint64_t* offset) {
+    canary_.Assert();
+
+    AutoLock a(&lock_);
+    if (root_vmar_ == nullptr || aspace_destroyed_) {
+        return nullptr;
+    }
+
+    fbl::RefPtr<VmAddressRegion> vmar(root_vmar_);
+    fbl::RefPtr<VmAddressRegionOrMapping> next;
+    while ((next = vmar->FindRegionLocked(va)) && !next->is_mapping()) {
+        vmar = next->as_vm_address_region();
+    }
+    if (!next) {
+        return nullptr;
+    }
+
+    fbl::RefPtr<VmMapping> mapping = next->as_vm_mapping();
+    if (len > mapping->size() - (va - mapping->base())) {
+        return nullptr;
+    }
+    if ((mapping->arch_mmu_flags() & arch_mmu_flags) != arch_mmu_flags) {
+        return nullptr;
+    }
+
+    *offset = mapping->object_offset() + (va - mapping->base());
+    return mapping->vmo();
+}
+
 void VmAspace::AttachToThread(thread_t* t) {
     canary_.Assert();
     DEBUG_ASSERT(t);
 
     // point the lk thread at our object via the dummy C vmm_aspace_t struct
-    AutoThreadLock lock;
+    AutoSpinLockIrqSave lock(&t->state_lock);
 
     // not prepared to handle setting a new address space or one on a running thread
     DEBUG_ASSERT(!t->aspace);
@@ -544,12 +575,26 @@ zx_status_t VmAspace::PageFault(vaddr_t va, uint flags) {
         flags |= VMM_PF_FLAG_GUEST;
     }
 
-    // for now, hold the aspace lock across the page fault operation,
-    // which stops any other operations on the address space from moving
-    // the region out from underneath it
-    AutoLock a(&lock_);
+    for (;;) {
+        fbl::RefPtr<PageRequest> page_request;
+        zx_status_t status;
+        {
+            // for now, hold the aspace lock across the page fault operation,
+            // which stops any other operations on the address space from moving
+            // the region out from underneath it
+            AutoLock a(&lock_);
+
+            status = root_vmar_->PageFault(va, flags, &page_request);
+        }
+        if (status != ZX_ERR_SHOULD_WAIT)
+            return status;
 
-    return root_vmar_->PageFault(va, flags);
+        // the page has to come from a page source. wait for it without holding
+        // the aspace lock, then fault again since the mapping may have changed
+        status = page_request->Wait();
+        if (status != ZX_OK)
+            return status;
+    }
 }
 
 void VmAspace::Dump(bool verbose) const {
@@ -9,10 +9,13 @@
 #include "vm_priv.h"
 #include <assert.h>
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/auto_call.h>
 #include <fbl/auto_lock.h>
 #include <inttypes.h>
+#include <kernel/stats.h>
+#include <lib/ktrace.h>
 #include <safeint/safe_math.h>
 #include <trace.h>
 #include <vm/fault.h>
@@ -99,6 +102,14 @@ zx_status_t VmMapping::Protect(vaddr_t base, size_t size, uint new_arch_mmu_flag
 
 namespace {
 
+// Sizes of the large pages we try to map on fault, smallest first.  The arch
+// layer uses the biggest page size it supports that fits each run it is given.
+const size_t kLargePageSizes[] = {2 * MB, 1 * GB};
+
+// Largest fault-around window, as log2 of the number of pages.  Every page of the
+// window is looked up under the object lock, so keep it bounded.
+const uint8_t kMaxFaultAroundShift = 7;
+
 // Implementation helper for ProtectLocked
 zx_status_t ProtectOrUnmap(const fbl::RefPtr<VmAspace>& aspace, vaddr_t base, size_t size,
                            uint new_arch_mmu_flags) {
@@ -156,6 +167,7 @@ zx_status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mm
         if (!ac.check()) {
             return ZX_ERR_NO_MEMORY;
         }
+        CopyFaultAroundTo(mapping.get());
 
         zx_status_t status = ProtectOrUnmap(aspace_, base, size, new_arch_mmu_flags);
         LTRACEF("arch_mmu_protect returns %d\n", status);
@@ -178,6 +190,7 @@ zx_status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mm
         if (!ac.check()) {
             return ZX_ERR_NO_MEMORY;
         }
+        CopyFaultAroundTo(mapping.get());
 
         zx_status_t status = ProtectOrUnmap(aspace_, base, size, new_arch_mmu_flags);
         LTRACEF("arch_mmu_protect returns %d\n", status);
@@ -200,12 +213,14 @@ zx_status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mm
     if (!ac.check()) {
         return ZX_ERR_NO_MEMORY;
     }
+    CopyFaultAroundTo(center_mapping.get());
     fbl::RefPtr<VmMapping> right_mapping(fbl::AdoptRef(
         new (&ac) VmMapping(*parent_, base + size, right_size, flags_,
                             object_, right_vmo_offset, arch_mmu_flags_)));
     if (!ac.check()) {
         return ZX_ERR_NO_MEMORY;
     }
+    CopyFaultAroundTo(right_mapping.get());
 
     zx_status_t status = ProtectOrUnmap(aspace_, base, size, new_arch_mmu_flags);
     LTRACEF("arch_mmu_protect returns %d\n", status);
@@ -305,6 +320,7 @@ zx_status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
     if (!ac.check()) {
         return ZX_ERR_NO_MEMORY;
     }
+    CopyFaultAroundTo(mapping.get());
 
     // Unmap the middle segment
     LTRACEF("unmapping base %#lx size %#zx\n", base, size);
@@ -420,6 +436,35 @@ zx_status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
     currently_faulting_ = true;
     auto ac = fbl::MakeAutoCall([&]() { currently_faulting_ = false; });
 
+    // physically contiguous pages are collected into a run and mapped with a single
+    // call, which lets the arch layer use large pages where the run is aligned
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_len = 0;
+    auto map_run = [&]() -> zx_status_t {
+        if (run_len == 0) {
+            return ZX_OK;
+        }
+
+        LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR " len %#zx\n",
+                      run_pa, run_va, run_len);
+
+        // Only perform the MMU mapping if the pages have non-empty permissions
+        if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_RWX_MASK) {
+            size_t mapped;
+            zx_status_t ret = aspace_->arch_aspace().Map(run_va, run_pa, run_len / PAGE_SIZE,
+                                                         arch_mmu_flags_, &mapped);
+            if (ret != ZX_OK) {
+                TRACEF("error %d mapping pages at va %#" PRIxPTR " pa %#" PRIxPTR "\n",
+                       ret, run_va, run_pa);
+                return ret;
+            }
+            DEBUG_ASSERT(mapped == run_len / PAGE_SIZE);
+        }
+        run_len = 0;
+        return ZX_OK;
+    };
+
     // iterate through the range, grabbing a page from the underlying object and
     // mapping it in
     size_t o;
@@ -428,34 +473,39 @@ zx_status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
 
         zx_status_t status;
         paddr_t pa;
-        status = object_->GetPageLocked(vmo_offset, pf_flags, nullptr, nullptr, &pa);
+        status = object_->GetPageLocked(vmo_offset, pf_flags, nullptr, nullptr, nullptr, &pa);
         if (status < 0) {
-            // no page to map
-            if (commit) {
+            // no page to map. pages that have to come from a page source are
+            // left to be faulted in, even when committing.
+            if (commit && status != ZX_ERR_SHOULD_WAIT) {
                 // fail when we can't commit every requested page
                 return status;
             } else {
                 // skip ahead
+                status = map_run();
+                if (status != ZX_OK) {
+                    return status;
+                }
                 continue;
             }
         }
 
         vaddr_t va = base_ + o;
-        LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR "\n", pa, va);
+        if (run_len != 0 && va == run_va + run_len && pa == run_pa + run_len) {
+            run_len += PAGE_SIZE;
+            continue;
+        }
 
-        // Only perform the MMU mapping if the pages have non-empty permissions
-        if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_RWX_MASK) {
-            size_t mapped;
-            zx_status_t ret = aspace_->arch_aspace().Map(va, pa, 1, arch_mmu_flags_, &mapped);
-            if (ret != ZX_OK) {
-                TRACEF("error %d mapping page at va %#" PRIxPTR " pa %#" PRIxPTR "\n", ret, va, pa);
-                return ret;
-            }
-            DEBUG_ASSERT(mapped == 1);
+        status = map_run();
+        if (status != ZX_OK) {
+            return status;
         }
+        run_va = va;
+        run_pa = pa;
+        run_len = PAGE_SIZE;
     }
 
-    return ZX_OK;
+    return map_run();
 }
 
 zx_status_t VmMapping::DecommitRange(size_t offset, size_t len,
@@ -526,7 +576,153 @@ zx_status_t VmMapping::DestroyLocked() {
     return ZX_OK;
 }
 
-zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
+zx_status_t VmMapping::MapLargePageLocked(vaddr_t va) {
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(va));
+
+    // cheap checks first: the faulting page itself has to be resident already, which
+    // rules out the common demand paging case without walking the whole range
+    paddr_t va_pa;
+    if (object_->GetContiguousRunLocked(va - base_ + object_offset_, PAGE_SIZE, &va_pa) != ZX_OK) {
+        return ZX_ERR_NOT_FOUND;
+    }
+
+    vaddr_t map_base = 0;
+    paddr_t map_pa = 0;
+    size_t map_size = 0;
+    for (size_t size : kLargePageSizes) {
+        vaddr_t large_base = ROUNDDOWN(va, size);
+        if (large_base < base_ || size - 1 > base_ + size_ - 1 - large_base) {
+            break;
+        }
+
+        // the large page has to be physically aligned as well
+        paddr_t expected_pa = va_pa - (va - large_base);
+        if (!IS_ALIGNED(expected_pa, size)) {
+            break;
+        }
+
+        paddr_t pa;
+        uint64_t vmo_offset = large_base - base_ + object_offset_;
+        if (object_->GetContiguousRunLocked(vmo_offset, size, &pa) != ZX_OK || pa != expected_pa) {
+            break;
+        }
+
+        // Map() can't replace smaller pages, so give up if the range has some already,
+        // say from faults taken before all of it was resident.
+        if (aspace_->arch_aspace().HasMappings(large_base, size / PAGE_SIZE)) {
+            break;
+        }
+
+        map_base = large_base;
+        map_pa = pa;
+        map_size = size;
+    }
+    if (map_size == 0) {
+        return ZX_ERR_NOT_FOUND;
+    }
+
+    LTRACEF("mapping large page va %#" PRIxPTR " pa %#" PRIxPTR " size %#zx\n",
+            map_base, map_pa, map_size);
+
+    // the range was checked to be unmapped above under the aspace lock; if this fails
+    // anyway the caller falls back to mapping the single page
+    return aspace_->arch_aspace().Map(map_base, map_pa, map_size / PAGE_SIZE,
+                                      arch_mmu_flags_, nullptr);
+}
+
+void VmMapping::SetFaultAround(uint8_t window_shift, bool commit) {
+    canary_.Assert();
+
+    window_shift = fbl::min(window_shift, kMaxFaultAroundShift);
+
+    // only anonymous memory gets committed ahead of use; committing in a clone would
+    // copy pages out of the parent that may never be written.  is_cow_clone() takes the
+    // object lock, so ask before taking the aspace lock.
+    bool anonymous = object_->is_paged() && !object_->is_cow_clone();
+
+    AutoLock guard(aspace_->lock());
+    fault_around_shift_ = window_shift;
+    fault_around_commit_ = commit && anonymous && window_shift != 0;
+}
+
+void VmMapping::FaultAroundLocked(vaddr_t va, uint pf_flags) {
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(va));
+
+    if (fault_around_shift_ == 0) {
+        return;
+    }
+
+    // the window is naturally aligned, clipped to the mapping
+    const size_t window = PAGE_SIZE << fault_around_shift_;
+    const vaddr_t window_base = ROUNDDOWN(va, window);
+    const vaddr_t start = fbl::max(window_base, base_);
+    const vaddr_t last = fbl::min(window_base + window - 1, base_ + size_ - 1);
+
+    // missing pages are only allocated when the fault was a write, which is a good sign
+    // the rest of the window is about to be written as well
+    const bool commit = fault_around_commit_ && (pf_flags & VMM_PF_FLAG_WRITE);
+
+    uint32_t mapped = 0;
+    uint32_t committed = 0;
+    for (vaddr_t v = start; v < last; v += PAGE_SIZE) {
+        if (v == va) {
+            continue;
+        }
+
+        // leave anything already mapped alone, it may have been mapped read-only on purpose
+        if (aspace_->arch_aspace().Query(v, nullptr, nullptr) == ZX_OK) {
+            continue;
+        }
+
+        uint64_t vmo_offset = v - base_ + object_offset_;
+        uint mmu_flags = arch_mmu_flags_;
+        paddr_t pa;
+        if (object_->GetContiguousRunLocked(vmo_offset, PAGE_SIZE, &pa) == ZX_OK) {
+            // the page belongs to the object itself, so it can be mapped with the full
+            // permissions of the mapping, as MapRange() would
+        } else if (commit) {
+            zx_status_t status = object_->GetPageLocked(
+                vmo_offset, VMM_PF_FLAG_WRITE | VMM_PF_FLAG_SW_FAULT, nullptr, nullptr, nullptr,
+                &pa);
+            if (status != ZX_OK) {
+                // don't push on speculatively if memory is short
+                break;
+            }
+            committed++;
+        } else if (object_->GetPageLocked(vmo_offset, 0, nullptr, nullptr, nullptr,
+                                          &pa) == ZX_OK) {
+            // a page shared with a parent, map it read-only so writes still fault and copy
+            mmu_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
+        } else {
+            continue;
+        }
+
+        size_t count;
+        zx_status_t status = aspace_->arch_aspace().Map(v, pa, 1, mmu_flags, &count);
+        if (status != ZX_OK) {
+            TRACEF("failed to fault around va %#" PRIxPTR ", status %d\n", v, status);
+            break;
+        }
+        DEBUG_ASSERT(count == 1);
+
+#if ARCH_ARM64
+        if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE) {
+            arch_sync_cache_range(v, PAGE_SIZE);
+        }
+#endif
+        mapped++;
+    }
+
+    if (mapped > 0) {
+        LTRACEF("fault around va %#" PRIxPTR ": mapped %u pages, committed %u\n",
+                va, mapped, committed);
+        CPU_STATS_ADD(fault_around_pages, mapped);
+        ktrace(TAG_PAGE_FAULT_AROUND, (uint32_t)(va >> 32), (uint32_t)va, mapped, committed);
+    }
+}
+
+zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags,
+                                 fbl::RefPtr<PageRequest>* page_request) {
     canary_.Assert();
     DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
 
@@ -573,10 +769,23 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     currently_faulting_ = true;
     auto ac = fbl::MakeAutoCall([&]() { currently_faulting_ = false; });
 
+    // if the object already has the memory around the fault resident, for example because
+    // it was committed contiguously, map it with a large page rather than a page at a time.
+    // these pages belong to the object itself, so there is no copy-on-write to preserve by
+    // mapping them read-only.
+    if (MapLargePageLocked(va) == ZX_OK) {
+        return ZX_OK;
+    }
+
     // fault in or grab an existing page
     paddr_t new_pa;
     vm_page_t* page;
-    zx_status_t status = object_->GetPageLocked(vmo_offset, pf_flags, nullptr, &page, &new_pa);
+    zx_status_t status = object_->GetPageLocked(vmo_offset, pf_flags, nullptr, page_request,
+                                                &page, &new_pa);
+    if (status == ZX_ERR_SHOULD_WAIT) {
+        // the caller waits for the page source and faults again
+        return status;
+    }
     if (status < 0) {
         TRACEF("ERROR: failed to fault in or grab existing page\n");
         TRACEF("%p vmo_offset %#" PRIx64 ", pf_flags %#x\n", this, vmo_offset, pf_flags);
@@ -659,6 +868,11 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         DEBUG_ASSERT(mapped == 1);
     }
 
+    // speculatively map the neighbours as well, to save taking faults on them later
+    if (!(pf_flags & VMM_PF_FLAG_GUEST)) {
+        FaultAroundLocked(va, pf_flags);
+    }
+
 // TODO: figure out what to do with this
 #if ARCH_ARM64
     if (pf_flags & VMM_PF_FLAG_GUEST) {
@@ -31,18 +31,6 @@ using fbl::AutoLock;
 
 namespace {
 
-void ZeroPage(paddr_t pa) {
-    void* ptr = paddr_to_physmap(pa);
-    DEBUG_ASSERT(ptr);
-
-    arch_zero_page(ptr);
-}
-
-void ZeroPage(vm_page_t* p) {
-    paddr_t pa = vm_page_to_paddr(p);
-    ZeroPage(pa);
-}
-
 void InitializeVmPage(vm_page_t* p) {
     DEBUG_ASSERT(p->state == VM_PAGE_STATE_ALLOC);
     p->state = VM_PAGE_STATE_OBJECT;
@@ -52,8 +40,10 @@ void InitializeVmPage(vm_page_t* p) {
 
 } // namespace
 
-VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags, fbl::RefPtr<VmObject> parent)
-    : VmObject(fbl::move(parent)), pmm_alloc_flags_(pmm_alloc_flags) {
+VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags, fbl::RefPtr<VmObject> parent,
+                             fbl::RefPtr<PageSource> page_source)
+    : VmObject(fbl::move(parent)), pmm_alloc_flags_(pmm_alloc_flags),
+      page_source_(fbl::move(page_source)) {
     LTRACEF("%p\n", this);
 }
 
@@ -73,6 +63,9 @@ VmObjectPaged::~VmObjectPaged() {
 
     // free all of the pages attached to us
     page_list_.FreeAllPages();
+
+    if (page_source_)
+        page_source_->Detach();
 }
 
 zx_status_t VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size, fbl::RefPtr<VmObject>* obj) {
@@ -81,7 +74,31 @@ zx_status_t VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size, fbl::
         return ZX_ERR_INVALID_ARGS;
 
     fbl::AllocChecker ac;
-    auto vmo = fbl::AdoptRef<VmObject>(new (&ac) VmObjectPaged(pmm_alloc_flags, nullptr));
+    auto vmo = fbl::AdoptRef<VmObject>(new (&ac) VmObjectPaged(pmm_alloc_flags, nullptr, nullptr));
+    if (!ac.check())
+        return ZX_ERR_NO_MEMORY;
+
+    auto err = vmo->Resize(size);
+    if (err != ZX_OK)
+        return err;
+
+    *obj = fbl::move(vmo);
+
+    return ZX_OK;
+}
+
+zx_status_t VmObjectPaged::CreateWithSource(uint32_t pmm_alloc_flags, uint64_t size,
+                                            fbl::RefPtr<PageSource> source,
+                                            fbl::RefPtr<VmObject>* obj) {
+    DEBUG_ASSERT(source);
+
+    // there's a max size to keep indexes within range
+    if (size > MAX_SIZE)
+        return ZX_ERR_INVALID_ARGS;
+
+    fbl::AllocChecker ac;
+    auto vmo = fbl::AdoptRef<VmObject>(
+        new (&ac) VmObjectPaged(pmm_alloc_flags, nullptr, fbl::move(source)));
     if (!ac.check())
         return ZX_ERR_NO_MEMORY;
 
@@ -100,7 +117,8 @@ zx_status_t VmObjectPaged::CloneCOW(uint64_t offset, uint64_t size, bool copy_na
     canary_.Assert();
 
     fbl::AllocChecker ac;
-    auto vmo = fbl::AdoptRef<VmObjectPaged>(new (&ac) VmObjectPaged(pmm_alloc_flags_, fbl::WrapRefPtr(this)));
+    auto vmo = fbl::AdoptRef<VmObjectPaged>(
+        new (&ac) VmObjectPaged(pmm_alloc_flags_, fbl::WrapRefPtr(this), nullptr));
     if (!ac.check())
         return ZX_ERR_NO_MEMORY;
 
@@ -237,7 +255,8 @@ zx_status_t VmObjectPaged::CreateFromROData(const void* data, size_t size, fbl::
 
             if (page->state == VM_PAGE_STATE_WIRED) {
                 // it's wired to the kernel, so we can just use it directly
-            } else if (page->state == VM_PAGE_STATE_FREE) {
+            } else if (page->state == VM_PAGE_STATE_FREE ||
+                       page->state == VM_PAGE_STATE_CACHED) {
                 ASSERT(pmm_alloc_range(pa, 1, nullptr) == 1);
                 page->state = VM_PAGE_STATE_WIRED;
             } else {
@@ -256,14 +275,45 @@ zx_status_t VmObjectPaged::CreateFromROData(const void* data, size_t size, fbl::
     return ZX_OK;
 }
 
+zx_status_t VmObjectPaged::GetContiguousRunLocked(uint64_t offset, uint64_t len, paddr_t* pa) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+
+    if (len == 0 || !InRange(offset, len, size_))
+        return ZX_ERR_OUT_OF_RANGE;
+
+    paddr_t start = 0;
+    for (uint64_t o = 0; o < len; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.GetPage(offset + o);
+        if (!p)
+            return ZX_ERR_NOT_FOUND;
+
+        paddr_t page_pa = vm_page_to_paddr(p);
+        if (o == 0) {
+            start = page_pa;
+        } else if (page_pa != start + o) {
+            return ZX_ERR_NOT_FOUND;
+        }
+    }
+
+    *pa = start;
+    return ZX_OK;
+}
+
 // Looks up the page at the requested offset, faulting it in if requested and necessary.  If
 // this VMO has a parent and the requested page isn't found, the parent will be searched.
 //
+// If this VMO has a page source, a missing page is never zero filled; the lookup fails with
+// ZX_ERR_SHOULD_WAIT, after asking the source for the page if |page_request| is not NULL.
+//
 // |free_list|, if not NULL, is a list of allocated but unused vm_page_t that
-// this function may allocate from.  This function will need at most one entry,
+// this function may allocate from.  The pages must already be zeroed, as from a
+// PMM_ALLOC_FLAG_ZEROED allocation.  This function will need at most one entry,
 // and will not fail if |free_list| is a non-empty list, faulting in was requested,
 // and offset is in range.
 zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_node* free_list,
+                                         fbl::RefPtr<PageRequest>* page_request,
                                          vm_page_t** const page_out, paddr_t* const pa_out) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
@@ -297,8 +347,13 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
         // make sure we don't cause the parent to fault in new pages, just ask for any that already exist
         uint parent_pf_flags = pf_flags & ~(VMM_PF_FLAG_FAULT_MASK);
 
+        // an ancestor with a page source may still have to ask it for the page, in which case
+        // we must not fill it with zeros ourselves
         zx_status_t status = parent_->GetPageLocked(parent_offset.ValueOrDie(), parent_pf_flags,
-                                                    nullptr, &p, &pa);
+                                                    nullptr, page_request, &p, &pa);
+        if (status == ZX_ERR_SHOULD_WAIT) {
+            return status;
+        }
         if (status == ZX_OK) {
             // we have a page from them. if we're read-only faulting, return that page so they can map
             // or read from it directly
@@ -313,18 +368,17 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
                 return ZX_OK;
             }
 
-            // if we're write faulting, we need to clone it and return the new page
+            // if we're write faulting, we need to clone it and return the new page.
+            // the copy overwrites the whole page, so only spend one of the pre-zeroed
+            // pages from |free_list| on it if a plain allocation fails.
             paddr_t pa_clone;
-            vm_page_t* p_clone = nullptr;
-            if (free_list) {
+            vm_page_t* p_clone = pmm_alloc_page(pmm_alloc_flags_, &pa_clone);
+            if (!p_clone && free_list) {
                 p_clone = list_remove_head_type(free_list, vm_page_t, free.node);
                 if (p_clone) {
                     pa_clone = vm_page_to_paddr(p_clone);
                 }
             }
-            if (!p_clone) {
-                p_clone = pmm_alloc_page(pmm_alloc_flags_, &pa_clone);
-            }
             if (!p_clone) {
                 return ZX_ERR_NO_MEMORY;
             }
@@ -355,6 +409,17 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
         }
     }
 
+    // a page that comes from our source is never zero filled. ask the source for it if the
+    // caller can wait, either way the caller can't have it yet
+    if (page_source_) {
+        if (page_request) {
+            zx_status_t status = page_source_->GetPage(offset, page_request);
+            if (status != ZX_OK)
+                return status;
+        }
+        return ZX_ERR_SHOULD_WAIT;
+    }
+
     // if we're not being asked to sw or hw fault in the page, return not found
     if ((pf_flags & VMM_PF_FLAG_FAULT_MASK) == 0)
         return ZX_ERR_NOT_FOUND;
@@ -378,7 +443,7 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
         }
     }
     if (!p) {
-        p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+        p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &pa);
     }
     if (!p) {
         return ZX_ERR_NO_MEMORY;
@@ -386,9 +451,6 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
 
     InitializeVmPage(p);
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
-
     zx_status_t status = AddPageLocked(p, offset);
     DEBUG_ASSERT(status == ZX_OK);
 
@@ -451,7 +513,7 @@ zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t*
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_, &page_list);
+    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &page_list);
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -473,15 +535,23 @@ zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t*
         paddr_t pa;
         const uint flags = VMM_PF_FLAG_SW_FAULT | VMM_PF_FLAG_WRITE;
         // Should not be able to fail, since we're providing it memory and the
-        // range should be valid.
-        zx_status_t status = GetPageLocked(o, flags, &page_list, &p, &pa);
-        ASSERT(status == ZX_OK);
+        // range should be valid, unless the page has to come from a page source.
+        // Committing doesn't wait on a source.
+        zx_status_t status = GetPageLocked(o, flags, &page_list, nullptr, &p, &pa);
+        if (status != ZX_OK) {
+            DEBUG_ASSERT(status == ZX_ERR_SHOULD_WAIT);
+            pmm_free(&page_list);
+            return ZX_ERR_NOT_SUPPORTED;
+        }
 
         if (committed)
             *committed += PAGE_SIZE;
     }
 
-    DEBUG_ASSERT(list_is_empty(&page_list));
+    // copy-on-write clones are allocated separately, so some of the zeroed pages
+    // may be left over
+    if (!list_is_empty(&page_list))
+        pmm_free(&page_list);
 
     // for now we only support committing as much as we were asked for
     DEBUG_ASSERT(!committed || *committed == count * PAGE_SIZE);
@@ -499,8 +569,9 @@ zx_status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len,
 
     AutoLock a(&lock_);
 
-    // This function does not support cloned VMOs.
-    if (unlikely(parent_)) {
+    // This function does not support cloned VMOs, or ones whose pages come
+    // from a page source.
+    if (unlikely(parent_ || page_source_)) {
         return ZX_ERR_NOT_SUPPORTED;
     }
 
@@ -533,7 +604,8 @@ zx_status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len,
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_, alignment_log2, nullptr, &page_list);
+    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED,
+                                            alignment_log2, nullptr, &page_list);
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -552,9 +624,6 @@ zx_status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len,
 
         InitializeVmPage(p);
 
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
-
         auto status = page_list_.AddPage(p, o);
         DEBUG_ASSERT(status == ZX_OK);
 
@@ -623,6 +692,127 @@ zx_status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t
     return ZX_OK;
 }
 
+zx_status_t VmObjectPaged::TakePages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return ZX_ERR_BAD_STATE;
+
+    AutoLock a(&lock_);
+
+    if (unlikely(!InRange(offset, len, size_)))
+        return ZX_ERR_OUT_OF_RANGE;
+
+    // Pages that a clone can still see through us, or that we see through a
+    // parent, are not ours to give away.
+    if (parent_ || children_list_len_ != 0)
+        return ZX_ERR_BAD_STATE;
+
+    if (AnyPagesPinnedLocked(offset, len))
+        return ZX_ERR_BAD_STATE;
+
+    // Only take the range if every page is committed, so that a failure
+    // leaves the object untouched.
+    uint64_t expected_next_off = offset;
+    zx_status_t status = page_list_.ForEveryPageInRange(
+        [&expected_next_off](const auto p, uint64_t off) {
+            if (off != expected_next_off) {
+                return ZX_ERR_NOT_FOUND;
+            }
+            expected_next_off = off + PAGE_SIZE;
+            return ZX_ERR_NEXT;
+        },
+        offset, offset + len);
+    if (status != ZX_OK || expected_next_off != offset + len)
+        return ZX_ERR_BAD_STATE;
+
+    // unmap all of the pages in this range on all the mapping regions
+    RangeChangeUpdateLocked(offset, len);
+
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.RemovePage(o);
+        DEBUG_ASSERT(p && p->state == VM_PAGE_STATE_OBJECT);
+        p->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(pages, &p->free.node);
+    }
+
+    return ZX_OK;
+}
+
+zx_status_t VmObjectPaged::SupplyPages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return ZX_ERR_BAD_STATE;
+    DEBUG_ASSERT(list_length(pages) == len / PAGE_SIZE);
+
+    AutoLock a(&lock_);
+
+    if (unlikely(!InRange(offset, len, size_)))
+        return ZX_ERR_OUT_OF_RANGE;
+
+    // A clone would either start seeing the new pages or keep the old ones
+    // alive through its own copy; neither is what the caller asked for.
+    if (parent_ || children_list_len_ != 0)
+        return ZX_ERR_BAD_STATE;
+
+    if (AnyPagesPinnedLocked(offset, len))
+        return ZX_ERR_BAD_STATE;
+
+    // unmap all of the pages in this range on all the mapping regions
+    RangeChangeUpdateLocked(offset, len);
+
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        page_list_.FreePage(o);
+
+        vm_page_t* p = list_remove_head_type(pages, vm_page_t, free.node);
+        InitializeVmPage(p);
+
+        __UNUSED auto status = page_list_.AddPage(p, o);
+        DEBUG_ASSERT(status == ZX_OK);
+    }
+
+    return ZX_OK;
+}
+
+zx_status_t VmObjectPaged::SupplyMissingPages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return ZX_ERR_BAD_STATE;
+    DEBUG_ASSERT(list_length(pages) == len / PAGE_SIZE);
+
+    AutoLock a(&lock_);
+
+    if (unlikely(!InRange(offset, len, size_)))
+        return ZX_ERR_OUT_OF_RANGE;
+
+    // Only holes are filled, so nothing that is already mapped, pinned or
+    // visible to a clone changes underneath anyone. Holes in an object with a
+    // page source are never mapped, not even to the zero page, so there are
+    // no mappings to update either.
+    list_node present = LIST_INITIAL_VALUE(present);
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(pages, vm_page_t, free.node);
+        if (page_list_.GetPage(o)) {
+            list_add_tail(&present, &p->free.node);
+            continue;
+        }
+
+        InitializeVmPage(p);
+
+        __UNUSED auto status = page_list_.AddPage(p, o);
+        DEBUG_ASSERT(status == ZX_OK);
+    }
+
+    list_move(&present, pages);
+
+    return ZX_OK;
+}
+
 zx_status_t VmObjectPaged::Pin(uint64_t offset, uint64_t len) {
     canary_.Assert();
 
@@ -759,6 +949,11 @@ zx_status_t VmObjectPaged::ResizeLocked(uint64_t s) {
             // unmap all of the pages in this range on all the mapping regions
             RangeChangeUpdateLocked(start, page_aligned_len);
 
+            // wake anyone waiting on our page source for these pages, they'll find
+            // the range gone when they retry
+            if (page_source_)
+                page_source_->OnPagesAvailable(start, page_aligned_len);
+
             // iterate through the pages, freeing them
             while (start < end) {
                 page_list_.FreePage(start);
@@ -820,48 +1015,59 @@ zx_status_t VmObjectPaged::ReadWriteInternal(uint64_t offset, size_t len, size_t
     if (bytes_copied)
         *bytes_copied = 0;
 
-    AutoLock a(&lock_);
-
-    // trim the size
-    uint64_t new_len;
-    if (!TrimRange(offset, len, size_, &new_len))
-        return ZX_ERR_OUT_OF_RANGE;
-
-    // was in range, just zero length
-    if (new_len == 0)
-        return 0;
-
-    // walk the list of pages and do the write
     uint64_t src_offset = offset;
     size_t dest_offset = 0;
-    while (new_len > 0) {
-        size_t page_offset = src_offset % PAGE_SIZE;
-        size_t tocopy = MIN(PAGE_SIZE - page_offset, new_len);
+    for (;;) {
+        fbl::RefPtr<PageRequest> page_request;
+        {
+            AutoLock a(&lock_);
+
+            // trim the size. the object may have been resized while we were waiting on a
+            // page source below.
+            uint64_t new_len;
+            if (!TrimRange(src_offset, len - dest_offset, size_, &new_len))
+                return ZX_ERR_OUT_OF_RANGE;
+
+            // walk the list of pages and do the write
+            while (new_len > 0) {
+                size_t page_offset = src_offset % PAGE_SIZE;
+                size_t tocopy = MIN(PAGE_SIZE - page_offset, new_len);
+
+                // fault in the page
+                paddr_t pa;
+                auto status = GetPageLocked(src_offset,
+                                            VMM_PF_FLAG_SW_FAULT | (write ? VMM_PF_FLAG_WRITE : 0),
+                                            nullptr, &page_request, nullptr, &pa);
+                if (status == ZX_ERR_SHOULD_WAIT)
+                    break;
+                if (status < 0)
+                    return status;
 
-        // fault in the page
-        paddr_t pa;
-        auto status = GetPageLocked(src_offset,
-                                    VMM_PF_FLAG_SW_FAULT | (write ? VMM_PF_FLAG_WRITE : 0),
-                                    nullptr, nullptr, &pa);
-        if (status < 0)
-            return status;
+                // compute the kernel mapping of this page
+                uint8_t* page_ptr = reinterpret_cast<uint8_t*>(paddr_to_physmap(pa));
 
-        // compute the kernel mapping of this page
-        uint8_t* page_ptr = reinterpret_cast<uint8_t*>(paddr_to_physmap(pa));
+                // call the copy routine
+                auto err = copyfunc(page_ptr + page_offset, dest_offset, tocopy);
+                if (err < 0)
+                    return err;
 
-        // call the copy routine
-        auto err = copyfunc(page_ptr + page_offset, dest_offset, tocopy);
-        if (err < 0)
-            return err;
+                src_offset += tocopy;
+                if (bytes_copied)
+                    *bytes_copied += tocopy;
+                dest_offset += tocopy;
+                new_len -= tocopy;
+            }
 
-        src_offset += tocopy;
-        if (bytes_copied)
-            *bytes_copied += tocopy;
-        dest_offset += tocopy;
-        new_len -= tocopy;
-    }
+            if (!page_request)
+                return ZX_OK;
+        }
 
-    return ZX_OK;
+        // the page has to come from our page source; wait for it with the lock
+        // dropped and pick up where we left off
+        zx_status_t status = page_request->Wait();
+        if (status != ZX_OK)
+            return status;
+    }
 }
 
 zx_status_t VmObjectPaged::Read(void* _ptr, uint64_t offset, size_t len, size_t* bytes_read) {
@@ -927,7 +1133,7 @@ zx_status_t VmObjectPaged::Lookup(uint64_t offset, uint64_t len, uint pf_flags,
 
                 paddr_t pa;
                 zx_status_t status = this->GetPageLocked(missing_off, pf_flags, nullptr,
-                                                         nullptr, &pa);
+                                                         nullptr, nullptr, &pa);
                 if (status != ZX_OK) {
                     return ZX_ERR_NO_MEMORY;
                 }
@@ -962,7 +1168,7 @@ zx_status_t VmObjectPaged::Lookup(uint64_t offset, uint64_t len, uint pf_flags,
     // If expected_next_off isn't at the end, there's a gap to process
     for (uint64_t off = expected_next_off; off < end_page_offset; off += PAGE_SIZE) {
         paddr_t pa;
-        zx_status_t status = GetPageLocked(off, pf_flags, nullptr, nullptr, &pa);
+        zx_status_t status = GetPageLocked(off, pf_flags, nullptr, nullptr, nullptr, &pa);
         if (status != ZX_OK) {
             return ZX_ERR_NO_MEMORY;
         }
@@ -1063,7 +1269,7 @@ zx_status_t VmObjectPaged::CacheOp(const uint64_t start_offset, const uint64_t l
 
         // lookup the physical address of the page, careful not to fault in a new one
         paddr_t pa;
-        auto status = GetPageLocked(op_start_offset, 0, nullptr, nullptr, &pa);
+        auto status = GetPageLocked(op_start_offset, 0, nullptr, nullptr, nullptr, &pa);
 
         if (likely(status == ZX_OK)) {
             // Convert the page address to a Kernel virtual address.
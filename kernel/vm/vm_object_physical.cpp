@@ -70,6 +70,7 @@ void VmObjectPhysical::Dump(uint depth, bool verbose) {
 
 // get the physical address of a page at offset
 zx_status_t VmObjectPhysical::GetPageLocked(uint64_t offset, uint pf_flags, list_node* free_list,
+                                            fbl::RefPtr<PageRequest>* page_request,
                                             vm_page_t** _page, paddr_t* _pa) {
     canary_.Assert();
 
@@ -88,6 +89,22 @@ zx_status_t VmObjectPhysical::GetPageLocked(uint64_t offset, uint pf_flags, list
     return ZX_OK;
 }
 
+zx_status_t VmObjectPhysical::GetContiguousRunLocked(uint64_t offset, uint64_t len, paddr_t* _pa) {
+    canary_.Assert();
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+
+    if (!InRange(offset, len, size_))
+        return ZX_ERR_OUT_OF_RANGE;
+
+    uint64_t pa = base_ + offset;
+    if (pa + len - 1 > UINTPTR_MAX)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    *_pa = (paddr_t)pa;
+
+    return ZX_OK;
+}
+
 zx_status_t VmObjectPhysical::LookupUser(uint64_t offset, uint64_t len, user_inout_ptr<paddr_t> buffer,
                                          size_t buffer_size) {
     canary_.Assert();
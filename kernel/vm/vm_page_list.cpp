@@ -113,7 +113,7 @@ vm_page* VmPageList::GetPage(uint64_t offset) {
     return pln->GetPage(index);
 }
 
-zx_status_t VmPageList::FreePage(uint64_t offset) {
+vm_page* VmPageList::RemovePage(uint64_t offset) {
     uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
     size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
 
@@ -123,21 +123,26 @@ zx_status_t VmPageList::FreePage(uint64_t offset) {
     // lookup the tree node that holds this page
     auto pln = list_.find(node_offset);
     if (!pln.IsValid()) {
-        return ZX_ERR_NOT_FOUND;
+        return nullptr;
     }
 
-    // free this page
     auto page = pln->RemovePage(index);
-    if (page) {
+    if (page && pln->IsEmpty()) {
         // if it was the last page in the node, remove the node from the tree
-        if (pln->IsEmpty()) {
-            LTRACEF_LEVEL(2, "%p freeing the list node\n", this);
-            list_.erase(*pln);
-        }
+        LTRACEF_LEVEL(2, "%p freeing the list node\n", this);
+        list_.erase(*pln);
+    }
 
-        pmm_free_page(page);
+    return page;
+}
+
+zx_status_t VmPageList::FreePage(uint64_t offset) {
+    auto page = RemovePage(offset);
+    if (!page) {
+        return ZX_ERR_NOT_FOUND;
     }
 
+    pmm_free_page(page);
     return ZX_OK;
 }
 
@@ -8,7 +8,11 @@
 #include <err.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/array.h>
+#include <fbl/auto_lock.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
 #include <unittest.h>
+#include <vm/physmap.h>
 #include <vm/vm.h>
 #include <vm/vm_address_region.h>
 #include <vm/vm_aspace.h>
@@ -72,6 +76,76 @@ static bool pmm_oversized_alloc_test(void* context) {
     END_TEST;
 }
 
+// Allocates zeroed pages, enough to drain the pre-zeroed pool, and checks them.
+static bool pmm_zeroed_alloc_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 2048;
+
+    auto count = pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_ZEROED, &list);
+    EXPECT_EQ(alloc_count, count, "pmm_alloc_pages zeroed count");
+
+    vm_page_t* page;
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        auto ptr = static_cast<const uint64_t*>(paddr_to_physmap(vm_page_to_paddr(page)));
+        bool zeroed = true;
+        for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+            if (ptr[i] != 0) {
+                zeroed = false;
+                break;
+            }
+        }
+        EXPECT_TRUE(zeroed, "page is zeroed");
+        EXPECT_EQ(VM_PAGE_STATE_ALLOC, page->state, "zeroed page state");
+    }
+
+    auto ret = pmm_free(&list);
+    EXPECT_EQ(alloc_count, ret, "pmm_free_page on a list of pages");
+    END_TEST;
+}
+
+// Frees a single page into the current cpu's cache, allocates it back out of there,
+// then frees it again and pulls it out of the cache by allocating its address.
+static bool pmm_pcpu_cache_test(void* context) {
+    BEGIN_TEST;
+
+    paddr_t pa;
+    vm_page_t* page = pmm_alloc_page(0, &pa);
+    REQUIRE_NONNULL(page, "pmm_alloc single page");
+    EXPECT_EQ(VM_PAGE_STATE_ALLOC, page->state, "allocated page state");
+
+    // stay on one cpu so that the page comes back out of the cache it went into
+    thread_t* t = get_current_thread();
+    cpu_mask_t old_affinity = t->cpu_affinity;
+    thread_set_cpu_affinity(t, cpu_num_to_mask(arch_curr_cpu_num()));
+
+    // a cached page counts as free, not as allocated
+    EXPECT_EQ(1u, pmm_free_page(page), "pmm_free_page into the cache");
+    EXPECT_EQ(VM_PAGE_STATE_CACHED, page->state, "cached page state");
+    size_t state_count[_VM_PAGE_STATE_COUNT] = {};
+    pmm_count_total_states(state_count);
+    EXPECT_LT(0u, state_count[VM_PAGE_STATE_CACHED], "cached pages counted");
+
+    paddr_t pa2;
+    vm_page_t* page2 = pmm_alloc_page(0, &pa2);
+    EXPECT_EQ(page, page2, "page comes back out of the cache");
+    EXPECT_EQ(pa, pa2, "page comes back out of the cache");
+    EXPECT_EQ(VM_PAGE_STATE_ALLOC, page2->state, "reallocated page state");
+
+    // the range allocator drains the caches to get at the page
+    EXPECT_EQ(1u, pmm_free_page(page2), "pmm_free_page into the cache");
+    EXPECT_EQ(VM_PAGE_STATE_CACHED, page->state, "cached page state");
+    list_node list = LIST_INITIAL_VALUE(list);
+    EXPECT_EQ(1u, pmm_alloc_range(pa, 1, &list), "pmm_alloc_range on a cached page");
+    EXPECT_EQ(page, list_peek_head_type(&list, vm_page_t, free.node), "pmm_alloc_range page");
+    EXPECT_EQ(VM_PAGE_STATE_ALLOC, page->state, "drained and reallocated page state");
+    EXPECT_EQ(1u, pmm_free(&list), "pmm_free");
+
+    thread_set_cpu_affinity(t, old_affinity);
+    END_TEST;
+}
+
 static uint32_t test_rand(uint32_t seed) {
     return (seed = seed * 1664525 + 1013904223);
 }
@@ -537,6 +611,110 @@ static bool vmo_demand_paged_map_test(void* context) {
     END_TEST;
 }
 
+// Creates a contiguous vm object, maps it demand paged, and checks that a single
+// fault maps the whole large page around it.
+static bool vmo_large_page_map_test(void* context) {
+    BEGIN_TEST;
+    static const uint8_t large_page_shift = 21;
+    static const size_t large_page_size = 1UL << large_page_shift;
+    static const size_t alloc_size = 2 * large_page_size;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+    uint64_t committed;
+    status = vmo->CommitRangeContiguous(0, alloc_size, &committed, large_page_shift);
+    if (status == ZX_ERR_NO_MEMORY) {
+        unittest_printf("no aligned contiguous memory, skipping\n");
+        END_TEST;
+    }
+    REQUIRE_EQ(ZX_OK, status, "committing vm object contig\n");
+
+    paddr_t base_pa;
+    {
+        fbl::AutoLock a(vmo->lock());
+        status = vmo->GetContiguousRunLocked(0, alloc_size, &base_pa);
+    }
+    EXPECT_EQ(ZX_OK, status, "contiguous run\n");
+    EXPECT_TRUE(IS_ALIGNED(base_pa, large_page_size), "contiguous run is aligned\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    auto ret = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr,
+                                     large_page_shift, 0, kArchRwFlags);
+    REQUIRE_EQ(ZX_OK, ret, "mapping object");
+
+    // touch the first page, which should map the whole first large page
+    *static_cast<volatile uint8_t*>(ptr) = 0x99;
+
+    paddr_t pa;
+    vaddr_t last = reinterpret_cast<vaddr_t>(ptr) + large_page_size - PAGE_SIZE;
+    status = ka->arch_aspace().Query(last, &pa, nullptr);
+    EXPECT_EQ(ZX_OK, status, "last page of large page is mapped\n");
+    EXPECT_EQ(base_pa + large_page_size - PAGE_SIZE, pa, "last page of large page\n");
+
+    status = ka->arch_aspace().Query(last + PAGE_SIZE, &pa, nullptr);
+    EXPECT_EQ(ZX_ERR_NOT_FOUND, status, "second large page is not mapped yet\n");
+
+    // fill with known pattern and test
+    if (!fill_and_test(ptr, alloc_size))
+        all_ok = false;
+
+    auto err = ka->FreeRegion((vaddr_t)ptr);
+    EXPECT_EQ(ZX_OK, err, "unmapping object");
+    END_TEST;
+}
+
+// Faults on one page of a committed vm object and checks that the pages around
+// it are mapped as well.
+static bool vmo_fault_around_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 16;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+    uint64_t committed;
+    status = vmo->CommitRange(0, alloc_size, &committed);
+    REQUIRE_EQ(ZX_OK, status, "committing vm object\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    // align the mapping to the window so the pages it covers are predictable
+    auto ret = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr,
+                                     PAGE_SIZE_SHIFT + 2, 0, kArchRwFlags);
+    REQUIRE_EQ(ZX_OK, ret, "mapping object");
+
+    vaddr_t base = reinterpret_cast<vaddr_t>(ptr);
+    auto mapping = ka->FindRegion(base)->as_vm_mapping();
+    REQUIRE_TRUE(mapping, "finding mapping\n");
+
+    // a window of four pages
+    mapping->SetFaultAround(2, false);
+
+    // touch the sixth page, which should map the second group of four
+    static_cast<volatile uint8_t*>(ptr)[5 * PAGE_SIZE] = 0x99;
+
+    for (size_t i = 0; i < 16; i++) {
+        status = ka->arch_aspace().Query(base + i * PAGE_SIZE, nullptr, nullptr);
+        if (i >= 4 && i < 8) {
+            EXPECT_EQ(ZX_OK, status, "page in the window is mapped\n");
+        } else {
+            EXPECT_EQ(ZX_ERR_NOT_FOUND, status, "page outside the window is not mapped\n");
+        }
+    }
+
+    // fill with known pattern and test
+    if (!fill_and_test(ptr, alloc_size))
+        all_ok = false;
+
+    auto err = ka->FreeRegion(base);
+    EXPECT_EQ(ZX_OK, err, "unmapping object");
+    END_TEST;
+}
+
 // Creates a vm object, maps it, drops ref before unmapping.
 static bool vmo_dropped_ref_test(void* context) {
     BEGIN_TEST;
@@ -894,6 +1072,8 @@ UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
 VM_UNITTEST(pmm_large_alloc_test)
 VM_UNITTEST(pmm_oversized_alloc_test)
+VM_UNITTEST(pmm_zeroed_alloc_test)
+VM_UNITTEST(pmm_pcpu_cache_test)
 VM_UNITTEST(vmm_alloc_smoke_test)
 VM_UNITTEST(vmm_alloc_contiguous_smoke_test)
 VM_UNITTEST(multiple_regions_test)
@@ -911,6 +1091,8 @@ VM_UNITTEST(vmo_odd_size_commit_test)
 VM_UNITTEST(vmo_contiguous_commit_test)
 VM_UNITTEST(vmo_precommitted_map_test)
 VM_UNITTEST(vmo_demand_paged_map_test)
+VM_UNITTEST(vmo_large_page_map_test)
+VM_UNITTEST(vmo_fault_around_test)
 VM_UNITTEST(vmo_dropped_ref_test)
 VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
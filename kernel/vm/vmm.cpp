@@ -30,7 +30,7 @@
 // the older api.
 
 static inline void vmm_context_switch(VmAspace* oldspace, VmAspace* newaspace) {
-    DEBUG_ASSERT(thread_lock_held());
+    DEBUG_ASSERT(arch_ints_disabled());
 
     ArchVmAspace::ContextSwitch(oldspace ? &oldspace->arch_aspace() : nullptr,
                                 newaspace ? &newaspace->arch_aspace() : nullptr);
@@ -83,11 +83,13 @@ void vmm_set_active_aspace(vmm_aspace_t* aspace) {
     if (aspace == t->aspace)
         return;
 
-    // grab the thread lock and switch to the new address space
-    AutoThreadLock lock;
+    // keep the scheduler off this cpu and switch to the new address space
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
     vmm_aspace_t* old = t->aspace;
     t->aspace = aspace;
     vmm_context_switch(old, t->aspace);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 vmm_aspace_t* vmm_get_kernel_aspace(void) {
@@ -19,6 +19,7 @@
 #include <fs/vnode.h>
 #include <fbl/atomic.h>
 #include <fbl/intrusive_double_list.h>
+#include <fbl/mutex.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/unique_ptr.h>
 #include <fs/remote.h>
@@ -167,6 +168,10 @@ public:
                               zx_off_t len);
 
     void MountSubtree(VnodeDir* parent, fbl::RefPtr<VnodeDir> subtree);
+
+    // Guards the dnode tree. fs::Vfs runs lookup and readdir without
+    // vfs_lock_, so directory operations take this instead.
+    fbl::Mutex dnode_lock_;
 };
 
 } // namespace memfs
@@ -259,6 +259,7 @@ zx_handle_t VnodeDir::GetRemote() const { return remoter_.GetRemote(); }
 void VnodeDir::SetRemote(zx::channel remote) { return remoter_.SetRemote(fbl::move(remote)); }
 
 zx_status_t VnodeDir::Lookup(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece name) {
+    fbl::AutoLock lock(&vfs_->dnode_lock_);
     if (!IsDirectory()) {
         return ZX_ERR_NOT_FOUND;
     }
@@ -330,6 +331,7 @@ zx_status_t VnodeMemfs::Setattr(const vnattr_t* attr) {
 }
 
 zx_status_t VnodeDir::Readdir(fs::vdircookie_t* cookie, void* data, size_t len, size_t* out_actual) {
+    fbl::AutoLock lock(&vfs_->dnode_lock_);
     fs::DirentFiller df(data, len);
     if (!IsDirectory()) {
         // This WAS a directory, but it has been deleted.
@@ -344,6 +346,7 @@ zx_status_t VnodeDir::Readdir(fs::vdircookie_t* cookie, void* data, size_t len,
 
 // postcondition: reference taken on vn returned through "out"
 zx_status_t VnodeDir::Create(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece name, uint32_t mode) {
+    fbl::AutoLock lock(&vfs_->dnode_lock_);
     zx_status_t status;
     if ((status = CanCreate(name)) != ZX_OK) {
         return status;
@@ -369,6 +372,7 @@ zx_status_t VnodeDir::Create(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece name,
 }
 
 zx_status_t VnodeDir::Unlink(fbl::StringPiece name, bool must_be_dir) {
+    fbl::AutoLock lock(&vfs_->dnode_lock_);
     if (!IsDirectory()) {
         // Calling unlink from unlinked, empty directory
         return ZX_ERR_BAD_STATE;
@@ -433,6 +437,7 @@ zx_status_t VnodeDir::Rename(fbl::RefPtr<fs::Vnode> _newdir, fbl::StringPiece ol
                              fbl::StringPiece newname, bool src_must_be_dir,
                              bool dst_must_be_dir) {
     auto newdir = fbl::RefPtr<VnodeMemfs>::Downcast(fbl::move(_newdir));
+    fbl::AutoLock lock(&vfs_->dnode_lock_);
 
     if (!IsDirectory() || !newdir->IsDirectory())
         return ZX_ERR_BAD_STATE;
@@ -506,6 +511,7 @@ zx_status_t VnodeDir::Rename(fbl::RefPtr<fs::Vnode> _newdir, fbl::StringPiece ol
 
 zx_status_t VnodeDir::Link(fbl::StringPiece name, fbl::RefPtr<fs::Vnode> target) {
     auto vn = fbl::RefPtr<VnodeMemfs>::Downcast(fbl::move(target));
+    fbl::AutoLock lock(&vfs_->dnode_lock_);
 
     if (!IsDirectory()) {
         // Empty, unlinked parent
@@ -640,11 +646,13 @@ static zx_status_t memfs_create_fs(const char* name, memfs::Vfs* vfs, fbl::RefPt
 }
 
 void VnodeDir::MountSubtree(fbl::RefPtr<VnodeDir> subtree) {
+    fbl::AutoLock lock(&vfs_->dnode_lock_);
     Dnode::AddChild(dnode_, subtree->dnode_);
 }
 
 zx_status_t VnodeDir::CreateFromVmo(bool vmofile, fbl::StringPiece name,
                                     zx_handle_t vmo, zx_off_t off, zx_off_t len) {
+    fbl::AutoLock lock(&vfs_->dnode_lock_);
     zx_status_t status;
     if ((status = CanCreate(name)) != ZX_OK) {
         return status;
@@ -90,6 +90,12 @@
 #define IOCTL_VFS_GET_DEVICE_PATH \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 9)
 
+// Set up a shared-memory transport for reads and writes on this connection.
+//   in: none
+//  out: vfs_io_fifo_t
+#define IOCTL_VFS_GET_IO_FIFO \
+    IOCTL(IOCTL_KIND_GET_TWO_HANDLES, IOCTL_FAMILY_VFS, 10)
+
 typedef struct {
     zx_handle_t channel; // Channel to which watch events will be sent
     uint32_t mask;       // Bitmask of desired events (1 << WATCH_EVT_*)
@@ -172,6 +178,55 @@ IOCTL_WRAPPER_IN(ioctl_vfs_watch_dir, IOCTL_VFS_WATCH_DIR, vfs_watch_dir_t);
 // ssize_t ioctl_vfs_get_device_path(int fd, char* out, size_t out_len);
 IOCTL_WRAPPER_VAROUT(ioctl_vfs_get_device_path, IOCTL_VFS_GET_DEVICE_PATH, char);
 
+// The shared-memory I/O transport.
+//
+// The client writes requests to the FIFO, each naming a range of the data VMO
+// to read into or write from, and the server answers each one by writing the
+// same structure back with |status| and |length| filled in. Responses come
+// back in the order the requests were sent, so a client may keep up to
+// VFS_IO_FIFO_DEPTH requests in flight and match them up by position.
+//
+// A request with VFS_IO_FLAG_CONTINUE continues the one before it: if that one
+// failed or was short, this one is not performed and completes with
+// ZX_ERR_CANCELED. This lets a large READ or WRITE be pipelined as several
+// requests without the seek offset moving past a short transfer.
+//
+// A server that receives more requests than it has room to answer closes
+// the FIFO; the client should fall back to the channel protocol.
+
+#define VFS_IO_FIFO_DEPTH     16
+// No request may move more than VFS_IO_MAX_LENGTH bytes. The data area holds
+// one such slot per request that can be in flight.
+#define VFS_IO_MAX_LENGTH     (32 * 1024)
+#define VFS_IO_FIFO_DATA_SIZE (VFS_IO_FIFO_DEPTH * VFS_IO_MAX_LENGTH)
+
+// Read or write at the connection's seek offset, moving it.
+#define VFS_IO_OP_READ        1
+#define VFS_IO_OP_WRITE       2
+// Read or write at |file_offset|.
+#define VFS_IO_OP_READ_AT     3
+#define VFS_IO_OP_WRITE_AT    4
+
+#define VFS_IO_FLAG_CONTINUE  0x0001
+
+typedef struct {
+    uint32_t reqid;        // Echoed back in the response.
+    uint16_t opcode;       // VFS_IO_OP_*
+    uint16_t flags;        // VFS_IO_FLAG_*
+    zx_status_t status;    // Response only.
+    uint32_t length;       // Bytes requested; bytes transferred in the response.
+    uint64_t data_offset;  // Offset of the data in the shared VMO.
+    uint64_t file_offset;  // Used by VFS_IO_OP_READ_AT and VFS_IO_OP_WRITE_AT.
+} vfs_io_request_t;
+
+typedef struct {
+    zx_handle_t fifo;  // FIFO of vfs_io_request_t, VFS_IO_FIFO_DEPTH deep.
+    zx_handle_t vmo;   // The data area, VFS_IO_FIFO_DATA_SIZE bytes.
+} vfs_io_fifo_t;
+
+// ssize_t ioctl_vfs_get_io_fifo(int fd, vfs_io_fifo_t* out);
+IOCTL_WRAPPER_OUT(ioctl_vfs_get_io_fifo, IOCTL_VFS_GET_IO_FIFO, vfs_io_fifo_t);
+
 typedef struct {
     zx_handle_t vmo;
     char name[]; // Null-terminator required
@@ -39,6 +39,9 @@
 #define ZX_DEFAULT_LOG_RIGHTS \
     (ZX_RIGHTS_BASIC | ZX_RIGHT_WRITE | ZX_RIGHT_SIGNAL)
 
+#define ZX_DEFAULT_PAGER_RIGHTS \
+    (ZX_RIGHTS_BASIC | ZX_RIGHT_WRITE)
+
 #define ZX_DEFAULT_PCI_DEVICE_RIGHTS \
     (ZX_RIGHTS_BASIC | ZX_RIGHTS_IO)
 
@@ -56,7 +59,8 @@
     (ZX_RIGHTS_BASIC | ZX_RIGHTS_IO | ZX_RIGHT_SIGNAL)
 
 #define ZX_DEFAULT_SOCKET_RIGHTS \
-    (ZX_RIGHTS_BASIC | ZX_RIGHTS_IO | ZX_RIGHT_SIGNAL | ZX_RIGHT_SIGNAL_PEER)
+    (ZX_RIGHTS_BASIC | ZX_RIGHTS_IO | ZX_RIGHTS_PROPERTY |\
+     ZX_RIGHT_SIGNAL | ZX_RIGHT_SIGNAL_PEER)
 
 #define ZX_DEFAULT_THREAD_RIGHTS \
     (ZX_RIGHTS_BASIC | ZX_RIGHTS_IO | ZX_RIGHTS_PROPERTY |\
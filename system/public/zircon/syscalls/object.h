@@ -54,6 +54,7 @@ typedef enum {
     ZX_OBJ_TYPE_GUEST               = 20,
     ZX_OBJ_TYPE_VCPU                = 21,
     ZX_OBJ_TYPE_TIMER               = 22,
+    ZX_OBJ_TYPE_PAGER               = 23,
     ZX_OBJ_TYPE_LAST
 } zx_obj_type_t;
 
@@ -375,6 +376,10 @@ typedef struct zx_info_resource {
 // Argument is an zx_job_importance_t value.
 #define ZX_PROP_JOB_IMPORTANCE             7u
 
+// Argument is the number of bytes a socket endpoint will buffer for
+// reading before its peer stops being writable, a size_t.
+#define ZX_PROP_SOCKET_CAPACITY            8u
+
 // Describes how important a job is.
 typedef int32_t zx_job_importance_t;
 
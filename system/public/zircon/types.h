@@ -241,6 +241,12 @@ typedef uint32_t zx_rights_t;
 #define ZX_VM_FLAG_CAN_MAP_WRITE      (1u << 8)
 #define ZX_VM_FLAG_CAN_MAP_EXECUTE    (1u << 9)
 #define ZX_VM_FLAG_MAP_RANGE          (1u << 10)
+#define ZX_VM_FLAG_FAULT_AROUND_COMMIT (1u << 11)
+// Bits 12-14 hold the log2 of the fault-around window, in pages.
+#define ZX_VM_FLAG_FAULT_AROUND_SHIFT 12
+#define ZX_VM_FLAG_FAULT_AROUND_MASK  (7u << ZX_VM_FLAG_FAULT_AROUND_SHIFT)
+#define ZX_VM_FLAG_FAULT_AROUND(log2_pages) \
+    (((uint32_t)(log2_pages) << ZX_VM_FLAG_FAULT_AROUND_SHIFT) & ZX_VM_FLAG_FAULT_AROUND_MASK)
 
 // clock ids
 #define ZX_CLOCK_MONOTONIC        (0u)
@@ -283,6 +289,8 @@ typedef uint64_t zx_off_t;
 #define ZX_SOCKET_SHUTDOWN_WRITE            (1u << 0)
 #define ZX_SOCKET_SHUTDOWN_READ             (1u << 1)
 #define ZX_SOCKET_SHUTDOWN_MASK             (ZX_SOCKET_SHUTDOWN_WRITE | ZX_SOCKET_SHUTDOWN_READ)
+// ZX_SOCKET_MOVE_PAGES can also be passed to zx_socket_read().
+#define ZX_SOCKET_MOVE_PAGES                (1u << 3)
 
 // These can be passed to zx_socket_create()
 #define ZX_SOCKET_STREAM                    (0u << 0)
@@ -12,9 +12,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <fbl/alloc_checker.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/string.h>
 #include <fbl/unique_fd.h>
+#include <fbl/unique_ptr.h>
 #include <fbl/vector.h>
 #include <fs/vfs.h>
 #include <zircon/process.h>
@@ -37,10 +39,19 @@ namespace {
 #define MIN_ARGS 3
 #endif
 
+// Number of threads serving filesystem requests, unless overridden.
+constexpr uint32_t kDefaultDispatchThreads = 4;
+
 typedef struct {
     bool readonly = false;
+    uint32_t threads = kDefaultDispatchThreads;
     uint64_t data_blocks = 0;
     fbl::Vector<fbl::String> blob_list;
+#ifndef __Fuchsia__
+    // How each blob in |blob_list| is to be stored, worked out while sizing
+    // the image.
+    fbl::Vector<fbl::unique_ptr<blobstore::BlobInfo>> blob_info;
+#endif
 } blob_options_t;
 
 #ifdef __Fuchsia__
@@ -75,20 +86,28 @@ int do_blobstore_mount(fbl::unique_fd fd, const blob_options_t& options) {
     if ((status = vfs.ServeDirectory(fbl::move(vn), zx::channel(h))) != ZX_OK) {
         return status;
     }
+    // The calling thread serves requests too.
+    for (uint32_t i = 1; i < options.threads; i++) {
+        if ((status = loop.StartThread("blobstore-dispatch")) != ZX_OK) {
+            FS_TRACE_ERROR("blobstore: Could not start dispatch thread: %d\n", status);
+            break;
+        }
+    }
     loop.Run();
     return 0;
 }
 
 #else
 
-int do_blobstore_add_blob(blobstore::Blobstore* bs, const char* blob_name) {
+int do_blobstore_add_blob(blobstore::Blobstore* bs, const char* blob_name,
+                          const blobstore::BlobInfo& info) {
     fbl::unique_fd data_fd(open(blob_name, O_RDONLY, 0644));
     if (!data_fd) {
         fprintf(stderr, "error: cannot open '%s'\n", blob_name);
         return -1;
     }
     int r;
-    if ((r = blobstore::blobstore_add_blob(bs, data_fd.get())) != 0) {
+    if ((r = blobstore::blobstore_add_blob(bs, data_fd.get(), info)) != 0) {
         if (r != ZX_ERR_ALREADY_EXISTS) {
             fprintf(stderr, "blobstore: Failed to add blob '%s': %d\n", blob_name, r);
             return -1;
@@ -109,7 +128,8 @@ int do_blobstore_add_blobs(fbl::unique_fd fd, const blob_options_t& options) {
     }
 
     for (unsigned i = 0; i < options.blob_list.size(); i++) {
-        if (do_blobstore_add_blob(bs.get(), options.blob_list[i].c_str()) < 0) {
+        if (do_blobstore_add_blob(bs.get(), options.blob_list[i].c_str(),
+                                  *options.blob_info[i]) < 0) {
             return -1;
         }
     }
@@ -155,21 +175,28 @@ off_t calculate_total_size(off_t data_blocks) {
     return (data_blocks + blobstore::DataStartBlock(info)) * blobstore::kBlobstoreBlockSize;
 }
 
-off_t calculate_blob_blocks(off_t data_size) {
-    blobstore::blobstore_inode_t node;
-    node.blob_size = data_size;
-    return MerkleTreeBlocks(node) + BlobDataBlocks(node);
-}
-
 zx_status_t process_blob(char* blob_name, blob_options_t* options) {
-    struct stat s;
-    if (stat(blob_name, &s) < 0) {
-        fprintf(stderr, "Failed to stat blob %s\n", blob_name);
+    fbl::unique_fd data_fd(open(blob_name, O_RDONLY, 0644));
+    if (!data_fd) {
+        fprintf(stderr, "Failed to open blob %s\n", blob_name);
+        return ZX_ERR_IO;
+    }
+
+    // Blobs may be stored compressed, so their size alone does not tell how
+    // much space they need.
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<blobstore::BlobInfo> info(new (&ac) blobstore::BlobInfo);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    if (blobstore::blobstore_prepare_blob(data_fd.get(), info.get()) != ZX_OK) {
+        fprintf(stderr, "Failed to size blob %s\n", blob_name);
         return ZX_ERR_IO;
     }
 
-    options->data_blocks += calculate_blob_blocks(s.st_size);
+    options->data_blocks += info->blocks;
     options->blob_list.push_back(blob_name);
+    options->blob_info.push_back(fbl::move(info));
     return ZX_OK;
 }
 
@@ -261,7 +288,8 @@ int usage() {
 #ifdef __Fuchsia__
             "usage: blobstore [ <options>* ] <command> [ <arg>* ]\n"
             "\n"
-            "options: --readonly  Mount filesystem read-only\n"
+            "options: --readonly      Mount filesystem read-only\n"
+            "         --threads <n>   Serve requests on <n> threads (default 4)\n"
             "\n"
             "On Fuchsia, blobstore takes the block device argument by handle.\n"
             "This can make 'blobstore' commands hard to invoke from command line.\n"
@@ -297,6 +325,14 @@ int process_args(int argc, char** argv, CommandFunction* func, blob_options_t* o
     while (argc > 1) {
         if (!strcmp(argv[0], "--readonly")) {
             options->readonly = true;
+        } else if (!strcmp(argv[0], "--threads") && argc > 2) {
+            options->threads = static_cast<uint32_t>(strtoul(argv[1], nullptr, 10));
+            if (options->threads == 0) {
+                fprintf(stderr, "blobstore: bad thread count: %s\n", argv[1]);
+                return usage();
+            }
+            argc--;
+            argv++;
         } else {
             break;
         }
@@ -27,6 +27,7 @@ MODULE_STATIC_LIBS := \
     system/ulib/zxcpp \
     system/ulib/fbl \
     system/ulib/sync \
+    third_party/ulib/lz4 \
 
 MODULE_LIBS := \
     system/ulib/async.default \
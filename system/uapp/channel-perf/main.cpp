@@ -9,6 +9,8 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <threads.h>
 
 #include <zircon/compiler.h>
 #include <zircon/syscalls.h>
@@ -112,6 +114,105 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
            test_args.size, test_args.handles, test_args.queue, its_per_second);
 }
 
+struct CallServerArgs {
+    zx_handle_t channel;
+    uint32_t size;
+};
+
+// Answers every message on |channel| by echoing it back, which keeps its txid.
+int call_server(void* arg) {
+    __UNUSED zx_status_t status;
+    const CallServerArgs* server_args = static_cast<const CallServerArgs*>(arg);
+
+    fbl::unique_ptr<uint8_t[]> data(new uint8_t[server_args->size]);
+    for (;;) {
+        zx_signals_t pending;
+        status = zx_object_wait_one(server_args->channel,
+                                    ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                    ZX_TIME_INFINITE, &pending);
+        assert(status == ZX_OK);
+        if (!(pending & ZX_CHANNEL_READABLE))
+            break;
+
+        uint32_t r_size = 0;
+        status = zx_channel_read(server_args->channel, 0u, data.get(), nullptr,
+                                 server_args->size, 0u, &r_size, nullptr);
+        assert(status == ZX_OK);
+        status = zx_channel_write(server_args->channel, 0u, data.get(), r_size, nullptr, 0u);
+        assert(status == ZX_OK);
+    }
+
+    return 0;
+}
+
+void do_call_test(uint32_t duration, uint32_t size) {
+    __UNUSED zx_status_t status;
+
+    uint64_t duration_ns = duration * 1000000000ull;
+
+    // Every call message starts with its txid.
+    if (size < sizeof(zx_txid_t))
+        size = sizeof(zx_txid_t);
+
+    // We'll call on mp[0] and a second thread answers on mp[1].
+    zx_handle_t mp[2] = {ZX_HANDLE_INVALID, ZX_HANDLE_INVALID};
+    status = zx_channel_create(0u, &mp[0], &mp[1]);
+    assert(status == ZX_OK);
+
+    CallServerArgs server_args = {mp[1], size};
+    thrd_t server;
+    __UNUSED int ret = thrd_create(&server, call_server, &server_args);
+    assert(ret == thrd_success);
+
+    fbl::unique_ptr<uint8_t[]> wr_data(new uint8_t[size]);
+    fbl::unique_ptr<uint8_t[]> rd_data(new uint8_t[size]);
+    for (uint32_t i = 0; i < size; i++)
+        wr_data[i] = static_cast<uint8_t>(i);
+
+    zx_channel_call_args_t args = {};
+    args.wr_bytes = wr_data.get();
+    args.rd_bytes = rd_data.get();
+    args.wr_num_bytes = size;
+    args.rd_num_bytes = size;
+
+    static constexpr uint32_t big_it_size = 10000;
+    uint64_t big_its = 0;
+    uint64_t start_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        big_its++;
+        for (uint32_t i = 0; i < big_it_size; i++) {
+            zx_txid_t txid = i;
+            memcpy(wr_data.get(), &txid, sizeof(txid));
+
+            uint32_t r_size = 0;
+            uint32_t r_handles = 0;
+            status = zx_channel_call(mp[0], 0u, ZX_TIME_INFINITE, &args,
+                                     &r_size, &r_handles, nullptr);
+            assert(status == ZX_OK);
+            assert(r_size == size);
+            assert(r_handles == 0u);
+        }
+
+        end_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+
+    // Closing our end makes the server exit.
+    status = zx_handle_close(mp[0]);
+    assert(status == ZX_OK);
+    ret = thrd_join(server, nullptr);
+    assert(ret == thrd_success);
+    status = zx_handle_close(mp[1]);
+    assert(status == ZX_OK);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
+    printf("call %" PRIu32 " bytes: %.0f calls/second (%.0f ns/call)\n",
+           size, its_per_second, 1000000000.0 / its_per_second);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -122,6 +223,7 @@ int main(int argc, char** argv) {
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
         "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -c    run channel call round trip test (uses -S, ignores -H/-Q)\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
@@ -129,6 +231,7 @@ int main(int argc, char** argv) {
         "  -Q N  set message pre-queue count to N messages (default: 0)\n";
 
     bool run_suite = false;  // -o/-s
+    bool run_call = false;   // -o/-c
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
     // Ignored when running a suite:
@@ -139,7 +242,7 @@ int main(int argc, char** argv) {
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hoscn:d:S:H:Q:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -157,9 +260,15 @@ int main(int argc, char** argv) {
                 return EXIT_SUCCESS;
             case 'o':
                 run_suite = false;
+                run_call = false;
                 break;
             case 's':
                 run_suite = true;
+                run_call = false;
+                break;
+            case 'c':
+                run_call = true;
+                run_suite = false;
                 break;
             case 'n':
                 assert(optarg);
@@ -217,6 +326,8 @@ int main(int argc, char** argv) {
             };
             for (size_t i = 0; i < fbl::count_of(suite); i++)
                 do_test(duration, suite[i]);
+        } else if (run_call) {
+            do_call_test(duration, test_args.size);
         } else {
             do_test(duration, test_args);
         }
@@ -40,12 +40,15 @@ extern fbl::RefPtr<minfs::VnodeMinfs> fake_root;
 
 namespace {
 
+// Number of threads serving filesystem requests, unless overridden.
+constexpr uint32_t kDefaultDispatchThreads = 4;
+
 int do_minfs_check(fbl::unique_ptr<minfs::Bcache> bc, int argc, char** argv) {
     return minfs_check(fbl::move(bc));
 }
 
 #ifdef __Fuchsia__
-int do_minfs_mount(fbl::unique_ptr<minfs::Bcache> bc, bool readonly) {
+int do_minfs_mount(fbl::unique_ptr<minfs::Bcache> bc, bool readonly, uint32_t threads) {
     fbl::RefPtr<minfs::VnodeMinfs> vn;
     if (minfs_mount(&vn, fbl::move(bc)) < 0) {
         return -1;
@@ -64,6 +67,13 @@ int do_minfs_mount(fbl::unique_ptr<minfs::Bcache> bc, bool readonly) {
     if ((status = vfs.ServeDirectory(fbl::move(vn), zx::channel(h))) != ZX_OK) {
         return status;
     }
+    // The calling thread serves requests too.
+    for (uint32_t i = 1; i < threads; i++) {
+        if ((status = loop.StartThread("minfs-dispatch")) != ZX_OK) {
+            FS_TRACE_ERROR("minfs: Could not start dispatch thread: %d\n", status);
+            break;
+        }
+    }
     loop.Run();
     return 0;
 }
@@ -352,6 +362,7 @@ int usage() {
             "          -vv         all debug messages\n"
             "          --readonly  Mount filesystem read-only\n"
 #ifdef __Fuchsia__
+            "          --threads <n>  Serve requests on <n> threads (default 4)\n"
             "\n"
             "On Fuchsia, MinFS takes the block device argument by handle.\n"
             "This can make 'minfs' commands hard to invoke from command line.\n"
@@ -392,6 +403,7 @@ off_t get_size(int fd) {
 int main(int argc, char** argv) {
     off_t size = 0;
     bool readonly = false;
+    __UNUSED uint32_t threads = kDefaultDispatchThreads;
 
     // handle options
     while (argc > 1) {
@@ -401,6 +413,14 @@ int main(int argc, char** argv) {
             fs_trace_on(FS_TRACE_ALL);
         } else if (!strcmp(argv[1], "--readonly")) {
             readonly = true;
+        } else if (!strcmp(argv[1], "--threads") && argc > 2) {
+            threads = static_cast<uint32_t>(strtoul(argv[2], nullptr, 10));
+            if (threads == 0) {
+                fprintf(stderr, "minfs: bad thread count: %s\n", argv[2]);
+                return usage();
+            }
+            argc--;
+            argv++;
         } else {
             break;
         }
@@ -517,7 +537,7 @@ found:
 
 #ifdef __Fuchsia__
     if (!strcmp(cmd, "mount")) {
-        return do_minfs_mount(fbl::move(bc), readonly);
+        return do_minfs_mount(fbl::move(bc), readonly, threads);
     }
 #endif
 
@@ -19,6 +19,9 @@
 // The port wait key associated with the dispatcher's control messages.
 #define KEY_CONTROL (0u)
 
+// The most packets taken from the port by a single wait.
+#define MAX_BATCH_PACKETS (16u)
+
 static zx_status_t async_loop_begin_wait(async_t* async, async_wait_t* wait);
 static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait);
 static zx_status_t async_loop_post_task(async_t* async, async_task_t* task);
@@ -53,9 +56,18 @@ typedef struct async_loop {
     list_node_t task_list; // pending tasks, earliest deadline first
     list_node_t due_list; // due tasks, earliest deadline first
     list_node_t thread_list; // earliest created thread first
+
+    // Packets taken from the port by a batched wait but not yet dispatched,
+    // oldest first, in a ring starting at |pending_head|.
+    zx_port_packet_t pending[MAX_BATCH_PACKETS];
+    size_t pending_head;
+    size_t pending_count;
+    bool refilling; // true while a thread is filling |pending| from the port
 } async_loop_t;
 
 static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline);
+static zx_status_t async_loop_next_packet(async_loop_t* loop, zx_time_t deadline,
+                                          zx_port_packet_t* out_packet);
 static zx_status_t async_loop_dispatch_wait(async_loop_t* loop, async_wait_t* wait,
                                             zx_status_t status, const zx_packet_signal_t* signal);
 static zx_status_t async_loop_dispatch_tasks(async_loop_t* loop);
@@ -160,6 +172,11 @@ void async_loop_shutdown(async_t* async) {
     async_loop_wake_threads(loop);
     async_loop_join_threads(async);
 
+    // Anything still held from a batched wait is either a wait completion,
+    // whose handler is told about the shutdown below, or a packet which would
+    // have been discarded with the port anyway.
+    loop->pending_count = 0u;
+
     list_node_t* node;
     while ((node = list_remove_head(&loop->wait_list))) {
         async_wait_t* wait = node_to_wait(node);
@@ -212,7 +229,7 @@ static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline) {
         return ZX_ERR_CANCELED;
 
     zx_port_packet_t packet;
-    zx_status_t status = zx_port_wait(loop->port, deadline, &packet, 0);
+    zx_status_t status = async_loop_next_packet(loop, deadline, &packet);
     if (status != ZX_OK)
         return status;
 
@@ -244,6 +261,87 @@ static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline) {
     return ZX_ERR_INTERNAL;
 }
 
+// Gets the next packet to dispatch: one left over from an earlier batch if
+// there is one, otherwise one from the port.
+//
+// While only one thread is dispatching, it takes everything the port has ready
+// in a single call and keeps the rest for its next iterations. With several
+// threads, each waits for one packet at a time so none of them sits on work
+// that another could be doing.
+static zx_status_t async_loop_next_packet(async_loop_t* loop, zx_time_t deadline,
+                                          zx_port_packet_t* out_packet) {
+    mtx_lock(&loop->lock);
+    if (loop->pending_count) {
+        *out_packet = loop->pending[loop->pending_head];
+        loop->pending_head = (loop->pending_head + 1u) % MAX_BATCH_PACKETS;
+        loop->pending_count--;
+        mtx_unlock(&loop->lock);
+        return ZX_OK;
+    }
+    bool batch = !loop->refilling &&
+                 atomic_load_explicit(&loop->active_threads, memory_order_acquire) == 1u;
+    loop->refilling |= batch;
+    mtx_unlock(&loop->lock);
+
+    if (!batch)
+        return zx_port_wait(loop->port, deadline, out_packet, 0);
+
+    zx_port_packet_t packets[MAX_BATCH_PACKETS];
+    size_t count = 0u;
+    zx_status_t status = zx_port_wait_many(loop->port, deadline, packets,
+                                           MAX_BATCH_PACKETS, &count);
+
+    size_t wakeups = 0u;
+    mtx_lock(&loop->lock);
+    loop->refilling = false;
+    if (status == ZX_OK) {
+        ZX_DEBUG_ASSERT(count > 0u && loop->pending_count == 0u);
+        *out_packet = packets[0];
+        for (size_t i = 1u; i < count; i++) {
+            // Wake-ups are meant for whichever threads are blocked on the
+            // port, which may have joined since we started waiting; hand
+            // them back rather than holding on to them here.
+            if (packets[i].key == KEY_CONTROL && packets[i].type == ZX_PKT_TYPE_USER) {
+                wakeups++;
+                continue;
+            }
+            size_t tail = (loop->pending_head + loop->pending_count) % MAX_BATCH_PACKETS;
+            loop->pending[tail] = packets[i];
+            loop->pending_count++;
+        }
+    }
+    mtx_unlock(&loop->lock);
+
+    for (size_t i = 0u; i < wakeups; i++) {
+        zx_port_packet_t packet = {
+            .key = KEY_CONTROL,
+            .type = ZX_PKT_TYPE_USER,
+            .status = ZX_OK};
+        zx_status_t queue_status = zx_port_queue(loop->port, &packet, 0u);
+        ZX_DEBUG_ASSERT_MSG(queue_status == ZX_OK, "status=%d", queue_status);
+    }
+    return status;
+}
+
+// Removes a batched wait completion for |wait| which has not been dispatched
+// yet, returning true if there was one.
+static bool async_loop_cancel_pending_locked(async_loop_t* loop, async_wait_t* wait) {
+    bool found = false;
+    size_t kept = 0u;
+    for (size_t i = 0u; i < loop->pending_count; i++) {
+        zx_port_packet_t* packet =
+            &loop->pending[(loop->pending_head + i) % MAX_BATCH_PACKETS];
+        if (packet->key == (uintptr_t)wait && packet->type != ZX_PKT_TYPE_USER) {
+            found = true;
+            continue;
+        }
+        loop->pending[(loop->pending_head + kept) % MAX_BATCH_PACKETS] = *packet;
+        kept++;
+    }
+    loop->pending_count = kept;
+    return found;
+}
+
 static zx_status_t async_loop_dispatch_wait(async_loop_t* loop, async_wait_t* wait,
                                             zx_status_t status, const zx_packet_signal_t* signal) {
     async_loop_invoke_prologue(loop);
@@ -450,6 +548,14 @@ static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait) {
     // invoked again past this point.
     zx_status_t status = zx_port_cancel(loop->port, wait->object,
                                         (uintptr_t)wait);
+
+    // The completion may already have been taken from the port by a batched
+    // wait without having been dispatched yet.
+    mtx_lock(&loop->lock);
+    if (async_loop_cancel_pending_locked(loop, wait))
+        status = ZX_OK;
+    mtx_unlock(&loop->lock);
+
     if (status == ZX_OK && (wait->flags & ASYNC_FLAG_HANDLE_SHUTDOWN)) {
         mtx_lock(&loop->lock);
         list_delete(wait_to_node(wait));
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,6 +18,7 @@
 #include <zircon/syscalls.h>
 #include <fdio/debug.h>
 #include <fbl/alloc_checker.h>
+#include <fbl/auto_lock.h>
 #include <fbl/limits.h>
 #include <fbl/ref_ptr.h>
 
@@ -105,6 +107,19 @@ zx_status_t CheckFvmConsistency(const blobstore_info_t* info, int block_fd) {
     return ZX_OK;
 }
 
+// Marks an unused slot of the digest index.
+constexpr uint32_t kIndexSlotEmpty = UINT32_MAX;
+// The smallest digest index; it doubles whenever it becomes half full.
+constexpr size_t kIndexMinSlots = 64;
+
+// Digests are cryptographic hashes, so their leading bytes are already
+// uniformly distributed.
+size_t DigestSlot(const uint8_t* digest, size_t slots) {
+    uint64_t prefix;
+    memcpy(&prefix, digest, sizeof(prefix));
+    return static_cast<size_t>(prefix) & (slots - 1);
+}
+
 }  // namespace
 
 
@@ -112,15 +127,22 @@ blobstore_inode_t* Blobstore::GetNode(size_t index) const {
     return &reinterpret_cast<blobstore_inode_t*>(node_map_->GetData())[index];
 }
 
+void Blobstore::ReadNode(size_t index, blobstore_inode_t* out) {
+    fbl::AutoLock lock(&lock_);
+    memcpy(out, GetNode(index), sizeof(*out));
+}
+
 zx_status_t VnodeBlob::InitVmos() {
     if (blob_ != nullptr) {
         return ZX_OK;
     }
 
     zx_status_t status;
-    blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
+    blobstore_inode_t inode;
+    blobstore_->ReadNode(map_index_, &inode);
 
-    uint64_t num_blocks = BlobDataBlocks(*inode) + MerkleTreeBlocks(*inode);
+    uint64_t merkle_blocks = MerkleTreeBlocks(inode);
+    uint64_t num_blocks = BlobDataBlocks(inode) + merkle_blocks;
     if ((status = MappedVmo::Create(num_blocks * kBlobstoreBlockSize, "blob", &blob_)) != ZX_OK) {
         FS_TRACE_ERROR("Failed to initialize vmo; error: %d\n", status);
         BlobCloseHandles();
@@ -131,17 +153,174 @@ zx_status_t VnodeBlob::InitVmos() {
         BlobCloseHandles();
         return status;
     }
+    if ((status = verified_.Reset(BlobDataBlocks(inode))) != ZX_OK) {
+        BlobCloseHandles();
+        return status;
+    }
 
+    // Only the Merkle tree is read up front; it is small next to the data,
+    // which is read as it is needed.
+    if (merkle_blocks == 0) {
+        return ZX_OK;
+    }
     ReadTxn txn(blobstore_.get());
-    txn.Enqueue(vmoid_, 0, inode->start_block + DataStartBlock(blobstore_->info_),
-                BlobDataBlocks(*inode) + MerkleTreeBlocks(*inode));
-    return txn.Flush();
+    txn.Enqueue(vmoid_, 0, inode.start_block + DataStartBlock(blobstore_->info_), merkle_blocks);
+    if ((status = txn.Flush()) != ZX_OK) {
+        BlobCloseHandles();
+        return status;
+    }
+    if (inode.flags & kBlobstoreInodeFlagLZ4) {
+        if ((status = InitCompressed(inode)) != ZX_OK) {
+            BlobCloseHandles();
+            return status;
+        }
+    }
+    return ZX_OK;
+}
+
+zx_status_t VnodeBlob::InitCompressed(const blobstore_inode_t& inode) {
+    const uint64_t merkle_blocks = MerkleTreeBlocks(inode);
+    const uint64_t table_size = BlobSeekTableSize(inode);
+    if (inode.num_blocks <= merkle_blocks ||
+        table_size > (inode.num_blocks - merkle_blocks) * kBlobstoreBlockSize) {
+        FS_TRACE_ERROR("blobstore: Compressed blob is too small for its seek table\n");
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+    const uint64_t stored_size = (inode.num_blocks - merkle_blocks) * kBlobstoreBlockSize;
+
+    zx_status_t status;
+    if ((status = MappedVmo::Create(stored_size, "blob-compressed", &compressed_)) != ZX_OK) {
+        FS_TRACE_ERROR("Failed to initialize vmo; error: %d\n", status);
+        return status;
+    }
+    if ((status = blobstore_->AttachVmo(compressed_->GetVmo(), &compressed_vmoid_)) != ZX_OK) {
+        FS_TRACE_ERROR("Failed to attach VMO to block device; error: %d\n", status);
+        return status;
+    }
+
+    const uint64_t table_blocks = fbl::round_up(table_size, kBlobstoreBlockSize) /
+                                  kBlobstoreBlockSize;
+    ReadTxn txn(blobstore_.get());
+    txn.Enqueue(compressed_vmoid_, 0,
+                inode.start_block + DataStartBlock(blobstore_->info_) + merkle_blocks,
+                table_blocks);
+    if ((status = txn.Flush()) != ZX_OK) {
+        return status;
+    }
+
+    const uint64_t chunks = BlobChunks(inode);
+    fbl::AllocChecker ac;
+    fbl::Array<uint64_t> table(new (&ac) uint64_t[chunks + 1], chunks + 1);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    memcpy(table.get(), compressed_->GetData(), table_size);
+    zx_vmo_op_range(compressed_->GetVmo(), ZX_VMO_OP_DECOMMIT, 0,
+                    table_blocks * kBlobstoreBlockSize, nullptr, 0);
+
+    if ((status = CheckSeekTable(inode, table.get(), stored_size)) != ZX_OK) {
+        return status;
+    }
+    seek_table_ = fbl::move(table);
+    return ZX_OK;
+}
+
+zx_status_t VnodeBlob::LoadChunks(const blobstore_inode_t& inode, uint64_t chunk_start,
+                                  uint64_t chunk_end) {
+    // The chunks are stored back to back, so they are read with one request.
+    const uint64_t block_start = seek_table_[chunk_start] / kBlobstoreBlockSize;
+    const uint64_t block_end = fbl::round_up(seek_table_[chunk_end], kBlobstoreBlockSize) /
+                               kBlobstoreBlockSize;
+    ReadTxn txn(blobstore_.get());
+    txn.Enqueue(compressed_vmoid_, block_start,
+                inode.start_block + DataStartBlock(blobstore_->info_) +
+                MerkleTreeBlocks(inode) + block_start,
+                block_end - block_start);
+    zx_status_t status = txn.Flush();
+    if (status != ZX_OK) {
+        return status;
+    }
+
+    const uint8_t* src = static_cast<const uint8_t*>(compressed_->GetData());
+    uint8_t* dst = static_cast<uint8_t*>(GetData());
+    for (uint64_t c = chunk_start; c < chunk_end; c++) {
+        status = DecompressChunk(inode, seek_table_.get(), c, src,
+                                 dst + c * kBlobstoreChunkSize);
+        if (status != ZX_OK) {
+            break;
+        }
+    }
+
+    // The compressed copy is of no further use once expanded.
+    zx_vmo_op_range(compressed_->GetVmo(), ZX_VMO_OP_DECOMMIT,
+                    block_start * kBlobstoreBlockSize,
+                    (block_end - block_start) * kBlobstoreBlockSize, nullptr, 0);
+    return status;
+}
+
+zx_status_t VnodeBlob::LoadAndVerify(uint64_t off, uint64_t len) {
+    blobstore_inode_t inode;
+    blobstore_->ReadNode(map_index_, &inode);
+    const uint64_t start = off / kBlobstoreBlockSize;
+    const uint64_t end = fbl::round_up(off + len, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+    if (verified_.Get(start, end)) {
+        return ZX_OK;
+    }
+
+    Digest d;
+    d = ((const uint8_t*)&digest_[0]);
+    const uint64_t merkle_blocks = MerkleTreeBlocks(inode);
+    const uint64_t size_merkle = MerkleTree::GetTreeLength(inode.blob_size);
+    const uint64_t dev_start = inode.start_block + DataStartBlock(blobstore_->info_) +
+                               merkle_blocks;
+
+    // Each run of blocks which has not been verified yet is read with a single
+    // request, then checked leaf by leaf against the tree. Compressed blobs
+    // can only be read by whole chunks, so their runs are widened to match.
+    const bool compressed = inode.flags & kBlobstoreInodeFlagLZ4;
+    size_t run_start = start;
+    while ((run_start = verified_.Scan(run_start, end, true)) < end) {
+        size_t run_end = verified_.Scan(run_start, end, false);
+
+        zx_status_t status;
+        if (compressed) {
+            const uint64_t chunk_start = run_start / kBlobstoreChunkBlocks;
+            const uint64_t chunk_end = fbl::round_up(run_end, kBlobstoreChunkBlocks) /
+                                       kBlobstoreChunkBlocks;
+            run_start = chunk_start * kBlobstoreChunkBlocks;
+            run_end = fbl::min(chunk_end * kBlobstoreChunkBlocks, BlobDataBlocks(inode));
+            status = LoadChunks(inode, chunk_start, chunk_end);
+        } else {
+            ReadTxn txn(blobstore_.get());
+            txn.Enqueue(vmoid_, merkle_blocks + run_start, dev_start + run_start,
+                        run_end - run_start);
+            status = txn.Flush();
+        }
+        if (status != ZX_OK) {
+            return status;
+        }
+
+        const uint64_t run_off = run_start * kBlobstoreBlockSize;
+        const uint64_t run_len = fbl::min(run_end * kBlobstoreBlockSize, inode.blob_size) -
+                                 run_off;
+        status = MerkleTree::Verify(GetData(), inode.blob_size, GetMerkle(), size_merkle,
+                                    run_off, run_len, d);
+        if (status != ZX_OK) {
+            FS_TRACE_ERROR("blobstore: Blob failed verification at offset %" PRIu64 "\n",
+                           run_off);
+            return status;
+        }
+        verified_.Set(run_start, run_end);
+        run_start = run_end;
+    }
+    return ZX_OK;
 }
 
 uint64_t VnodeBlob::SizeData() const {
     if (GetState() == kBlobStateReadable) {
-        auto inode = blobstore_->GetNode(map_index_);
-        return inode->blob_size;
+        blobstore_inode_t inode;
+        blobstore_->ReadNode(map_index_, &inode);
+        return inode.blob_size;
     }
     return 0;
 }
@@ -159,6 +338,8 @@ VnodeBlob::VnodeBlob(fbl::RefPtr<Blobstore> bs)
 
 void VnodeBlob::BlobCloseHandles() {
     blob_ = nullptr;
+    compressed_ = nullptr;
+    seek_table_.reset();
     readable_event_.reset();
 }
 
@@ -170,6 +351,10 @@ zx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
         return ZX_ERR_BAD_STATE;
     }
 
+    // Allocation is rare relative to reads and writes, so the blobstore lock
+    // is simply held across the whole of it.
+    fbl::AutoLock lock(&blobstore_->lock_);
+
     // Find a free node, mark it as reserved.
     zx_status_t status;
     if ((status = blobstore_->AllocateNode(&map_index_)) != ZX_OK) {
@@ -181,6 +366,7 @@ zx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
     memset(inode->merkle_root_hash, 0, Digest::kLength);
     inode->blob_size = size_data;
     inode->num_blocks = MerkleTreeBlocks(*inode) + BlobDataBlocks(*inode);
+    inode->flags = 0;
 
     // Open VMOs, so we can begin writing after allocate succeeds.
     if ((status = MappedVmo::Create(inode->num_blocks * kBlobstoreBlockSize, "blob", &blob_)) != ZX_OK) {
@@ -189,6 +375,9 @@ zx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
     if ((status = blobstore_->AttachVmo(blob_->GetVmo(), &vmoid_)) != ZX_OK) {
         goto fail;
     }
+    if ((status = verified_.Reset(BlobDataBlocks(*inode))) != ZX_OK) {
+        goto fail;
+    }
 
     // Allocate space for the blob
     if ((status = blobstore_->AllocateBlocks(inode->num_blocks, &inode->start_block)) != ZX_OK) {
@@ -215,9 +404,10 @@ zx_status_t VnodeBlob::WriteShared(WriteTxn* txn, size_t start, size_t len, uint
 }
 
 void* VnodeBlob::GetData() const {
-    auto inode = blobstore_->GetNode(map_index_);
+    blobstore_inode_t inode;
+    blobstore_->ReadNode(map_index_, &inode);
     return fs::GetBlock<kBlobstoreBlockSize>(blob_->GetData(),
-                                             MerkleTreeBlocks(*inode));
+                                             MerkleTreeBlocks(inode));
 }
 
 void* VnodeBlob::GetMerkle() const {
@@ -244,6 +434,7 @@ zx_status_t VnodeBlob::WriteMetadata() {
     // This 'kBlobFlagSync' is currently not used, but it indicates when the sync is
     // complete.
     flags_ |= kBlobFlagSync;
+    fbl::AutoLock lock(&blobstore_->lock_);
     auto inode = blobstore_->GetNode(map_index_);
 
     WriteTxn txn(blobstore_.get());
@@ -258,6 +449,10 @@ zx_status_t VnodeBlob::WriteMetadata() {
 
     // Update the on-disk hash
     memcpy(inode->merkle_root_hash, &digest_[0], Digest::kLength);
+    zx_status_t status = blobstore_->IndexNode(map_index_);
+    if (status != ZX_OK) {
+        return status;
+    }
 
     // Write back the blob node
     if (blobstore_->WriteNode(&txn, map_index_)) {
@@ -276,17 +471,18 @@ zx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
     }
 
     WriteTxn txn(blobstore_.get());
-    auto inode = blobstore_->GetNode(map_index_);
-    const size_t data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
+    blobstore_inode_t inode;
+    blobstore_->ReadNode(map_index_, &inode);
+    const size_t data_start = MerkleTreeBlocks(inode) * kBlobstoreBlockSize;
     if (GetState() == kBlobStateDataWrite) {
-        size_t to_write = fbl::min(len, inode->blob_size - bytes_written_);
+        size_t to_write = fbl::min(len, inode.blob_size - bytes_written_);
         size_t offset = bytes_written_ + data_start;
         zx_status_t status = vmo_write_exact(blob_->GetVmo(), data, offset, to_write);
         if (status != ZX_OK) {
             return status;
         }
 
-        status = WriteShared(&txn, offset, len, inode->start_block);
+        status = WriteShared(&txn, offset, len, inode.start_block);
         if (status != ZX_OK) {
             SetState(kBlobStateError);
             return status;
@@ -296,19 +492,19 @@ zx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
         bytes_written_ += to_write;
 
         // More data to write.
-        if (bytes_written_ < inode->blob_size) {
+        if (bytes_written_ < inode.blob_size) {
             return ZX_OK;
         }
 
         // TODO(smklein): As an optimization, use the CreateInit/Update/Final
         // methods to create the merkle tree as we write data, rather than
         // waiting until the data is fully downloaded to create the tree.
-        size_t merkle_size = MerkleTree::GetTreeLength(inode->blob_size);
+        size_t merkle_size = MerkleTree::GetTreeLength(inode.blob_size);
         if (merkle_size > 0) {
             Digest digest;
             void* merkle_data = GetMerkle();
             const void* blob_data = GetData();
-            if (MerkleTree::Create(blob_data, inode->blob_size, merkle_data,
+            if (MerkleTree::Create(blob_data, inode.blob_size, merkle_data,
                                    merkle_size, &digest) != ZX_OK) {
                 SetState(kBlobStateError);
                 return status;
@@ -318,11 +514,15 @@ zx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
                 return status;
             }
 
-            status = WriteShared(&txn, 0, merkle_size, inode->start_block);
+            status = WriteShared(&txn, 0, merkle_size, inode.start_block);
             if (status != ZX_OK) {
                 SetState(kBlobStateError);
                 return status;
             }
+
+            // The tree was just built from the data in the VMO and matched the
+            // digest, so none of it needs to be checked again.
+            verified_.Set(0, BlobDataBlocks(inode));
         }
 
         // No more data to write. Flush to disk.
@@ -367,24 +567,18 @@ zx_status_t VnodeBlob::CopyVmo(zx_rights_t rights, zx_handle_t* out) {
     // we could fault in pages on-demand.
     //
     // For now, we aggressively verify the entire VMO up front.
-    Digest d;
-    d = ((const uint8_t*)&digest_[0]);
-    auto inode = blobstore_->GetNode(map_index_);
-    uint64_t size_merkle = MerkleTree::GetTreeLength(inode->blob_size);
-    const void* merkle_data = GetMerkle();
-    const void* blob_data = GetData();
-    status = MerkleTree::Verify(blob_data, inode->blob_size, merkle_data,
-                                size_merkle, 0, inode->blob_size, d);
-    if (status != ZX_OK) {
+    blobstore_inode_t inode;
+    blobstore_->ReadNode(map_index_, &inode);
+    if ((status = LoadAndVerify(0, inode.blob_size)) != ZX_OK) {
         return status;
     }
 
     // TODO(smklein): Only clone / verify the part of the vmo that
     // was requested.
-    const size_t data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
+    const size_t data_start = MerkleTreeBlocks(inode) * kBlobstoreBlockSize;
     zx_handle_t clone;
     if ((status = zx_vmo_clone(blob_->GetVmo(), ZX_VMO_CLONE_COPY_ON_WRITE,
-                               data_start, inode->blob_size, &clone)) != ZX_OK) {
+                               data_start, inode.blob_size, &clone)) != ZX_OK) {
         return status;
     }
 
@@ -405,31 +599,26 @@ zx_status_t VnodeBlob::ReadInternal(void* data, size_t len, size_t off, size_t*
         return status;
     }
 
-    Digest d;
-    d = ((const uint8_t*)&digest_[0]);
-    auto inode = blobstore_->GetNode(map_index_);
-    if (off >= inode->blob_size) {
+    blobstore_inode_t inode;
+    blobstore_->ReadNode(map_index_, &inode);
+    if (off >= inode.blob_size) {
         *actual = 0;
         return ZX_OK;
     }
-    if (len > (inode->blob_size - off)) {
-        len = inode->blob_size - off;
+    if (len > (inode.blob_size - off)) {
+        len = inode.blob_size - off;
     }
 
-    uint64_t size_merkle = MerkleTree::GetTreeLength(inode->blob_size);
-    const void* merkle_data = GetMerkle();
-    const void* blob_data = GetData();
-    status = MerkleTree::Verify(blob_data, inode->blob_size, merkle_data,
-                                size_merkle, off, len, d);
-    if (status != ZX_OK) {
+    if ((status = LoadAndVerify(off, len)) != ZX_OK) {
         return status;
     }
 
-    const size_t data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
+    const size_t data_start = MerkleTreeBlocks(inode) * kBlobstoreBlockSize;
     return zx_vmo_read(blob_->GetVmo(), data, data_start + off, len, actual);
 }
 
 void VnodeBlob::QueueUnlink() {
+    fbl::AutoLock lock(&lock_);
     flags_ |= kBlobFlagDeletable;
 }
 
@@ -492,10 +681,116 @@ zx_status_t Blobstore::AllocateNode(size_t* node_index_out) {
 
 // Frees a node IN MEMORY
 void Blobstore::FreeNode(size_t node_index) {
+    UnindexNode(node_index);
     memset(GetNode(node_index), 0, sizeof(blobstore_inode_t));
     info_.alloc_inode_count--;
 }
 
+zx_status_t Blobstore::BuildDigestIndex() {
+    for (size_t i = 0; i < info_.inode_count; ++i) {
+        if (GetNode(i)->start_block >= kStartBlockMinimum) {
+            zx_status_t status = IndexNode(i);
+            if (status != ZX_OK) {
+                return status;
+            }
+        }
+    }
+    return ZX_OK;
+}
+
+zx_status_t Blobstore::IndexNode(size_t node_index) {
+    ZX_DEBUG_ASSERT(node_index < kIndexSlotEmpty);
+    if ((digest_index_count_ + 1) * 2 > digest_index_.size()) {
+        zx_status_t status = ResizeDigestIndex(fbl::max(kIndexMinSlots,
+                                                        digest_index_.size() * 2));
+        if (status != ZX_OK) {
+            return status;
+        }
+    }
+
+    const size_t mask = digest_index_.size() - 1;
+    size_t slot = DigestSlot(GetNode(node_index)->merkle_root_hash, digest_index_.size());
+    while (digest_index_[slot] != kIndexSlotEmpty) {
+        slot = (slot + 1) & mask;
+    }
+    digest_index_[slot] = static_cast<uint32_t>(node_index);
+    digest_index_count_++;
+    return ZX_OK;
+}
+
+void Blobstore::UnindexNode(size_t node_index) {
+    if (digest_index_count_ == 0) {
+        return;
+    }
+
+    const size_t mask = digest_index_.size() - 1;
+    size_t hole = DigestSlot(GetNode(node_index)->merkle_root_hash, digest_index_.size());
+    while (digest_index_[hole] != node_index) {
+        if (digest_index_[hole] == kIndexSlotEmpty) {
+            // Never indexed: the blob was not completely written.
+            return;
+        }
+        hole = (hole + 1) & mask;
+    }
+
+    // Close the hole by moving back each following entry of the probe
+    // sequence which may live there, so that no lookup stops short.
+    for (size_t next = (hole + 1) & mask; digest_index_[next] != kIndexSlotEmpty;
+         next = (next + 1) & mask) {
+        size_t home = DigestSlot(GetNode(digest_index_[next])->merkle_root_hash,
+                                 digest_index_.size());
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            digest_index_[hole] = digest_index_[next];
+            hole = next;
+        }
+    }
+    digest_index_[hole] = kIndexSlotEmpty;
+    digest_index_count_--;
+}
+
+zx_status_t Blobstore::FindNode(const uint8_t* digest, size_t* node_index_out) const {
+    if (digest_index_count_ == 0) {
+        return ZX_ERR_NOT_FOUND;
+    }
+
+    const size_t mask = digest_index_.size() - 1;
+    for (size_t slot = DigestSlot(digest, digest_index_.size());
+         digest_index_[slot] != kIndexSlotEmpty; slot = (slot + 1) & mask) {
+        size_t node_index = digest_index_[slot];
+        if (memcmp(GetNode(node_index)->merkle_root_hash, digest, Digest::kLength) == 0) {
+            *node_index_out = node_index;
+            return ZX_OK;
+        }
+    }
+    return ZX_ERR_NOT_FOUND;
+}
+
+zx_status_t Blobstore::ResizeDigestIndex(size_t slots) {
+    ZX_DEBUG_ASSERT(fbl::is_pow2(slots));
+    fbl::AllocChecker ac;
+    fbl::Array<uint32_t> index(new (&ac) uint32_t[slots], slots);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    for (size_t i = 0; i < slots; ++i) {
+        index[i] = kIndexSlotEmpty;
+    }
+
+    for (size_t i = 0; i < digest_index_.size(); ++i) {
+        uint32_t node_index = digest_index_[i];
+        if (node_index == kIndexSlotEmpty) {
+            continue;
+        }
+        size_t slot = DigestSlot(GetNode(node_index)->merkle_root_hash, slots);
+        while (index[slot] != kIndexSlotEmpty) {
+            slot = (slot + 1) & (slots - 1);
+        }
+        index[slot] = node_index;
+    }
+    digest_index_ = fbl::move(index);
+    return ZX_OK;
+}
+
 zx_status_t Blobstore::Unmount() {
     // Explicitly delete this (rather than just letting the memory release when
     // the process exits) to ensure that the block device's fifo has been
@@ -525,10 +820,14 @@ zx_status_t Blobstore::WriteNode(WriteTxn* txn, size_t map_index) {
 }
 
 zx_status_t Blobstore::NewBlob(const Digest& digest, fbl::RefPtr<VnodeBlob>* out) {
+    // Declared ahead of the lock, so that a reference taken on an existing
+    // blob is dropped only once lock_ has been released.
+    fbl::RefPtr<VnodeBlob> existing;
+    fbl::AutoLock lock(&lock_);
     zx_status_t status;
     // If the blob already exists (or we're having trouble looking up the blob),
     // return an error.
-    if ((status = LookupBlob(digest, nullptr)) != ZX_ERR_NOT_FOUND) {
+    if ((status = LookupBlobLocked(digest, &existing)) != ZX_ERR_NOT_FOUND) {
         return (status == ZX_OK) ? ZX_ERR_ALREADY_EXISTS : status;
     }
 
@@ -548,16 +847,26 @@ zx_status_t Blobstore::ReleaseBlob(VnodeBlob* vn) {
     // Ex: open, alloc, disk write async start, unlink, release, disk write async end.
     // FWIW, this isn't a problem right now with synchronous writes, but it
     // would become a problem with asynchronous writes.
+    fbl::AutoLock lock(&lock_);
+
+    // LookupBlob may have already dropped a blob which was in the process of
+    // being destroyed from the map.
+    auto erase = [this, vn]() __TA_REQUIRES(lock_) {
+        if (VnodeBlob::TypeWavlTraits::node_state(*vn).InContainer()) {
+            hash_.erase(*vn);
+        }
+    };
+
     switch (vn->GetState()) {
     case kBlobStateEmpty: {
         // There are no in-memory or on-disk structures allocated.
-        hash_.erase(*vn);
+        erase();
         return ZX_OK;
     }
     case kBlobStateReadable: {
         if (!vn->DeletionQueued()) {
             // We want in-memory and on-disk data to persist.
-            hash_.erase(*vn);
+            erase();
             return ZX_OK;
         }
         // Fall-through
@@ -574,7 +883,7 @@ zx_status_t Blobstore::ReleaseBlob(VnodeBlob* vn) {
         WriteNode(&txn, node_index);
         WriteBitmap(&txn, nblocks, start_block);
         CountUpdate(&txn);
-        hash_.erase(*vn);
+        erase();
         return ZX_OK;
     }
     default: {
@@ -604,6 +913,7 @@ zx_status_t Blobstore::Readdir(fs::vdircookie_t* cookie, void* dirents, size_t l
                                size_t* out_actual) {
     fs::DirentFiller df(dirents, len);
     dircookie_t* c = reinterpret_cast<dircookie_t*>(cookie);
+    fbl::AutoLock lock(&lock_);
 
     for (size_t i = c->index; i < info_.inode_count; ++i) {
         if (GetNode(i)->start_block >= kStartBlockMinimum) {
@@ -626,39 +936,61 @@ zx_status_t Blobstore::Readdir(fs::vdircookie_t* cookie, void* dirents, size_t l
 }
 
 zx_status_t Blobstore::LookupBlob(const Digest& digest, fbl::RefPtr<VnodeBlob>* out) {
+    fbl::RefPtr<VnodeBlob> vn;
+    zx_status_t status;
+    {
+        fbl::AutoLock lock(&lock_);
+        status = LookupBlobLocked(digest, &vn);
+    }
+    if (out != nullptr) {
+        *out = fbl::move(vn);
+    }
+    return status;
+}
+
+zx_status_t Blobstore::LookupBlobLocked(const Digest& digest, fbl::RefPtr<VnodeBlob>* out) {
     // Look up blob in the fast map (is the blob open elsewhere?)
-    fbl::RefPtr<VnodeBlob> vn = fbl::RefPtr<VnodeBlob>(hash_.find(digest.AcquireBytes()).CopyPointer());
+    auto raw_vn = hash_.find(digest.AcquireBytes());
     digest.ReleaseBytes();
-    if (vn != nullptr) {
-        if (out != nullptr) {
-            *out = fbl::move(vn);
+    if (raw_vn.IsValid()) {
+        // The blob may be concurrently losing its last reference on another
+        // dispatch thread; in that case it is blocked on lock_ in ReleaseBlob.
+        // The reference goes straight to |out|, so that it is never dropped
+        // while lock_ is held.
+        *out = fbl::internal::MakeRefPtrUpgradeFromRaw(raw_vn.CopyPointer(), lock_);
+        if (*out != nullptr) {
+            return ZX_OK;
+        }
+        // Drop the dying blob from the map, so a fresh vnode may take its
+        // place. If it was queued for deletion, it is about to be released
+        // from the node map as well, so don't resurrect it below.
+        bool deleted = raw_vn->DeletionQueued();
+        hash_.erase(*raw_vn);
+        if (deleted) {
+            return ZX_ERR_NOT_FOUND;
         }
-        return ZX_OK;
     }
 
-    // Look up blob in the slow map
-    for (size_t i = 0; i < info_.inode_count; ++i) {
-        if (GetNode(i)->start_block >= kStartBlockMinimum) {
-            if (digest == GetNode(i)->merkle_root_hash) {
-                if (out != nullptr) {
-                    // Found it. Attempt to wrap the blob in a vnode.
-                    fbl::AllocChecker ac;
-                    fbl::RefPtr<VnodeBlob> vn =
-                        fbl::AdoptRef(new (&ac) VnodeBlob(fbl::RefPtr<Blobstore>(this), digest));
-                    if (!ac.check()) {
-                        return ZX_ERR_NO_MEMORY;
-                    }
-                    vn->SetState(kBlobStateReadable);
-                    vn->SetMapIndex(i);
-                    // Delay reading any data from disk until read.
-                    hash_.insert(vn.get());
-                    *out = fbl::move(vn);
-                }
-                return ZX_OK;
-            }
-        }
+    // Look up blob in the node map
+    size_t i;
+    zx_status_t status = FindNode(digest.AcquireBytes(), &i);
+    digest.ReleaseBytes();
+    if (status != ZX_OK) {
+        return status;
     }
-    return ZX_ERR_NOT_FOUND;
+    // Found it. Attempt to wrap the blob in a vnode.
+    fbl::AllocChecker ac;
+    fbl::RefPtr<VnodeBlob> vn =
+        fbl::AdoptRef(new (&ac) VnodeBlob(fbl::RefPtr<Blobstore>(this), digest));
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    vn->SetState(kBlobStateReadable);
+    vn->SetMapIndex(i);
+    // Delay reading any data from disk until read.
+    hash_.insert(vn.get());
+    *out = fbl::move(vn);
+    return ZX_OK;
 }
 
 zx_status_t Blobstore::AttachVmo(zx_handle_t vmo, vmoid_t* out) {
@@ -780,12 +1112,54 @@ Blobstore::Blobstore(fbl::unique_fd fd, const blobstore_info_t* info)
 
 Blobstore::~Blobstore() {
     if (fifo_client_ != nullptr) {
-        ioctl_block_free_txn(Fd(), &txnid_);
+        FreeAllTxnIds();
         ioctl_block_fifo_close(Fd());
         block_fifo_release_client(fifo_client_);
     }
 }
 
+txnid_t Blobstore::TxnId() {
+    thrd_t self = thrd_current();
+    fbl::AutoLock lock(&txnid_lock_);
+    for (const auto& entry : txnids_) {
+        if (thrd_equal(entry.thread, self)) {
+            return entry.txnid;
+        }
+    }
+
+    txnid_t txnid;
+    if (ioctl_block_alloc_txn(Fd(), &txnid) < 0) {
+        return TXNID_INVALID;
+    }
+    fbl::AllocChecker ac;
+    txnids_.push_back({self, txnid}, &ac);
+    if (!ac.check()) {
+        ioctl_block_free_txn(Fd(), &txnid);
+        return TXNID_INVALID;
+    }
+    return txnid;
+}
+
+void Blobstore::FreeTxnId() {
+    thrd_t self = thrd_current();
+    fbl::AutoLock lock(&txnid_lock_);
+    for (size_t i = 0; i < txnids_.size(); i++) {
+        if (thrd_equal(txnids_[i].thread, self)) {
+            ioctl_block_free_txn(Fd(), &txnids_[i].txnid);
+            txnids_.erase(i);
+            return;
+        }
+    }
+}
+
+void Blobstore::FreeAllTxnIds() {
+    fbl::AutoLock lock(&txnid_lock_);
+    for (auto& entry : txnids_) {
+        ioctl_block_free_txn(Fd(), &entry.txnid);
+    }
+    txnids_.reset();
+}
+
 zx_status_t Blobstore::Create(fbl::unique_fd fd, const blobstore_info_t* info,
                               fbl::RefPtr<Blobstore>* out) {
     zx_status_t status = blobstore_check_info(info, TotalBlocks(*info));
@@ -804,11 +1178,11 @@ zx_status_t Blobstore::Create(fbl::unique_fd fd, const blobstore_info_t* info,
     ssize_t r;
     if ((r = ioctl_block_get_fifos(fs->Fd(), &fifo)) < 0) {
         return static_cast<zx_status_t>(r);
-    } else if ((r = ioctl_block_alloc_txn(fs->Fd(), &fs->txnid_)) < 0) {
+    } else if (fs->TxnId() == TXNID_INVALID) {
         zx_handle_close(fifo);
-        return static_cast<zx_status_t>(r);
+        return ZX_ERR_NO_RESOURCES;
     } else if ((status = block_fifo_create_client(fifo, &fs->fifo_client_)) != ZX_OK) {
-        ioctl_block_free_txn(fs->Fd(), &fs->txnid_);
+        fs->FreeTxnId();
         zx_handle_close(fifo);
         return status;
     }
@@ -846,6 +1220,14 @@ zx_status_t Blobstore::Create(fbl::unique_fd fd, const blobstore_info_t* info,
         return status;
     }
 
+    {
+        fbl::AutoLock lock(&fs->lock_);
+        if ((status = fs->BuildDigestIndex()) != ZX_OK) {
+            fprintf(stderr, "blobstore: Failed to index blobs: %d\n", status);
+            return status;
+        }
+    }
+
     *out = fs;
     return ZX_OK;
 }
@@ -19,6 +19,7 @@
 #include <fbl/limits.h>
 #include <fs/block-txn.h>
 #include <fs/trace.h>
+#include <lz4/lz4.h>
 
 #define MXDEBUG 0
 
@@ -35,6 +36,46 @@ uint64_t MerkleTreeBlocks(const blobstore_inode_t& blobNode) {
     return fbl::round_up(size_merkle, kBlobstoreBlockSize) / kBlobstoreBlockSize;
 }
 
+zx_status_t CheckSeekTable(const blobstore_inode_t& blobNode, const uint64_t* table,
+                           uint64_t stored_size) {
+    // The table is only covered by the Merkle tree indirectly, through the
+    // data it leads to, so it is checked before anything relies on it.
+    if (table[0] != BlobSeekTableSize(blobNode)) {
+        FS_TRACE_ERROR("blobstore: Invalid seek table\n");
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+    const uint64_t chunks = BlobChunks(blobNode);
+    for (uint64_t c = 0; c < chunks; c++) {
+        const uint64_t raw_len = fbl::min(kBlobstoreChunkSize,
+                                          blobNode.blob_size - c * kBlobstoreChunkSize);
+        if (table[c + 1] < table[c] || table[c + 1] - table[c] > raw_len ||
+            table[c + 1] > stored_size) {
+            FS_TRACE_ERROR("blobstore: Invalid seek table\n");
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+    }
+    return ZX_OK;
+}
+
+zx_status_t DecompressChunk(const blobstore_inode_t& blobNode, const uint64_t* table,
+                            uint64_t chunk, const void* stored, void* out) {
+    const uint64_t raw_len = fbl::min(kBlobstoreChunkSize,
+                                      blobNode.blob_size - chunk * kBlobstoreChunkSize);
+    const uint64_t stored_len = table[chunk + 1] - table[chunk];
+    const char* src = static_cast<const char*>(stored) + table[chunk];
+    if (stored_len == raw_len) {
+        memcpy(out, src, raw_len);
+        return ZX_OK;
+    }
+    int actual = LZ4_decompress_safe(src, static_cast<char*>(out), static_cast<int>(stored_len),
+                                     static_cast<int>(raw_len));
+    if (actual < 0 || static_cast<uint64_t>(actual) != raw_len) {
+        FS_TRACE_ERROR("blobstore: Failed to decompress chunk %" PRIu64 "\n", chunk);
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+    return ZX_OK;
+}
+
 // Sanity check the metadata for the blobstore, given a maximum number of
 // available blocks.
 zx_status_t blobstore_check_info(const blobstore_info_t* info, uint64_t max) {
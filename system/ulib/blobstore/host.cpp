@@ -20,6 +20,7 @@
 #include <fbl/new.h>
 #include <fbl/unique_ptr.h>
 #include <fdio/debug.h>
+#include <lz4/lz4hc.h>
 
 #define MXDEBUG 0
 
@@ -34,6 +35,10 @@ namespace blobstore {
 
 #define EXTENT_COUNT 4
 
+// Compression level used for blobs added to images; they are written once and
+// read many times, so it favors size over speed.
+constexpr int kLZ4HCLevel = 9;
+
 zx_status_t readblk_offset(int fd, uint64_t bno, off_t offset, void* data) {
     off_t off = offset + bno * kBlobstoreBlockSize;
     if (lseek(fd, off, SEEK_SET) < 0) {
@@ -60,6 +65,53 @@ zx_status_t writeblk_offset(int fd, uint64_t bno, off_t offset, const void* data
     return ZX_OK;
 }
 
+// Compresses |len| bytes of |data| into |out| as described by
+// kBlobstoreInodeFlagLZ4: a seek table, followed by each chunk compressed on
+// its own, or left as it is if it does not compress. Sets |out_len| to the
+// number of bytes used.
+static zx_status_t CompressBlob(const void* data, size_t len, fbl::unique_ptr<uint8_t[]>* out,
+                                size_t* out_len) {
+    blobstore_inode_t node;
+    node.blob_size = len;
+    const uint64_t chunks = BlobChunks(node);
+    const uint64_t table_size = BlobSeekTableSize(node);
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buffer(new (&ac) uint8_t[table_size + len]);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    uint64_t* table = reinterpret_cast<uint64_t*>(buffer.get());
+    const char* src = static_cast<const char*>(data);
+    table[0] = table_size;
+    for (uint64_t c = 0; c < chunks; c++) {
+        const size_t raw_off = c * kBlobstoreChunkSize;
+        const size_t raw_len = fbl::min(kBlobstoreChunkSize, len - raw_off);
+        char* dst = reinterpret_cast<char*>(buffer.get() + table[c]);
+
+        // Compressed chunks must come out strictly smaller than the original,
+        // which is what tells the two apart when reading.
+        int actual = LZ4_compress_HC(src + raw_off, dst, static_cast<int>(raw_len),
+                                     static_cast<int>(raw_len - 1), kLZ4HCLevel);
+        if (actual <= 0) {
+            memcpy(dst, src + raw_off, raw_len);
+            actual = static_cast<int>(raw_len);
+        }
+        table[c + 1] = table[c] + actual;
+    }
+
+    *out = fbl::move(buffer);
+    *out_len = table[chunks];
+    return ZX_OK;
+}
+
+// Only compress blobs when it saves at least a block.
+static bool ShouldCompress(size_t blob_size, size_t compressed_size) {
+    return fbl::round_up(compressed_size, kBlobstoreBlockSize) <
+           fbl::round_up(blob_size, kBlobstoreBlockSize);
+}
+
 zx_status_t blobstore_create(fbl::RefPtr<Blobstore>* out, fbl::unique_fd fd) {
     info_block_t info_block;
 
@@ -147,29 +199,52 @@ zx_status_t blobstore_create_sparse(fbl::RefPtr<Blobstore>* out, fbl::unique_fd
     return ZX_OK;
 }
 
-zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd) {
-    // Mmap user-provided file, create the corresponding merkle tree
-    struct stat s;
-    if (fstat(data_fd, &s) < 0) {
-        return ZX_ERR_BAD_STATE;
+// Works out how the |len| bytes at |data| are to be stored.
+static zx_status_t PrepareBlob(const void* data, size_t len, BlobInfo* out) {
+    blobstore_inode_t node;
+    node.blob_size = len;
+    out->blocks = MerkleTreeBlocks(node) + BlobDataBlocks(node);
+    out->compressed.reset();
+    out->compressed_size = 0;
+    if (len == 0) {
+        return ZX_OK;
     }
-    void* blob_data = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, data_fd, 0);
-    if (blob_data == nullptr) {
-        return ZX_ERR_BAD_STATE;
+
+    zx_status_t status;
+    fbl::unique_ptr<uint8_t[]> compressed;
+    size_t compressed_size;
+    if ((status = CompressBlob(data, len, &compressed, &compressed_size)) != ZX_OK) {
+        return status;
+    }
+    if (!ShouldCompress(len, compressed_size)) {
+        return ZX_OK;
     }
 
-    auto auto_unmap = fbl::MakeAutoCall([blob_data, s]() {
-        munmap(blob_data, s.st_size);
-    });
+    // The compression buffer is sized for the uncompressed blob, and is kept
+    // until the blob is added, so only hold on to what was used.
+    fbl::AllocChecker ac;
+    out->compressed.reset(new (&ac) uint8_t[compressed_size]);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    memcpy(out->compressed.get(), compressed.get(), compressed_size);
+    out->compressed_size = compressed_size;
+    out->blocks = MerkleTreeBlocks(node) +
+                  fbl::round_up(compressed_size, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+    return ZX_OK;
+}
 
+static zx_status_t AddBlob(Blobstore* bs, const void* blob_data, size_t blob_size,
+                           const BlobInfo& info) {
+    // Create the corresponding merkle tree
     zx_status_t status;
     digest::Digest digest;
     fbl::AllocChecker ac;
-    size_t merkle_size = MerkleTree::GetTreeLength(s.st_size);
+    size_t merkle_size = MerkleTree::GetTreeLength(blob_size);
     auto merkle_tree = fbl::unique_ptr<uint8_t[]>(new (&ac) uint8_t[merkle_size]);
     if (!ac.check()) {
         return ZX_ERR_NO_MEMORY;
-    } else if ((status = MerkleTree::Create(blob_data, s.st_size, merkle_tree.get(),
+    } else if ((status = MerkleTree::Create(blob_data, blob_size, merkle_tree.get(),
                                   merkle_size, &digest)) != ZX_OK) {
         return status;
     }
@@ -183,14 +258,21 @@ zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd) {
         return ZX_ERR_NO_RESOURCES;
     }
 
-    inode_block->SetSize(s.st_size);
+    const void* data = blob_data;
+    size_t data_size = blob_size;
+    inode_block->SetSize(blob_size);
+    if (info.compressed != nullptr) {
+        inode_block->SetCompressedSize(info.compressed_size);
+        data = info.compressed.get();
+        data_size = info.compressed_size;
+    }
     blobstore_inode_t* inode = inode_block->GetInode();
 
     if ((status = bs->AllocateBlocks(inode->num_blocks,
                                      reinterpret_cast<size_t*>(&inode->start_block))) != ZX_OK) {
         fprintf(stderr, "error: No blocks available\n");
         return status;
-    } else if ((status = bs->WriteData(inode, merkle_tree.get(), blob_data)) != ZX_OK) {
+    } else if ((status = bs->WriteData(inode, merkle_tree.get(), data, data_size)) != ZX_OK) {
         return status;
     } else if ((status = bs->WriteBitmap(inode->num_blocks, inode->start_block)) != ZX_OK) {
         return status;
@@ -203,6 +285,66 @@ zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd) {
     return ZX_OK;
 }
 
+zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd) {
+    // Mmap user-provided file
+    struct stat s;
+    if (fstat(data_fd, &s) < 0) {
+        return ZX_ERR_BAD_STATE;
+    }
+    void* blob_data = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, data_fd, 0);
+    if (blob_data == nullptr) {
+        return ZX_ERR_BAD_STATE;
+    }
+
+    auto auto_unmap = fbl::MakeAutoCall([blob_data, s]() {
+        munmap(blob_data, s.st_size);
+    });
+
+    zx_status_t status;
+    BlobInfo info;
+    if ((status = PrepareBlob(blob_data, s.st_size, &info)) != ZX_OK) {
+        return status;
+    }
+    return AddBlob(bs, blob_data, s.st_size, info);
+}
+
+zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd, const BlobInfo& info) {
+    struct stat s;
+    if (fstat(data_fd, &s) < 0) {
+        return ZX_ERR_BAD_STATE;
+    }
+    void* blob_data = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, data_fd, 0);
+    if (blob_data == nullptr) {
+        return ZX_ERR_BAD_STATE;
+    }
+
+    auto auto_unmap = fbl::MakeAutoCall([blob_data, s]() {
+        munmap(blob_data, s.st_size);
+    });
+
+    return AddBlob(bs, blob_data, s.st_size, info);
+}
+
+zx_status_t blobstore_prepare_blob(int data_fd, BlobInfo* out) {
+    struct stat s;
+    if (fstat(data_fd, &s) < 0) {
+        return ZX_ERR_BAD_STATE;
+    }
+    if (s.st_size == 0) {
+        return PrepareBlob(nullptr, 0, out);
+    }
+
+    void* blob_data = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, data_fd, 0);
+    if (blob_data == MAP_FAILED) {
+        return ZX_ERR_BAD_STATE;
+    }
+    auto auto_unmap = fbl::MakeAutoCall([blob_data, s]() {
+        munmap(blob_data, s.st_size);
+    });
+
+    return PrepareBlob(blob_data, s.st_size, out);
+}
+
 zx_status_t blobstore_fsck(fbl::unique_fd fd, off_t start, off_t end,
                    const fbl::Vector<size_t>& extent_lengths) {
     fbl::RefPtr<Blobstore> blob;
@@ -219,6 +361,13 @@ zx_status_t blobstore_fsck(fbl::unique_fd fd, off_t start, off_t end,
 void InodeBlock::SetSize(size_t size) {
     inode_->blob_size = size;
     inode_->num_blocks = MerkleTreeBlocks(*inode_) + BlobDataBlocks(*inode_);
+    inode_->flags = 0;
+}
+
+void InodeBlock::SetCompressedSize(size_t compressed_size) {
+    inode_->flags |= kBlobstoreInodeFlagLZ4;
+    inode_->num_blocks = MerkleTreeBlocks(*inode_) +
+                         fbl::round_up(compressed_size, kBlobstoreBlockSize) / kBlobstoreBlockSize;
 }
 
 Blobstore::Blobstore(fbl::unique_fd fd, off_t offset, const info_block_t& info_block,
@@ -381,7 +530,8 @@ zx_status_t Blobstore::WriteNode(fbl::unique_ptr<InodeBlock> ino_block) {
     return WriteBlock(cache_.bno, cache_.blk);
 }
 
-zx_status_t Blobstore::WriteData(blobstore_inode_t* inode, void* merkle_data, void* blob_data) {
+zx_status_t Blobstore::WriteData(blobstore_inode_t* inode, const void* merkle_data,
+                                 const void* blob_data, size_t blob_len) {
     for (size_t n = 0; n < MerkleTreeBlocks(*inode); n++) {
         const void* data = fs::GetBlock<kBlobstoreBlockSize>(merkle_data, n);
         uint64_t bno = data_start_block_ + inode->start_block + n;
@@ -391,17 +541,18 @@ zx_status_t Blobstore::WriteData(blobstore_inode_t* inode, void* merkle_data, vo
         }
     }
 
-    for (size_t n = 0; n < BlobDataBlocks(*inode); n++) {
+    const size_t data_blocks = fbl::round_up(blob_len, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+    for (size_t n = 0; n < data_blocks; n++) {
         const void* data = fs::GetBlock<kBlobstoreBlockSize>(blob_data, n);
 
         // If we try to write a block, will it be reaching beyond the end of the
         // mapped file?
         size_t off = n * kBlobstoreBlockSize;
         uint8_t last_data[kBlobstoreBlockSize];
-        if (inode->blob_size < off + kBlobstoreBlockSize) {
+        if (blob_len < off + kBlobstoreBlockSize) {
             // Read the partial block from a block-sized buffer which zero-pads the data.
             memset(last_data, 0, kBlobstoreBlockSize);
-            memcpy(last_data, data, inode->blob_size - off);
+            memcpy(last_data, data, blob_len - off);
             data = last_data;
         }
 
@@ -14,19 +14,24 @@
 #include <bitmap/raw-bitmap.h>
 #include <digest/digest.h>
 #include <fbl/algorithm.h>
+#include <fbl/array.h>
+#include <fbl/auto_lock.h>
 #include <fbl/intrusive_double_list.h>
 #include <fbl/intrusive_wavl_tree.h>
 #include <fbl/macros.h>
+#include <fbl/mutex.h>
 #include <fbl/ref_counted.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/unique_fd.h>
 #include <fbl/unique_ptr.h>
+#include <fbl/vector.h>
 #include <fs/block-txn.h>
 #include <fs/trace.h>
 #include <fs/vfs.h>
 #include <fs/vnode.h>
 
 #include <string.h>
+#include <threads.h>
 
 #include <block-client/client.h>
 #include <fs/mapped-vmo.h>
@@ -125,23 +130,24 @@ private:
     //
     // Returns "ZX_OK" if blob is already readable.
     // Otherwise, returns size of the handle.
-    zx_status_t GetReadableEvent(zx_handle_t* out);
+    zx_status_t GetReadableEvent(zx_handle_t* out) __TA_REQUIRES(lock_);
 
-    zx_status_t CopyVmo(zx_rights_t rights, zx_handle_t* out);
+    zx_status_t CopyVmo(zx_rights_t rights, zx_handle_t* out) __TA_REQUIRES(lock_);
 
     void QueueUnlink();
 
     // If successful, allocates Blob Node and Blocks (in-memory)
     // kBlobStateEmpty --> kBlobStateDataWrite
-    zx_status_t SpaceAllocate(uint64_t size_data);
+    zx_status_t SpaceAllocate(uint64_t size_data) __TA_REQUIRES(lock_);
 
     // Writes to either the Merkle Tree or the Data section,
     // depending on the state.
-    zx_status_t WriteInternal(const void* data, size_t len, size_t* actual);
+    zx_status_t WriteInternal(const void* data, size_t len, size_t* actual) __TA_REQUIRES(lock_);
 
     // Reads from a blob.
     // Requires: kBlobStateReadable
-    zx_status_t ReadInternal(void* data, size_t len, size_t off, size_t* actual);
+    zx_status_t ReadInternal(void* data, size_t len, size_t off, size_t* actual)
+        __TA_REQUIRES(lock_);
 
     // Vnode I/O operations
     zx_status_t GetHandles(uint32_t flags, zx_handle_t* hnds, size_t* hcount, uint32_t* type,
@@ -163,18 +169,34 @@ private:
     zx_status_t Mmap(int flags, size_t len, size_t* off, zx_handle_t* out) final;
     zx_status_t Sync() final;
 
-    // Read both VMOs into memory, if we haven't already.
+    // Creates the blob's VMO and reads the Merkle tree into it, if we haven't
+    // already. The data itself is read by LoadAndVerify().
     //
     // TODO(smklein): When we have can register the Blob Store as a pager
     // service, and it can properly handle pages faults on a vnode's contents,
-    // then we can avoid reading the entire blob up-front. Until then, read
-    // the contents of a VMO into memory when it is opened.
-    zx_status_t InitVmos();
-
-    zx_status_t WriteShared(WriteTxn* txn, size_t start, size_t len, uint64_t start_block);
+    // then data can be read when it is first touched through a mapping too.
+    // Until then, cloning the VMO loads and verifies the whole blob.
+    zx_status_t InitVmos() __TA_REQUIRES(lock_);
+
+    // Reads the blocks of data covering [off, off + len) into the VMO and
+    // verifies them against the Merkle tree, unless they already have been.
+    zx_status_t LoadAndVerify(uint64_t off, uint64_t len) __TA_REQUIRES(lock_);
+
+    // Reads and checks the seek table of a compressed blob, and creates the
+    // VMO its compressed data is read into.
+    zx_status_t InitCompressed(const blobstore_inode_t& inode) __TA_REQUIRES(lock_);
+
+    // Reads chunks [chunk_start, chunk_end) of a compressed blob and
+    // decompresses them into the data section of blob_. They still need to be
+    // verified.
+    zx_status_t LoadChunks(const blobstore_inode_t& inode, uint64_t chunk_start,
+                           uint64_t chunk_end) __TA_REQUIRES(lock_);
+
+    zx_status_t WriteShared(WriteTxn* txn, size_t start, size_t len, uint64_t start_block)
+        __TA_REQUIRES(lock_);
     // Called by Blob once the last write has completed, updating the
     // on-disk metadata.
-    zx_status_t WriteMetadata();
+    zx_status_t WriteMetadata() __TA_REQUIRES(lock_);
 
     // Acquire a pointer to the mapped data or merkle tree
     void* GetData() const;
@@ -183,6 +205,10 @@ private:
     WAVLTreeNodeState type_wavl_state_{};
 
     const fbl::RefPtr<Blobstore> blobstore_;
+
+    // Serializes operations on this blob between dispatch threads.
+    // Acquired before Blobstore::lock_.
+    fbl::Mutex lock_;
     BlobFlags flags_{};
 
     // The blob_ here consists of:
@@ -191,6 +217,17 @@ private:
     fbl::unique_ptr<MappedVmo> blob_{};
     vmoid_t vmoid_{};
 
+    // One bit per block of data, set once the block has been read into blob_
+    // and checked against the Merkle tree.
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> verified_{};
+
+    // Only used by compressed blobs: compressed_ holds the data blocks as they
+    // are on disk, which are dropped again once decompressed into blob_, and
+    // seek_table_ the offset of each chunk within them.
+    fbl::unique_ptr<MappedVmo> compressed_{};
+    vmoid_t compressed_vmoid_{};
+    fbl::Array<uint64_t> seek_table_{};
+
     zx::event readable_event_{};
     uint64_t bytes_written_{};
     uint8_t digest_[Digest::kLength]{};
@@ -252,18 +289,30 @@ public:
     zx_status_t Txn(block_fifo_request_t* requests, size_t count) {
         return block_fifo_txn(fifo_client_, requests, count);
     }
-    txnid_t TxnId() const { return txnid_; }
+
+    // Returns the calling thread's TxnId for sending messages over the block
+    // I/O FIFO, allocating one the first time the thread asks. Returns
+    // TXNID_INVALID if the device has none left.
+    txnid_t TxnId();
+
+    // Frees the calling thread's TxnId, if it has one. Ids still held by
+    // dispatch threads are freed when the Blobstore is destroyed.
+    void FreeTxnId();
 
     // If possible, attempt to resize the blobstore partition.
     // Add one additional slice for inodes.
-    zx_status_t AddInodes();
+    zx_status_t AddInodes() __TA_REQUIRES(lock_);
     // Add enough slices required to hold nblocks additional blocks.
-    zx_status_t AddBlocks(size_t nblocks);
+    zx_status_t AddBlocks(size_t nblocks) __TA_REQUIRES(lock_);
 
     int Fd() const {
         return blockfd_.get();
     }
 
+    // Guards the blob map, the allocation bitmaps, the node map and info_,
+    // and serializes writing them back to disk. Requests are dispatched on
+    // multiple threads, so this must be held to touch any of them.
+    fbl::Mutex lock_;
     blobstore_info_t info_;
 
 private:
@@ -272,26 +321,50 @@ private:
     Blobstore(fbl::unique_fd fd, const blobstore_info_t* info);
     zx_status_t LoadBitmaps();
 
+    // Implementation of LookupBlob. |out| must not be null. Dropping the
+    // last reference to a blob takes lock_, so the caller must not release
+    // what it receives in |out| until lock_ is released.
+    zx_status_t LookupBlobLocked(const Digest& digest, fbl::RefPtr<VnodeBlob>* out)
+        __TA_REQUIRES(lock_);
+
     // Finds space for a block in memory. Does not update disk.
-    zx_status_t AllocateBlocks(size_t nblocks, size_t* blkno_out);
-    void FreeBlocks(size_t nblocks, size_t blkno);
+    zx_status_t AllocateBlocks(size_t nblocks, size_t* blkno_out) __TA_REQUIRES(lock_);
+    void FreeBlocks(size_t nblocks, size_t blkno) __TA_REQUIRES(lock_);
 
     // Finds space for a blob node in memory. Does not update disk.
-    zx_status_t AllocateNode(size_t* node_index_out);
-    void FreeNode(size_t node_index);
+    zx_status_t AllocateNode(size_t* node_index_out) __TA_REQUIRES(lock_);
+    void FreeNode(size_t node_index) __TA_REQUIRES(lock_);
 
-    // Access the nth inode of the node map
+    // Access the nth inode of the node map.
+    // The node map may be remapped when it grows, so the returned pointer is
+    // only valid while lock_ is held (or while no other thread can run).
     blobstore_inode_t* GetNode(size_t index) const;
 
+    // Copies the nth inode of the node map into |out|.
+    void ReadNode(size_t index, blobstore_inode_t* out) __TA_EXCLUDES(lock_);
+
     // Given a contiguous number of blocks after a starting block,
     // write out the bitmap to disk for the corresponding blocks.
-    zx_status_t WriteBitmap(WriteTxn* txn, uint64_t nblocks, uint64_t start_block);
+    zx_status_t WriteBitmap(WriteTxn* txn, uint64_t nblocks, uint64_t start_block)
+        __TA_REQUIRES(lock_);
 
     // Given a node within the node map at an index, write it to disk.
-    zx_status_t WriteNode(WriteTxn* txn, size_t map_index);
+    zx_status_t WriteNode(WriteTxn* txn, size_t map_index) __TA_REQUIRES(lock_);
 
     // Enqueues an update for allocated inode/block counts
-    zx_status_t CountUpdate(WriteTxn* txn);
+    zx_status_t CountUpdate(WriteTxn* txn) __TA_REQUIRES(lock_);
+
+    // Adds every allocated node of the node map to the digest index.
+    zx_status_t BuildDigestIndex() __TA_REQUIRES(lock_);
+    // Adds the nth node to the digest index, under its merkle_root_hash.
+    zx_status_t IndexNode(size_t node_index) __TA_REQUIRES(lock_);
+    // Removes the nth node from the digest index, if it is there. Must be
+    // called before its merkle_root_hash changes.
+    void UnindexNode(size_t node_index) __TA_REQUIRES(lock_);
+    // Finds the node of the blob named by |digest| in the digest index.
+    zx_status_t FindNode(const uint8_t* digest, size_t* node_index_out) const
+        __TA_REQUIRES(lock_);
+    zx_status_t ResizeDigestIndex(size_t slots) __TA_REQUIRES(lock_);
 
     // VnodeBlobs exist in the WAVLTree as long as one or more reference exists;
     // when the Vnode is deleted, it is immediately removed from the WAVL tree.
@@ -299,11 +372,28 @@ private:
                                             VnodeBlob*,
                                             MerkleRootTraits,
                                             VnodeBlob::TypeWavlTraits>;
-    WAVLTreeByMerkle hash_{}; // Map of all 'in use' blobs
+    WAVLTreeByMerkle hash_ __TA_GUARDED(lock_){}; // Map of all 'in use' blobs
+
+    // Maps the merkle root of every blob in the node map to its node, so that
+    // blobs which are not open can be found without scanning the node map.
+    // This is an open-addressed table of node indices, probed linearly from a
+    // slot chosen by the leading bytes of the digest. It is rebuilt at mount.
+    fbl::Array<uint32_t> digest_index_ __TA_GUARDED(lock_){};
+    size_t digest_index_count_ __TA_GUARDED(lock_){};
+
+    // Frees every TxnId handed out by TxnId().
+    void FreeAllTxnIds();
+
+    struct ThreadTxnId {
+        thrd_t thread;
+        txnid_t txnid;
+    };
+    // TxnIds of the threads which have sent requests for this Blobstore.
+    fbl::Mutex txnid_lock_;
+    fbl::Vector<ThreadTxnId> txnids_ __TA_GUARDED(txnid_lock_);
 
     fbl::unique_fd blockfd_;
     fifo_client_t* fifo_client_{};
-    txnid_t txnid_{};
     RawBitmap block_map_{};
     vmoid_t block_map_vmoid_{};
     fbl::unique_ptr<MappedVmo> node_map_{};
@@ -40,6 +40,15 @@ int blobstore_mkfs(int fd, uint64_t block_count);
 
 uint64_t MerkleTreeBlocks(const blobstore_inode_t& blobNode);
 
+// Checks the seek table of a compressed blob, whose data blocks hold
+// |stored_size| bytes. |table| holds BlobChunks(blobNode) + 1 offsets.
+zx_status_t CheckSeekTable(const blobstore_inode_t& blobNode, const uint64_t* table,
+                           uint64_t stored_size);
+// Expands chunk |chunk| of a compressed blob, whose data blocks are at
+// |stored| and whose checked seek table is |table|, into |out|.
+zx_status_t DecompressChunk(const blobstore_inode_t& blobNode, const uint64_t* table,
+                            uint64_t chunk, const void* stored, void* out);
+
 // Get a pointer to the nth block of the bitmap.
 inline void* get_raw_bitmap_data(const RawBitmap& bm, uint64_t n) {
     assert(n * kBlobstoreBlockSize < bm.size());                  // Accessing beyond end of bitmap
@@ -23,7 +23,7 @@ namespace blobstore {
 
 constexpr uint64_t kBlobstoreMagic0  = (0xac2153479e694d21ULL);
 constexpr uint64_t kBlobstoreMagic1  = (0x985000d4d4d3d314ULL);
-constexpr uint32_t kBlobstoreVersion = 0x00000004;
+constexpr uint32_t kBlobstoreVersion = 0x00000005;
 
 constexpr uint32_t kBlobstoreFlagClean      = 1;
 constexpr uint32_t kBlobstoreFlagDirty      = 2;
@@ -114,17 +114,45 @@ typedef struct {
     uint64_t start_block;
     uint64_t num_blocks;
     uint64_t blob_size;
-    uint64_t reserved;
+    uint32_t flags;
+    uint32_t reserved;
 } blobstore_inode_t;
 
+// Flags of blobstore_inode_t:
+constexpr uint32_t kBlobstoreInodeFlagLZ4 = 1; // Data is stored as LZ4-compressed chunks
+
+// A compressed blob is split into chunks of this many bytes of its
+// uncompressed data (the last one may be shorter), and each chunk is
+// compressed on its own so that it can be read without the others.
+//
+// On disk, the Merkle tree of a compressed blob still covers its uncompressed
+// data. The data blocks begin with a seek table of (chunks + 1) uint64_t
+// byte offsets from the start of the data blocks: chunk n occupies
+// [table[n], table[n + 1]), and table[0] is the size of the table itself. A
+// chunk which is as long as its uncompressed data is stored uncompressed.
+constexpr uint64_t kBlobstoreChunkSize   = 32768;
+constexpr uint64_t kBlobstoreChunkBlocks = kBlobstoreChunkSize / kBlobstoreBlockSize;
+static_assert(kBlobstoreChunkSize % kBlobstoreBlockSize == 0,
+              "Blobstore chunks should be made of whole blocks");
+
 static_assert(sizeof(blobstore_inode_t) == kBlobstoreInodeSize,
               "Blobstore Inode size is wrong");
 static_assert(kBlobstoreBlockSize % kBlobstoreInodeSize == 0,
               "Blobstore Inodes should fit cleanly within a blobstore block");
 
-// Number of blocks reserved for the blob itself
+// Number of blocks reserved for the blob itself, uncompressed
 constexpr uint64_t BlobDataBlocks(const blobstore_inode_t& blobNode) {
     return fbl::round_up(blobNode.blob_size, kBlobstoreBlockSize) / kBlobstoreBlockSize;
 }
 
+// Number of chunks of a compressed blob
+constexpr uint64_t BlobChunks(const blobstore_inode_t& blobNode) {
+    return fbl::round_up(blobNode.blob_size, kBlobstoreChunkSize) / kBlobstoreChunkSize;
+}
+
+// Size of the seek table of a compressed blob, in bytes
+constexpr uint64_t BlobSeekTableSize(const blobstore_inode_t& blobNode) {
+    return (BlobChunks(blobNode) + 1) * sizeof(uint64_t);
+}
+
 } // namespace blobstore
@@ -19,6 +19,7 @@
 #include <fbl/ref_ptr.h>
 #include <fbl/unique_fd.h>
 #include <fbl/unique_free_ptr.h>
+#include <fbl/unique_ptr.h>
 #include <fbl/vector.h>
 #include <zircon/types.h>
 
@@ -56,6 +57,10 @@ public:
 
     void SetSize(size_t size);
 
+    // Marks the blob as stored compressed, in |compressed_size| bytes.
+    // Must follow SetSize().
+    void SetCompressedSize(size_t compressed_size);
+
 private:
     size_t bno_;
     blobstore_inode_t* inode_;
@@ -79,7 +84,10 @@ public:
     // Allocate |nblocks| starting at |*blkno_out| in memory
     zx_status_t AllocateBlocks(size_t nblocks, size_t* blkno_out);
 
-    zx_status_t WriteData(blobstore_inode_t* inode, void* merkle_data, void* blob_data);
+    // Writes the Merkle tree of |inode|, followed by the |blob_len| bytes of
+    // |blob_data| as they are to be stored (compressed or not).
+    zx_status_t WriteData(blobstore_inode_t* inode, const void* merkle_data,
+                          const void* blob_data, size_t blob_len);
     zx_status_t WriteBitmap(size_t nblocks, size_t start_block);
     zx_status_t WriteNode(fbl::unique_ptr<InodeBlock> ino_block);
     zx_status_t WriteInfo();
@@ -133,7 +141,21 @@ private:
 };
 
 zx_status_t blobstore_create(fbl::RefPtr<Blobstore>* out, fbl::unique_fd blockfd);
+// How a blob is stored once added to an image. Compressing a blob is most of
+// the work of adding it, and sizing an image already has to do it, so the
+// result is kept and handed back to blobstore_add_blob().
+struct BlobInfo {
+    // Number of blocks the blob takes up in an image.
+    uint64_t blocks = 0;
+    // The blob's compressed form, or null if it is stored as it is.
+    fbl::unique_ptr<uint8_t[]> compressed;
+    size_t compressed_size = 0;
+};
+
 zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd);
+// Adds the blob in |data_fd|, which |info| was prepared from.
+zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd, const BlobInfo& info);
+zx_status_t blobstore_prepare_blob(int data_fd, BlobInfo* out);
 zx_status_t blobstore_fsck(fbl::unique_fd fd, off_t start, off_t end,
                            const fbl::Vector<size_t>& extent_lengths);
 
@@ -8,6 +8,7 @@
 #include <string.h>
 #include <threads.h>
 
+#include <fbl/auto_lock.h>
 #include <fs/vfs.h>
 
 #include <fdio/io.h>
@@ -26,6 +27,7 @@ namespace blobstore {
 zx_status_t VnodeBlob::GetHandles(uint32_t flags, zx_handle_t* hnds, size_t* hcount,
                                   uint32_t* type, void* extra, uint32_t* esize) {
     *type = FDIO_PROTOCOL_REMOTE;
+    fbl::AutoLock lock(&lock_);
     if (IsDirectory()) {
         *hcount = 0;
         return ZX_OK;
@@ -32,6 +32,7 @@ MODULE_STATIC_LIBS := \
     system/ulib/zxcpp \
     system/ulib/fbl \
     system/ulib/sync \
+    third_party/ulib/lz4 \
 
 MODULE_LIBS := \
     system/ulib/async.default \
@@ -51,6 +52,8 @@ MODULE_TYPE := hostlib
 MODULE_SRCS := \
     $(COMMON_SRCS) \
     $(LOCAL_DIR)/host.cpp \
+    third_party/ulib/lz4/lz4.c \
+    third_party/ulib/lz4/lz4hc.c \
 
 MODULE_COMPILEFLAGS := \
     -Werror-implicit-function-declaration \
@@ -61,6 +64,8 @@ MODULE_COMPILEFLAGS := \
     -Isystem/ulib/fs/include \
     -Isystem/ulib/fdio/include \
     -Isystem/ulib/bitmap/include \
+    -Ithird_party/ulib/lz4/include \
+    -Ithird_party/ulib/lz4/include/lz4 \
 
 MODULE_DEFINES := DISABLE_THREAD_ANNOTATIONS
 
@@ -18,6 +18,7 @@
 #include <zircon/syscalls.h>
 #include <fdio/debug.h>
 #include <fdio/vfs.h>
+#include <fbl/auto_lock.h>
 #include <fbl/ref_ptr.h>
 
 #define MXDEBUG 0
@@ -37,6 +38,13 @@ VnodeBlob::~VnodeBlob() {
         request.opcode = BLOCKIO_CLOSE_VMO;
         blobstore_->Txn(&request, 1);
     }
+    if (compressed_ != nullptr) {
+        block_fifo_request_t request;
+        request.txnid = blobstore_->TxnId();
+        request.vmoid = compressed_vmoid_;
+        request.opcode = BLOCKIO_CLOSE_VMO;
+        blobstore_->Txn(&request, 1);
+    }
 }
 
 zx_status_t VnodeBlob::ValidateFlags(uint32_t flags) {
@@ -47,6 +55,7 @@ zx_status_t VnodeBlob::ValidateFlags(uint32_t flags) {
     switch (flags & O_ACCMODE) {
     case O_WRONLY:
     case O_RDWR:
+        fbl::AutoLock lock(&lock_);
         if (IsDirectory()) {
             return ZX_ERR_NOT_FILE;
         } else if (GetState() != kBlobStateEmpty) {
@@ -66,6 +75,7 @@ zx_status_t VnodeBlob::Readdir(fs::vdircookie_t* cookie, void* dirents, size_t l
 }
 
 zx_status_t VnodeBlob::Read(void* data, size_t len, size_t off, size_t* out_actual) {
+    fbl::AutoLock lock(&lock_);
     if (IsDirectory()) {
         return ZX_ERR_NOT_FILE;
     }
@@ -75,6 +85,7 @@ zx_status_t VnodeBlob::Read(void* data, size_t len, size_t off, size_t* out_actu
 
 zx_status_t VnodeBlob::Write(const void* data, size_t len, size_t offset,
                              size_t* out_actual) {
+    fbl::AutoLock lock(&lock_);
     if (IsDirectory()) {
         return ZX_ERR_NOT_FILE;
     }
@@ -84,7 +95,11 @@ zx_status_t VnodeBlob::Write(const void* data, size_t len, size_t offset,
 
 zx_status_t VnodeBlob::Append(const void* data, size_t len, size_t* out_end,
                               size_t* out_actual) {
-    zx_status_t status = Write(data, len, bytes_written_, out_actual);
+    fbl::AutoLock lock(&lock_);
+    if (IsDirectory()) {
+        return ZX_ERR_NOT_FILE;
+    }
+    zx_status_t status = WriteInternal(data, len, out_actual);
     *out_actual = bytes_written_;
     return status;
 }
@@ -115,13 +130,15 @@ zx_status_t VnodeBlob::Lookup(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece name
 }
 
 zx_status_t VnodeBlob::Getattr(vnattr_t* a) {
+    fbl::AutoLock lock(&lock_);
+    blobstore_inode_t inode;
+    blobstore_->ReadNode(map_index_, &inode);
     memset(a, 0, sizeof(vnattr_t));
     a->mode = (IsDirectory() ? V_TYPE_DIR : V_TYPE_FILE) | V_IRUSR;
     a->inode = 0;
     a->size = IsDirectory() ? 0 : SizeData();
     a->blksize = kBlobstoreBlockSize;
-    a->blkcount = blobstore_->GetNode(map_index_)->num_blocks *
-                  (kBlobstoreBlockSize / VNATTR_BLKSIZE);
+    a->blkcount = inode.num_blocks * (kBlobstoreBlockSize / VNATTR_BLKSIZE);
     a->nlink = 1;
     a->create_time = 0;
     a->modify_time = 0;
@@ -156,6 +173,7 @@ zx_status_t VnodeBlob::Ioctl(uint32_t op, const void* in_buf, size_t in_len, voi
         if (out_len < sizeof(vfs_query_info_t) + strlen(kFsName)) {
             return ZX_ERR_INVALID_ARGS;
         }
+        fbl::AutoLock lock(&blobstore_->lock_);
         vfs_query_info_t* info = static_cast<vfs_query_info_t*>(out_buf);
         memset(info, 0, sizeof(*info));
         info->block_size = kBlobstoreBlockSize;
@@ -197,6 +215,7 @@ zx_status_t VnodeBlob::Ioctl(uint32_t op, const void* in_buf, size_t in_len, voi
 }
 
 zx_status_t VnodeBlob::Truncate(size_t len) {
+    fbl::AutoLock lock(&lock_);
     if (IsDirectory()) {
         return ZX_ERR_NOT_SUPPORTED;
     }
@@ -223,6 +242,7 @@ zx_status_t VnodeBlob::Unlink(fbl::StringPiece name, bool must_be_dir) {
 }
 
 zx_status_t VnodeBlob::Mmap(int flags, size_t len, size_t* off, zx_handle_t* out) {
+    fbl::AutoLock lock(&lock_);
     if (IsDirectory()) {
         return ZX_ERR_NOT_SUPPORTED;
     }
@@ -263,8 +263,12 @@ zx_status_t MerkleTree::Verify(const void* data, size_t data_len, const void* tr
             return ZX_ERR_BUFFER_TOO_SMALL;
         }
         tree_len -= data_len;
-        offset /= kDigestsPerNode;
-        length /= kDigestsPerNode;
+        // The range to check next is made up of the digests of every node
+        // checked above.  Simply dividing the length would lose the last of
+        // them whenever the range is short or unaligned.
+        size_t finish = fbl::round_up(offset + length, kNodeSize);
+        offset = (offset / kNodeSize) * Digest::kLength;
+        length = (finish / kNodeSize) * Digest::kLength - offset;
         ++level;
     }
     return VerifyRoot(data, root_len, level, root);
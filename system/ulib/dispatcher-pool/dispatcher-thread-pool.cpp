@@ -4,6 +4,7 @@
 
 #include <zircon/syscalls.h>
 #include <zircon/syscalls/port.h>
+#include <fbl/algorithm.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -121,6 +122,8 @@ zx_status_t ThreadPool::AddDomainToPool(fbl::RefPtr<ExecutionDomain> domain) {
         }
 
         active_thread_count_++;
+        if (active_thread_count_ > 1)
+            multi_threaded_.store(true);
     }
 
     return ZX_OK;
@@ -212,7 +215,7 @@ void ThreadPool::InternalShutdown() {
         fbl::AutoLock lock(&pool_lock_);
         for (__UNUSED const auto& thread : active_threads_) {
             __UNUSED zx_status_t res;
-            res = port_.queue(&pkt, sizeof(pkt));
+            res = port_.queue(&pkt, 1);
             ZX_DEBUG_ASSERT(res == ZX_OK);
         }
     }
@@ -287,42 +290,60 @@ int ThreadPool::Thread::Main() {
         DEBUG_LOG("WARNING - Failed to set thread priority (res %d)\n", res);
     }
 
-    while (true) {
-        zx_port_packet_t pkt;
+    bool quit = false;
+    while (!quit) {
+        zx_port_packet_t pkts[kMaxPacketsPerWait];
+        size_t pkt_count;
 
         // TODO(johngro) : consider automatically shutting down if we have more
         // threads than clients.
 
-        // Wait for there to be work to dispatch.  We should never encounter an
-        // error, but if we do, shut down.
-        res = pool_->port().wait(ZX_TIME_INFINITE, &pkt, 0);
+        // Wait for there to be work to dispatch.  A lone thread takes
+        // whatever else is already queued along with it; in a larger pool,
+        // that would keep the rest from the threads sitting idle.  We should
+        // never encounter an error, but if we do, shut down.
+        size_t max_pkts = pool_->multi_threaded_.load() ? 1 : fbl::count_of(pkts);
+        res = pool_->port().wait_many(ZX_TIME_INFINITE, pkts, max_pkts, &pkt_count);
         ZX_DEBUG_ASSERT(res == ZX_OK);
-
-        // Is it time to exit?
-        if ((res != ZX_OK) || (pkt.type == ZX_PKT_TYPE_USER)) {
+        if (res != ZX_OK) {
             break;
         }
 
-        if (pkt.type != ZX_PKT_TYPE_SIGNAL_ONE) {
-            LOG("Unexpected packet type (%u) in Thread pool!\n", pkt.type);
-            continue;
+        for (size_t i = 0; i < pkt_count; ++i) {
+            const zx_port_packet_t& pkt = pkts[i];
+
+            // Is it time to exit?  There is one quit message per thread, so if
+            // we picked up someone else's as well, put it back for them.
+            if (pkt.type == ZX_PKT_TYPE_USER) {
+                if (quit) {
+                    __UNUSED zx_status_t queue_res = pool_->port().queue(&pkt, 1);
+                    ZX_DEBUG_ASSERT(queue_res == ZX_OK);
+                }
+                quit = true;
+                continue;
+            }
+
+            if (pkt.type != ZX_PKT_TYPE_SIGNAL_ONE) {
+                LOG("Unexpected packet type (%u) in Thread pool!\n", pkt.type);
+                continue;
+            }
+
+            // Reclaim our event source reference from the kernel.
+            static_assert(sizeof(pkt.key) >= sizeof(EventSource*),
+                          "Port packet keys are not large enough to hold a pointer!");
+            auto event_source =
+                fbl::internal::MakeRefPtrNoAdopt(reinterpret_cast<EventSource*>(pkt.key));
+
+            // Schedule the dispatch of the pending events for this event source.
+            // If ScheduleDispatch returns a valid ExecutionDomain reference, then
+            // actually go ahead and perform the dispatch of pending work for this
+            // domain.
+            ZX_DEBUG_ASSERT(event_source != nullptr);
+            fbl::RefPtr<ExecutionDomain> domain = event_source->ScheduleDispatch(pkt);
+
+            if (domain != nullptr)
+                domain->DispatchPendingWork();
         }
-
-        // Reclaim our event source reference from the kernel.
-        static_assert(sizeof(pkt.key) >= sizeof(EventSource*),
-                      "Port packet keys are not large enough to hold a pointer!");
-        auto event_source =
-            fbl::internal::MakeRefPtrNoAdopt(reinterpret_cast<EventSource*>(pkt.key));
-
-        // Schedule the dispatch of the pending events for this event source.
-        // If ScheduleDispatch returns a valid ExecutionDomain reference, then
-        // actually go ahead and perform the dispatch of pending work for this
-        // domain.
-        ZX_DEBUG_ASSERT(event_source != nullptr);
-        fbl::RefPtr<ExecutionDomain> domain = event_source->ScheduleDispatch(pkt);
-
-        if (domain != nullptr)
-            domain->DispatchPendingWork();
     }
 
     DEBUG_LOG("Client work thread shutting down\n");
@@ -7,6 +7,7 @@
 #include <zircon/compiler.h>
 #include <zircon/types.h>
 #include <zx/port.h>
+#include <fbl/atomic.h>
 #include <fbl/auto_lock.h>
 #include <fbl/intrusive_double_list.h>
 #include <fbl/intrusive_single_list.h>
@@ -50,6 +51,10 @@ private:
         void Join();
 
     private:
+        // The most port packets a thread takes per wakeup, when it is the only
+        // thread in the pool.
+        static constexpr size_t kMaxPacketsPerWait = 8;
+
         Thread(fbl::RefPtr<ThreadPool> pool, uint32_t id);
 
         void PrintDebugPrefix() const;
@@ -88,6 +93,11 @@ private:
     uint32_t active_thread_count_ __TA_GUARDED(pool_lock_) = 0;
     bool pool_shutting_down_ __TA_GUARDED(pool_lock_) = false;
 
+    // Set once the pool has more than one thread.  From then on, threads take
+    // one packet per wakeup; packets a thread holds in a batch cannot be
+    // dispatched by its idle peers.
+    fbl::atomic_bool multi_threaded_{false};
+
     fbl::DoublyLinkedList<fbl::RefPtr<ExecutionDomain>,
                            ExecutionDomain::ThreadPoolListTraits> active_domains_
         __TA_GUARDED(pool_lock_);
@@ -24,6 +24,9 @@ namespace fbl {
 class __TA_CAPABILITY("mutex") Mutex {
 public:
     constexpr Mutex() : mutex_(MUTEX_INITIAL_VALUE(mutex_)) { }
+    // |options| are MUTEX_OPTION_* flags.
+    constexpr explicit Mutex(uint32_t options)
+        : mutex_(MUTEX_INITIAL_VALUE_ETC(mutex_, options)) { }
     ~Mutex() { mutex_destroy(&mutex_); }
     void Acquire() __TA_ACQUIRE() { mutex_acquire(&mutex_); }
     void Release() __TA_RELEASE() { mutex_release(&mutex_); }
@@ -19,6 +19,14 @@ struct zxrio {
 
     // transaction id used for synchronous remoteio calls
     _Atomic zx_txid_t txid;
+
+    // Shared-memory transport for large reads and writes, set up on first
+    // use (see IOCTL_VFS_GET_IO_FIFO). |io_lock| guards the fields below
+    // and serializes use of the transport.
+    mtx_t io_lock;
+    int io_state;
+    zx_handle_t io_fifo;
+    uintptr_t io_buffer;
 };
 
 // These are for the benefit of namespace.c
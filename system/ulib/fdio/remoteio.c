@@ -16,6 +16,8 @@
 
 #include <zircon/device/device.h>
 #include <zircon/device/ioctl.h>
+#include <zircon/device/vfs.h>
+#include <zircon/process.h>
 #include <zircon/processargs.h>
 #include <zircon/syscalls.h>
 
@@ -343,6 +345,176 @@ ssize_t zxrio_ioctl(fdio_t* io, uint32_t op, const void* in_buf,
     return r;
 }
 
+// Values of zxrio_t.io_state. Zero-initialized objects start out UNKNOWN and
+// ask the server for a transport the first time it would help.
+enum {
+    IO_FIFO_UNKNOWN = 0,
+    IO_FIFO_READY,
+    IO_FIFO_UNAVAILABLE,
+};
+
+// Called with rio->io_lock held.
+static bool io_fifo_ready(zxrio_t* rio) {
+    if (rio->io_state != IO_FIFO_UNKNOWN) {
+        return rio->io_state == IO_FIFO_READY;
+    }
+    rio->io_state = IO_FIFO_UNAVAILABLE;
+
+    vfs_io_fifo_t fifo;
+    ssize_t r = zxrio_ioctl(&rio->io, IOCTL_VFS_GET_IO_FIFO, NULL, 0, &fifo, sizeof(fifo));
+    if (r < 0) {
+        return false;
+    }
+    if (r != sizeof(fifo)) {
+        discard_handles((zx_handle_t*)&fifo, 2);
+        return false;
+    }
+
+    uintptr_t buffer;
+    zx_status_t status = zx_vmar_map(zx_vmar_root_self(), 0, fifo.vmo, 0,
+                                     VFS_IO_FIFO_DATA_SIZE,
+                                     ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE,
+                                     &buffer);
+    zx_handle_close(fifo.vmo);
+    if (status != ZX_OK) {
+        zx_handle_close(fifo.fifo);
+        return false;
+    }
+
+    xprintf("io fifo h=%x fifo=%x buffer=%p\n", rio->h, fifo.fifo, (void*)buffer);
+    rio->io_fifo = fifo.fifo;
+    rio->io_buffer = buffer;
+    rio->io_state = IO_FIFO_READY;
+    return true;
+}
+
+// Called with rio->io_lock held, or when no one else can be using |rio|.
+static void io_fifo_close(zxrio_t* rio) {
+    if (rio->io_state == IO_FIFO_READY) {
+        zx_vmar_unmap(zx_vmar_root_self(), rio->io_buffer, VFS_IO_FIFO_DATA_SIZE);
+        zx_handle_close(rio->io_fifo);
+        rio->io_fifo = ZX_HANDLE_INVALID;
+        rio->io_buffer = 0;
+    }
+    rio->io_state = IO_FIFO_UNAVAILABLE;
+}
+
+// Moves up to |len| bytes between |data| and the file over the shared-memory
+// transport, keeping as many requests in flight as the fifo allows. Like the
+// channel path, it stops at the first short transfer, and returns the number
+// of bytes moved or, if there were none, the error. Called with
+// rio->io_lock held.
+static ssize_t io_fifo_xfer(zxrio_t* rio, uint16_t op, uint8_t* data, size_t len, off_t offset) {
+    const bool is_write = (op == VFS_IO_OP_WRITE) || (op == VFS_IO_OP_WRITE_AT);
+    uint8_t* buffer = (uint8_t*)rio->io_buffer;
+    vfs_io_request_t requests[VFS_IO_FIFO_DEPTH];
+    zx_status_t status = ZX_OK;
+    size_t issued = 0;
+    size_t done = 0;
+    uint32_t sent = 0;
+    uint32_t completed = 0;
+    bool stop = false;
+
+    while ((completed < sent) || (!stop && (issued < len))) {
+        // Top up the pipeline. Request n always uses slot n % depth, and
+        // responses come back in order, so slots are never reused early.
+        uint32_t count = 0;
+        while (!stop && (issued < len) && (sent + count - completed < VFS_IO_FIFO_DEPTH)) {
+            uint32_t n = sent + count;
+            size_t xfer = (len - issued > VFS_IO_MAX_LENGTH) ? VFS_IO_MAX_LENGTH : len - issued;
+            vfs_io_request_t* request = &requests[count++];
+            memset(request, 0, sizeof(*request));
+            request->reqid = n;
+            request->opcode = op;
+            request->flags = (n == 0) ? 0 : VFS_IO_FLAG_CONTINUE;
+            request->length = xfer;
+            request->data_offset = (n % VFS_IO_FIFO_DEPTH) * VFS_IO_MAX_LENGTH;
+            request->file_offset = offset + issued;
+            if (is_write) {
+                memcpy(buffer + request->data_offset, data + issued, xfer);
+            }
+            issued += xfer;
+        }
+        if (count > 0) {
+            uint32_t actual;
+            status = zx_fifo_write(rio->io_fifo, requests, count * sizeof(vfs_io_request_t),
+                                   &actual);
+            if ((status != ZX_OK) || (actual != count)) {
+                goto fail;
+            }
+            sent += count;
+        }
+
+        // Collect whatever has completed.
+        zx_signals_t pending;
+        status = zx_object_wait_one(rio->io_fifo, ZX_FIFO_READABLE | ZX_FIFO_PEER_CLOSED,
+                                    ZX_TIME_INFINITE, &pending);
+        if (status != ZX_OK) {
+            goto fail;
+        }
+        uint32_t actual;
+        status = zx_fifo_read(rio->io_fifo, requests, sizeof(requests), &actual);
+        if (status != ZX_OK) {
+            goto fail;
+        }
+        for (uint32_t i = 0; i < actual; i++) {
+            vfs_io_request_t* response = &requests[i];
+            if (response->reqid != completed++) {
+                status = ZX_ERR_IO;
+                goto fail;
+            }
+            if (stop) {
+                // Canceled by the server, or not worth looking at.
+                continue;
+            }
+            if (response->status != ZX_OK) {
+                status = response->status;
+                stop = true;
+                continue;
+            }
+            size_t xfer = (len - done > VFS_IO_MAX_LENGTH) ? VFS_IO_MAX_LENGTH : len - done;
+            if (response->length > xfer) {
+                status = ZX_ERR_IO;
+                goto fail;
+            }
+            if (!is_write) {
+                size_t slot = ((completed - 1) % VFS_IO_FIFO_DEPTH) * VFS_IO_MAX_LENGTH;
+                memcpy(data + done, buffer + slot, response->length);
+            }
+            done += response->length;
+            if (response->length < xfer) {
+                stop = true;
+            }
+        }
+    }
+    return done ? (ssize_t)done : status;
+
+fail:
+    // We no longer know what the server has seen; stop using the transport.
+    xprintf("io fifo h=%x failed: %d\n", rio->h, status);
+    io_fifo_close(rio);
+    if (status == ZX_OK) {
+        status = ZX_ERR_IO;
+    }
+    return done ? (ssize_t)done : status;
+}
+
+// Large transfers use the shared-memory transport if the server has one.
+// Returns false if the caller should use the channel instead.
+static bool io_fifo_try_xfer(zxrio_t* rio, uint16_t op, uint8_t* data, size_t len, off_t offset,
+                             ssize_t* result) {
+    if (len <= FDIO_CHUNK_SIZE) {
+        return false;
+    }
+    mtx_lock(&rio->io_lock);
+    bool ready = io_fifo_ready(rio);
+    if (ready) {
+        *result = io_fifo_xfer(rio, op, data, len, offset);
+    }
+    mtx_unlock(&rio->io_lock);
+    return ready;
+}
+
 static ssize_t write_common(uint32_t op, fdio_t* io, const void* _data, size_t len, off_t offset) {
     zxrio_t* rio = (zxrio_t*)io;
     const uint8_t* data = _data;
@@ -351,6 +523,11 @@ static ssize_t write_common(uint32_t op, fdio_t* io, const void* _data, size_t l
     zxrio_msg_t msg;
     ssize_t xfer;
 
+    if (io_fifo_try_xfer(rio, (op == ZXRIO_WRITE) ? VFS_IO_OP_WRITE : VFS_IO_OP_WRITE_AT,
+                         (uint8_t*)data, len, offset, &count)) {
+        return count;
+    }
+
     while (len > 0) {
         xfer = (len > FDIO_CHUNK_SIZE) ? FDIO_CHUNK_SIZE : len;
 
@@ -399,6 +576,11 @@ static ssize_t read_common(uint32_t op, fdio_t* io, void* _data, size_t len, off
     zxrio_msg_t msg;
     ssize_t xfer;
 
+    if (io_fifo_try_xfer(rio, (op == ZXRIO_READ) ? VFS_IO_OP_READ : VFS_IO_OP_READ_AT,
+                         data, len, offset, &count)) {
+        return count;
+    }
+
     while (len > 0) {
         xfer = (len > FDIO_CHUNK_SIZE) ? FDIO_CHUNK_SIZE : len;
 
@@ -463,6 +645,8 @@ zx_status_t zxrio_close(fdio_t* io) {
     zxrio_msg_t msg;
     zx_status_t r;
 
+    io_fifo_close(rio);
+
     memset(&msg, 0, ZXRIO_HDR_SZ);
     msg.op = ZXRIO_CLOSE;
 
@@ -911,6 +1095,7 @@ zx_status_t __zxrio_clone(zx_handle_t h, zx_handle_t* handles, uint32_t* types)
 static zx_status_t zxrio_unwrap(fdio_t* io, zx_handle_t* handles, uint32_t* types) {
     zxrio_t* rio = (void*)io;
     zx_status_t r;
+    io_fifo_close(rio);
     handles[0] = rio->h;
     types[0] = PA_FDIO_REMOTE;
     if (rio->h2 != 0) {
@@ -15,6 +15,8 @@
 #include <fdio/io.h>
 #include <fdio/remoteio.h>
 #include <fdio/vfs.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/auto_lock.h>
 #include <fs/vnode.h>
 #include <zircon/assert.h>
 
@@ -130,17 +132,49 @@ Connection::Connection(Vfs* vfs, fbl::RefPtr<Vnode> vnode,
     : vfs_(vfs), vnode_(fbl::move(vnode)), channel_(fbl::move(channel)),
       wait_(ZX_HANDLE_INVALID, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
             ASYNC_FLAG_HANDLE_SHUTDOWN),
-      flags_(flags) {
+      flags_(flags),
+      io_wait_(ZX_HANDLE_INVALID, ZX_FIFO_READABLE | ZX_FIFO_PEER_CLOSED,
+               ASYNC_FLAG_HANDLE_SHUTDOWN) {
     ZX_DEBUG_ASSERT(vfs);
     ZX_DEBUG_ASSERT(vnode_);
     ZX_DEBUG_ASSERT(channel_);
 
+    io_wait_.set_handler([this](async_t* async, zx_status_t status,
+                                const zx_packet_signal_t* signal) {
+        lock_.Acquire();
+        ZX_DEBUG_ASSERT(is_io_waiting());
+
+        if (closing_) {
+            io_wait_.set_object(ZX_HANDLE_INVALID);
+            CloseIoFifo();
+            lock_.Release();
+            vfs_->OnConnectionClosedRemotely(this);
+            return ASYNC_WAIT_FINISHED;
+        }
+
+        if (status == ZX_OK && (signal->observed & ZX_FIFO_READABLE)) {
+            status = HandleIoFifo();
+            if (status == ZX_OK && (status = io_wait_.Begin(async)) == ZX_OK) {
+                lock_.Release();
+                return ASYNC_WAIT_FINISHED;
+            }
+        }
+
+        // The client closed its end or broke the protocol. Either way it can
+        // carry on over the channel.
+        io_wait_.set_object(ZX_HANDLE_INVALID);
+        CloseIoFifo();
+        lock_.Release();
+        return ASYNC_WAIT_FINISHED;
+    });
+
     wait_.set_handler([this](async_t* async, zx_status_t status,
                              const zx_packet_signal_t* signal) {
         ZX_DEBUG_ASSERT(is_waiting());
 
         // Handle the message.
         if (status == ZX_OK && (signal->observed & ZX_CHANNEL_READABLE)) {
+            fbl::AutoLock lock(&lock_);
             status = CallHandler();
             if (status == ZX_OK) {
                 return ASYNC_WAIT_AGAIN;
@@ -148,9 +182,19 @@ Connection::Connection(Vfs* vfs, fbl::RefPtr<Vnode> vnode,
         }
         wait_.set_object(ZX_HANDLE_INVALID);
 
-        // Give the dispatcher a chance to clean up.
-        if (status != ERR_DISPATCHER_DONE) {
-            CallHandler();
+        {
+            fbl::AutoLock lock(&lock_);
+            // Give the dispatcher a chance to clean up.
+            if (status != ERR_DISPATCHER_DONE) {
+                CallHandler();
+            }
+
+            if (!StopIoFifoLocked()) {
+                // The io fifo handler is about to run on another thread; let
+                // it finish closing the connection.
+                closing_ = true;
+                return ASYNC_WAIT_FINISHED;
+            }
         }
 
         // Tell the VFS that the connection closed remotely.
@@ -161,6 +205,8 @@ Connection::Connection(Vfs* vfs, fbl::RefPtr<Vnode> vnode,
 }
 
 Connection::~Connection() {
+    fbl::AutoLock lock(&lock_);
+
     // Stop waiting and clean up if still connected.
     if (is_waiting()) {
         zx_status_t status = wait_.Cancel(vfs_->async());
@@ -170,6 +216,9 @@ Connection::~Connection() {
         CallHandler();
     }
 
+    __UNUSED bool stopped = StopIoFifoLocked();
+    ZX_DEBUG_ASSERT_MSG(stopped, "Could not cancel io wait");
+
     // Release the token associated with this connection's vnode since the connection
     // will be releasing the vnode's reference once this function returns.
     if (token_) {
@@ -188,6 +237,171 @@ zx_status_t Connection::Serve() {
     return status;
 }
 
+zx_status_t Connection::CreateIoFifo(vfs_io_fifo_t* out) {
+    if (io_fifo_) {
+        return ZX_ERR_ALREADY_BOUND;
+    }
+
+    fbl::AllocChecker ac;
+    uint8_t* buffer = new (&ac) uint8_t[VFS_IO_MAX_LENGTH];
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    fbl::Array<uint8_t> io_buffer(buffer, VFS_IO_MAX_LENGTH);
+
+    zx::vmo vmo;
+    zx_status_t status = zx::vmo::create(VFS_IO_FIFO_DATA_SIZE, 0, &vmo);
+    if (status != ZX_OK) {
+        return status;
+    }
+    zx::vmo client_vmo;
+    if ((status = vmo.duplicate(ZX_RIGHT_SAME_RIGHTS, &client_vmo)) != ZX_OK) {
+        return status;
+    }
+    zx::fifo client_fifo;
+    zx::fifo fifo;
+    status = zx::fifo::create(VFS_IO_FIFO_DEPTH, sizeof(vfs_io_request_t), 0,
+                              &client_fifo, &fifo);
+    if (status != ZX_OK) {
+        return status;
+    }
+
+    io_wait_.set_object(fifo.get());
+    if ((status = io_wait_.Begin(vfs_->async())) != ZX_OK) {
+        io_wait_.set_object(ZX_HANDLE_INVALID);
+        return status;
+    }
+    io_fifo_ = fbl::move(fifo);
+    io_vmo_ = fbl::move(vmo);
+    io_buffer_ = fbl::move(io_buffer);
+    io_chain_broken_ = false;
+
+    out->fifo = client_fifo.release();
+    out->vmo = client_vmo.release();
+    return ZX_OK;
+}
+
+void Connection::CloseIoFifo() {
+    ZX_DEBUG_ASSERT(!is_io_waiting());
+    io_fifo_.reset();
+    io_vmo_.reset();
+    io_buffer_.reset();
+}
+
+bool Connection::StopIoFifoLocked() {
+    if (is_io_waiting()) {
+        if (io_wait_.Cancel(vfs_->async()) != ZX_OK) {
+            return false;
+        }
+        io_wait_.set_object(ZX_HANDLE_INVALID);
+    }
+    CloseIoFifo();
+    return true;
+}
+
+zx_status_t Connection::HandleIoFifo() {
+    vfs_io_request_t requests[VFS_IO_FIFO_DEPTH];
+    uint32_t count;
+    zx_status_t status = io_fifo_.read(requests, sizeof(requests), &count);
+    if (status == ZX_ERR_SHOULD_WAIT) {
+        return ZX_OK;
+    } else if (status != ZX_OK) {
+        return status;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        HandleIoRequest(&requests[i]);
+    }
+
+    // A well-behaved client never has more requests in flight than the
+    // fifo holds, so there is always room for the responses.
+    uint32_t actual;
+    status = io_fifo_.write(requests, count * sizeof(vfs_io_request_t), &actual);
+    if (status != ZX_OK) {
+        return status;
+    }
+    return actual == count ? ZX_OK : ZX_ERR_IO;
+}
+
+void Connection::HandleIoRequest(vfs_io_request_t* request) {
+    const uint32_t len = request->length;
+    request->length = 0;
+
+    if ((request->flags & VFS_IO_FLAG_CONTINUE) && io_chain_broken_) {
+        request->status = ZX_ERR_CANCELED;
+        return;
+    }
+    // Only a request that transfers everything it asked for keeps the chain.
+    io_chain_broken_ = true;
+
+    if ((len > VFS_IO_MAX_LENGTH) ||
+        (request->data_offset > VFS_IO_FIFO_DATA_SIZE - len)) {
+        request->status = ZX_ERR_OUT_OF_RANGE;
+        return;
+    }
+
+    size_t actual = 0;
+    zx_status_t status;
+    switch (request->opcode) {
+    case VFS_IO_OP_READ:
+    case VFS_IO_OP_READ_AT: {
+        if (!IsReadable(flags_)) {
+            status = ZX_ERR_BAD_HANDLE;
+            break;
+        }
+        bool at = request->opcode == VFS_IO_OP_READ_AT;
+        status = vnode_->Read(io_buffer_.get(), len, at ? request->file_offset : offset_,
+                              &actual);
+        if (status != ZX_OK) {
+            break;
+        }
+        ZX_DEBUG_ASSERT(actual <= len);
+        status = io_vmo_.write(io_buffer_.get(), request->data_offset, actual, &actual);
+        if (status == ZX_OK && !at) {
+            offset_ += actual;
+        }
+        break;
+    }
+    case VFS_IO_OP_WRITE:
+    case VFS_IO_OP_WRITE_AT: {
+        if (!IsWritable(flags_)) {
+            status = ZX_ERR_BAD_HANDLE;
+            break;
+        }
+        size_t copied;
+        status = io_vmo_.read(io_buffer_.get(), request->data_offset, len, &copied);
+        if (status != ZX_OK) {
+            break;
+        }
+        if (request->opcode == VFS_IO_OP_WRITE_AT) {
+            status = vnode_->Write(io_buffer_.get(), copied, request->file_offset, &actual);
+        } else if (flags_ & O_APPEND) {
+            size_t end;
+            status = vnode_->Append(io_buffer_.get(), copied, &end, &actual);
+            if (status == ZX_OK) {
+                offset_ = end;
+            }
+        } else {
+            status = vnode_->Write(io_buffer_.get(), copied, offset_, &actual);
+            if (status == ZX_OK) {
+                offset_ += actual;
+            }
+        }
+        ZX_DEBUG_ASSERT(status != ZX_OK || actual <= copied);
+        break;
+    }
+    default:
+        status = ZX_ERR_NOT_SUPPORTED;
+        break;
+    }
+
+    request->status = status;
+    if (status == ZX_OK) {
+        request->length = static_cast<uint32_t>(actual);
+        io_chain_broken_ = (actual < len);
+    }
+}
+
 zx_status_t Connection::CallHandler() {
     return zxrio_handler(channel_.get(), (void*)&Connection::HandleMessageThunk, this);
 }
@@ -470,6 +684,17 @@ zx_status_t Connection::HandleMessage(zxrio_msg_t* msg) {
 
         size_t actual = 0;
         switch (msg->arg2.op) {
+        case IOCTL_VFS_GET_IO_FIFO: {
+            if (arg != sizeof(vfs_io_fifo_t)) {
+                return ZX_ERR_INVALID_ARGS;
+            }
+            zx_status_t status = CreateIoFifo(reinterpret_cast<vfs_io_fifo_t*>(msg->data));
+            if (status != ZX_OK) {
+                return status;
+            }
+            actual = sizeof(vfs_io_fifo_t);
+            break;
+        }
         case IOCTL_VFS_GET_TOKEN: {
             // Ioctls which act on Connection
             if (arg != sizeof(zx_handle_t)) {
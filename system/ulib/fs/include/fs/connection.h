@@ -11,12 +11,17 @@
 #include <stdint.h>
 
 #include <async/wait.h>
+#include <fbl/array.h>
 #include <fbl/intrusive_double_list.h>
+#include <fbl/mutex.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/unique_ptr.h>
 #include <fs/vfs.h>
 #include <fs/vnode.h>
+#include <zircon/device/vfs.h>
 #include <zx/event.h>
+#include <zx/fifo.h>
+#include <zx/vmo.h>
 
 namespace fs {
 
@@ -54,13 +59,24 @@ public:
     zx_status_t Serve();
 
 private:
-    zx_status_t CallHandler();
+    zx_status_t CallHandler() __TA_REQUIRES(lock_);
 
     static zx_status_t HandleMessageThunk(zxrio_msg_t* msg, void* cookie);
     zx_status_t HandleMessage(zxrio_msg_t* msg);
 
     bool is_waiting() const { return wait_.object() != ZX_HANDLE_INVALID; }
 
+    // Shared-memory I/O transport (IOCTL_VFS_GET_IO_FIFO).
+    zx_status_t CreateIoFifo(vfs_io_fifo_t* out) __TA_REQUIRES(lock_);
+    zx_status_t HandleIoFifo() __TA_REQUIRES(lock_);
+    void HandleIoRequest(vfs_io_request_t* request) __TA_REQUIRES(lock_);
+    void CloseIoFifo() __TA_REQUIRES(lock_);
+    // Stops serving the io fifo. Returns false if its handler has already
+    // been dispatched and can no longer be canceled.
+    bool StopIoFifoLocked() __TA_REQUIRES(lock_);
+
+    bool is_io_waiting() const { return io_wait_.object() != ZX_HANDLE_INVALID; }
+
     fs::Vfs* const vfs_;
     fbl::RefPtr<fs::Vnode> const vnode_;
 
@@ -82,8 +98,31 @@ private:
     // Directory cookie for readdir operations.
     fs::vdircookie_t dircookie_{};
 
+    // Serializes the channel and io fifo handlers, which may otherwise run
+    // at the same time on a multi-threaded dispatcher.
+    fbl::Mutex lock_;
+
     // Current seek offset.
-    size_t offset_{};
+    size_t offset_ __TA_GUARDED(lock_){};
+
+    // Server end of the shared-memory I/O transport, if the client asked for
+    // one. Requests are served by |io_wait_| on the same dispatcher as |wait_|.
+    // Its handler re-arms the wait itself while holding |lock_|, so that
+    // whoever holds the lock can tell whether it may still run.
+    //
+    // The data area is copied through |io_buffer_| with zx_vmo_read() and
+    // zx_vmo_write() rather than mapped, since the client holds a handle that
+    // can resize it out from under a mapping.
+    zx::fifo io_fifo_;
+    zx::vmo io_vmo_;
+    async::Wait io_wait_;
+    fbl::Array<uint8_t> io_buffer_;
+    // Set when a request fails or is short, so that any requests continuing
+    // it are canceled rather than performed.
+    bool io_chain_broken_ __TA_GUARDED(lock_){};
+    // Set when the channel closed while the io fifo handler was already
+    // dispatched; that handler then finishes closing the connection.
+    bool closing_ __TA_GUARDED(lock_){};
 };
 
 } // namespace fs
@@ -8,12 +8,17 @@
 #error "Fuchsia-only header"
 #endif
 
+#include <fbl/atomic.h>
 #include <fs/vfs.h>
 #include <zx/channel.h>
 
 namespace fs {
 
 // RemoteContainer adds support for mounting remote handles on nodes.
+//
+// The handle is set and detached with the Vfs's vfs_lock_ held. IsRemote() may
+// be called without it, as path walks do, but only a check made with the lock
+// held says anything about the handle GetRemote() returns.
 class RemoteContainer {
 public:
     constexpr RemoteContainer() {};
@@ -23,6 +28,7 @@ public:
     void SetRemote(zx::channel remote);
 private:
     zx::channel remote_;
+    fbl::atomic<bool> is_remote_{false};
 };
 
 }
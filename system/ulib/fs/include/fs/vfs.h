@@ -151,8 +151,8 @@ public:
                      fbl::StringPiece oldStr, fbl::StringPiece newStr) __TA_EXCLUDES(vfs_lock_);
     zx_status_t Rename(zx::event token, fbl::RefPtr<Vnode> oldparent,
                        fbl::StringPiece oldStr, fbl::StringPiece newStr) __TA_EXCLUDES(vfs_lock_);
-    // Calls readdir on the Vnode while holding the vfs_lock, preventing path
-    // modification operations for the duration of the operation.
+    // Calls readdir on the Vnode. Like lookup, readdir is not serialized by
+    // vfs_lock_; the filesystem orders it against its own modifications.
     zx_status_t Readdir(Vnode* vn, vdircookie_t* cookie,
                         void* dirents, size_t len, size_t* out_actual) __TA_EXCLUDES(vfs_lock_);
 
@@ -198,13 +198,22 @@ private:
     // On success,
     // |out| is the vnode at which we stopped searching
     // |pathout| is the reaminer of the path to search
+    //
+    // Walk may be called with or without vfs_lock_ held. Without it, the mount
+    // point it stops at must be checked again under the lock before use.
     zx_status_t Walk(fbl::RefPtr<Vnode> vn, fbl::RefPtr<Vnode>* out,
-                     fbl::StringPiece path, fbl::StringPiece* pathout) __TA_REQUIRES(vfs_lock_);
+                     fbl::StringPiece path, fbl::StringPiece* pathout);
 
     zx_status_t OpenLocked(fbl::RefPtr<Vnode> vn, fbl::RefPtr<Vnode>* out,
                            fbl::StringPiece path, fbl::StringPiece* pathout,
                            uint32_t flags, uint32_t mode) __TA_REQUIRES(vfs_lock_);
 
+    // Opens |vn|, already looked up by the caller, or traverses it if it is a
+    // mount point.
+    zx_status_t OpenVnodeLocked(fbl::RefPtr<Vnode> vn, fbl::RefPtr<Vnode>* out,
+                                fbl::StringPiece* pathout, uint32_t flags,
+                                bool must_be_dir) __TA_REQUIRES(vfs_lock_);
+
     bool readonly_{};
 
 #ifdef __Fuchsia__
@@ -237,7 +246,12 @@ private:
     async_t* async_{};
 
 protected:
-    // A lock which should be used to protect lookup and walk operations
+    // Guards the mount points and the read-only flag, and serializes operations
+    // which modify the namespace. Lookups, walks and readdir run without it,
+    // so filesystems must order those against their own modifications. Walks
+    // see mount points come and go through Vnode::IsRemote(), which is safe to
+    // call without the lock, but a mount point is only traversed or handed off
+    // with the lock held.
     mtx_t vfs_lock_{};
 
     // Starts tracking the lifetime of the connection.
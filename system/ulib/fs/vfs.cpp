@@ -90,10 +90,11 @@ zx_status_t vfs_prevalidate_flags(uint32_t flags) {
 #ifdef __Fuchsia__
 
 bool RemoteContainer::IsRemote() const {
-    return remote_.is_valid();
+    return is_remote_.load(fbl::memory_order_acquire);
 }
 
 zx::channel RemoteContainer::DetachRemote() {
+    is_remote_.store(false, fbl::memory_order_release);
     return fbl::move(remote_);
 }
 
@@ -104,6 +105,7 @@ zx_handle_t RemoteContainer::GetRemote() const {
 void RemoteContainer::SetRemote(zx::channel remote) {
     ZX_DEBUG_ASSERT(!remote_.is_valid());
     remote_ = fbl::move(remote);
+    is_remote_.store(remote_.is_valid(), fbl::memory_order_release);
 }
 
 #endif
@@ -119,16 +121,56 @@ Vfs::Vfs(async_t* async)
 zx_status_t Vfs::Open(fbl::RefPtr<Vnode> vndir, fbl::RefPtr<Vnode>* out,
                       fbl::StringPiece path, fbl::StringPiece* pathout, uint32_t flags,
                       uint32_t mode) {
+    FS_TRACE(VFS, "VfsOpen: path='%s' flags=%d\n", path.begin(), flags);
+    zx_status_t r;
+    if ((r = vfs_prevalidate_flags(flags)) != ZX_OK) {
+        return r;
+    }
+    // Lookups are serialized against modifications by the filesystem itself,
+    // so the path is walked without vfs_lock_; a lookup which has to go to
+    // disk doesn't hold up every other open in the filesystem.
+    if ((r = Vfs::Walk(vndir, &vndir, path, &path)) < 0) {
+        return r;
+    }
+    if (flags & O_CREAT) {
+#ifdef __Fuchsia__
+        fbl::AutoLock lock(&vfs_lock_);
+#endif
+        return OpenLocked(fbl::move(vndir), out, path, pathout, flags, mode);
+    }
+#ifdef __Fuchsia__
+    {
+        // The walk only saw a snapshot of the mount points; whether vndir is
+        // one is settled, and it is handed off, under vfs_lock_.
+        fbl::AutoLock lock(&vfs_lock_);
+        if (vndir->IsRemote()) {
+            // remote filesystem, return handle and path through to caller
+            *out = fbl::move(vndir);
+            *pathout = path;
+            return ZX_OK;
+        }
+    }
+#endif
+
+    bool must_be_dir = false;
+    if ((r = vfs_name_trim(path, &path, &must_be_dir)) != ZX_OK) {
+        return r;
+    } else if (path == "..") {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    fbl::RefPtr<Vnode> vn;
+    if ((r = vfs_lookup(fbl::move(vndir), &vn, path)) < 0) {
+        return r;
+    }
 #ifdef __Fuchsia__
     fbl::AutoLock lock(&vfs_lock_);
 #endif
-    return OpenLocked(fbl::move(vndir), out, path, pathout, flags, mode);
+    return OpenVnodeLocked(fbl::move(vn), out, pathout, flags, must_be_dir);
 }
 
 zx_status_t Vfs::OpenLocked(fbl::RefPtr<Vnode> vndir, fbl::RefPtr<Vnode>* out,
                             fbl::StringPiece path, fbl::StringPiece* pathout,
                             uint32_t flags, uint32_t mode) {
-    FS_TRACE(VFS, "VfsOpen: path='%s' flags=%d\n", path.begin(), flags);
     zx_status_t r;
     if ((r = vfs_prevalidate_flags(flags)) != ZX_OK) {
         return r;
@@ -180,35 +222,46 @@ zx_status_t Vfs::OpenLocked(fbl::RefPtr<Vnode> vndir, fbl::RefPtr<Vnode>* out,
         if (r < 0) {
             return r;
         }
+        return OpenVnodeLocked(fbl::move(vn), out, pathout, flags, must_be_dir);
+    }
+    FS_TRACE(VFS, "VfsOpen: vn=%p\n", vn.get());
+    *pathout = "";
+    *out = vn;
+    return ZX_OK;
+}
+
+zx_status_t Vfs::OpenVnodeLocked(fbl::RefPtr<Vnode> vn, fbl::RefPtr<Vnode>* out,
+                                 fbl::StringPiece* pathout, uint32_t flags,
+                                 bool must_be_dir) {
+    zx_status_t r;
 #ifdef __Fuchsia__
-        if (!(flags & O_NOREMOTE) && vn->IsRemote()) {
-            // Opening a mount point: Traverse across remote.
-            *pathout = ".";
+    if (!(flags & O_NOREMOTE) && vn->IsRemote()) {
+        // Opening a mount point: Traverse across remote.
+        *pathout = ".";
 
-            if ((r = vn->GetRemote()) > 0) {
-                *out = fbl::move(vn);
-                return ZX_OK;
-            }
+        if ((r = vn->GetRemote()) > 0) {
+            *out = fbl::move(vn);
+            return ZX_OK;
         }
+    }
 
-        flags |= (must_be_dir ? O_DIRECTORY : 0);
+    flags |= (must_be_dir ? O_DIRECTORY : 0);
 #endif
-        if (ReadonlyLocked() && IsWritable(flags)) {
-            return ZX_ERR_ACCESS_DENIED;
-        }
-        if ((r = vn->ValidateFlags(flags)) != ZX_OK) {
+    if (ReadonlyLocked() && IsWritable(flags)) {
+        return ZX_ERR_ACCESS_DENIED;
+    }
+    if ((r = vn->ValidateFlags(flags)) != ZX_OK) {
+        return r;
+    }
+    // O_PATH requests that we don't actually open the underlying
+    // Vnode.
+    if (!IsPathOnly(flags)) {
+        if ((r = OpenVnode(flags, &vn)) != ZX_OK) {
             return r;
         }
-        // O_PATH requests that we don't actually open the underlying
-        // Vnode.
-        if (!IsPathOnly(flags)) {
-            if ((r = OpenVnode(flags, &vn)) != ZX_OK) {
-                return r;
-            }
-            if ((flags & O_TRUNC) && ((r = vn->Truncate(0)) < 0)) {
-                vn->Close();
-                return r;
-            }
+        if ((flags & O_TRUNC) && ((r = vn->Truncate(0)) < 0)) {
+            vn->Close();
+            return r;
         }
     }
     FS_TRACE(VFS, "VfsOpen: vn=%p\n", vn.get());
@@ -353,7 +406,6 @@ zx_status_t Vfs::Rename(zx::event token, fbl::RefPtr<Vnode> oldparent,
 
 zx_status_t Vfs::Readdir(Vnode* vn, vdircookie_t* cookie,
                          void* dirents, size_t len, size_t* out_actual) {
-    fbl::AutoLock lock(&vfs_lock_);
     return vn->Readdir(cookie, dirents, len, out_actual);
 }
 
@@ -27,11 +27,8 @@ zx_status_t Bcache::Readblk(blk_t bno, void* data) {
 #ifndef __Fuchsia__
     off += offset_;
 #endif
-    if (lseek(fd_.get(), off, SEEK_SET) < 0) {
-        FS_TRACE_ERROR("minfs: cannot seek to block %u\n", bno);
-        return ZX_ERR_IO;
-    }
-    if (read(fd_.get(), data, kMinfsBlockSize) != kMinfsBlockSize) {
+    // Use positional io; the fd offset is shared between dispatch threads.
+    if (pread(fd_.get(), data, kMinfsBlockSize, off) != kMinfsBlockSize) {
         FS_TRACE_ERROR("minfs: cannot read block %u\n", bno);
         return ZX_ERR_IO;
     }
@@ -45,11 +42,7 @@ zx_status_t Bcache::Writeblk(blk_t bno, const void* data) {
 #ifndef __Fuchsia__
     off += offset_;
 #endif
-    if (lseek(fd_.get(), off, SEEK_SET) < 0) {
-        FS_TRACE_ERROR("minfs: cannot seek to block %u\n", bno);
-        return ZX_ERR_IO;
-    }
-    if (write(fd_.get(), data, kMinfsBlockSize) != kMinfsBlockSize) {
+    if (pwrite(fd_.get(), data, kMinfsBlockSize, off) != kMinfsBlockSize) {
         FS_TRACE_ERROR("minfs: cannot write block %u\n", bno);
         return ZX_ERR_IO;
     }
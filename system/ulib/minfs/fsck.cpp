@@ -45,90 +45,6 @@ zx_status_t MinfsChecker::GetInode(minfs_inode_t* inode, ino_t ino) {
 #define CD_DUMP 1
 #define CD_RECURSE 2
 
-zx_status_t MinfsChecker::GetInodeNthBno(minfs_inode_t* inode, blk_t n,
-                                         blk_t* next_n, blk_t* bno_out) {
-    // The default value for the "next n". It's easier to set it here anyway,
-    // since we proceed to modify n in the code below.
-    *next_n = n + 1;
-    if (n < kMinfsDirect) {
-        *bno_out = inode->dnum[n];
-        return ZX_OK;
-    }
-
-    n -= kMinfsDirect;
-    uint32_t i = n / kMinfsDirectPerIndirect; // indirect index
-    uint32_t j = n % kMinfsDirectPerIndirect; // direct index
-
-    if (i < kMinfsIndirect) {
-        blk_t ibno;
-        if ((ibno = inode->inum[i]) == 0) {
-            *bno_out = 0;
-            *next_n = kMinfsDirect + (i + 1) * kMinfsDirectPerIndirect;
-            return ZX_OK;
-        }
-
-        if (cached_indirect_ != ibno) {
-            zx_status_t status;
-            if ((status = fs_->ReadDat(ibno, indirect_cache_)) != ZX_OK) {
-                return status;
-            }
-            cached_indirect_ = ibno;
-        }
-
-        uint32_t* ientry = reinterpret_cast<uint32_t*>(indirect_cache_);
-        *bno_out = ientry[j];
-        return ZX_OK;
-    }
-
-    n -= kMinfsIndirect * kMinfsDirectPerIndirect;
-    const uint32_t kMinfsDirectPerDindirect = kMinfsDirectPerIndirect * kMinfsDirectPerIndirect;
-    i = n / (kMinfsDirectPerDindirect); // doubly indirect index
-    n -= (i * kMinfsDirectPerDindirect);
-    j = n / kMinfsDirectPerIndirect; // indirect index
-    uint32_t k = n % kMinfsDirectPerIndirect; // direct index
-
-    if (i < kMinfsDoublyIndirect) {
-        blk_t dibno;
-        if ((dibno = inode->dinum[i]) == 0) {
-            *bno_out = 0;
-            *next_n = kMinfsDirect + kMinfsIndirect * kMinfsDirectPerIndirect +
-                    (i + 1) * kMinfsDirectPerDindirect;
-            return ZX_OK;
-        }
-
-        if (cached_doubly_indirect_ != dibno) {
-            zx_status_t status;
-            if ((status = fs_->ReadDat(dibno, doubly_indirect_cache_)) != ZX_OK) {
-                return status;
-            }
-            cached_doubly_indirect_ = dibno;
-        }
-
-        uint32_t* dientry = reinterpret_cast<uint32_t*>(doubly_indirect_cache_);
-        blk_t ibno;
-        if ((ibno = dientry[j]) == 0) {
-            *bno_out = 0;
-            *next_n = kMinfsDirect + kMinfsIndirect * kMinfsDirectPerIndirect +
-                    (i * kMinfsDirectPerDindirect) + (j + 1) * kMinfsDirectPerIndirect;
-            return ZX_OK;
-        }
-
-        if (cached_indirect_ != ibno) {
-            zx_status_t status;
-            if ((status = fs_->ReadDat(ibno, indirect_cache_)) != ZX_OK) {
-                return status;
-            }
-            cached_indirect_ = ibno;
-        }
-
-        uint32_t* ientry = reinterpret_cast<uint32_t*>(indirect_cache_);
-        *bno_out = ientry[k];
-        return ZX_OK;
-    }
-
-    return ZX_ERR_OUT_OF_RANGE;
-}
-
 zx_status_t MinfsChecker::CheckDirectory(minfs_inode_t* inode, ino_t ino,
                                          ino_t parent, uint32_t flags) {
     unsigned eno = 0;
@@ -144,15 +60,28 @@ zx_status_t MinfsChecker::CheckDirectory(minfs_inode_t* inode, ino_t ino,
     memcpy(&vn->inode_, inode, kMinfsInodeSize);
     vn->ino_ = ino;
 
+    // Hashed directories consist of exactly |dir_buckets| buckets.
+    uint32_t buckets = inode->dir_buckets;
+    if ((buckets > kMinfsMaxDirBuckets) ||
+        ((buckets != 0) && (inode->size != buckets * kMinfsDirBucketSize))) {
+        FS_TRACE_ERROR("check: ino#%u: bad hash buckets %u for size %u\n",
+                       ino, buckets, inode->size);
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+
     size_t prev_off = 0;
     size_t off = 0;
     while (true) {
+        if ((buckets != 0) && (off == inode->size)) {
+            break;
+        }
         uint32_t data[MINFS_DIRENT_SIZE];
         size_t actual;
         status = vn->ReadInternal(data, MINFS_DIRENT_SIZE, off, &actual);
         if (status != ZX_OK || actual != MINFS_DIRENT_SIZE) {
             FS_TRACE_ERROR("check: ino#%u: Could not read de[%u] at %zd\n", eno, ino, off);
-            if (inode->dirent_count >= 2 && inode->dirent_count == eno - 1) {
+            if ((buckets == 0) && inode->dirent_count >= 2 &&
+                inode->dirent_count == eno - 1) {
                 // So we couldn't read the last direntry, for whatever reason, but our
                 // inode says that we shouldn't have been able to read it anyway.
                 FS_TRACE_ERROR("check: de count (%u) > inode_dirent_count (%u)\n", eno, inode->dirent_count);
@@ -192,6 +121,11 @@ zx_status_t MinfsChecker::CheckDirectory(minfs_inode_t* inode, ino_t ino,
             FS_TRACE_ERROR("check: ino#%u: de[%u]: bad dirent reclen (%u)\n", ino, eno, rlen);
             return ZX_ERR_IO_DATA_INTEGRITY;
         }
+        if ((buckets != 0) &&
+            (is_last || ((off % kMinfsDirBucketSize) + rlen > kMinfsDirBucketSize))) {
+            FS_TRACE_ERROR("check: ino#%u: de[%u]: record crosses bucket end\n", ino, eno);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
         if (de->ino == 0) {
             if (flags & CD_DUMP) {
                 FS_TRACE_INFO("ino#%u: de[%u]: <empty> reclen=%u\n", ino, eno, rlen);
@@ -211,6 +145,12 @@ zx_status_t MinfsChecker::CheckDirectory(minfs_inode_t* inode, ino_t ino,
                 FS_TRACE_ERROR("check: ino#%u: de[%u]: invalid namelen %u\n", ino, eno, de->namelen);
                 return ZX_ERR_IO_DATA_INTEGRITY;
             }
+            if ((buckets != 0) &&
+                (MinfsDirentBucket(de->name, de->namelen, buckets) != off / kMinfsDirBucketSize)) {
+                FS_TRACE_ERROR("check: ino#%u: de[%u]: '%.*s' in wrong bucket\n",
+                               ino, eno, de->namelen, de->name);
+                return ZX_ERR_IO_DATA_INTEGRITY;
+            }
             if ((de->namelen == 1) && (de->name[0] == '.')) {
                 if (dot) {
                     FS_TRACE_ERROR("check: ino#%u: multiple '.' entries\n", ino);
@@ -283,91 +223,100 @@ const char* MinfsChecker::CheckDataBlock(blk_t bno) {
     return nullptr;
 }
 
-zx_status_t MinfsChecker::CheckFile(minfs_inode_t* inode, ino_t ino) {
-    FS_TRACE_INFO("Direct blocks: \n");
-    for (unsigned n = 0; n < kMinfsDirect; n++) {
-        FS_TRACE_INFO(" %d,", inode->dnum[n]);
-    }
-    FS_TRACE_INFO(" ...\n");
+zx_status_t MinfsChecker::CheckExtents(ino_t ino, const minfs_extent_t* entries,
+                                       uint32_t count, uint32_t level, bool last,
+                                       blk_t* next_blk, uint32_t* block_count) {
+    for (uint32_t i = 0; i < count; i++) {
+        const minfs_extent_t& entry = entries[i];
+        const char* msg;
+        if (level == 0) {
+            if ((entry.length == 0) || (entry.fblock < *next_blk) ||
+                (entry.fblock >= kMinfsMaxFileBlock) ||
+                (entry.length > kMinfsMaxFileBlock - entry.fblock)) {
+                FS_TRACE_ERROR("check: ino#%u: bad extent (%u, %u, %u)\n",
+                               ino, entry.fblock, entry.start, entry.length);
+                return ZX_ERR_IO_DATA_INTEGRITY;
+            }
+            for (blk_t n = 0; n < entry.length; n++) {
+                if ((msg = CheckDataBlock(entry.start + n)) != nullptr) {
+                    FS_TRACE_WARN("check: ino#%u: block %u(@%u): %s\n",
+                                  ino, entry.fblock + n, entry.start + n, msg);
+                    conforming_ = false;
+                }
+            }
+            *block_count += entry.length;
+            *next_blk = entry.fblock + entry.length;
+            continue;
+        }
 
-    uint32_t block_count = 0;
+        // An index entry: check the extent block it refers to, and then the
+        // entries held by that block.
+        if ((entry.start == 0) || (entry.start >= fs_->info_.block_count)) {
+            FS_TRACE_ERROR("check: ino#%u: extent block %u(@%u): out of range\n",
+                           ino, i, entry.start);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        if ((msg = CheckDataBlock(entry.start)) != nullptr) {
+            FS_TRACE_WARN("check: ino#%u: extent block %u(@%u): %s\n", ino, i, entry.start, msg);
+            conforming_ = false;
+        }
+        (*block_count)++;
 
-    // count and sanity-check indirect blocks
-    for (unsigned n = 0; n < kMinfsIndirect; n++) {
-        if (inode->inum[n]) {
-            const char* msg;
-            if ((msg = CheckDataBlock(inode->inum[n])) != nullptr) {
-                FS_TRACE_WARN("check: ino#%u: indirect block %u(@%u): %s\n",
-                     ino, n, inode->inum[n], msg);
-                conforming_ = false;
-            }
-            block_count++;
+        uint8_t data[kMinfsBlockSize];
+        zx_status_t status;
+        if ((status = fs_->ReadDat(entry.start, data)) != ZX_OK) {
+            return status;
+        }
+        const minfs_extent_block_t* blk = reinterpret_cast<const minfs_extent_block_t*>(data);
+        const uint32_t magic = (level == 1) ? kMinfsMagicExtentLeaf : kMinfsMagicExtentIndex;
+        const bool last_block = last && (i + 1 == count);
+        if ((blk->hdr.magic != magic) || (blk->hdr.count == 0) ||
+            (blk->hdr.count > kMinfsExtentsPerBlock) || (blk->hdr.count != entry.length) ||
+            (blk->entries[0].fblock != entry.fblock)) {
+            FS_TRACE_ERROR("check: ino#%u: extent block %u(@%u): bad header\n",
+                           ino, i, entry.start);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        if (!last_block && (blk->hdr.count != kMinfsExtentsPerBlock)) {
+            FS_TRACE_ERROR("check: ino#%u: extent block %u(@%u): not full\n",
+                           ino, i, entry.start);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        if ((status = CheckExtents(ino, blk->entries, blk->hdr.count, level - 1, last_block,
+                                   next_blk, block_count)) != ZX_OK) {
+            return status;
         }
     }
+    return ZX_OK;
+}
 
-    // count and sanity-check doubly indirect blocks
-    for (unsigned n = 0; n < kMinfsDoublyIndirect; n++) {
-        if (inode->dinum[n]) {
-            const char* msg;
-            if ((msg = CheckDataBlock(inode->dinum[n])) != nullptr) {
-                FS_TRACE_WARN("check: ino#%u: doubly indirect block %u(@%u): %s\n",
-                     ino, n, inode->dinum[n], msg);
-                conforming_ = false;
-            }
-            block_count++;
+zx_status_t MinfsChecker::CheckFile(minfs_inode_t* inode, ino_t ino) {
+    if ((inode->extent_depth > kMinfsMaxExtentDepth) ||
+        (inode->extent_count > kMinfsInlineExtents)) {
+        FS_TRACE_ERROR("check: ino#%u: bad extent tree (depth %u, count %u)\n",
+                       ino, inode->extent_depth, inode->extent_count);
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
 
-            char data[kMinfsBlockSize];
-            zx_status_t status;
-            if ((status = fs_->ReadDat(inode->dinum[n], data)) != ZX_OK) {
-                return status;
-            }
-            uint32_t* entry = reinterpret_cast<uint32_t*>(data);
-
-            for (unsigned m = 0; m < kMinfsDirectPerIndirect; m++) {
-                if (entry[m]) {
-                    if ((msg = CheckDataBlock(entry[m])) != nullptr) {
-                        FS_TRACE_WARN("check: ino#%u: indirect block (in dind) %u(@%u): %s\n",
-                            ino, m, entry[m], msg);
-                        conforming_ = false;
-                    }
-                    block_count++;
-                }
-            }
-        }
+    FS_TRACE_INFO("Extents (depth %u): \n", inode->extent_depth);
+    for (unsigned n = 0; n < inode->extent_count; n++) {
+        FS_TRACE_INFO(" %u+%u@%u,", inode->extents[n].fblock, inode->extents[n].length,
+                      inode->extents[n].start);
     }
+    FS_TRACE_INFO(" ...\n");
 
-    // count and sanity-check data blocks
+    // count and sanity-check data and extent blocks
 
     // The next block which would be allocated if we expand the file size
     // by a single block.
-    unsigned next_blk = 0;
-    cached_doubly_indirect_ = 0;
-    cached_indirect_ = 0;
-
-    blk_t n = 0;
-    while (true) {
-        zx_status_t status;
-        blk_t bno;
-        blk_t next_n;
-        if ((status = GetInodeNthBno(inode, n, &next_n, &bno)) < 0) {
-            if (status == ZX_ERR_OUT_OF_RANGE) {
-                break;
-            } else {
-                return status;
-            }
-        }
-        assert(next_n > n);
-        if (bno) {
-            next_blk = n + 1;
-            block_count++;
-            const char* msg;
-            if ((msg = CheckDataBlock(bno)) != nullptr) {
-                FS_TRACE_WARN("check: ino#%u: block %u(@%u): %s\n", ino, n, bno, msg);
-                conforming_ = false;
-            }
-        }
-        n = next_n;
+    blk_t next_blk = 0;
+    uint32_t block_count = 0;
+    zx_status_t status;
+    if ((status = CheckExtents(ino, inode->extents, inode->extent_count, inode->extent_depth,
+                               true, &next_blk, &block_count)) != ZX_OK) {
+        return status;
     }
+
     if (next_blk) {
         unsigned max_blocks = fbl::round_up(inode->size, kMinfsBlockSize) / kMinfsBlockSize;
         if (next_blk > max_blocks) {
@@ -510,9 +459,6 @@ zx_status_t MinfsChecker::Init(fbl::unique_ptr<Bcache> bc, const minfs_info_t* i
     links_.reset(new int32_t[info->inode_count]{0}, info->inode_count);
     links_[0] = -1;
 
-    cached_doubly_indirect_ = 0;
-    cached_indirect_ = 0;
-
     zx_status_t status;
     if ((status = checked_inodes_.Reset(info->inode_count)) < 0) {
         return status;
@@ -107,6 +107,12 @@ public:
         ioctl_block_free_txn(fd_.get(), &tid);
     }
 
+    // Asks the block device to stop serving the fifo. The client side is left
+    // allocated for threads which may still be using it; their requests fail.
+    void CloseFifo() {
+        ioctl_block_fifo_close(fd_.get());
+    }
+
 #else
     // Lengths of each extent (in bytes)
     fbl::Array<size_t> extent_lengths_;
@@ -42,7 +42,7 @@ typedef uint32_t ino_t;
 
 constexpr uint64_t kMinfsMagic0         = (0x002153466e694d21ULL);
 constexpr uint64_t kMinfsMagic1         = (0x385000d3d3d3d304ULL);
-constexpr uint32_t kMinfsVersion        = 0x00000005;
+constexpr uint32_t kMinfsVersion        = 0x00000007;
 
 constexpr ino_t kMinfsRootIno           = 1;
 constexpr uint32_t kMinfsFlagClean      = 0x00000001; // Currently unused
@@ -52,16 +52,14 @@ constexpr uint32_t kMinfsBlockBits      = (kMinfsBlockSize * 8);
 constexpr uint32_t kMinfsInodeSize      = 256;
 constexpr uint32_t kMinfsInodesPerBlock = (kMinfsBlockSize / kMinfsInodeSize);
 
-constexpr uint32_t kMinfsDirect         = 16;
-constexpr uint32_t kMinfsIndirect       = 31;
-constexpr uint32_t kMinfsDoublyIndirect = 1;
+// The number of extents (or, for larger files, extent tree index entries)
+// which fit in an inode, and the most levels of extent blocks below it.
+constexpr uint32_t kMinfsInlineExtents  = 16;
+constexpr uint32_t kMinfsMaxExtentDepth = 2;
 
-constexpr uint32_t kMinfsDirectPerIndirect = (kMinfsBlockSize / sizeof(blk_t));
 // not possible to have a block at or past this one
-// due to the limitations of the inode and indirect blocks
-constexpr uint64_t kMinfsMaxFileBlock = (kMinfsDirect + (kMinfsIndirect * kMinfsDirectPerIndirect)
-                                        + (kMinfsDoublyIndirect * kMinfsDirectPerIndirect
-                                        * kMinfsDirectPerIndirect));
+// due to the limitations of the inode size field
+constexpr uint64_t kMinfsMaxFileBlock = UINT32_MAX / kMinfsBlockSize;
 constexpr uint64_t kMinfsMaxFileSize  = kMinfsMaxFileBlock * kMinfsBlockSize;
 
 constexpr uint32_t kMinfsTypeFile = 8;
@@ -72,6 +70,9 @@ constexpr uint32_t kMinfsMagicDir  = MinfsMagic(kMinfsTypeDir);
 constexpr uint32_t kMinfsMagicFile = MinfsMagic(kMinfsTypeFile);
 constexpr uint32_t MinfsMagicType(uint32_t n) { return n & 0xFF; }
 
+constexpr uint32_t kMinfsMagicExtentLeaf  = 0xAA6f6e45;
+constexpr uint32_t kMinfsMagicExtentIndex = 0xAA6f6e49;
+
 constexpr size_t kFVMBlockInodeBmStart = 0x10000;
 constexpr size_t kFVMBlockDataBmStart  = 0x20000;
 constexpr size_t kFVMBlockInodeStart   = 0x30000;
@@ -106,15 +107,45 @@ typedef struct {
 //   and may not overlap
 // - the abm has an entry for every block on the volume, including
 //   the info block (0), the bitmaps, etc
-// - data blocks referenced from direct and indirect block tables
-//   in inodes are also relative to (0), but it is not legal for
-//   a block number of less than dat_block (start of data blocks)
-//   to be used
+// - data blocks referenced from extents and extent blocks
+//   in inodes are relative to dat_block; data block (0) is
+//   reserved and never referenced
 // - inode numbers refer to the inode in block:
 //     ino_block + ino / kMinfsInodesPerBlock
 //   at offset: ino % kMinfsInodesPerBlock
 // - inode 0 is never used, should be marked allocated but ignored
 
+// A run of |length| blocks of a file, starting at block |fblock| of the file,
+// stored in data blocks [start, start + length).
+//
+// In an extent index, |fblock| is the first file block mapped below the
+// entry, |start| is the extent block holding the next level, and |length| is
+// the number of entries in that block.
+typedef struct {
+    blk_t fblock;
+    blk_t start;
+    uint32_t length;
+} minfs_extent_t;
+
+typedef struct {
+    uint32_t magic;                 // kMinfsMagicExtentLeaf or kMinfsMagicExtentIndex
+    uint32_t count;                 // entries in use
+} minfs_extent_header_t;
+
+constexpr uint32_t kMinfsExtentsPerBlock = (kMinfsBlockSize - sizeof(minfs_extent_header_t)) /
+                                           sizeof(minfs_extent_t);
+
+typedef struct {
+    minfs_extent_header_t hdr;
+    minfs_extent_t entries[kMinfsExtentsPerBlock];
+} minfs_extent_block_t;
+
+static_assert(sizeof(minfs_extent_block_t) <= kMinfsBlockSize,
+              "minfs extent block size is wrong");
+static_assert(kMinfsMaxFileBlock <= static_cast<uint64_t>(kMinfsInlineExtents) *
+                                    kMinfsExtentsPerBlock * kMinfsExtentsPerBlock,
+              "minfs extent tree cannot map every block of the largest file");
+
 typedef struct {
     uint32_t magic;
     uint32_t size;
@@ -125,12 +156,22 @@ typedef struct {
     uint32_t seq_num;               // bumped when modified
     uint32_t gen_num;               // bumped when deleted
     uint32_t dirent_count;          // for directories
-    uint32_t rsvd[5];
-    blk_t dnum[kMinfsDirect];    // direct blocks
-    blk_t inum[kMinfsIndirect];  // indirect blocks
-    blk_t dinum[kMinfsDoublyIndirect]; // doubly indirect blocks
+    uint32_t dir_buckets;           // for directories: hash buckets, or 0
+    uint32_t extent_count;          // entries in use in extents[]
+    uint32_t extent_depth;          // levels of extent blocks below extents[]
+    uint32_t rsvd[2];
+    minfs_extent_t extents[kMinfsInlineExtents];
 } minfs_inode_t;
 
+// Notes:
+// - the extents of a file are sorted by fblock and do not overlap; blocks
+//   of the file outside of every extent are holes, and read as zeros
+// - at depth 0, the inode holds the extents themselves. Otherwise each level
+//   is a sequence of extent blocks, filled in order: every block but the
+//   last of a level holds kMinfsExtentsPerBlock entries, and the inode
+//   indexes the top level
+// - extent blocks are data blocks, and are counted in block_count
+
 static_assert(sizeof(minfs_inode_t) == kMinfsInodeSize,
               "minfs inode size is wrong");
 
@@ -178,6 +219,38 @@ static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
 //   actual size of this record can be computed from the offset at which this
 //   record starts. If the MAX_DIR_SIZE is increased, this 'last' record will
 //   also increase in size.
+//
+// Hashed directories:
+// - a directory with a nonzero "dir_buckets" is an array of that many
+//   buckets, each kMinfsDirBucketSize bytes long, and its size is exactly
+//   dir_buckets * kMinfsDirBucketSize
+// - each bucket is a self-contained chain of records whose lengths sum to
+//   the bucket size; "kMinfsReclenLast" is never set
+// - a dirent lives in bucket MinfsDirentBucket(name, namelen, dir_buckets);
+//   "." and ".." are no exception. Each bucket covers a contiguous range of
+//   name hashes, so walking the buckets in turn visits hashes in order,
+//   whatever their number
+// - directories start out linear (dir_buckets == 0) and are converted once
+//   they outgrow a single bucket
+
+constexpr uint32_t kMinfsDirBucketSize = kMinfsBlockSize;
+constexpr uint32_t kMinfsMaxDirBuckets = kMinfsMaxDirectorySize / kMinfsDirBucketSize;
+
+static_assert(kMinfsDirBucketSize >= kMinfsMaxDirentSize,
+              "MinFS directory buckets must hold at least one dirent");
+
+static inline uint32_t MinfsDirentHash(const char* name, size_t namelen) {
+    return fnv1a32(name, namelen);
+}
+
+static inline uint32_t MinfsHashBucket(uint32_t hash, uint32_t buckets) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(hash) * buckets) >> 32);
+}
+
+static inline uint32_t MinfsDirentBucket(const char* name, size_t namelen,
+                                         uint32_t buckets) {
+    return MinfsHashBucket(MinfsDirentHash(name, namelen), buckets);
+}
 
 
 // blocksize   8K    16K    32K
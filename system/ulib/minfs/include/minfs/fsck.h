@@ -40,16 +40,17 @@ private:
 
     zx_status_t GetInode(minfs_inode_t* inode, ino_t ino);
 
-    // Returns the nth block within an inode, relative to the start of the
-    // file. Returns the "next_n" which might contain a bno. This "next_n"
-    // is for performance reasons -- it allows fsck to avoid repeatedly checking
-    // the same indirect / doubly indirect blocks with all internal
-    // bno unallocated.
-    zx_status_t GetInodeNthBno(minfs_inode_t* inode, blk_t n, blk_t* next_n,
-                               blk_t* bno_out);
     zx_status_t CheckDirectory(minfs_inode_t* inode, ino_t ino,
                                ino_t parent, uint32_t flags);
     const char* CheckDataBlock(blk_t bno);
+    // Checks the |count| entries of |entries|, which have |level| levels of
+    // extent blocks below them, and the blocks they refer to. |last| is set
+    // if the entries end their level of the extent tree. Extents must start
+    // at or after |*next_blk|, which is advanced past each one; the blocks
+    // found are added to |*block_count|.
+    zx_status_t CheckExtents(ino_t ino, const minfs_extent_t* entries, uint32_t count,
+                             uint32_t level, bool last, blk_t* next_blk,
+                             uint32_t* block_count);
     zx_status_t CheckFile(minfs_inode_t* inode, ino_t ino);
 
     fbl::unique_ptr<Minfs> fs_;
@@ -59,11 +60,6 @@ private:
     uint32_t alloc_inodes_;
     uint32_t alloc_blocks_;
     fbl::Array<int32_t> links_;
-
-    blk_t cached_doubly_indirect_;
-    blk_t cached_indirect_;
-    uint8_t doubly_indirect_cache_[kMinfsBlockSize];
-    uint8_t indirect_cache_[kMinfsBlockSize];
 };
 
 zx_status_t minfs_check_info(const minfs_info_t* info, Bcache* bc);
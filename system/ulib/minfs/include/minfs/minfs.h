@@ -10,6 +10,7 @@
 #include <inttypes.h>
 
 #ifdef __Fuchsia__
+#include <bitmap/rle-bitmap.h>
 #include <fbl/auto_lock.h>
 #include <fs/remote.h>
 #include <fs/watcher.h>
@@ -23,6 +24,7 @@
 #include <fbl/macros.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/unique_ptr.h>
+#include <fbl/vector.h>
 
 #include <fs/block-txn.h>
 #include <fs/mapped-vmo.h>
@@ -84,11 +86,24 @@ public:
     static zx_status_t Create(Minfs** out, fbl::unique_ptr<Bcache> bc,
                               const minfs_info_t* info);
 
+#ifdef __Fuchsia__
+    zx_status_t Unmount() __TA_EXCLUDES(txn_lock_);
+
+    // Set by Unmount(). Operations which would start a transaction check it
+    // under txn_lock_ and fail with ZX_ERR_BAD_STATE once it is set.
+    bool IsClosed() const __TA_REQUIRES(txn_lock_) { return closed_; }
+#else
     zx_status_t Unmount();
 
+    bool IsClosed() const { return false; }
+#endif
+
     // instantiate a vnode from an inode
     // the inode must exist in the file system
-    zx_status_t VnodeGet(fbl::RefPtr<VnodeMinfs>* out, ino_t ino);
+    // lookups run concurrently, so the hash lock is held from finding no
+    // vnode through inserting the new one; two vnodes are never instantiated
+    // for the same inode
+    zx_status_t VnodeGet(fbl::RefPtr<VnodeMinfs>* out, ino_t ino) __TA_EXCLUDES(hash_lock_);
 
     // instantiate a vnode with a new inode
     zx_status_t VnodeNew(WriteTxn* txn, fbl::RefPtr<VnodeMinfs>* out, uint32_t type);
@@ -97,10 +112,18 @@ public:
     void VnodeInsert(VnodeMinfs* vn) __TA_EXCLUDES(hash_lock_);
     fbl::RefPtr<VnodeMinfs> VnodeLookup(uint32_t ino) __TA_EXCLUDES(hash_lock_);
     void VnodeReleaseLocked(VnodeMinfs* vn) __TA_REQUIRES(hash_lock_);
+    void VnodeInsertLocked(VnodeMinfs* vn) __TA_REQUIRES(hash_lock_);
+    fbl::RefPtr<VnodeMinfs> VnodeLookupLocked(uint32_t ino) __TA_REQUIRES(hash_lock_);
 
     // Allocate a new data block.
     zx_status_t BlockNew(WriteTxn* txn, blk_t hint, blk_t* out_bno);
 
+    // Allocate a new block of file data. |goal| is the block following the
+    // one which holds the preceding block of the file, or zero if there is
+    // none. Blocks are handed out in contiguous runs, so that large files can
+    // be transferred with large requests.
+    zx_status_t DataBlockNew(WriteTxn* txn, blk_t goal, blk_t* out_bno);
+
     // free block in block bitmap
     zx_status_t BlockFree(WriteTxn* txn, blk_t bno);
 
@@ -128,13 +151,19 @@ public:
     // Signals the completion object as soon as...
     // (1) A sync probe has entered and exited the writeback queue, and
     // (2) The block cache has sync'd with the underlying block device.
-    zx_status_t Sync(completion_t* completion);
+    zx_status_t Sync(completion_t* completion) __TA_EXCLUDES(txn_lock_);
 #endif
 
     fbl::unique_ptr<Bcache> bc_{};
     minfs_info_t info_{};
 #ifdef __Fuchsia__
+    // Serializes every operation which modifies the filesystem, from building
+    // a WritebackWork through handing it to EnqueueWork, so that writeback
+    // observes modifications in the order they were made. Acquired before
+    // any VnodeMinfs::lock_.
+    fbl::Mutex txn_lock_;
     fbl::Mutex hash_lock_;
+    bool closed_ __TA_GUARDED(txn_lock_) = false;
 #endif
 
     // The following methods are used to read one block from the specified extent,
@@ -159,6 +188,9 @@ private:
     // Enqueues an update for allocated inode/block counts
     zx_status_t CountUpdate(WriteTxn* txn);
 
+    // Marks the free block |bno| as allocated and enqueues the bitmap update.
+    zx_status_t BlockAllocate(WriteTxn* txn, blk_t bno);
+
     // If possible, attempt to resize the MinFS partition.
     zx_status_t AddInodes();
     zx_status_t AddBlocks();
@@ -168,6 +200,10 @@ private:
     uint32_t inoblks_{};
     RawBitmap inode_map_{};
     RawBitmap block_map_{};
+    // Where DataBlockNew looks for room to start the next run. Runs started
+    // for different files are spaced apart so the files may keep growing
+    // contiguously.
+    blk_t alloc_rotor_{};
 #ifdef __Fuchsia__
     fbl::unique_ptr<MappedVmo> inode_table_{};
     fbl::unique_ptr<MappedVmo> info_vmo_{};
@@ -206,6 +242,7 @@ struct DirArgs {
     uint32_t type;
     uint32_t reclen;
     WritebackWork* wb;
+    size_t off;      // Offset of the matching dirent, set by lookups
 };
 
 struct DirectoryOffset {
@@ -233,8 +270,12 @@ public:
 
     zx_status_t UnlinkChild(WritebackWork* wb, fbl::RefPtr<VnodeMinfs> child,
                             minfs_dirent_t* de, DirectoryOffset* offs);
+    // Adds the dirent described by |args| to this directory, indexing the
+    // directory by name hash once it outgrows a single bucket.
+    zx_status_t AppendDirent(DirArgs* args);
     // Remove the link to a vnode (referring to inodes exclusively).
     // Has no impact on direntries (or parent inode).
+    // Acquires the vnode lock; the caller must hold the transaction lock.
     void RemoveInodeLink(WriteTxn* txn);
     zx_status_t ReadInternal(void* data, size_t len, size_t off, size_t* actual);
     zx_status_t ReadExactInternal(void* data, size_t len, size_t off);
@@ -246,7 +287,7 @@ public:
     zx_status_t Ioctl(uint32_t op, const void* in_buf, size_t in_len, void* out_buf,
                       size_t out_len, size_t* out_actual) final;
     zx_status_t Lookup(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece name) final;
-    // Lookup which can traverse '..'
+    // Lookup which can traverse '..'. Acquires the vnode lock.
     zx_status_t LookupInternal(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece name);
 
     Minfs* fs_{};
@@ -272,6 +313,10 @@ private:
                       size_t* out_actual) final;
     zx_status_t Append(const void* data, size_t len, size_t* out_end,
                        size_t* out_actual) final;
+    // Common implementation of Write and Append. The caller must hold both
+    // the transaction lock and the vnode lock.
+    zx_status_t WriteLocked(const void* data, size_t len, size_t offset,
+                            size_t* out_actual);
     zx_status_t Getattr(vnattr_t* a) final;
     zx_status_t Setattr(const vnattr_t* a) final;
     zx_status_t Readdir(fs::vdircookie_t* cookie, void* dirents, size_t len,
@@ -288,13 +333,15 @@ private:
     zx_status_t Sync() final;
     zx_status_t AttachRemote(fs::MountChannel h) final;
     zx_status_t InitVmo();
-    zx_status_t InitIndirectVmo();
-    // Loads indirect blocks up to and including the doubly indirect block at |index|
-    zx_status_t LoadIndirectWithinDoublyIndirect(uint32_t index);
-    // Initializes the indirect VMO, grows it to |size| bytes, and reads |count| indirect
-    // blocks from |iarray| into the indirect VMO, starting at block offset |offset|.
-    zx_status_t LoadIndirectBlocks(blk_t* iarray, uint32_t count, uint32_t offset,
-                                   uint64_t size);
+    // Reads the blocks in [start, end) which have not been loaded into the
+    // VMO yet, clipped to the size of the file.
+    zx_status_t LoadVmoBlocks(blk_t start, blk_t end);
+    // Loads the blocks covering [off, off + len) ahead of a read, along with
+    // the following blocks if the file is being read sequentially.
+    zx_status_t LoadVmoForRead(size_t off, size_t len);
+    // Creates or grows |vmo_extents_| to stage an extent tree with |leaves|
+    // leaf blocks.
+    zx_status_t InitExtentVmo(size_t leaves);
 #endif  // __Fuchsia__
 
     // Although file sizes don't need to be block-aligned, the underlying VMO is
@@ -323,85 +370,35 @@ private:
     }
 
 
-    // Get the disk block 'bno' corresponding to the 'nth' block relative to the start of the
-    // current direct/indirect/doubly indirect block section.
+    // Get the disk block 'bno' corresponding to the 'nth' block of the file.
     // Allocate the block if requested with a non-null "txn".
     zx_status_t GetBno(WriteTxn* txn, blk_t n, blk_t* bno);
-    // Acquire (or allocate) a direct block |*bno|. If allocation occurs,
-    // |*dirty| is set to true, and the inode block is written to disk.
-    //
-    // Example call for accessing the 0th direct block in the inode:
-    // GetBnoDirect(txn, &inode_.dnum[0], &dirty);
-    zx_status_t GetBnoDirect(WriteTxn* txn, blk_t* bno, bool* dirty);
-    // Acquire (or allocate) a direct block |*bno| contained at index |bindex| within an indirect
-    // block |*ibno|, which is allocated if necessary. If allocation of the indirect block occurs,
-    // |*dirty| is set to true, and the indirect and inode blocks are written to disk.
-    //
-    // On Fuchsia, |ib_vmo_offset| contains the block offset of |*ibno| within the cached
-    // indirect VMO. On other platforms, this argument may be ignored.
-    //
-    // Example call for accessing the 3rd direct block within the 2nd indirect block:
-    // GetBnoIndirect(txn, 3, 2, &inode_.inum[2], &bno, &dirty);
-    zx_status_t GetBnoIndirect(WriteTxn* txn, uint32_t bindex, uint32_t ib_vmo_offset,
-                               blk_t* ibno, blk_t* bno, bool* dirty);
-    // Acquire (or allocate) a direct block |*bno| contained at index |bindex| within a doubly
-    // indirect block |*dibno|, at index |ibindex| within that indirect block. If allocation occurs,
-    // |*dirty| is set to true, and the doubly indirect, indirect, and inode blocks are written to
-    // disk. |dib_vmo_offset| and |ib_vmo_offset| are the offset of the doubly indirect block and
-    // the doubly indirect block's indirect block set within the indirect VMO, respectively.
-    //
-    // Example call for accessing the 3rd direct block in the 2nd indirect block
-    // in the 0th doubly indirect block:
-    // GetBnoDoublyIndirect(txn, 2, 3, GetVmoOffsetForDoublyIndirect(0), GetVmoOffsetForIndirect(0),
-    //                      &inode_.dinum[0], &bno, &dirty);
-    zx_status_t GetBnoDoublyIndirect(WriteTxn* txn, uint32_t ibindex, uint32_t bindex,
-                                     uint32_t dib_vmo_offset, uint32_t ib_vmo_offset,
-                                     blk_t* dibno, blk_t* bno, bool* dirty);
 
     // Deletes all blocks (relative to a file) from "start" (inclusive) to the end
     // of the file. Does not update mtime/atime.
     zx_status_t BlocksShrink(WriteTxn* txn, blk_t start);
-    // Shrink |count| direct blocks from the |barray| array of direct blocks. Sets |*dirty| to
-    // true if anything is deleted.
-    zx_status_t BlocksShrinkDirect(WriteTxn *txn, size_t count, blk_t* barray, bool* dirty);
 
-    // Shrink |count| indirect blocks from the |iarray| array of indirect blocks. Sets |*dirty| to
-    // true if anything is deleted.
-    //
-    // For the first indirect block in a set, only remove the blocks from index |bindex| up to the
-    // end of the  indirect block. Only deletes this first indirect block if |bindex| is zero.
-    //
-    // On Fuchsia |ib_vmo_offset| contains the block offset of the |iarray| buffer within the
-    // cached indirect VMO. On other platforms, this argument may be ignored.
-    zx_status_t BlocksShrinkIndirect(WriteTxn* txn, uint32_t bindex, size_t count,
-                                     uint32_t ib_vmo_offset, blk_t* iarray, bool* dirty);
-    // Shrink |count| doubly indirect blocks from the |diarray| array of doubly indirect blocks.
-    // Sets |*dirty| to true if anything is deleted.
-    //
-    // For the first doubly indirect block in a set, only remove blocks from indirect blocks from
-    // index |ibindex| up to the end of the doubly indirect block. |bindex| is the first direct
-    // block to be deleted in the first indirect block of the first doubly indirect block. Only
-    // delete the doubly indirect block if |ibindex| is zero AND |bindex| is zero.
-    //
-    // On Fuchsia |dib_vmo_offset| contains the block offset of the |diarray| buffer within the
-    // cached indirect VMO, and |ib_vmo_offset| contains the block offset of the indirect blocks
-    // pointed to from the doubly indirect block at diarray[0]. On other platforms, this argument
-    // may be ignored.
-    zx_status_t BlocksShrinkDoublyIndirect(WriteTxn *txn, uint32_t ibindex, uint32_t bindex,
-                                           size_t count, uint32_t dib_vmo_offset,
-                                           uint32_t ib_vmo_offset, blk_t* diarray, bool* dirty);
-
-#ifdef __Fuchsia__
-    // Reads the block at |offset| in memory
-    void ReadIndirectVmoBlock(uint32_t offset, uint32_t** entry);
-    // Clears the block at |offset| in memory
-    void ClearIndirectVmoBlock(uint32_t offset);
-#else
-    // Reads the block at |bno| on disk
-    void ReadIndirectBlock(blk_t bno, uint32_t* entry);
-    // Clears the block at |bno| on disk
-    void ClearIndirectBlock(blk_t bno);
-#endif
+    // Reads the extents of the file from the inode and its extent blocks
+    // into |extents_|, if that has not been done yet.
+    zx_status_t ExtentsLoad();
+    // Appends the extents mapped by the |count| entries of |entries|, which
+    // have |level| levels of extent blocks below them, to |extents_|.
+    zx_status_t ExtentsLoadEntries(const minfs_extent_t* entries, uint32_t count,
+                                   uint32_t level);
+    // Returns the index of the first extent which starts past file block |n|.
+    size_t ExtentsFind(blk_t n) const;
+    // Records that file block |n|, which precedes extent |index|, is stored
+    // in data block |bno|.
+    zx_status_t ExtentsInsert(WriteTxn* txn, size_t index, blk_t n, blk_t bno);
+    // Allocates enough extent blocks to hold |count| extents. Extent blocks
+    // which are no longer needed are freed by ExtentsSync().
+    zx_status_t ExtentsReserve(WriteTxn* txn, size_t count);
+    // Returns entry |index| of |level| of the extent tree: an extent at
+    // level 0, or the index entry for block |index| of the level below.
+    minfs_extent_t ExtentEntry(uint32_t level, size_t index) const;
+    // Writes back the extent blocks which changed, and stores the top level
+    // of the extent tree in the inode.
+    void ExtentsSync(WriteTxn* txn);
 
     // Update the vnode's inode and write it to disk
     void InodeSync(WriteTxn* txn, uint32_t flags);
@@ -411,8 +408,36 @@ private:
                                            DirectoryOffset*);
 
     // Directories only
+    //
+    // In a hashed directory, only the bucket holding |args->name| is visited.
     zx_status_t ForEachDirent(DirArgs* args, const DirentCallback func);
 
+    // Returns the end of the run of records containing |off|: the end of its
+    // bucket in a hashed directory, or the maximum directory size otherwise.
+    size_t DirentRegionEnd(size_t off) const;
+    // Returns the offset past which no dirent may start.
+    size_t DirentEnd() const;
+
+    // Lists a linear directory in place, starting from the dirent at |*off|,
+    // which was a dirent offset when the inode's seq_num was |seqno|. Leaves
+    // |*off| at the first dirent which did not fit in |df|.
+    zx_status_t ReaddirLinear(size_t* off, uint32_t seqno, fs::DirentFiller* df);
+
+    // Increases the number of hash buckets until every live dirent fits, or
+    // returns ZX_ERR_NO_SPACE once kMinfsMaxDirBuckets is reached.
+    zx_status_t GrowBuckets(WritebackWork* wb);
+    // Rewrites the directory as |buckets| hash buckets. Returns
+    // ZX_ERR_NO_SPACE without modifying the directory if some bucket would
+    // overflow.
+    zx_status_t DirRehash(WritebackWork* wb, uint32_t buckets);
+
+    // Consults the dirent cache for |args->name|, filling in |args| on a hit.
+    // Cached offsets are verified against the dirent on disk before use.
+    bool DirentCacheLookup(DirArgs* args);
+    void DirentCacheInsert(fbl::StringPiece name, size_t off);
+    void DirentCacheRemove(fbl::StringPiece name, size_t off);
+    void DirentCacheReset();
+
     // Deletes this Vnode from disk, freeing the inode and blocks.
     //
     // Must only be called on Vnodes which
@@ -429,19 +454,26 @@ private:
 
     // TODO(smklein): When we have can register MinFS as a pager service, and
     // it can properly handle pages faults on a vnode's contents, then we can
-    // avoid reading the entire file up-front. Until then, read the contents of
-    // a VMO into memory when it is read/written.
+    // let the kernel tell us which pages are needed. Until then, blocks are
+    // read into the VMO as reads and writes touch them.
     zx::vmo vmo_{};
 
-    // vmo_indirect_ contains all indirect and doubly indirect blocks in the following order:
-    // First kMinfsIndirect blocks                                - initial set of indirect blocks
-    // Next kMinfsDoublyIndirect blocks                           - doubly indirect blocks
-    // Next kMinfsDoublyIndirect * kMinfsDirectPerIndirect blocks - indirect blocks pointed to
-    //                                                              by doubly indirect blocks
-    fbl::unique_ptr<MappedVmo> vmo_indirect_{};
+    // The blocks of vmo_ which hold the contents of the file. Blocks outside
+    // of these ranges have not been read from disk yet.
+    bitmap::RleBitmap vmo_loaded_;
+
+    // Read-ahead state: the offset at which the previous read ended, and the
+    // number of blocks past the end of a sequential read which are loaded
+    // along with it.
+    size_t last_read_end_ = 0;
+    blk_t readahead_blocks_ = 0;
+
+    // Staging area for extent blocks written back by ExtentsSync(). Index
+    // blocks are held at kMinfsInlineExtents blocks at the front, followed
+    // by the leaves.
+    fbl::unique_ptr<MappedVmo> vmo_extents_{};
 
     vmoid_t vmoid_{};
-    vmoid_t vmoid_indirect_{};
 
     // Use the watcher container to implement a directory watcher
     void Notify(fbl::StringPiece name, unsigned event) final;
@@ -461,30 +493,42 @@ private:
     // VnodeMinfs's own refcount, since there may still be filesystem
     // work to do after the last file descriptor has been closed.
     uint32_t fd_count_{};
-};
-
-// Return the block offset in vmo_indirect_ of indirect blocks pointed to by the doubly indirect
-// block at dindex
-constexpr uint32_t GetVmoOffsetForIndirect(uint32_t dibindex) {
-    return kMinfsIndirect + kMinfsDoublyIndirect + (dibindex * kMinfsDirectPerIndirect);
-}
-
-// Return the required vmo size (in bytes) to store indirect blocks pointed to by doubly indirect
-// block dibindex
-constexpr size_t GetVmoSizeForIndirect(uint32_t dibindex) {
-    return GetVmoOffsetForIndirect(dibindex + 1) * kMinfsBlockSize;
-}
 
-// Return the block offset of doubly indirect blocks in vmo_indirect_
-constexpr uint32_t GetVmoOffsetForDoublyIndirect(uint32_t dibindex) {
-    ZX_DEBUG_ASSERT(dibindex < kMinfsDoublyIndirect);
-    return kMinfsIndirect + dibindex;
-}
+    // The extents of the file, sorted by file block. The extent blocks
+    // holding them are |extent_blocks_[0]|, and those indexing the level
+    // below are |extent_blocks_[1]|; the inode indexes the top level.
+    fbl::Vector<minfs_extent_t> extents_{};
+    fbl::Vector<blk_t> extent_blocks_[kMinfsMaxExtentDepth]{};
+    bool extents_loaded_{};
+    // The first extent which changed since the extent blocks were last
+    // written back, and the number of blocks of each level which were.
+    size_t extents_dirty_{};
+    size_t extent_blocks_synced_[kMinfsMaxExtentDepth]{};
+
+    // Directories only: a direct-mapped cache from name hash to dirent
+    // offset, allocated once a directory holds kDirentCacheMinEntries dirents.
+    struct DirentCacheEntry {
+        uint32_t hash;
+        uint32_t off;
+    };
+    static constexpr size_t kDirentCacheSize = 256;
+    static constexpr uint32_t kDirentCacheMinEntries = 32;
+    fbl::unique_ptr<DirentCacheEntry[]> dirent_cache_{};
+
+    // Directories only: the size of the directory when converting it to hash
+    // buckets last failed for lack of space, or 0.
+    size_t dir_rehash_failed_size_{};
 
-// Return the required vmo size (in bytes) to store doubly indirect blocks in vmo_indirect_
-constexpr size_t GetVmoSizeForDoublyIndirect() {
-    return (kMinfsIndirect + kMinfsDoublyIndirect) * kMinfsBlockSize;
-}
+#ifdef __Fuchsia__
+    // Guards |inode_|, the cached VMOs and extents, |fd_count_|,
+    // |dirent_cache_| and |dir_rehash_failed_size_| against concurrent
+    // dispatch threads.
+    // Operations which only read take this lock alone; operations which
+    // modify the vnode take Minfs::txn_lock_ first. More than one vnode lock
+    // may only be held while holding the transaction lock.
+    fbl::Mutex lock_;
+#endif
+};
 
 // write the inode data of this vnode to disk (default does not update time values)
 void minfs_sync_vnode(fbl::RefPtr<VnodeMinfs> vn, uint32_t flags);
@@ -218,6 +218,10 @@ zx_status_t Minfs::InodeSync(WriteTxn* txn, ino_t ino, const minfs_inode_t* inod
 
 #ifdef __Fuchsia__
 zx_status_t Minfs::Sync(completion_t* completion) {
+    fbl::AutoLock txn_lock(&txn_lock_);
+    if (closed_) {
+        return ZX_ERR_BAD_STATE;
+    }
     fbl::unique_ptr<WritebackWork> wb(new WritebackWork(bc_.get()));
     wb->SetCompletion(completion);
     EnqueueWork(fbl::move(wb));
@@ -271,108 +275,14 @@ zx_status_t Minfs::InoFree(VnodeMinfs* vn, WriteTxn* txn) {
 
     blk_t bitbno = vn->ino_ / kMinfsBlockBits;
     txn->Enqueue(ibm_id, bitbno, info_.ibm_block + bitbno, 1);
-    uint32_t block_count = vn->inode_.block_count;
-
-    // release all direct blocks
-    for (unsigned n = 0; n < kMinfsDirect; n++) {
-        if (vn->inode_.dnum[n] == 0) {
-            continue;
-        }
-        ValidateBno(vn->inode_.dnum[n]);
-        block_count--;
-        BlockFree(txn, vn->inode_.dnum[n]);
-    }
-
-
-    // release all indirect blocks
-    for (unsigned n = 0; n < kMinfsIndirect; n++) {
-        if (vn->inode_.inum[n] == 0) {
-            continue;
-        }
-
-#ifdef __Fuchsia__
-        zx_status_t status;
-        if ((status = vn->InitIndirectVmo()) != ZX_OK) {
-            return status;
-        }
-
-        uint32_t* entry;
-        vn->ReadIndirectVmoBlock(n, &entry);
-#else
-        uint32_t entry[kMinfsBlockSize];
-        vn->ReadIndirectBlock(vn->inode_.inum[n], entry);
-#endif
-
-        // release the direct blocks pointed at by the entries in the indirect block
-        for (unsigned m = 0; m < kMinfsDirectPerIndirect; m++) {
-            if (entry[m] == 0) {
-                continue;
-            }
-            block_count--;
-            BlockFree(txn, entry[m]);
-        }
-        // release the direct block itself
-        block_count--;
-        BlockFree(txn, vn->inode_.inum[n]);
-    }
-
-    // release doubly indirect blocks
-    for (unsigned n = 0; n < kMinfsDoublyIndirect; n++) {
-        if (vn->inode_.dinum[n] == 0) {
-            continue;
-        }
-#ifdef __Fuchsia__
-        zx_status_t status;
-        if ((status = vn->InitIndirectVmo()) != ZX_OK) {
-            return status;
-        }
-
-        uint32_t* dentry;
-        vn->ReadIndirectVmoBlock(GetVmoOffsetForDoublyIndirect(n), &dentry);
-#else
-        uint32_t dentry[kMinfsBlockSize];
-        vn->ReadIndirectBlock(vn->inode_.dinum[n], dentry);
-#endif
-        // release indirect blocks
-        for (unsigned m = 0; m < kMinfsDirectPerIndirect; m++) {
-            if (dentry[m] == 0) {
-                continue;
-            }
-
-#ifdef __Fuchsia__
-            if ((status = vn->LoadIndirectWithinDoublyIndirect(n)) != ZX_OK) {
-                return status;
-            }
-
-            uint32_t* entry;
-            vn->ReadIndirectVmoBlock(GetVmoOffsetForIndirect(n) + m, &entry);
-
-#else
-            uint32_t entry[kMinfsBlockSize];
-            vn->ReadIndirectBlock(dentry[m], entry);
-#endif
-
-            // release direct blocks
-            for (unsigned k = 0; k < kMinfsDirectPerIndirect; k++) {
-                if (entry[k] == 0) {
-                    continue;
-                }
-
-                block_count--;
-                BlockFree(txn, entry[k]);
-            }
-
-            block_count--;
-            BlockFree(txn, dentry[m]);
-        }
-
-        // release the doubly indirect block itself
-        block_count--;
-        BlockFree(txn, vn->inode_.dinum[n]);
+    // release the data and extent blocks
+    zx_status_t status;
+    if ((status = vn->BlocksShrink(txn, 0)) != ZX_OK) {
+        return status;
     }
 
     CountUpdate(txn);
-    ZX_DEBUG_ASSERT(block_count == 0);
+    ZX_DEBUG_ASSERT(vn->inode_.block_count == 0);
     ZX_DEBUG_ASSERT(vn->IsUnlinked());
     return ZX_OK;
 }
@@ -586,6 +496,10 @@ void Minfs::VnodeInsert(VnodeMinfs* vn) {
 #ifdef __Fuchsia__
     fbl::AutoLock lock(&hash_lock_);
 #endif
+    VnodeInsertLocked(vn);
+}
+
+void Minfs::VnodeInsertLocked(VnodeMinfs* vn) {
     ZX_DEBUG_ASSERT_MSG(!vnode_hash_.find(vn->ino_).IsValid(), "ino %u already in map\n", vn->ino_);
     vnode_hash_.insert(vn);
 }
@@ -593,6 +507,12 @@ void Minfs::VnodeInsert(VnodeMinfs* vn) {
 fbl::RefPtr<VnodeMinfs> Minfs::VnodeLookup(uint32_t ino) {
 #ifdef __Fuchsia__
     fbl::AutoLock lock(&hash_lock_);
+#endif
+    return VnodeLookupLocked(ino);
+}
+
+fbl::RefPtr<VnodeMinfs> Minfs::VnodeLookupLocked(uint32_t ino) {
+#ifdef __Fuchsia__
     auto rawVn = vnode_hash_.find(ino);
     if (!rawVn.IsValid()) {
         // Nothing exists in the lookup table
@@ -626,28 +546,41 @@ zx_status_t Minfs::VnodeGet(fbl::RefPtr<VnodeMinfs>* out, ino_t ino) {
         return ZX_ERR_OUT_OF_RANGE;
     }
 
-    fbl::RefPtr<VnodeMinfs> vn = VnodeLookup(ino);
+#ifdef __Fuchsia__
+    fbl::AutoLock lock(&hash_lock_);
+#endif
+    fbl::RefPtr<VnodeMinfs> vn = VnodeLookupLocked(ino);
     if (vn != nullptr) {
         *out = fbl::move(vn);
         return ZX_OK;
     }
     zx_status_t status;
-    if ((status = VnodeMinfs::AllocateHollow(this, &vn)) != ZX_OK) {
-        return ZX_ERR_NO_MEMORY;
-    }
 
     // obtain the block of the inode table we need
+    minfs_inode_t inode;
     uint32_t off_of_ino = (ino % kMinfsInodesPerBlock) * kMinfsInodeSize;
 #ifdef __Fuchsia__
-    void* inodata = (void*)((uintptr_t)(inode_table_->GetData()) +
-                            (uintptr_t)((ino / kMinfsInodesPerBlock) * kMinfsBlockSize));
+    // Read through the VMO rather than the mapping: lookups don't hold
+    // txn_lock_, and AddInodes may move the mapping while the table grows.
+    size_t actual;
+    status = zx_vmo_read(inode_table_->GetVmo(), &inode,
+                         (ino / kMinfsInodesPerBlock) * kMinfsBlockSize + off_of_ino,
+                         kMinfsInodeSize, &actual);
+    if (status != ZX_OK || actual != kMinfsInodeSize) {
+        return ZX_ERR_IO;
+    }
 #else
     uint8_t inodata[kMinfsBlockSize];
     bc_->Readblk(info_.ino_block + (ino / kMinfsInodesPerBlock), inodata);
+    memcpy(&inode, (void*)((uintptr_t)inodata + off_of_ino), kMinfsInodeSize);
 #endif
-    memcpy(&vn->inode_, (void*)((uintptr_t)inodata + off_of_ino), kMinfsInodeSize);
+
+    if ((status = VnodeMinfs::AllocateHollow(this, &vn)) != ZX_OK) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    memcpy(&vn->inode_, &inode, kMinfsInodeSize);
     vn->ino_ = ino;
-    VnodeInsert(vn.get());
+    VnodeInsertLocked(vn.get());
 
     *out = fbl::move(vn);
     return ZX_OK;
@@ -688,10 +621,53 @@ zx_status_t Minfs::BlockNew(WriteTxn* txn, blk_t hint, blk_t* out_bno) {
         }
     }
 
-    status = block_map_.Set(bitoff_start, bitoff_start + 1);
-    assert(status == ZX_OK);
-    info_.alloc_block_count++;
     blk_t bno = static_cast<blk_t>(bitoff_start);
+    if ((status = BlockAllocate(txn, bno)) != ZX_OK) {
+        return status;
+    }
+    *out_bno = bno;
+    return ZX_OK;
+}
+
+// The number of free blocks DataBlockNew looks for when starting a new run.
+constexpr size_t kMinfsAllocRun = 32;
+
+zx_status_t Minfs::DataBlockNew(WriteTxn* txn, blk_t goal, blk_t* out_bno) {
+    zx_status_t status;
+    if ((goal != 0) && (goal < block_map_.size()) && !block_map_.Get(goal, goal + 1)) {
+        // Extend the file's current run.
+        if ((status = BlockAllocate(txn, goal)) != ZX_OK) {
+            return status;
+        }
+        *out_bno = goal;
+        return ZX_OK;
+    }
+
+    // Start a new run at the next sufficiently large free region, leaving
+    // the rest of the region for this file to grow into.
+    size_t start = (alloc_rotor_ < block_map_.size()) ? alloc_rotor_ : 0;
+    size_t bitoff;
+    if ((block_map_.Find(false, start, block_map_.size(), kMinfsAllocRun, &bitoff) == ZX_OK) ||
+        (block_map_.Find(false, 0, start, kMinfsAllocRun, &bitoff) == ZX_OK)) {
+        blk_t bno = static_cast<blk_t>(bitoff);
+        if ((status = BlockAllocate(txn, bno)) != ZX_OK) {
+            return status;
+        }
+        alloc_rotor_ = static_cast<blk_t>(bitoff + kMinfsAllocRun);
+        *out_bno = bno;
+        return ZX_OK;
+    }
+
+    // Free space is too fragmented for a new run; take any free block.
+    return BlockNew(txn, goal, out_bno);
+}
+
+zx_status_t Minfs::BlockAllocate(WriteTxn* txn, blk_t bno) {
+    zx_status_t status;
+    if ((status = block_map_.Set(bno, bno + 1)) != ZX_OK) {
+        return status;
+    }
+    info_.alloc_block_count++;
     ValidateBno(bno);
 
     // obtain the in-memory bitmap block
@@ -705,7 +681,6 @@ zx_status_t Minfs::BlockNew(WriteTxn* txn, blk_t hint, blk_t* out_bno) {
     void* bmdata = fs::GetBlock<kMinfsBlockSize>(block_map_.StorageUnsafe()->GetData(), bmbno_rel);
     bc_->Writeblk(bmbno_abs, bmdata);
 #endif
-    *out_bno = bno;
 
     CountUpdate(txn);
     return ZX_OK;
@@ -898,15 +873,29 @@ zx_status_t minfs_mount(fbl::RefPtr<VnodeMinfs>* out, fbl::unique_ptr<Bcache> bc
 
 zx_status_t Minfs::Unmount() {
 #ifdef __Fuchsia__
-    // Ensure writeback buffer completes before auxilliary structures
-    // are deleted.
-    writeback_ = nullptr;
+    {
+        fbl::AutoLock txn_lock(&txn_lock_);
+        if (closed_) {
+            return ZX_ERR_BAD_STATE;
+        }
+        // Other dispatch threads may still be serving requests. Any of them
+        // that starts a transaction from here on sees closed_ and fails,
+        // rather than using the writeback queue torn down below.
+        closed_ = true;
+        // Ensure writeback buffer completes before auxilliary structures
+        // are deleted.
+        writeback_ = nullptr;
+    }
 #endif
     bc_->Sync();
-    // Explicitly delete this (rather than just letting the memory release when
-    // the process exits) to ensure that the block device's fifo has been
-    // closed.
+#ifdef __Fuchsia__
+    // The filesystem can't be deleted while other dispatch threads may still
+    // be reading through it, so close the block device's fifo explicitly
+    // before exiting.
+    bc_->CloseFifo();
+#else
     delete this;
+#endif
     // TODO(smklein): To not bind filesystem lifecycle to a process, shut
     // down (closing dispatcher) rather than calling exit.
     exit(0);
@@ -1119,7 +1108,10 @@ int minfs_mkfs(fbl::unique_ptr<Bcache> bc) {
     ino[kMinfsRootIno].block_count = 1;
     ino[kMinfsRootIno].link_count = 2;
     ino[kMinfsRootIno].dirent_count = 2;
-    ino[kMinfsRootIno].dnum[0] = 1;
+    ino[kMinfsRootIno].extent_count = 1;
+    ino[kMinfsRootIno].extents[0].fblock = 0;
+    ino[kMinfsRootIno].extents[0].start = 1;
+    ino[kMinfsRootIno].extents[0].length = 1;
     bc->Writeblk(info.ino_block, blk);
 
     memset(blk, 0, sizeof(blk));
@@ -32,6 +32,21 @@ zx_time_t minfs_gettime_utc() {
     return time;
 }
 
+// Stores the number of extent blocks on each level of the extent tree of a
+// file with |count| extents in |blocks|, and returns the depth of the tree.
+uint32_t ExtentTreeShape(size_t count, size_t* blocks) {
+    uint32_t depth = 0;
+    while (count > minfs::kMinfsInlineExtents) {
+        ZX_DEBUG_ASSERT(depth < minfs::kMinfsMaxExtentDepth);
+        count = fbl::round_up(count, minfs::kMinfsExtentsPerBlock) / minfs::kMinfsExtentsPerBlock;
+        blocks[depth++] = count;
+    }
+    for (uint32_t level = depth; level < minfs::kMinfsMaxExtentDepth; level++) {
+        blocks[level] = 0;
+    }
+    return depth;
+}
+
 } // namespace anonymous
 
 namespace minfs {
@@ -74,280 +89,352 @@ void VnodeMinfs::InodeSync(WriteTxn* txn, uint32_t flags) {
         }
     }
 
+    ExtentsSync(txn);
     fs_->InodeSync(txn, ino_, &inode_);
 }
 
-zx_status_t VnodeMinfs::BlocksShrinkDirect(WriteTxn *txn, size_t count, blk_t* barray,
-                                           bool* dirty) {
-    // release direct blocks
-    for (unsigned i = 0; i < count; i++) {
-        if (barray[i] == 0) {
-            continue;
-        }
-        fs_->ValidateBno(barray[i]);
-        fs_->BlockFree(txn, barray[i]);
-        barray[i] = 0;
-        inode_.block_count--;
-        *dirty = true;
+// Delete all blocks (relative to a file) from "start" (inclusive) to the end of
+// the file. Does not update mtime/atime.
+zx_status_t VnodeMinfs::BlocksShrink(WriteTxn *txn, blk_t start) {
+    zx_status_t status;
+    if ((status = ExtentsLoad()) != ZX_OK) {
+        return status;
     }
 
-    return ZX_OK;
-}
-
-zx_status_t VnodeMinfs::BlocksShrinkIndirect(WriteTxn* txn, uint32_t bindex, size_t count,
-                                             uint32_t ib_vmo_offset, blk_t* iarray,
-                                             bool* dirty) {
-    // release indirect blocks
-    for (unsigned i = 0; i < count; i++) {
-        if (iarray[i] == 0) {
-            continue;
+    bool dirty = false;
+    while (!extents_.is_empty()) {
+        const size_t index = extents_.size() - 1;
+        minfs_extent_t* extent = &extents_[index];
+        if (extent->fblock + extent->length <= start) {
+            break;
         }
-        fs_->ValidateBno(iarray[i]);
 
-#ifdef __Fuchsia__
-        uint32_t* entry;
-        ReadIndirectVmoBlock(ib_vmo_offset + i, &entry);
-#else
-        uint32_t entry[kMinfsBlockSize];
-        ReadIndirectBlock(iarray[i], entry);
-#endif
-
-        // release the blocks pointed at by the entries in the indirect block
-        zx_status_t status;
-        uint32_t direct_start = i == 0 ? bindex : 0;
-        if ((status = BlocksShrinkDirect(txn, kMinfsDirectPerIndirect - direct_start,
-                                         &entry[direct_start], dirty)) != ZX_OK) {
-            return status;
+        // release the blocks of the extent from "start" on
+        const blk_t keep = (extent->fblock < start) ? start - extent->fblock : 0;
+        for (blk_t i = keep; i < extent->length; i++) {
+            fs_->BlockFree(txn, extent->start + i);
+            inode_.block_count--;
         }
+        extents_dirty_ = fbl::min(extents_dirty_, index);
+        dirty = true;
 
-        // only update the indirect block if an entry was deleted
-        if (*dirty) {
-#ifdef __Fuchsia__
-            txn->Enqueue(vmo_indirect_->GetVmo(), ib_vmo_offset + i, iarray[i] +
-                         fs_->info_.dat_block, 1);
-#else
-            fs_->bc_->Writeblk(iarray[i] + fs_->info_.dat_block, entry);
-#endif
+        if (keep != 0) {
+            extent->length = keep;
+            break;
         }
+        extents_.pop_back();
+    }
 
-        // Only delete the indirect block if all direct blocks have been deleted
-        if (direct_start == 0)  {
-            // release the direct block itself
-            fs_->BlockFree(txn, iarray[i]);
-            iarray[i] = 0;
-            inode_.block_count--;
-            *dirty = true;
-        }
+    if (dirty) {
+        InodeSync(txn, kMxFsSyncDefault);
     }
 
     return ZX_OK;
 }
 
-zx_status_t VnodeMinfs::BlocksShrinkDoublyIndirect(WriteTxn *txn, uint32_t ibindex, uint32_t bindex,
-                                                   size_t count, uint32_t dib_vmo_offset,
-                                                   uint32_t ib_vmo_offset, blk_t* diarray,
-                                                   bool* dirty) {
-    // release doubly indirect blocks
-    for (unsigned i = 0; i < count; i++) {
-        if (diarray[i] == 0) {
-            continue;
-        }
-
-        fs_->ValidateBno(diarray[i]);
-
-#ifdef __Fuchsia__
-        uint32_t* dientry;
-        ReadIndirectVmoBlock(GetVmoOffsetForDoublyIndirect(i), &dientry);
-#else
-        uint32_t dientry[kMinfsBlockSize];
-        ReadIndirectBlock(diarray[i], dientry);
-#endif
-
-        // release the blocks pointed at by the entries in the indirect block
-        uint32_t indirect_start = i == 0 ? ibindex : 0;
-        uint32_t direct_start = (i == 0 && indirect_start == ibindex) ? bindex : 0;
-        zx_status_t status;
-        if ((status = BlocksShrinkIndirect(txn, direct_start,
-                                           kMinfsDirectPerIndirect - indirect_start,
-                                           ib_vmo_offset + i + indirect_start,
-                                           &dientry[indirect_start], dirty))
-            != ZX_OK) {
-            return status;
-        }
+zx_status_t VnodeMinfs::ExtentsLoad() {
+    if (extents_loaded_) {
+        return ZX_OK;
+    }
+    if ((inode_.extent_depth > kMinfsMaxExtentDepth) ||
+        (inode_.extent_count > kMinfsInlineExtents)) {
+        FS_TRACE_ERROR("minfs: ino#%u: bad extent tree (depth %u, count %u)\n", ino_,
+                       inode_.extent_depth, inode_.extent_count);
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
 
-        // only update the indirect block if an entry was deleted
-        if (*dirty) {
+    zx_status_t status = ExtentsLoadEntries(inode_.extents, inode_.extent_count,
+                                            inode_.extent_depth);
 #ifdef __Fuchsia__
-            txn->Enqueue(vmo_indirect_->GetVmo(), dib_vmo_offset + i, diarray[i] +
-                         fs_->info_.dat_block, 1);
-#else
-            fs_->bc_->Writeblk(diarray[i] + fs_->info_.dat_block, dientry);
+    if ((status == ZX_OK) && !extent_blocks_[0].is_empty()) {
+        status = InitExtentVmo(extent_blocks_[0].size());
+    }
 #endif
+    if (status != ZX_OK) {
+        extents_.reset();
+        for (uint32_t level = 0; level < kMinfsMaxExtentDepth; level++) {
+            extent_blocks_[level].reset();
         }
-
-        // Only delete the doubly indirect block if all indirect blocks have been deleted
-        if (indirect_start == 0 && direct_start == 0)  {
-            // release the doubly indirect block itself
-            fs_->BlockFree(txn, diarray[i]);
-            diarray[i] = 0;
-            inode_.block_count--;
-            *dirty = true;
-        }
+        return status;
     }
 
+    for (uint32_t level = 0; level < kMinfsMaxExtentDepth; level++) {
+        extent_blocks_synced_[level] = extent_blocks_[level].size();
+    }
+    extents_dirty_ = extents_.size();
+    extents_loaded_ = true;
     return ZX_OK;
 }
 
-// Delete all blocks (relative to a file) from "start" (inclusive) to the end of
-// the file. Does not update mtime/atime.
-zx_status_t VnodeMinfs::BlocksShrink(WriteTxn *txn, blk_t start) {
-    bool dirty = false;
-    zx_status_t status = ZX_OK;
-    size_t size = (kMinfsIndirect + kMinfsDoublyIndirect) * kMinfsBlockSize;
-    size_t count = start <= kMinfsDirect ? kMinfsDirect - start : 0;
-
-    if ((status = BlocksShrinkDirect(txn, count, &inode_.dnum[start], &dirty))
-        != ZX_OK) {
-        return status;
-    }
-
-    if (start < kMinfsDirect) {
-        start = 0;
-    } else {
-        start -= kMinfsDirect;
+zx_status_t VnodeMinfs::ExtentsLoadEntries(const minfs_extent_t* entries, uint32_t count,
+                                           uint32_t level) {
+    if (level == 0) {
+        for (uint32_t i = 0; i < count; i++) {
+            const minfs_extent_t& extent = entries[i];
+            blk_t end = 0;
+            if (!extents_.is_empty()) {
+                const minfs_extent_t& prev = extents_[extents_.size() - 1];
+                end = prev.fblock + prev.length;
+            }
+            if ((extent.length == 0) || (extent.fblock < end) ||
+                (extent.fblock >= kMinfsMaxFileBlock) ||
+                (extent.length > kMinfsMaxFileBlock - extent.fblock) ||
+                (extent.start == 0) || (extent.start >= fs_->info_.block_count) ||
+                (extent.length > fs_->info_.block_count - extent.start)) {
+                FS_TRACE_ERROR("minfs: ino#%u: bad extent (%u, %u, %u)\n", ino_,
+                               extent.fblock, extent.start, extent.length);
+                return ZX_ERR_IO_DATA_INTEGRITY;
+            }
+            fbl::AllocChecker ac;
+            extents_.push_back(extent, &ac);
+            if (!ac.check()) {
+                return ZX_ERR_NO_MEMORY;
+            }
+        }
+        return ZX_OK;
     }
 
-    uint32_t ibindex = start / kMinfsDirectPerIndirect;
-    uint32_t bindex = start % kMinfsDirectPerIndirect;
-    count = ibindex <= kMinfsIndirect ? kMinfsIndirect - ibindex : 0;
-    if ((status = BlocksShrinkIndirect(txn, bindex, count, ibindex, &inode_.inum[ibindex], &dirty))
-        != ZX_OK) {
-        return status;
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[kMinfsBlockSize]);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
     }
+    const minfs_extent_block_t* blk = reinterpret_cast<minfs_extent_block_t*>(data.get());
+    const uint32_t magic = (level == 1) ? kMinfsMagicExtentLeaf : kMinfsMagicExtentIndex;
+    fbl::Vector<blk_t>* blocks = &extent_blocks_[level - 1];
 
-    if (start < kMinfsIndirect * kMinfsDirectPerIndirect) {
-        start = 0;
-    } else {
-        start -= kMinfsIndirect * kMinfsDirectPerIndirect;
-
-        uint32_t last_dindirect = start / (kMinfsDirectPerIndirect * kMinfsDirectPerIndirect);
-        uint32_t first_indirect = start % (kMinfsDirectPerIndirect * kMinfsDirectPerIndirect);
+    for (uint32_t i = 0; i < count; i++) {
+        const blk_t bno = entries[i].start;
+        if ((bno == 0) || (bno >= fs_->info_.block_count)) {
+            FS_TRACE_ERROR("minfs: ino#%u: bad extent block %u\n", ino_, bno);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        zx_status_t status;
+        if ((status = fs_->ReadDat(bno, data.get())) != ZX_OK) {
+            return status;
+        }
 
-        if (first_indirect > 0) {
-            size = GetVmoSizeForIndirect(last_dindirect);
-        } else if (last_dindirect > 0) {
-            size = GetVmoSizeForIndirect(last_dindirect - 1);
+        // Every block of a level but the last is full, so the entries of the
+        // level which precede this block fill the blocks which precede it.
+        const size_t preceding = (level == 1) ? extents_.size() : extent_blocks_[level - 2].size();
+        if ((blk->hdr.magic != magic) || (blk->hdr.count == 0) ||
+            (blk->hdr.count > kMinfsExtentsPerBlock) || (blk->hdr.count != entries[i].length) ||
+            (preceding != blocks->size() * kMinfsExtentsPerBlock)) {
+            FS_TRACE_ERROR("minfs: ino#%u: bad extent block %u\n", ino_, bno);
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        blocks->push_back(bno, &ac);
+        if (!ac.check()) {
+            return ZX_ERR_NO_MEMORY;
+        }
+        if ((status = ExtentsLoadEntries(blk->entries, blk->hdr.count, level - 1)) != ZX_OK) {
+            return status;
         }
     }
+    return ZX_OK;
+}
 
-    uint32_t dibindex = start / (kMinfsDirectPerIndirect * kMinfsDirectPerIndirect);
-    start %= kMinfsDirectPerIndirect * kMinfsDirectPerIndirect;
-    ibindex = start / kMinfsDirectPerIndirect;
-    bindex = start % kMinfsDirectPerIndirect;
-    count = dibindex <= kMinfsDoublyIndirect ? kMinfsDoublyIndirect - dibindex : 0;
-    if ((status = BlocksShrinkDoublyIndirect(txn, ibindex, bindex, count,
-                                             GetVmoOffsetForDoublyIndirect(dibindex),
-                                             GetVmoOffsetForIndirect(dibindex),
-                                             &inode_.dinum[dibindex], &dirty)) != ZX_OK) {
-        return status;
+size_t VnodeMinfs::ExtentsFind(blk_t n) const {
+    size_t lo = 0;
+    size_t hi = extents_.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (extents_[mid].fblock <= n) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
+    return lo;
+}
 
-#ifdef __Fuchsia__
-    if (vmo_indirect_ != nullptr && vmo_indirect_->GetSize() > size) {
-        if ((status = vmo_indirect_->Shrink(size)) != ZX_OK) {
-            return status;
+zx_status_t VnodeMinfs::ExtentsInsert(WriteTxn* txn, size_t index, blk_t n, blk_t bno) {
+    // Grow the preceding or the following extent if the block adjoins it, both
+    // in the file and on disk.
+    const bool joins_next = (index < extents_.size()) && (extents_[index].fblock == n + 1) &&
+                            (extents_[index].start == bno + 1);
+    if (index > 0) {
+        minfs_extent_t* prev = &extents_[index - 1];
+        if ((prev->fblock + prev->length == n) && (prev->start + prev->length == bno)) {
+            prev->length++;
+            if (joins_next) {
+                prev->length += extents_[index].length;
+                extents_.erase(index);
+            }
+            extents_dirty_ = fbl::min(extents_dirty_, index - 1);
+            return ZX_OK;
         }
     }
-#endif
-
-    if (dirty) {
-        InodeSync(txn, kMxFsSyncDefault);
+    if (joins_next) {
+        extents_[index].fblock--;
+        extents_[index].start--;
+        extents_[index].length++;
+        extents_dirty_ = fbl::min(extents_dirty_, index);
+        return ZX_OK;
     }
 
+    zx_status_t status;
+    if ((status = ExtentsReserve(txn, extents_.size() + 1)) != ZX_OK) {
+        return status;
+    }
+    minfs_extent_t extent;
+    extent.fblock = n;
+    extent.start = bno;
+    extent.length = 1;
+    fbl::AllocChecker ac;
+    extents_.insert(index, extent, &ac);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    extents_dirty_ = fbl::min(extents_dirty_, index);
     return ZX_OK;
 }
 
-#ifdef __Fuchsia__
-zx_status_t VnodeMinfs::LoadIndirectBlocks(blk_t* iarray, uint32_t count, uint32_t offset,
-                                           uint64_t size) {
-    zx_status_t status;
-    if ((status = InitIndirectVmo()) != ZX_OK) {
-        return status;
+zx_status_t VnodeMinfs::ExtentsReserve(WriteTxn* txn, size_t count) {
+    size_t blocks[kMinfsMaxExtentDepth];
+    ExtentTreeShape(count, blocks);
+    size_t reserved[kMinfsMaxExtentDepth];
+    for (uint32_t level = 0; level < kMinfsMaxExtentDepth; level++) {
+        reserved[level] = extent_blocks_[level].size();
     }
 
-    if (vmo_indirect_->GetSize() < size) {
-        zx_status_t status;
-        if ((status = vmo_indirect_->Grow(size)) != ZX_OK) {
-            return status;
+    zx_status_t status = ZX_OK;
+#ifdef __Fuchsia__
+    if (blocks[0] != 0) {
+        status = InitExtentVmo(blocks[0]);
+    }
+#endif
+    for (uint32_t level = 0; (status == ZX_OK) && (level < kMinfsMaxExtentDepth); level++) {
+        while (extent_blocks_[level].size() < blocks[level]) {
+            blk_t bno;
+            if ((status = fs_->BlockNew(txn, 0, &bno)) != ZX_OK) {
+                break;
+            }
+            fbl::AllocChecker ac;
+            extent_blocks_[level].push_back(bno, &ac);
+            if (!ac.check()) {
+                fs_->BlockFree(txn, bno);
+                status = ZX_ERR_NO_MEMORY;
+                break;
+            }
+            inode_.block_count++;
         }
     }
 
-    ReadTxn txn(fs_->bc_.get());
-
-    for (uint32_t i = 0; i < count; i++) {
-        blk_t ibno;
-        if ((ibno = iarray[i]) != 0) {
-            fs_->ValidateBno(ibno);
-            txn.Enqueue(vmoid_indirect_, offset + i, ibno + fs_->info_.dat_block, 1);
+    if (status != ZX_OK) {
+        // Give back the blocks reserved so far, so that the extent blocks
+        // keep matching the extents.
+        for (uint32_t level = 0; level < kMinfsMaxExtentDepth; level++) {
+            fbl::Vector<blk_t>* level_blocks = &extent_blocks_[level];
+            while (level_blocks->size() > reserved[level]) {
+                fs_->BlockFree(txn, (*level_blocks)[level_blocks->size() - 1]);
+                level_blocks->pop_back();
+                inode_.block_count--;
+            }
         }
     }
-
-    return txn.Flush();
+    return status;
 }
 
-zx_status_t VnodeMinfs::LoadIndirectWithinDoublyIndirect(uint32_t dindex) {
-    uint32_t* dientry;
-
-    size_t size = GetVmoSizeForIndirect(dindex);
-    if (vmo_indirect_->GetSize() >= size) {
-        // We've already loaded this indirect (within dind) block.
-        return ZX_OK;
+minfs_extent_t VnodeMinfs::ExtentEntry(uint32_t level, size_t index) const {
+    if (level == 0) {
+        return extents_[index];
     }
 
-    ReadIndirectVmoBlock(GetVmoOffsetForDoublyIndirect(dindex), &dientry);
-    return LoadIndirectBlocks(dientry, kMinfsDirectPerIndirect,
-                              GetVmoOffsetForIndirect(dindex), size);
+    // The entry indexes block |index| of the level below, which holds the
+    // entries of that level from |first| on.
+    size_t blocks[kMinfsMaxExtentDepth];
+    ExtentTreeShape(extents_.size(), blocks);
+    const size_t below = (level == 1) ? extents_.size() : blocks[level - 2];
+    const size_t first = index * kMinfsExtentsPerBlock;
+
+    minfs_extent_t entry;
+    entry.fblock = ExtentEntry(level - 1, first).fblock;
+    entry.start = extent_blocks_[level - 1][index];
+    entry.length = static_cast<uint32_t>(fbl::min<size_t>(below - first, kMinfsExtentsPerBlock));
+    return entry;
 }
 
-zx_status_t VnodeMinfs::InitIndirectVmo() {
-    if (vmo_indirect_ != nullptr) {
-        return ZX_OK;
+void VnodeMinfs::ExtentsSync(WriteTxn* txn) {
+    if (!extents_loaded_) {
+        return;
     }
 
-    zx_status_t status;
-    if ((status = MappedVmo::Create(kMinfsBlockSize * (kMinfsIndirect + kMinfsDoublyIndirect),
-                                    "minfs-indirect", &vmo_indirect_)) != ZX_OK) {
-        return status;
-    }
-    if ((status = fs_->bc_->AttachVmo(vmo_indirect_->GetVmo(), &vmoid_indirect_)) != ZX_OK) {
-        vmo_indirect_ = nullptr;
-        return status;
+    size_t blocks[kMinfsMaxExtentDepth];
+    const uint32_t depth = ExtentTreeShape(extents_.size(), blocks);
+
+    // Release the extent blocks which are no longer needed
+    for (uint32_t level = 0; level < kMinfsMaxExtentDepth; level++) {
+        fbl::Vector<blk_t>* level_blocks = &extent_blocks_[level];
+        ZX_DEBUG_ASSERT(level_blocks->size() >= blocks[level]);
+        while (level_blocks->size() > blocks[level]) {
+            fs_->BlockFree(txn, (*level_blocks)[level_blocks->size() - 1]);
+            level_blocks->pop_back();
+            inode_.block_count--;
+        }
+        extent_blocks_synced_[level] = fbl::min(extent_blocks_synced_[level], blocks[level]);
     }
 
-    // Load initial set of indirect blocks
-    if ((status = LoadIndirectBlocks(inode_.inum, kMinfsIndirect, 0, 0)) != ZX_OK) {
-        vmo_indirect_ = nullptr;
-        return status;
+    // Write back the extent blocks holding an entry which changed, and those
+    // which have not been written yet. Entry |i| of a level indexes block |i|
+    // of the level below, so it changes along with that block.
+    size_t dirty = extents_dirty_;
+    for (uint32_t level = 0; level < depth; level++) {
+        const size_t first = fbl::min(dirty / kMinfsExtentsPerBlock,
+                                      extent_blocks_synced_[level]);
+        for (size_t i = first; i < blocks[level]; i++) {
+            const blk_t bno = extent_blocks_[level][i];
+#ifdef __Fuchsia__
+            const size_t vmo_block = (level == 0) ? kMinfsInlineExtents + i : i;
+            uintptr_t addr = reinterpret_cast<uintptr_t>(vmo_extents_->GetData()) +
+                             vmo_block * kMinfsBlockSize;
+            minfs_extent_block_t* blk = reinterpret_cast<minfs_extent_block_t*>(addr);
+#else
+            uint8_t data[kMinfsBlockSize];
+            minfs_extent_block_t* blk = reinterpret_cast<minfs_extent_block_t*>(data);
+#endif
+            memset(blk, 0, kMinfsBlockSize);
+            blk->hdr.magic = (level == 0) ? kMinfsMagicExtentLeaf : kMinfsMagicExtentIndex;
+            blk->hdr.count = ExtentEntry(level + 1, i).length;
+            for (uint32_t j = 0; j < blk->hdr.count; j++) {
+                blk->entries[j] = ExtentEntry(level, i * kMinfsExtentsPerBlock + j);
+            }
+#ifdef __Fuchsia__
+            txn->Enqueue(vmo_extents_->GetVmo(), vmo_block, bno + fs_->info_.dat_block, 1);
+#else
+            fs_->bc_->Writeblk(bno + fs_->info_.dat_block, data);
+#endif
+        }
+        extent_blocks_synced_[level] = blocks[level];
+        dirty = first;
     }
+    extents_dirty_ = extents_.size();
 
-    // Load doubly indirect blocks
-    if ((status = LoadIndirectBlocks(inode_.dinum, kMinfsDoublyIndirect,
-                                     GetVmoOffsetForDoublyIndirect(0),
-                                     GetVmoSizeForDoublyIndirect()) != ZX_OK)) {
-        vmo_indirect_ = nullptr;
-        return status;
+    // The inode holds the top level
+    const size_t count = (depth == 0) ? extents_.size() : blocks[depth - 1];
+    memset(inode_.extents, 0, sizeof(inode_.extents));
+    for (size_t i = 0; i < count; i++) {
+        inode_.extents[i] = ExtentEntry(depth, i);
     }
+    inode_.extent_count = static_cast<uint32_t>(count);
+    inode_.extent_depth = depth;
+}
 
+#ifdef __Fuchsia__
+zx_status_t VnodeMinfs::InitExtentVmo(size_t leaves) {
+    const size_t size = (kMinfsInlineExtents + leaves) * kMinfsBlockSize;
+    if (vmo_extents_ == nullptr) {
+        return MappedVmo::Create(size, "minfs-extents", &vmo_extents_);
+    } else if (vmo_extents_->GetSize() < size) {
+        return vmo_extents_->Grow(size);
+    }
     return ZX_OK;
 }
 
 // Since we cannot yet register the filesystem as a paging service (and cleanly
-// fault on pages when they are actually needed), we currently read an entire
-// file to a VMO when a file's data block are accessed.
-//
-// TODO(smklein): Even this hack can be optimized; a bitmap could be used to
-// track all 'empty/read/dirty' blocks for each vnode, rather than reading
-// the entire file.
+// fault on pages when they are actually needed), the VMO backing a file is
+// filled in by LoadVmoBlocks() as reads and writes touch its blocks. InitVmo()
+// only creates it.
 zx_status_t VnodeMinfs::InitVmo() {
     if (vmo_.is_valid()) {
         return ZX_OK;
@@ -366,312 +453,135 @@ zx_status_t VnodeMinfs::InitVmo() {
         vmo_.reset();
         return status;
     }
-    ReadTxn txn(fs_->bc_.get());
-
-    // Initialize all direct blocks
-    blk_t bno;
-    for (uint32_t d = 0; d < kMinfsDirect; d++) {
-        if ((bno = inode_.dnum[d]) != 0) {
-            fs_->ValidateBno(bno);
-            txn.Enqueue(vmoid_, d, bno + fs_->info_.dat_block, 1);
-        }
-    }
-
-    // Initialize all indirect blocks
-    for (uint32_t i = 0; i < kMinfsIndirect; i++) {
-        blk_t ibno;
-        if ((ibno = inode_.inum[i]) != 0) {
-            fs_->ValidateBno(ibno);
-
-            // Only initialize the indirect vmo if it is being used.
-            if ((status = InitIndirectVmo()) != ZX_OK) {
-                vmo_.reset();
-                return status;
-            }
-
-            uint32_t* ientry;
-            ReadIndirectVmoBlock(i, &ientry);
-
-            for (uint32_t j = 0; j < kMinfsDirectPerIndirect; j++) {
-                if ((bno = ientry[j]) != 0) {
-                    fs_->ValidateBno(bno);
-                    uint32_t n = kMinfsDirect + i * kMinfsDirectPerIndirect + j;
-                    txn.Enqueue(vmoid_, n, bno + fs_->info_.dat_block, 1);
-                }
-            }
-        }
-    }
-
-    // Initialize all doubly indirect blocks
-    for (uint32_t i = 0; i < kMinfsDoublyIndirect; i++) {
-        blk_t dibno;
-
-        if ((dibno = inode_.dinum[i]) != 0) {
-            fs_->ValidateBno(dibno);
-
-            // Only initialize the doubly indirect vmo if it is being used.
-            if ((status = InitIndirectVmo()) != ZX_OK) {
-                vmo_.reset();
-                return status;
-            }
-
-            uint32_t* dientry;
-            ReadIndirectVmoBlock(GetVmoOffsetForDoublyIndirect(i), &dientry);
-
-            for (uint32_t j = 0; j < kMinfsDirectPerIndirect; j++) {
-                blk_t ibno;
-                if ((ibno = dientry[j]) != 0) {
-                    fs_->ValidateBno(ibno);
-
-                    // Only initialize the indirect vmo if it is being used.
-                    if ((status = LoadIndirectWithinDoublyIndirect(i)) != ZX_OK) {
-                        vmo_.reset();
-                        return status;
-                    }
-
-                    uint32_t* ientry;
-                    ReadIndirectVmoBlock(GetVmoOffsetForIndirect(i) + j, &ientry);
-
-                    for (uint32_t k = 0; k < kMinfsDirectPerIndirect; k++) {
-                        if ((bno = ientry[k]) != 0) {
-                            fs_->ValidateBno(bno);
-                            uint32_t n = kMinfsDirect + kMinfsIndirect * kMinfsDirectPerIndirect
-                                         + j * kMinfsDirectPerIndirect + k;
-                            txn.Enqueue(vmoid_, n, bno + fs_->info_.dat_block, 1);
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    status = txn.Flush();
-    ValidateVmoTail();
-    return status;
-}
-#endif
-
-zx_status_t VnodeMinfs::GetBnoDirect(WriteTxn* txn, blk_t* bno, bool* dirty) {
-    // direct blocks are simple... is there an entry in dnum[]?
-    blk_t hint = 0;
-
-    if (*bno == 0) {
-        if (txn == nullptr) {
-            *bno = 0;
-            return ZX_OK;
-        }
-        // allocate a new block
-        zx_status_t status = fs_->BlockNew(txn, hint, bno);
-        if (status != ZX_OK) {
-            return status;
-        }
-        inode_.block_count++;
-        *dirty = true;
-    }
-
-    fs_->ValidateBno(*bno);
+    vmo_loaded_.ClearAll();
+    last_read_end_ = 0;
+    readahead_blocks_ = 0;
     return ZX_OK;
 }
 
-zx_status_t VnodeMinfs::GetBnoIndirect(WriteTxn* txn, uint32_t bindex, uint32_t ib_vmo_offset,
-                                       blk_t* ibno, blk_t* bno, bool* dirty) {
-    // we should have initialized vmo before calling this method
+zx_status_t VnodeMinfs::LoadVmoBlocks(blk_t start, blk_t end) {
     zx_status_t status;
-
-#ifdef __Fuchsia__
-    if ((status = VnodeMinfs::InitIndirectVmo()) != ZX_OK) {
+    if ((status = InitVmo()) != ZX_OK) {
         return status;
     }
-#endif
 
-    // retrieve indirect block at this index
-    if (*ibno == 0) {
-        if (txn == nullptr) {
-            *bno = 0;
-            return ZX_OK;
-        }
-        // allocate new indirect block if it does not exist
-        if ((status = fs_->BlockNew(txn, 0, ibno)) != ZX_OK) {
-            return status;
-        }
-
-#ifdef __Fuchsia__
-        ClearIndirectVmoBlock(ib_vmo_offset);
-#else
-        ClearIndirectBlock(*ibno);
-#endif
-
-        inode_.block_count++;
-        *dirty = true;
+    const blk_t file_blocks = static_cast<blk_t>(fbl::round_up(inode_.size, kMinfsBlockSize) /
+                                                 kMinfsBlockSize);
+    end = fbl::min(end, file_blocks);
+    if (start >= end) {
+        return ZX_OK;
     }
 
-#ifdef __Fuchsia__
-    uint32_t* ientry;
-    ReadIndirectVmoBlock(ib_vmo_offset, &ientry);
-#else
-    uint32_t ientry[kMinfsBlockSize];
-    ReadIndirectBlock(*ibno, ientry);
-#endif
-
-    bool direct_dirty = false;
-    if ((status = GetBnoDirect(txn, &ientry[bindex], &direct_dirty)) != ZX_OK) {
-        return status;
+    size_t first_missing;
+    if (vmo_loaded_.Get(start, end, &first_missing)) {
+        return ZX_OK;
     }
 
-    *bno = ientry[bindex];
-
-    if (*dirty || direct_dirty) {
-        // Write back the indirect block if a new block was allocated
-#ifdef __Fuchsia__
-        txn->Enqueue(vmo_indirect_->GetVmo(), ib_vmo_offset, *ibno + fs_->info_.dat_block, 1);
-#else
-        fs_->bc_->Writeblk(*ibno + fs_->info_.dat_block, ientry);
-#endif
-        InodeSync(txn, kMxFsSyncDefault);
+    if ((status = ExtentsLoad()) != ZX_OK) {
+        return status;
     }
 
-    return ZX_OK;
-}
-
-zx_status_t VnodeMinfs::GetBnoDoublyIndirect(WriteTxn* txn, uint32_t ibindex, uint32_t bindex,
-                                             uint32_t dib_vmo_offset, uint32_t ib_vmo_offset,
-                                             blk_t* dibno, blk_t* bno, bool* dirty) {
-    zx_status_t status;
-
-    // look up the doubly indirect bno, create if it doesn't already exist
-    if (*dibno == 0) {
-        if (txn == nullptr) {
-            *bno = 0;
-            return ZX_OK;
-        }
-
-        // allocate a new doubly indirect block
-        if ((status = fs_->BlockNew(txn, 0, dibno)) != ZX_OK) {
-            return status;
+    // Each run of missing blocks within an extent is contiguous on disk, so it
+    // is read with a single request. Holes need no reading; the VMO is already
+    // zero there.
+    ReadTxn txn(fs_->bc_.get());
+    size_t index = ExtentsFind(static_cast<blk_t>(first_missing));
+    if (index > 0) {
+        index--;
+    }
+    for (; index < extents_.size() && extents_[index].fblock < end; index++) {
+        const minfs_extent_t& extent = extents_[index];
+        const blk_t extent_end = fbl::min(extent.fblock + extent.length, end);
+        blk_t n = fbl::max(extent.fblock, static_cast<blk_t>(first_missing));
+        while (n < extent_end) {
+            if (vmo_loaded_.Get(n, n + 1)) {
+                n++;
+                continue;
+            }
+            blk_t len = 1;
+            while (n + len < extent_end && !vmo_loaded_.Get(n + len, n + len + 1)) {
+                len++;
+            }
+            const blk_t bno = extent.start + (n - extent.fblock);
+            fs_->ValidateBno(bno);
+            fs_->ValidateBno(bno + len - 1);
+            txn.Enqueue(vmoid_, n, bno + fs_->info_.dat_block, len);
+            n += len;
         }
-
-#ifdef __Fuchsia__
-        ClearIndirectVmoBlock(dib_vmo_offset);
-#else
-        ClearIndirectBlock(*dibno);
-#endif
-
-        // record new doubly indirect block in inode, note that we need to update
-        inode_.block_count++;
-        *dirty = true;
     }
 
-    // read from doubly indirect block
-#ifdef __Fuchsia__
-    uint32_t* dientry;
-    ReadIndirectVmoBlock(dib_vmo_offset, &dientry);
-#else
-    uint32_t dientry[kMinfsBlockSize];
-    ReadIndirectBlock(*dibno, dientry);
-#endif
-
-    // get indirect block
-    bool indirect_dirty = false;
-    if ((status = GetBnoIndirect(txn, bindex, ib_vmo_offset + ibindex, &dientry[ibindex], bno,
-                                 &indirect_dirty)) != ZX_OK) {
+    if ((status = txn.Flush()) != ZX_OK) {
         return status;
     }
-
-    if (*dirty || indirect_dirty) {
-        // Write back the doubly indirect block if a new block was allocated
-#ifdef __Fuchsia__
-        txn->Enqueue(vmo_indirect_->GetVmo(), dib_vmo_offset, *dibno + fs_->info_.dat_block, 1);
-#else
-        fs_->bc_->Writeblk(*dibno + fs_->info_.dat_block, dientry);
-#endif
-        InodeSync(txn, kMxFsSyncDefault);
-    }
-
-    return ZX_OK;
+    return vmo_loaded_.Set(start, end);
 }
 
-#ifdef __Fuchsia__
-void VnodeMinfs::ReadIndirectVmoBlock(uint32_t offset, uint32_t** entry) {
-    ZX_DEBUG_ASSERT(vmo_indirect_ != nullptr);
-    uintptr_t addr = reinterpret_cast<uintptr_t>(vmo_indirect_->GetData());
-    validate_vmo_size(vmo_indirect_->GetVmo(), offset);
-    *entry = reinterpret_cast<uint32_t*>(addr + kMinfsBlockSize * offset);
-}
+// The number of blocks read ahead of the first sequential read of a file, and
+// the most read ahead of any read. The window doubles with every sequential
+// read which needs to go to disk.
+constexpr blk_t kReadAheadMinBlocks = 4;
+constexpr blk_t kReadAheadMaxBlocks = 32;
 
-void VnodeMinfs::ClearIndirectVmoBlock(uint32_t offset) {
-    ZX_DEBUG_ASSERT(vmo_indirect_ != nullptr);
-    uintptr_t addr = reinterpret_cast<uintptr_t>(vmo_indirect_->GetData());
-    validate_vmo_size(vmo_indirect_->GetVmo(), offset);
-    memset(reinterpret_cast<void*>(addr + kMinfsBlockSize * offset), 0, kMinfsBlockSize);
-}
-#else
-void VnodeMinfs::ReadIndirectBlock(blk_t bno, uint32_t* entry) {
-    fs_->bc_->Readblk(bno + fs_->info_.dat_block, entry);
-}
+zx_status_t VnodeMinfs::LoadVmoForRead(size_t off, size_t len) {
+    const bool sequential = (off == last_read_end_);
+    last_read_end_ = off + len;
 
-void VnodeMinfs::ClearIndirectBlock(blk_t bno) {
-    uint32_t data[kMinfsBlockSize];
-    memset(data, 0, kMinfsBlockSize);
-    fs_->bc_->Writeblk(bno + fs_->info_.dat_block, data);
+    const blk_t start = static_cast<blk_t>(off / kMinfsBlockSize);
+    const blk_t end = static_cast<blk_t>(fbl::round_up(off + len, kMinfsBlockSize) /
+                                         kMinfsBlockSize);
+    if (vmo_.is_valid() && vmo_loaded_.Get(start, end)) {
+        return ZX_OK;
+    }
+
+    if (!sequential) {
+        readahead_blocks_ = 0;
+    } else if (readahead_blocks_ == 0) {
+        readahead_blocks_ = kReadAheadMinBlocks;
+    } else {
+        readahead_blocks_ = fbl::min(readahead_blocks_ * 2, kReadAheadMaxBlocks);
+    }
+    return LoadVmoBlocks(start, end + readahead_blocks_);
 }
 #endif
 
 // Get the bno corresponding to the nth logical block within the file.
 zx_status_t VnodeMinfs::GetBno(WriteTxn* txn, blk_t n, blk_t* bno) {
-    bool dirty = false;
-
-    if (n < kMinfsDirect) {
-        zx_status_t status = GetBnoDirect(txn, &inode_.dnum[n], &dirty);
-        *bno = inode_.dnum[n];
-        return status;
+    if (n >= kMinfsMaxFileBlock) {
+        return ZX_ERR_OUT_OF_RANGE;
     }
 
-    // for indirect blocks, adjust past the direct blocks
-    n -= kMinfsDirect;
-
-    if (n < kMinfsIndirect * kMinfsDirectPerIndirect) {
-        // index of indirect block
-        uint32_t ibindex = n / kMinfsDirectPerIndirect;
-        // index of direct block within indirect block
-        uint32_t bindex = n % kMinfsDirectPerIndirect;
-        return GetBnoIndirect(txn, bindex, ibindex, &inode_.inum[ibindex], bno, &dirty);
+    zx_status_t status;
+    if ((status = ExtentsLoad()) != ZX_OK) {
+        return status;
     }
 
-    // for doubly indirect blocks, adjust past the indirect blocks
-    n -= (kMinfsIndirect * kMinfsDirectPerIndirect);
-
-    if (n < kMinfsDoublyIndirect * kMinfsDirectPerIndirect * kMinfsDirectPerIndirect) {
-        // index of doubly indirect block
-        uint32_t dibindex = n / (kMinfsDirectPerIndirect * kMinfsDirectPerIndirect);
-        ZX_DEBUG_ASSERT(dibindex < kMinfsDoublyIndirect);
-        n -= (dibindex * kMinfsDirectPerIndirect * kMinfsDirectPerIndirect);
-        // index of indirect block within doubly indirect block
-        uint32_t ibindex = n / kMinfsDirectPerIndirect;
-        // index of direct block within indirect block
-        uint32_t bindex = n % kMinfsDirectPerIndirect;
-
-    #ifdef __Fuchsia__
-        zx_status_t status;
-        // If the vmo_indirect_ vmo has not been created, make it now.
-        if ((status = InitIndirectVmo()) != ZX_OK) {
-            return status;
-        }
-
-        // Grow VMO if we need more space to fit this set of indirect blocks
-        uint64_t vmo_size = GetVmoSizeForIndirect(dibindex);
-        if (vmo_indirect_->GetSize() < vmo_size) {
-            if ((status = vmo_indirect_->Grow(vmo_size)) != ZX_OK) {
-                return status;
-            }
+    const size_t index = ExtentsFind(n);
+    blk_t goal = 0;
+    if (index > 0) {
+        const minfs_extent_t& extent = extents_[index - 1];
+        if (n - extent.fblock < extent.length) {
+            *bno = extent.start + (n - extent.fblock);
+            return ZX_OK;
+        } else if (n - extent.fblock == extent.length) {
+            // Aim for the block following the previous block of the file, so
+            // that sequentially written files are contiguous.
+            goal = extent.start + extent.length;
         }
-    #endif
-
-        return GetBnoDoublyIndirect(txn, ibindex, bindex, GetVmoOffsetForDoublyIndirect(dibindex),
-                                    GetVmoOffsetForIndirect(dibindex), &inode_.dinum[dibindex], bno,
-                                    &dirty);
     }
 
-    return ZX_ERR_OUT_OF_RANGE;
+    if (txn == nullptr) {
+        *bno = 0;
+        return ZX_OK;
+    }
+    if ((status = fs_->DataBlockNew(txn, goal, bno)) != ZX_OK) {
+        return status;
+    }
+    if ((status = ExtentsInsert(txn, index, n, *bno)) != ZX_OK) {
+        fs_->BlockFree(txn, *bno);
+        return status;
+    }
+    inode_.block_count++;
+    return ZX_OK;
 }
 
 // Immediately stop iterating over the directory.
@@ -681,6 +591,11 @@ zx_status_t VnodeMinfs::GetBno(WriteTxn* txn, blk_t n, blk_t* bno) {
 // Identify that the direntry record was modified. Stop iterating.
 #define DIR_CB_SAVE_SYNC 2
 
+// The number of bytes of a directory read at once while iterating over it.
+constexpr size_t kDirentChunkSize = 4096;
+// Marks an unused slot in a directory's dirent cache.
+constexpr uint32_t kDirentCacheEmpty = UINT32_MAX;
+
 zx_status_t VnodeMinfs::ReadExactInternal(void* data, size_t len, size_t off) {
     size_t actual;
     zx_status_t status = ReadInternal(data, len, off, &actual);
@@ -705,13 +620,15 @@ zx_status_t VnodeMinfs::WriteExactInternal(WriteTxn* txn, const void* data,
     return ZX_OK;
 }
 
-static zx_status_t validate_dirent(minfs_dirent_t* de, size_t bytes_read, size_t off) {
+// Validates the dirent at |off|, which must not extend past |end|.
+static zx_status_t validate_dirent(minfs_dirent_t* de, size_t bytes_read, size_t off,
+                                   size_t end) {
     uint32_t reclen = static_cast<uint32_t>(MinfsReclen(de, off));
     if ((bytes_read < MINFS_DIRENT_SIZE) || (reclen < MINFS_DIRENT_SIZE)) {
         FS_TRACE_ERROR("vn_dir: Could not read dirent at offset: %zd\n", off);
         return ZX_ERR_IO;
-    } else if ((off + reclen > kMinfsMaxDirectorySize) || (reclen & 3)) {
-        FS_TRACE_ERROR("vn_dir: bad reclen %u > %u\n", reclen, kMinfsMaxDirectorySize);
+    } else if ((off + reclen > end) || (reclen & 3)) {
+        FS_TRACE_ERROR("vn_dir: bad reclen %u > %zu\n", reclen, end - off);
         return ZX_ERR_IO;
     } else if (de->ino != 0) {
         if ((de->namelen == 0) ||
@@ -735,6 +652,7 @@ static zx_status_t cb_dir_find(fbl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t* de
     if ((de->ino != 0) && fbl::StringPiece(de->name, de->namelen) == args->name) {
         args->ino = de->ino;
         args->type = de->type;
+        args->off = offs->off;
         return DIR_CB_DONE;
     } else {
         return do_next_dirent(de, offs);
@@ -772,13 +690,15 @@ zx_status_t VnodeMinfs::UnlinkChild(WritebackWork* wb,
     // Verify they are free and small enough to merge.
     size_t coalesced_size = MinfsReclen(de, off);
     // Coalesce with "next" first, so the kMinfsReclenLast bit can easily flow
-    // back to "de" and "de_prev".
-    if (!(de->reclen & kMinfsReclenLast)) {
+    // back to "de" and "de_prev". In a hashed directory, records never
+    // coalesce across the end of a bucket.
+    if (!(de->reclen & kMinfsReclenLast) && (off_next < DirentRegionEnd(off))) {
         size_t len = MINFS_DIRENT_SIZE;
         if ((status = ReadExactInternal(&de_next, len, off_next)) != ZX_OK) {
             FS_TRACE_ERROR("unlink: Failed to read next dirent\n");
             return status;
-        } else if ((status = validate_dirent(&de_next, len, off_next)) != ZX_OK) {
+        } else if ((status = validate_dirent(&de_next, len, off_next,
+                                             DirentRegionEnd(off_next))) != ZX_OK) {
             FS_TRACE_ERROR("unlink: Read invalid dirent\n");
             return status;
         }
@@ -793,7 +713,8 @@ zx_status_t VnodeMinfs::UnlinkChild(WritebackWork* wb,
         if ((status = ReadExactInternal(&de_prev, len, off_prev)) != ZX_OK) {
             FS_TRACE_ERROR("unlink: Failed to read previous dirent\n");
             return status;
-        } else if ((status = validate_dirent(&de_prev, len, off_prev)) != ZX_OK) {
+        } else if ((status = validate_dirent(&de_prev, len, off_prev,
+                                             DirentRegionEnd(off_prev))) != ZX_OK) {
             FS_TRACE_ERROR("unlink: Read invalid dirent\n");
             return status;
         }
@@ -807,6 +728,7 @@ zx_status_t VnodeMinfs::UnlinkChild(WritebackWork* wb,
         // Should only be possible if the on-disk record format is corrupted
         return ZX_ERR_IO;
     }
+    DirentCacheRemove(fbl::StringPiece(de->name, de->namelen), offs->off);
     de->ino = 0;
     de->reclen = static_cast<uint32_t>(coalesced_size & kMinfsReclenMask) |
         (de->reclen & kMinfsReclenLast);
@@ -834,6 +756,9 @@ zx_status_t VnodeMinfs::UnlinkChild(WritebackWork* wb,
 }
 
 void VnodeMinfs::RemoveInodeLink(WriteTxn* txn) {
+#ifdef __Fuchsia__
+    fbl::AutoLock lock(&lock_);
+#endif
     // This effectively 'unlinks' the target node without deleting the direntry
     inode_.link_count--;
     if (MinfsMagicType(inode_.magic) == kMinfsTypeDir) {
@@ -1027,19 +952,47 @@ static zx_status_t cb_dir_append(fbl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t*
 //          Since 'func' may create / remove surrounding dirents, it is responsible for
 //          updating the offset information to access the next dirent.
 zx_status_t VnodeMinfs::ForEachDirent(DirArgs* args, const DirentCallback func) {
+    size_t start = 0;
+    size_t end = kMinfsMaxDirectorySize;
+    if (inode_.dir_buckets != 0) {
+        start = MinfsDirentBucket(args->name.data(), args->name.length(),
+                                  inode_.dir_buckets) * kMinfsDirBucketSize;
+        end = start + kMinfsDirBucketSize;
+    }
+
+    // Dirents are read from the directory a chunk at a time, and copied out
+    // one at a time so callbacks may modify |de| in place. Any callback which
+    // modifies the directory stops iteration, so the chunk is never stale.
+    char chunk[kDirentChunkSize];
+    size_t chunk_off = 0;
+    size_t chunk_len = 0;
+    bool chunk_complete = false; // The chunk reaches the end of readable data
+
     char data[kMinfsMaxDirentSize];
     minfs_dirent_t* de = (minfs_dirent_t*) data;
     DirectoryOffset offs = {
-        .off = 0,
-        .off_prev = 0,
+        .off = start,
+        .off_prev = start,
     };
-    while (offs.off + MINFS_DIRENT_SIZE < kMinfsMaxDirectorySize) {
+    while (offs.off + MINFS_DIRENT_SIZE < end) {
         FS_TRACE(MINFS, "Reading dirent at offset %zd\n", offs.off);
-        size_t r;
-        zx_status_t status = ReadInternal(data, kMinfsMaxDirentSize, offs.off, &r);
-        if (status != ZX_OK) {
-            return status;
-        } else if ((status = validate_dirent(de, r, offs.off)) != ZX_OK) {
+        size_t avail = 0;
+        if ((offs.off >= chunk_off) && (offs.off < chunk_off + chunk_len)) {
+            avail = chunk_off + chunk_len - offs.off;
+        }
+        zx_status_t status;
+        if ((avail < kMinfsMaxDirentSize) && !(avail > 0 && chunk_complete)) {
+            size_t len = fbl::min(sizeof(chunk), end - offs.off);
+            if ((status = ReadInternal(chunk, len, offs.off, &chunk_len)) != ZX_OK) {
+                return status;
+            }
+            chunk_off = offs.off;
+            chunk_complete = (chunk_len < sizeof(chunk));
+            avail = chunk_len;
+        }
+        size_t r = fbl::min(avail, sizeof(data));
+        memcpy(data, chunk + (offs.off - chunk_off), r);
+        if ((status = validate_dirent(de, r, offs.off, end)) != ZX_OK) {
             return status;
         }
 
@@ -1059,6 +1012,204 @@ zx_status_t VnodeMinfs::ForEachDirent(DirArgs* args, const DirentCallback func)
     return ZX_ERR_NOT_FOUND;
 }
 
+size_t VnodeMinfs::DirentRegionEnd(size_t off) const {
+    if (inode_.dir_buckets == 0) {
+        return kMinfsMaxDirectorySize;
+    }
+    return fbl::round_down(off, kMinfsDirBucketSize) + kMinfsDirBucketSize;
+}
+
+size_t VnodeMinfs::DirentEnd() const {
+    if (inode_.dir_buckets == 0) {
+        return kMinfsMaxDirectorySize;
+    }
+    return inode_.dir_buckets * kMinfsDirBucketSize;
+}
+
+zx_status_t VnodeMinfs::AppendDirent(DirArgs* args) {
+    zx_status_t status;
+    while ((status = ForEachDirent(args, cb_dir_append)) == ZX_ERR_NOT_FOUND &&
+           inode_.dir_buckets != 0) {
+        // The bucket holding |args->name| is full.
+        if ((status = GrowBuckets(args->wb)) != ZX_OK) {
+            return status;
+        }
+    }
+    if (status != ZX_OK) {
+        return status;
+    }
+
+    if ((inode_.dir_buckets == 0) && (inode_.size > kMinfsDirBucketSize) &&
+        (inode_.size > dir_rehash_failed_size_)) {
+        // Indexing the directory is an optimization; if no bucket count fits
+        // its dirents, it stays a valid linear directory, and is not tried
+        // again until it has grown.
+        status = GrowBuckets(args->wb);
+        if (status == ZX_ERR_NO_SPACE) {
+            dir_rehash_failed_size_ = inode_.size;
+        } else if (status != ZX_OK) {
+            return status;
+        }
+    }
+    return ZX_OK;
+}
+
+zx_status_t VnodeMinfs::GrowBuckets(WritebackWork* wb) {
+    uint32_t buckets = inode_.dir_buckets;
+    if (buckets == 0) {
+        // Leave room for the directory to double before the next rehash.
+        buckets = static_cast<uint32_t>(
+                fbl::round_up(inode_.size, kMinfsDirBucketSize) / kMinfsDirBucketSize);
+    }
+    zx_status_t status;
+    do {
+        if (buckets >= kMinfsMaxDirBuckets) {
+            return ZX_ERR_NO_SPACE;
+        }
+        buckets = fbl::min(buckets * 2, kMinfsMaxDirBuckets);
+    } while ((status = DirRehash(wb, buckets)) == ZX_ERR_NO_SPACE);
+    return status;
+}
+
+zx_status_t VnodeMinfs::DirRehash(WritebackWork* wb, uint32_t buckets) {
+    ZX_DEBUG_ASSERT(buckets > inode_.dir_buckets);
+    size_t old_size = inode_.size;
+    size_t new_size = buckets * kMinfsDirBucketSize;
+    ZX_DEBUG_ASSERT(new_size >= old_size);
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<char[]> old_dir(new (&ac) char[old_size]);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    fbl::unique_ptr<char[]> new_dir(new (&ac) char[new_size]);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    zx_status_t status;
+    if ((status = ReadExactInternal(old_dir.get(), old_size, 0)) != ZX_OK) {
+        return status;
+    }
+    memset(new_dir.get(), 0, new_size);
+
+    // Pack each live dirent into its new bucket, remembering the last record
+    // of each bucket so it can absorb the remaining space.
+    uint32_t fill[kMinfsMaxDirBuckets] = {};
+    uint32_t last[kMinfsMaxDirBuckets] = {};
+    size_t off = 0;
+    while (off + MINFS_DIRENT_SIZE <= old_size) {
+        minfs_dirent_t* de = reinterpret_cast<minfs_dirent_t*>(old_dir.get() + off);
+        if ((status = validate_dirent(de, old_size - off, off, DirentRegionEnd(off))) != ZX_OK) {
+            return status;
+        }
+        if (de->ino != 0) {
+            uint32_t size = DirentSize(de->namelen);
+            if (off + size > old_size) {
+                return ZX_ERR_IO;
+            }
+            uint32_t b = MinfsDirentBucket(de->name, de->namelen, buckets);
+            if (fill[b] + size > kMinfsDirBucketSize) {
+                return ZX_ERR_NO_SPACE;
+            }
+            minfs_dirent_t* nde = reinterpret_cast<minfs_dirent_t*>(
+                    new_dir.get() + b * kMinfsDirBucketSize + fill[b]);
+            memcpy(nde, de, size);
+            nde->reclen = size;
+            last[b] = fill[b];
+            fill[b] += size;
+        }
+        if (de->reclen & kMinfsReclenLast) {
+            break;
+        }
+        off += MinfsReclen(de, off);
+    }
+    for (uint32_t b = 0; b < buckets; b++) {
+        char* bucket = new_dir.get() + b * kMinfsDirBucketSize;
+        minfs_dirent_t* de;
+        if (fill[b] == 0) {
+            // An empty bucket holds a single free record.
+            de = reinterpret_cast<minfs_dirent_t*>(bucket);
+            de->reclen = 0;
+        } else {
+            de = reinterpret_cast<minfs_dirent_t*>(bucket + last[b]);
+        }
+        de->reclen += kMinfsDirBucketSize - fill[b];
+    }
+
+    if ((status = WriteExactInternal(wb->txn(), new_dir.get(), new_size, 0)) != ZX_OK) {
+        return status;
+    }
+    inode_.dir_buckets = buckets;
+    inode_.seq_num++;
+    InodeSync(wb->txn(), kMxFsSyncMtime);
+    wb->PinVnode(fbl::move(fbl::WrapRefPtr(this)));
+    DirentCacheReset();
+    return ZX_OK;
+}
+
+bool VnodeMinfs::DirentCacheLookup(DirArgs* args) {
+    if (dirent_cache_ == nullptr) {
+        return false;
+    }
+    uint32_t hash = MinfsDirentHash(args->name.data(), args->name.length());
+    const DirentCacheEntry& entry = dirent_cache_[hash % kDirentCacheSize];
+    if ((entry.off == kDirentCacheEmpty) || (entry.hash != hash)) {
+        return false;
+    }
+
+    // The entry only hints at where the dirent may be; confirm it.
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    size_t len = DirentSize(static_cast<uint8_t>(args->name.length()));
+    if ((ReadExactInternal(data, len, entry.off) != ZX_OK) ||
+        (de->ino == 0) || (fbl::StringPiece(de->name, de->namelen) != args->name)) {
+        return false;
+    }
+    args->ino = de->ino;
+    args->type = de->type;
+    args->off = entry.off;
+    return true;
+}
+
+void VnodeMinfs::DirentCacheInsert(fbl::StringPiece name, size_t off) {
+    if (dirent_cache_ == nullptr) {
+        if (inode_.dirent_count < kDirentCacheMinEntries) {
+            return;
+        }
+        fbl::AllocChecker ac;
+        dirent_cache_.reset(new (&ac) DirentCacheEntry[kDirentCacheSize]);
+        if (!ac.check()) {
+            // The cache is only an optimization.
+            return;
+        }
+        DirentCacheReset();
+    }
+    uint32_t hash = MinfsDirentHash(name.data(), name.length());
+    DirentCacheEntry& entry = dirent_cache_[hash % kDirentCacheSize];
+    entry.hash = hash;
+    entry.off = static_cast<uint32_t>(off);
+}
+
+void VnodeMinfs::DirentCacheRemove(fbl::StringPiece name, size_t off) {
+    if (dirent_cache_ == nullptr) {
+        return;
+    }
+    uint32_t hash = MinfsDirentHash(name.data(), name.length());
+    DirentCacheEntry& entry = dirent_cache_[hash % kDirentCacheSize];
+    if ((entry.hash == hash) && (entry.off == off)) {
+        entry.off = kDirentCacheEmpty;
+    }
+}
+
+void VnodeMinfs::DirentCacheReset() {
+    if (dirent_cache_ == nullptr) {
+        return;
+    }
+    for (size_t i = 0; i < kDirentCacheSize; i++) {
+        dirent_cache_[i].off = kDirentCacheEmpty;
+    }
+}
+
 void VnodeMinfs::fbl_recycle() {
     if (fd_count_ != 0 || !IsUnlinked()) {
         // If this node has not been purged already, remove it from the
@@ -1075,24 +1226,14 @@ void VnodeMinfs::fbl_recycle() {
 
 VnodeMinfs::~VnodeMinfs() {
 #ifdef __Fuchsia__
-    // Detach the vmoids from the underlying block device,
+    // Detach the vmoid from the underlying block device,
     // so the underlying VMO may be released.
-    size_t request_count = 0;
-    block_fifo_request_t request[2];
     if (vmo_.is_valid()) {
-        request[request_count].txnid = fs_->bc_->TxnId();
-        request[request_count].vmoid = vmoid_;
-        request[request_count].opcode = BLOCKIO_CLOSE_VMO;
-        request_count++;
-    }
-    if (vmo_indirect_ != nullptr) {
-        request[request_count].txnid = fs_->bc_->TxnId();
-        request[request_count].vmoid = vmoid_indirect_;
-        request[request_count].opcode = BLOCKIO_CLOSE_VMO;
-        request_count++;
-    }
-    if (request_count) {
-        fs_->bc_->Txn(&request[0], request_count);
+        block_fifo_request_t request;
+        request.txnid = fs_->bc_->TxnId();
+        request.vmoid = vmoid_;
+        request.opcode = BLOCKIO_CLOSE_VMO;
+        fs_->bc_->Txn(&request, 1);
     }
 #endif
 }
@@ -1114,6 +1255,9 @@ zx_status_t VnodeMinfs::ValidateFlags(uint32_t flags) {
 }
 
 zx_status_t VnodeMinfs::Open(uint32_t flags, fbl::RefPtr<Vnode>* out_redirect) {
+#ifdef __Fuchsia__
+    fbl::AutoLock lock(&lock_);
+#endif
     fd_count_++;
     return ZX_OK;
 }
@@ -1126,23 +1270,22 @@ void VnodeMinfs::Purge(WriteTxn* txn) {
         fbl::AutoLock lock(&fs_->hash_lock_);
         fs_->VnodeReleaseLocked(this);
     }
-    // TODO(smklein): Only init indirect vmo if it's needed
-    if (InitIndirectVmo() == ZX_OK) {
-        fs_->InoFree(this, txn);
-    } else {
-        fprintf(stderr, "minfs: Failed to Init Indirect VMO while purging %u\n", ino_);
-    }
 #else
     fs_->VnodeReleaseLocked(this);
-    fs_->InoFree(this, txn);
 #endif
+    fs_->InoFree(this, txn);
 }
 
 zx_status_t VnodeMinfs::Close() {
+#ifdef __Fuchsia__
+    fbl::AutoLock txn_lock(&fs_->txn_lock_);
+    fbl::AutoLock lock(&lock_);
+#endif
     ZX_DEBUG_ASSERT_MSG(fd_count_ > 0, "Closing ino with no fds open");
     fd_count_--;
 
-    if (fd_count_ == 0 && IsUnlinked()) {
+    // Once unmounted, an unlinked inode is left for fsck to reclaim.
+    if (fd_count_ == 0 && IsUnlinked() && !fs_->IsClosed()) {
         fbl::unique_ptr<WritebackWork> wb(new WritebackWork(fs_->bc_.get()));
         Purge(wb->txn());
         fs_->EnqueueWork(fbl::move(wb));
@@ -1151,6 +1294,9 @@ zx_status_t VnodeMinfs::Close() {
 }
 
 zx_status_t VnodeMinfs::Read(void* data, size_t len, size_t off, size_t* out_actual) {
+#ifdef __Fuchsia__
+    fbl::AutoLock lock(&lock_);
+#endif
     ZX_DEBUG_ASSERT_MSG(fd_count_ > 0, "Reading from ino with no fds open");
     FS_TRACE(MINFS, "minfs_read() vn=%p(#%u) len=%zd off=%zd\n", this, ino_, len, off);
     if (IsDirectory()) {
@@ -1176,7 +1322,7 @@ zx_status_t VnodeMinfs::ReadInternal(void* data, size_t len, size_t off, size_t*
 
     zx_status_t status;
 #ifdef __Fuchsia__
-    if ((status = InitVmo()) != ZX_OK) {
+    if ((status = LoadVmoForRead(off, len)) != ZX_OK) {
         return status;
     } else if ((status = vmo_.read(data, off, len, actual)) != ZX_OK) {
         return status;
@@ -1221,6 +1367,32 @@ zx_status_t VnodeMinfs::ReadInternal(void* data, size_t len, size_t off, size_t*
 
 zx_status_t VnodeMinfs::Write(const void* data, size_t len, size_t offset,
                               size_t* out_actual) {
+#ifdef __Fuchsia__
+    fbl::AutoLock txn_lock(&fs_->txn_lock_);
+    if (fs_->IsClosed()) {
+        return ZX_ERR_BAD_STATE;
+    }
+    fbl::AutoLock lock(&lock_);
+#endif
+    return WriteLocked(data, len, offset, out_actual);
+}
+
+zx_status_t VnodeMinfs::Append(const void* data, size_t len, size_t* out_end,
+                               size_t* out_actual) {
+#ifdef __Fuchsia__
+    fbl::AutoLock txn_lock(&fs_->txn_lock_);
+    if (fs_->IsClosed()) {
+        return ZX_ERR_BAD_STATE;
+    }
+    fbl::AutoLock lock(&lock_);
+#endif
+    zx_status_t status = WriteLocked(data, len, inode_.size, out_actual);
+    *out_end = inode_.size;
+    return status;
+}
+
+zx_status_t VnodeMinfs::WriteLocked(const void* data, size_t len, size_t offset,
+                                    size_t* out_actual) {
     ZX_DEBUG_ASSERT_MSG(fd_count_ > 0, "Writing to ino with no fds open");
     FS_TRACE(MINFS, "minfs_write() vn=%p(#%u) len=%zd off=%zd\n", this, ino_, len, offset);
     if (IsDirectory()) {
@@ -1244,13 +1416,6 @@ zx_status_t VnodeMinfs::Write(const void* data, size_t len, size_t offset,
     return ZX_OK;
 }
 
-zx_status_t VnodeMinfs::Append(const void* data, size_t len, size_t* out_end,
-                               size_t* out_actual) {
-    zx_status_t status = Write(data, len, inode_.size, out_actual);
-    *out_end = inode_.size;
-    return status;
-}
-
 // Internal write. Usable on directories.
 zx_status_t VnodeMinfs::WriteInternal(WriteTxn* txn, const void* data,
                                       size_t len, size_t off, size_t* actual) {
@@ -1288,10 +1453,19 @@ zx_status_t VnodeMinfs::WriteInternal(WriteTxn* txn, const void* data,
             }
         }
 
+        // The whole block is written back below, so the parts of it which are
+        // not being overwritten must be read in first.
+        if (xfer != kMinfsBlockSize && (status = LoadVmoBlocks(n, n + 1)) != ZX_OK) {
+            goto done;
+        }
+
         // Update this block of the in-memory VMO
         if ((status = VmoWriteExact(data, xfer_off, xfer)) != ZX_OK) {
             goto done;
         }
+        if ((status = vmo_loaded_.Set(n, n + 1)) != ZX_OK) {
+            goto done;
+        }
 
         // Update this block on-disk
         blk_t bno;
@@ -1357,11 +1531,17 @@ zx_status_t VnodeMinfs::Lookup(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece nam
 }
 
 zx_status_t VnodeMinfs::LookupInternal(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece name) {
+#ifdef __Fuchsia__
+    fbl::AutoLock lock(&lock_);
+#endif
     DirArgs args = DirArgs();
     args.name = name;
     zx_status_t status;
-    if ((status = ForEachDirent(&args, cb_dir_find)) < 0) {
-        return status;
+    if (!DirentCacheLookup(&args)) {
+        if ((status = ForEachDirent(&args, cb_dir_find)) < 0) {
+            return status;
+        }
+        DirentCacheInsert(name, args.off);
     }
     fbl::RefPtr<VnodeMinfs> vn;
     if ((status = fs_->VnodeGet(&vn, args.ino)) < 0) {
@@ -1373,6 +1553,9 @@ zx_status_t VnodeMinfs::LookupInternal(fbl::RefPtr<fs::Vnode>* out, fbl::StringP
 
 zx_status_t VnodeMinfs::Getattr(vnattr_t* a) {
     FS_TRACE(MINFS, "minfs_getattr() vn=%p(#%u)\n", this, ino_);
+#ifdef __Fuchsia__
+    fbl::AutoLock lock(&lock_);
+#endif
     a->mode = DTYPE_TO_VTYPE(MinfsMagicType(inode_.magic)) |
             V_IRUSR | V_IWUSR | V_IRGRP | V_IROTH;
     a->inode = ino_;
@@ -1391,6 +1574,13 @@ zx_status_t VnodeMinfs::Setattr(const vnattr_t* a) {
     if ((a->valid & ~(ATTR_CTIME|ATTR_MTIME)) != 0) {
         return ZX_ERR_NOT_SUPPORTED;
     }
+#ifdef __Fuchsia__
+    fbl::AutoLock txn_lock(&fs_->txn_lock_);
+    if (fs_->IsClosed()) {
+        return ZX_ERR_BAD_STATE;
+    }
+    fbl::AutoLock lock(&lock_);
+#endif
     if ((a->valid & ATTR_CTIME) != 0) {
         inode_.create_time = a->create_time;
         dirty = 1;
@@ -1414,13 +1604,46 @@ zx_status_t VnodeMinfs::Setattr(const vnattr_t* a) {
 }
 
 typedef struct dircookie {
-    size_t off;        // Offset into directory
-    uint32_t reserved; // Unused
-    uint32_t seqno;    // inode seq no
+    uint64_t order; // DirentOrder() of the last dirent returned, or 0
+    uint32_t off;   // Offset of the next dirent of a large linear directory, or 0
+    uint32_t seqno; // inode_.seq_num when |off| was saved
 } dircookie_t;
 
 static_assert(sizeof(dircookie_t) <= sizeof(fs::vdircookie_t),
               "MinFS dircookie too large to fit in IO state");
+static_assert(kMinfsMaxDirectorySize <= UINT32_MAX,
+              "MinFS directory offsets must fit in a dircookie");
+
+// Readdir returns dirents in increasing DirentOrder(): by name hash, then by
+// inode number. Since each hash bucket covers a range of hashes, this order
+// does not depend on where dirents live, so a cookie stays meaningful when
+// the directory is rehashed and every dirent moves.
+//
+// Sorting costs a read of the whole region being listed on every call, which
+// is fine for a bucket, or a linear directory no larger than one. A linear
+// directory that has outgrown a bucket but could not be rehashed is instead
+// listed in place, and its cookie holds an offset, like the cookies of
+// directories before they were hashed. A listing already under way when the
+// rehash failed carries on sorted, and one under way when such a directory
+// is finally rehashed starts over.
+namespace {
+
+uint64_t DirentOrder(const minfs_dirent_t* de) {
+    return (static_cast<uint64_t>(MinfsDirentHash(de->name, de->namelen)) << 32) | de->ino;
+}
+
+struct ReaddirEntry {
+    uint64_t order;
+    size_t off;
+};
+
+int ReaddirEntryCompare(const void* a, const void* b) {
+    uint64_t oa = static_cast<const ReaddirEntry*>(a)->order;
+    uint64_t ob = static_cast<const ReaddirEntry*>(b)->order;
+    return (oa < ob) ? -1 : (oa > ob) ? 1 : 0;
+}
+
+} // namespace
 
 zx_status_t VnodeMinfs::Readdir(fs::vdircookie_t* cookie, void* dirents, size_t len,
                                 size_t* out_actual) {
@@ -1431,25 +1654,120 @@ zx_status_t VnodeMinfs::Readdir(fs::vdircookie_t* cookie, void* dirents, size_t
     if (!IsDirectory()) {
         return ZX_ERR_NOT_SUPPORTED;
     }
+#ifdef __Fuchsia__
+    fbl::AutoLock lock(&lock_);
+#endif
+
+    if (dc->off != 0 && inode_.dir_buckets != 0) {
+        // Rehashed since the offset was saved.
+        dc->order = 0;
+        dc->off = 0;
+    } else if (dc->off != 0 ||
+               (dc->order == 0 && inode_.dir_buckets == 0 &&
+                inode_.size > kMinfsDirBucketSize)) {
+        size_t off = dc->off;
+        zx_status_t status = ReaddirLinear(&off, dc->seqno, &df);
+        if (status != ZX_OK) {
+            dc->off = 0;
+            return status;
+        }
+        // save our place in the dircookie
+        dc->off = static_cast<uint32_t>(off);
+        dc->seqno = inode_.seq_num;
+        *out_actual = df.BytesFilled();
+        ZX_DEBUG_ASSERT(*out_actual <= len); // Otherwise, we're overflowing the input buffer.
+        return ZX_OK;
+    }
+
+    // A linear directory is a single region; a hashed one is visited a
+    // bucket at a time, starting with the bucket holding the cookie's hash.
+    uint32_t regions = 1;
+    uint32_t region = 0;
+    size_t region_size = inode_.size;
+    if (inode_.dir_buckets != 0) {
+        regions = inode_.dir_buckets;
+        region = MinfsHashBucket(static_cast<uint32_t>(dc->order >> 32), regions);
+        region_size = kMinfsDirBucketSize;
+    }
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<char[]> data(new (&ac) char[region_size]);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    const size_t max_entries = region_size / MINFS_DIRENT_SIZE;
+    fbl::unique_ptr<ReaddirEntry[]> entries(new (&ac) ReaddirEntry[max_entries]);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    for (; region < regions; region++) {
+        const size_t start = region * region_size;
+        if (ReadExactInternal(data.get(), region_size, start) != ZX_OK) {
+            return ZX_ERR_IO;
+        }
+
+        // Collect the dirents not returned yet, then return them in order.
+        size_t count = 0;
+        size_t off = 0;
+        while (off + MINFS_DIRENT_SIZE <= region_size) {
+            minfs_dirent_t* de = reinterpret_cast<minfs_dirent_t*>(data.get() + off);
+            if (validate_dirent(de, region_size - off, start + off,
+                                DirentRegionEnd(start + off)) != ZX_OK) {
+                return ZX_ERR_IO;
+            }
+            if (de->ino != 0) {
+                if (off + DirentSize(de->namelen) > region_size) {
+                    return ZX_ERR_IO;
+                }
+                fbl::StringPiece name(de->name, de->namelen);
+                uint64_t order = DirentOrder(de);
+                if ((order > dc->order) && (name != "..")) {
+                    ZX_DEBUG_ASSERT(count < max_entries);
+                    entries[count++] = {order, off};
+                }
+            }
+            if (de->reclen & kMinfsReclenLast) {
+                break;
+            }
+            off += MinfsReclen(de, start + off);
+        }
+        qsort(entries.get(), count, sizeof(ReaddirEntry), ReaddirEntryCompare);
+
+        for (size_t i = 0; i < count; i++) {
+            minfs_dirent_t* de = reinterpret_cast<minfs_dirent_t*>(data.get() + entries[i].off);
+            if (df.Next(fbl::StringPiece(de->name, de->namelen), de->type) != ZX_OK) {
+                // no more space
+                goto done;
+            }
+            dc->order = entries[i].order;
+        }
+    }
 
-    size_t off = dc->off;
+done:
+    *out_actual = df.BytesFilled();
+    ZX_DEBUG_ASSERT(*out_actual <= len); // Otherwise, we're overflowing the input buffer.
+    return ZX_OK;
+}
+
+zx_status_t VnodeMinfs::ReaddirLinear(size_t* out_off, uint32_t seqno, fs::DirentFiller* df) {
+    size_t off = *out_off;
     size_t r;
     char data[kMinfsMaxDirentSize];
-    minfs_dirent_t* de = (minfs_dirent_t*) data;
-
-    if (off != 0 && dc->seqno != inode_.seq_num) {
-        // The offset *might* be invalid, if we called Readdir after a directory
-        // has been modified. In this case, we need to re-read the directory
-        // until we get to the direntry at or after the previously identified offset.
+    minfs_dirent_t* de = reinterpret_cast<minfs_dirent_t*>(data);
 
+    if (off != 0 && seqno != inode_.seq_num) {
+        // The directory has been modified, so the offset may no longer be
+        // that of a dirent. Walk back up to the first one at or after it.
         size_t off_recovered = 0;
         while (off_recovered < off) {
             if (off_recovered + MINFS_DIRENT_SIZE >= kMinfsMaxDirectorySize) {
-                goto fail;
+                return ZX_ERR_IO;
             }
             zx_status_t status = ReadInternal(de, kMinfsMaxDirentSize, off_recovered, &r);
-            if ((status != ZX_OK) || (validate_dirent(de, r, off_recovered) != ZX_OK)) {
-                goto fail;
+            if ((status != ZX_OK) ||
+                (validate_dirent(de, r, off_recovered, kMinfsMaxDirectorySize) != ZX_OK)) {
+                return ZX_ERR_IO;
             }
             off_recovered += MinfsReclen(de, off_recovered);
         }
@@ -1458,41 +1776,26 @@ zx_status_t VnodeMinfs::Readdir(fs::vdircookie_t* cookie, void* dirents, size_t
 
     while (off + MINFS_DIRENT_SIZE < kMinfsMaxDirectorySize) {
         zx_status_t status = ReadInternal(de, kMinfsMaxDirentSize, off, &r);
-        if (status != ZX_OK) {
-            goto fail;
-        } else if (validate_dirent(de, r, off) != ZX_OK) {
-            goto fail;
+        if ((status != ZX_OK) ||
+            (validate_dirent(de, r, off, kMinfsMaxDirectorySize) != ZX_OK)) {
+            return ZX_ERR_IO;
         }
 
         fbl::StringPiece name(de->name, de->namelen);
-
-        if (de->ino && name != "..") {
-            zx_status_t status;
-            if ((status = df.Next(name, de->type)) != ZX_OK) {
-                // no more space
-                goto done;
-            }
+        if (de->ino && name != ".." && df->Next(name, de->type) != ZX_OK) {
+            // no more space
+            break;
         }
-
         off += MinfsReclen(de, off);
     }
 
-done:
-    // save our place in the dircookie
-    dc->off = off;
-    dc->seqno = inode_.seq_num;
-    *out_actual = df.BytesFilled();
-    ZX_DEBUG_ASSERT(*out_actual <= len); // Otherwise, we're overflowing the input buffer.
+    *out_off = off;
     return ZX_OK;
-
-fail:
-    dc->off = 0;
-    return ZX_ERR_IO;
 }
 
 #ifdef __Fuchsia__
 VnodeMinfs::VnodeMinfs(Minfs* fs) :
-    fs_(fs), vmo_(ZX_HANDLE_INVALID), vmo_indirect_(nullptr) {}
+    fs_(fs), vmo_(ZX_HANDLE_INVALID) {}
 
 void VnodeMinfs::Notify(fbl::StringPiece name, unsigned event) { watcher_.Notify(name, event); }
 zx_status_t VnodeMinfs::WatchDir(fs::Vfs* vfs, const vfs_watch_dir_t* cmd) {
@@ -1535,6 +1838,13 @@ zx_status_t VnodeMinfs::Create(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece nam
     if (!IsDirectory()) {
         return ZX_ERR_NOT_SUPPORTED;
     }
+#ifdef __Fuchsia__
+    fbl::AutoLock txn_lock(&fs_->txn_lock_);
+    if (fs_->IsClosed()) {
+        return ZX_ERR_BAD_STATE;
+    }
+    fbl::AutoLock lock(&lock_);
+#endif
     if (IsUnlinked()) {
         return ZX_ERR_BAD_STATE;
     }
@@ -1579,7 +1889,7 @@ zx_status_t VnodeMinfs::Create(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece nam
     args.type = type;
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(name.length())));
     args.wb = wb.get();
-    if ((status = ForEachDirent(&args, cb_dir_append)) < 0) {
+    if ((status = AppendDirent(&args)) < 0) {
         return status;
     }
 
@@ -1602,6 +1912,9 @@ zx_status_t VnodeMinfs::Ioctl(uint32_t op, const void* in_buf, size_t in_len, vo
                 return ZX_ERR_INVALID_ARGS;
             }
 
+#ifdef __Fuchsia__
+            fbl::AutoLock txn_lock(&fs_->txn_lock_);
+#endif
             vfs_query_info_t* info = static_cast<vfs_query_info_t*>(out_buf);
             memset(info, 0, sizeof(*info));
             info->block_size = kMinfsBlockSize;
@@ -1619,7 +1932,7 @@ zx_status_t VnodeMinfs::Ioctl(uint32_t op, const void* in_buf, size_t in_len, vo
             if (status != ZX_OK) {
                 FS_TRACE_ERROR("minfs unmount failed to sync; unmounting anyway: %d\n", status);
             }
-            // 'fs_' is deleted after Unmount is called.
+            // Unmount only returns if the filesystem is already unmounting.
             *out_actual = 0;
             return fs_->Unmount();
         }
@@ -1648,6 +1961,13 @@ zx_status_t VnodeMinfs::Unlink(fbl::StringPiece name, bool must_be_dir) {
     if (!IsDirectory()) {
         return ZX_ERR_NOT_SUPPORTED;
     }
+#ifdef __Fuchsia__
+    fbl::AutoLock txn_lock(&fs_->txn_lock_);
+    if (fs_->IsClosed()) {
+        return ZX_ERR_BAD_STATE;
+    }
+    fbl::AutoLock lock(&lock_);
+#endif
     fbl::AllocChecker ac;
     fbl::unique_ptr<WritebackWork> wb(new (&ac) WritebackWork(fs_->bc_.get()));
     if (!ac.check()) {
@@ -1669,6 +1989,13 @@ zx_status_t VnodeMinfs::Truncate(size_t len) {
     if (IsDirectory()) {
         return ZX_ERR_NOT_FILE;
     }
+#ifdef __Fuchsia__
+    fbl::AutoLock txn_lock(&fs_->txn_lock_);
+    if (fs_->IsClosed()) {
+        return ZX_ERR_BAD_STATE;
+    }
+    fbl::AutoLock lock(&lock_);
+#endif
 
     fbl::AllocChecker ac;
     fbl::unique_ptr<WritebackWork> wb(new (&ac) WritebackWork(fs_->bc_.get()));
@@ -1688,8 +2015,6 @@ zx_status_t VnodeMinfs::Truncate(size_t len) {
 zx_status_t VnodeMinfs::TruncateInternal(WriteTxn* txn, size_t len) {
     zx_status_t r = 0;
 #ifdef __Fuchsia__
-    // TODO(smklein): We should only init up to 'len'; no need
-    // to read in the portion of a large file we plan on deleting.
     if (InitVmo() != ZX_OK) {
         return ZX_ERR_IO;
     }
@@ -1723,6 +2048,9 @@ zx_status_t VnodeMinfs::TruncateInternal(WriteTxn* txn, size_t len) {
             if (bno != 0) {
                 size_t adjust = len % kMinfsBlockSize;
 #ifdef __Fuchsia__
+                if ((r = LoadVmoBlocks(rel_bno, rel_bno + 1)) != ZX_OK) {
+                    return ZX_ERR_IO;
+                }
                 if ((r = VmoReadExact(bdata, len - adjust, adjust)) != ZX_OK) {
                     return ZX_ERR_IO;
                 }
@@ -1757,6 +2085,9 @@ zx_status_t VnodeMinfs::TruncateInternal(WriteTxn* txn, size_t len) {
     if ((r = vmo_.set_size(fbl::round_up(len, kMinfsBlockSize))) != ZX_OK) {
         return r;
     }
+    // Anything past the end of the file is gone from the VMO as well.
+    vmo_loaded_.Clear(fbl::round_up(len, kMinfsBlockSize) / kMinfsBlockSize,
+                      kMinfsMaxFileBlock);
 #endif
 
     ValidateVmoTail();
@@ -1793,12 +2124,29 @@ zx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, fbl::StringPiece
     if (!(IsDirectory() && newdir->IsDirectory()))
         return ZX_ERR_NOT_SUPPORTED;
 
+#ifdef __Fuchsia__
+    // Rename touches up to four vnodes, some of which may be the same vnode.
+    // Rather than holding all of their locks at once, each vnode is locked
+    // around each step which accesses it; the transaction lock keeps the
+    // operation as a whole atomic with respect to other modifications.
+    fbl::AutoLock txn_lock(&fs_->txn_lock_);
+    if (fs_->IsClosed()) {
+        return ZX_ERR_BAD_STATE;
+    }
+#endif
+
     zx_status_t status;
     fbl::RefPtr<VnodeMinfs> oldvn = nullptr;
     // acquire the 'oldname' node (it must exist)
     DirArgs args = DirArgs();
     args.name = oldname;
-    if ((status = ForEachDirent(&args, cb_dir_find)) < 0) {
+    {
+#ifdef __Fuchsia__
+        fbl::AutoLock lock(&lock_);
+#endif
+        status = ForEachDirent(&args, cb_dir_find);
+    }
+    if (status < 0) {
         return status;
     } else if ((status = fs_->VnodeGet(&oldvn, args.ino)) < 0) {
         return status;
@@ -1822,14 +2170,18 @@ zx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, fbl::StringPiece
     args.name = newname;
     args.ino = oldvn->ino_;
     args.type = oldvn->IsDirectory() ? kMinfsTypeDir : kMinfsTypeFile;
-    status = newdir->ForEachDirent(&args, cb_dir_attempt_rename);
-    if (status == ZX_ERR_NOT_FOUND) {
-        // if 'newname' does not exist, create it
-        args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(newname.length())));
-        if ((status = newdir->ForEachDirent(&args, cb_dir_append)) < 0) {
-            return status;
+    {
+#ifdef __Fuchsia__
+        fbl::AutoLock newdir_lock(&newdir->lock_);
+#endif
+        status = newdir->ForEachDirent(&args, cb_dir_attempt_rename);
+        if (status == ZX_ERR_NOT_FOUND) {
+            // if 'newname' does not exist, create it
+            args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(newname.length())));
+            status = newdir->AppendDirent(&args);
         }
-    } else if (status != ZX_OK) {
+    }
+    if (status < 0) {
         return status;
     }
 
@@ -1837,12 +2189,15 @@ zx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, fbl::StringPiece
     // moved to a new directory
     if ((args.type == kMinfsTypeDir) && (ino_ != newdir->ino_)) {
         fbl::RefPtr<fs::Vnode> vn_fs;
-        if ((status = newdir->Lookup(&vn_fs, newname)) < 0) {
+        if ((status = newdir->LookupInternal(&vn_fs, newname)) < 0) {
             return status;
         }
         auto vn = fbl::RefPtr<VnodeMinfs>::Downcast(vn_fs);
         args.name = "..";
         args.ino = newdir->ino_;
+#ifdef __Fuchsia__
+        fbl::AutoLock vn_lock(&vn->lock_);
+#endif
         if ((status = vn->ForEachDirent(&args, cb_dir_update_inode)) < 0) {
             return status;
         }
@@ -1850,11 +2205,21 @@ zx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, fbl::StringPiece
 
     // at this point, the oldvn exists with multiple names (or the same name in
     // different directories)
-    oldvn->inode_.link_count++;
+    {
+#ifdef __Fuchsia__
+        fbl::AutoLock oldvn_lock(&oldvn->lock_);
+#endif
+        oldvn->inode_.link_count++;
+    }
 
     // finally, remove oldname from its original position
     args.name = oldname;
-    status = ForEachDirent(&args, cb_dir_force_unlink);
+    {
+#ifdef __Fuchsia__
+        fbl::AutoLock lock(&lock_);
+#endif
+        status = ForEachDirent(&args, cb_dir_force_unlink);
+    }
     wb->PinVnode(oldvn);
     wb->PinVnode(newdir);
     fs_->EnqueueWork(fbl::move(wb));
@@ -1866,7 +2231,15 @@ zx_status_t VnodeMinfs::Link(fbl::StringPiece name, fbl::RefPtr<fs::Vnode> _targ
 
     if (!IsDirectory()) {
         return ZX_ERR_NOT_SUPPORTED;
-    } else if (IsUnlinked()) {
+    }
+#ifdef __Fuchsia__
+    fbl::AutoLock txn_lock(&fs_->txn_lock_);
+    if (fs_->IsClosed()) {
+        return ZX_ERR_BAD_STATE;
+    }
+    fbl::AutoLock lock(&lock_);
+#endif
+    if (IsUnlinked()) {
         return ZX_ERR_BAD_STATE;
     }
 
@@ -1893,13 +2266,18 @@ zx_status_t VnodeMinfs::Link(fbl::StringPiece name, fbl::RefPtr<fs::Vnode> _targ
     args.type = kMinfsTypeFile; // We can't hard link directories
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(name.length())));
     args.wb = wb.get();
-    if ((status = ForEachDirent(&args, cb_dir_append)) < 0) {
+    if ((status = AppendDirent(&args)) < 0) {
         return status;
     }
 
     // We have successfully added the vn to a new location. Increment the link count.
-    target->inode_.link_count++;
-    target->InodeSync(wb->txn(), kMxFsSyncDefault);
+    {
+#ifdef __Fuchsia__
+        fbl::AutoLock target_lock(&target->lock_);
+#endif
+        target->inode_.link_count++;
+        target->InodeSync(wb->txn(), kMxFsSyncDefault);
+    }
     wb->PinVnode(fbl::move(fbl::WrapRefPtr(this)));
     wb->PinVnode(target);
     fs_->EnqueueWork(fbl::move(wb));
@@ -35,9 +35,11 @@ void WriteTxn::Enqueue(zx_handle_t vmo, uint64_t relative_block,
             continue;
         }
 
-        if (requests_[i].vmo_offset == relative_block) {
+        if ((requests_[i].vmo_offset == relative_block) &&
+            (requests_[i].dev_offset == absolute_block)) {
             // Take the longer of the operations (if operating on the same
-            // blocks).
+            // blocks). The same VMO block may be bound for more than one
+            // device block.
             requests_[i].length = (requests_[i].length > nblocks) ? requests_[i].length : nblocks;
             return;
         } else if ((requests_[i].vmo_offset + requests_[i].length == relative_block) &&
@@ -16,6 +16,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/fifo.cpp \
     $(LOCAL_DIR)/job.cpp \
     $(LOCAL_DIR)/log.cpp \
+    $(LOCAL_DIR)/pager.cpp \
     $(LOCAL_DIR)/port.cpp \
     $(LOCAL_DIR)/process.cpp \
     $(LOCAL_DIR)/socket.cpp \
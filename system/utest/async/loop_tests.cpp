@@ -79,6 +79,24 @@ protected:
     }
 };
 
+class CancelOtherWait : public TestWait {
+public:
+    CancelOtherWait(zx_handle_t object, zx_signals_t trigger, TestWait* other)
+        : TestWait(object, trigger), other_(other) {}
+
+    zx_status_t cancel_status = ZX_ERR_INTERNAL;
+
+protected:
+    TestWait* other_;
+
+    async_wait_result_t Handle(async_t* async, zx_status_t status,
+                               const zx_packet_signal_t* signal) override {
+        TestWait::Handle(async, status, signal);
+        cancel_status = other_->op.Cancel(async);
+        return ASYNC_WAIT_FINISHED;
+    }
+};
+
 class TestTask {
 public:
     TestTask(zx_time_t deadline)
@@ -371,6 +389,32 @@ bool wait_test() {
     END_TEST;
 }
 
+bool wait_cancel_from_handler_test() {
+    BEGIN_TEST;
+
+    async::Loop loop;
+    zx::event event1, event2;
+    EXPECT_EQ(ZX_OK, zx::event::create(0u, &event1), "create event 1");
+    EXPECT_EQ(ZX_OK, zx::event::create(0u, &event2), "create event 2");
+
+    TestWait wait2(event2.get(), ZX_USER_SIGNAL_0);
+    CancelOtherWait wait1(event1.get(), ZX_USER_SIGNAL_0, &wait2);
+    EXPECT_EQ(ZX_OK, wait1.op.Begin(loop.async()), "wait 1");
+    EXPECT_EQ(ZX_OK, wait2.op.Begin(loop.async()), "wait 2");
+
+    // Both completions are queued before the loop runs, so a single port wait
+    // can pick them up together. Cancelling the second from the first's
+    // handler must still keep it from running.
+    EXPECT_EQ(ZX_OK, event1.signal(0u, ZX_USER_SIGNAL_0), "signal 1");
+    EXPECT_EQ(ZX_OK, event2.signal(0u, ZX_USER_SIGNAL_0), "signal 2");
+    EXPECT_EQ(ZX_ERR_TIMED_OUT, loop.Run(zx_deadline_after(ZX_MSEC(1))), "run loop");
+    EXPECT_EQ(1u, wait1.run_count, "run count 1");
+    EXPECT_EQ(ZX_OK, wait1.cancel_status, "cancel status");
+    EXPECT_EQ(0u, wait2.run_count, "run count 2");
+
+    END_TEST;
+}
+
 bool wait_invalid_handle_test() {
     BEGIN_TEST;
 
@@ -907,6 +951,7 @@ RUN_TEST(make_default_false_test)
 RUN_TEST(make_default_true_test)
 RUN_TEST(quit_test)
 RUN_TEST(wait_test)
+RUN_TEST(wait_cancel_from_handler_test)
 RUN_TEST(wait_invalid_handle_test)
 RUN_TEST(wait_shutdown_test)
 RUN_TEST(task_test)
@@ -0,0 +1,40 @@
+# Copyright 2018 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR).hostapp
+
+MODULE_TYPE := hostapp
+
+MODULE_NAME := blobstore-host-test
+
+MODULE_SRCS := \
+    $(LOCAL_DIR)/main.cpp \
+    $(LOCAL_DIR)/test-compression.cpp \
+    system/ulib/bitmap/raw-bitmap.cpp \
+
+MODULE_COMPILEFLAGS := \
+    -Werror-implicit-function-declaration \
+    -Wstrict-prototypes -Wwrite-strings \
+    -Isystem/ulib/unittest/include \
+    -Isystem/ulib/bitmap/include \
+    -Isystem/ulib/blobstore/include \
+    -Isystem/ulib/digest/include \
+    -Isystem/ulib/zxcpp/include \
+    -Isystem/ulib/fdio/include \
+    -Isystem/ulib/fbl/include \
+    -Isystem/ulib/fs/include \
+
+MODULE_HOST_LIBS := \
+    system/ulib/unittest.hostlib \
+    system/ulib/pretty.hostlib \
+    third_party/ulib/uboringssl.hostlib \
+    system/ulib/blobstore.hostlib \
+    system/ulib/digest.hostlib \
+    system/ulib/fbl.hostlib \
+
+MODULE_DEFINES += DISABLE_THREAD_ANNOTATIONS
+
+include make/module.mk
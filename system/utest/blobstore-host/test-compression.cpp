@@ -0,0 +1,314 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests for compressed blobs in images built by the host blobstore tool.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <blobstore/common.h>
+#include <blobstore/format.h>
+#include <blobstore/fsck.h>
+#include <blobstore/host.h>
+#include <digest/digest.h>
+#include <digest/merkle-tree.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/array.h>
+#include <fbl/unique_fd.h>
+#include <fbl/unique_ptr.h>
+#include <unittest/unittest.h>
+
+using digest::Digest;
+using digest::MerkleTree;
+
+namespace {
+
+constexpr uint64_t kImageBlocks = 4096;
+constexpr size_t kChunk = blobstore::kBlobstoreChunkSize;
+
+// A blob as it was added to an image, and as it was found in it.
+struct Blob {
+    fbl::Array<uint8_t> data;
+    Digest digest;
+    blobstore::blobstore_inode_t inode;
+    // The blob's data blocks, as stored.
+    fbl::Array<uint8_t> stored;
+    uint64_t stored_size;
+};
+
+// Fills |len| bytes at |data| with bytes which LZ4 can compress.
+void FillCompressible(uint8_t* data, size_t len, unsigned int* seed) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] = static_cast<uint8_t>((i / 64) % 16 == 0 ? rand_r(seed) : i % 7);
+    }
+}
+
+// Fills |len| bytes at |data| with bytes which LZ4 cannot compress.
+void FillRandom(uint8_t* data, size_t len, unsigned int* seed) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] = static_cast<uint8_t>(rand_r(seed));
+    }
+}
+
+// Creates an empty blobstore image in a temporary file.
+bool CreateImage(fbl::unique_fd* out) {
+    BEGIN_HELPER;
+    char path[] = "/tmp/blobstore-host-test.XXXXXX";
+    fbl::unique_fd fd(mkstemp(path));
+    ASSERT_TRUE(fd);
+    ASSERT_EQ(unlink(path), 0);
+    ASSERT_EQ(ftruncate(fd.get(), kImageBlocks * blobstore::kBlobstoreBlockSize), 0);
+    ASSERT_EQ(blobstore::blobstore_mkfs(fd.get(), kImageBlocks), 0);
+    *out = fbl::move(fd);
+    END_HELPER;
+}
+
+// Adds |blob->data| to the image |fd| with the host blobstore tool, then
+// reads back the blob's node and data blocks.
+bool AddBlob(int fd, Blob* blob) {
+    BEGIN_HELPER;
+    const size_t len = blob->data.size();
+    char path[] = "/tmp/blobstore-host-blob.XXXXXX";
+    fbl::unique_fd data_fd(mkstemp(path));
+    ASSERT_TRUE(data_fd);
+    ASSERT_EQ(unlink(path), 0);
+    ASSERT_EQ(write(data_fd.get(), blob->data.get(), len), static_cast<ssize_t>(len));
+
+    fbl::RefPtr<blobstore::Blobstore> bs;
+    ASSERT_EQ(blobstore::blobstore_create(&bs, fbl::unique_fd(dup(fd))), ZX_OK);
+    ASSERT_EQ(blobstore::blobstore_add_blob(bs.get(), data_fd.get()), ZX_OK);
+    ASSERT_EQ(blobstore::blobstore_check(fbl::move(bs)), ZX_OK);
+
+    fbl::AllocChecker ac;
+    const size_t merkle_len = MerkleTree::GetTreeLength(len);
+    fbl::unique_ptr<uint8_t[]> merkle(new (&ac) uint8_t[merkle_len]);
+    ASSERT_TRUE(ac.check());
+    ASSERT_EQ(MerkleTree::Create(blob->data.get(), len, merkle.get(), merkle_len,
+                                 &blob->digest), ZX_OK);
+
+    // Find the blob's node.
+    uint8_t block[blobstore::kBlobstoreBlockSize];
+    ASSERT_EQ(blobstore::readblk(fd, 0, block), ZX_OK);
+    blobstore::blobstore_info_t info;
+    memcpy(&info, block, sizeof(info));
+    bool found = false;
+    for (uint64_t n = 0; n < blobstore::NodeMapBlocks(info) && !found; n++) {
+        ASSERT_EQ(blobstore::readblk(fd, blobstore::NodeMapStartBlock(info) + n, block), ZX_OK);
+        auto nodes = reinterpret_cast<const blobstore::blobstore_inode_t*>(block);
+        for (size_t i = 0; i < blobstore::kBlobstoreInodesPerBlock; i++) {
+            if (nodes[i].start_block >= blobstore::kStartBlockMinimum &&
+                blob->digest == nodes[i].merkle_root_hash) {
+                blob->inode = nodes[i];
+                found = true;
+                break;
+            }
+        }
+    }
+    ASSERT_TRUE(found, "Blob missing from the node map");
+    ASSERT_EQ(blob->inode.blob_size, len);
+
+    // The Merkle tree is stored first, then the data.
+    const uint64_t merkle_blocks = blobstore::MerkleTreeBlocks(blob->inode);
+    const uint64_t start = blobstore::DataStartBlock(info) + blob->inode.start_block;
+    for (uint64_t n = 0; n < merkle_blocks; n++) {
+        ASSERT_EQ(blobstore::readblk(fd, start + n, block), ZX_OK);
+        const size_t off = n * blobstore::kBlobstoreBlockSize;
+        const size_t part = fbl::min(merkle_len - off, sizeof(block));
+        ASSERT_EQ(memcmp(block, merkle.get() + off, part), 0, "Unexpected Merkle tree");
+    }
+    const uint64_t data_blocks = blob->inode.num_blocks - merkle_blocks;
+    blob->stored_size = data_blocks * blobstore::kBlobstoreBlockSize;
+    blob->stored.reset(new (&ac) uint8_t[blob->stored_size], blob->stored_size);
+    ASSERT_TRUE(ac.check());
+    for (uint64_t n = 0; n < data_blocks; n++) {
+        ASSERT_EQ(blobstore::readblk(fd, start + merkle_blocks + n,
+                                     blob->stored.get() + n * blobstore::kBlobstoreBlockSize),
+                  ZX_OK);
+    }
+    END_HELPER;
+}
+
+// Reads |len| bytes at |off| of the compressed |blob| into |out|, expanding
+// only the chunks which cover them, as blobstore does.
+bool ReadCompressed(const Blob& blob, const uint64_t* table, size_t off, size_t len,
+                    uint8_t* out) {
+    BEGIN_HELPER;
+    uint8_t chunk[kChunk];
+    for (uint64_t c = off / kChunk; c * kChunk < off + len; c++) {
+        ASSERT_EQ(blobstore::DecompressChunk(blob.inode, table, c, blob.stored.get(), chunk),
+                  ZX_OK);
+        const size_t chunk_off = c * kChunk;
+        const size_t start = fbl::max(off, chunk_off);
+        const size_t end = fbl::min(off + len, fbl::min(chunk_off + kChunk,
+                                                        blob.data.size()));
+        memcpy(out + (start - off), chunk + (start - chunk_off), end - start);
+    }
+    END_HELPER;
+}
+
+// Returns the seek table at the start of the data of the compressed |blob|.
+const uint64_t* SeekTable(const Blob& blob) {
+    return reinterpret_cast<const uint64_t*>(blob.stored.get());
+}
+
+// Builds a blob whose chunks alternate between compressible and random
+// data, with a short final chunk.
+bool CreateMixedBlob(Blob* blob) {
+    BEGIN_HELPER;
+    constexpr size_t kLen = kChunk * 5 + 1000;
+    fbl::AllocChecker ac;
+    blob->data.reset(new (&ac) uint8_t[kLen], kLen);
+    ASSERT_TRUE(ac.check());
+    unsigned int seed = static_cast<unsigned int>(time(nullptr));
+    unittest_printf("Compression test using seed: %u\n", seed);
+    for (size_t c = 0; c * kChunk < kLen; c++) {
+        const size_t len = fbl::min(kChunk, kLen - c * kChunk);
+        if (c == 2) {
+            FillRandom(blob->data.get() + c * kChunk, len, &seed);
+        } else {
+            FillCompressible(blob->data.get() + c * kChunk, len, &seed);
+        }
+    }
+    END_HELPER;
+}
+
+bool TestCompressedRead(void) {
+    BEGIN_TEST;
+    fbl::unique_fd fd;
+    ASSERT_TRUE(CreateImage(&fd));
+    Blob blob;
+    ASSERT_TRUE(CreateMixedBlob(&blob));
+    ASSERT_TRUE(AddBlob(fd.get(), &blob));
+    const size_t len = blob.data.size();
+
+    ASSERT_TRUE(blob.inode.flags & blobstore::kBlobstoreInodeFlagLZ4, "Blob was not compressed");
+    ASSERT_LT(blob.inode.num_blocks,
+              blobstore::MerkleTreeBlocks(blob.inode) + blobstore::BlobDataBlocks(blob.inode));
+    const uint64_t* table = SeekTable(blob);
+    ASSERT_EQ(blobstore::CheckSeekTable(blob.inode, table, blob.stored_size), ZX_OK);
+
+    // The random chunk is stored as it is; the others shrink.
+    const uint64_t chunks = blobstore::BlobChunks(blob.inode);
+    for (uint64_t c = 0; c < chunks; c++) {
+        const uint64_t raw_len = fbl::min(kChunk, len - c * kChunk);
+        if (c == 2) {
+            ASSERT_EQ(table[c + 1] - table[c], raw_len, "Random chunk was compressed");
+            ASSERT_EQ(memcmp(blob.stored.get() + table[c], blob.data.get() + c * kChunk,
+                             raw_len), 0);
+        } else {
+            ASSERT_LT(table[c + 1] - table[c], raw_len, "Chunk was not compressed");
+        }
+    }
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[len]);
+    ASSERT_TRUE(ac.check());
+    ASSERT_TRUE(ReadCompressed(blob, table, 0, len, out.get()));
+    ASSERT_EQ(memcmp(out.get(), blob.data.get(), len), 0, "Unexpected blob contents");
+
+    // The Merkle tree covers the uncompressed data.
+    const size_t merkle_len = MerkleTree::GetTreeLength(len);
+    fbl::unique_ptr<uint8_t[]> merkle(new (&ac) uint8_t[merkle_len]);
+    ASSERT_TRUE(ac.check());
+    Digest digest;
+    ASSERT_EQ(MerkleTree::Create(out.get(), len, merkle.get(), merkle_len, &digest), ZX_OK);
+    ASSERT_TRUE(digest == blob.digest, "Merkle root does not match the blob's name");
+
+    unsigned int seed = static_cast<unsigned int>(time(nullptr));
+    for (size_t i = 0; i < 100; i++) {
+        const size_t off = rand_r(&seed) % len;
+        const size_t part = 1 + rand_r(&seed) % fbl::min(len - off, 3 * kChunk);
+        memset(out.get(), 0, part);
+        ASSERT_TRUE(ReadCompressed(blob, table, off, part, out.get()));
+        ASSERT_EQ(memcmp(out.get(), blob.data.get() + off, part), 0,
+                  "Unexpected blob contents");
+    }
+    END_TEST;
+}
+
+bool TestIncompressibleBlob(void) {
+    BEGIN_TEST;
+    fbl::unique_fd fd;
+    ASSERT_TRUE(CreateImage(&fd));
+    Blob blob;
+    constexpr size_t kLen = kChunk * 2 + 10;
+    fbl::AllocChecker ac;
+    blob.data.reset(new (&ac) uint8_t[kLen], kLen);
+    ASSERT_TRUE(ac.check());
+    unsigned int seed = static_cast<unsigned int>(time(nullptr));
+    FillRandom(blob.data.get(), kLen, &seed);
+    ASSERT_TRUE(AddBlob(fd.get(), &blob));
+
+    // Compression would not save a block, so the blob is stored as it is.
+    ASSERT_EQ(blob.inode.flags & blobstore::kBlobstoreInodeFlagLZ4, 0);
+    ASSERT_EQ(blob.inode.num_blocks,
+              blobstore::MerkleTreeBlocks(blob.inode) + blobstore::BlobDataBlocks(blob.inode));
+    ASSERT_EQ(memcmp(blob.stored.get(), blob.data.get(), kLen), 0);
+    END_TEST;
+}
+
+bool TestCorruptSeekTable(void) {
+    BEGIN_TEST;
+    fbl::unique_fd fd;
+    ASSERT_TRUE(CreateImage(&fd));
+    Blob blob;
+    ASSERT_TRUE(CreateMixedBlob(&blob));
+    ASSERT_TRUE(AddBlob(fd.get(), &blob));
+    const blobstore::blobstore_inode_t& inode = blob.inode;
+
+    const uint64_t entries = blobstore::BlobChunks(inode) + 1;
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint64_t[]> table(new (&ac) uint64_t[entries]);
+    ASSERT_TRUE(ac.check());
+    auto reset = [&]() {
+        memcpy(table.get(), SeekTable(blob), entries * sizeof(uint64_t));
+    };
+    reset();
+    ASSERT_EQ(blobstore::CheckSeekTable(inode, table.get(), blob.stored_size), ZX_OK);
+
+    // The table must start right after itself.
+    table[0] += sizeof(uint64_t);
+    ASSERT_EQ(blobstore::CheckSeekTable(inode, table.get(), blob.stored_size),
+              ZX_ERR_IO_DATA_INTEGRITY);
+    reset();
+
+    // Offsets must not go backwards.
+    table[2] = table[1] - 1;
+    ASSERT_EQ(blobstore::CheckSeekTable(inode, table.get(), blob.stored_size),
+              ZX_ERR_IO_DATA_INTEGRITY);
+    reset();
+
+    // A chunk may not be stored in more bytes than it expands to.
+    table[2] = table[1] + kChunk + 1;
+    ASSERT_EQ(blobstore::CheckSeekTable(inode, table.get(), blob.stored_size),
+              ZX_ERR_IO_DATA_INTEGRITY);
+    reset();
+
+    // Chunks must lie within the blob's blocks.
+    table[entries - 1] = blob.stored_size + 1;
+    ASSERT_EQ(blobstore::CheckSeekTable(inode, table.get(), blob.stored_size),
+              ZX_ERR_IO_DATA_INTEGRITY);
+    reset();
+
+    // A consistent table which cuts a compressed chunk short makes it fail to
+    // expand, rather than expand into the wrong data.
+    table[1]--;
+    ASSERT_EQ(blobstore::CheckSeekTable(inode, table.get(), blob.stored_size), ZX_OK);
+    uint8_t chunk[kChunk];
+    ASSERT_EQ(blobstore::DecompressChunk(inode, table.get(), 0, blob.stored.get(), chunk),
+              ZX_ERR_IO_DATA_INTEGRITY);
+    END_TEST;
+}
+
+} // namespace
+
+BEGIN_TEST_CASE(blobstore_compression_tests)
+RUN_TEST_MEDIUM(TestCompressedRead)
+RUN_TEST_MEDIUM(TestIncompressibleBlob)
+RUN_TEST_MEDIUM(TestCorruptSeekTable)
+END_TEST_CASE(blobstore_compression_tests)
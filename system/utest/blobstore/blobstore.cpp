@@ -19,6 +19,7 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <blobstore/format.h>
 #include <digest/digest.h>
 #include <digest/merkle-tree.h>
 #include <fs-management/mount.h>
@@ -703,6 +704,113 @@ static bool CorruptedBlob(void) {
     END_TEST;
 }
 
+// Reads the superblock, and the node of the blob at |path|, straight from the
+// device of an unmounted blobstore.
+static bool ReadBlobNode(int dev_fd, const char* path, blobstore::blobstore_info_t* info_out,
+                         blobstore::blobstore_inode_t* inode_out) {
+    using namespace blobstore;
+    char block[kBlobstoreBlockSize];
+    ASSERT_EQ(pread(dev_fd, block, sizeof(block), 0), (ssize_t)sizeof(block));
+    memcpy(info_out, block, sizeof(*info_out));
+
+    Digest digest;
+    const char* hex = path + strlen(MOUNT_PATH "/");
+    ASSERT_EQ(digest.Parse(hex, strlen(hex)), ZX_OK);
+
+    bool found = false;
+    for (uint64_t n = 0; n < NodeMapBlocks(*info_out) && !found; n++) {
+        off_t off = (NodeMapStartBlock(*info_out) + n) * kBlobstoreBlockSize;
+        ASSERT_EQ(pread(dev_fd, block, sizeof(block), off), (ssize_t)sizeof(block));
+        const blobstore_inode_t* nodes = reinterpret_cast<const blobstore_inode_t*>(block);
+        for (size_t i = 0; i < kBlobstoreInodesPerBlock && !found; i++) {
+            if (nodes[i].start_block >= kStartBlockMinimum &&
+                digest == nodes[i].merkle_root_hash) {
+                *inode_out = nodes[i];
+                found = true;
+            }
+        }
+    }
+    ASSERT_TRUE(found, "Blob not found on disk");
+    return true;
+}
+
+// Flips the bits of the first byte of device block |bno|.
+static bool CorruptDeviceBlock(int dev_fd, uint64_t bno) {
+    char block[blobstore::kBlobstoreBlockSize];
+    off_t off = bno * blobstore::kBlobstoreBlockSize;
+    ASSERT_EQ(pread(dev_fd, block, sizeof(block), off), (ssize_t)sizeof(block));
+    block[0] = static_cast<char>(~block[0]);
+    ASSERT_EQ(pwrite(dev_fd, block, sizeof(block), off), (ssize_t)sizeof(block));
+    return true;
+}
+
+// Blob data is verified range by range as it is first read, so corruption
+// far into a blob must not stop the data ahead of it being read, and a range
+// which has been verified once is served from memory from then on.
+template <fs_test_type_t TestType>
+static bool CorruptedBlockReadByRange(void) {
+    BEGIN_TEST;
+    using namespace blobstore;
+    char ramdisk_path[PATH_MAX];
+    char fvm_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest<TestType>(512, 1 << 20, ramdisk_path, fvm_path), 0,
+              "Mounting Blobstore");
+
+    constexpr size_t kBlobBlocks = 128;
+    constexpr size_t kBadBlock = kBlobBlocks - 8;
+    constexpr size_t kReadLen = 4 * kBlobstoreBlockSize;
+    fbl::unique_ptr<blob_info_t> info;
+    ASSERT_TRUE(GenerateBlob(kBlobBlocks * kBlobstoreBlockSize, &info));
+    int fd;
+    ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                         info->data.get(), info->size_data, &fd));
+    ASSERT_EQ(close(fd), 0);
+
+    // Corrupt the blob behind blobstore's back, then bring it back up with
+    // nothing cached.
+    ASSERT_EQ(umount(MOUNT_PATH), ZX_OK, "Could not unmount blobstore");
+    int dev_fd = open(ramdisk_path, O_RDWR);
+    ASSERT_GT(dev_fd, 0, "Could not open ramdisk");
+    blobstore_info_t sb;
+    blobstore_inode_t inode;
+    ASSERT_TRUE(ReadBlobNode(dev_fd, info->path, &sb, &inode));
+    const uint64_t merkle_blocks = fbl::round_up(info->size_merkle, kBlobstoreBlockSize) /
+                                   kBlobstoreBlockSize;
+    const uint64_t data_start = DataStartBlock(sb) + inode.start_block + merkle_blocks;
+    ASSERT_TRUE(CorruptDeviceBlock(dev_fd, data_start + kBadBlock));
+    ASSERT_EQ(close(dev_fd), 0);
+    ASSERT_EQ(MountBlobstore(ramdisk_path), 0, "Could not re-mount blobstore");
+
+    fd = open(info->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<char[]> buf(new (&ac) char[kReadLen]);
+    ASSERT_EQ(ac.check(), true);
+
+    // Only the range that was read has to check out.
+    ASSERT_EQ(pread(fd, buf.get(), kReadLen, 0), (ssize_t)kReadLen);
+    ASSERT_EQ(memcmp(buf.get(), info->data.get(), kReadLen), 0, "Read data, but it was bad");
+
+    // The integrity error surfaces through fdio as EIO.
+    ASSERT_LT(pread(fd, buf.get(), kBlobstoreBlockSize, kBadBlock * kBlobstoreBlockSize), 0,
+              "Expected reading the corrupt block to fail");
+    ASSERT_EQ(errno, EIO);
+
+    // Corrupt the range that was read too. Had it been read from disk again,
+    // it would now fail verification.
+    dev_fd = open(ramdisk_path, O_RDWR);
+    ASSERT_GT(dev_fd, 0, "Could not open ramdisk");
+    ASSERT_TRUE(CorruptDeviceBlock(dev_fd, data_start));
+    ASSERT_EQ(close(dev_fd), 0);
+
+    ASSERT_EQ(pread(fd, buf.get(), kReadLen, 0), (ssize_t)kReadLen);
+    ASSERT_EQ(memcmp(buf.get(), info->data.get(), kReadLen), 0, "Read data, but it was bad");
+    ASSERT_EQ(close(fd), 0);
+
+    ASSERT_EQ(EndBlobstoreTest<TestType>(ramdisk_path, fvm_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
 template <fs_test_type_t TestType>
 static bool CorruptedDigest(void) {
     BEGIN_TEST;
@@ -797,6 +905,136 @@ static bool CreateUmountRemountSmall(void) {
     END_TEST;
 }
 
+// Generates blobs until one has a digest beginning with the byte |prefix|.
+static bool GenerateBlobWithPrefix(uint8_t prefix, fbl::unique_ptr<blob_info_t>* out) {
+    BEGIN_HELPER;
+    char hex[3] = {};
+    do {
+        ASSERT_TRUE(GenerateBlob(1 << 10, out));
+        memcpy(hex, (*out)->path + strlen(MOUNT_PATH "/"), 2);
+    } while (strtoul(hex, nullptr, 16) != prefix);
+    END_HELPER;
+}
+
+// Checks that the blob |info| can be opened and read if |present|, and that
+// it cannot be found otherwise.
+static bool CheckBlobPresent(const blob_info_t* info, bool present) {
+    BEGIN_HELPER;
+    int fd = open(info->path, O_RDONLY);
+    if (!present) {
+        ASSERT_LT(fd, 0, "Found a blob which was removed");
+        ASSERT_EQ(errno, ENOENT);
+    } else {
+        ASSERT_GT(fd, 0, "Failed to find blob");
+        ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data));
+        ASSERT_EQ(close(fd), 0);
+    }
+    END_HELPER;
+}
+
+// Blobs which are not open are found through the digest index, which starts
+// at 64 slots and picks a blob's slot from the leading bytes of its digest.
+// Digests beginning with 0xff share the last slot of any small index, so
+// their probe sequence wraps around into the slots of digests beginning with
+// 0x00.
+template <fs_test_type_t TestType>
+static bool CollidingDigests(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    char fvm_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest<TestType>(512, 1 << 20, ramdisk_path, fvm_path), 0,
+              "Mounting Blobstore");
+
+    constexpr size_t kBlobs = 6;
+    constexpr uint8_t kPrefixes[kBlobs] = {0xff, 0xff, 0xff, 0xff, 0x00, 0x00};
+    fbl::unique_ptr<blob_info_t> infos[kBlobs];
+    bool present[kBlobs];
+    for (size_t i = 0; i < kBlobs; i++) {
+        ASSERT_TRUE(GenerateBlobWithPrefix(kPrefixes[i], &infos[i]));
+        int fd;
+        ASSERT_TRUE(MakeBlob(infos[i]->path, infos[i]->merkle.get(), infos[i]->size_merkle,
+                             infos[i]->data.get(), infos[i]->size_data, &fd));
+        ASSERT_EQ(close(fd), 0);
+        present[i] = true;
+    }
+    for (size_t i = 0; i < kBlobs; i++) {
+        ASSERT_TRUE(CheckBlobPresent(infos[i].get(), present[i]));
+    }
+
+    // Remove blobs from the middle of each probe sequence, including the one
+    // which wraps around, then add one back behind the others.
+    constexpr size_t kRemoved[] = {1, 4};
+    for (size_t i : kRemoved) {
+        ASSERT_EQ(unlink(infos[i]->path), 0);
+        present[i] = false;
+        for (size_t j = 0; j < kBlobs; j++) {
+            ASSERT_TRUE(CheckBlobPresent(infos[j].get(), present[j]));
+        }
+    }
+    int fd;
+    ASSERT_TRUE(MakeBlob(infos[1]->path, infos[1]->merkle.get(), infos[1]->size_merkle,
+                         infos[1]->data.get(), infos[1]->size_data, &fd));
+    ASSERT_EQ(close(fd), 0);
+    present[1] = true;
+    for (size_t i = 0; i < kBlobs; i++) {
+        ASSERT_TRUE(CheckBlobPresent(infos[i].get(), present[i]));
+    }
+
+    // The index is rebuilt from the node map at mount.
+    ASSERT_EQ(umount(MOUNT_PATH), ZX_OK, "Could not unmount blobstore");
+    ASSERT_EQ(MountBlobstore(ramdisk_path), 0, "Could not re-mount blobstore");
+    for (size_t i = 0; i < kBlobs; i++) {
+        ASSERT_TRUE(CheckBlobPresent(infos[i].get(), present[i]));
+    }
+    ASSERT_EQ(unlink(infos[0]->path), 0);
+    present[0] = false;
+    for (size_t i = 0; i < kBlobs; i++) {
+        ASSERT_TRUE(CheckBlobPresent(infos[i].get(), present[i]));
+    }
+
+    ASSERT_EQ(EndBlobstoreTest<TestType>(ramdisk_path, fvm_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
+// Adds enough blobs to grow the digest index several times, and checks that
+// every blob can be found before and after the index is rebuilt at mount.
+template <fs_test_type_t TestType>
+static bool DigestIndexGrowth(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    char fvm_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest<TestType>(512, 1 << 20, ramdisk_path, fvm_path), 0,
+              "Mounting Blobstore");
+
+    constexpr size_t kBlobs = 300;
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<fbl::unique_ptr<blob_info_t>[]> infos(
+        new (&ac) fbl::unique_ptr<blob_info_t>[kBlobs]);
+    ASSERT_TRUE(ac.check());
+    for (size_t i = 0; i < kBlobs; i++) {
+        ASSERT_TRUE(GenerateBlob(1 << 10, &infos[i]));
+        int fd;
+        ASSERT_TRUE(MakeBlob(infos[i]->path, infos[i]->merkle.get(), infos[i]->size_merkle,
+                             infos[i]->data.get(), infos[i]->size_data, &fd));
+        ASSERT_EQ(close(fd), 0);
+    }
+    for (size_t i = 0; i < kBlobs; i++) {
+        ASSERT_TRUE(CheckBlobPresent(infos[i].get(), true));
+    }
+
+    for (size_t i = 0; i < kBlobs; i += 2) {
+        ASSERT_EQ(unlink(infos[i]->path), 0);
+    }
+    ASSERT_EQ(umount(MOUNT_PATH), ZX_OK, "Could not unmount blobstore");
+    ASSERT_EQ(MountBlobstore(ramdisk_path), 0, "Could not re-mount blobstore");
+    for (size_t i = 0; i < kBlobs; i++) {
+        ASSERT_TRUE(CheckBlobPresent(infos[i].get(), i % 2 == 1));
+    }
+
+    ASSERT_EQ(EndBlobstoreTest<TestType>(ramdisk_path, fvm_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
 enum TestState {
     empty,
     configured,
@@ -1569,8 +1807,11 @@ RUN_TEST_FOR_ALL_TYPES(MEDIUM, ReadTooLarge)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, BadAllocation)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, CorruptedBlob)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, CorruptedDigest)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, CorruptedBlockReadByRange)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, EdgeAllocation)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, CreateUmountRemountSmall)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, CollidingDigests)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, DigestIndexGrowth)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, EarlyRead)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, WaitForRead)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, WriteSeekIgnored)
@@ -22,6 +22,9 @@ MODULE_STATIC_LIBS := \
     system/ulib/fbl \
     third_party/ulib/uboringssl \
 
+MODULE_HEADER_DEPS := \
+    system/ulib/blobstore \
+
 MODULE_LIBS := \
     system/ulib/fdio \
     system/ulib/c \
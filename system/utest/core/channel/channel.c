@@ -10,6 +10,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <threads.h>
 #include <unistd.h>
 
@@ -855,6 +856,101 @@ static bool channel_disallow_write_to_self(void) {
     END_TEST;
 }
 
+// Writes |data_size| bytes and |num_handles| fresh events through a channel
+// and checks that exactly the same bytes and events come out the other end.
+static bool roundtrip_message(zx_handle_t writer, zx_handle_t reader,
+                              uint32_t data_size, uint32_t num_handles) {
+    BEGIN_HELPER;
+
+    uint8_t data[512];
+    uint8_t read_data[512];
+    zx_handle_t handles[4];
+    zx_handle_t read_handles[4];
+    zx_koid_t koids[4];
+    ASSERT_LE(data_size, sizeof(data), "");
+    ASSERT_LE(num_handles, countof(handles), "");
+
+    for (uint32_t i = 0; i < data_size; i++)
+        data[i] = (uint8_t)(i * 7 + data_size);
+    for (uint32_t i = 0; i < num_handles; i++) {
+        ASSERT_EQ(zx_event_create(0u, &handles[i]), ZX_OK, "");
+        zx_info_handle_basic_t info;
+        ASSERT_EQ(zx_object_get_info(handles[i], ZX_INFO_HANDLE_BASIC, &info, sizeof(info),
+                                     NULL, NULL), ZX_OK, "");
+        koids[i] = info.koid;
+    }
+
+    ASSERT_EQ(zx_channel_write(writer, 0u, data, data_size, handles, num_handles), ZX_OK, "");
+
+    memset(read_data, 0, sizeof(read_data));
+    uint32_t actual_bytes, actual_handles;
+    ASSERT_EQ(zx_channel_read(reader, 0u, read_data, read_handles, sizeof(read_data),
+                              countof(read_handles), &actual_bytes, &actual_handles), ZX_OK, "");
+    ASSERT_EQ(actual_bytes, data_size, "");
+    ASSERT_EQ(actual_handles, num_handles, "");
+    EXPECT_EQ(memcmp(read_data, data, data_size), 0, "message data corrupted");
+
+    for (uint32_t i = 0; i < num_handles; i++) {
+        zx_info_handle_basic_t info;
+        ASSERT_EQ(zx_object_get_info(read_handles[i], ZX_INFO_HANDLE_BASIC, &info,
+                                     sizeof(info), NULL, NULL), ZX_OK, "");
+        EXPECT_EQ(info.type, (uint32_t)ZX_OBJ_TYPE_EVENT, "");
+        EXPECT_EQ(info.koid, koids[i], "handles out of order");
+        EXPECT_EQ(zx_handle_close(read_handles[i]), ZX_OK, "");
+    }
+
+    END_HELPER;
+}
+
+// The kernel keeps a message inside its packet when the data plus one
+// pointer per handle fits in 256 + 8 bytes, and allocates a separate buffer
+// otherwise. Check messages right at that limit and just past it.
+static bool channel_inline_threshold(void) {
+    BEGIN_TEST;
+
+    const uint32_t kInlineBytes = 256 + 8;
+    const uint32_t kHandleBytes = 8;
+
+    zx_handle_t channel[2];
+    ASSERT_EQ(zx_channel_create(0, &channel[0], &channel[1]), ZX_OK, "");
+
+    // e.g. 256 bytes with one handle, 257 bytes with one handle
+    for (uint32_t num_handles = 0; num_handles <= 3; num_handles++) {
+        uint32_t fits = kInlineBytes - num_handles * kHandleBytes;
+        EXPECT_TRUE(roundtrip_message(channel[0], channel[1], fits, num_handles), "");
+        EXPECT_TRUE(roundtrip_message(channel[0], channel[1], fits + 1, num_handles), "");
+        EXPECT_TRUE(roundtrip_message(channel[1], channel[0], fits - 1, num_handles), "");
+    }
+    // 256 bytes is exactly full with one handle, and overflows with two
+    EXPECT_TRUE(roundtrip_message(channel[0], channel[1], 256, 2), "");
+
+    // queue several of each kind before reading any back, so inline and
+    // out of line packets sit in the channel together
+    uint8_t data[257];
+    memset(data, 0x5a, sizeof(data));
+    for (uint32_t size = 255; size <= 257; size++) {
+        zx_handle_t event;
+        ASSERT_EQ(zx_event_create(0u, &event), ZX_OK, "");
+        ASSERT_EQ(zx_channel_write(channel[0], 0u, data, size, &event, 1u), ZX_OK, "");
+    }
+    for (uint32_t size = 255; size <= 257; size++) {
+        uint8_t read_data[257];
+        zx_handle_t event;
+        uint32_t actual_bytes, actual_handles;
+        ASSERT_EQ(zx_channel_read(channel[1], 0u, read_data, &event, sizeof(read_data), 1u,
+                                  &actual_bytes, &actual_handles), ZX_OK, "");
+        EXPECT_EQ(actual_bytes, size, "");
+        EXPECT_EQ(actual_handles, 1u, "");
+        EXPECT_EQ(memcmp(read_data, data, size), 0, "");
+        EXPECT_EQ(zx_handle_close(event), ZX_OK, "");
+    }
+
+    EXPECT_EQ(zx_handle_close(channel[0]), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(channel[1]), ZX_OK, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(channel_tests)
 RUN_TEST(channel_test)
 RUN_TEST(channel_read_error_test)
@@ -868,6 +964,7 @@ RUN_TEST(channel_call2)
 RUN_TEST(bad_channel_call_finish)
 RUN_TEST(channel_nest)
 RUN_TEST(channel_disallow_write_to_self)
+RUN_TEST(channel_inline_threshold)
 END_TEST_CASE(channel_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -0,0 +1,272 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests the kernel's handle table, which hands out slots through per-cpu
+// caches in front of a shared arena. Every zx_handle_duplicate() and
+// zx_handle_close() allocates or frees a slot, so these tests exercise the
+// refill and flush paths between the caches and the arena, the drain of other
+// cpus' caches when the arena runs dry, and the generation encoded in the
+// value of a reused slot. The performance test measures how handle creation
+// and destruction scale with the number of threads doing it at once.
+
+#include <inttypes.h>
+#include <threads.h>
+
+#include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/atomic.h>
+#include <fbl/unique_ptr.h>
+#include <unittest/unittest.h>
+#include <zircon/syscalls.h>
+#include <zircon/threads.h>
+
+namespace {
+
+constexpr uint32_t kIterationsPerThread = 20000u;
+constexpr uint32_t kMaxThreads = 8u;
+
+// The kernel's handle table holds 256K handles system wide.
+constexpr size_t kMaxHandles = 256u * 1024u;
+
+// How many handles each thread closes into its cpu's cache after the table
+// has been exhausted. Less than the size of a cache, so none are flushed.
+constexpr size_t kHandlesReleasedPerThread = 8u;
+
+struct Worker {
+    fbl::atomic<bool>* go;
+    zx_handle_t event;
+    zx_status_t status;
+};
+
+int DupCloseLoop(void* arg) {
+    auto worker = static_cast<Worker*>(arg);
+    while (!worker->go->load())
+        thrd_yield();
+
+    for (uint32_t i = 0; i < kIterationsPerThread; ++i) {
+        zx_handle_t dup;
+        zx_status_t status = zx_handle_duplicate(worker->event, ZX_RIGHT_SAME_RIGHTS, &dup);
+        if (status == ZX_OK)
+            status = zx_handle_close(dup);
+        if (status != ZX_OK) {
+            worker->status = status;
+            return 0;
+        }
+    }
+    worker->status = ZX_OK;
+    return 0;
+}
+
+// Runs |num_threads| threads that each duplicate and close a handle
+// kIterationsPerThread times, and returns the aggregate handles per second.
+bool RunDupClose(uint32_t num_threads, uint64_t* handles_per_sec) {
+    BEGIN_HELPER;
+
+    fbl::atomic<bool> go(false);
+    Worker workers[kMaxThreads];
+    thrd_t threads[kMaxThreads];
+
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        workers[i].go = &go;
+        workers[i].status = ZX_ERR_INTERNAL;
+        ASSERT_EQ(zx_event_create(0u, &workers[i].event), ZX_OK, "");
+        ASSERT_EQ(thrd_create_with_name(&threads[i], DupCloseLoop, &workers[i], "dup-close"),
+                  thrd_success, "");
+    }
+
+    zx_time_t start = zx_time_get(ZX_CLOCK_MONOTONIC);
+    go.store(true);
+    for (uint32_t i = 0; i < num_threads; ++i)
+        ASSERT_EQ(thrd_join(threads[i], nullptr), thrd_success, "");
+    zx_time_t elapsed = zx_time_get(ZX_CLOCK_MONOTONIC) - start;
+
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        EXPECT_EQ(workers[i].status, ZX_OK, "duplicate/close failed");
+        EXPECT_EQ(zx_handle_close(workers[i].event), ZX_OK, "");
+    }
+
+    uint64_t handles = static_cast<uint64_t>(num_threads) * kIterationsPerThread;
+    *handles_per_sec = elapsed > 0 ? handles * ZX_SEC(1) / elapsed : 0u;
+
+    END_HELPER;
+}
+
+bool IsHandleValid(zx_handle_t handle) {
+    return zx_object_get_info(handle, ZX_INFO_HANDLE_VALID, nullptr, 0u,
+                              nullptr, nullptr) == ZX_OK;
+}
+
+struct ExhaustWorker {
+    fbl::atomic<bool>* go;
+    fbl::atomic<bool>* exhausted;
+    zx_handle_t event;
+    zx_handle_t* handles;
+    size_t count;
+    size_t released;
+    zx_status_t status;
+};
+
+// Duplicates |event| until the handle table is exhausted, on whatever cpus
+// the thread is scheduled on, then closes a few handles so that their slots
+// sit in per-cpu caches rather than in the arena.
+int ExhaustLoop(void* arg) {
+    auto worker = static_cast<ExhaustWorker*>(arg);
+    while (!worker->go->load())
+        thrd_yield();
+
+    worker->status = ZX_OK;
+    while (worker->count < kMaxHandles && !worker->exhausted->load()) {
+        zx_status_t status = zx_handle_duplicate(worker->event, ZX_RIGHT_SAME_RIGHTS,
+                                                 &worker->handles[worker->count]);
+        if (status == ZX_ERR_NO_MEMORY) {
+            worker->exhausted->store(true);
+            break;
+        }
+        if (status != ZX_OK) {
+            worker->status = status;
+            return 0;
+        }
+        worker->count++;
+    }
+
+    while (worker->released < kHandlesReleasedPerThread && worker->count > 0u) {
+        zx_status_t status = zx_handle_close(worker->handles[--worker->count]);
+        if (status != ZX_OK) {
+            worker->status = status;
+            return 0;
+        }
+        worker->released++;
+    }
+    return 0;
+}
+
+// Exhausts the handle table from several threads at once, which leaves the
+// free slots scattered across the per-cpu caches when it runs out. The slots
+// the workers then release land in their own cpus' caches, and must all be
+// reachable from this thread through the drain of the other cpus' caches.
+bool handle_alloc_exhaust_test() {
+    BEGIN_TEST;
+
+    fbl::atomic<bool> go(false);
+    fbl::atomic<bool> exhausted(false);
+    ExhaustWorker workers[kMaxThreads];
+    thrd_t threads[kMaxThreads];
+    fbl::unique_ptr<zx_handle_t[]> handles[kMaxThreads];
+
+    for (uint32_t i = 0; i < kMaxThreads; ++i) {
+        fbl::AllocChecker ac;
+        handles[i].reset(new (&ac) zx_handle_t[kMaxHandles]);
+        ASSERT_TRUE(ac.check(), "");
+
+        workers[i].go = &go;
+        workers[i].exhausted = &exhausted;
+        workers[i].handles = handles[i].get();
+        workers[i].count = 0u;
+        workers[i].released = 0u;
+        workers[i].status = ZX_ERR_INTERNAL;
+        ASSERT_EQ(zx_event_create(0u, &workers[i].event), ZX_OK, "");
+        ASSERT_EQ(thrd_create_with_name(&threads[i], ExhaustLoop, &workers[i], "exhaust"),
+                  thrd_success, "");
+    }
+
+    go.store(true);
+    for (uint32_t i = 0; i < kMaxThreads; ++i)
+        ASSERT_EQ(thrd_join(threads[i], nullptr), thrd_success, "");
+
+    EXPECT_TRUE(exhausted.load(), "handle table was not exhausted");
+    for (uint32_t i = 0; i < kMaxThreads; ++i)
+        EXPECT_EQ(workers[i].status, ZX_OK, "duplicate/close failed");
+
+    // Every slot the workers released is sitting in some cpu's cache, and
+    // the arena is empty, so getting them back depends on the drain.
+    size_t released = 0u;
+    for (uint32_t i = 0; i < kMaxThreads; ++i)
+        released += workers[i].released;
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<zx_handle_t[]> reclaimed(new (&ac) zx_handle_t[released]);
+    ASSERT_TRUE(ac.check(), "");
+    size_t reclaimed_count = 0u;
+    while (reclaimed_count < released) {
+        if (zx_handle_duplicate(workers[0].event, ZX_RIGHT_SAME_RIGHTS,
+                                &reclaimed[reclaimed_count]) != ZX_OK)
+            break;
+        reclaimed_count++;
+    }
+    EXPECT_EQ(reclaimed_count, released, "slots cached by other cpus were not reclaimed");
+
+    // Closing everything flushes full caches back to the arena.
+    for (size_t i = 0u; i < reclaimed_count; ++i)
+        EXPECT_EQ(zx_handle_close(reclaimed[i]), ZX_OK, "");
+    for (uint32_t i = 0; i < kMaxThreads; ++i) {
+        for (size_t j = 0u; j < workers[i].count; ++j)
+            EXPECT_EQ(zx_handle_close(workers[i].handles[j]), ZX_OK, "");
+        EXPECT_EQ(zx_handle_close(workers[i].event), ZX_OK, "");
+    }
+
+    // And the table is usable again.
+    zx_handle_t event;
+    ASSERT_EQ(zx_event_create(0u, &event), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(event), ZX_OK, "");
+
+    END_TEST;
+}
+
+// A closed handle's slot goes back on top of the cpu's cache and is usually
+// the next one handed out. The generation in the new handle's value must keep
+// the old value from naming it.
+bool handle_alloc_reuse_test() {
+    BEGIN_TEST;
+
+    zx_handle_t event;
+    ASSERT_EQ(zx_event_create(0u, &event), ZX_OK, "");
+
+    for (int i = 0; i < 100; ++i) {
+        zx_handle_t old_handle;
+        ASSERT_EQ(zx_handle_duplicate(event, ZX_RIGHT_SAME_RIGHTS, &old_handle), ZX_OK, "");
+        ASSERT_EQ(zx_handle_close(old_handle), ZX_OK, "");
+        EXPECT_FALSE(IsHandleValid(old_handle), "closed handle is still valid");
+
+        zx_handle_t new_handle;
+        ASSERT_EQ(zx_handle_duplicate(event, ZX_RIGHT_SAME_RIGHTS, &new_handle), ZX_OK, "");
+        EXPECT_NE(old_handle, new_handle, "reused slot got the same handle value");
+        EXPECT_TRUE(IsHandleValid(new_handle), "");
+        EXPECT_FALSE(IsHandleValid(old_handle), "closed handle validates after reuse");
+        EXPECT_EQ(zx_handle_close(old_handle), ZX_ERR_BAD_HANDLE, "");
+        EXPECT_EQ(zx_handle_close(new_handle), ZX_OK, "");
+    }
+
+    EXPECT_EQ(zx_handle_close(event), ZX_OK, "");
+    END_TEST;
+}
+
+bool handle_alloc_scaling_test() {
+    BEGIN_TEST;
+
+    uint64_t base = 0u;
+    for (uint32_t num_threads = 1u; num_threads <= kMaxThreads; num_threads *= 2) {
+        uint64_t rate;
+        ASSERT_TRUE(RunDupClose(num_threads, &rate), "");
+        if (num_threads == 1u)
+            base = rate;
+        unittest_printf("%u thread(s): %" PRIu64 " handles/sec (%" PRIu64 "%% of 1 thread)\n",
+                        num_threads, rate, base ? rate * 100 / base : 0u);
+    }
+
+    END_TEST;
+}
+
+} // namespace
+
+BEGIN_TEST_CASE(handle_alloc_tests)
+RUN_TEST(handle_alloc_reuse_test)
+RUN_TEST(handle_alloc_exhaust_test)
+RUN_TEST_PERFORMANCE(handle_alloc_scaling_test)
+END_TEST_CASE(handle_alloc_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
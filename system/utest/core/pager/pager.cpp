@@ -0,0 +1,233 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <threads.h>
+
+#include <zircon/process.h>
+#include <zircon/syscalls.h>
+#include <zircon/syscalls/port.h>
+
+#include <unittest/unittest.h>
+
+namespace {
+
+constexpr uint64_t kKey = 0x1234;
+constexpr size_t kPageCount = 4;
+constexpr size_t kVmoSize = kPageCount * PAGE_SIZE;
+
+struct Reader {
+    zx_handle_t vmo;
+    const volatile uint8_t* addr;
+    uint64_t offset;
+    uint8_t value;
+    zx_status_t status;
+};
+
+// Reads one byte through the mapping, blocking until the page is supplied.
+int mapped_reader(void* arg) {
+    auto reader = static_cast<Reader*>(arg);
+    reader->value = reader->addr[reader->offset];
+    reader->status = ZX_OK;
+    return 0;
+}
+
+// Reads one byte with zx_vmo_read(), blocking until the page is supplied.
+int vmo_reader(void* arg) {
+    auto reader = static_cast<Reader*>(arg);
+    size_t actual;
+    reader->status = zx_vmo_read(reader->vmo, &reader->value, reader->offset, 1, &actual);
+    return 0;
+}
+
+// Waits for a page request and checks that it is for the page at |offset|.
+bool expect_request(zx_handle_t port, uint64_t offset) {
+    BEGIN_HELPER;
+
+    zx_port_packet_t packet;
+    ASSERT_EQ(zx_port_wait(port, ZX_TIME_INFINITE, &packet, 1), ZX_OK, "");
+    EXPECT_EQ(packet.key, kKey, "");
+    EXPECT_EQ(packet.type, ZX_PKT_TYPE_PAGE_REQUEST, "");
+    EXPECT_EQ(packet.page_request.command, ZX_PAGER_VMO_READ, "");
+    EXPECT_EQ(packet.page_request.offset, offset, "");
+    EXPECT_EQ(packet.page_request.length, PAGE_SIZE, "");
+
+    END_HELPER;
+}
+
+// Supplies [offset, offset + length) with every byte set to |value|.
+bool supply(zx_handle_t pager, zx_handle_t vmo, uint64_t offset, uint64_t length,
+            uint8_t value) {
+    BEGIN_HELPER;
+
+    zx_handle_t aux;
+    ASSERT_EQ(zx_vmo_create(length, 0, &aux), ZX_OK, "");
+    uint8_t data[PAGE_SIZE];
+    memset(data, value, sizeof(data));
+    for (uint64_t off = 0; off < length; off += PAGE_SIZE) {
+        size_t actual;
+        ASSERT_EQ(zx_vmo_write(aux, data, off, sizeof(data), &actual), ZX_OK, "");
+    }
+    EXPECT_EQ(zx_pager_supply_pages(pager, vmo, offset, length, aux, 0), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(aux), ZX_OK, "");
+
+    END_HELPER;
+}
+
+bool create_pager_vmo(zx_handle_t* pager, zx_handle_t* port, zx_handle_t* vmo) {
+    BEGIN_HELPER;
+
+    ASSERT_EQ(zx_pager_create(0, pager), ZX_OK, "");
+    ASSERT_EQ(zx_port_create(0, port), ZX_OK, "");
+    ASSERT_EQ(zx_pager_create_vmo(*pager, *port, kKey, kVmoSize, 0, vmo), ZX_OK, "");
+
+    END_HELPER;
+}
+
+bool mapped_fault_test() {
+    BEGIN_TEST;
+
+    zx_handle_t pager, port, vmo;
+    ASSERT_TRUE(create_pager_vmo(&pager, &port, &vmo), "");
+
+    uintptr_t addr;
+    ASSERT_EQ(zx_vmar_map(zx_vmar_root_self(), 0, vmo, 0, kVmoSize,
+                          ZX_VM_FLAG_PERM_READ, &addr), ZX_OK, "");
+
+    Reader reader = {vmo, reinterpret_cast<const volatile uint8_t*>(addr), PAGE_SIZE + 7, 0,
+                     ZX_ERR_INTERNAL};
+    thrd_t thread;
+    ASSERT_EQ(thrd_create(&thread, mapped_reader, &reader), thrd_success, "");
+
+    ASSERT_TRUE(expect_request(port, PAGE_SIZE), "");
+    ASSERT_TRUE(supply(pager, vmo, PAGE_SIZE, PAGE_SIZE, 0xab), "");
+
+    EXPECT_EQ(thrd_join(thread, nullptr), thrd_success, "");
+    EXPECT_EQ(reader.status, ZX_OK, "");
+    EXPECT_EQ(reader.value, 0xab, "");
+
+    // The page stays resident, so touching it again doesn't ask the pager.
+    EXPECT_EQ(reinterpret_cast<const volatile uint8_t*>(addr)[PAGE_SIZE], 0xab, "");
+    zx_port_packet_t packet;
+    EXPECT_EQ(zx_port_wait(port, 0, &packet, 1), ZX_ERR_TIMED_OUT, "");
+
+    EXPECT_EQ(zx_vmar_unmap(zx_vmar_root_self(), addr, kVmoSize), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(vmo), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(port), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(pager), ZX_OK, "");
+
+    END_TEST;
+}
+
+bool vmo_read_test() {
+    BEGIN_TEST;
+
+    zx_handle_t pager, port, vmo;
+    ASSERT_TRUE(create_pager_vmo(&pager, &port, &vmo), "");
+
+    // Supplying ahead of any request is fine, and satisfies later reads.
+    ASSERT_TRUE(supply(pager, vmo, 0, PAGE_SIZE, 0x11), "");
+    uint8_t value;
+    size_t actual;
+    EXPECT_EQ(zx_vmo_read(vmo, &value, 10, 1, &actual), ZX_OK, "");
+    EXPECT_EQ(value, 0x11, "");
+
+    Reader reader = {vmo, nullptr, 3 * PAGE_SIZE, 0, ZX_ERR_INTERNAL};
+    thrd_t thread;
+    ASSERT_EQ(thrd_create(&thread, vmo_reader, &reader), thrd_success, "");
+
+    ASSERT_TRUE(expect_request(port, 3 * PAGE_SIZE), "");
+    // Supplying a page that is already there leaves it alone.
+    ASSERT_TRUE(supply(pager, vmo, 0, kVmoSize, 0x22), "");
+
+    EXPECT_EQ(thrd_join(thread, nullptr), thrd_success, "");
+    EXPECT_EQ(reader.status, ZX_OK, "");
+    EXPECT_EQ(reader.value, 0x22, "");
+    EXPECT_EQ(zx_vmo_read(vmo, &value, 10, 1, &actual), ZX_OK, "");
+    EXPECT_EQ(value, 0x11, "");
+
+    EXPECT_EQ(zx_handle_close(vmo), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(port), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(pager), ZX_OK, "");
+
+    END_TEST;
+}
+
+bool close_pager_test() {
+    BEGIN_TEST;
+
+    zx_handle_t pager, port, vmo;
+    ASSERT_TRUE(create_pager_vmo(&pager, &port, &vmo), "");
+
+    Reader reader = {vmo, nullptr, 0, 0, ZX_ERR_INTERNAL};
+    thrd_t thread;
+    ASSERT_EQ(thrd_create(&thread, vmo_reader, &reader), thrd_success, "");
+
+    // Once the pager is gone, waiters are woken with an error.
+    ASSERT_TRUE(expect_request(port, 0), "");
+    EXPECT_EQ(zx_handle_close(pager), ZX_OK, "");
+
+    EXPECT_EQ(thrd_join(thread, nullptr), thrd_success, "");
+    EXPECT_EQ(reader.status, ZX_ERR_BAD_STATE, "");
+
+    uint8_t value;
+    size_t actual;
+    EXPECT_EQ(zx_vmo_read(vmo, &value, 0, 1, &actual), ZX_ERR_BAD_STATE, "");
+
+    EXPECT_EQ(zx_handle_close(vmo), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(port), ZX_OK, "");
+
+    END_TEST;
+}
+
+bool supply_errors_test() {
+    BEGIN_TEST;
+
+    zx_handle_t pager, port, vmo;
+    ASSERT_TRUE(create_pager_vmo(&pager, &port, &vmo), "");
+
+    zx_handle_t other_vmo, aux;
+    ASSERT_EQ(zx_vmo_create(kVmoSize, 0, &other_vmo), ZX_OK, "");
+    ASSERT_EQ(zx_vmo_create(kVmoSize, 0, &aux), ZX_OK, "");
+
+    // Only VMOs created by the pager can be supplied.
+    EXPECT_EQ(zx_pager_supply_pages(pager, other_vmo, 0, PAGE_SIZE, aux, 0),
+              ZX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(zx_pager_supply_pages(pager, vmo, 1, PAGE_SIZE, aux, 0),
+              ZX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(zx_pager_supply_pages(pager, vmo, 0, 2 * kVmoSize, aux, 0),
+              ZX_ERR_OUT_OF_RANGE, "");
+    // The pages to supply must all be committed.
+    EXPECT_EQ(zx_pager_supply_pages(pager, vmo, 0, PAGE_SIZE, aux, 0),
+              ZX_ERR_BAD_STATE, "");
+
+    // Committing a pager-backed VMO would need the pager.
+    EXPECT_EQ(zx_vmo_op_range(vmo, ZX_VMO_OP_COMMIT, 0, PAGE_SIZE, nullptr, 0),
+              ZX_ERR_NOT_SUPPORTED, "");
+
+    EXPECT_EQ(zx_handle_close(aux), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(other_vmo), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(vmo), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(port), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(pager), ZX_OK, "");
+
+    END_TEST;
+}
+
+} // namespace
+
+BEGIN_TEST_CASE(pager_tests)
+RUN_TEST(mapped_fault_test)
+RUN_TEST(vmo_read_test)
+RUN_TEST(close_pager_test)
+RUN_TEST(supply_errors_test)
+END_TEST_CASE(pager_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
@@ -139,6 +139,47 @@ static bool wait_count_invalid_test() {
     END_TEST;
 }
 
+static bool wait_many_test() {
+    BEGIN_TEST;
+
+    zx_handle_t port;
+    zx_status_t status = zx_port_create(0u, &port);
+    EXPECT_EQ(status, ZX_OK);
+
+    for (uint64_t key = 1u; key <= 5u; ++key) {
+        const zx_port_packet_t in = {key, ZX_PKT_TYPE_USER, 0, { {} }};
+        status = zx_port_queue(port, &in, 1u);
+        EXPECT_EQ(status, ZX_OK);
+    }
+
+    zx_port_packet_t out[8] = {};
+    size_t actual = 0u;
+
+    status = zx_port_wait_many(port, ZX_TIME_INFINITE, out, 0u, &actual);
+    EXPECT_EQ(status, ZX_ERR_INVALID_ARGS);
+
+    // Packets come back in FIFO order, no more than asked for.
+    status = zx_port_wait_many(port, ZX_TIME_INFINITE, out, 3u, &actual);
+    EXPECT_EQ(status, ZX_OK);
+    EXPECT_EQ(actual, 3u);
+    for (size_t i = 0u; i < actual; ++i)
+        EXPECT_EQ(out[i].key, i + 1u);
+
+    // Fewer than asked for when that is all there is.
+    status = zx_port_wait_many(port, ZX_TIME_INFINITE, out, fbl::count_of(out), &actual);
+    EXPECT_EQ(status, ZX_OK);
+    EXPECT_EQ(actual, 2u);
+    EXPECT_EQ(out[0].key, 4u);
+    EXPECT_EQ(out[1].key, 5u);
+
+    status = zx_port_wait_many(port, 0u, out, fbl::count_of(out), &actual);
+    EXPECT_EQ(status, ZX_ERR_TIMED_OUT);
+
+    EXPECT_EQ(zx_handle_close(port), ZX_OK);
+
+    END_TEST;
+}
+
 static bool queue_and_close_test(void) {
     BEGIN_TEST;
     zx_status_t status;
@@ -746,6 +787,7 @@ RUN_TEST(wait_count_valid_test<0u>)
 RUN_TEST(wait_count_valid_test<1u>)
 RUN_TEST(wait_count_invalid_test<2u>)
 RUN_TEST(wait_count_invalid_test<23u>)
+RUN_TEST(wait_many_test)
 RUN_TEST(queue_and_close_test)
 RUN_TEST(async_wait_channel_test)
 RUN_TEST(async_wait_event_test_single)
@@ -3,6 +3,8 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <limits.h>
+#include <zircon/process.h>
 #include <zircon/syscalls.h>
 #include <unittest/unittest.h>
 #include <stdbool.h>
@@ -460,8 +462,10 @@ static bool socket_short_write(void) {
     status = zx_socket_create(0, &h0, &h1);
     ASSERT_EQ(status, ZX_OK, "");
 
-    // TODO(qsr): Request socket buffer and use (socket_buffer + 1).
-    const size_t buffer_size = 256 * 1024 + 1;
+    size_t capacity = 0;
+    status = zx_object_get_property(h1, ZX_PROP_SOCKET_CAPACITY, &capacity, sizeof(capacity));
+    ASSERT_EQ(status, ZX_OK, "");
+    const size_t buffer_size = capacity + 1;
     char* buffer = malloc(buffer_size);
     size_t written = ~(size_t)0; // This should get overwritten by the syscall.
     status = zx_socket_write(h0, 0u, buffer, buffer_size, &written);
@@ -552,8 +556,10 @@ static bool socket_datagram_no_short_write(void) {
     status = zx_socket_create(ZX_SOCKET_DATAGRAM, &h0, &h1);
     ASSERT_EQ(status, ZX_OK, "");
 
-    // TODO(qsr): Request socket buffer and use (socket_buffer + 1).
-    const size_t buffer_size = 256 * 1024 + 1;
+    size_t capacity = 0;
+    status = zx_object_get_property(h1, ZX_PROP_SOCKET_CAPACITY, &capacity, sizeof(capacity));
+    ASSERT_EQ(status, ZX_OK, "");
+    const size_t buffer_size = capacity + 1;
     char* buffer = malloc(buffer_size);
     size_t written = 999;
     status = zx_socket_write(h0, 0u, buffer, buffer_size, &written);
@@ -799,6 +805,157 @@ static bool socket_accept(void) {
     END_TEST;
 }
 
+static bool socket_capacity(void) {
+    BEGIN_TEST;
+
+    zx_status_t status;
+    size_t count;
+
+    zx_handle_t h0, h1;
+    status = zx_socket_create(0, &h0, &h1);
+    ASSERT_EQ(status, ZX_OK, "");
+
+    size_t capacity = 0;
+    status = zx_object_get_property(h1, ZX_PROP_SOCKET_CAPACITY, &capacity, sizeof(capacity));
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_GT(capacity, 0u, "");
+
+    capacity = 0;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_CAPACITY, &capacity, sizeof(capacity));
+    EXPECT_EQ(status, ZX_ERR_OUT_OF_RANGE, "");
+    capacity = SIZE_MAX;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_CAPACITY, &capacity, sizeof(capacity));
+    EXPECT_EQ(status, ZX_ERR_OUT_OF_RANGE, "");
+
+    // Grow the reading end well past the default and fill it in one write.
+    const size_t kBigCapacity = 4 * 1024 * 1024;
+    capacity = kBigCapacity;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_CAPACITY, &capacity, sizeof(capacity));
+    ASSERT_EQ(status, ZX_OK, "");
+    capacity = 0;
+    status = zx_object_get_property(h1, ZX_PROP_SOCKET_CAPACITY, &capacity, sizeof(capacity));
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(capacity, kBigCapacity, "");
+
+    char* buf = malloc(kBigCapacity + 1);
+    ASSERT_NONNULL(buf, "");
+    status = zx_socket_write(h0, 0u, buf, kBigCapacity + 1, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, kBigCapacity, "");
+    EXPECT_EQ(get_satisfied_signals(h0), 0u, "");
+
+    // Capacity only limits writes, so shrinking keeps what is buffered; the
+    // writer stays blocked until the reader drains below the new limit.
+    const size_t kSmallCapacity = 64 * 1024;
+    capacity = kSmallCapacity;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_CAPACITY, &capacity, sizeof(capacity));
+    ASSERT_EQ(status, ZX_OK, "");
+    status = zx_socket_read(h1, 0u, buf, kBigCapacity - kSmallCapacity, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, kBigCapacity - kSmallCapacity, "");
+    EXPECT_EQ(get_satisfied_signals(h0), 0u, "");
+    status = zx_socket_read(h1, 0u, buf, 1, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(get_satisfied_signals(h0), ZX_SOCKET_WRITABLE, "");
+
+    // Growing a full endpoint makes its peer writable again.
+    status = zx_socket_write(h0, 0u, buf, 1, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(get_satisfied_signals(h0), 0u, "");
+    capacity = kSmallCapacity + 1;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_CAPACITY, &capacity, sizeof(capacity));
+    ASSERT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(get_satisfied_signals(h0), ZX_SOCKET_WRITABLE, "");
+
+    free(buf);
+    zx_handle_close(h0);
+    zx_handle_close(h1);
+
+    END_TEST;
+}
+
+static bool socket_move_pages(void) {
+    BEGIN_TEST;
+
+    zx_status_t status;
+    size_t count;
+
+    zx_handle_t h0, h1;
+    status = zx_socket_create(0, &h0, &h1);
+    ASSERT_EQ(status, ZX_OK, "");
+
+    const size_t kPages = 8;
+    const size_t kSize = kPages * PAGE_SIZE;
+    zx_handle_t vmo;
+    ASSERT_EQ(zx_vmo_create(kSize * 2, 0, &vmo), ZX_OK, "");
+    uintptr_t addr;
+    ASSERT_EQ(zx_vmar_map(zx_vmar_root_self(), 0, vmo, 0, kSize * 2,
+                          ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE, &addr),
+              ZX_OK, "");
+    unsigned char* src = (unsigned char*)addr;
+    unsigned char* dst = src + kSize;
+    for (size_t i = 0; i < kSize; i++)
+        src[i] = (unsigned char)(i * 7 + 1);
+
+    // A whole-page write is moved, leaving the writer's pages decommitted.
+    status = zx_socket_write(h0, ZX_SOCKET_MOVE_PAGES, src, kSize, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, kSize, "");
+    EXPECT_EQ(src[0], 0u, "");
+    EXPECT_EQ(src[kSize - 1], 0u, "");
+
+    // Partial pages are copied out. A reader that doesn't ask for moved
+    // pages gets a copy even on a page boundary; once it does ask, an
+    // aligned read takes the remaining pages whole.
+    const size_t kHalf = PAGE_SIZE / 2;
+    status = zx_socket_read(h1, 0u, dst, kHalf, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, kHalf, "");
+    status = zx_socket_read(h1, 0u, dst + kHalf, kHalf, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, kHalf, "");
+    status = zx_socket_read(h1, 0u, dst + PAGE_SIZE, PAGE_SIZE, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, PAGE_SIZE, "");
+    status = zx_socket_read(h1, ZX_SOCKET_MOVE_PAGES | ZX_SOCKET_CONTROL,
+                            dst + PAGE_SIZE * 2, kSize - PAGE_SIZE * 2, &count);
+    EXPECT_EQ(status, ZX_ERR_INVALID_ARGS, "");
+    status = zx_socket_read(h1, ZX_SOCKET_MOVE_PAGES, dst + PAGE_SIZE * 2,
+                            kSize - PAGE_SIZE * 2, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, kSize - PAGE_SIZE * 2, "");
+    for (size_t i = 0; i < kSize; i++)
+        ASSERT_EQ(dst[i], (unsigned char)(i * 7 + 1), "");
+
+    // Unaligned and uncommitted sources fall back to copying.
+    memset(src, 0x5a, PAGE_SIZE + 1);
+    status = zx_socket_write(h0, ZX_SOCKET_MOVE_PAGES, src + 1, PAGE_SIZE, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, PAGE_SIZE, "");
+    EXPECT_EQ(src[1], 0x5a, "");
+    status = zx_socket_write(h0, ZX_SOCKET_MOVE_PAGES, src + PAGE_SIZE * 2, PAGE_SIZE, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, PAGE_SIZE, "");
+    status = zx_socket_read(h1, 0u, NULL, 0, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, PAGE_SIZE * 2, "");
+
+    // Asking for moved pages when none were queued just copies.
+    status = zx_socket_read(h1, ZX_SOCKET_MOVE_PAGES, dst, PAGE_SIZE * 2, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, PAGE_SIZE * 2, "");
+    EXPECT_EQ(dst[0], 0x5a, "");
+    EXPECT_EQ(dst[PAGE_SIZE - 1], 0x5a, "");
+    EXPECT_EQ(dst[PAGE_SIZE], 0u, "");
+
+    EXPECT_EQ(zx_vmar_unmap(zx_vmar_root_self(), addr, kSize * 2), ZX_OK, "");
+    zx_handle_close(vmo);
+    zx_handle_close(h0);
+    zx_handle_close(h1);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(socket_tests)
 RUN_TEST(socket_basic)
 RUN_TEST(socket_signals)
@@ -814,6 +971,8 @@ RUN_TEST(socket_control_plane_absent)
 RUN_TEST(socket_control_plane)
 RUN_TEST(socket_control_plane_shutdown)
 RUN_TEST(socket_accept)
+RUN_TEST(socket_capacity)
+RUN_TEST(socket_move_pages)
 END_TEST_CASE(socket_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -603,6 +603,20 @@ bool VerifyBadTree(void) {
     END_TEST;
 }
 
+bool VerifyShortRangeOfBadTree(void) {
+    BEGIN_TEST_WITH_RC;
+    size_t tree_len = MerkleTree::GetTreeLength(kLarge);
+    Digest digest;
+    ASSERT_OK(MerkleTree::Create(gData, kLarge, gTree, tree_len, &digest));
+    // Corrupt the digest of the second node; the first node is still good, but
+    // the tree node holding both digests is not.
+    gTree[Digest::kLength] ^= 1;
+    ASSERT_ERR(
+        ZX_ERR_IO_DATA_INTEGRITY,
+        MerkleTree::Verify(gData, kLarge, gTree, tree_len, 0, 1, digest));
+    END_TEST;
+}
+
 bool VerifyGoodPartOfBadLeaves(void) {
     BEGIN_TEST_WITH_RC;
     size_t tree_len = MerkleTree::GetTreeLength(kSmall);
@@ -737,6 +751,7 @@ RUN_TEST(VerifyZeroLength)
 RUN_TEST(VerifyBadRoot)
 RUN_TEST(VerifyGoodPartOfBadTree)
 RUN_TEST(VerifyBadTree)
+RUN_TEST(VerifyShortRangeOfBadTree)
 RUN_TEST(VerifyGoodPartOfBadLeaves)
 RUN_TEST(VerifyBadLeaves)
 RUN_TEST(CreateAndVerifyHugePRNGData)
@@ -33,6 +33,7 @@ MODULE_COMPILEFLAGS := \
     -Isystem/ulib/fbl/include \
     -Isystem/ulib/fdio/include \
     -Isystem/ulib/zircon/include \
+    -Isystem/utest/fs \
 
 MODULE_HOST_LIBS := \
     system/ulib/unittest.hostlib \
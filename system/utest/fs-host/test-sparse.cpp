@@ -6,7 +6,9 @@
 
 #include <fbl/alloc_checker.h>
 #include <fbl/unique_ptr.h>
+#include <minfs/format.h>
 
+#include "minfs-pattern.h"
 #include "util.h"
 
 static unsigned count = 0;
@@ -72,6 +74,58 @@ bool test_sparse(void) {
 constexpr size_t kBlockSize = 8192;
 constexpr size_t kDirectBlocks = 16;
 
+// Writes every other block of a file, so each block becomes its own extent,
+// until the file needs a two level extent tree.
+bool test_sparse_fragmented(void) {
+    BEGIN_TEST;
+
+    constexpr size_t kExtents = minfs::kMinfsInlineExtents * minfs::kMinfsExtentsPerBlock + 64;
+    constexpr size_t kBlocks = kExtents * 2;
+    uint8_t buf[kBlockSize];
+
+    int fd = emu_open("::fragmented", O_RDWR | O_CREAT, 0644);
+    ASSERT_GT(fd, 0);
+    for (size_t n = 0; n < kBlocks; n += 2) {
+        fill_block(buf, n);
+        ASSERT_EQ(emu_pwrite(fd, buf, kBlockSize, n * kBlockSize), kBlockSize);
+    }
+    ASSERT_TRUE(check_blocks(emu_pread, fd, kBlocks - 1, 2));
+    ASSERT_EQ(emu_close(fd), 0);
+
+    // Reading the file back after reopening it loads the tree from disk.
+    fd = emu_open("::fragmented", O_RDWR, 0644);
+    ASSERT_GT(fd, 0);
+    ASSERT_TRUE(check_blocks(emu_pread, fd, kBlocks - 1, 2));
+
+    // Shrink the file back to a single level tree, then to inline extents.
+    constexpr size_t kSmallBlocks[] = {
+        minfs::kMinfsExtentsPerBlock * 4,
+        minfs::kMinfsInlineExtents * 2,
+    };
+    for (size_t blocks : kSmallBlocks) {
+        ASSERT_EQ(emu_ftruncate(fd, blocks * kBlockSize), 0);
+        ASSERT_EQ(emu_close(fd), 0);
+        fd = emu_open("::fragmented", O_RDWR, 0644);
+        ASSERT_GT(fd, 0);
+        ASSERT_TRUE(check_blocks(emu_pread, fd, blocks - 1, 2));
+        ASSERT_EQ(emu_pread(fd, buf, kBlockSize, blocks * kBlockSize), 0);
+    }
+
+    // Fill the holes between the remaining extents.
+    for (size_t n = 1; n < kSmallBlocks[1]; n += 2) {
+        fill_block(buf, n);
+        ASSERT_EQ(emu_pwrite(fd, buf, kBlockSize, n * kBlockSize), kBlockSize);
+    }
+    ASSERT_EQ(emu_close(fd), 0);
+    fd = emu_open("::fragmented", O_RDWR, 0644);
+    ASSERT_GT(fd, 0);
+    ASSERT_TRUE(check_blocks(emu_pread, fd, kSmallBlocks[1], 1));
+
+    ASSERT_EQ(emu_ftruncate(fd, 0), 0);
+    ASSERT_EQ(emu_close(fd), 0);
+    END_TEST;
+}
+
 RUN_MINFS_TESTS(sparse_tests,
     RUN_TEST_MEDIUM((test_sparse<0, 0, kBlockSize>))
     RUN_TEST_MEDIUM((test_sparse<kBlockSize / 2, 0, kBlockSize>))
@@ -91,4 +145,5 @@ RUN_MINFS_TESTS(sparse_tests,
     RUN_TEST_MEDIUM((test_sparse<kBlockSize * kDirectBlocks + kBlockSize,
                                  kBlockSize * kDirectBlocks + 2 * kBlockSize,
                                  kBlockSize * 32>))
+    RUN_TEST_LARGE(test_sparse_fragmented)
 )
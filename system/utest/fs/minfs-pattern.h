@@ -0,0 +1,44 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <minfs/format.h>
+#include <unittest/unittest.h>
+
+// Helpers shared by the minfs tests on the device and on the host, which
+// write files block by block with a pattern unique to each block.
+
+// Fills |buf| with a pattern unique to block |n| of a file.
+inline void fill_block(uint8_t* buf, size_t n) {
+    for (size_t i = 0; i < minfs::kMinfsBlockSize; i++) {
+        buf[i] = static_cast<uint8_t>(n * 7 + i / 256);
+    }
+    memcpy(buf, &n, sizeof(n));
+}
+
+// Checks that every |stride|th block of the first |blocks| blocks of |fd|
+// holds its pattern, and that the remaining blocks are sparse. |read_at| is
+// pread on the device, and emu_pread on the host.
+inline bool check_blocks(ssize_t (*read_at)(int, void*, size_t, off_t), int fd,
+                         size_t blocks, size_t stride) {
+    BEGIN_HELPER;
+    uint8_t expected[minfs::kMinfsBlockSize];
+    uint8_t buf[minfs::kMinfsBlockSize];
+    for (size_t n = 0; n < blocks; n++) {
+        ASSERT_EQ(read_at(fd, buf, sizeof(buf), n * sizeof(buf)), sizeof(buf));
+        if (n % stride == 0) {
+            fill_block(expected, n);
+        } else {
+            memset(expected, 0, sizeof(expected));
+        }
+        ASSERT_EQ(memcmp(buf, expected, sizeof(buf)), 0, "Unexpected block contents");
+    }
+    END_HELPER;
+}
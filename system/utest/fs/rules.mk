@@ -23,6 +23,7 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test-basic.c \
     $(LOCAL_DIR)/test-directory.cpp \
     $(LOCAL_DIR)/test-dot-dot.c \
+    $(LOCAL_DIR)/test-io-fifo.cpp \
     $(LOCAL_DIR)/test-link.c \
     $(LOCAL_DIR)/test-fcntl.cpp \
     $(LOCAL_DIR)/test-maxfile.cpp \
@@ -44,6 +45,13 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test-vmo.cpp \
     $(LOCAL_DIR)/test-watcher.cpp \
 
+# minfs-pattern.h uses the minfs on-disk format.
+MODULE_COMPILEFLAGS := \
+    -Isystem/ulib/bitmap/include \
+    -Isystem/ulib/block-client/include \
+    -Isystem/ulib/minfs/include \
+    -Isystem/ulib/zx/include \
+
 MODULE_LDFLAGS := --wrap open --wrap unlink --wrap stat --wrap mkdir
 MODULE_LDFLAGS += --wrap rename --wrap truncate --wrap opendir
 MODULE_LDFLAGS += --wrap utimes --wrap link --wrap symlink --wrap rmdir
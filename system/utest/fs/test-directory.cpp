@@ -14,6 +14,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <fbl/alloc_checker.h>
+#include <fbl/unique_ptr.h>
 #include <zircon/compiler.h>
 
 #include "filesystems.h"
@@ -62,6 +64,14 @@ bool test_directory_large(void) {
         ASSERT_EQ(close(fd), 0, "");
     }
 
+    // Every file should still be found once the directory has grown
+    for (int i = 0; i < num_files; i++) {
+        char path[LARGE_PATH_LENGTH + 1];
+        snprintf(path, sizeof(path), "::%0*d", LARGE_PATH_LENGTH - 2, i);
+        struct stat s;
+        ASSERT_EQ(stat(path, &s), 0, "");
+    }
+
     // Unlink all those files
     for (int i = 0; i < num_files; i++) {
         char path[LARGE_PATH_LENGTH + 1];
@@ -302,6 +312,19 @@ bool test_directory_readdir(void) {
     END_TEST;
 }
 
+// Marks the entry "name" of a directory created by large_dir_setup as seen.
+// Directories may return their entries in any order, but only once each.
+bool large_dir_mark_seen(const char* name, size_t num_entries, bool* seen) {
+    BEGIN_HELPER;
+    char* end;
+    size_t index = strtoul(name, &end, 10);
+    ASSERT_EQ(*end, '\0', "Unexpected dirent");
+    ASSERT_LT(index, num_entries, "Unexpected dirent");
+    ASSERT_FALSE(seen[index], "Duplicate dirent");
+    seen[index] = true;
+    END_HELPER;
+}
+
 // Create a directory named "::dir" with entries "00000", "00001" ... up to
 // num_entries.
 bool large_dir_setup(size_t num_entries) {
@@ -319,20 +342,22 @@ bool large_dir_setup(size_t num_entries) {
     DIR* dir = opendir("::dir");
     ASSERT_NONNULL(dir, "");
 
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<bool[]> seen(new (&ac) bool[num_entries]());
+    ASSERT_TRUE(ac.check(), "");
+
     // As a sanity check, it should contain all then entries we made
     struct dirent* de;
     size_t num_seen = 0;
-    size_t i = 0;
     while ((de = readdir(dir)) != NULL) {
         if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
             // Ignore these entries
             continue;
         }
-        char dirname[100];
-        snprintf(dirname, 100, "%05lu", i++);
-        ASSERT_EQ(strcmp(de->d_name, dirname), 0, "Unexpected dirent");
+        ASSERT_TRUE(large_dir_mark_seen(de->d_name, num_entries, seen.get()), "");
         num_seen++;
     }
+    ASSERT_EQ(num_seen, num_entries, "Did not see all expected entries");
     ASSERT_EQ(closedir(dir), 0, "");
 
     return true;
@@ -347,19 +372,20 @@ bool test_directory_readdir_rm_all(void) {
     DIR* dir = opendir("::dir");
     ASSERT_NONNULL(dir, "");
 
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<bool[]> seen(new (&ac) bool[num_entries]());
+    ASSERT_TRUE(ac.check(), "");
+
     // Unlink all the entries as we read them.
     struct dirent* de;
     size_t num_seen = 0;
-    size_t i = 0;
     while ((de = readdir(dir)) != NULL) {
         if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
             // Ignore these entries
             continue;
         }
-        char dirname[100];
-        snprintf(dirname, 100, "%05lu", i++);
-        ASSERT_EQ(strcmp(de->d_name, dirname), 0, "Unexpected dirent");
-        ASSERT_EQ(unlinkat(dirfd(dir), dirname, AT_REMOVEDIR), 0, "");
+        ASSERT_TRUE(large_dir_mark_seen(de->d_name, num_entries, seen.get()), "");
+        ASSERT_EQ(unlinkat(dirfd(dir), de->d_name, AT_REMOVEDIR), 0, "");
         num_seen++;
     }
 
@@ -369,6 +395,55 @@ bool test_directory_readdir_rm_all(void) {
     END_TEST;
 }
 
+bool test_directory_readdir_create_all(void) {
+    BEGIN_TEST;
+
+    size_t num_entries = 100;
+    ASSERT_TRUE(large_dir_setup(num_entries), "");
+
+    DIR* dir = opendir("::dir");
+    ASSERT_NONNULL(dir, "");
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<bool[]> seen(new (&ac) bool[num_entries]());
+    ASSERT_TRUE(ac.check(), "");
+
+    // Grow the directory as it is read, well past the point where filesystems
+    // which index their directories reorganize them. Every entry which was
+    // there from the start should still be seen exactly once.
+    const size_t num_created_per_entry = 20;
+    size_t num_created = 0;
+    struct dirent* de;
+    size_t num_seen = 0;
+    while ((de = readdir(dir)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") || de->d_name[0] == 'n') {
+            // Ignore these entries, as well as the ones we are creating
+            continue;
+        }
+        ASSERT_TRUE(large_dir_mark_seen(de->d_name, num_entries, seen.get()), "");
+        num_seen++;
+
+        for (size_t i = 0; i < num_created_per_entry; i++) {
+            char dirname[100];
+            snprintf(dirname, 100, "n%05lu", num_created++);
+            ASSERT_EQ(mkdirat(dirfd(dir), dirname, 0755), 0, "");
+        }
+    }
+    ASSERT_EQ(num_seen, num_entries, "Did not see all expected entries");
+
+    // Clean up
+    rewinddir(dir);
+    while ((de = readdir(dir)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        ASSERT_EQ(unlinkat(dirfd(dir), de->d_name, AT_REMOVEDIR), 0, "");
+    }
+    ASSERT_EQ(closedir(dir), 0, "");
+    ASSERT_EQ(rmdir("::dir"), 0, "Could not unlink containing directory");
+    END_TEST;
+}
+
 bool test_directory_rewind(void) {
     BEGIN_TEST;
 
@@ -460,6 +535,7 @@ RUN_FOR_ALL_FILESYSTEMS(directory_tests,
     RUN_TEST_MEDIUM(test_directory_trailing_slash)
     RUN_TEST_MEDIUM(test_directory_readdir)
     RUN_TEST_LARGE(test_directory_readdir_rm_all)
+    RUN_TEST_LARGE(test_directory_readdir_create_all)
     RUN_TEST_MEDIUM(test_directory_rewind)
     RUN_TEST_MEDIUM(test_directory_after_rmdir)
 )
@@ -0,0 +1,71 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fbl/alloc_checker.h>
+#include <fbl/unique_ptr.h>
+
+#include "filesystems.h"
+#include "misc.h"
+
+// Transfers this large go over the shared-memory transport (when the
+// filesystem offers one), and span several fifo requests.
+constexpr size_t kLargeSize = 1 << 20;
+
+bool test_io_fifo_large(void) {
+    BEGIN_TEST;
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[kLargeSize]);
+    ASSERT_TRUE(ac.check());
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[kLargeSize]);
+    ASSERT_TRUE(ac.check());
+    for (size_t i = 0; i < kLargeSize; i++) {
+        data[i] = static_cast<uint8_t>(rand());
+    }
+
+    int fd = open("::io-fifo", O_RDWR | O_CREAT, 0644);
+    ASSERT_GT(fd, 0);
+
+    ASSERT_EQ(write(fd, data.get(), kLargeSize), (ssize_t)kLargeSize);
+    ASSERT_EQ(lseek(fd, 0, SEEK_CUR), (off_t)kLargeSize);
+    ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+    ASSERT_EQ(read(fd, buf.get(), kLargeSize), (ssize_t)kLargeSize);
+    ASSERT_EQ(memcmp(buf.get(), data.get(), kLargeSize), 0);
+
+    // Positional transfers must leave the seek offset alone.
+    memset(buf.get(), 0, kLargeSize);
+    ASSERT_EQ(pread(fd, buf.get(), kLargeSize / 2, kLargeSize / 4), (ssize_t)(kLargeSize / 2));
+    ASSERT_EQ(memcmp(buf.get(), data.get() + kLargeSize / 4, kLargeSize / 2), 0);
+    ASSERT_EQ(pwrite(fd, data.get(), kLargeSize / 2, kLargeSize), (ssize_t)(kLargeSize / 2));
+    ASSERT_EQ(lseek(fd, 0, SEEK_CUR), (off_t)kLargeSize);
+
+    // A read that runs into the end of the file comes back short, with the
+    // bytes that were there.
+    const off_t start = kLargeSize + kLargeSize / 4 + 17;
+    memset(buf.get(), 0, kLargeSize);
+    ASSERT_EQ(pread(fd, buf.get(), kLargeSize, start), (ssize_t)(kLargeSize / 4 - 17));
+    ASSERT_EQ(memcmp(buf.get(), data.get() + kLargeSize / 4 + 17, kLargeSize / 4 - 17), 0);
+    ASSERT_EQ(pread(fd, buf.get(), kLargeSize, kLargeSize * 2), 0);
+
+    struct stat st;
+    ASSERT_EQ(fstat(fd, &st), 0);
+    ASSERT_EQ(st.st_size, (off_t)(kLargeSize + kLargeSize / 2));
+
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink("::io-fifo"), 0);
+
+    END_TEST;
+}
+
+RUN_FOR_ALL_FILESYSTEMS(io_fifo_tests,
+    RUN_TEST_MEDIUM(test_io_fifo_large)
+)
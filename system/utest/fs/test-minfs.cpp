@@ -7,12 +7,18 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <fbl/alloc_checker.h>
+#include <fbl/unique_ptr.h>
 #include <zircon/device/vfs.h>
 #include <unittest/unittest.h>
 
 #include "filesystems.h"
+#include "minfs-pattern.h"
+#include "misc.h"
 
 bool QueryInfo(size_t expected_nodes) {
     int fd = open(MOUNT_PATH, O_RDONLY | O_DIRECTORY);
@@ -58,9 +64,197 @@ bool TestQueryInfo(void) {
     END_TEST;
 }
 
+constexpr size_t kBlockSize = minfs::kMinfsBlockSize;
+
+bool TestExtentTree(void) {
+    BEGIN_TEST;
+
+    // Writing every other block makes each block its own extent; enough of
+    // them to spill out of the inode into several leaf blocks.
+    constexpr size_t kExtents = minfs::kMinfsExtentsPerBlock * 2 + 100;
+    constexpr size_t kBlocks = kExtents * 2;
+    const char* path = MOUNT_PATH "/extents";
+    uint8_t buf[kBlockSize];
+
+    int fd = open(path, O_CREAT | O_RDWR, 0644);
+    ASSERT_GT(fd, 0);
+    for (size_t n = 0; n < kBlocks; n += 2) {
+        fill_block(buf, n);
+        ASSERT_EQ(pwrite(fd, buf, sizeof(buf), n * sizeof(buf)), sizeof(buf));
+    }
+    ASSERT_TRUE(check_blocks(pread, fd, kBlocks - 1, 2));
+    struct stat s;
+    ASSERT_EQ(fstat(fd, &s), 0);
+    ASSERT_GT(s.st_blocks * 512, kExtents * sizeof(buf), "Extent blocks are not counted");
+    ASSERT_EQ(close(fd), 0);
+
+    // Remounting runs fsck over the tree, and reads it back from disk.
+    ASSERT_TRUE(check_remount());
+    fd = open(path, O_RDWR);
+    ASSERT_GT(fd, 0);
+    ASSERT_TRUE(check_blocks(pread, fd, kBlocks - 1, 2));
+
+    // Truncate into the middle of a leaf, and fill the holes left behind.
+    constexpr size_t kSmallBlocks = minfs::kMinfsExtentsPerBlock + 9;
+    ASSERT_EQ(ftruncate(fd, kSmallBlocks * sizeof(buf)), 0);
+    for (size_t n = 1; n < kSmallBlocks; n += 2) {
+        fill_block(buf, n);
+        ASSERT_EQ(pwrite(fd, buf, sizeof(buf), n * sizeof(buf)), sizeof(buf));
+    }
+    ASSERT_TRUE(check_blocks(pread, fd, kSmallBlocks, 1));
+    ASSERT_EQ(pread(fd, buf, sizeof(buf), kSmallBlocks * sizeof(buf)), 0);
+    ASSERT_EQ(close(fd), 0);
+
+    ASSERT_TRUE(check_remount());
+    fd = open(path, O_RDWR);
+    ASSERT_GT(fd, 0);
+    ASSERT_TRUE(check_blocks(pread, fd, kSmallBlocks, 1));
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(unlink(path), 0);
+    ASSERT_TRUE(check_remount());
+    END_TEST;
+}
+
+// A file spanning more than the largest read-ahead window, with a hole in
+// the middle. Data is only loaded from disk as it is accessed, so each test
+// remounts to start with none of the file loaded.
+constexpr size_t kLazyBlocks = 48;
+constexpr size_t kLazyHoleStart = 20;
+constexpr size_t kLazyHoleEnd = 24;
+constexpr size_t kLazySize = kLazyBlocks * kBlockSize;
+const char* kLazyPath = MOUNT_PATH "/lazy";
+
+// Creates the file at |kLazyPath|, and fills |expected| with its contents.
+bool LazyFileCreate(fbl::unique_ptr<uint8_t[]>* expected) {
+    BEGIN_HELPER;
+    fbl::AllocChecker ac;
+    expected->reset(new (&ac) uint8_t[kLazySize]);
+    ASSERT_TRUE(ac.check());
+    int fd = open(kLazyPath, O_CREAT | O_RDWR, 0644);
+    ASSERT_GT(fd, 0);
+    for (size_t n = 0; n < kLazyBlocks; n++) {
+        uint8_t* block = expected->get() + n * kBlockSize;
+        if (n >= kLazyHoleStart && n < kLazyHoleEnd) {
+            memset(block, 0, kBlockSize);
+            continue;
+        }
+        fill_block(block, n);
+        ASSERT_EQ(pwrite(fd, block, kBlockSize, n * kBlockSize), kBlockSize);
+    }
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_TRUE(check_remount());
+    END_HELPER;
+}
+
+// Checks that |len| bytes of |fd| at |off| match |expected|.
+bool LazyFileCheck(int fd, const uint8_t* expected, size_t off, size_t len) {
+    BEGIN_HELPER;
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[len]);
+    ASSERT_TRUE(ac.check());
+    ASSERT_EQ(pread(fd, buf.get(), len, off), static_cast<ssize_t>(len));
+    ASSERT_EQ(memcmp(buf.get(), expected + off, len), 0, "Unexpected file contents");
+    END_HELPER;
+}
+
+bool TestLazyLoadPartialRead(void) {
+    BEGIN_TEST;
+    fbl::unique_ptr<uint8_t[]> expected;
+    ASSERT_TRUE(LazyFileCreate(&expected));
+
+    int fd = open(kLazyPath, O_RDWR);
+    ASSERT_GT(fd, 0);
+    // Within one block, across block boundaries, and over the hole.
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), 30 * kBlockSize + 100, 1000));
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), 5 * kBlockSize - 1, 2 * kBlockSize + 2));
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), kLazyHoleStart * kBlockSize - 10, 20));
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), kLazySize - 1, 1));
+    uint8_t byte;
+    ASSERT_EQ(pread(fd, &byte, 1, kLazySize), 0);
+    ASSERT_EQ(close(fd), 0);
+
+    ASSERT_EQ(unlink(kLazyPath), 0);
+    END_TEST;
+}
+
+bool TestLazyLoadSpanningRead(void) {
+    BEGIN_TEST;
+    fbl::unique_ptr<uint8_t[]> expected;
+    ASSERT_TRUE(LazyFileCreate(&expected));
+
+    int fd = open(kLazyPath, O_RDWR);
+    ASSERT_GT(fd, 0);
+    // Load a few scattered ranges, then read the whole file at once, across
+    // loaded blocks, unloaded blocks and the hole.
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), 2 * kBlockSize + 10, 10));
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), 17 * kBlockSize, 2 * kBlockSize));
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), 40 * kBlockSize + 500, 500));
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), 0, kLazySize));
+    ASSERT_EQ(close(fd), 0);
+
+    // Read backwards through a freshly loaded file, so no read is sequential
+    // and each one lands on both sides of a block boundary.
+    ASSERT_TRUE(check_remount());
+    fd = open(kLazyPath, O_RDWR);
+    ASSERT_GT(fd, 0);
+    constexpr size_t kChunk = 5000;
+    for (size_t end = kLazySize; end > 0;) {
+        size_t len = end < kChunk ? end : kChunk;
+        ASSERT_TRUE(LazyFileCheck(fd, expected.get(), end - len, len));
+        end -= len;
+    }
+    ASSERT_EQ(close(fd), 0);
+
+    ASSERT_EQ(unlink(kLazyPath), 0);
+    END_TEST;
+}
+
+bool TestLazyLoadWrite(void) {
+    BEGIN_TEST;
+    fbl::unique_ptr<uint8_t[]> expected;
+    ASSERT_TRUE(LazyFileCreate(&expected));
+
+    int fd = open(kLazyPath, O_RDWR);
+    ASSERT_GT(fd, 0);
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), 2 * kBlockSize, 100));
+
+    // Partial writes must keep the rest of each block, whether or not it was
+    // loaded, while whole-block writes replace it.
+    struct {
+        size_t off;
+        size_t len;
+    } writes[] = {
+        {3 * kBlockSize - 50, 100},                 // Loaded block, then unloaded
+        {40 * kBlockSize + 1000, 50},               // Unloaded block
+        {41 * kBlockSize, kBlockSize},              // Whole unloaded block
+        {(kLazyHoleStart + 1) * kBlockSize + 7, 9}, // Hole
+    };
+    uint8_t data[kBlockSize];
+    for (const auto& w : writes) {
+        memset(data, 0xa5, w.len);
+        ASSERT_EQ(pwrite(fd, data, w.len, w.off), static_cast<ssize_t>(w.len));
+        memcpy(expected.get() + w.off, data, w.len);
+    }
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), 0, kLazySize));
+    ASSERT_EQ(close(fd), 0);
+
+    ASSERT_TRUE(check_remount());
+    fd = open(kLazyPath, O_RDWR);
+    ASSERT_GT(fd, 0);
+    ASSERT_TRUE(LazyFileCheck(fd, expected.get(), 0, kLazySize));
+    ASSERT_EQ(close(fd), 0);
+
+    ASSERT_EQ(unlink(kLazyPath), 0);
+    END_TEST;
+}
+
 #define RUN_MINFS_TESTS(name, CASE_TESTS) \
     FS_TEST_CASE(name, DEFAULT_DISK_SIZE, CASE_TESTS, FS_TEST_FVM, minfs, 1)
 
 RUN_MINFS_TESTS(FsMinfsTestsFvm,
     RUN_TEST_MEDIUM(TestQueryInfo)
+    RUN_TEST_MEDIUM(TestExtentTree)
+    RUN_TEST_MEDIUM(TestLazyLoadPartialRead)
+    RUN_TEST_MEDIUM(TestLazyLoadSpanningRead)
+    RUN_TEST_MEDIUM(TestLazyLoadWrite)
 )
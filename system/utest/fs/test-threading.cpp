@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <threads.h>
 #include <unistd.h>
@@ -243,6 +244,107 @@ bool test_link_exclusive(void) {
     END_TEST;
 }
 
+constexpr size_t kMixedFileCount = 16;
+constexpr size_t kMixedOpCount = 500;
+constexpr size_t kMixedDataSize = 4096;
+
+// Every file in the directory holds either nothing or this one buffer, whatever
+// it has been renamed to, so readers can check what they see.
+static uint8_t mixed_data[kMixedDataSize];
+
+static void mixed_path(char* path, size_t len, unsigned int* seed) {
+    snprintf(path, len, "::mixed/%u", rand_r(seed) % static_cast<unsigned int>(kMixedFileCount));
+}
+
+static int mixed_op(unsigned int* seed) {
+    char path[64];
+    mixed_path(path, sizeof(path), seed);
+
+    switch (rand_r(seed) % 4) {
+    case 0: { // read
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return errno == ENOENT ? kSuccess : kUnexpectedFailure;
+        }
+        uint8_t buf[kMixedDataSize];
+        ssize_t r = read(fd, buf, sizeof(buf));
+        bool ok = (r == 0) || (r == static_cast<ssize_t>(sizeof(buf)) &&
+                               memcmp(buf, mixed_data, sizeof(buf)) == 0);
+        return (close(fd) == 0 && ok) ? kSuccess : kUnexpectedFailure;
+    }
+    case 1: { // write
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            return kUnexpectedFailure;
+        }
+        bool ok = write(fd, mixed_data, sizeof(mixed_data)) ==
+                  static_cast<ssize_t>(sizeof(mixed_data));
+        return (close(fd) == 0 && ok) ? kSuccess : kUnexpectedFailure;
+    }
+    case 2: { // rename, possibly over another file
+        char dst[64];
+        mixed_path(dst, sizeof(dst), seed);
+        if (rename(path, dst) == 0 || errno == ENOENT) {
+            return kSuccess;
+        }
+        return kUnexpectedFailure;
+    }
+    default: // unlink
+        if (unlink(path) == 0 || errno == ENOENT) {
+            return kSuccess;
+        }
+        return kUnexpectedFailure;
+    }
+}
+
+// Read, write, rename and unlink files in one directory from several threads at
+// once. Filesystems serve requests from more than one dispatch thread, so these
+// race inside the filesystem, not just in the client.
+bool test_mixed_ops_one_directory(void) {
+    BEGIN_TEST;
+
+    for (size_t i = 0; i < sizeof(mixed_data); i++) {
+        mixed_data[i] = static_cast<uint8_t>(i * 7 + 1);
+    }
+
+    ASSERT_EQ(mkdir("::mixed", 0755), 0);
+
+    fbl::atomic<uint32_t> ctr{0};
+    ASSERT_TRUE((thread_action_test<8, 8>([](void* arg) {
+        auto ctr = reinterpret_cast<fbl::atomic<uint32_t>*>(arg);
+        unsigned int seed = ctr->fetch_add(1);
+        for (size_t i = 0; i < kMixedOpCount; i++) {
+            int rc = mixed_op(&seed);
+            if (rc != kSuccess) {
+                return rc;
+            }
+        }
+        return kSuccess;
+    }, &ctr)));
+
+    // Whatever survived has to be intact and removable, leaving the directory
+    // empty.
+    DIR* dir = opendir("::mixed");
+    ASSERT_NONNULL(dir);
+    struct dirent* de;
+    while ((de = readdir(dir)) != nullptr) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        int fd = openat(dirfd(dir), de->d_name, O_RDONLY);
+        ASSERT_GT(fd, 0);
+        struct stat st;
+        ASSERT_EQ(fstat(fd, &st), 0);
+        ASSERT_TRUE(st.st_size == 0 || st.st_size == static_cast<off_t>(kMixedDataSize));
+        ASSERT_EQ(close(fd), 0);
+        ASSERT_EQ(unlinkat(dirfd(dir), de->d_name, 0), 0);
+    }
+    ASSERT_EQ(closedir(dir), 0);
+    ASSERT_EQ(rmdir("::mixed"), 0);
+    ASSERT_TRUE(check_remount());
+    END_TEST;
+}
+
 RUN_FOR_ALL_FILESYSTEMS(threading_tests,
     RUN_TEST_LARGE((test_inode_reuse<false>))
     RUN_TEST_LARGE((test_inode_reuse<true>))
@@ -251,4 +353,5 @@ RUN_FOR_ALL_FILESYSTEMS(threading_tests,
     RUN_TEST_LARGE(test_rename_exclusive)
     RUN_TEST_LARGE(test_rename_overwrite)
     RUN_TEST_LARGE(test_link_exclusive)
+    RUN_TEST_LARGE(test_mixed_ops_one_directory)
 )